@@ -0,0 +1,194 @@
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+typedef struct bench_metric
+{
+    char name[64];
+    bench_fn fn;
+    void *arg;
+    unsigned iterations;
+    unsigned nsamples;
+    double samples[BENCH_MAX_SAMPLES];  //!< ns per call
+} bench_metric_t;
+
+static bench_metric_t metrics[BENCH_MAX_METRICS];
+static unsigned nmetrics;
+/* fixed work measured every round, to normalise machine speed */
+static bench_metric_t reference;
+static volatile uint64_t reference_sink;
+
+/* --- PRIVATE -------------------------------------------------------------- */
+static int _cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double _sample(unsigned iterations, bench_fn fn, void *arg)
+{
+    uint64_t start = bench_now_ns();
+    for (unsigned i = 0; i < iterations; ++i) {
+        fn(arg);
+    }
+    return (double)(bench_now_ns() - start) / iterations;
+}
+
+static void _reference(void *arg)
+{
+    uint64_t x = reference_sink | 1;
+    (void) arg;
+    for (int i = 0; i < 64; ++i) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+    }
+    reference_sink = x;
+}
+
+/* double the iterations until a sample takes BENCH_SAMPLE_NS */
+static unsigned _calibrate(bench_fn fn, void *arg)
+{
+    unsigned iterations = 1;
+    while (iterations < (1u << 30)) {
+        uint64_t start = bench_now_ns();
+        for (unsigned i = 0; i < iterations; ++i) {
+            fn(arg);
+        }
+        uint64_t elapsed = bench_now_ns() - start;
+        if (elapsed >= BENCH_SAMPLE_NS / 4) {
+            return (unsigned)((double)iterations * BENCH_SAMPLE_NS / elapsed) + 1;
+        }
+        iterations *= 2;
+    }
+    return iterations;
+}
+
+/* --- PUBLIC --------------------------------------------------------------- */
+int bench_init(bench_config_t *cfg, int argc, char *argv[])
+{
+    int opt;
+    cfg->iterations = 0;
+    cfg->samples = 15;
+    cfg->warmup = 3;
+    cfg->cpu = -1;
+    cfg->json = false;
+    while ((opt = getopt(argc, argv, "n:r:w:c:j")) != -1) {
+        switch (opt) {
+        case 'n':
+            cfg->iterations = strtoul(optarg, NULL, 0);
+            break;
+        case 'r':
+            cfg->samples = strtoul(optarg, NULL, 0);
+            break;
+        case 'w':
+            cfg->warmup = strtoul(optarg, NULL, 0);
+            break;
+        case 'c':
+            cfg->cpu = atoi(optarg);
+            break;
+        case 'j':
+            cfg->json = true;
+            break;
+        default:
+            fprintf(stderr, "USAGE: %s [-n iterations] [-r samples] "
+                    "[-w warmup] [-c cpu] [-j] ...\n", argv[0]);
+            return -1;
+        }
+    }
+    if (!cfg->samples || (cfg->samples > BENCH_MAX_SAMPLES)) {
+        fprintf(stderr, "%s: need 1..%d samples\n",
+                argv[0], BENCH_MAX_SAMPLES);
+        return -1;
+    }
+    if (cfg->cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cfg->cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set)) {
+            perror("sched_setaffinity");
+            return -1;
+        }
+    }
+    return optind;
+}
+
+uint64_t bench_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void bench_add(const char *name, bench_fn fn, void *arg)
+{
+    if (nmetrics == BENCH_MAX_METRICS) {
+        fprintf(stderr, "too many metrics, %s dropped\n", name);
+        return;
+    }
+    bench_metric_t *m = &metrics[nmetrics++];
+    snprintf(m->name, sizeof(m->name), "%s", name);
+    m->fn = fn;
+    m->arg = arg;
+}
+
+static void _print(const bench_config_t *cfg)
+{
+    if (cfg->json) {
+        printf("{\n  \"unit\": \"ns/op\",\n  \"reference\": [");
+        for (unsigned i = 0; i < reference.nsamples; ++i) {
+            printf("%s%.3f", i ? ", " : "", reference.samples[i]);
+        }
+        printf("],\n  \"metrics\": {");
+        for (unsigned i = 0; i < nmetrics; ++i) {
+            printf("%s\n    \"%s\": [", i ? "," : "", metrics[i].name);
+            for (unsigned j = 0; j < metrics[i].nsamples; ++j) {
+                printf("%s%.3f", j ? ", " : "", metrics[i].samples[j]);
+            }
+            printf("]");
+        }
+        printf("\n  }\n}\n");
+        return;
+    }
+    printf("%-40s %10s %10s %10s\n", "metric (ns/op)", "min", "median", "max");
+    for (unsigned i = 0; i < nmetrics; ++i) {
+        bench_metric_t *m = &metrics[i];
+        double s[BENCH_MAX_SAMPLES];
+        memcpy(s, m->samples, m->nsamples * sizeof(double));
+        qsort(s, m->nsamples, sizeof(double), _cmp_double);
+        printf("%-40s %10.1f %10.1f %10.1f\n", m->name,
+               s[0], s[m->nsamples / 2], s[m->nsamples - 1]);
+    }
+}
+
+void bench_run(const bench_config_t *cfg)
+{
+    reference.fn = _reference;
+    reference.iterations = _calibrate(_reference, NULL);
+    for (unsigned i = 0; i < nmetrics; ++i) {
+        bench_metric_t *m = &metrics[i];
+        m->iterations = cfg->iterations ? cfg->iterations : _calibrate(m->fn, m->arg);
+        m->nsamples = 0;
+    }
+    for (unsigned r = 0; r < cfg->warmup + cfg->samples; ++r) {
+        bool keep = (r >= cfg->warmup);
+        double ns = _sample(reference.iterations, _reference, NULL);
+        if (keep) {
+            reference.samples[reference.nsamples++] = ns;
+        }
+        for (unsigned i = 0; i < nmetrics; ++i) {
+            bench_metric_t *m = &metrics[i];
+            ns = _sample(m->iterations, m->fn, m->arg);
+            if (keep) {
+                m->samples[m->nsamples++] = ns;
+            }
+        }
+    }
+    _print(cfg);
+}
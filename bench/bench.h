@@ -0,0 +1,64 @@
+#ifndef BENCH_H
+#define BENCH_H 1
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define BENCH_MAX_METRICS   256     //!< metrics per benchmark program
+#define BENCH_MAX_SAMPLES   64      //!< samples per metric
+#define BENCH_SAMPLE_NS     2000000 //!< calibrated duration of a sample
+
+/**
+ * Benchmark options shared by all benchmark programs
+ */
+typedef struct bench_config
+{
+    unsigned iterations;    //!< calls per sample (-n), 0 calibrates per metric
+    unsigned samples;       //!< samples per metric (-r)
+    unsigned warmup;        //!< discarded samples before measuring (-w)
+    int cpu;                //!< pin to this CPU if >= 0 (-c)
+    bool json;              //!< print results as JSON (-j)
+} bench_config_t;
+
+/**
+ * @brief Callback measured by bench_measure
+ *
+ * @param[in] arg User pointer passed to bench_measure
+ */
+typedef void (*bench_fn)(void *arg);
+
+/**
+ * @brief Parse common options
+ *
+ * @param[out] cfg Configuration, set to defaults first
+ * @param[in] argc Argument count of main
+ * @param[in] argv Arguments of main
+ *
+ * @return Index of the first non option argument, or -1 on usage errors
+ */
+int bench_init(bench_config_t *cfg, int argc, char *argv[]);
+
+/**
+ * @brief Monotonic clock in nanoseconds
+ */
+uint64_t bench_now_ns(void);
+
+/**
+ * @brief Register metric \p name, measured as ns per call of \p fn
+ */
+void bench_add(const char *name, bench_fn fn, void *arg);
+
+/**
+ * @brief Measure all registered metrics and print them
+ *
+ * Runs cfg->warmup discarded rounds, then cfg->samples rounds. Each round
+ * takes one sample of cfg->iterations calls per metric, so that a transient
+ * slowdown of the host spreads over all metrics instead of skewing one.
+ * With 0 iterations the count is calibrated per metric so that a sample
+ * takes about BENCH_SAMPLE_NS. A fixed reference loop is sampled every round
+ * and reported with the JSON output, see tools/perf_check.py.
+ */
+void bench_run(const bench_config_t *cfg);
+
+#endif
@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "coap.h"
+#include "coap_acl.h"
+#include "bench.h"
+
+/*
+ * The ACL per request: dispatching through coap_handle_request, and through
+ * coap_handle_request_acl for a principal allowed and one denied, which adds
+ * a shift and a mask; and mapping identities to principals, a source address
+ * among BENCH_PREFIXES prefixes as over plain UDP for every request and a PSK
+ * identity as coap_dtls does once per session. main() prints the requests
+ * per second of each.
+ */
+
+#define BENCH_PREFIXES      32      //!< prefixes in the policy
+#define BENCH_THROUGHPUT    1000000 //!< requests timed for the rate
+
+typedef struct bench_req
+{
+    const coap_acl_table_t *table;
+    uint8_t principal;
+    coap_packet_t pkt;
+} bench_req_t;
+
+static int _handler(const coap_resource_t *resource, const coap_packet_t *inpkt,
+                    coap_packet_t *pkt)
+{
+    return coap_make_response(inpkt->hdr.id, &inpkt->tok, COAP_TYPE_ACK,
+                              COAP_RSPCODE_CONTENT, resource->content_type,
+                              (const uint8_t *)"21.5", 4, pkt);
+}
+
+static const coap_resource_path_t path_core = {2, {".well-known", "core"}};
+static const coap_resource_path_t path_light = {1, {"light"}};
+static const coap_resource_path_t path_temp = {2, {"sensors", "temp"}};
+static const coap_resource_path_t path_rd = {1, {"rd"}};
+
+static coap_resource_t resources[] =
+{
+    {COAP_RDY, COAP_METHOD_GET, COAP_TYPE_ACK, _handler, &path_core,
+        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_APP_LINKFORMAT), NULL},
+    {COAP_RDY, COAP_METHOD_GET, COAP_TYPE_ACK, _handler, &path_light,
+        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_TXT_PLAIN), NULL},
+    {COAP_RDY, COAP_METHOD_PUT, COAP_TYPE_ACK, _handler, &path_light,
+        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_TXT_PLAIN), NULL},
+    {COAP_RDY, COAP_METHOD_POST, COAP_TYPE_ACK, _handler, &path_rd,
+        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_NONE), NULL},
+    {COAP_RDY, COAP_METHOD_GET, COAP_TYPE_ACK, _handler, &path_temp,
+        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_TXT_PLAIN), NULL},
+    {(coap_state_t)0, (coap_method_t)0, (coap_msgtype_t)0, NULL, NULL,
+        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_NONE), NULL}
+};
+
+static const uint8_t tok[4] = { 0xca, 0xfe, 0xba, 0xbe };
+static coap_acl_table_t *table;
+static bench_req_t plain, allowed, denied;
+static struct sockaddr_in6 addr;
+static volatile size_t sink;
+
+/* --- PRIVATE -------------------------------------------------------------- */
+static void _request(bench_req_t *req, const coap_acl_table_t *t, const uint8_t principal)
+{
+    req->table = t;
+    req->principal = principal;
+    memset(&req->pkt, 0, sizeof(req->pkt));
+    req->pkt.hdr.ver = 1;
+    req->pkt.hdr.t = COAP_TYPE_CON;
+    req->pkt.hdr.tkl = sizeof(tok);
+    req->pkt.hdr.code = COAP_METHOD_GET;
+    req->pkt.hdr.id = 0x1234;
+    req->pkt.tok = (coap_buffer_t){ tok, sizeof(tok) };
+    coap_add_option(&req->pkt, COAP_OPTION_URI_PATH, (const uint8_t *)"sensors", 7);
+    coap_add_option(&req->pkt, COAP_OPTION_URI_PATH, (const uint8_t *)"temp", 4);
+}
+
+static void _dispatch(void *arg)
+{
+    bench_req_t *req = arg;
+    coap_packet_t rsp;
+
+    sink += coap_handle_request(resources, &req->pkt, &rsp) + rsp.hdr.code;
+}
+
+static void _dispatch_acl(void *arg)
+{
+    bench_req_t *req = arg;
+    coap_packet_t rsp;
+
+    sink += coap_handle_request_acl(resources, coap_acl_mask(req->table), req->principal,
+                                    &req->pkt, &rsp) + rsp.hdr.code;
+}
+
+static void _lookup_addr(void *arg)
+{
+    (void)arg;
+    sink += coap_acl_addr(table, (const struct sockaddr *)&addr, sizeof(addr));
+}
+
+static void _lookup_psk(void *arg)
+{
+    (void)arg;
+    sink += coap_acl_psk(table, "sensor-31");
+}
+
+static double _rate(bench_fn fn, void *arg)
+{
+    const uint64_t start = bench_now_ns();
+    for (int i = 0; i < BENCH_THROUGHPUT; ++i) {
+        fn(arg);
+    }
+    return (double)BENCH_THROUGHPUT * 1e9 / (double)(bench_now_ns() - start);
+}
+
+/* --- MAIN ----------------------------------------------------------------- */
+int main(int argc, char *argv[])
+{
+    bench_config_t cfg;
+    char policy[4096];
+    size_t n = 0;
+
+    if (bench_init(&cfg, argc, argv) < 0) {
+        return 1;
+    }
+    // a /48 per site, the address in the last and a /32 around all
+    for (int i = 0; i < BENCH_PREFIXES; ++i) {
+        n += (size_t)snprintf(policy + n, sizeof(policy) - n,
+                              "principal site%d prefix 2001:db8:%x::/48\n"
+                              "principal site%d psk sensor-%d\n", i, i, i, i);
+    }
+    n += (size_t)snprintf(policy + n, sizeof(policy) - n,
+                          "principal all prefix 2001:db8::/32\n"
+                          "allow * GET /.well-known/core\n"
+                          "allow site31 GET,PUT /light\n"
+                          "allow site31 GET /sensors/*\n");
+    if (coap_acl_compile(policy, n, resources, &table, NULL) != COAP_SUCCESS) {
+        fprintf(stderr, "policy failed\n");
+        return 1;
+    }
+    addr.sin6_family = AF_INET6;
+    inet_pton(AF_INET6, "2001:db8:1f::1", &addr.sin6_addr);
+    const uint8_t site = coap_acl_addr(table, (const struct sockaddr *)&addr, sizeof(addr));
+    if ((site != coap_acl_psk(table, "sensor-31")) || !coap_acl_allowed(table, 4, site)) {
+        fprintf(stderr, "lookup failed\n");
+        return 1;
+    }
+    _request(&plain, NULL, 0);
+    _request(&allowed, table, site);
+    _request(&denied, table, site - 1);
+
+    fprintf(stderr, "dispatch:         %6.2f M/s\n", _rate(_dispatch, &plain) / 1e6);
+    fprintf(stderr, "dispatch allowed: %6.2f M/s\n", _rate(_dispatch_acl, &allowed) / 1e6);
+    fprintf(stderr, "dispatch denied:  %6.2f M/s\n", _rate(_dispatch_acl, &denied) / 1e6);
+    fprintf(stderr, "lookup address:   %6.2f M/s\n", _rate(_lookup_addr, NULL) / 1e6);
+    fprintf(stderr, "lookup psk:       %6.2f M/s\n", _rate(_lookup_psk, NULL) / 1e6);
+
+    bench_add("dispatch/plain", _dispatch, &plain);
+    bench_add("dispatch/allowed", _dispatch_acl, &allowed);
+    bench_add("dispatch/denied", _dispatch_acl, &denied);
+    bench_add("lookup/addr", _lookup_addr, NULL);
+    bench_add("lookup/psk", _lookup_psk, NULL);
+    bench_run(&cfg);
+    coap_acl_free(table);
+    return 0;
+}
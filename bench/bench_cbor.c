@@ -0,0 +1,276 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "coap.h"
+#include "coap_cbor.h"
+#include "bench.h"
+#include "cbor_ref.h"
+
+/*
+ * coap_cbor against the tree based reference in cbor_ref.c, on a small map
+ * as a light resource would return it and on an array of sensor records.
+ * Both sides produce and consume the same documents, main() cross checks
+ * them before measuring.
+ */
+
+#define BENCH_RECORDS   16      //!< records of the sensor document
+#define BENCH_BUFLEN    2048    //!< encoding buffer, about a CoAP datagram
+
+typedef struct bench_doc
+{
+    uint8_t buf[BENCH_BUFLEN];
+    size_t len;
+} bench_doc_t;
+
+static bench_doc_t small, records;
+static char names[BENCH_RECORDS][40];
+static volatile double sink;
+
+/* --- PRIVATE -------------------------------------------------------------- */
+static size_t _encode_small(uint8_t *buf, size_t len)
+{
+    coap_cbor_writer_t w;
+    coap_cbor_writer_init(&w, buf, len);
+    coap_cbor_put_map(&w, 3);
+    coap_cbor_put_text(&w, "light", 5);
+    coap_cbor_put_bool(&w, true);
+    coap_cbor_put_text(&w, "level", 5);
+    coap_cbor_put_uint(&w, 42);
+    coap_cbor_put_text(&w, "temp", 4);
+    coap_cbor_put_double(&w, 21.5);
+    return (w.err == COAP_SUCCESS) ? w.pos : 0;
+}
+
+static size_t _encode_records(uint8_t *buf, size_t len)
+{
+    coap_cbor_writer_t w;
+    coap_cbor_writer_init(&w, buf, len);
+    coap_cbor_put_array(&w, BENCH_RECORDS);
+    for (int i = 0; i < BENCH_RECORDS; ++i) {
+        coap_cbor_put_map(&w, 4);
+        coap_cbor_put_text(&w, "n", 1);
+        coap_cbor_put_text(&w, names[i], strlen(names[i]));
+        coap_cbor_put_text(&w, "u", 1);
+        coap_cbor_put_text(&w, "Cel", 3);
+        coap_cbor_put_text(&w, "v", 1);
+        coap_cbor_put_double(&w, 20.1 + i * 0.37);
+        coap_cbor_put_text(&w, "t", 1);
+        coap_cbor_put_uint(&w, 1700000000u + i);
+    }
+    return (w.err == COAP_SUCCESS) ? w.pos : 0;
+}
+
+static ref_node_t *_tree_small(void)
+{
+    ref_node_t *map = ref_new(REF_MAP);
+    ref_node_t *light = ref_new(REF_BOOL);
+    light->u = 1;
+    ref_append(map, ref_new_text("light"));
+    ref_append(map, light);
+    ref_append(map, ref_new_text("level"));
+    ref_append(map, ref_new_uint(42));
+    ref_append(map, ref_new_text("temp"));
+    ref_append(map, ref_new_float(21.5));
+    return map;
+}
+
+static ref_node_t *_tree_records(void)
+{
+    ref_node_t *array = ref_new(REF_ARRAY);
+    for (int i = 0; i < BENCH_RECORDS; ++i) {
+        ref_node_t *map = ref_new(REF_MAP);
+        ref_append(map, ref_new_text("n"));
+        ref_append(map, ref_new_text(names[i]));
+        ref_append(map, ref_new_text("u"));
+        ref_append(map, ref_new_text("Cel"));
+        ref_append(map, ref_new_text("v"));
+        ref_append(map, ref_new_float(20.1 + i * 0.37));
+        ref_append(map, ref_new_text("t"));
+        ref_append(map, ref_new_uint(1700000000u + i));
+        ref_append(array, map);
+    }
+    return array;
+}
+
+/* sum of "v" and "t" and the name lengths, touches every record */
+static double _walk_records(const uint8_t *buf, size_t len)
+{
+    coap_cbor_reader_t r;
+    coap_cbor_item_t item, key, value;
+    double sum = 0;
+
+    coap_cbor_reader_init(&r, buf, len);
+    if (coap_cbor_expect(&r, COAP_CBOR_ARRAY, &item) != COAP_SUCCESS) {
+        return -1;
+    }
+    for (uint64_t i = 0; i < item.v.count; ++i) {
+        coap_cbor_item_t map;
+        if (coap_cbor_expect(&r, COAP_CBOR_MAP, &map) != COAP_SUCCESS) {
+            return -1;
+        }
+        for (uint64_t j = 0; j < map.v.count; ++j) {
+            if ((coap_cbor_expect(&r, COAP_CBOR_TEXT, &key) != COAP_SUCCESS) ||
+                (coap_cbor_next(&r, &value) != COAP_SUCCESS)) {
+                return -1;
+            }
+            if ((key.v.str.len == 1) && (key.v.str.p[0] == 'v')) {
+                sum += value.v.f;
+            }
+            else if ((key.v.str.len == 1) && (key.v.str.p[0] == 't')) {
+                sum += value.v.u;
+            }
+            else if ((key.v.str.len == 1) && (key.v.str.p[0] == 'n')) {
+                sum += value.v.str.len;
+            }
+        }
+    }
+    return sum;
+}
+
+static double _walk_records_ref(const ref_node_t *array)
+{
+    double sum = 0;
+    for (size_t i = 0; i < array->len; ++i) {
+        const ref_node_t *rec = array->items[i];
+        sum += ref_map_get(rec, "v")->f;
+        sum += ref_map_get(rec, "t")->u;
+        sum += ref_map_get(rec, "n")->len;
+    }
+    return sum;
+}
+
+static void _encode_small_yacoap(void *arg)
+{
+    uint8_t buf[BENCH_BUFLEN];
+    (void) arg;
+    sink += _encode_small(buf, sizeof(buf));
+}
+
+static void _encode_small_ref(void *arg)
+{
+    size_t len;
+    (void) arg;
+    ref_node_t *tree = _tree_small();
+    uint8_t *buf = ref_encode(tree, &len);
+    sink += len;
+    free(buf);
+    ref_free(tree);
+}
+
+static void _encode_records_yacoap(void *arg)
+{
+    uint8_t buf[BENCH_BUFLEN];
+    (void) arg;
+    sink += _encode_records(buf, sizeof(buf));
+}
+
+static void _encode_records_ref(void *arg)
+{
+    size_t len;
+    (void) arg;
+    ref_node_t *tree = _tree_records();
+    uint8_t *buf = ref_encode(tree, &len);
+    sink += len;
+    free(buf);
+    ref_free(tree);
+}
+
+static void _decode_records_yacoap(void *arg)
+{
+    (void) arg;
+    sink += _walk_records(records.buf, records.len);
+}
+
+static void _decode_records_ref(void *arg)
+{
+    (void) arg;
+    ref_node_t *tree = ref_decode(records.buf, records.len);
+    sink += _walk_records_ref(tree);
+    ref_free(tree);
+}
+
+static void _lookup_small_yacoap(void *arg)
+{
+    coap_cbor_reader_t r;
+    coap_cbor_item_t item;
+    (void) arg;
+    coap_cbor_reader_init(&r, small.buf, small.len);
+    if ((coap_cbor_expect(&r, COAP_CBOR_MAP, &item) == COAP_SUCCESS) &&
+        (coap_cbor_map_find(&r, item.v.count, "temp") == COAP_SUCCESS) &&
+        (coap_cbor_expect(&r, COAP_CBOR_FLOAT, &item) == COAP_SUCCESS)) {
+        sink += item.v.f;
+    }
+}
+
+static void _lookup_small_ref(void *arg)
+{
+    (void) arg;
+    ref_node_t *tree = ref_decode(small.buf, small.len);
+    sink += ref_map_get(tree, "temp")->f;
+    ref_free(tree);
+}
+
+/* both implementations have to agree on the documents */
+static int _check(void)
+{
+    size_t len;
+    ref_node_t *tree = _tree_records();
+    uint8_t *buf = ref_encode(tree, &len);
+    double expect = _walk_records_ref(tree);
+    ref_free(tree);
+    // doubles are always 9 bytes in the reference, values must still match
+    double got = _walk_records(buf, len);
+    free(buf);
+    if (got != expect) {
+        fprintf(stderr, "decode mismatch: %f != %f\n", got, expect);
+        return -1;
+    }
+    tree = ref_decode(small.buf, small.len);
+    if (!tree || (ref_map_get(tree, "temp")->f != 21.5)) {
+        fprintf(stderr, "reference rejects coap_cbor encoding\n");
+        ref_free(tree);
+        return -1;
+    }
+    ref_free(tree);
+    tree = ref_decode(records.buf, records.len);
+    if (!tree) {
+        fprintf(stderr, "reference rejects coap_cbor encoding\n");
+        return -1;
+    }
+    got = _walk_records_ref(tree);
+    ref_free(tree);
+    if (got != expect) {
+        fprintf(stderr, "encode mismatch: %f != %f\n", got, expect);
+        return -1;
+    }
+    return 0;
+}
+
+/* --- MAIN ----------------------------------------------------------------- */
+int main(int argc, char *argv[])
+{
+    bench_config_t cfg;
+    if (bench_init(&cfg, argc, argv) < 0) {
+        return 1;
+    }
+    for (int i = 0; i < BENCH_RECORDS; ++i) {
+        snprintf(names[i], sizeof(names[i]), "urn:dev:ow:10e2073a0108006:%d", i);
+    }
+    small.len = _encode_small(small.buf, sizeof(small.buf));
+    records.len = _encode_records(records.buf, sizeof(records.buf));
+    if (!small.len || !records.len || _check()) {
+        return 1;
+    }
+
+    bench_add("encode/small/yacoap", _encode_small_yacoap, NULL);
+    bench_add("encode/small/ref", _encode_small_ref, NULL);
+    bench_add("encode/records/yacoap", _encode_records_yacoap, NULL);
+    bench_add("encode/records/ref", _encode_records_ref, NULL);
+    bench_add("decode/records/yacoap", _decode_records_yacoap, NULL);
+    bench_add("decode/records/ref", _decode_records_ref, NULL);
+    bench_add("lookup/small/yacoap", _lookup_small_yacoap, NULL);
+    bench_add("lookup/small/ref", _lookup_small_ref, NULL);
+    bench_run(&cfg);
+    return 0;
+}
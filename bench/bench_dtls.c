@@ -0,0 +1,385 @@
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+#include "coap.h"
+#include "coap_dtls.h"
+#include "bench.h"
+
+/*
+ * The DTLS transport over loopback, client and server in this process:
+ * PSK handshakes, full and resumed, on the calling thread and a batch of
+ * concurrent ones on worker threads, and a request from the client record
+ * to the response record. request/udp times the same request in plain UDP
+ * for comparison. cookie/ times the stateless check of a ClientHello without,
+ * with a valid and with a stale cookie, flood/ the same from the socket to the
+ * HelloVerifyRequest sent, what a ClientHello flood costs the server. Socket bound, so not part of the perf-check set; the
+ * inverse of the times are the handshakes and records per second.
+ */
+
+#define BENCH_BATCH     32      //!< concurrent handshakes
+#define BENCH_WORKERS   4
+
+typedef struct bench_client
+{
+    int fd;
+    SSL *ssl;
+} bench_client_t;
+
+typedef struct bench_server
+{
+    coap_dtls_t dtls;
+    uint16_t port;
+} bench_server_t;
+
+static bench_server_t inline_server, worker_server;
+static SSL_CTX *ctx;
+static SSL_SESSION *session;
+static bench_client_t client, batch[BENCH_BATCH];
+static int udp_server, udp_client;
+static uint8_t request[64];
+static size_t request_len;
+static volatile size_t sink;
+
+typedef struct bench_hello
+{
+    uint8_t buf[COAP_DTLS_DGRAM_SIZE];
+    size_t len;
+} bench_hello_t;
+
+static bench_hello_t hello, valid, stale;
+static struct sockaddr_in hello_addr = { .sin_family = AF_INET, .sin_port = 0x3316 };
+static int flood_fd;
+
+/* --- RESOURCES ------------------------------------------------------------ */
+static const coap_resource_path_t path_light = {1, {"light"}};
+
+static int handle_get_light(const coap_resource_t *resource,
+                            const coap_packet_t *inpkt,
+                            coap_packet_t *pkt)
+{
+    return coap_make_response(inpkt->hdr.id, &inpkt->tok,
+                              COAP_TYPE_ACK, COAP_RSPCODE_CONTENT,
+                              resource->content_type,
+                              (const uint8_t *)"1", 1, pkt);
+}
+
+static coap_resource_t resources[] =
+{
+    {COAP_RDY, COAP_METHOD_GET, COAP_TYPE_ACK,
+        handle_get_light, &path_light,
+        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_TXT_PLAIN), NULL},
+    {(coap_state_t)0, (coap_method_t)0, (coap_msgtype_t)0,
+        NULL, NULL,
+        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_NONE), NULL}
+};
+
+static const char secret[] = "secretPSK";
+
+static size_t server_psk(void *ctx, const char *identity, uint8_t *key, const size_t size)
+{
+    (void) ctx;
+    (void) identity;
+    memcpy(key, secret, (size < sizeof(secret) - 1) ? size : sizeof(secret) - 1);
+    return sizeof(secret) - 1;
+}
+
+static unsigned int client_psk(SSL *ssl, const char *hint, char *identity,
+                               unsigned int max_identity_len, unsigned char *psk,
+                               unsigned int max_psk_len)
+{
+    (void) ssl;
+    (void) hint;
+    (void) max_identity_len;
+    (void) max_psk_len;
+    strcpy(identity, "bench");
+    memcpy(psk, secret, sizeof(secret) - 1);
+    return sizeof(secret) - 1;
+}
+
+/* --- PRIVATE -------------------------------------------------------------- */
+static uint32_t _now_ms(void)
+{
+    return (uint32_t)(bench_now_ns() / 1000000);
+}
+
+static void _pump(bench_server_t *s, const int timeout)
+{
+    struct pollfd fds[2];
+    const size_t n = coap_dtls_pollfds(&s->dtls, fds, 2);
+    if (timeout) {
+        poll(fds, n, timeout);
+    }
+    coap_dtls_process(&s->dtls, _now_ms());
+}
+
+static int _udp_socket(const uint16_t port, uint16_t *bound)
+{
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port) };
+    socklen_t len = sizeof(addr);
+    const int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if ((fd < 0) || (port ? connect(fd, (struct sockaddr *)&addr, sizeof(addr)) :
+                     bind(fd, (struct sockaddr *)&addr, sizeof(addr)))) {
+        perror("socket");
+        exit(1);
+    }
+    if (bound) {
+        getsockname(fd, (struct sockaddr *)&addr, &len);
+        *bound = ntohs(addr.sin_port);
+    }
+    return fd;
+}
+
+static void _server(bench_server_t *s, const unsigned workers)
+{
+    const coap_dtls_config_t config = { .psk = server_psk, .workers = workers };
+    const int fd = _udp_socket(0, &s->port);
+    if (coap_dtls_init(&s->dtls, fd, resources, &config) != COAP_SUCCESS) {
+        exit(1);
+    }
+}
+
+/* a new connection from the port of \p c, replacing the previous one */
+static void _connect(bench_client_t *c, const bench_server_t *s, SSL_SESSION *resume)
+{
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(s->port) };
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (c->ssl) {
+        SSL_set_shutdown(c->ssl, SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+        SSL_free(c->ssl);
+    }
+    else {
+        c->fd = _udp_socket(s->port, NULL);
+        fcntl(c->fd, F_SETFL, O_NONBLOCK);
+    }
+    BIO *bio = BIO_new_dgram(c->fd, BIO_NOCLOSE);
+    BIO_ctrl(bio, BIO_CTRL_DGRAM_SET_CONNECTED, 0, &addr);
+    c->ssl = SSL_new(ctx);
+    SSL_set_bio(c->ssl, bio, bio);
+    SSL_set_mtu(c->ssl, COAP_DTLS_MTU);
+    if (resume) {
+        SSL_set_session(c->ssl, resume);
+    }
+    SSL_set_connect_state(c->ssl);
+}
+
+static int _step(bench_client_t *c)
+{
+    const int rc = SSL_do_handshake(c->ssl);
+    if ((rc != 1) && (SSL_get_error(c->ssl, rc) != SSL_ERROR_WANT_READ)) {
+        fprintf(stderr, "handshake failed\n");
+        exit(1);
+    }
+    return rc == 1;
+}
+
+static void _handshake(bench_client_t *c, bench_server_t *s, SSL_SESSION *resume)
+{
+    _connect(c, s, resume);
+    while (!_step(c)) {
+        _pump(s, 1);
+    }
+    sink += SSL_session_reused(c->ssl);
+}
+
+static void _full(void *arg)
+{
+    (void) arg;
+    _handshake(&client, &inline_server, NULL);
+}
+
+static void _resumed(void *arg)
+{
+    (void) arg;
+    _handshake(&client, &inline_server, session);
+}
+
+static void _batch(void *arg)
+{
+    size_t done = 0;
+    bool open[BENCH_BATCH] = { false };
+    (void) arg;
+    for (size_t i = 0; i < BENCH_BATCH; ++i) {
+        _connect(&batch[i], &worker_server, NULL);
+    }
+    while (done < BENCH_BATCH) {
+        for (size_t i = 0; i < BENCH_BATCH; ++i) {
+            if (!open[i] && (open[i] = _step(&batch[i]))) {
+                done++;
+            }
+        }
+        _pump(&worker_server, 1);
+    }
+}
+
+static void _cookie(void *arg)
+{
+    const bench_hello_t *h = arg;
+    uint8_t hvr[COAP_DTLS_HVR_SIZE];
+    size_t hvrlen = sizeof(hvr);
+    if (coap_dtls_cookie_check(&inline_server.dtls, (struct sockaddr *)&hello_addr,
+                               sizeof(hello_addr), h->buf, h->len, hvr, &hvrlen) != COAP_SUCCESS) {
+        abort();
+    }
+    sink += hvrlen;
+}
+
+static void _flood(void *arg)
+{
+    const bench_hello_t *h = arg;
+    uint8_t hvr[COAP_DTLS_DGRAM_SIZE];
+    const uint32_t sent = inline_server.dtls.hello_verifies;
+    send(flood_fd, h->buf, h->len, 0);
+    while (inline_server.dtls.hello_verifies == sent) {
+        _pump(&inline_server, 0);
+    }
+    sink += (size_t)recv(flood_fd, hvr, sizeof(hvr), 0);
+}
+
+/* the first ClientHello of a client, captured */
+static void _hello_init(void)
+{
+    bench_server_t capture;
+    bench_client_t c = { -1, NULL };
+    uint8_t hvr[COAP_DTLS_HVR_SIZE];
+    size_t hvrlen = sizeof(hvr);
+
+    capture.dtls.fd = _udp_socket(0, &capture.port);
+    _connect(&c, &capture, NULL);
+    _step(&c);
+    const ssize_t n = recv(capture.dtls.fd, hello.buf, sizeof(hello.buf), 0);
+    if (n <= 25) {
+        exit(1);
+    }
+    hello.len = (size_t)n;
+    SSL_free(c.ssl);
+    close(c.fd);
+    close(capture.dtls.fd);
+
+    // sent again with the cookie, lengths and message sequence updated
+    hello_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    coap_dtls_cookie_check(&inline_server.dtls, (struct sockaddr *)&hello_addr, sizeof(hello_addr),
+                           hello.buf, hello.len, hvr, &hvrlen);
+    const size_t cookie_at = 25 + 2 + 32 + 1 + hello.buf[25 + 2 + 32];
+    const size_t cookielen = hvr[27];
+    memcpy(valid.buf, hello.buf, cookie_at);
+    valid.buf[cookie_at] = (uint8_t)cookielen;
+    memcpy(valid.buf + cookie_at + 1, hvr + 28, cookielen);
+    memcpy(valid.buf + cookie_at + 1 + cookielen, hello.buf + cookie_at + 1, hello.len - cookie_at - 1);
+    valid.len = hello.len + cookielen;
+    const size_t reclen = ((size_t)valid.buf[11] << 8 | valid.buf[12]) + cookielen;
+    const size_t msglen = reclen - 12;
+    valid.buf[11] = (uint8_t)(reclen >> 8);
+    valid.buf[12] = (uint8_t)reclen;
+    valid.buf[15] = valid.buf[23] = (uint8_t)(msglen >> 8);
+    valid.buf[16] = valid.buf[24] = (uint8_t)msglen;
+    valid.buf[18] = 1;
+    stale = valid;
+    stale.buf[cookie_at + 1] ^= 0xff;
+}
+
+static void _request_dtls(void *arg)
+{
+    uint8_t buf[COAP_DTLS_DGRAM_SIZE];
+    int n;
+    (void) arg;
+    SSL_write(client.ssl, request, (int)request_len);
+    while ((n = SSL_read(client.ssl, buf, sizeof(buf))) <= 0) {
+        _pump(&inline_server, 0);
+    }
+    sink += (size_t)n;
+}
+
+static void _request_udp(void *arg)
+{
+    uint8_t buf[1152];
+    struct sockaddr_storage addr;
+    socklen_t addrlen = sizeof(addr);
+    coap_packet_t pkt, rsp;
+    size_t buflen = sizeof(buf);
+    (void) arg;
+
+    send(udp_client, request, request_len, 0);
+    const ssize_t n = recvfrom(udp_server, buf, sizeof(buf), 0, (struct sockaddr *)&addr, &addrlen);
+    if ((n < 0) || (coap_parse(buf, (size_t)n, &pkt) != COAP_SUCCESS)) {
+        abort();
+    }
+    coap_handle_request(resources, &pkt, &rsp);
+    coap_build(&rsp, buf, &buflen);
+    sendto(udp_server, buf, buflen, 0, (struct sockaddr *)&addr, addrlen);
+    sink += (size_t)recv(udp_client, buf, sizeof(buf), 0);
+}
+
+static void _request_init(void)
+{
+    static const uint8_t tok[] = { 0x12, 0x34, 0x56, 0x78 };
+    coap_packet_t pkt;
+
+    memset(&pkt, 0, sizeof(pkt));
+    pkt.hdr.ver = COAP_VERSION;
+    pkt.hdr.t = COAP_TYPE_CON;
+    pkt.hdr.code = COAP_METHOD_GET;
+    pkt.hdr.id = 0x4242;
+    pkt.hdr.tkl = sizeof(tok);
+    pkt.tok.p = tok;
+    pkt.tok.len = sizeof(tok);
+    coap_add_option(&pkt, COAP_OPTION_URI_PATH, (const uint8_t *)"light", 5);
+    request_len = sizeof(request);
+    coap_build(&pkt, request, &request_len);
+}
+
+/* --- MAIN ----------------------------------------------------------------- */
+int main(int argc, char *argv[])
+{
+    bench_config_t cfg;
+    uint16_t port;
+    if (bench_init(&cfg, argc, argv) < 0) {
+        return 1;
+    }
+    ctx = SSL_CTX_new(DTLS_client_method());
+    SSL_CTX_set_min_proto_version(ctx, DTLS1_2_VERSION);
+    SSL_CTX_set_options(ctx, SSL_OP_NO_QUERY_MTU);
+    SSL_CTX_set_cipher_list(ctx, "PSK-AES128-CCM8");
+    SSL_CTX_set_psk_client_callback(ctx, client_psk);
+    _server(&inline_server, 0);
+    _server(&worker_server, BENCH_WORKERS);
+    _request_init();
+    _hello_init();
+    flood_fd = _udp_socket(inline_server.port, NULL);
+    _handshake(&client, &inline_server, NULL);
+    session = SSL_get1_session(client.ssl);
+    udp_server = _udp_socket(0, &port);
+    udp_client = _udp_socket(port, NULL);
+
+    bench_add("handshake/psk/full", _full, NULL);
+    bench_add("handshake/psk/resumed", _resumed, NULL);
+    bench_add("handshake/psk/workers/32", _batch, NULL);
+    bench_add("cookie/none", _cookie, &hello);
+    bench_add("cookie/valid", _cookie, &valid);
+    bench_add("cookie/stale", _cookie, &stale);
+    bench_add("flood/none", _flood, &hello);
+    bench_add("flood/stale", _flood, &stale);
+    bench_add("request/dtls", _request_dtls, NULL);
+    bench_add("request/udp", _request_udp, NULL);
+    bench_run(&cfg);
+
+    fprintf(stderr, "server: %u handshakes, %u resumed, %u records, %u failures, %u drops, "
+            "%u HelloVerifyRequests\n",
+            inline_server.dtls.handshakes + worker_server.dtls.handshakes,
+            inline_server.dtls.resumed, inline_server.dtls.records,
+            inline_server.dtls.failures + worker_server.dtls.failures,
+            inline_server.dtls.drops + worker_server.dtls.drops,
+            inline_server.dtls.hello_verifies + worker_server.dtls.hello_verifies);
+    return 0;
+}
@@ -0,0 +1,143 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "coap.h"
+#include "coap_echo.h"
+#include "bench.h"
+
+/*
+ * coap_echo per request as a server loop calls it: verifying a valid, an
+ * expired and a forged Echo value, the check of a small response that costs
+ * no HMAC, and a challenge replacing a large response and built. main()
+ * prints the requests per second of each.
+ */
+
+#define BENCH_NOW           1000000u
+#define BENCH_THROUGHPUT    200000  //!< requests timed for the rate
+
+typedef struct bench_req
+{
+    coap_echo_t *echo;
+    const struct sockaddr *addr;
+    socklen_t addrlen;
+    uint32_t now;
+    coap_packet_t pkt;
+    size_t reqlen;
+    size_t rsplen;
+} bench_req_t;
+
+static const uint8_t key[32] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16 };
+static const uint8_t tok[4] = { 0xca, 0xfe, 0xba, 0xbe };
+static coap_echo_t echo;
+static struct sockaddr_in6 addr;
+static uint8_t valid[COAP_ECHO_SIZE], forged[COAP_ECHO_SIZE];
+static bench_req_t reqs[4];
+static volatile size_t sink;
+
+/* --- PRIVATE -------------------------------------------------------------- */
+static void _request(bench_req_t *req, const uint8_t *value, const uint32_t now,
+                     const size_t rsplen)
+{
+    uint8_t buf[64];
+
+    req->echo = &echo;
+    req->addr = (const struct sockaddr *)&addr;
+    req->addrlen = sizeof(addr);
+    req->now = now;
+    memset(&req->pkt, 0, sizeof(req->pkt));
+    req->pkt.hdr.ver = 1;
+    req->pkt.hdr.t = COAP_TYPE_CON;
+    req->pkt.hdr.tkl = sizeof(tok);
+    req->pkt.hdr.code = COAP_METHOD_GET;
+    req->pkt.hdr.id = 0x1234;
+    req->pkt.tok = (coap_buffer_t){ tok, sizeof(tok) };
+    coap_add_option(&req->pkt, COAP_OPTION_URI_PATH, (const uint8_t *)"sensors", 7);
+    if (value) {
+        coap_add_option(&req->pkt, COAP_OPTION_ECHO, value, COAP_ECHO_SIZE);
+    }
+    req->reqlen = sizeof(buf);
+    coap_build(&req->pkt, buf, &req->reqlen);
+    req->rsplen = rsplen;
+}
+
+static void _verify(void *arg)
+{
+    bench_req_t *req = arg;
+    sink += coap_echo_verify(req->echo, &req->pkt, req->addr, req->addrlen, req->now);
+}
+
+/* the decision of a server loop, the challenge only for large responses */
+static void _serve(void *arg)
+{
+    bench_req_t *req = arg;
+    uint8_t value[COAP_ECHO_SIZE], buf[64];
+    size_t len = sizeof(buf);
+    coap_packet_t rsp;
+
+    if ((coap_echo_verify(req->echo, &req->pkt, req->addr, req->addrlen, req->now) == COAP_SUCCESS) ||
+        !coap_echo_amplifies(req->reqlen, req->rsplen)) {
+        sink += req->rsplen;
+        return;
+    }
+    coap_echo_challenge(req->echo, &req->pkt, req->addr, req->addrlen, req->now, value, &rsp);
+    coap_build(&rsp, buf, &len);
+    sink += len;
+}
+
+static double _rate(bench_fn fn, bench_req_t *req)
+{
+    const uint64_t start = bench_now_ns();
+    for (int i = 0; i < BENCH_THROUGHPUT; ++i) {
+        fn(req);
+    }
+    return (double)BENCH_THROUGHPUT * 1e9 / (double)(bench_now_ns() - start);
+}
+
+/* --- MAIN ----------------------------------------------------------------- */
+int main(int argc, char *argv[])
+{
+    bench_config_t cfg;
+
+    if (bench_init(&cfg, argc, argv) < 0) {
+        return 1;
+    }
+    addr.sin6_family = AF_INET6;
+    addr.sin6_addr.s6_addr[0] = 0x20;
+    addr.sin6_addr.s6_addr[1] = 0x01;
+    addr.sin6_addr.s6_addr[15] = 0x01;
+    if (coap_echo_init(&echo, key, sizeof(key), 0) != COAP_SUCCESS) {
+        return 1;
+    }
+    coap_echo_make(&echo, (const struct sockaddr *)&addr, sizeof(addr), BENCH_NOW, valid);
+    memcpy(forged, valid, sizeof(forged));
+    forged[COAP_ECHO_SIZE - 1] ^= 1;
+    _request(&reqs[0], valid, BENCH_NOW + 1, 1024);
+    _request(&reqs[1], valid, BENCH_NOW + COAP_ECHO_LIFETIME + 1, 1024);
+    _request(&reqs[2], forged, BENCH_NOW + 1, 1024);
+    _request(&reqs[3], NULL, BENCH_NOW + 1, 1024);
+    if ((coap_echo_verify(&echo, &reqs[0].pkt, reqs[0].addr, reqs[0].addrlen, reqs[0].now) != COAP_SUCCESS) ||
+        (coap_echo_verify(&echo, &reqs[2].pkt, reqs[2].addr, reqs[2].addrlen, reqs[2].now) == COAP_SUCCESS)) {
+        fprintf(stderr, "verify failed\n");
+        return 1;
+    }
+    static bench_req_t small;
+    small = reqs[3];
+    small.rsplen = 16;
+
+    fprintf(stderr, "verify valid:   %6.2f M/s\n", _rate(_verify, &reqs[0]) / 1e6);
+    fprintf(stderr, "verify expired: %6.2f M/s\n", _rate(_verify, &reqs[1]) / 1e6);
+    fprintf(stderr, "verify forged:  %6.2f M/s\n", _rate(_verify, &reqs[2]) / 1e6);
+    fprintf(stderr, "small response: %6.2f M/s\n", _rate(_serve, &small) / 1e6);
+    fprintf(stderr, "challenge:      %6.2f M/s\n", _rate(_serve, &reqs[3]) / 1e6);
+
+    bench_add("verify/valid", _verify, &reqs[0]);
+    bench_add("verify/expired", _verify, &reqs[1]);
+    bench_add("verify/forged", _verify, &reqs[2]);
+    bench_add("serve/small", _serve, &small);
+    bench_add("serve/challenge", _serve, &reqs[3]);
+    bench_run(&cfg);
+    return 0;
+}
@@ -0,0 +1,156 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "coap.h"
+#include "coap_http.h"
+#include "bench.h"
+
+/*
+ * The per request work of the cross-proxy without sockets: translating a
+ * CoAP GET into an HTTP request, against the same request put together with
+ * snprintf, and parsing a response with Content-Length and a chunked one.
+ * Responses are copied into the receive buffer first as the proxy receives
+ * them, chunked bodies are decoded in place. main() checks that both
+ * requests are identical.
+ */
+
+static coap_packet_t get;
+static uint8_t tx[COAP_HTTP_TX_SIZE];
+static uint8_t rx[COAP_HTTP_RX_SIZE];
+static char rsp_length[1024], rsp_chunked[1024];
+static size_t rsp_length_len, rsp_chunked_len;
+static volatile size_t sink;
+
+/* --- PRIVATE -------------------------------------------------------------- */
+static size_t _request_yacoap(void)
+{
+    size_t len;
+    if (coap_http_make_request(&get, "/v1", "localhost:8080", tx, sizeof(tx), &len) !=
+        COAP_SUCCESS) {
+        return 0;
+    }
+    return len;
+}
+
+/* the usual way, segments and queries known not to need encoding */
+static size_t _request_snprintf(void)
+{
+    uint8_t count;
+    int n = snprintf((char *)tx, sizeof(tx), "GET /v1");
+    const coap_option_t *opt = coap_find_options(&get, COAP_OPTION_URI_PATH, &count);
+    for (size_t i = 1; i < count; ++i) {
+        n += snprintf((char *)tx + n, sizeof(tx) - n, "/%.*s",
+                      (int)opt[i].buf.len, (const char *)opt[i].buf.p);
+    }
+    opt = coap_find_options(&get, COAP_OPTION_URI_QUERY, &count);
+    for (size_t i = 0; opt && (i < count); ++i) {
+        n += snprintf((char *)tx + n, sizeof(tx) - n, "%c%.*s", i ? '&' : '?',
+                      (int)opt[i].buf.len, (const char *)opt[i].buf.p);
+    }
+    opt = coap_find_options(&get, COAP_OPTION_ACCEPT, &count);
+    n += snprintf((char *)tx + n, sizeof(tx) - n,
+                  " HTTP/1.1\r\nHost: %s\r\nAccept: %s\r\n\r\n", "localhost:8080",
+                  coap_http_media_type((uint16_t)coap_decode_uint(&opt->buf)));
+    return (size_t)n;
+}
+
+static size_t _parse(const char *rsp, size_t len)
+{
+    coap_http_response_t r;
+    memcpy(rx, rsp, len);
+    if (coap_http_parse_response(rx, len, false, &r) != COAP_SUCCESS) {
+        return 0;
+    }
+    return r.body.len + (size_t)r.content_format + (size_t)r.max_age;
+}
+
+static void _bench_request_yacoap(void *arg)
+{
+    (void) arg;
+    sink += _request_yacoap();
+}
+
+static void _bench_request_snprintf(void *arg)
+{
+    (void) arg;
+    sink += _request_snprintf();
+}
+
+static void _bench_response_length(void *arg)
+{
+    (void) arg;
+    sink += _parse(rsp_length, rsp_length_len);
+}
+
+static void _bench_response_chunked(void *arg)
+{
+    (void) arg;
+    sink += _parse(rsp_chunked, rsp_chunked_len);
+}
+
+static void _make_messages(void)
+{
+    static const char *path[] = { "api", "devices", "node-17", "temperature" };
+    static const uint8_t tok[] = { 0x12, 0x34 };
+    static const uint8_t accept[] = { COAP_CONTENTTYPE_APP_JSON };
+    static const char query[] = "unit=celsius";
+    const char *body = "{\"temp\":21.5,\"unit\":\"Cel\",\"time\":1700000000}";
+
+    memset(&get, 0, sizeof(get));
+    get.hdr.ver = COAP_VERSION;
+    get.hdr.t = COAP_TYPE_CON;
+    get.hdr.code = COAP_METHOD_GET;
+    get.hdr.tkl = sizeof(tok);
+    get.tok.p = tok;
+    get.tok.len = sizeof(tok);
+    for (size_t i = 0; i < sizeof(path) / sizeof(path[0]); ++i) {
+        coap_add_option(&get, COAP_OPTION_URI_PATH, (const uint8_t *)path[i], strlen(path[i]));
+    }
+    coap_add_option(&get, COAP_OPTION_URI_QUERY, (const uint8_t *)query, strlen(query));
+    coap_add_option(&get, COAP_OPTION_ACCEPT, accept, sizeof(accept));
+
+    // typical headers of a web framework
+    const char *headers = "Date: Tue, 14 Nov 2023 22:13:20 GMT\r\n"
+                          "Server: upstream/1.0\r\n"
+                          "Content-Type: application/json; charset=utf-8\r\n"
+                          "Cache-Control: public, max-age=30\r\n"
+                          "Vary: Accept\r\n"
+                          "ETag: \"5f2c-1a\"\r\n";
+    rsp_length_len = snprintf(rsp_length, sizeof(rsp_length),
+                              "HTTP/1.1 200 OK\r\n%sContent-Length: %zu\r\n\r\n%s",
+                              headers, strlen(body), body);
+    rsp_chunked_len = snprintf(rsp_chunked, sizeof(rsp_chunked),
+                               "HTTP/1.1 200 OK\r\n%sTransfer-Encoding: chunked\r\n\r\n"
+                               "%zx\r\n%.*s\r\n%zx\r\n%s\r\n0\r\n\r\n",
+                               headers, (size_t)16, 16, body, strlen(body) - 16, body + 16);
+}
+
+/* --- MAIN ----------------------------------------------------------------- */
+int main(int argc, char *argv[])
+{
+    bench_config_t cfg;
+    if (bench_init(&cfg, argc, argv) < 0) {
+        return 1;
+    }
+    _make_messages();
+    uint8_t yacoap[COAP_HTTP_TX_SIZE];
+    const size_t len = _request_yacoap();
+    memcpy(yacoap, tx, len);
+    if (!len || (len != _request_snprintf()) || memcmp(yacoap, tx, len) ||
+        !_parse(rsp_length, rsp_length_len) ||
+        (_parse(rsp_length, rsp_length_len) != _parse(rsp_chunked, rsp_chunked_len))) {
+        fprintf(stderr, "mismatch: request %zu %zu, response %zu %zu\n", len,
+                _request_snprintf(), _parse(rsp_length, rsp_length_len),
+                _parse(rsp_chunked, rsp_chunked_len));
+        return 1;
+    }
+    fprintf(stderr, "request: %zu bytes, response: %zu bytes\n", len, rsp_length_len);
+
+    bench_add("request/yacoap", _bench_request_yacoap, NULL);
+    bench_add("request/snprintf", _bench_request_snprintf, NULL);
+    bench_add("response/length", _bench_response_length, NULL);
+    bench_add("response/chunked", _bench_response_chunked, NULL);
+    bench_run(&cfg);
+    return 0;
+}
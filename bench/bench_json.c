@@ -0,0 +1,282 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "coap.h"
+#include "coap_json.h"
+#include "bench.h"
+
+/*
+ * coap_json against payloads built with snprintf and read back with strstr
+ * and strtod, as handlers of content format 50 do without a JSON library.
+ * Doubles go through "%.17g", the shortest printf format that always reads
+ * back exactly. Documents are a small map as a light resource would return
+ * it and an array of sensor records of about a datagram; main() checks that
+ * both sides agree on the values before measuring.
+ */
+
+#define BENCH_RECORDS   16      //!< records of the sensor document
+#define BENCH_BUFLEN    2048    //!< encoding buffer, about a CoAP datagram
+#define BENCH_DOUBLES   64      //!< values of the format/double metrics
+
+typedef struct bench_doc
+{
+    char buf[BENCH_BUFLEN];
+    size_t len;
+} bench_doc_t;
+
+static bench_doc_t small, records, records_printf;
+static char names[BENCH_RECORDS][40];
+static double values[BENCH_DOUBLES];
+static volatile double sink;
+
+/* --- PRIVATE -------------------------------------------------------------- */
+static double _value(int i)
+{
+    return 20.1 + i * 0.37;
+}
+
+static size_t _encode_small(char *buf, size_t len)
+{
+    coap_json_writer_t w;
+    coap_json_writer_init(&w, (uint8_t *)buf, len);
+    coap_json_begin_object(&w);
+    coap_json_put_key(&w, "light", 5);
+    coap_json_put_bool(&w, true);
+    coap_json_put_key(&w, "level", 5);
+    coap_json_put_uint(&w, 42);
+    coap_json_put_key(&w, "temp", 4);
+    coap_json_put_double(&w, 21.5);
+    coap_json_end_object(&w);
+    return (w.err == COAP_SUCCESS) ? w.pos : 0;
+}
+
+static size_t _encode_small_printf(char *buf, size_t len)
+{
+    int n = snprintf(buf, len, "{\"light\":%s,\"level\":%u,\"temp\":%.17g}",
+                     "true", 42u, 21.5);
+    return ((n > 0) && ((size_t)n < len)) ? (size_t)n : 0;
+}
+
+static size_t _encode_records(char *buf, size_t len)
+{
+    coap_json_writer_t w;
+    coap_json_writer_init(&w, (uint8_t *)buf, len);
+    coap_json_begin_array(&w);
+    for (int i = 0; i < BENCH_RECORDS; ++i) {
+        coap_json_begin_object(&w);
+        coap_json_put_key(&w, "n", 1);
+        coap_json_put_string(&w, names[i], strlen(names[i]));
+        coap_json_put_key(&w, "u", 1);
+        coap_json_put_string(&w, "Cel", 3);
+        coap_json_put_key(&w, "v", 1);
+        coap_json_put_double(&w, _value(i));
+        coap_json_put_key(&w, "t", 1);
+        coap_json_put_uint(&w, 1700000000u + i);
+        coap_json_end_object(&w);
+    }
+    coap_json_end_array(&w);
+    return (w.err == COAP_SUCCESS) ? w.pos : 0;
+}
+
+static size_t _encode_records_printf(char *buf, size_t len)
+{
+    size_t pos = 0;
+    for (int i = 0; i < BENCH_RECORDS; ++i) {
+        // names are known not to need escaping here, handlers rarely check
+        int n = snprintf(buf + pos, len - pos,
+                         "%c{\"n\":\"%s\",\"u\":\"Cel\",\"v\":%.17g,\"t\":%u}",
+                         i ? ',' : '[', names[i], _value(i), 1700000000u + i);
+        if ((n < 0) || ((size_t)n >= len - pos)) {
+            return 0;
+        }
+        pos += n;
+    }
+    if (pos + 1 >= len) {
+        return 0;
+    }
+    buf[pos++] = ']';
+    buf[pos] = '\0';
+    return pos;
+}
+
+/* sum of "v" and "t" and the name lengths, touches every record */
+static double _walk_records(const char *buf, size_t len)
+{
+    coap_json_reader_t r;
+    coap_json_token_t tok, value;
+    double sum = 0, d;
+
+    coap_json_reader_init(&r, (const uint8_t *)buf, len);
+    if (coap_json_expect(&r, COAP_JSON_ARRAY, &tok) != COAP_SUCCESS) {
+        return -1;
+    }
+    while ((coap_json_next(&r, &tok) == COAP_SUCCESS) &&
+           (tok.type == COAP_JSON_OBJECT)) {
+        while ((coap_json_next(&r, &tok) == COAP_SUCCESS) &&
+               (tok.type == COAP_JSON_KEY)) {
+            if (coap_json_next(&r, &value) != COAP_SUCCESS) {
+                return -1;
+            }
+            if ((tok.str.len == 1) && (tok.str.p[0] == 'n')) {
+                sum += value.str.len;
+            }
+            else if ((tok.str.len == 1) && ((tok.str.p[0] == 'v') || (tok.str.p[0] == 't'))) {
+                if (coap_json_number(&value, &d) != COAP_SUCCESS) {
+                    return -1;
+                }
+                sum += d;
+            }
+        }
+    }
+    return coap_json_at_end(&r) ? sum : -1;
+}
+
+/* the same with strstr and strtod, the buffer has to be terminated */
+static double _walk_records_strtod(const char *buf)
+{
+    double sum = 0;
+    const char *p = buf;
+    while ((p = strstr(p, "{\"n\":\""))) {
+        const char *name = p + 6;
+        const char *end = strchr(name, '"');
+        const char *v = strstr(p, "\"v\":");
+        const char *t = strstr(p, "\"t\":");
+        if (!end || !v || !t) {
+            return -1;
+        }
+        sum += end - name;
+        sum += strtod(v + 4, NULL);
+        sum += strtod(t + 4, NULL);
+        p = end;
+    }
+    return sum;
+}
+
+static void _encode_small_yacoap(void *arg)
+{
+    char buf[BENCH_BUFLEN];
+    (void) arg;
+    sink += _encode_small(buf, sizeof(buf));
+}
+
+static void _encode_small_sprintf(void *arg)
+{
+    char buf[BENCH_BUFLEN];
+    (void) arg;
+    sink += _encode_small_printf(buf, sizeof(buf));
+}
+
+static void _encode_records_yacoap(void *arg)
+{
+    char buf[BENCH_BUFLEN];
+    (void) arg;
+    sink += _encode_records(buf, sizeof(buf));
+}
+
+static void _encode_records_sprintf(void *arg)
+{
+    char buf[BENCH_BUFLEN];
+    (void) arg;
+    sink += _encode_records_printf(buf, sizeof(buf));
+}
+
+static void _format_double_yacoap(void *arg)
+{
+    char buf[COAP_JSON_DOUBLE_LEN];
+    (void) arg;
+    for (int i = 0; i < BENCH_DOUBLES; ++i) {
+        sink += coap_json_format_double(values[i], buf);
+    }
+}
+
+static void _format_double_sprintf(void *arg)
+{
+    char buf[COAP_JSON_DOUBLE_LEN];
+    (void) arg;
+    for (int i = 0; i < BENCH_DOUBLES; ++i) {
+        sink += snprintf(buf, sizeof(buf), "%.17g", values[i]);
+    }
+}
+
+static void _decode_records_yacoap(void *arg)
+{
+    (void) arg;
+    sink += _walk_records(records.buf, records.len);
+}
+
+static void _decode_records_strtod(void *arg)
+{
+    (void) arg;
+    sink += _walk_records_strtod(records_printf.buf);
+}
+
+/* both sides have to agree on the documents */
+static int _check(void)
+{
+    double expect = 0;
+    for (int i = 0; i < BENCH_RECORDS; ++i) {
+        expect += strlen(names[i]) + _value(i) + 1700000000u + i;
+    }
+    const double got[] = {
+        _walk_records(records.buf, records.len),
+        _walk_records(records_printf.buf, records_printf.len),
+        _walk_records_strtod(records.buf),
+        _walk_records_strtod(records_printf.buf),
+    };
+    for (size_t i = 0; i < sizeof(got) / sizeof(got[0]); ++i) {
+        // summation order differs from the expectation, values have to match
+        if ((got[i] < expect * (1 - 1e-12)) || (got[i] > expect * (1 + 1e-12))) {
+            fprintf(stderr, "decode mismatch %zu: %f != %f\n", i, got[i], expect);
+            return -1;
+        }
+    }
+    for (int i = 0; i < BENCH_DOUBLES; ++i) {
+        char buf[COAP_JSON_DOUBLE_LEN + 1];
+        size_t n = coap_json_format_double(values[i], buf);
+        buf[n] = '\0';
+        if (strtod(buf, NULL) != values[i]) {
+            fprintf(stderr, "format mismatch: %s != %.17g\n", buf, values[i]);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* --- MAIN ----------------------------------------------------------------- */
+int main(int argc, char *argv[])
+{
+    bench_config_t cfg;
+    if (bench_init(&cfg, argc, argv) < 0) {
+        return 1;
+    }
+    for (int i = 0; i < BENCH_RECORDS; ++i) {
+        snprintf(names[i], sizeof(names[i]), "urn:dev:ow:10e2073a0108006:%d", i);
+    }
+    // readings, times, and values from a wide range
+    for (int i = 0; i < BENCH_DOUBLES; ++i) {
+        values[i] = (i % 4 == 0) ? _value(i) : (i % 4 == 1) ? 1700000000.0 + i :
+                    (i % 4 == 2) ? 1.0 / (i + 1) : 6.02214076e23 * i;
+    }
+    small.len = _encode_small(small.buf, sizeof(small.buf));
+    records.len = _encode_records(records.buf, sizeof(records.buf) - 1);
+    records.buf[records.len] = '\0';
+    records_printf.len = _encode_records_printf(records_printf.buf,
+                                                sizeof(records_printf.buf));
+    if (!small.len || !records.len || !records_printf.len || _check()) {
+        return 1;
+    }
+    fprintf(stderr, "records document: %zu bytes, %zu with %%.17g\n",
+            records.len, records_printf.len);
+
+    bench_add("encode/small/yacoap", _encode_small_yacoap, NULL);
+    bench_add("encode/small/sprintf", _encode_small_sprintf, NULL);
+    bench_add("encode/records/yacoap", _encode_records_yacoap, NULL);
+    bench_add("encode/records/sprintf", _encode_records_sprintf, NULL);
+    bench_add("format/double/yacoap", _format_double_yacoap, NULL);
+    bench_add("format/double/sprintf", _format_double_sprintf, NULL);
+    bench_add("decode/records/yacoap", _decode_records_yacoap, NULL);
+    bench_add("decode/records/strtod", _decode_records_strtod, NULL);
+    bench_run(&cfg);
+    return 0;
+}
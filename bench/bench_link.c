@@ -0,0 +1,212 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "coap.h"
+#include "coap_link.h"
+#include "bench.h"
+
+/*
+ * coap_link against the usual string code for link format: copy the
+ * document, split it with strtok_r at ',', ';' and '=' and compare with
+ * strcmp. The document lists BENCH_LINKS resources as a resource directory or
+ * a gateway would, about 70 kB; main() checks that both find the same links.
+ * stream/yacoap reads it in 1024 byte Block2 payloads.
+ */
+
+#define BENCH_LINKS     1000    //!< links of the document
+#define BENCH_BLOCK     1024    //!< Block2 size of the stream metric
+
+static char *doc;
+static size_t doclen;
+static const coap_link_filter_t temperature[] = {{ "rt", "temperature-c" }};
+static volatile size_t sink;
+
+/* --- PRIVATE -------------------------------------------------------------- */
+static size_t _parse_yacoap(void)
+{
+    coap_link_reader_t r;
+    coap_link_t link;
+    coap_link_attr_t attr;
+    size_t n = 0;
+
+    coap_link_reader_init(&r, (const uint8_t *)doc, doclen);
+    while (coap_link_next(&r, &link) == COAP_SUCCESS) {
+        size_t pos = 0;
+        while (coap_link_attr_next(&link, &pos, &attr) == COAP_SUCCESS) {
+            n += attr.value.len;
+        }
+        n += link.target.len;
+    }
+    return n;
+}
+
+/* value lengths without quotes, as coap_link returns them */
+static size_t _unquoted_len(const char *value)
+{
+    size_t len = strlen(value);
+    return ((len >= 2) && (value[0] == '"')) ? len - 2 : len;
+}
+
+static size_t _parse_strtok(void)
+{
+    char *copy = strdup(doc);
+    char *save_link, *save_attr;
+    size_t n = 0;
+
+    for (char *l = strtok_r(copy, ",", &save_link); l; l = strtok_r(NULL, ",", &save_link)) {
+        char *target = strtok_r(l, ";", &save_attr);
+        n += strlen(target) - 2;
+        for (char *a = strtok_r(NULL, ";", &save_attr); a; a = strtok_r(NULL, ";", &save_attr)) {
+            char *eq = strchr(a, '=');
+            if (eq) {
+                n += _unquoted_len(eq + 1);
+            }
+        }
+    }
+    free(copy);
+    return n;
+}
+
+static size_t _filter_yacoap(void)
+{
+    coap_link_reader_t r;
+    coap_link_t link;
+    size_t n = 0;
+
+    coap_link_reader_init(&r, (const uint8_t *)doc, doclen);
+    while (coap_link_find(&r, temperature, 1, &link) == COAP_SUCCESS) {
+        n += link.target.len;
+    }
+    return n;
+}
+
+static size_t _filter_strtok(void)
+{
+    char *copy = strdup(doc);
+    char *save_link, *save_attr, *save_value;
+    size_t n = 0;
+
+    for (char *l = strtok_r(copy, ",", &save_link); l; l = strtok_r(NULL, ",", &save_link)) {
+        char *target = strtok_r(l, ";", &save_attr);
+        for (char *a = strtok_r(NULL, ";", &save_attr); a; a = strtok_r(NULL, ";", &save_attr)) {
+            if (strncmp(a, "rt=", 3)) {
+                continue;
+            }
+            // quoted values hold space separated relation types
+            char *value = a + 3 + (a[3] == '"');
+            char *end = strrchr(value, '"');
+            if (end) {
+                *end = '\0';
+            }
+            bool match = false;
+            for (char *v = strtok_r(value, " ", &save_value); v; v = strtok_r(NULL, " ", &save_value)) {
+                match |= !strcmp(v, "temperature-c");
+            }
+            if (match) {
+                n += strlen(target) - 2;
+                break;
+            }
+        }
+    }
+    free(copy);
+    return n;
+}
+
+static size_t _stream_yacoap(void)
+{
+    uint8_t carry[256];
+    coap_link_stream_t s;
+    coap_link_t link;
+    coap_state_t rc;
+    size_t n = 0, fed = 0;
+
+    coap_link_stream_init(&s, carry, sizeof(carry));
+    while ((rc = coap_link_stream_next(&s, &link)) != COAP_RSP_RECV) {
+        if (rc == COAP_RSP_WAIT) {
+            size_t len = (doclen - fed < BENCH_BLOCK) ? doclen - fed : BENCH_BLOCK;
+            coap_link_stream_feed(&s, (const uint8_t *)doc + fed, len, fed + len == doclen);
+            fed += len;
+        }
+        else if (rc == COAP_SUCCESS) {
+            n += coap_link_match(&link, temperature, 1) ? link.target.len : 0;
+        }
+        else {
+            return 0;
+        }
+    }
+    return n;
+}
+
+static void _bench_parse_yacoap(void *arg)
+{
+    (void) arg;
+    sink += _parse_yacoap();
+}
+
+static void _bench_parse_strtok(void *arg)
+{
+    (void) arg;
+    sink += _parse_strtok();
+}
+
+static void _bench_filter_yacoap(void *arg)
+{
+    (void) arg;
+    sink += _filter_yacoap();
+}
+
+static void _bench_filter_strtok(void *arg)
+{
+    (void) arg;
+    sink += _filter_strtok();
+}
+
+static void _bench_stream_yacoap(void *arg)
+{
+    (void) arg;
+    sink += _stream_yacoap();
+}
+
+static void _make_doc(void)
+{
+    size_t size = BENCH_LINKS * 96;
+    doc = malloc(size);
+    doclen = 0;
+    for (int i = 0; i < BENCH_LINKS; ++i) {
+        const char *fmt = (i % 3 == 0) ?
+            "%s</dev/%d/temp>;rt=\"temperature-c sensor\";if=\"core.s\";ct=0;obs" :
+            (i % 3 == 1) ?
+            "%s</dev/%d/light>;rt=\"light-lux\";if=\"core.s\";ct=60;title=\"Light\"" :
+            "%s</dev/%d/config>;rt=\"config\";if=\"core.p\";ct=\"0 60\";sz=512";
+        doclen += snprintf(doc + doclen, size - doclen, fmt, i ? "," : "", i);
+    }
+}
+
+/* --- MAIN ----------------------------------------------------------------- */
+int main(int argc, char *argv[])
+{
+    bench_config_t cfg;
+    if (bench_init(&cfg, argc, argv) < 0) {
+        return 1;
+    }
+    _make_doc();
+    if ((_parse_yacoap() != _parse_strtok()) || !_filter_yacoap() ||
+        (_filter_yacoap() != _filter_strtok()) ||
+        (_filter_yacoap() != _stream_yacoap())) {
+        fprintf(stderr, "mismatch: parse %zu %zu, filter %zu %zu %zu\n",
+                _parse_yacoap(), _parse_strtok(), _filter_yacoap(),
+                _filter_strtok(), _stream_yacoap());
+        return 1;
+    }
+    fprintf(stderr, "document: %d links, %zu bytes\n", BENCH_LINKS, doclen);
+
+    bench_add("parse/yacoap", _bench_parse_yacoap, NULL);
+    bench_add("parse/strtok", _bench_parse_strtok, NULL);
+    bench_add("filter/yacoap", _bench_filter_yacoap, NULL);
+    bench_add("filter/strtok", _bench_filter_strtok, NULL);
+    bench_add("stream/yacoap", _bench_stream_yacoap, NULL);
+    bench_run(&cfg);
+    free(doc);
+    return 0;
+}
@@ -0,0 +1,267 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "coap.h"
+#include "coap_local.h"
+#include "bench.h"
+
+/*
+ * The local transports against UDP over loopback, a GET answered by the same
+ * resource table. request/ runs client and server on the calling thread:
+ * the request sent, the server reading, dispatching and answering, the
+ * client reading the response; what each transport costs in CPU. rtt/ runs
+ * a second server on a thread of its own sleeping in poll and the client
+ * waiting in poll for the response, the latency of a round trip with both
+ * wakeups. Socket bound, so not part of the perf-check set.
+ */
+
+typedef struct bench_server
+{
+    int udp;
+    coap_local_t local;
+    char path[64];
+} bench_server_t;
+
+typedef struct bench_client
+{
+    bench_server_t *server;
+    bool threaded;          //!< the server runs on a thread, wait in poll
+    int udp;
+    int unx;
+    struct sockaddr_in udp_addr;
+    struct sockaddr_un unx_addr;
+    coap_local_channel_t channel;
+} bench_client_t;
+
+static bench_server_t inline_server, thread_server;
+static bench_client_t inline_client = { .server = &inline_server },
+                      thread_client = { .server = &thread_server, .threaded = true };
+static uint8_t request[64];
+static size_t request_len;
+static volatile size_t sink;
+static bool stop;
+
+/* --- RESOURCES ------------------------------------------------------------ */
+static const coap_resource_path_t path_light = {1, {"light"}};
+
+static int handle_get_light(const coap_resource_t *resource,
+                            const coap_packet_t *inpkt,
+                            coap_packet_t *pkt)
+{
+    return coap_make_response(inpkt->hdr.id, &inpkt->tok, COAP_TYPE_ACK,
+                              COAP_RSPCODE_CONTENT, resource->content_type,
+                              (const uint8_t *)"on", 2, pkt);
+}
+
+static coap_resource_t resources[] =
+{
+    {COAP_RDY, COAP_METHOD_GET, COAP_TYPE_ACK, handle_get_light, &path_light,
+        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_TXT_PLAIN), NULL},
+    {(coap_state_t)0, (coap_method_t)0, (coap_msgtype_t)0, NULL, NULL,
+        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_NONE), NULL}
+};
+
+/* --- HELPERS -------------------------------------------------------------- */
+/* the UDP server, as in the example */
+static void _udp_serve(const int fd)
+{
+    uint8_t buf[COAP_LOCAL_DGRAM_SIZE];
+    struct sockaddr_storage addr;
+    socklen_t addrlen = sizeof(addr);
+    coap_packet_t pkt, rsp;
+    size_t buflen = sizeof(buf);
+
+    const ssize_t n = recvfrom(fd, buf, sizeof(buf), 0, (struct sockaddr *)&addr,
+                               &addrlen);
+    if ((n < 0) || (coap_parse(buf, (size_t)n, &pkt) != COAP_SUCCESS)) {
+        return;
+    }
+    coap_handle_request(resources, &pkt, &rsp);
+    coap_build(&rsp, buf, &buflen);
+    sendto(fd, buf, buflen, 0, (struct sockaddr *)&addr, addrlen);
+}
+
+/* what poll reports, or without poll the entry \p only */
+static void _serve(bench_server_t *s, const int timeout, const size_t only)
+{
+    struct pollfd fds[4] = {{ s->udp, POLLIN, 0 }};
+    const size_t n = 1 + coap_local_pollfds(&s->local, fds + 1, 3);
+
+    if (timeout) {
+        if (poll(fds, n, timeout) <= 0) {
+            return;
+        }
+    }
+    else {
+        fds[only].revents = POLLIN;
+    }
+    if (fds[0].revents) {
+        _udp_serve(s->udp);
+    }
+    coap_local_process(&s->local, fds + 1, n - 1);
+}
+
+static void *_server(void *arg)
+{
+    while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+        _serve(arg, 10, 0);
+    }
+    return NULL;
+}
+
+/* for the response on \p fd, to the request of server entry \p entry */
+static void _wait(bench_client_t *c, const int fd, const size_t entry)
+{
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    if (c->threaded) {
+        poll(&pfd, 1, -1);
+    }
+    else {
+        _serve(c->server, 0, entry);
+    }
+}
+
+static void _recv(bench_client_t *c, const int fd, const size_t entry)
+{
+    uint8_t buf[COAP_LOCAL_DGRAM_SIZE];
+
+    _wait(c, fd, entry);
+    const ssize_t n = recv(fd, buf, sizeof(buf), 0);
+    if (n < 0) {
+        abort();
+    }
+    sink += (size_t)n;
+}
+
+static void _request_udp(void *arg)
+{
+    bench_client_t *c = arg;
+    sendto(c->udp, request, request_len, 0, (struct sockaddr *)&c->udp_addr,
+           sizeof(c->udp_addr));
+    _recv(c, c->udp, 0);
+}
+
+static void _request_unix(void *arg)
+{
+    bench_client_t *c = arg;
+    sendto(c->unx, request, request_len, 0, (struct sockaddr *)&c->unx_addr,
+           sizeof(c->unx_addr));
+    _recv(c, c->unx, 1);
+}
+
+/* the request copied into the slot as it would be built there */
+static void _request_shm(void *arg)
+{
+    bench_client_t *c = arg;
+    const uint8_t *rsp;
+    size_t size, len;
+
+    uint8_t *slot = coap_local_reserve(&c->channel, &size);
+    memcpy(slot, request, request_len);
+    coap_local_commit(&c->channel, request_len);
+    while (!(rsp = coap_local_peek(&c->channel, &len))) {
+        _wait(c, c->channel.rxfd, 2);
+        coap_local_wakeup(&c->channel);
+    }
+    sink += len + rsp[1];
+    coap_local_release(&c->channel);
+}
+
+static void _request_init(void)
+{
+    static const uint8_t tok[] = { 0x12, 0x34, 0x56, 0x78 };
+    coap_packet_t pkt;
+
+    memset(&pkt, 0, sizeof(pkt));
+    pkt.hdr.ver = COAP_VERSION;
+    pkt.hdr.t = COAP_TYPE_CON;
+    pkt.hdr.code = COAP_METHOD_GET;
+    pkt.hdr.id = 0x4242;
+    pkt.hdr.tkl = sizeof(tok);
+    pkt.tok.p = tok;
+    pkt.tok.len = sizeof(tok);
+    coap_add_option(&pkt, COAP_OPTION_URI_PATH, (const uint8_t *)"light", 5);
+    request_len = sizeof(request);
+    coap_build(&pkt, request, &request_len);
+}
+
+/* a server on loopback and in /tmp, a client with a channel to it */
+static void _init(bench_client_t *c, const char *name)
+{
+    bench_server_t *s = c->server;
+    socklen_t len = sizeof(c->udp_addr);
+
+    s->udp = socket(AF_INET, SOCK_DGRAM, 0);
+    c->udp_addr.sin_family = AF_INET;
+    c->udp_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(s->udp, (struct sockaddr *)&c->udp_addr, len);
+    getsockname(s->udp, (struct sockaddr *)&c->udp_addr, &len);
+    c->udp = socket(AF_INET, SOCK_DGRAM, 0);
+
+    snprintf(s->path, sizeof(s->path), "/tmp/bench-local-%d-%s.sock", (int)getpid(), name);
+    c->unx_addr.sun_family = AF_UNIX;
+    strcpy(c->unx_addr.sun_path, s->path);
+    c->unx = coap_local_socket(NULL);
+    if ((s->udp < 0) || (c->udp < 0) || (c->unx < 0) ||
+        (coap_local_init(&s->local, coap_local_socket(s->path), resources, 1) != COAP_SUCCESS) ||
+        (s->local.fd < 0) ||
+        (coap_local_channel_open(&c->channel, c->unx, (struct sockaddr *)&c->unx_addr,
+                                 sizeof(c->unx_addr)) != COAP_SUCCESS)) {
+        fprintf(stderr, "no local transports\n");
+        exit(1);
+    }
+    _serve(s, 100, 0);
+}
+
+static void _free(bench_client_t *c)
+{
+    bench_server_t *s = c->server;
+
+    coap_local_channel_close(&c->channel);
+    close(c->udp);
+    close(c->unx);
+    close(s->udp);
+    close(s->local.fd);
+    coap_local_free(&s->local);
+    unlink(s->path);
+}
+
+/* --- MAIN ----------------------------------------------------------------- */
+int main(int argc, char *argv[])
+{
+    bench_config_t cfg;
+    pthread_t thread;
+
+    if (bench_init(&cfg, argc, argv) < 0) {
+        return 1;
+    }
+    _request_init();
+    _init(&inline_client, "inline");
+    _init(&thread_client, "thread");
+    pthread_create(&thread, NULL, _server, &thread_server);
+
+    bench_add("request/udp", _request_udp, &inline_client);
+    bench_add("request/unix", _request_unix, &inline_client);
+    bench_add("request/shm", _request_shm, &inline_client);
+    bench_add("rtt/udp", _request_udp, &thread_client);
+    bench_add("rtt/unix", _request_unix, &thread_client);
+    bench_add("rtt/shm", _request_shm, &thread_client);
+    bench_run(&cfg);
+
+    __atomic_store_n(&stop, true, __ATOMIC_RELAXED);
+    pthread_join(thread, NULL);
+    fprintf(stderr, "server: %u requests, %u dropped\n",
+            inline_server.local.requests + thread_server.local.requests,
+            inline_server.local.dropped + thread_server.local.dropped);
+    _free(&inline_client);
+    _free(&thread_client);
+    return 0;
+}
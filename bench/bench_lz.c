@@ -0,0 +1,156 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "coap.h"
+#include "coap_lz.h"
+#include "bench.h"
+
+/*
+ * coap_lz on the large documents it is meant for: a discovery result of
+ * BENCH_LINKS links and a JSON array of BENCH_RECORDS sensor records. Besides
+ * compressing and decompressing, transfer/ times what a server spends per
+ * client to serve the whole document block wise, building every Block2
+ * response datagram, plain and precompressed. main() checks the round trip
+ * and prints the number of blocks of each.
+ */
+
+#define BENCH_LINKS     1000    //!< links of the link-format document
+#define BENCH_RECORDS   500     //!< records of the JSON document
+#define BENCH_SZX       6       //!< 1024 byte blocks
+
+typedef struct bench_doc
+{
+    uint8_t *plain;
+    size_t len;
+    uint8_t *packed;
+    size_t packed_len;
+    uint8_t *out;           //!< decompression buffer
+} bench_doc_t;
+
+static bench_doc_t link, json;
+static volatile size_t sink;
+
+/* --- PRIVATE -------------------------------------------------------------- */
+static size_t _make_link(uint8_t *buf, size_t size)
+{
+    size_t len = 0;
+    for (int i = 0; i < BENCH_LINKS; ++i) {
+        len += snprintf((char *)buf + len, size - len,
+                        "%s</dev/%d/temp>;rt=\"temperature-c sensor\";if=\"core.s\";ct=0;obs",
+                        i ? "," : "", i);
+    }
+    return len;
+}
+
+static size_t _make_json(uint8_t *buf, size_t size)
+{
+    size_t len = 0;
+    for (int i = 0; i < BENCH_RECORDS; ++i) {
+        len += snprintf((char *)buf + len, size - len,
+                        "%c{\"n\":\"urn:dev:ow:10e2073a0108006:%d\",\"u\":\"Cel\",\"v\":%.2f,\"t\":%d}",
+                        i ? ',' : '[', i, 20.1 + i * 0.37, 1700000000 + i);
+    }
+    len += snprintf((char *)buf + len, size - len, "]");
+    return len;
+}
+
+static int _doc_init(bench_doc_t *doc, size_t (*make)(uint8_t *, size_t))
+{
+    const size_t size = 128 * 1024;
+    doc->plain = malloc(size);
+    doc->len = make(doc->plain, size);
+    doc->packed = malloc(COAP_LZ_BOUND(doc->len));
+    doc->packed_len = coap_lz_compress(doc->plain, doc->len,
+                                       doc->packed, COAP_LZ_BOUND(doc->len));
+    doc->out = malloc(doc->len);
+    size_t n = 0;
+    if (!doc->packed_len ||
+        (coap_lz_decompress(doc->packed, doc->packed_len, doc->out, doc->len, &n) != COAP_SUCCESS) ||
+        (n != doc->len) || memcmp(doc->out, doc->plain, n)) {
+        fprintf(stderr, "round trip failed\n");
+        return -1;
+    }
+    return 0;
+}
+
+/* all Block2 responses of \p payload, returns the number of blocks */
+static size_t _transfer(const uint8_t *payload, const size_t len)
+{
+    static const uint8_t ct[2] = COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_APP_LINKFORMAT);
+    coap_packet_t req, rsp;
+    uint8_t opt[4], scratch[4], buf[1152];
+    size_t blocks = 0;
+    coap_block_t block = { 0, true, BENCH_SZX };
+
+    for (; block.more; ++block.num, ++blocks) {
+        size_t buflen = sizeof(buf);
+        memset(&req, 0, sizeof(req));
+        coap_add_option(&req, COAP_OPTION_BLOCK2, opt,
+                        coap_encode_uint((block.num << 4) | BENCH_SZX, opt));
+        coap_make_response(1, NULL, COAP_TYPE_ACK, COAP_RSPCODE_CONTENT,
+                           ct, payload, len, &rsp);
+        if ((coap_make_block2(&req, BENCH_SZX, scratch, &rsp) != COAP_RSP_SEND) ||
+            (coap_build(&rsp, buf, &buflen) != COAP_SUCCESS) ||
+            (coap_get_block(&rsp, COAP_OPTION_BLOCK2, &block) != COAP_SUCCESS)) {
+            return 0;
+        }
+        sink += buflen;
+    }
+    return blocks;
+}
+
+static void _compress(void *arg)
+{
+    bench_doc_t *doc = arg;
+    sink += coap_lz_compress(doc->plain, doc->len, doc->packed, COAP_LZ_BOUND(doc->len));
+}
+
+static void _decompress(void *arg)
+{
+    bench_doc_t *doc = arg;
+    size_t n;
+    coap_lz_decompress(doc->packed, doc->packed_len, doc->out, doc->len, &n);
+    sink += n;
+}
+
+static void _transfer_plain(void *arg)
+{
+    bench_doc_t *doc = arg;
+    sink += _transfer(doc->plain, doc->len);
+}
+
+static void _transfer_lz4(void *arg)
+{
+    bench_doc_t *doc = arg;
+    sink += _transfer(doc->packed, doc->packed_len);
+}
+
+/* --- MAIN ----------------------------------------------------------------- */
+int main(int argc, char *argv[])
+{
+    bench_config_t cfg;
+    if (bench_init(&cfg, argc, argv) < 0) {
+        return 1;
+    }
+    if (_doc_init(&link, _make_link) || _doc_init(&json, _make_json)) {
+        return 1;
+    }
+    fprintf(stderr, "link: %zu -> %zu bytes, %zu -> %zu blocks\n",
+            link.len, link.packed_len, _transfer(link.plain, link.len),
+            _transfer(link.packed, link.packed_len));
+    fprintf(stderr, "json: %zu -> %zu bytes, %zu -> %zu blocks\n",
+            json.len, json.packed_len, _transfer(json.plain, json.len),
+            _transfer(json.packed, json.packed_len));
+
+    bench_add("compress/link", _compress, &link);
+    bench_add("decompress/link", _decompress, &link);
+    bench_add("compress/json", _compress, &json);
+    bench_add("decompress/json", _decompress, &json);
+    bench_add("transfer/link/plain", _transfer_plain, &link);
+    bench_add("transfer/link/lz4", _transfer_lz4, &link);
+    bench_add("transfer/json/plain", _transfer_plain, &json);
+    bench_add("transfer/json/lz4", _transfer_lz4, &json);
+    bench_run(&cfg);
+    return 0;
+}
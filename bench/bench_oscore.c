@@ -0,0 +1,172 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "coap.h"
+#include "coap_oscore.h"
+#include "bench.h"
+
+/*
+ * coap_oscore per message: a PUT with a payload of 16 to 1024 bytes
+ * protected by the client and unprotected by the server, on AES-NI where the
+ * processor has it and on the portable AES. Unprotecting forgets the replay
+ * window before each call, so that the same message is accepted again. main()
+ * prints the throughput of each in payload bytes per second.
+ */
+
+#define BENCH_SIZES         4
+#define BENCH_THROUGHPUT    20000   //!< messages timed for the throughput
+
+typedef struct bench_msg
+{
+    coap_oscore_ctx_t *client;
+    coap_oscore_ctx_t *server;
+    size_t plainlen;
+    uint8_t plain[1152];
+    size_t protectedlen;
+    uint8_t protected[1152 + COAP_OSCORE_OVERHEAD];
+    uint8_t buf[1152 + COAP_OSCORE_OVERHEAD];
+} bench_msg_t;
+
+static const size_t sizes[BENCH_SIZES] = { 16, 64, 256, 1024 };
+static coap_oscore_ctx_t client[2], server[2];  //!< AES-NI and portable
+static bench_msg_t msgs[2][BENCH_SIZES];
+static volatile size_t sink;
+
+/* --- PRIVATE -------------------------------------------------------------- */
+static int _init(const int impl)
+{
+    static const uint8_t secret[16] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16 };
+    static const uint8_t salt[8] = { 0x9e, 0x7c, 0xa9, 0x22, 0x23, 0x78, 0x63, 0x40 };
+    static const uint8_t id[1] = { 1 };
+    static const uint8_t tok[4] = { 0xca, 0xfe, 0xba, 0xbe };
+    static const uint8_t ct[1] = { COAP_CONTENTTYPE_APP_JSON };
+    static uint8_t payload[1024];
+    coap_oscore_params_t params = {
+        .master_secret = { secret, sizeof(secret) },
+        .master_salt = { salt, sizeof(salt) },
+        .sender_id = { id, 0 },
+        .recipient_id = { id, 1 },
+    };
+    coap_oscore_request_t req;
+    coap_packet_t pkt;
+
+    if (coap_oscore_derive(&client[impl], &params) != COAP_SUCCESS) {
+        return -1;
+    }
+    params.sender_id.len = 1;
+    params.recipient_id.len = 0;
+    if (coap_oscore_derive(&server[impl], &params) != COAP_SUCCESS) {
+        return -1;
+    }
+    client[impl].aesni &= !impl;
+    server[impl].aesni &= !impl;
+    memset(payload, 'x', sizeof(payload));
+    for (int i = 0; i < BENCH_SIZES; ++i) {
+        bench_msg_t *msg = &msgs[impl][i];
+        msg->client = &client[impl];
+        msg->server = &server[impl];
+        memset(&pkt, 0, sizeof(pkt));
+        pkt.hdr.ver = 1;
+        pkt.hdr.t = COAP_TYPE_CON;
+        pkt.hdr.tkl = sizeof(tok);
+        pkt.hdr.code = COAP_METHOD_PUT;
+        pkt.hdr.id = 0x1234;
+        pkt.tok = (coap_buffer_t){ tok, sizeof(tok) };
+        coap_add_option(&pkt, COAP_OPTION_URI_HOST, (const uint8_t *)"example.com", 11);
+        coap_add_option(&pkt, COAP_OPTION_URI_PATH, (const uint8_t *)"sensors", 7);
+        coap_add_option(&pkt, COAP_OPTION_CONTENT_FORMAT, ct, sizeof(ct));
+        pkt.payload = (coap_buffer_t){ payload, sizes[i] };
+        msg->plainlen = sizeof(msg->plain);
+        if (coap_build(&pkt, msg->plain, &msg->plainlen) != COAP_SUCCESS) {
+            return -1;
+        }
+        memcpy(msg->protected, msg->plain, msg->plainlen);
+        msg->protectedlen = msg->plainlen;
+        if (coap_oscore_protect(&client[impl], msg->protected, &msg->protectedlen,
+                                sizeof(msg->protected), &req) != COAP_SUCCESS) {
+            return -1;
+        }
+        // the server gets the plain message back
+        size_t len = msg->protectedlen;
+        memcpy(msg->buf, msg->protected, len);
+        if ((coap_oscore_unprotect(&server[impl], msg->buf, &len, &req) != COAP_SUCCESS) ||
+            (len != msg->plainlen) || memcmp(msg->buf, msg->plain, len)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void _protect(void *arg)
+{
+    bench_msg_t *msg = arg;
+    coap_oscore_request_t req;
+    size_t len = msg->plainlen;
+
+    memcpy(msg->buf, msg->plain, len);
+    coap_oscore_protect(msg->client, msg->buf, &len, sizeof(msg->buf), &req);
+    sink += len;
+}
+
+static void _unprotect(void *arg)
+{
+    bench_msg_t *msg = arg;
+    coap_oscore_request_t req;
+    size_t len = msg->protectedlen;
+
+    memcpy(msg->buf, msg->protected, len);
+    msg->server->replay_init = false;
+    coap_oscore_unprotect(msg->server, msg->buf, &len, &req);
+    sink += len;
+}
+
+static double _throughput(bench_fn fn, bench_msg_t *msg, const size_t payload)
+{
+    const uint64_t start = bench_now_ns();
+    for (int i = 0; i < BENCH_THROUGHPUT; ++i) {
+        fn(msg);
+    }
+    return (double)payload * BENCH_THROUGHPUT * 1e3 / (double)(bench_now_ns() - start);
+}
+
+/* --- MAIN ----------------------------------------------------------------- */
+int main(int argc, char *argv[])
+{
+    static const char *impls[2] = { "aesni", "portable" };
+    static char names[2][BENCH_SIZES][2][32];
+    bench_config_t cfg;
+
+    if (bench_init(&cfg, argc, argv) < 0) {
+        return 1;
+    }
+    if (_init(0) || _init(1)) {
+        fprintf(stderr, "round trip failed\n");
+        return 1;
+    }
+    const int first = client[0].aesni ? 0 : 1;
+    if (first) {
+        fprintf(stderr, "no AES-NI, portable AES only\n");
+    }
+    for (int impl = first; impl < 2; ++impl) {
+        for (int i = 0; i < BENCH_SIZES; ++i) {
+            bench_msg_t *msg = &msgs[impl][i];
+            const double protect = _throughput(_protect, msg, sizes[i]);
+            const double unprotect = _throughput(_unprotect, msg, sizes[i]);
+            fprintf(stderr, "%s %4zu bytes: protect %7.1f MB/s, unprotect %7.1f MB/s, +%zu bytes\n",
+                    impls[impl], sizes[i], protect, unprotect, msg->protectedlen - msg->plainlen);
+        }
+    }
+    for (int impl = first; impl < 2; ++impl) {
+        for (int i = 0; i < BENCH_SIZES; ++i) {
+            snprintf(names[impl][i][0], sizeof(names[impl][i][0]), "protect/%zu/%s",
+                     sizes[i], impls[impl]);
+            snprintf(names[impl][i][1], sizeof(names[impl][i][1]), "unprotect/%zu/%s",
+                     sizes[i], impls[impl]);
+            bench_add(names[impl][i][0], _protect, &msgs[impl][i]);
+            bench_add(names[impl][i][1], _unprotect, &msgs[impl][i]);
+        }
+    }
+    bench_run(&cfg);
+    return 0;
+}
@@ -0,0 +1,148 @@
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "coap.h"
+#include "bench.h"
+
+/*
+ * Parse and build microbenchmarks over a corpus of datagrams, by default the
+ * fuzzing seed corpus, so odd inputs (extended option headers, truncations,
+ * long options) are timed next to the common ones.
+ */
+
+#define BENCH_MAX_INPUTS    256     //!< corpus files loaded
+#define BENCH_MAX_DGRAM     2048    //!< largest corpus file loaded
+
+typedef struct bench_input
+{
+    char name[48];
+    size_t len;
+    uint8_t data[BENCH_MAX_DGRAM];
+    coap_packet_t pkt;      //!< parsed packet, input to build
+    bool valid;             //!< coap_parse succeeded
+} bench_input_t;
+
+static bench_input_t inputs[BENCH_MAX_INPUTS];
+static size_t ninputs;
+static volatile int sink;
+
+/* --- PRIVATE -------------------------------------------------------------- */
+static int _cmp_input(const void *a, const void *b)
+{
+    return strcmp(((const bench_input_t *)a)->name, ((const bench_input_t *)b)->name);
+}
+
+static void _load_file(const char *file, const char *name)
+{
+    if (ninputs == BENCH_MAX_INPUTS) {
+        return;
+    }
+    FILE *f = fopen(file, "rb");
+    if (!f) {
+        perror(file);
+        return;
+    }
+    bench_input_t *in = &inputs[ninputs++];
+    snprintf(in->name, sizeof(in->name), "%s", name);
+    in->len = fread(in->data, 1, sizeof(in->data), f);
+    fclose(f);
+    in->valid = (coap_parse(in->data, in->len, &in->pkt) == COAP_SUCCESS);
+}
+
+static void _load(const char *path)
+{
+    struct stat st;
+    if (stat(path, &st)) {
+        perror(path);
+        return;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        const char *name = strrchr(path, '/');
+        _load_file(path, name ? name + 1 : path);
+        return;
+    }
+    DIR *dir = opendir(path);
+    struct dirent *ent;
+    while (dir && (ent = readdir(dir))) {
+        char file[1024];
+        if (ent->d_name[0] == '.') {
+            continue;
+        }
+        snprintf(file, sizeof(file), "%s/%s", path, ent->d_name);
+        _load_file(file, ent->d_name);
+    }
+    if (dir) {
+        closedir(dir);
+    }
+}
+
+static void _parse_one(void *arg)
+{
+    const bench_input_t *in = arg;
+    coap_packet_t pkt;
+    sink += coap_parse(in->data, in->len, &pkt);
+}
+
+static void _build_one(void *arg)
+{
+    const bench_input_t *in = arg;
+    uint8_t buf[BENCH_MAX_DGRAM];
+    size_t buflen = sizeof(buf);
+    sink += coap_build(&in->pkt, buf, &buflen);
+}
+
+static void _parse_all(void *arg)
+{
+    (void) arg;
+    for (size_t i = 0; i < ninputs; ++i) {
+        _parse_one(&inputs[i]);
+    }
+}
+
+static void _build_all(void *arg)
+{
+    (void) arg;
+    for (size_t i = 0; i < ninputs; ++i) {
+        if (inputs[i].valid) {
+            _build_one(&inputs[i]);
+        }
+    }
+}
+
+/* --- MAIN ----------------------------------------------------------------- */
+int main(int argc, char *argv[])
+{
+    bench_config_t cfg;
+    int first = bench_init(&cfg, argc, argv);
+    if (first < 0) {
+        return 1;
+    }
+    if (first == argc) {
+        _load("../fuzz/corpus");
+    }
+    for (int i = first; i < argc; ++i) {
+        _load(argv[i]);
+    }
+    if (!ninputs) {
+        fprintf(stderr, "%s: empty corpus\n", argv[0]);
+        return 1;
+    }
+    qsort(inputs, ninputs, sizeof(inputs[0]), _cmp_input);
+
+    bench_add("parse/corpus", _parse_all, NULL);
+    bench_add("build/corpus", _build_all, NULL);
+    for (size_t i = 0; i < ninputs; ++i) {
+        char name[64];
+        snprintf(name, sizeof(name), "parse/%.48s", inputs[i].name);
+        bench_add(name, _parse_one, &inputs[i]);
+        if (inputs[i].valid) {
+            snprintf(name, sizeof(name), "build/%.48s", inputs[i].name);
+            bench_add(name, _build_one, &inputs[i]);
+        }
+    }
+    bench_run(&cfg);
+    return 0;
+}
@@ -0,0 +1,203 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "coap.h"
+#include "coap_rd.h"
+#include "bench.h"
+
+/*
+ * coap_rd with BENCH_ENDPOINTS registered endpoints of four links each;
+ * every BENCH_RARE-th one also has a CO2 sensor. Lookups with an exact
+ * filter walk the index, the same lookups with a prefix filter, e.g.
+ * rt=co2*, find the same results by scanning all registrations; main()
+ * checks both agree. tick/ advances the clock one second, which visits one
+ * wheel slot. main() prints the registration and expiry rates and the
+ * memory used.
+ */
+
+#define BENCH_ENDPOINTS 100000  //!< registrations
+#define BENCH_RARE      1000    //!< every n-th endpoint has rt=co2
+#define BENCH_LIFETIME  10000000 //!< seconds, nothing expires while measuring
+
+typedef struct bench_lookup
+{
+    const char *path;       //!< rd-lookup/ep or rd-lookup/res
+    const char *query[2];   //!< filters, NULL terminated
+    bool all;               //!< all blocks, else the first
+} bench_lookup_t;
+
+static coap_rd_t rd;
+static uint32_t now = 1000;
+static volatile size_t sink;
+
+static const bench_lookup_t ep_indexed = { "ep", { "ep=node54321", NULL }, false };
+static const bench_lookup_t ep_scan = { "ep", { "ep=node54321*", NULL }, false };
+static const bench_lookup_t res_indexed = { "res", { "rt=co2", NULL }, false };
+static const bench_lookup_t res_scan = { "res", { "rt=co2*", NULL }, false };
+static const bench_lookup_t res_two = { "res", { "if=sensor", "ep=node777", }, false };
+static const bench_lookup_t res_all = { "res", { "rt=co2", NULL }, true };
+
+/* --- PRIVATE -------------------------------------------------------------- */
+static void _request(coap_packet_t *pkt, const coap_method_t method,
+                     const char *path1, const char *path2, const char *query[],
+                     const char *payload)
+{
+    static const uint8_t ct[1] = { COAP_CONTENTTYPE_APP_LINKFORMAT };
+    memset(pkt, 0, sizeof(*pkt));
+    pkt->hdr.ver = COAP_VERSION;
+    pkt->hdr.t = COAP_TYPE_CON;
+    pkt->hdr.code = method;
+    pkt->hdr.id = 1;
+    coap_add_option(pkt, COAP_OPTION_URI_PATH, (const uint8_t *)path1, strlen(path1));
+    if (path2) {
+        coap_add_option(pkt, COAP_OPTION_URI_PATH, (const uint8_t *)path2, strlen(path2));
+    }
+    for (int i = 0; query && query[i]; ++i) {
+        coap_add_option(pkt, COAP_OPTION_URI_QUERY, (const uint8_t *)query[i], strlen(query[i]));
+    }
+    if (payload) {
+        coap_add_option(pkt, COAP_OPTION_CONTENT_FORMAT, ct, sizeof(ct));
+        pkt->payload.p = (const uint8_t *)payload;
+        pkt->payload.len = strlen(payload);
+    }
+}
+
+static coap_responsecode_t _register(coap_rd_t *dir, const int i, const uint32_t lifetime)
+{
+    char ep[32], lt[32], doc[512];
+    const char *query[] = { ep, lt, NULL };
+    coap_packet_t req, rsp;
+
+    snprintf(ep, sizeof(ep), "ep=node%d", i);
+    snprintf(lt, sizeof(lt), "lt=%u", lifetime);
+    snprintf(doc, sizeof(doc),
+             "</temp>;rt=\"temperature-c\";if=\"sensor\";ct=0;obs,"
+             "</hum>;rt=\"humidity\";if=\"sensor\";ct=0,"
+             "</light>;rt=\"light-lux\";if=\"actuator\";ct=\"0 60\","
+             "</fw>;rt=\"firmware\";sz=262144%s",
+             (i % BENCH_RARE) ? "" : ",</co2>;rt=\"co2\";if=\"sensor\"");
+    _request(&req, COAP_METHOD_POST, "rd", NULL, query, doc);
+    coap_rd_handle_request(dir, &req, "coap://[2001:db8::1]:5683", &rsp);
+    return (coap_responsecode_t)rsp.hdr.code;
+}
+
+/* runs the lookup, returns the bytes of all blocks or of the first */
+static size_t _lookup(const bench_lookup_t *l)
+{
+    coap_packet_t req, rsp;
+    coap_block_t block = { 0, true, COAP_RD_BLOCK_SZX };
+    uint8_t opt[4];
+    size_t total = 0;
+
+    for (; block.more; ++block.num) {
+        _request(&req, COAP_METHOD_GET, "rd-lookup", l->path, (const char **)l->query, NULL);
+        if (block.num) {
+            coap_add_option(&req, COAP_OPTION_BLOCK2, opt,
+                            coap_encode_uint((block.num << 4) | block.szx, opt));
+        }
+        if ((coap_rd_handle_request(&rd, &req, NULL, &rsp) != COAP_RSP_SEND) ||
+            (rsp.hdr.code != COAP_RSPCODE_CONTENT)) {
+            return 0;
+        }
+        total += rsp.payload.len;
+        if (!l->all || (coap_get_block(&rsp, COAP_OPTION_BLOCK2, &block) != COAP_SUCCESS)) {
+            break;
+        }
+    }
+    return total;
+}
+
+static void _bench_lookup(void *arg)
+{
+    sink += _lookup(arg);
+}
+
+static void _bench_replace(void *arg)
+{
+    (void) arg;
+    sink += _register(&rd, 4242, BENCH_LIFETIME + 4242);
+}
+
+static void _bench_refresh(void *arg)
+{
+    static const char *query[] = { NULL };
+    coap_packet_t req, rsp;
+    (void) arg;
+    _request(&req, COAP_METHOD_POST, "rd", "4242", query, NULL);
+    coap_rd_handle_request(&rd, &req, NULL, &rsp);
+    sink += rsp.hdr.code;
+}
+
+static void _bench_tick(void *arg)
+{
+    (void) arg;
+    sink += coap_rd_tick(&rd, ++now);
+}
+
+/* expiry of \p n registrations, lifetimes spread over the wheel */
+static double _expire_ns(const int n)
+{
+    coap_rd_t dir;
+    coap_rd_init(&dir, n, 0);
+    for (int i = 0; i < n; ++i) {
+        _register(&dir, i, 1 + i % 3600);
+    }
+    const uint64_t start = bench_now_ns();
+    uint32_t removed = 0;
+    for (uint32_t t = 1; t <= 3600; ++t) {
+        removed += coap_rd_tick(&dir, t);
+    }
+    double ns = (double)(bench_now_ns() - start) / n;
+    if ((removed != (uint32_t)n) || dir.count) {
+        fprintf(stderr, "expired %u of %d\n", removed, n);
+        ns = -1;
+    }
+    coap_rd_free(&dir);
+    return ns;
+}
+
+/* --- MAIN ----------------------------------------------------------------- */
+int main(int argc, char *argv[])
+{
+    bench_config_t cfg;
+    if (bench_init(&cfg, argc, argv) < 0) {
+        return 1;
+    }
+    if (coap_rd_init(&rd, BENCH_ENDPOINTS, now) != COAP_SUCCESS) {
+        return 1;
+    }
+    const uint64_t start = bench_now_ns();
+    for (int i = 0; i < BENCH_ENDPOINTS; ++i) {
+        if (_register(&rd, i, BENCH_LIFETIME + i) != COAP_RSPCODE_CREATED) {
+            fprintf(stderr, "registration %d failed\n", i);
+            return 1;
+        }
+    }
+    const double reg_ns = (double)(bench_now_ns() - start) / BENCH_ENDPOINTS;
+    const size_t co2 = _lookup(&res_all);
+    if (!_lookup(&ep_indexed) || (_lookup(&ep_indexed) != _lookup(&ep_scan)) ||
+        !co2 || (_lookup(&res_indexed) != _lookup(&res_scan)) || !_lookup(&res_two)) {
+        fprintf(stderr, "mismatch: ep %zu %zu, res %zu %zu\n",
+                _lookup(&ep_indexed), _lookup(&ep_scan),
+                _lookup(&res_indexed), _lookup(&res_scan));
+        return 1;
+    }
+    fprintf(stderr, "%u registrations, %zu bytes, %zu per registration\n",
+            rd.count, rd.mem, rd.mem / rd.count);
+    fprintf(stderr, "register %.0f ns, expire %.0f ns per registration, rt=co2 %zu bytes\n",
+            reg_ns, _expire_ns(BENCH_ENDPOINTS), co2);
+
+    bench_add("lookup/ep/indexed", _bench_lookup, (void *)&ep_indexed);
+    bench_add("lookup/ep/scan", _bench_lookup, (void *)&ep_scan);
+    bench_add("lookup/res/indexed", _bench_lookup, (void *)&res_indexed);
+    bench_add("lookup/res/scan", _bench_lookup, (void *)&res_scan);
+    bench_add("lookup/res/two-filters", _bench_lookup, (void *)&res_two);
+    bench_add("transfer/res/all-blocks", _bench_lookup, (void *)&res_all);
+    bench_add("register/replace", _bench_replace, NULL);
+    bench_add("update/refresh", _bench_refresh, NULL);
+    bench_add("tick/second", _bench_tick, NULL);
+    bench_run(&cfg);
+    coap_rd_free(&rd);
+    return 0;
+}
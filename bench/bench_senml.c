@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "coap.h"
+#include "coap_senml.h"
+#include "bench.h"
+
+/*
+ * SenML packing and unpacking of sensor readings in datagram sized packs,
+ * JSON and CBOR. Metrics are ns per full datagram; main() reports how many
+ * records fit into one, with and without base values.
+ */
+
+#define BENCH_RECORDS   256     //!< readings available to pack
+#define BENCH_PAYLOAD   1024    //!< payload size of a datagram
+
+typedef struct bench_pack
+{
+    coap_content_type_t format;
+    uint8_t buf[BENCH_PAYLOAD];
+    size_t len;             //!< size of the first full pack
+    size_t count;           //!< records in it
+} bench_pack_t;
+
+static coap_senml_record_t readings[BENCH_RECORDS];
+static char names[BENCH_RECORDS][16];
+static char full_names[BENCH_RECORDS][48];
+static const coap_senml_base_t base = {
+    "urn:dev:ow:10e2073a01080063:", 1700000000.0, "Cel"
+};
+static bench_pack_t json = { COAP_CONTENTTYPE_APP_SENML_JSON, {0}, 0, 0 };
+static bench_pack_t cbor = { COAP_CONTENTTYPE_APP_SENML_CBOR, {0}, 0, 0 };
+static volatile size_t sink;
+
+/* --- PRIVATE -------------------------------------------------------------- */
+static size_t _fill(bench_pack_t *bp, const coap_senml_base_t *b, size_t *count)
+{
+    coap_senml_pack_t pack;
+    size_t n = 0;
+    coap_senml_pack_init(&pack, bp->format, b, bp->buf, sizeof(bp->buf));
+    while ((n < BENCH_RECORDS) &&
+           (coap_senml_pack_add(&pack, &readings[n]) == COAP_SUCCESS)) {
+        ++n;
+    }
+    *count = n;
+    return coap_senml_pack_finish(&pack);
+}
+
+static void _pack(void *arg)
+{
+    bench_pack_t *bp = arg;
+    size_t count;
+    sink += _fill(bp, &base, &count);
+}
+
+static void _unpack(void *arg)
+{
+    static coap_senml_record_t out[BENCH_RECORDS];
+    bench_pack_t *bp = arg;
+    coap_buffer_t payload = { bp->buf, bp->len };
+    size_t count = BENCH_RECORDS;
+    if (coap_senml_unpack(&payload, bp->format, out, &count) == COAP_SUCCESS) {
+        sink += count;
+    }
+}
+
+/* --- MAIN ----------------------------------------------------------------- */
+int main(int argc, char *argv[])
+{
+    bench_config_t cfg;
+    size_t plain_json, plain_cbor;
+    if (bench_init(&cfg, argc, argv) < 0) {
+        return 1;
+    }
+    for (int i = 0; i < BENCH_RECORDS; ++i) {
+        snprintf(names[i], sizeof(names[i]), "temp%d", i % 8);
+        readings[i].name.p = (const uint8_t *)names[i];
+        readings[i].name.len = strlen(names[i]);
+        readings[i].unit.p = (const uint8_t *)"Cel";
+        readings[i].unit.len = 3;
+        readings[i].kind = COAP_SENML_VALUE;
+        readings[i].value = 21.5 + (i % 13) * 0.25;
+        readings[i].time = base.time + i / 8;
+    }
+    // base values off: full names, units and absolute times in every record
+    coap_senml_base_t none = { NULL, 0, NULL };
+    for (int i = 0; i < BENCH_RECORDS; ++i) {
+        snprintf(full_names[i], sizeof(full_names[i]), "%.28s%.15s", base.name, names[i]);
+        readings[i].name.p = (const uint8_t *)full_names[i];
+        readings[i].name.len = strlen(full_names[i]);
+    }
+    _fill(&json, &none, &plain_json);
+    _fill(&cbor, &none, &plain_cbor);
+    for (int i = 0; i < BENCH_RECORDS; ++i) {
+        readings[i].name.p = (const uint8_t *)names[i];
+        readings[i].name.len = strlen(names[i]);
+    }
+    json.len = _fill(&json, &base, &json.count);
+    cbor.len = _fill(&cbor, &base, &cbor.count);
+    fprintf(stderr, "records per %d byte datagram: json %zu (%zu without base "
+            "values), cbor %zu (%zu)\n", BENCH_PAYLOAD, json.count, plain_json,
+            cbor.count, plain_cbor);
+
+    bench_add("pack/json", _pack, &json);
+    bench_add("pack/cbor", _pack, &cbor);
+    bench_add("unpack/json", _unpack, &json);
+    bench_add("unpack/cbor", _unpack, &cbor);
+    bench_run(&cfg);
+    return 0;
+}
@@ -0,0 +1,162 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "coap.h"
+#include "coap_ws.h"
+#include "bench.h"
+
+/*
+ * The per message work of the WebSocket transport without the sockets:
+ * unmasking client frames, with coap_ws_mask against the byte loop it
+ * replaces, and a whole request from the masked frame to the response frame
+ * (unmask, coap_parse_tcp, coap_handle_request, coap_build_tcp and the frame
+ * header). udp/ times the same request over coap_parse and coap_build for
+ * comparison.
+ */
+
+#define BENCH_LARGE     1024    //!< a block of payload
+
+typedef struct bench_mask
+{
+    uint8_t buf[BENCH_LARGE + 3];
+    size_t len;
+    size_t off;             //!< payload behind a frame header is unaligned
+} bench_mask_t;
+
+typedef struct bench_request
+{
+    uint8_t frame[256];     //!< masked as received
+    size_t framelen;
+    uint8_t udp[256];
+    size_t udplen;
+} bench_request_t;
+
+static const uint8_t key[4] = { 0x37, 0xfa, 0x21, 0x3d };
+static bench_mask_t small = { .len = 32, .off = 2 }, large = { .len = BENCH_LARGE, .off = 2 };
+static bench_request_t request;
+static volatile size_t sink;
+
+/* --- RESOURCES ------------------------------------------------------------ */
+static const coap_resource_path_t path_light = {1, {"light"}};
+
+static int handle_get_light(const coap_resource_t *resource,
+                            const coap_packet_t *inpkt,
+                            coap_packet_t *pkt)
+{
+    return coap_make_response(inpkt->hdr.id, &inpkt->tok,
+                              COAP_TYPE_ACK, COAP_RSPCODE_CONTENT,
+                              resource->content_type,
+                              (const uint8_t *)"1", 1, pkt);
+}
+
+static coap_resource_t resources[] =
+{
+    {COAP_RDY, COAP_METHOD_GET, COAP_TYPE_ACK,
+        handle_get_light, &path_light,
+        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_TXT_PLAIN), NULL},
+    {(coap_state_t)0, (coap_method_t)0, (coap_msgtype_t)0,
+        NULL, NULL,
+        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_NONE), NULL}
+};
+
+/* --- PRIVATE -------------------------------------------------------------- */
+static void _mask_bytewise(void *arg)
+{
+    bench_mask_t *m = arg;
+    uint8_t *p = m->buf + m->off;
+    for (size_t i = 0; i < m->len; ++i) {
+        p[i] ^= key[i & 3];
+    }
+    sink += p[0];
+}
+
+static void _mask_yacoap(void *arg)
+{
+    bench_mask_t *m = arg;
+    coap_ws_mask(m->buf + m->off, m->len, key);
+    sink += m->buf[m->off];
+}
+
+static void _request_ws(void *arg)
+{
+    bench_request_t *r = arg;
+    uint8_t in[256], out[256];
+    coap_ws_frame_t frame;
+    coap_packet_t pkt, rsp;
+    size_t msglen, outlen = sizeof(out) - 10;
+
+    memcpy(in, r->frame, r->framelen);
+    if ((coap_ws_parse_frame(in, r->framelen, true, &frame) != COAP_SUCCESS) ||
+        (coap_parse_tcp(frame.payload, frame.len, COAP_FRAMING_WS, &pkt, &msglen) != COAP_SUCCESS)) {
+        abort();
+    }
+    coap_handle_request(resources, &pkt, &rsp);
+    coap_build_tcp(&rsp, COAP_FRAMING_WS, out + 10, &outlen);
+    sink += coap_ws_frame_header(out, COAP_WS_BINARY, outlen) + outlen;
+}
+
+static void _request_udp(void *arg)
+{
+    bench_request_t *r = arg;
+    uint8_t out[256];
+    coap_packet_t pkt, rsp;
+    size_t outlen = sizeof(out);
+
+    if (coap_parse(r->udp, r->udplen, &pkt) != COAP_SUCCESS) {
+        abort();
+    }
+    coap_handle_request(resources, &pkt, &rsp);
+    coap_build(&rsp, out, &outlen);
+    sink += outlen;
+}
+
+static void _request_init(bench_request_t *r)
+{
+    static const uint8_t tok[] = { 0x12, 0x34, 0x56, 0x78 };
+    coap_packet_t pkt;
+    uint8_t msg[128];
+    size_t len = sizeof(msg);
+
+    memset(&pkt, 0, sizeof(pkt));
+    pkt.hdr.ver = COAP_VERSION;
+    pkt.hdr.t = COAP_TYPE_CON;
+    pkt.hdr.code = COAP_METHOD_GET;
+    pkt.hdr.id = 0x4242;
+    pkt.hdr.tkl = sizeof(tok);
+    pkt.tok.p = tok;
+    pkt.tok.len = sizeof(tok);
+    coap_add_option(&pkt, COAP_OPTION_URI_PATH, (const uint8_t *)"light", 5);
+    coap_build_tcp(&pkt, COAP_FRAMING_WS, msg, &len);
+    // masked client frame
+    r->framelen = coap_ws_frame_header(r->frame, COAP_WS_BINARY, len);
+    r->frame[1] |= 0x80;
+    memcpy(r->frame + r->framelen, key, 4);
+    memcpy(r->frame + r->framelen + 4, msg, len);
+    coap_ws_mask(r->frame + r->framelen + 4, len, key);
+    r->framelen += 4 + len;
+    r->udplen = sizeof(r->udp);
+    coap_build(&pkt, r->udp, &r->udplen);
+}
+
+/* --- MAIN ----------------------------------------------------------------- */
+int main(int argc, char *argv[])
+{
+    bench_config_t cfg;
+    if (bench_init(&cfg, argc, argv) < 0) {
+        return 1;
+    }
+    for (size_t i = 0; i < sizeof(large.buf); ++i) {
+        small.buf[i % sizeof(small.buf)] = large.buf[i] = (uint8_t)(i * 7);
+    }
+    _request_init(&request);
+
+    bench_add("mask/32/bytewise", _mask_bytewise, &small);
+    bench_add("mask/32/yacoap", _mask_yacoap, &small);
+    bench_add("mask/1024/bytewise", _mask_bytewise, &large);
+    bench_add("mask/1024/yacoap", _mask_yacoap, &large);
+    bench_add("request/ws", _request_ws, &request);
+    bench_add("request/udp", _request_udp, &request);
+    bench_run(&cfg);
+    return 0;
+}
@@ -0,0 +1,276 @@
+#define _GNU_SOURCE     // recvmmsg, sendmmsg
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/if_packet.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "coap.h"
+#include "coap_xdp.h"
+#include "bench.h"
+
+/*
+ * The AF_XDP server against a UDP socket served with recvmmsg and sendmmsg,
+ * on one end of a veth pair. A packet socket on the other end writes a
+ * burst of BURST requests as Ethernet frames, the server answers them and
+ * the packet socket reads the responses back; everything on the calling
+ * thread, so the metric is the CPU cost of a burst through each server,
+ * the packet socket side being the same for both. The UDP server has the
+ * XDP program in front of it, passing its port, as it would in production.
+ * Needs root and the interfaces, see the README:
+ *
+ *     ./bench_xdp [options] [served [peer]]    (vxdp0 and vxdp1 by default)
+ *
+ * Socket bound, so not part of the perf-check set.
+ */
+
+#define BURST       32
+#define UDP_PORT    5683
+#define XDP_PORT    5684
+
+typedef struct bench_server
+{
+    int udp;
+    coap_xdp_t xdp;
+} bench_server_t;
+
+static bench_server_t server;
+static int peer;                                // packet socket on the peer
+static uint8_t frames[2][BURST][128];           // requests to the UDP and the XDP port
+static size_t frame_len[2][BURST];
+static volatile size_t sink;
+
+static const uint8_t mac_client[6] = { 0x02, 0, 0, 0, 0, 0x01 };
+// RFC 2544 benchmarking addresses, nothing else routes them
+static const uint8_t ip_client[4] = { 198, 18, 0, 1 };
+static const uint8_t ip_server[4] = { 198, 18, 0, 2 };
+
+/* --- RESOURCES ------------------------------------------------------------ */
+static const coap_resource_path_t path_light = {1, {"light"}};
+
+static int handle_get_light(const coap_resource_t *resource,
+                            const coap_packet_t *inpkt,
+                            coap_packet_t *pkt)
+{
+    return coap_make_response(inpkt->hdr.id, &inpkt->tok, COAP_TYPE_ACK,
+                              COAP_RSPCODE_CONTENT, resource->content_type,
+                              (const uint8_t *)"on", 2, pkt);
+}
+
+static coap_resource_t resources[] =
+{
+    {COAP_RDY, COAP_METHOD_GET, COAP_TYPE_ACK, handle_get_light, &path_light,
+        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_TXT_PLAIN), NULL},
+    {(coap_state_t)0, (coap_method_t)0, (coap_msgtype_t)0, NULL, NULL,
+        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_NONE), NULL}
+};
+
+/* --- HELPERS -------------------------------------------------------------- */
+static uint32_t _sum(const uint8_t *p, const size_t len, uint32_t sum)
+{
+    for (size_t i = 0; i < len; i += 2) {
+        sum += (uint32_t)(p[i] << 8 | ((i + 1 < len) ? p[i + 1] : 0));
+    }
+    return sum;
+}
+
+static uint16_t _fold(uint32_t sum)
+{
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return (uint16_t)~sum;
+}
+
+/* IPv4 frames with correct checksums, the kernel checks them for the UDP server */
+static size_t _frame(uint8_t *frame, const uint8_t *mac_server, const uint16_t port,
+                     const uint16_t id)
+{
+    static const uint8_t tok[] = { 0x12, 0x34, 0x56, 0x78 };
+    uint8_t *ip = frame + 14, *udp = ip + 20;
+    coap_packet_t pkt;
+    size_t coaplen = 64;
+
+    memset(&pkt, 0, sizeof(pkt));
+    pkt.hdr.ver = COAP_VERSION;
+    pkt.hdr.t = COAP_TYPE_CON;
+    pkt.hdr.code = COAP_METHOD_GET;
+    pkt.hdr.id = id;
+    pkt.hdr.tkl = sizeof(tok);
+    pkt.tok.p = tok;
+    pkt.tok.len = sizeof(tok);
+    coap_add_option(&pkt, COAP_OPTION_URI_PATH, (const uint8_t *)"light", 5);
+    coap_build(&pkt, udp + 8, &coaplen);
+
+    const uint16_t udplen = (uint16_t)(8 + coaplen);
+    memcpy(frame, mac_server, 6);
+    memcpy(frame + 6, mac_client, 6);
+    frame[12] = 0x08;
+    frame[13] = 0x00;
+    memset(ip, 0, 20);
+    ip[0] = 0x45;
+    ip[2] = (uint8_t)((20 + udplen) >> 8);
+    ip[3] = (uint8_t)(20 + udplen);
+    ip[8] = 64;
+    ip[9] = IPPROTO_UDP;
+    memcpy(ip + 12, ip_client, 4);
+    memcpy(ip + 16, ip_server, 4);
+    const uint16_t ipsum = _fold(_sum(ip, 20, 0));
+    ip[10] = (uint8_t)(ipsum >> 8);
+    ip[11] = (uint8_t)ipsum;
+    udp[0] = 40000 >> 8;
+    udp[1] = 40000 & 0xff;
+    udp[2] = (uint8_t)(port >> 8);
+    udp[3] = (uint8_t)port;
+    udp[4] = (uint8_t)(udplen >> 8);
+    udp[5] = (uint8_t)udplen;
+    udp[6] = udp[7] = 0;
+    uint16_t sum = _fold(_sum(udp, udplen, _sum(ip + 12, 8, IPPROTO_UDP + udplen)));
+    sum = sum ? sum : 0xffff;
+    udp[6] = (uint8_t)(sum >> 8);
+    udp[7] = (uint8_t)sum;
+    return 34 + udplen;
+}
+
+static void _send_burst(const int which)
+{
+    for (size_t i = 0; i < BURST; ++i) {
+        if (send(peer, frames[which][i], frame_len[which][i], 0) < 0) {
+            abort();
+        }
+    }
+}
+
+/* the responses back on the peer */
+static void _recv_burst(void)
+{
+    uint8_t buf[2048];
+
+    for (size_t got = 0; got < BURST; ) {
+        struct pollfd p = { peer, POLLIN, 0 };
+        const ssize_t n = recv(peer, buf, sizeof(buf), MSG_DONTWAIT);
+        if (n > 0) {
+            got += memcmp(buf, mac_client, 6) == 0;
+            sink += (size_t)n;
+        }
+        else if (poll(&p, 1, 1000) <= 0) {
+            fprintf(stderr, "responses lost\n");
+            exit(1);
+        }
+    }
+}
+
+/* the UDP server, a burst at a time */
+static void _burst_udp(void *arg)
+{
+    static uint8_t bufs[BURST][COAP_XDP_DGRAM_SIZE], out[BURST][COAP_XDP_DGRAM_SIZE];
+    struct mmsghdr in[BURST], rsp[BURST];
+    struct iovec iov[BURST], oiov[BURST];
+    struct sockaddr_in addrs[BURST];
+    bench_server_t *s = arg;
+
+    _send_burst(0);
+    for (size_t done = 0; done < BURST; ) {
+        for (size_t i = 0; i < BURST; ++i) {
+            iov[i] = (struct iovec){ bufs[i], sizeof(bufs[i]) };
+            in[i].msg_hdr = (struct msghdr){ .msg_name = &addrs[i], .msg_namelen = sizeof(addrs[i]),
+                                             .msg_iov = &iov[i], .msg_iovlen = 1 };
+        }
+        const int n = recvmmsg(s->udp, in, BURST, MSG_WAITFORONE, NULL);
+        if (n <= 0) {
+            abort();
+        }
+        for (int i = 0; i < n; ++i) {
+            coap_packet_t pkt, reply;
+            size_t len = sizeof(out[i]);
+
+            if (coap_parse(bufs[i], in[i].msg_len, &pkt) != COAP_SUCCESS) {
+                len = 0;
+            }
+            else {
+                coap_handle_request(resources, &pkt, &reply);
+                coap_build(&reply, out[i], &len);
+            }
+            oiov[i] = (struct iovec){ out[i], len };
+            rsp[i].msg_hdr = (struct msghdr){ .msg_name = &addrs[i],
+                                              .msg_namelen = in[i].msg_hdr.msg_namelen,
+                                              .msg_iov = &oiov[i], .msg_iovlen = 1 };
+        }
+        sendmmsg(s->udp, rsp, (unsigned)n, 0);
+        done += (size_t)n;
+    }
+    _recv_burst();
+}
+
+static void _burst_xdp(void *arg)
+{
+    bench_server_t *s = arg;
+
+    _send_burst(1);
+    for (size_t done = 0; done < BURST; ) {
+        struct pollfd p = { s->xdp.fd, POLLIN, 0 };
+        const size_t n = coap_xdp_process(&s->xdp);
+        if (!n && (poll(&p, 1, 1000) <= 0)) {
+            fprintf(stderr, "requests lost\n");
+            exit(1);
+        }
+        done += n;
+    }
+    _recv_burst();
+}
+
+/* --- MAIN ----------------------------------------------------------------- */
+int main(int argc, char *argv[])
+{
+    bench_config_t cfg;
+    struct ifreq ifr;
+
+    const int args = bench_init(&cfg, argc, argv);
+    if (args < 0) {
+        return 1;
+    }
+    const char *served = (args < argc) ? argv[args] : "vxdp0";
+    const char *name = (args + 1 < argc) ? argv[args + 1] : "vxdp1";
+    const unsigned ifindex = if_nametoindex(served);
+
+    // frames go to the MAC of the served end, or the kernel drops them
+    server.udp = socket(AF_INET, SOCK_DGRAM, 0);
+    memset(&ifr, 0, sizeof(ifr));
+    snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", served);
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(UDP_PORT) };
+    memcpy(&addr.sin_addr, ip_server, 4);
+    struct sockaddr_ll sll = { .sll_family = AF_PACKET, .sll_protocol = htons(0x0800),
+                               .sll_ifindex = (int)if_nametoindex(name) };
+    peer = socket(AF_PACKET, SOCK_RAW, htons(0x0800));
+    if (!ifindex || (server.udp < 0) || (peer < 0) ||
+        (ioctl(server.udp, SIOCGIFHWADDR, &ifr) < 0) ||
+        (bind(server.udp, (struct sockaddr *)&addr, sizeof(addr)) < 0) ||
+        (bind(peer, (struct sockaddr *)&sll, sizeof(sll)) < 0) ||
+        (coap_xdp_init(&server.xdp, ifindex, 0, XDP_PORT, resources) != COAP_SUCCESS)) {
+        fprintf(stderr, "no veth pair %s/%s set up as in the README, or not root\n",
+                served, name);
+        return 1;
+    }
+    for (uint16_t i = 0; i < BURST; ++i) {
+        frame_len[0][i] = _frame(frames[0][i], (uint8_t *)ifr.ifr_hwaddr.sa_data, UDP_PORT, i);
+        frame_len[1][i] = _frame(frames[1][i], (uint8_t *)ifr.ifr_hwaddr.sa_data, XDP_PORT, i);
+    }
+
+    bench_add("burst32/recvmmsg", _burst_udp, &server);
+    bench_add("burst32/xdp", _burst_xdp, &server);
+    bench_run(&cfg);
+
+    fprintf(stderr, "xdp: %u requests, %u responses, %u dropped, %u unserved\n",
+            server.xdp.requests, server.xdp.responses, server.xdp.dropped,
+            server.xdp.unserved);
+    coap_xdp_free(&server.xdp);
+    close(server.udp);
+    close(peer);
+    return 0;
+}
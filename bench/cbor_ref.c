@@ -0,0 +1,257 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "cbor_ref.h"
+
+typedef struct ref_buf
+{
+    uint8_t *p;
+    size_t len;
+    size_t cap;
+} ref_buf_t;
+
+/* --- PRIVATE -------------------------------------------------------------- */
+static void _put(ref_buf_t *b, const void *data, size_t len)
+{
+    if (b->len + len > b->cap) {
+        b->cap = (b->cap ? 2 * b->cap : 64) + len;
+        b->p = realloc(b->p, b->cap);
+    }
+    memcpy(b->p + b->len, data, len);
+    b->len += len;
+}
+
+static void _put_head(ref_buf_t *b, uint8_t major, uint64_t value)
+{
+    uint8_t head[9];
+    size_t n;
+    if (value < 24) {
+        head[0] = (major << 5) | value;
+        n = 1;
+    }
+    else {
+        n = (value <= 0xFF) ? 2 : (value <= 0xFFFF) ? 3 :
+            (value <= 0xFFFFFFFF) ? 5 : 9;
+        head[0] = (major << 5) | ((n == 2) ? 24 : (n == 3) ? 25 : (n == 5) ? 26 : 27);
+        for (size_t i = 1; i < n; ++i) {
+            head[i] = (value >> (8 * (n - 1 - i))) & 0xFF;
+        }
+    }
+    _put(b, head, n);
+}
+
+static void _encode(ref_buf_t *b, const ref_node_t *node)
+{
+    uint8_t byte;
+    switch (node->type) {
+    case REF_UINT:
+        _put_head(b, 0, node->u);
+        break;
+    case REF_NEGINT:
+        _put_head(b, 1, node->u);
+        break;
+    case REF_BYTES:
+    case REF_TEXT:
+        _put_head(b, (node->type == REF_BYTES) ? 2 : 3, node->len);
+        _put(b, node->str, node->len);
+        break;
+    case REF_ARRAY:
+    case REF_MAP:
+        _put_head(b, (node->type == REF_ARRAY) ? 4 : 5,
+                  (node->type == REF_ARRAY) ? node->len : node->len / 2);
+        for (size_t i = 0; i < node->len; ++i) {
+            _encode(b, node->items[i]);
+        }
+        break;
+    case REF_BOOL:
+        byte = node->u ? 0xF5 : 0xF4;
+        _put(b, &byte, 1);
+        break;
+    case REF_NULL:
+        byte = 0xF6;
+        _put(b, &byte, 1);
+        break;
+    case REF_FLOAT: {
+        uint64_t bits;
+        uint8_t out[9];
+        memcpy(&bits, &node->f, sizeof(bits));
+        out[0] = 0xFB;
+        for (int i = 1; i < 9; ++i) {
+            out[i] = (bits >> (8 * (8 - i))) & 0xFF;
+        }
+        _put(b, out, sizeof(out));
+        break;
+    }
+    }
+}
+
+static ref_node_t *_decode(const uint8_t *buf, size_t len, size_t *pos, int depth)
+{
+    if ((*pos >= len) || (depth > 16)) {
+        return NULL;
+    }
+    uint8_t ib = buf[(*pos)++];
+    uint8_t major = ib >> 5, ai = ib & 0x1F;
+    uint64_t value = ai;
+    if ((ai >= 24) && (ai <= 27)) {
+        size_t n = (size_t)1 << (ai - 24);
+        if (len - *pos < n) {
+            return NULL;
+        }
+        value = 0;
+        for (size_t i = 0; i < n; ++i) {
+            value = (value << 8) | buf[(*pos)++];
+        }
+    }
+    else if (ai > 27) {
+        return NULL;
+    }
+    ref_node_t *node = NULL;
+    switch (major) {
+    case 0:
+    case 1:
+        node = ref_new(major ? REF_NEGINT : REF_UINT);
+        node->u = value;
+        break;
+    case 2:
+    case 3:
+        if (value > len - *pos) {
+            return NULL;
+        }
+        node = ref_new((major == 2) ? REF_BYTES : REF_TEXT);
+        node->str = malloc(value + 1);
+        memcpy(node->str, buf + *pos, value);
+        node->str[value] = '\0';
+        node->len = value;
+        *pos += value;
+        break;
+    case 4:
+    case 5:
+        if (value > len - *pos) {
+            return NULL;
+        }
+        node = ref_new((major == 4) ? REF_ARRAY : REF_MAP);
+        for (uint64_t i = 0; i < ((major == 4) ? value : 2 * value); ++i) {
+            ref_node_t *item = _decode(buf, len, pos, depth + 1);
+            if (!item) {
+                ref_free(node);
+                return NULL;
+            }
+            ref_append(node, item);
+        }
+        break;
+    case 7:
+        if ((ai == 20) || (ai == 21)) {
+            node = ref_new(REF_BOOL);
+            node->u = (ai == 21);
+        }
+        else if (ai == 22) {
+            node = ref_new(REF_NULL);
+        }
+        else if (ai == 27) {
+            node = ref_new(REF_FLOAT);
+            memcpy(&node->f, &value, sizeof(node->f));
+        }
+        else if (ai == 25) {
+            // half precision, https://tools.ietf.org/html/rfc8949#appendix-D
+            int exp = (value >> 10) & 0x1F;
+            double mant = value & 0x3FF;
+            double f = (exp == 0) ? mant / 16777216.0 :
+                       (exp == 31) ? (mant ? 0.0 / 0.0 : 1.0 / 0.0) :
+                       (mant + 1024) * ((exp >= 25) ? (double)(1u << (exp - 25)) :
+                                        1.0 / (1u << (25 - exp)));
+            node = ref_new(REF_FLOAT);
+            node->f = (value & 0x8000) ? -f : f;
+        }
+        else if (ai == 26) {
+            uint32_t bits = (uint32_t)value;
+            float f;
+            memcpy(&f, &bits, sizeof(f));
+            node = ref_new(REF_FLOAT);
+            node->f = f;
+        }
+        break;
+    default:
+        break;
+    }
+    return node;
+}
+
+/* --- PUBLIC --------------------------------------------------------------- */
+ref_node_t *ref_new(ref_type_t type)
+{
+    ref_node_t *node = calloc(1, sizeof(*node));
+    node->type = type;
+    return node;
+}
+
+ref_node_t *ref_new_uint(uint64_t u)
+{
+    ref_node_t *node = ref_new(REF_UINT);
+    node->u = u;
+    return node;
+}
+
+ref_node_t *ref_new_float(double f)
+{
+    ref_node_t *node = ref_new(REF_FLOAT);
+    node->f = f;
+    return node;
+}
+
+ref_node_t *ref_new_text(const char *text)
+{
+    ref_node_t *node = ref_new(REF_TEXT);
+    node->len = strlen(text);
+    node->str = malloc(node->len + 1);
+    memcpy(node->str, text, node->len + 1);
+    return node;
+}
+
+void ref_append(ref_node_t *container, ref_node_t *item)
+{
+    container->items = realloc(container->items,
+                               (container->len + 1) * sizeof(*container->items));
+    container->items[container->len++] = item;
+}
+
+void ref_free(ref_node_t *node)
+{
+    if (!node) {
+        return;
+    }
+    if ((node->type == REF_ARRAY) || (node->type == REF_MAP)) {
+        for (size_t i = 0; i < node->len; ++i) {
+            ref_free(node->items[i]);
+        }
+    }
+    free(node->items);
+    free(node->str);
+    free(node);
+}
+
+uint8_t *ref_encode(const ref_node_t *node, size_t *len)
+{
+    ref_buf_t b = { NULL, 0, 0 };
+    _encode(&b, node);
+    *len = b.len;
+    return b.p;
+}
+
+ref_node_t *ref_decode(const uint8_t *buf, size_t len)
+{
+    size_t pos = 0;
+    return _decode(buf, len, &pos, 0);
+}
+
+const ref_node_t *ref_map_get(const ref_node_t *map, const char *key)
+{
+    size_t keylen = strlen(key);
+    for (size_t i = 0; i + 1 < map->len; i += 2) {
+        const ref_node_t *k = map->items[i];
+        if ((k->type == REF_TEXT) && (k->len == keylen) && !memcmp(k->str, key, keylen)) {
+            return map->items[i + 1];
+        }
+    }
+    return NULL;
+}
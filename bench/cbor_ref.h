@@ -0,0 +1,54 @@
+#ifndef CBOR_REF_H
+#define CBOR_REF_H 1
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Reference CBOR implementation for bench_cbor, in the way general purpose
+ * libraries commonly work: decoding builds a tree of heap allocated nodes
+ * with copied strings, encoding serialises such a tree into a growing heap
+ * buffer. Definite lengths, integers, strings, arrays, maps, simple values
+ * and floats (always as double) only.
+ */
+
+typedef enum
+{
+    REF_UINT, REF_NEGINT, REF_BYTES, REF_TEXT, REF_ARRAY, REF_MAP,
+    REF_BOOL, REF_NULL, REF_FLOAT,
+} ref_type_t;
+
+typedef struct ref_node
+{
+    ref_type_t type;
+    uint64_t u;                 //!< integer, -1 - u for REF_NEGINT, bool
+    double f;                   //!< REF_FLOAT
+    uint8_t *str;               //!< copied string content
+    size_t len;                 //!< string length, or number of children
+    struct ref_node **items;    //!< children, key and value alternating for maps
+} ref_node_t;
+
+ref_node_t *ref_new(ref_type_t type);
+ref_node_t *ref_new_uint(uint64_t u);
+ref_node_t *ref_new_float(double f);
+ref_node_t *ref_new_text(const char *text);
+void ref_append(ref_node_t *container, ref_node_t *item);
+void ref_free(ref_node_t *node);
+
+/**
+ * @brief Serialise \p node, the result is malloc'ed
+ */
+uint8_t *ref_encode(const ref_node_t *node, size_t *len);
+
+/**
+ * @brief Decode one item, NULL on errors
+ */
+ref_node_t *ref_decode(const uint8_t *buf, size_t len);
+
+/**
+ * @brief Look up a text key in a map node
+ */
+const ref_node_t *ref_map_get(const ref_node_t *map, const char *key);
+
+#endif
@@ -7,42 +7,28 @@
 #include <arpa/inet.h>
 
 #include "coap.h"
+#include "coap_trace.h"
+#include "coap_metrics.h"
+
+#if YACOAP_USDT
+COAP_TRACE_SEMAPHORE_DEFINE(receive);
+COAP_TRACE_SEMAPHORE_DEFINE(parse);
+COAP_TRACE_SEMAPHORE_DEFINE(dispatch);
+COAP_TRACE_SEMAPHORE_DEFINE(handler_start);
+COAP_TRACE_SEMAPHORE_DEFINE(handler_end);
+COAP_TRACE_SEMAPHORE_DEFINE(build);
+COAP_TRACE_SEMAPHORE_DEFINE(send);
+#endif /* YACOAP_USDT */
 
 /* --- PRIVATE -------------------------------------------------------------- */
-static const coap_option_t *_find_options(const coap_packet_t *pkt,
-                                          const coap_option_num_t num,
-                                          uint8_t *count);
 static void _option_decode(const uint32_t value, uint8_t *delta);
-
-/*
- * options are always stored consecutively,
- * so can return a block with same option num
- */
-static const coap_option_t *_find_options(const coap_packet_t *pkt,
-                                          const coap_option_num_t num,
-                                          uint8_t *count)
-{
-    const coap_option_t * first = NULL;
-    /* loop through packet opts */
-    *count = 0;
-    for (size_t i = 0; i < pkt->numopts; ++i) {
-        if (pkt->opts[i].num == num) {
-            if (!first) {
-                first = &pkt->opts[i];
-            }
-            (*count)++;
-        }
-        /* options are ordered by num, skip if greater */
-        else if (pkt->opts[i].num > num) {
-            break;
-        }
-        /* single block for same option num, skip on first match */
-        else if (first) {
-            break;
-        }
-    }
-    return first;
-}
+static coap_state_t _build(const coap_packet_t *pkt,
+                           uint8_t *buf, size_t *buflen);
+static int _call_handler(const coap_resource_t *rs,
+                         const coap_packet_t *inpkt, coap_packet_t *pkt);
+#if YACOAP_USDT
+static uint32_t _path_hash(const coap_option_t *opt, const uint8_t count);
+#endif /* YACOAP_USDT */
 
 /* https://tools.ietf.org/html/rfc7252#section-3.1 */
 static void _option_decode(const uint32_t value, uint8_t *delta)
@@ -56,41 +42,75 @@ static void _option_decode(const uint32_t value, uint8_t *delta)
     else if (value <= 0xFFFF+269) {
         *delta = 14;
     }
+    else {
+        *delta = 15;    // not encodable
+    }
 }
 
-/* --- PUBLIC --------------------------------------------------------------- */
-coap_state_t coap_build(const coap_packet_t *pkt, uint8_t *buf, size_t *buflen)
+#if YACOAP_USDT
+/*
+ * FNV-1a over the Uri-Path segments, each one prefixed by '/', as passed
+ * to the trace probes, e.g. "/.well-known/core"
+ */
+static uint32_t _path_hash(const coap_option_t *opt, const uint8_t count)
 {
-    // build header
-    if (*buflen < (sizeof(coap_raw_header_t) + pkt->hdr.tkl)) {
-        return COAP_ERR_BUFFER_TOO_SMALL;
+    uint32_t hash = 2166136261u;
+    for (uint8_t i = 0; i < count; ++i) {
+        hash = (hash ^ '/') * 16777619u;
+        for (size_t j = 0; j < opt[i].buf.len; ++j) {
+            hash = (hash ^ opt[i].buf.p[j]) * 16777619u;
+        }
     }
-    coap_raw_header_t *r = (coap_raw_header_t *)buf;
-    r->hdr.ver = pkt->hdr.ver;
-    r->hdr.t = pkt->hdr.t;
-    r->hdr.tkl = pkt->hdr.tkl;
-    r->hdr.code = pkt->hdr.code;
-    r->hdr.id = htons(pkt->hdr.id);
-    // inject token
-    uint8_t *p = buf + sizeof(coap_raw_header_t);
-    if ((pkt->hdr.tkl > 0) && (pkt->hdr.tkl != pkt->tok.len)) {
-        return COAP_ERR_UNSUPPORTED;
+    return hash;
+}
+#endif /* YACOAP_USDT */
+
+/*
+ * Calls the handler of \p rs, or of the representation the request accepts
+ */
+static int _call_handler(const coap_resource_t *rs,
+                         const coap_packet_t *inpkt, coap_packet_t *pkt)
+{
+    if (!rs->reps) {
+        return rs->handler(rs, inpkt, pkt);
     }
-    if (pkt->hdr.tkl > 0) {
-        memcpy(p, pkt->tok.p, pkt->hdr.tkl);
+    const int rep = coap_select_representation(rs, inpkt);
+    if (rep < 0) {
+        return coap_make_response(inpkt->hdr.id, &inpkt->tok,
+                                  rs->msg_type, COAP_RSPCODE_NOT_ACCEPTABLE,
+                                  NULL, NULL, 0, pkt);
     }
-    p += pkt->hdr.tkl;
-    // inject options, http://tools.ietf.org/html/rfc7252#section-3.1
+    return rs->reps->handler[rep](rs, inpkt, pkt);
+}
+
+// options and payload, http://tools.ietf.org/html/rfc7252#section-3.1
+// inlined into both builders, it is the hot path
+static inline __attribute__((always_inline))
+coap_state_t _build_options_payload(const coap_packet_t *pkt,
+                                    uint8_t **buf, const uint8_t *end)
+{
+    uint8_t *p = *buf;
     uint16_t running_delta = 0;
     for (size_t i = 0; i < pkt->numopts; ++i) {
-        if (((size_t)(p - buf)) > *buflen) {
-            return COAP_ERR_BUFFER_TOO_SMALL;
+        const size_t optlen = pkt->opts[i].buf.len;
+        // options must be sorted by number
+        if (pkt->opts[i].num < running_delta) {
+            return COAP_ERR_OPTION_DELTA_INVALID;
         }
         uint32_t optDelta = pkt->opts[i].num - running_delta;
         uint8_t delta = 0;
         _option_decode(optDelta, &delta);
         uint8_t len = 0;
-        _option_decode((uint32_t)pkt->opts[i].buf.len, &len);
+        _option_decode((optlen > 0xFFFF+269) ? 0xFFFFFFFF : (uint32_t)optlen, &len);
+        if (len == 15) {
+            return COAP_ERR_OPTION_TOO_BIG;
+        }
+        // header byte, up to 2+2 extended bytes and the value
+        size_t need = 1 + (delta == 13) + 2 * (delta == 14) +
+                      (len == 13) + 2 * (len == 14) + optlen;
+        if ((size_t)(end - p) < need) {
+            return COAP_ERR_BUFFER_TOO_SMALL;
+        }
 
         *p++ = (0xFF & (delta << 4 | len));
         if (delta == 13) {
@@ -101,34 +121,177 @@ coap_state_t coap_build(const coap_packet_t *pkt, uint8_t *buf, size_t *buflen)
             *p++ = (0xFF & (optDelta-269));
         }
         if (len == 13) {
-            *p++ = (pkt->opts[i].buf.len - 13);
+            *p++ = (optlen - 13);
         }
         else if (len == 14) {
-            *p++ = (pkt->opts[i].buf.len >> 8);
-            *p++ = (0xFF & (pkt->opts[i].buf.len-269));
+            *p++ = ((optlen-269) >> 8);
+            *p++ = (0xFF & (optlen-269));
         }
 
-        memcpy(p, pkt->opts[i].buf.p, pkt->opts[i].buf.len);
-        p += pkt->opts[i].buf.len;
+        if (optlen > 0) {
+            memcpy(p, pkt->opts[i].buf.p, optlen);
+        }
+        p += optlen;
         running_delta = pkt->opts[i].num;
     }
-    // calc number of bytes used by options
-    size_t opts_len = (p - buf) - sizeof(coap_raw_header_t);
     if (pkt->payload.len > 0) {
-        if (*buflen < sizeof(coap_raw_header_t) + 1 + pkt->payload.len + opts_len) {
+        if ((size_t)(end - p) < 1 + pkt->payload.len) {
             return COAP_ERR_BUFFER_TOO_SMALL;
         }
-        buf[sizeof(coap_raw_header_t) + opts_len] = 0xFF;  // payload marker
-        memcpy(buf + sizeof(coap_raw_header_t) + opts_len + 1,
-               pkt->payload.p, pkt->payload.len);
-        *buflen = sizeof(coap_raw_header_t) + opts_len + 1 + pkt->payload.len;
+        *p++ = 0xFF;  // payload marker
+        memcpy(p, pkt->payload.p, pkt->payload.len);
+        p += pkt->payload.len;
+    }
+    *buf = p;
+    return COAP_SUCCESS;
+}
+
+static coap_state_t _build(const coap_packet_t *pkt,
+                           uint8_t *buf, size_t *buflen)
+{
+    // build header
+    if (*buflen < (sizeof(coap_raw_header_t) + pkt->hdr.tkl)) {
+        return COAP_ERR_BUFFER_TOO_SMALL;
+    }
+    if ((pkt->hdr.tkl > COAP_MAX_TOKLEN) ||
+        ((pkt->hdr.tkl > 0) && (pkt->hdr.tkl != pkt->tok.len))) {
+        return COAP_ERR_UNSUPPORTED;
+    }
+    // byte wise, buf may be unaligned
+    buf[0] = (pkt->hdr.ver & 0x03) << 6 | (pkt->hdr.t & 0x03) << 4 |
+             (pkt->hdr.tkl & 0x0F);
+    buf[1] = pkt->hdr.code;
+    buf[2] = pkt->hdr.id >> 8;
+    buf[3] = pkt->hdr.id & 0xFF;
+    // inject token
+    uint8_t *p = buf + sizeof(coap_raw_header_t);
+    if (pkt->hdr.tkl > 0) {
+        memcpy(p, pkt->tok.p, pkt->hdr.tkl);
+    }
+    p += pkt->hdr.tkl;
+    coap_state_t rc = _build_options_payload(pkt, &p, buf + *buflen);
+    if (rc) {
+        return rc;
+    }
+    *buflen = p - buf;
+    return COAP_SUCCESS;
+}
+
+// https://tools.ietf.org/html/rfc8323#section-3.2
+static coap_state_t _build_tcp(const coap_packet_t *pkt, const coap_framing_t framing,
+                               uint8_t *buf, size_t *buflen)
+{
+    // Len and code, for TCP framing room for 4 extended length bytes
+    const size_t room = (framing == COAP_FRAMING_WS) ? 2 : 6;
+    if (*buflen < room + pkt->hdr.tkl) {
+        return COAP_ERR_BUFFER_TOO_SMALL;
+    }
+    if ((pkt->hdr.tkl > COAP_MAX_TOKLEN) ||
+        ((pkt->hdr.tkl > 0) && (pkt->hdr.tkl != pkt->tok.len))) {
+        return COAP_ERR_UNSUPPORTED;
+    }
+    uint8_t *body = buf + room + pkt->hdr.tkl, *p = body;
+    coap_state_t rc = _build_options_payload(pkt, &p, buf + *buflen);
+    if (rc) {
+        return rc;
+    }
+    const size_t len = p - body;
+    uint8_t head[6];
+    size_t headlen = 1;
+    if (framing == COAP_FRAMING_WS) {
+        head[0] = 0;
+    }
+    else if (len < 13) {
+        head[0] = len << 4;
+    }
+    else if (len < 269) {
+        head[0] = 13 << 4;
+        head[headlen++] = len - 13;
+    }
+    else if (len < 65805) {
+        head[0] = 14 << 4;
+        head[headlen++] = (len - 269) >> 8;
+        head[headlen++] = (len - 269) & 0xFF;
     }
     else {
-        *buflen = opts_len + sizeof(coap_raw_header_t);
+        head[0] = 15 << 4;
+        head[headlen++] = (len - 65805) >> 24;
+        head[headlen++] = ((len - 65805) >> 16) & 0xFF;
+        head[headlen++] = ((len - 65805) >> 8) & 0xFF;
+        head[headlen++] = (len - 65805) & 0xFF;
+    }
+    head[0] |= pkt->hdr.tkl & 0x0F;
+    head[headlen++] = pkt->hdr.code;
+    // the length is known now, close the gap to the options
+    if (headlen < room) {
+        memmove(buf + headlen + pkt->hdr.tkl, body, len);
     }
+    memcpy(buf, head, headlen);
+    if (pkt->hdr.tkl > 0) {
+        memcpy(buf + headlen, pkt->tok.p, pkt->hdr.tkl);
+    }
+    *buflen = headlen + pkt->hdr.tkl + len;
     return COAP_SUCCESS;
 }
 
+/* --- PUBLIC --------------------------------------------------------------- */
+/*
+ * options are always stored consecutively,
+ * so can return a block with same option num
+ */
+const coap_option_t *coap_find_options(const coap_packet_t *pkt,
+                                       const coap_option_num_t num,
+                                       uint8_t *count)
+{
+    const coap_option_t * first = NULL;
+    /* loop through packet opts */
+    *count = 0;
+    for (size_t i = 0; i < pkt->numopts; ++i) {
+        if (pkt->opts[i].num == num) {
+            if (!first) {
+                first = &pkt->opts[i];
+            }
+            (*count)++;
+        }
+        /* options are ordered by num, skip if greater */
+        else if (pkt->opts[i].num > num) {
+            break;
+        }
+        /* single block for same option num, skip on first match */
+        else if (first) {
+            break;
+        }
+    }
+    return first;
+}
+
+coap_state_t coap_build(const coap_packet_t *pkt, uint8_t *buf, size_t *buflen)
+{
+    coap_state_t rc = _build(pkt, buf, buflen);
+    COAP_TRACE_BUILD(rc, pkt->hdr.id, pkt->hdr.code, (rc ? 0 : *buflen));
+    if (rc) {
+        COAP_METRICS_ERROR(COAP_METRIC_ERR_BUILD, rc);
+    }
+    else {
+        COAP_METRICS_INC(COAP_METRIC_BUILT);
+    }
+    return rc;
+}
+
+coap_state_t coap_build_tcp(const coap_packet_t *pkt, const coap_framing_t framing,
+                            uint8_t *buf, size_t *buflen)
+{
+    coap_state_t rc = _build_tcp(pkt, framing, buf, buflen);
+    COAP_TRACE_BUILD(rc, 0, pkt->hdr.code, (rc ? 0 : *buflen));
+    if (rc) {
+        COAP_METRICS_ERROR(COAP_METRIC_ERR_BUILD, rc);
+    }
+    else {
+        COAP_METRICS_INC(COAP_METRIC_BUILT);
+    }
+    return rc;
+}
+
 coap_state_t coap_make_request(const uint16_t msgid,
                                const coap_buffer_t* tok,
                                const coap_resource_t *resource,
@@ -180,7 +343,9 @@ coap_state_t coap_make_request(const uint16_t msgid,
 
 coap_state_t coap_make_ack(const coap_packet_t *inpkt, coap_packet_t *pkt)
 {
+#if YACOAP_DEBUG
     printf("coap_make_ack\n");
+#endif
     return coap_make_response(inpkt->hdr.id, &inpkt->tok,
                               COAP_TYPE_ACK, COAP_RSPCODE_EMPTY,
                               NULL, NULL, 0, pkt);
@@ -220,13 +385,22 @@ coap_state_t coap_make_response(const uint16_t msgid,
     return COAP_RSP_SEND;
 }
 
-coap_state_t coap_handle_request(coap_resource_t *resources,
-                                 const coap_packet_t *inpkt,
-                                 coap_packet_t *pkt)
+// both entry points, the one without ACL has no check compiled in
+static inline __attribute__((always_inline))
+coap_state_t _handle_request(coap_resource_t *resources, const coap_acl_mask_t *allow,
+                             const uint8_t principal, const coap_packet_t *inpkt,
+                             coap_packet_t *pkt)
 {
     uint8_t count;
     coap_responsecode_t rspcode = COAP_RSPCODE_NOT_IMPLEMENTED;
-    const coap_option_t *opt = _find_options(inpkt, COAP_OPTION_URI_PATH, &count);
+    const coap_option_t *opt = coap_find_options(inpkt, COAP_OPTION_URI_PATH, &count);
+    COAP_METRICS_INC(COAP_METRIC_REQUESTS);
+#if YACOAP_USDT
+    uint32_t hash = 0;
+    if (COAP_TRACE_ENABLED(dispatch) || COAP_TRACE_ENABLED(handler_start)) {
+        hash = _path_hash(opt, count);
+    }
+#endif /* YACOAP_USDT */
     // find handler for requested resource
     for (coap_resource_t *rs = resources; rs->handler && opt; ++rs) {
         if ((rs->method == inpkt->hdr.code) && (count == rs->path->count)){
@@ -240,11 +414,41 @@ coap_state_t coap_handle_request(coap_resource_t *resources,
                 }
             }
             if (i == count) { // matching resource found
+                COAP_TRACE_DISPATCH(inpkt->hdr.id, inpkt->hdr.code, hash,
+                                    (int)(rs - resources));
+                if (allow && !((principal < COAP_ACL_MAX_PRINCIPALS) &&
+                               ((allow[rs - resources] >> principal) & 1))) {
+                    COAP_METRICS_INC(COAP_METRIC_DENIED);
+                    return coap_make_response(inpkt->hdr.id, &inpkt->tok, COAP_TYPE_ACK,
+                                              principal ? COAP_RSPCODE_FORBIDDEN
+                                                        : COAP_RSPCODE_UNAUTHORIZED,
+                                              NULL, NULL, 0, pkt);
+                }
                 if ((inpkt->hdr.t == COAP_TYPE_CON) && (rs->msg_type != COAP_TYPE_ACK) && (rs->state != COAP_ACK_SEND)) { // no piggyback
                     rs->state = coap_make_ack(inpkt, pkt);
+                    COAP_METRICS_INC(COAP_METRIC_SEPARATE_ACKS);
                 }
                 else {
-                    rs->state = rs->handler(rs, inpkt, pkt);
+#if YACOAP_METRICS
+                    uint64_t start = COAP_METRICS_CLOCK();
+#endif /* YACOAP_METRICS */
+                    COAP_TRACE_HANDLER_START(inpkt->hdr.id, inpkt->hdr.code, hash);
+                    rs->state = _call_handler(rs, inpkt, pkt);
+                    COAP_TRACE_HANDLER_END(inpkt->hdr.id, rs->state,
+                                           pkt->hdr.code, pkt->payload.len);
+#if YACOAP_METRICS
+                    COAP_METRICS_OBSERVE(COAP_HIST_HANDLER_NS,
+                                         COAP_METRICS_CLOCK() - start);
+                    if ((pkt->hdr.code >> 5) == 2) {
+                        COAP_METRICS_INC(COAP_METRIC_RSP_2XX);
+                    }
+                    else if ((pkt->hdr.code >> 5) == 4) {
+                        COAP_METRICS_INC(COAP_METRIC_RSP_4XX);
+                    }
+                    else if ((pkt->hdr.code >> 5) == 5) {
+                        COAP_METRICS_INC(COAP_METRIC_RSP_5XX);
+                    }
+#endif /* YACOAP_METRICS */
                 }
                 return rs->state;
             }
@@ -254,11 +458,69 @@ coap_state_t coap_handle_request(coap_resource_t *resources,
             rspcode = COAP_RSPCODE_METHOD_NOT_ALLOWED;
         }
     }
+    COAP_TRACE_DISPATCH(inpkt->hdr.id, inpkt->hdr.code, hash, -1);
+    COAP_METRICS_INC(COAP_METRIC_NOT_FOUND);
     return coap_make_response(inpkt->hdr.id, &inpkt->tok,
                               COAP_TYPE_ACK, rspcode,
                               NULL, NULL, 0, pkt);
 }
 
+coap_state_t coap_handle_request(coap_resource_t *resources,
+                                 const coap_packet_t *inpkt,
+                                 coap_packet_t *pkt)
+{
+    return _handle_request(resources, NULL, 0, inpkt, pkt);
+}
+
+coap_state_t coap_handle_request_acl(coap_resource_t *resources,
+                                     const coap_acl_mask_t *allow,
+                                     const uint8_t principal,
+                                     const coap_packet_t *inpkt,
+                                     coap_packet_t *pkt)
+{
+    return _handle_request(resources, allow, principal, inpkt, pkt);
+}
+
+int coap_select_representation(const coap_resource_t *resource,
+                               const coap_packet_t *inpkt)
+{
+    const coap_representations_t *reps = resource->reps;
+    const uint64_t low = 0x7FFF7FFF7FFF7FFFull;
+    uint8_t count, accept[2], valid[8] = {0};
+    uint64_t lanes, mask, x, match;
+    uint16_t key;
+
+    const coap_option_t *opt = coap_find_options(inpkt, COAP_OPTION_ACCEPT, &count);
+    if (!opt) {
+        return 0;
+    }
+    const uint32_t ct = coap_decode_uint(&opt->buf);
+    if (ct > 0xFFFF) {
+        return -1;
+    }
+    // content types as 16 bit lanes of one word, in memory order, the
+    // Accept value repeated in each lane
+    accept[0] = ct >> 8;
+    accept[1] = ct & 0xFF;
+    memcpy(&key, accept, sizeof(key));
+    memcpy(&lanes, reps->content_type, sizeof(lanes));
+    count = (reps->count < COAP_MAX_REPRESENTATIONS) ?
+            reps->count : COAP_MAX_REPRESENTATIONS;
+    memset(valid, 0xFF, 2 * count);
+    memcpy(&mask, valid, sizeof(mask));
+    // sets the top bit of the lanes equal to the key, no carry crosses lanes
+    x = lanes ^ (key * 0x0001000100010001ull);
+    match = ~(((x & low) + low) | x | low) & mask;
+    if (!match) {
+        return -1;
+    }
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+    return __builtin_clzll(match) / 16;
+#else
+    return __builtin_ctzll(match) / 16;
+#endif
+}
+
 coap_state_t coap_handle_response(coap_resource_t *resources,
                                   const coap_packet_t *reqpkt,
                                   coap_packet_t *rsppkt)
@@ -272,7 +534,7 @@ coap_state_t coap_handle_response(coap_resource_t *resources,
     if (rsppkt->hdr.code >= COAP_RSPCODE_BAD_REQUEST)
         return COAP_ERR_RESPONSE;
     uint8_t count;
-    const coap_option_t *opt = _find_options(reqpkt, COAP_OPTION_URI_PATH, &count);
+    const coap_option_t *opt = coap_find_options(reqpkt, COAP_OPTION_URI_PATH, &count);
     // find handler for requested resource
     for (coap_resource_t *rs = resources; rs->handler && opt; ++rs) {
         if (count == rs->path->count) {
@@ -293,6 +555,101 @@ coap_state_t coap_handle_response(coap_resource_t *resources,
     return COAP_ERR_REQUEST_NOT_FOUND;
 }
 
+coap_state_t coap_add_option(coap_packet_t *pkt, const uint16_t num,
+                             const uint8_t *value, const size_t len)
+{
+    if (pkt->numopts >= COAP_MAX_OPTIONS) {
+        return COAP_ERR_BUFFER_TOO_SMALL;
+    }
+    // keep options ordered by number, insert after equal numbers
+    size_t i = pkt->numopts;
+    while ((i > 0) && (pkt->opts[i - 1].num > num)) {
+        pkt->opts[i] = pkt->opts[i - 1];
+        --i;
+    }
+    pkt->opts[i].num = num;
+    pkt->opts[i].buf.p = value;
+    pkt->opts[i].buf.len = len;
+    pkt->numopts++;
+    return COAP_SUCCESS;
+}
+
+size_t coap_encode_uint(const uint32_t value, uint8_t *buf)
+{
+    size_t len = 0;
+    // minimal length, https://tools.ietf.org/html/rfc7252#section-3.2
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        if (len || (value >> shift)) {
+            buf[len++] = 0xFF & (value >> shift);
+        }
+    }
+    return len;
+}
+
+uint32_t coap_decode_uint(const coap_buffer_t *buf)
+{
+    uint32_t value = 0;
+    for (size_t i = 0; (i < buf->len) && (i < 4); ++i) {
+        value = (value << 8) | buf->p[i];
+    }
+    return value;
+}
+
+coap_state_t coap_get_block(const coap_packet_t *pkt,
+                            const coap_option_num_t num,
+                            coap_block_t *block)
+{
+    uint8_t count;
+    const coap_option_t *opt = coap_find_options(pkt, num, &count);
+    if (!opt) {
+        return COAP_ERR_OPTION_NOT_FOUND;
+    }
+    if (opt->buf.len > 3) {
+        return COAP_ERR_OPTION_LEN_INVALID;
+    }
+    uint32_t value = coap_decode_uint(&opt->buf);
+    block->num = value >> 4;
+    block->more = (value & 0x08) != 0;
+    block->szx = value & 0x07;
+    // szx 7 is reserved, https://tools.ietf.org/html/rfc7959#section-2.2
+    if (block->szx > COAP_BLOCK_SZX_MAX) {
+        return COAP_ERR_OPTION_LEN_INVALID;
+    }
+    return COAP_SUCCESS;
+}
+
+coap_state_t coap_make_block2(const coap_packet_t *inpkt, const uint8_t szx,
+                              uint8_t *scratch, coap_packet_t *pkt)
+{
+    coap_block_t block = { 0, false, szx };
+    coap_state_t rc = coap_get_block(inpkt, COAP_OPTION_BLOCK2, &block);
+    if ((rc != COAP_SUCCESS) && (pkt->payload.len <= COAP_BLOCK_SIZE(szx))) {
+        return COAP_RSP_SEND;
+    }
+    size_t offset = block.num * COAP_BLOCK_SIZE(block.szx);
+    if (block.szx > szx) {
+        // smaller blocks than requested, renumber
+        block.szx = szx;
+        block.num = offset / COAP_BLOCK_SIZE(szx);
+    }
+    if ((rc == COAP_ERR_OPTION_LEN_INVALID) ||
+        ((offset >= pkt->payload.len) && (offset > 0))) {
+        pkt->hdr.code = COAP_RSPCODE_BAD_OPTION;
+        pkt->numopts = 0;
+        pkt->payload.p = NULL;
+        pkt->payload.len = 0;
+        return COAP_RSP_SEND;
+    }
+    size_t size = COAP_BLOCK_SIZE(block.szx);
+    block.more = (offset + size < pkt->payload.len);
+    pkt->payload.p += offset;
+    pkt->payload.len = block.more ? size : pkt->payload.len - offset;
+    uint32_t value = (block.num << 4) | (block.more << 3) | block.szx;
+    rc = coap_add_option(pkt, COAP_OPTION_BLOCK2, scratch,
+                         coap_encode_uint(value, scratch));
+    return (rc == COAP_SUCCESS) ? COAP_RSP_SEND : rc;
+}
+
 coap_state_t coap_make_link_format(const coap_resource_t *resources,
                                    char *buf, size_t buflen)
 {
@@ -327,9 +684,25 @@ coap_state_t coap_make_link_format(const coap_resource_t *resources,
         // insert >; after path
         strncat(buf, ">;", len);
         len -= 2;
-        // append content type
-        len -= sprintf(buf + (buflen - len - 1), "ct=%d",
-                       COAP_GET_CONTENTTYPE(rs->content_type));
+        // append content type, or all of the representations
+        if (!rs->reps) {
+            len -= sprintf(buf + (buflen - len - 1), "ct=%d",
+                           (uint16_t)COAP_GET_CONTENTTYPE(rs->content_type));
+            continue;
+        }
+        strncat(buf, "ct=\"", len);
+        len -= 4;
+        for (int i = 0; (i < rs->reps->count) && (i < COAP_MAX_REPRESENTATIONS) && (0 < len); i++) {
+            char ct[8];
+            int n = sprintf(ct, i ? " %d" : "%d",
+                            (uint16_t)COAP_GET_CONTENTTYPE(rs->reps->content_type[i]));
+            strncat(buf, ct, len);
+            len -= n;
+        }
+        if (0 >= len)
+            return COAP_ERR_BUFFER_TOO_SMALL;
+        strncat(buf, "\"", len);
+        len--;
     }
     return COAP_SUCCESS;
 }
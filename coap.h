@@ -18,7 +18,9 @@ extern "C" {
 #define COAP_DEFAULT_PORT 5683  //!< The port number used by the CoAP protocol.
 #define COAPS_DEFAULT_PORT 5684 //!< The port number used by the CoAPs protocol.
 
+#ifndef COAP_MAX_OPTIONS
 #define COAP_MAX_OPTIONS 8      //!< Maximum number of options in a CoAP packet.
+#endif
 #define COAP_MAX_TOKLEN 8       //!< Maximum token length, not enforced yet
 
 /**
@@ -71,7 +73,7 @@ typedef struct coap_rw_buffer
  */
 typedef struct coap_option
 {
-    uint8_t num;            //!< option number, http://tools.ietf.org/html/rfc7252#section-5.10
+    uint16_t num;           //!< option number, http://tools.ietf.org/html/rfc7252#section-5.10
     coap_buffer_t buf;      //!< Option value
 } coap_option_t;
 
@@ -106,6 +108,8 @@ typedef enum
     COAP_OPTION_OBSERVE         = 6,
     COAP_OPTION_URI_PORT        = 7,
     COAP_OPTION_LOCATION_PATH   = 8,
+    // OSCORE, https://tools.ietf.org/html/rfc8613#section-2
+    COAP_OPTION_OSCORE          = 9,
     COAP_OPTION_URI_PATH        = 11,
     COAP_OPTION_CONTENT_FORMAT  = 12,
     COAP_OPTION_MAX_AGE         = 14,
@@ -122,6 +126,8 @@ typedef enum
     COAP_OPTION_PROXY_URI       = 35,
     COAP_OPTION_PROXY_SCHEME    = 39,
     COAP_OPTION_SIZE1           = 60,
+    // Echo, https://tools.ietf.org/html/rfc9175#section-2.2
+    COAP_OPTION_ECHO            = 252,
     COAP_OPTION_NO_RESPONSE     = 258,
 } coap_option_num_t;
 
@@ -190,6 +196,28 @@ typedef enum
     COAP_RSPCODE_NO_PROXY_SUPPORT           = MAKE_RSPCODE(5, 5),
 } coap_responsecode_t;
 
+/**
+ * Signaling codes of the reliable transports,
+ * see https://tools.ietf.org/html/rfc8323#section-5
+ */
+typedef enum
+{
+    COAP_SIGNAL_CSM                         = MAKE_RSPCODE(7, 1),
+    COAP_SIGNAL_PING                        = MAKE_RSPCODE(7, 2),
+    COAP_SIGNAL_PONG                        = MAKE_RSPCODE(7, 3),
+    COAP_SIGNAL_RELEASE                     = MAKE_RSPCODE(7, 4),
+    COAP_SIGNAL_ABORT                       = MAKE_RSPCODE(7, 5),
+} coap_signalcode_t;
+
+/**
+ * Message framing of the reliable transports, RFC 8323 sections 3.2 and 4.4
+ */
+typedef enum
+{
+    COAP_FRAMING_TCP,       //!< length prefixed, messages follow each other in a stream
+    COAP_FRAMING_WS,        //!< length 0, one message per WebSocket frame
+} coap_framing_t;
+
 /**
  * Definition of CoAP content types,
  * see http://tools.ietf.org/html/rfc7252#section-12.3
@@ -203,6 +231,13 @@ typedef enum
     COAP_CONTENTTYPE_APP_OCTECT_STREAM      = 42,
     COAP_CONTENTTYPE_APP_EXI                = 47,
     COAP_CONTENTTYPE_APP_JSON               = 50,
+    // https://tools.ietf.org/html/rfc8949#section-9.5
+    COAP_CONTENTTYPE_APP_CBOR               = 60,
+    // https://tools.ietf.org/html/rfc8742#section-6.2
+    COAP_CONTENTTYPE_APP_CBOR_SEQ           = 63,
+    // https://tools.ietf.org/html/rfc8428#section-12.3
+    COAP_CONTENTTYPE_APP_SENML_JSON         = 110,
+    COAP_CONTENTTYPE_APP_SENML_CBOR         = 112,
 } coap_content_type_t;
 
 ///////////////////////
@@ -239,6 +274,11 @@ typedef enum {
     COAP_ERR_REQUEST_MSGID_MISMATCH,
     COAP_ERR_REQUEST_TOKEN_MISMATCH,
     COAP_ERR_RESPONSE,
+    COAP_ERR_PAYLOAD_INVALID,
+    COAP_ERR_TIMEOUT,
+    COAP_ERR_SECURITY_CONTEXT,
+    COAP_ERR_REPLAY,
+    COAP_ERR_DECRYPT,
     COAP_ERR_MAX,   // this has to be the last error code
 } coap_state_t;
 
@@ -273,6 +313,22 @@ typedef int (*coap_resource_handler)(const coap_resource_t *resource,
                                      const coap_packet_t *inpkt,
                                      coap_packet_t *pkt);
 
+#define COAP_MAX_REPRESENTATIONS 4  //!< representations per resource, see coap_select_representation
+
+/**
+ * Representations of a resource, one of which is chosen per request by its
+ * Accept option. Content types are stored as by COAP_SET_CONTENTTYPE, packed
+ * so that all of them are compared with the Accept value at once. The
+ * resource keeps the handler and content type of the first one, which also
+ * terminate and describe resource tables as usual.
+ */
+typedef struct coap_representations
+{
+    uint8_t count;                                          //!< number of representations
+    uint8_t content_type[COAP_MAX_REPRESENTATIONS][2];      //!< content types, the first one is served without Accept
+    coap_resource_handler handler[COAP_MAX_REPRESENTATIONS];//!< handler per representation
+} coap_representations_t;
+
 /**
  * Describes a distinct resource served by a CoAP entpoint
  */
@@ -284,8 +340,25 @@ struct coap_resource
     coap_resource_handler handler;      //!< callback function for method
     const coap_resource_path_t *path;   //!< resource path, e.g. foo/bar/
     const uint8_t content_type[2];      //!< content type of response
+    const coap_representations_t *reps; //!< alternative representations, or NULL
 };
 
+#define COAP_ACL_MAX_PRINCIPALS 64  //!< principals of coap_handle_request_acl
+typedef uint64_t coap_acl_mask_t;   //!< set of principals, bit n for principal n
+
+/**
+ * Block option value, see https://tools.ietf.org/html/rfc7959#section-2.2
+ */
+typedef struct coap_block
+{
+    uint32_t num;           //!< block number
+    bool more;              //!< more blocks follow
+    uint8_t szx;            //!< size exponent, see COAP_BLOCK_SIZE
+} coap_block_t;
+
+#define COAP_BLOCK_SZX_MAX  6       //!< largest size exponent, 1024 bytes
+#define COAP_BLOCK_SIZE(szx) ((size_t)1 << ((szx) + 4)) //!< block size in bytes
+
 /**
  * @brief Set content type
  *
@@ -344,6 +417,42 @@ coap_state_t coap_parse(const uint8_t *buf,
  */
 coap_state_t coap_build(const coap_packet_t *pkt, uint8_t *buf, size_t *buflen);
 
+/**
+ * @brief Parse a CoAP message of the reliable transports (RFC 8323)
+ *
+ * The message has no type and message ID, \p pkt gets NON and 0, so that
+ * coap_handle_request answers at once, there is nothing to acknowledge.
+ * Token, options and payload are parsed as by coap_parse.
+ *
+ * @param[in] buf Received bytes, for COAP_FRAMING_WS exactly one message
+ * @param[in] buflen Length of \p buf in bytes
+ * @param[in] framing COAP_FRAMING_TCP or COAP_FRAMING_WS
+ * @param[out] pkt Parsed message
+ * @param[out] msglen Length of the message in bytes, if known also when
+ * \p buf does not hold all of it yet, else 0
+ *
+ * @return 0 on success, COAP_ERR_HEADER_TOO_SHORT if \p buf does not hold
+ * the whole message yet, or the according coap_state_t
+ */
+coap_state_t coap_parse_tcp(const uint8_t *buf, const size_t buflen,
+                            const coap_framing_t framing, coap_packet_t *pkt,
+                            size_t *msglen);
+
+/**
+ * @brief Writes a CoAP message of the reliable transports (RFC 8323)
+ *
+ * As coap_build, type and message ID of \p pkt are left out.
+ *
+ * @param[in] pkt The message
+ * @param[in] framing COAP_FRAMING_TCP or COAP_FRAMING_WS
+ * @param[out] buf Byte buffer the message is written to
+ * @param[in,out] buflen Size of \p buf, then the length of the message
+ *
+ * @return 0 on success, or the according coap_state_t as of coap_build
+ */
+coap_state_t coap_build_tcp(const coap_packet_t *pkt, const coap_framing_t framing,
+                            uint8_t *buf, size_t *buflen);
+
 /**
  * @brief Create CoAP acknowledgement
  *
@@ -397,7 +506,8 @@ coap_state_t coap_make_response(const uint16_t msgid,
  * @brief Handle incoming CoAP request
  *
  * Handles the CoAP request in \p inpkt, and creates a response packet which is
- * stored in \p pkt.
+ * stored in \p pkt. For resources with representations the handler of the
+ * one selected by coap_select_representation is called.
  *
  * @param[in/out] resources Pointer to the coap_resource_t array of all resources.
  * @param[in] inpkt Pointer to the coap_packet_t structure containing the
@@ -411,10 +521,133 @@ coap_state_t coap_handle_request(coap_resource_t *resources,
                                  const coap_packet_t *inpkt,
                                  coap_packet_t *pkt);
 
+/**
+ * @brief Handle a request of a principal, see coap_acl.h
+ *
+ * Like coap_handle_request, but the handler of the resource found is only
+ * called if \p principal is in its set in \p allow. Otherwise the response
+ * is 4.01 Unauthorized for the anonymous principal 0, which might be allowed
+ * with an identity, and 4.03 Forbidden for the others.
+ *
+ * @param[in/out] resources Pointer to the coap_resource_t array of all resources.
+ * @param[in] allow Principals allowed per entry of \p resources, NULL allows all
+ * @param[in] principal Principal of the peer, below COAP_ACL_MAX_PRINCIPALS
+ * @param[in] inpkt Request
+ * @param[out] pkt Response
+ *
+ * @return 0 on success, or a reasonable error code on failure.
+ */
+coap_state_t coap_handle_request_acl(coap_resource_t *resources,
+                                     const coap_acl_mask_t *allow,
+                                     const uint8_t principal,
+                                     const coap_packet_t *inpkt,
+                                     coap_packet_t *pkt);
+
+/**
+ * @brief Select the representation of a resource requested by \p inpkt
+ *
+ * Without Accept option the first representation is selected. The lookup is
+ * a single compare of the Accept value against all content types of
+ * \p resource, however many it has.
+ *
+ * @param[in] resource Resource with representations
+ * @param[in] inpkt Request
+ *
+ * @return Index into resource->reps, or -1 if none matches the Accept
+ * option, the request is answered with 4.06 Not Acceptable then
+ */
+int coap_select_representation(const coap_resource_t *resource,
+                               const coap_packet_t *inpkt);
+
 coap_state_t coap_handle_response(coap_resource_t *resources,
                                   const coap_packet_t *reqpkt,
                                   coap_packet_t *rsppkt);
 
+/**
+ * @brief Find options in a packet
+ *
+ * Options are stored ordered by number, so all options with number \p num
+ * are stored consecutively.
+ *
+ * @param[in] pkt Pointer to the packet to search
+ * @param[in] num Option number to look for
+ * @param[out] count Number of consecutive options with number \p num
+ *
+ * @return Pointer to the first option with number \p num, or NULL
+ */
+const coap_option_t *coap_find_options(const coap_packet_t *pkt,
+                                       const coap_option_num_t num,
+                                       uint8_t *count);
+
+/**
+ * @brief Add an option to a packet
+ *
+ * Inserts the option keeping the options ordered by number, after options
+ * with the same number. The value is not copied, it must stay valid until
+ * the packet is built.
+ *
+ * @param[in,out] pkt Pointer to the packet
+ * @param[in] num Option number
+ * @param[in] value Option value
+ * @param[in] len Length of \p value in bytes
+ *
+ * @return 0 on success, or COAP_ERR_BUFFER_TOO_SMALL if the packet already
+ * holds COAP_MAX_OPTIONS options
+ */
+coap_state_t coap_add_option(coap_packet_t *pkt, const uint16_t num,
+                             const uint8_t *value, const size_t len);
+
+/**
+ * @brief Encode an uint option value
+ *
+ * @param[in] value Value to encode
+ * @param[out] buf Buffer of at least 4 bytes
+ *
+ * @return Number of bytes written, 0 for value 0
+ */
+size_t coap_encode_uint(const uint32_t value, uint8_t *buf);
+
+/**
+ * @brief Decode an uint option value of up to 4 bytes
+ */
+uint32_t coap_decode_uint(const coap_buffer_t *buf);
+
+/**
+ * @brief Read a Block1 or Block2 option
+ *
+ * @param[in] pkt Pointer to the packet
+ * @param[in] num COAP_OPTION_BLOCK1 or COAP_OPTION_BLOCK2
+ * @param[out] block Decoded option value
+ *
+ * @return 0 on success, or COAP_ERR_OPTION_NOT_FOUND if the packet has no
+ * such option, or COAP_ERR_OPTION_LEN_INVALID if it is malformed
+ */
+coap_state_t coap_get_block(const coap_packet_t *pkt,
+                            const coap_option_num_t num,
+                            coap_block_t *block);
+
+/**
+ * @brief Serve a response payload block wise
+ *
+ * Cuts the payload of the response \p pkt down to the block requested by the
+ * Block2 option of \p inpkt, or to the first block if the request has none
+ * and the payload exceeds the block size, and adds a Block2 option. The
+ * smaller one of \p szx and the requested size is used. Responses that fit
+ * into a single block and were not requested block wise stay as they are.
+ * If the requested block is beyond the payload, the response is turned into
+ * 4.02 Bad Option.
+ *
+ * @param[in] inpkt Pointer to the request
+ * @param[in] szx Largest block size exponent the server wants to use
+ * @param[out] scratch At least 4 bytes that hold the Block2 option value until
+ * the response is built
+ * @param[in,out] pkt Pointer to the response, carrying the whole payload
+ *
+ * @return COAP_RSP_SEND, or an error code if the option cannot be added
+ */
+coap_state_t coap_make_block2(const coap_packet_t *inpkt, const uint8_t szx,
+                              uint8_t *scratch, coap_packet_t *pkt);
+
 /**
  * @brief Create link format of resources
  *
@@ -0,0 +1,433 @@
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "coap.h"
+#include "coap_acl.h"
+
+#define ACL_MAX_TOKENS  5       //!< per line, one more than a valid line has
+#define ACL_METHODS     7       //!< GET to iPATCH, codes 1 to 7
+
+typedef struct acl_token
+{
+    const char *p;
+    size_t len;
+} acl_token_t;
+
+typedef struct acl_names
+{
+    char name[COAP_ACL_MAX_PRINCIPALS][COAP_ACL_MAX_NAME + 1];
+    uint8_t count;
+} acl_names_t;
+
+static const char *acl_methods[ACL_METHODS] = {
+    "GET", "POST", "PUT", "DELETE", "FETCH", "PATCH", "IPATCH"
+};
+
+/* --- PRIVATE -------------------------------------------------------------- */
+static bool _is(const acl_token_t *t, const char *s)
+{
+    return (t->len == strlen(s)) && !memcmp(t->p, s, t->len);
+}
+
+/* the tokens of a line up to a comment, ACL_MAX_TOKENS if there are more */
+static size_t _tokens(const char *line, const size_t len, acl_token_t *toks)
+{
+    size_t n = 0, i = 0;
+
+    while ((i < len) && (line[i] != '#')) {
+        if ((line[i] == ' ') || (line[i] == '\t') || (line[i] == '\r')) {
+            ++i;
+            continue;
+        }
+        const size_t start = i;
+        while ((i < len) && (line[i] != ' ') && (line[i] != '\t') &&
+               (line[i] != '\r') && (line[i] != '#')) {
+            ++i;
+        }
+        if (n == ACL_MAX_TOKENS) {
+            return n;
+        }
+        toks[n++] = (acl_token_t){ line + start, i - start };
+    }
+    return n;
+}
+
+/* the next item of a comma separated list in \p list, false at its end */
+static bool _item(acl_token_t *list, acl_token_t *item)
+{
+    if (!list->len) {
+        return false;
+    }
+    const char *comma = memchr(list->p, ',', list->len);
+    item->p = list->p;
+    item->len = comma ? (size_t)(comma - list->p) : list->len;
+    list->p += item->len + (comma != NULL);
+    list->len -= item->len + (comma != NULL);
+    return true;
+}
+
+static int _find_name(const acl_names_t *names, const acl_token_t *t)
+{
+    for (int i = 0; i < names->count; ++i) {
+        if (_is(t, names->name[i])) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int _hex_digit(const char c)
+{
+    if ((c >= '0') && (c <= '9')) {
+        return c - '0';
+    }
+    if ((c >= 'a') && (c <= 'f')) {
+        return c - 'a' + 10;
+    }
+    if ((c >= 'A') && (c <= 'F')) {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+static bool _parse_identity(const acl_token_t *type, const acl_token_t *value,
+                            coap_acl_identity_t *id)
+{
+    // identities of DTLS are strings
+    if (_is(type, "psk") && (value->len <= COAP_ACL_MAX_ID) && !memchr(value->p, 0, value->len)) {
+        id->type = COAP_ACL_PSK;
+        id->len = (uint8_t)value->len;
+        memcpy(id->id, value->p, value->len);
+        return true;
+    }
+    if (_is(type, "kid") && !(value->len & 1) && (value->len <= 2 * COAP_ACL_MAX_ID)) {
+        id->type = COAP_ACL_KID;
+        id->len = (uint8_t)(value->len / 2);
+        for (size_t i = 0; i < id->len; ++i) {
+            const int hi = _hex_digit(value->p[2 * i]), lo = _hex_digit(value->p[2 * i + 1]);
+            if ((hi < 0) || (lo < 0)) {
+                return false;
+            }
+            id->id[i] = (uint8_t)(hi << 4 | lo);
+        }
+        return true;
+    }
+    if (_is(type, "prefix")) {
+        char addr[INET6_ADDRSTRLEN];
+        const char *slash = memchr(value->p, '/', value->len);
+        const size_t addrlen = slash ? (size_t)(slash - value->p) : value->len;
+        unsigned bits = 0;
+
+        if ((addrlen >= sizeof(addr)) || memchr(value->p, 0, addrlen)) {
+            return false;
+        }
+        memcpy(addr, value->p, addrlen);
+        addr[addrlen] = 0;
+        id->type = COAP_ACL_PREFIX;
+        id->family = strchr(addr, ':') ? AF_INET6 : AF_INET;
+        if (inet_pton(id->family, addr, id->id) != 1) {
+            return false;
+        }
+        const unsigned max = (id->family == AF_INET) ? 32 : 128;
+        if (!slash) {
+            bits = max;
+        }
+        else {
+            const char *p = slash + 1, *end = value->p + value->len;
+            if ((p == end) || (end - p > 3)) {
+                return false;
+            }
+            for (; p < end; ++p) {
+                if ((*p < '0') || (*p > '9')) {
+                    return false;
+                }
+                bits = bits * 10 + (unsigned)(*p - '0');
+            }
+            if (bits > max) {
+                return false;
+            }
+        }
+        id->len = (uint8_t)bits;
+        // host bits cleared, so that matching compares whole bytes
+        for (unsigned i = bits; i < max; ++i) {
+            id->id[i / 8] &= (uint8_t)~(0x80 >> (i % 8));
+        }
+        // addresses are matched IPv4-mapped as IPv4, so are prefixes
+        if ((id->family == AF_INET6) && (bits >= 96) &&
+            IN6_IS_ADDR_V4MAPPED((const struct in6_addr *)id->id)) {
+            memmove(id->id, id->id + 12, 4);
+            id->family = AF_INET;
+            id->len = (uint8_t)(bits - 96);
+        }
+        return true;
+    }
+    return false;
+}
+
+/* whether a policy path, e.g. /a/b or /a/ *, names the path of a resource */
+static bool _path_match(const coap_resource_path_t *path, acl_token_t pat)
+{
+    int i = 0;
+    acl_token_t seg;
+
+    if (!pat.len || (pat.p[0] != '/')) {
+        return false;
+    }
+    pat.p++;
+    pat.len--;
+    while (pat.len) {
+        const char *slash = memchr(pat.p, '/', pat.len);
+        seg.p = pat.p;
+        seg.len = slash ? (size_t)(slash - pat.p) : pat.len;
+        pat.p += seg.len + (slash != NULL);
+        pat.len -= seg.len + (slash != NULL);
+        if (_is(&seg, "*") && !pat.len) {
+            return true;
+        }
+        if ((i >= path->count) || !_is(&seg, path->items[i])) {
+            return false;
+        }
+        ++i;
+    }
+    return i == path->count;
+}
+
+static int _cmp_identity(const void *a, const void *b)
+{
+    const coap_acl_identity_t *x = a, *y = b;
+    if (x->type != y->type) {
+        return (int)x->type - (int)y->type;
+    }
+    return (int)y->len - (int)x->len;
+}
+
+/* one line, the principals in the first pass, the rules in the second */
+static coap_state_t _line(coap_acl_table_t *t, acl_names_t *names, const bool rules,
+                          const char *line, const size_t len)
+{
+    acl_token_t toks[ACL_MAX_TOKENS], item;
+    const size_t n = _tokens(line, len, toks);
+
+    if (!n) {
+        return COAP_SUCCESS;
+    }
+    if (n != 4) {
+        return COAP_ERR_PAYLOAD_INVALID;
+    }
+    if (_is(&toks[0], "principal")) {
+        if (rules) {
+            return COAP_SUCCESS;
+        }
+        int p = _find_name(names, &toks[1]);
+        if ((p < 0) && (_is(&toks[1], "*") || memchr(toks[1].p, ',', toks[1].len) ||
+                        (toks[1].len > COAP_ACL_MAX_NAME))) {
+            return COAP_ERR_PAYLOAD_INVALID;
+        }
+        if (p < 0) {
+            if (names->count == COAP_ACL_MAX_PRINCIPALS) {
+                return COAP_ERR_BUFFER_TOO_SMALL;
+            }
+            p = names->count++;
+            memcpy(names->name[p], toks[1].p, toks[1].len);
+            names->name[p][toks[1].len] = 0;
+        }
+        coap_acl_identity_t *id = &t->ids[t->nids];
+        memset(id, 0, sizeof(*id));
+        if (!p || !_parse_identity(&toks[2], &toks[3], id)) {
+            return COAP_ERR_PAYLOAD_INVALID;    // anonymous has no identity
+        }
+        id->principal = (uint8_t)p;
+        t->nids++;
+        return COAP_SUCCESS;
+    }
+    if (!_is(&toks[0], "allow")) {
+        return COAP_ERR_PAYLOAD_INVALID;
+    }
+    if (!rules) {
+        return COAP_SUCCESS;
+    }
+    coap_acl_mask_t who = 0;
+    uint8_t methods = 0;
+    if (_is(&toks[1], "*")) {
+        who = ~(coap_acl_mask_t)0;
+        toks[1].len = 0;
+    }
+    while (_item(&toks[1], &item)) {
+        const int p = _find_name(names, &item);
+        if (p < 0) {
+            return COAP_ERR_PAYLOAD_INVALID;
+        }
+        who |= (coap_acl_mask_t)1 << p;
+    }
+    if (_is(&toks[2], "*")) {
+        methods = 0xFF;
+        toks[2].len = 0;
+    }
+    while (_item(&toks[2], &item)) {
+        int m = 0;
+        while ((m < ACL_METHODS) && !_is(&item, acl_methods[m])) {
+            ++m;
+        }
+        if (m == ACL_METHODS) {
+            return COAP_ERR_PAYLOAD_INVALID;
+        }
+        methods |= (uint8_t)(1 << m);
+    }
+    if (!who || !methods || (toks[3].p[0] != '/')) {
+        return COAP_ERR_PAYLOAD_INVALID;
+    }
+    for (size_t i = 0; i < t->nresources; ++i) {
+        const coap_resource_t *rs = &t->resources[i];
+        const unsigned m = (unsigned)rs->method - 1;
+        if ((m < ACL_METHODS) && ((methods >> m) & 1) && rs->path &&
+            _path_match(rs->path, toks[3])) {
+            t->allow[i] |= who;
+        }
+    }
+    return COAP_SUCCESS;
+}
+
+/* the address of \p addr, IPv4-mapped IPv6 addresses as IPv4 */
+static int _addr_bytes(const struct sockaddr *addr, const socklen_t addrlen, const uint8_t **bytes)
+{
+    static const uint8_t v4mapped[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
+
+    if ((addr->sa_family == AF_INET) && (addrlen >= sizeof(struct sockaddr_in))) {
+        *bytes = (const uint8_t *)&((const struct sockaddr_in *)addr)->sin_addr;
+        return AF_INET;
+    }
+    if ((addr->sa_family == AF_INET6) && (addrlen >= sizeof(struct sockaddr_in6))) {
+        *bytes = (const uint8_t *)&((const struct sockaddr_in6 *)addr)->sin6_addr;
+        if (!memcmp(*bytes, v4mapped, sizeof(v4mapped))) {
+            *bytes += sizeof(v4mapped);
+            return AF_INET;
+        }
+        return AF_INET6;
+    }
+    return AF_UNSPEC;
+}
+
+/* --- PUBLIC --------------------------------------------------------------- */
+coap_state_t coap_acl_compile(const char *policy, const size_t len,
+                              const coap_resource_t *resources,
+                              coap_acl_table_t **table, unsigned *errline)
+{
+    acl_names_t names;
+    size_t nres = 0, nlines = 1;
+
+    *table = NULL;
+    for (const coap_resource_t *rs = resources; rs->handler; ++rs) {
+        nres++;
+    }
+    for (size_t i = 0; i < len; ++i) {
+        nlines += (policy[i] == '\n');
+    }
+    // the table, the bitsets and at most an identity per line in one block
+    const size_t size = sizeof(coap_acl_table_t) + nres * sizeof(coap_acl_mask_t) +
+                        nlines * sizeof(coap_acl_identity_t);
+    coap_acl_table_t *t = calloc(1, size);
+    if (!t) {
+        return COAP_ERR_BUFFER_TOO_SMALL;
+    }
+    t->resources = resources;
+    t->nresources = nres;
+    t->allow = (coap_acl_mask_t *)(t + 1);
+    t->ids = (coap_acl_identity_t *)(t->allow + nres);
+    memset(&names, 0, sizeof(names));
+    strcpy(names.name[COAP_ACL_ANONYMOUS], "anonymous");
+    names.count = 1;
+
+    for (int pass = 0; pass < 2; ++pass) {
+        const char *line = policy, *end = policy + len;
+        unsigned lineno = 1;
+        while (line < end) {
+            const char *nl = memchr(line, '\n', (size_t)(end - line));
+            const size_t linelen = nl ? (size_t)(nl - line) : (size_t)(end - line);
+            const coap_state_t rc = _line(t, &names, pass == 1, line, linelen);
+            if (rc != COAP_SUCCESS) {
+                if (errline) {
+                    *errline = lineno;
+                }
+                free(t);
+                return rc;
+            }
+            line += linelen + 1;
+            lineno++;
+        }
+    }
+    t->nprincipals = names.count;
+    qsort(t->ids, t->nids, sizeof(*t->ids), _cmp_identity);
+    t->prefixes = 0;
+    while ((t->prefixes < t->nids) && (t->ids[t->prefixes].type != COAP_ACL_PREFIX)) {
+        t->prefixes++;
+    }
+    *table = t;
+    return COAP_SUCCESS;
+}
+
+void coap_acl_free(coap_acl_table_t *table)
+{
+    free(table);
+}
+
+coap_acl_table_t *coap_acl_swap(coap_acl_t *acl, coap_acl_table_t *table)
+{
+    if (table) {
+        table->gen = __atomic_add_fetch(&acl->gen, 1, __ATOMIC_RELAXED);
+    }
+    return __atomic_exchange_n(&acl->table, table, __ATOMIC_ACQ_REL);
+}
+
+uint8_t coap_acl_psk(const coap_acl_table_t *table, const char *identity)
+{
+    const size_t len = identity ? strlen(identity) : 0;
+
+    for (size_t i = 0; table && identity && (i < table->nids); ++i) {
+        const coap_acl_identity_t *id = &table->ids[i];
+        if ((id->type == COAP_ACL_PSK) && (id->len == len) && !memcmp(id->id, identity, len)) {
+            return id->principal;
+        }
+    }
+    return COAP_ACL_ANONYMOUS;
+}
+
+uint8_t coap_acl_kid(const coap_acl_table_t *table, const uint8_t *kid, const size_t len)
+{
+    for (size_t i = 0; table && (i < table->nids); ++i) {
+        const coap_acl_identity_t *id = &table->ids[i];
+        if ((id->type == COAP_ACL_KID) && (id->len == len) && !memcmp(id->id, kid, len)) {
+            return id->principal;
+        }
+    }
+    return COAP_ACL_ANONYMOUS;
+}
+
+uint8_t coap_acl_addr(const coap_acl_table_t *table, const struct sockaddr *addr,
+                      const socklen_t addrlen)
+{
+    const uint8_t *a;
+    const int family = _addr_bytes(addr, addrlen, &a);
+
+    // prefixes are sorted longest first, the first match is the longest
+    for (size_t i = table ? table->prefixes : 0; table && (family != AF_UNSPEC) && (i < table->nids); ++i) {
+        const coap_acl_identity_t *id = &table->ids[i];
+        if (id->family != family) {
+            continue;
+        }
+        const size_t whole = id->len / 8;
+        const uint8_t mask = (uint8_t)(0xFF00 >> (id->len % 8));
+        if (!memcmp(id->id, a, whole) && (!(id->len % 8) || ((a[whole] & mask) == id->id[whole]))) {
+            return id->principal;
+        }
+    }
+    return COAP_ACL_ANONYMOUS;
+}
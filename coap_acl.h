@@ -0,0 +1,191 @@
+#ifndef COAP_ACL_H
+#define COAP_ACL_H 1
+
+/**
+ * @file coap_acl.h
+ *
+ * Access control for coap_handle_request_acl. A policy names principals by
+ * their identities, DTLS PSK identities, OSCORE key IDs and source address
+ * prefixes, and allows them methods on resources:
+ *
+ *     # name      type    identity
+ *     principal   sensor  psk     sensor-01
+ *     principal   sensor  kid     01
+ *     principal   admin   prefix  2001:db8::/32
+ *     principal   admin   prefix  192.0.2.0/24
+ *     # names     methods         path
+ *     allow       *       GET     /.well-known/core
+ *     allow       sensor  PUT,GET /light
+ *     allow       admin,sensor *  /rd/ *
+ *
+ * Names and methods are lists separated by commas or * for all, a last path
+ * segment * (written without the blank above) matches the rest of the path.
+ * coap_acl_compile turns it into a table against the resource table of the
+ * server: principals become small integers, 0 for peers without identity
+ * (the name anonymous) and 1 to COAP_ACL_MAX_PRINCIPALS - 1 in the order of
+ * the policy, and every entry of the resource table, which is one method on
+ * one path, gets the bitset of the principals allowed. A request is checked
+ * with a shift and a mask; nothing of the policy is looked at per request.
+ *
+ * Identities are mapped to principals once, when a session is set up: by
+ * coap_dtls for PSK identities, by the application for OSCORE contexts and,
+ * over plain UDP, per request by address. A policy is reloaded by compiling
+ * it and swapping the table in with coap_acl_swap, atomically, so requests
+ * see either table. Principals of sessions carry the generation of the table
+ * they were mapped with and are mapped again once it changed.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <sys/socket.h>
+
+#include "coap.h"
+
+#define COAP_ACL_ANONYMOUS      0       //!< principal of peers without identity
+#define COAP_ACL_MAX_NAME       31      //!< characters of a principal name
+#define COAP_ACL_MAX_ID         64      //!< bytes of a PSK identity or key ID
+
+/**
+ * Kinds of identities
+ */
+typedef enum
+{
+    COAP_ACL_PSK,               //!< DTLS PSK identity
+    COAP_ACL_KID,               //!< OSCORE recipient ID
+    COAP_ACL_PREFIX,            //!< source address prefix, IPv4 or IPv6
+} coap_acl_id_type_t;
+
+/**
+ * Identity of a principal
+ */
+typedef struct coap_acl_identity
+{
+    uint8_t type;               //!< coap_acl_id_type_t
+    uint8_t principal;
+    uint8_t len;                //!< bytes of id, bits of prefixes
+    uint8_t family;             //!< AF_INET or AF_INET6 for prefixes
+    uint8_t id[COAP_ACL_MAX_ID];
+} coap_acl_identity_t;
+
+/**
+ * Compiled policy, allocated in one block by coap_acl_compile
+ */
+typedef struct coap_acl_table
+{
+    uint32_t gen;               //!< set by coap_acl_swap
+    uint8_t nprincipals;        //!< including anonymous
+    const coap_resource_t *resources;   //!< compiled against
+    size_t nresources;
+    coap_acl_mask_t *allow;     //!< principals allowed, per entry of resources
+    coap_acl_identity_t *ids;   //!< by type, prefixes last and longest first
+    size_t nids;
+    size_t prefixes;            //!< index of the first prefix in ids
+} coap_acl_table_t;
+
+/**
+ * Policy in force
+ */
+typedef struct coap_acl
+{
+    coap_acl_table_t *table;    //!< swapped atomically, NULL allows all
+    uint32_t gen;               //!< of the last table swapped in
+} coap_acl_t;
+
+/**
+ * @brief Compile a policy against a resource table
+ *
+ * @param[in] policy Policy text, lines as in the description of this file
+ * @param[in] len Length of \p policy
+ * @param[in] resources Resource table the policy is for
+ * @param[out] table Compiled policy, free with coap_acl_free
+ * @param[out] errline Line of the error, may be NULL
+ *
+ * @return 0 on success, COAP_ERR_PAYLOAD_INVALID if a line is malformed or
+ * names an unknown principal or method, COAP_ERR_BUFFER_TOO_SMALL for more
+ * than COAP_ACL_MAX_PRINCIPALS principals or if out of memory
+ */
+coap_state_t coap_acl_compile(const char *policy, const size_t len,
+                              const coap_resource_t *resources,
+                              coap_acl_table_t **table, unsigned *errline);
+
+/**
+ * @brief Free a compiled policy, NULL is ignored
+ */
+void coap_acl_free(coap_acl_table_t *table);
+
+/**
+ * @brief Put a compiled policy in force
+ *
+ * Requests dispatched after this see \p table. The caller frees the table
+ * returned once no request uses it any more, right away if the tables are
+ * only read on the thread calling this.
+ *
+ * @param[in,out] acl Policy in force
+ * @param[in] table Compiled policy, NULL to allow all
+ *
+ * @return The table replaced
+ */
+coap_acl_table_t *coap_acl_swap(coap_acl_t *acl, coap_acl_table_t *table);
+
+/**
+ * @brief The table in force, to dispatch a request with
+ */
+static inline const coap_acl_table_t *coap_acl_current(const coap_acl_t *acl)
+{
+    return __atomic_load_n(&acl->table, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * @brief Principal of a DTLS PSK identity
+ *
+ * @return The principal, COAP_ACL_ANONYMOUS if the identity is not named
+ */
+uint8_t coap_acl_psk(const coap_acl_table_t *table, const char *identity);
+
+/**
+ * @brief Principal of an OSCORE key ID, the recipient ID of a context
+ *
+ * @return The principal, COAP_ACL_ANONYMOUS if the key ID is not named
+ */
+uint8_t coap_acl_kid(const coap_acl_table_t *table, const uint8_t *kid, const size_t len);
+
+/**
+ * @brief Principal of a source address, by the longest prefix matching it
+ *
+ * IPv4-mapped IPv6 addresses match IPv4 prefixes.
+ *
+ * @return The principal, COAP_ACL_ANONYMOUS if no prefix matches
+ */
+uint8_t coap_acl_addr(const coap_acl_table_t *table, const struct sockaddr *addr,
+                      const socklen_t addrlen);
+
+/**
+ * @brief Whether a principal may call an entry of the resource table
+ *
+ * @param[in] table Compiled policy, NULL allows all
+ * @param[in] index Entry of the resource table
+ * @param[in] principal Principal
+ */
+static inline bool coap_acl_allowed(const coap_acl_table_t *table, const size_t index,
+                                    const uint8_t principal)
+{
+    return !table || ((principal < COAP_ACL_MAX_PRINCIPALS) &&
+                      ((table->allow[index] >> principal) & 1));
+}
+
+/**
+ * @brief The bitsets to pass to coap_handle_request_acl, NULL allows all
+ */
+static inline const coap_acl_mask_t *coap_acl_mask(const coap_acl_table_t *table)
+{
+    return table ? table->allow : NULL;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,565 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+
+#include "coap.h"
+#include "coap_cbor.h"
+
+/* major types, https://tools.ietf.org/html/rfc8949#section-3.1 */
+#define CBOR_UINT       0
+#define CBOR_NEGINT     1
+#define CBOR_BYTES      2
+#define CBOR_TEXT       3
+#define CBOR_ARRAY      4
+#define CBOR_MAP        5
+#define CBOR_TAG        6
+#define CBOR_SIMPLE     7
+
+#define CBOR_AI_INDEFINITE  31
+#define CBOR_FALSE      0xF4
+#define CBOR_TRUE       0xF5
+#define CBOR_NULL       0xF6
+#define CBOR_HALF       0xF9
+#define CBOR_FLOAT      0xFA
+#define CBOR_DOUBLE     0xFB
+#define CBOR_BREAK      0xFF
+
+/* --- PRIVATE -------------------------------------------------------------- */
+static uint8_t *_reserve(coap_cbor_writer_t *w, const size_t n)
+{
+    if (w->err != COAP_SUCCESS) {
+        return NULL;
+    }
+    if (w->len - w->pos < n) {
+        w->err = COAP_ERR_BUFFER_TOO_SMALL;
+        return NULL;
+    }
+    uint8_t *p = w->p + w->pos;
+    w->pos += n;
+    return p;
+}
+
+/* initial byte and argument in the shortest form */
+static coap_state_t _put_head(coap_cbor_writer_t *w, const uint8_t major,
+                              uint64_t value)
+{
+    size_t n = (value < 24) ? 1 : (value <= 0xFF) ? 2 : (value <= 0xFFFF) ? 3 :
+               (value <= 0xFFFFFFFF) ? 5 : 9;
+    uint8_t *p = _reserve(w, n);
+    if (!p) {
+        return w->err;
+    }
+    if (n == 1) {
+        p[0] = (major << 5) | value;
+        return COAP_SUCCESS;
+    }
+    // additional info 24..27 for 1, 2, 4 and 8 bytes
+    p[0] = (major << 5) | ((n == 2) ? 24 : (n == 3) ? 25 : (n == 5) ? 26 : 27);
+    for (size_t i = n - 1; i > 0; --i) {
+        p[i] = 0xFF & value;
+        value >>= 8;
+    }
+    return COAP_SUCCESS;
+}
+
+static coap_state_t _put_byte(coap_cbor_writer_t *w, const uint8_t byte)
+{
+    uint8_t *p = _reserve(w, 1);
+    if (!p) {
+        return w->err;
+    }
+    *p = byte;
+    return COAP_SUCCESS;
+}
+
+static coap_state_t _put_string(coap_cbor_writer_t *w, const uint8_t major,
+                                const void *data, const size_t len)
+{
+    if (_put_head(w, major, len) != COAP_SUCCESS) {
+        return w->err;
+    }
+    uint8_t *p = _reserve(w, len);
+    if (!p) {
+        return w->err;
+    }
+    if (len) {
+        memcpy(p, data, len);
+    }
+    return COAP_SUCCESS;
+}
+
+/* exact half precision representation of a single, if there is one */
+static bool _to_half(const uint32_t bits, uint16_t *half)
+{
+    uint16_t sign = (bits >> 16) & 0x8000;
+    int exp = (bits >> 23) & 0xFF;
+    uint32_t mant = bits & 0x7FFFFF;
+
+    if ((exp == 0) && (mant == 0)) {
+        *half = sign;
+        return true;
+    }
+    if (exp == 0xFF) {
+        *half = sign | 0x7C00 | (mant ? 0x200 : 0);
+        return true;
+    }
+    int e = exp - 127 + 15;
+    if ((e >= 1) && (e <= 30)) {
+        if (mant & 0x1FFF) {
+            return false;
+        }
+        *half = sign | (e << 10) | (mant >> 13);
+        return true;
+    }
+    if ((e <= 0) && (e >= -10)) {
+        // half subnormal, mantissa * 2^-24
+        int shift = 14 - e;
+        mant |= 0x800000;
+        if (mant & ((1u << shift) - 1)) {
+            return false;
+        }
+        *half = sign | (mant >> shift);
+        return true;
+    }
+    return false;
+}
+
+static double _from_half(const uint16_t half)
+{
+    uint32_t sign = (uint32_t)(half & 0x8000) << 16;
+    int exp = (half >> 10) & 0x1F;
+    uint32_t mant = half & 0x3FF;
+    uint32_t bits;
+    float f;
+
+    if (exp == 0) {
+        double d = mant / 16777216.0;
+        return sign ? -d : d;
+    }
+    if (exp == 31) {
+        bits = sign | 0x7F800000 | (mant << 13);
+    }
+    else {
+        bits = sign | ((uint32_t)(exp - 15 + 127) << 23) | (mant << 13);
+    }
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+static coap_state_t _decode(const coap_cbor_reader_t *r, coap_cbor_item_t *item,
+                            size_t *next)
+{
+    size_t pos = r->pos;
+    if (pos >= r->len) {
+        return COAP_ERR_PAYLOAD_INVALID;
+    }
+    const uint8_t ib = r->p[pos++];
+    const uint8_t major = ib >> 5;
+    const uint8_t ai = ib & 0x1F;
+    uint64_t value = ai;
+
+    if ((ai >= 24) && (ai <= 27)) {
+        size_t n = (size_t)1 << (ai - 24);
+        if (r->len - pos < n) {
+            return COAP_ERR_PAYLOAD_INVALID;
+        }
+        value = 0;
+        for (size_t i = 0; i < n; ++i) {
+            value = (value << 8) | r->p[pos++];
+        }
+    }
+    else if ((ai >= 28) && (ai < CBOR_AI_INDEFINITE)) {
+        return COAP_ERR_PAYLOAD_INVALID;
+    }
+    else if (ai == CBOR_AI_INDEFINITE) {
+        if ((major == CBOR_UINT) || (major == CBOR_NEGINT) || (major == CBOR_TAG)) {
+            return COAP_ERR_PAYLOAD_INVALID;
+        }
+        value = COAP_CBOR_INDEFINITE;
+    }
+
+    switch (major) {
+    case CBOR_UINT:
+        item->type = COAP_CBOR_UINT;
+        item->v.u = value;
+        break;
+    case CBOR_NEGINT:
+        if (value > INT64_MAX) {
+            return COAP_ERR_PAYLOAD_INVALID;
+        }
+        item->type = COAP_CBOR_NEGINT;
+        item->v.i = -1 - (int64_t)value;
+        break;
+    case CBOR_BYTES:
+    case CBOR_TEXT:
+        item->type = (major == CBOR_BYTES) ? COAP_CBOR_BYTES : COAP_CBOR_TEXT;
+        if (value == COAP_CBOR_INDEFINITE) {
+            item->v.str.p = NULL;
+            item->v.str.len = SIZE_MAX;
+            break;
+        }
+        if (value > r->len - pos) {
+            return COAP_ERR_PAYLOAD_INVALID;
+        }
+        item->v.str.p = r->p + pos;
+        item->v.str.len = value;
+        pos += value;
+        break;
+    case CBOR_ARRAY:
+    case CBOR_MAP:
+        // every item takes at least one byte, reject counts that cannot fit
+        if ((value != COAP_CBOR_INDEFINITE) && (value > r->len - pos)) {
+            return COAP_ERR_PAYLOAD_INVALID;
+        }
+        item->type = (major == CBOR_ARRAY) ? COAP_CBOR_ARRAY : COAP_CBOR_MAP;
+        item->v.count = value;
+        break;
+    case CBOR_TAG:
+        item->type = COAP_CBOR_TAG;
+        item->v.u = value;
+        break;
+    default:
+        switch (ai) {
+        case 20:
+        case 21:
+            item->type = COAP_CBOR_BOOL;
+            item->v.b = (ai == 21);
+            break;
+        case 22:
+            item->type = COAP_CBOR_NULL;
+            break;
+        case 23:
+            item->type = COAP_CBOR_UNDEFINED;
+            break;
+        case 24:
+            // two byte simple values below 32 are not well-formed
+            if (value < 32) {
+                return COAP_ERR_PAYLOAD_INVALID;
+            }
+            item->type = COAP_CBOR_SIMPLE;
+            item->v.u = value;
+            break;
+        case 25:
+            item->type = COAP_CBOR_FLOAT;
+            item->v.f = _from_half((uint16_t)value);
+            break;
+        case 26: {
+            uint32_t bits = (uint32_t)value;
+            float f;
+            memcpy(&f, &bits, sizeof(f));
+            item->type = COAP_CBOR_FLOAT;
+            item->v.f = f;
+            break;
+        }
+        case 27:
+            item->type = COAP_CBOR_FLOAT;
+            memcpy(&item->v.f, &value, sizeof(item->v.f));
+            break;
+        case CBOR_AI_INDEFINITE:
+            item->type = COAP_CBOR_BREAK;
+            break;
+        default:
+            item->type = COAP_CBOR_SIMPLE;
+            item->v.u = value;
+            break;
+        }
+        break;
+    }
+    *next = pos;
+    return COAP_SUCCESS;
+}
+
+/* --- PUBLIC --------------------------------------------------------------- */
+void coap_cbor_writer_init(coap_cbor_writer_t *w, uint8_t *buf, const size_t len)
+{
+    w->p = buf;
+    w->len = len;
+    w->pos = 0;
+    w->err = COAP_SUCCESS;
+}
+
+coap_state_t coap_cbor_put_uint(coap_cbor_writer_t *w, const uint64_t value)
+{
+    return _put_head(w, CBOR_UINT, value);
+}
+
+coap_state_t coap_cbor_put_int(coap_cbor_writer_t *w, const int64_t value)
+{
+    if (value < 0) {
+        // -1 - value without overflow for INT64_MIN
+        return _put_head(w, CBOR_NEGINT, ~(uint64_t)value);
+    }
+    return _put_head(w, CBOR_UINT, (uint64_t)value);
+}
+
+coap_state_t coap_cbor_put_bytes(coap_cbor_writer_t *w,
+                                 const uint8_t *data, const size_t len)
+{
+    return _put_string(w, CBOR_BYTES, data, len);
+}
+
+coap_state_t coap_cbor_put_text(coap_cbor_writer_t *w,
+                                const char *text, const size_t len)
+{
+    return _put_string(w, CBOR_TEXT, text, len);
+}
+
+uint8_t *coap_cbor_put_bytes_ptr(coap_cbor_writer_t *w, const size_t len)
+{
+    if (_put_head(w, CBOR_BYTES, len) != COAP_SUCCESS) {
+        return NULL;
+    }
+    return _reserve(w, len);
+}
+
+char *coap_cbor_put_text_ptr(coap_cbor_writer_t *w, const size_t len)
+{
+    if (_put_head(w, CBOR_TEXT, len) != COAP_SUCCESS) {
+        return NULL;
+    }
+    return (char *)_reserve(w, len);
+}
+
+coap_state_t coap_cbor_put_array(coap_cbor_writer_t *w, const uint64_t count)
+{
+    if (count == COAP_CBOR_INDEFINITE) {
+        return _put_byte(w, (CBOR_ARRAY << 5) | CBOR_AI_INDEFINITE);
+    }
+    return _put_head(w, CBOR_ARRAY, count);
+}
+
+coap_state_t coap_cbor_put_map(coap_cbor_writer_t *w, const uint64_t count)
+{
+    if (count == COAP_CBOR_INDEFINITE) {
+        return _put_byte(w, (CBOR_MAP << 5) | CBOR_AI_INDEFINITE);
+    }
+    return _put_head(w, CBOR_MAP, count);
+}
+
+coap_state_t coap_cbor_put_break(coap_cbor_writer_t *w)
+{
+    return _put_byte(w, CBOR_BREAK);
+}
+
+coap_state_t coap_cbor_put_tag(coap_cbor_writer_t *w, const uint64_t tag)
+{
+    return _put_head(w, CBOR_TAG, tag);
+}
+
+coap_state_t coap_cbor_put_bool(coap_cbor_writer_t *w, const bool value)
+{
+    return _put_byte(w, value ? CBOR_TRUE : CBOR_FALSE);
+}
+
+coap_state_t coap_cbor_put_null(coap_cbor_writer_t *w)
+{
+    return _put_byte(w, CBOR_NULL);
+}
+
+coap_state_t coap_cbor_put_double(coap_cbor_writer_t *w, const double value)
+{
+    uint8_t *p;
+    if (isnan(value)) {
+        // canonical NaN, https://tools.ietf.org/html/rfc8949#section-4.2.2
+        if (!(p = _reserve(w, 3))) {
+            return w->err;
+        }
+        p[0] = CBOR_HALF;
+        p[1] = 0x7E;
+        p[2] = 0x00;
+        return COAP_SUCCESS;
+    }
+    if (isinf(value) || ((value >= -FLT_MAX) && (value <= FLT_MAX) &&
+                         ((double)(float)value == value))) {
+        float f = (float)value;
+        uint32_t bits;
+        uint16_t half;
+        memcpy(&bits, &f, sizeof(bits));
+        if (_to_half(bits, &half)) {
+            if (!(p = _reserve(w, 3))) {
+                return w->err;
+            }
+            p[0] = CBOR_HALF;
+            p[1] = half >> 8;
+            p[2] = 0xFF & half;
+            return COAP_SUCCESS;
+        }
+        if (!(p = _reserve(w, 5))) {
+            return w->err;
+        }
+        p[0] = CBOR_FLOAT;
+        for (int i = 4; i > 0; --i) {
+            p[i] = 0xFF & bits;
+            bits >>= 8;
+        }
+        return COAP_SUCCESS;
+    }
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    if (!(p = _reserve(w, 9))) {
+        return w->err;
+    }
+    p[0] = CBOR_DOUBLE;
+    for (int i = 8; i > 0; --i) {
+        p[i] = 0xFF & bits;
+        bits >>= 8;
+    }
+    return COAP_SUCCESS;
+}
+
+coap_state_t coap_cbor_put_raw(coap_cbor_writer_t *w,
+                               const uint8_t *data, const size_t len)
+{
+    uint8_t *p = _reserve(w, len);
+    if (!p) {
+        return w->err;
+    }
+    if (len) {
+        memcpy(p, data, len);
+    }
+    return COAP_SUCCESS;
+}
+
+void coap_cbor_reader_init(coap_cbor_reader_t *r,
+                           const uint8_t *buf, const size_t len)
+{
+    r->p = buf;
+    r->len = len;
+    r->pos = 0;
+}
+
+bool coap_cbor_at_end(const coap_cbor_reader_t *r)
+{
+    return r->pos >= r->len;
+}
+
+coap_state_t coap_cbor_next(coap_cbor_reader_t *r, coap_cbor_item_t *item)
+{
+    size_t next;
+    coap_state_t rc = _decode(r, item, &next);
+    if (rc == COAP_SUCCESS) {
+        r->pos = next;
+    }
+    return rc;
+}
+
+coap_state_t coap_cbor_peek(const coap_cbor_reader_t *r, coap_cbor_item_t *item)
+{
+    size_t next;
+    return _decode(r, item, &next);
+}
+
+coap_state_t coap_cbor_skip(coap_cbor_reader_t *r)
+{
+    uint64_t pending[COAP_CBOR_MAX_DEPTH]; // items left per nesting level
+    int depth = 0;
+    coap_cbor_reader_t tmp = *r;
+    coap_cbor_item_t item;
+
+    do {
+        if (coap_cbor_next(&tmp, &item) != COAP_SUCCESS) {
+            return COAP_ERR_PAYLOAD_INVALID;
+        }
+        uint64_t count = 0;
+        switch (item.type) {
+        case COAP_CBOR_BREAK:
+            if (!depth || (pending[depth - 1] != COAP_CBOR_INDEFINITE)) {
+                return COAP_ERR_PAYLOAD_INVALID;
+            }
+            --depth;
+            break;
+        case COAP_CBOR_ARRAY:
+            count = item.v.count;
+            break;
+        case COAP_CBOR_MAP:
+            count = (item.v.count == COAP_CBOR_INDEFINITE) ?
+                    COAP_CBOR_INDEFINITE : 2 * item.v.count;
+            break;
+        case COAP_CBOR_TAG:
+            count = 1;
+            break;
+        case COAP_CBOR_BYTES:
+        case COAP_CBOR_TEXT:
+            if (!item.v.str.p) {
+                count = COAP_CBOR_INDEFINITE;
+            }
+            break;
+        default:
+            break;
+        }
+        if (count) {
+            if (depth == COAP_CBOR_MAX_DEPTH) {
+                return COAP_ERR_PAYLOAD_INVALID;
+            }
+            pending[depth++] = count;
+            continue;
+        }
+        // one item complete, this may complete its enclosing items too
+        while (depth && (pending[depth - 1] != COAP_CBOR_INDEFINITE) &&
+               (--pending[depth - 1] == 0)) {
+            --depth;
+        }
+    } while (depth);
+    r->pos = tmp.pos;
+    return COAP_SUCCESS;
+}
+
+coap_state_t coap_cbor_expect(coap_cbor_reader_t *r,
+                              const coap_cbor_type_t type,
+                              coap_cbor_item_t *item)
+{
+    coap_cbor_reader_t tmp = *r;
+    if (coap_cbor_next(&tmp, item) != COAP_SUCCESS) {
+        return COAP_ERR_PAYLOAD_INVALID;
+    }
+    if (item->type != type) {
+        if ((type == COAP_CBOR_NEGINT) && (item->type == COAP_CBOR_UINT) &&
+            (item->v.u <= INT64_MAX)) {
+            // v.i aliases v.u
+        }
+        else if ((type == COAP_CBOR_FLOAT) && (item->type == COAP_CBOR_UINT)) {
+            item->v.f = (double)item->v.u;
+        }
+        else if ((type == COAP_CBOR_FLOAT) && (item->type == COAP_CBOR_NEGINT)) {
+            item->v.f = (double)item->v.i;
+        }
+        else {
+            return COAP_ERR_PAYLOAD_INVALID;
+        }
+        item->type = type;
+    }
+    r->pos = tmp.pos;
+    return COAP_SUCCESS;
+}
+
+coap_state_t coap_cbor_map_find(coap_cbor_reader_t *r, const uint64_t count,
+                                const char *key)
+{
+    const size_t keylen = strlen(key);
+    coap_cbor_item_t item;
+
+    for (uint64_t i = 0; (count == COAP_CBOR_INDEFINITE) || (i < count); ++i) {
+        if (coap_cbor_peek(r, &item) != COAP_SUCCESS) {
+            return COAP_ERR_PAYLOAD_INVALID;
+        }
+        if (item.type == COAP_CBOR_BREAK) {
+            if (count != COAP_CBOR_INDEFINITE) {
+                return COAP_ERR_PAYLOAD_INVALID;
+            }
+            coap_cbor_next(r, &item);
+            break;
+        }
+        if ((item.type == COAP_CBOR_TEXT) && item.v.str.p &&
+            (item.v.str.len == keylen) && !memcmp(item.v.str.p, key, keylen)) {
+            coap_cbor_next(r, &item);
+            return COAP_SUCCESS;
+        }
+        if ((coap_cbor_skip(r) != COAP_SUCCESS) ||
+            (coap_cbor_skip(r) != COAP_SUCCESS)) {
+            return COAP_ERR_PAYLOAD_INVALID;
+        }
+    }
+    return COAP_ERR_OPTION_NOT_FOUND;
+}
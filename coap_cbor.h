@@ -0,0 +1,218 @@
+#ifndef COAP_CBOR_H
+#define COAP_CBOR_H 1
+
+/**
+ * @file coap_cbor.h
+ *
+ * CBOR (RFC 8949) for payloads of content format 60. The writer encodes
+ * straight into a caller buffer, e.g. the one the response payload points
+ * to, the reader pulls items from a payload and returns strings as views into
+ * it. Neither allocates nor copies.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "coap.h"
+
+#ifndef COAP_CBOR_MAX_DEPTH
+#define COAP_CBOR_MAX_DEPTH 16      //!< nesting limit of coap_cbor_skip
+#endif
+
+#define COAP_CBOR_INDEFINITE UINT64_MAX //!< length of indefinite items
+
+/**
+ * Item types, major types with 7 split up
+ */
+typedef enum
+{
+    COAP_CBOR_UINT                  = 0,    //!< unsigned integer, v.u
+    COAP_CBOR_NEGINT,                       //!< negative integer, v.i
+    COAP_CBOR_BYTES,                        //!< byte string, v.str
+    COAP_CBOR_TEXT,                         //!< UTF-8 text string, v.str
+    COAP_CBOR_ARRAY,                        //!< array of v.count items
+    COAP_CBOR_MAP,                          //!< map of v.count pairs
+    COAP_CBOR_TAG,                          //!< tag v.u, tagged item follows
+    COAP_CBOR_BOOL,                         //!< false or true, v.b
+    COAP_CBOR_NULL,
+    COAP_CBOR_UNDEFINED,
+    COAP_CBOR_SIMPLE,                       //!< other simple value, v.u
+    COAP_CBOR_FLOAT,                        //!< half, single or double, v.f
+    COAP_CBOR_BREAK,                        //!< end of an indefinite item
+} coap_cbor_type_t;
+
+/**
+ * Decoded item
+ *
+ * Strings point into the decoded buffer. Indefinite arrays and maps have
+ * count COAP_CBOR_INDEFINITE, indefinite strings str.p NULL and str.len
+ * SIZE_MAX, their items or chunks follow up to a COAP_CBOR_BREAK. v.i is
+ * valid for COAP_CBOR_UINT too if the value fits.
+ */
+typedef struct coap_cbor_item
+{
+    coap_cbor_type_t type;
+    union {
+        uint64_t u;         //!< COAP_CBOR_UINT, COAP_CBOR_TAG, COAP_CBOR_SIMPLE
+        int64_t i;          //!< COAP_CBOR_NEGINT
+        uint64_t count;     //!< COAP_CBOR_ARRAY, COAP_CBOR_MAP
+        coap_buffer_t str;  //!< COAP_CBOR_BYTES, COAP_CBOR_TEXT
+        double f;           //!< COAP_CBOR_FLOAT
+        bool b;             //!< COAP_CBOR_BOOL
+    } v;
+} coap_cbor_item_t;
+
+/**
+ * Encoder state, errors are sticky so that a sequence of puts can be checked
+ * once at the end
+ */
+typedef struct coap_cbor_writer
+{
+    uint8_t *p;             //!< output buffer
+    size_t len;             //!< size of p
+    size_t pos;             //!< bytes written
+    coap_state_t err;       //!< first error, COAP_SUCCESS if none
+} coap_cbor_writer_t;
+
+/**
+ * Decoder state
+ */
+typedef struct coap_cbor_reader
+{
+    const uint8_t *p;       //!< encoded items
+    size_t len;             //!< length of p
+    size_t pos;             //!< offset of the next item
+} coap_cbor_reader_t;
+
+/**
+ * @brief Start encoding into \p buf
+ */
+void coap_cbor_writer_init(coap_cbor_writer_t *w, uint8_t *buf, const size_t len);
+
+/**
+ * @brief Encode an unsigned or a (possibly negative) integer
+ *
+ * @return 0 on success, or COAP_ERR_BUFFER_TOO_SMALL if the item does not
+ * fit or an earlier put failed
+ */
+coap_state_t coap_cbor_put_uint(coap_cbor_writer_t *w, const uint64_t value);
+coap_state_t coap_cbor_put_int(coap_cbor_writer_t *w, const int64_t value);
+
+/**
+ * @brief Encode a byte or text string, \p len bytes are copied from \p data
+ */
+coap_state_t coap_cbor_put_bytes(coap_cbor_writer_t *w,
+                                 const uint8_t *data, const size_t len);
+coap_state_t coap_cbor_put_text(coap_cbor_writer_t *w,
+                                const char *text, const size_t len);
+
+/**
+ * @brief Encode a string header and return where its \p len bytes go
+ *
+ * For handlers that produce the string content themselves, e.g. with
+ * snprintf, without an intermediate buffer.
+ *
+ * @return Pointer to \p len bytes to fill, or NULL if they do not fit
+ */
+uint8_t *coap_cbor_put_bytes_ptr(coap_cbor_writer_t *w, const size_t len);
+char *coap_cbor_put_text_ptr(coap_cbor_writer_t *w, const size_t len);
+
+/**
+ * @brief Encode the head of an array of \p count items or a map of \p count
+ * pairs, COAP_CBOR_INDEFINITE starts one ended by coap_cbor_put_break
+ */
+coap_state_t coap_cbor_put_array(coap_cbor_writer_t *w, const uint64_t count);
+coap_state_t coap_cbor_put_map(coap_cbor_writer_t *w, const uint64_t count);
+coap_state_t coap_cbor_put_break(coap_cbor_writer_t *w);
+
+/**
+ * @brief Encode tag \p tag, the tagged item has to follow
+ */
+coap_state_t coap_cbor_put_tag(coap_cbor_writer_t *w, const uint64_t tag);
+
+coap_state_t coap_cbor_put_bool(coap_cbor_writer_t *w, const bool value);
+coap_state_t coap_cbor_put_null(coap_cbor_writer_t *w);
+
+/**
+ * @brief Encode a float in the shortest of half, single or double precision
+ * that represents \p value exactly (preferred serialisation)
+ */
+coap_state_t coap_cbor_put_double(coap_cbor_writer_t *w, const double value);
+
+/**
+ * @brief Append \p len bytes of already encoded CBOR, e.g. an item passed
+ * through from a request without decoding it
+ */
+coap_state_t coap_cbor_put_raw(coap_cbor_writer_t *w,
+                               const uint8_t *data, const size_t len);
+
+/**
+ * @brief Start decoding \p len bytes at \p buf, e.g. inpkt->payload
+ */
+void coap_cbor_reader_init(coap_cbor_reader_t *r,
+                           const uint8_t *buf, const size_t len);
+
+/**
+ * @brief True if all items have been read
+ */
+bool coap_cbor_at_end(const coap_cbor_reader_t *r);
+
+/**
+ * @brief Decode the next item
+ *
+ * Only the head of arrays, maps and tags is consumed, their content follows
+ * as separate items.
+ *
+ * @param[in,out] r Reader
+ * @param[out] item Decoded item
+ *
+ * @return 0 on success, or COAP_ERR_PAYLOAD_INVALID if the input is
+ * truncated or not well-formed, or a negative integer below INT64_MIN, the
+ * reader does not advance then
+ */
+coap_state_t coap_cbor_next(coap_cbor_reader_t *r, coap_cbor_item_t *item);
+
+/**
+ * @brief Decode the next item without consuming it
+ */
+coap_state_t coap_cbor_peek(const coap_cbor_reader_t *r, coap_cbor_item_t *item);
+
+/**
+ * @brief Skip the next item including everything nested in it
+ *
+ * @return 0 on success, or COAP_ERR_PAYLOAD_INVALID if the input is
+ * malformed or nested deeper than COAP_CBOR_MAX_DEPTH
+ */
+coap_state_t coap_cbor_skip(coap_cbor_reader_t *r);
+
+/**
+ * @brief Decode the next item and check its type
+ *
+ * COAP_CBOR_UINT is accepted for \p type COAP_CBOR_NEGINT if the value fits
+ * v.i, and integers for COAP_CBOR_FLOAT, converted.
+ *
+ * @return 0 on success, or COAP_ERR_PAYLOAD_INVALID on other types
+ */
+coap_state_t coap_cbor_expect(coap_cbor_reader_t *r,
+                              const coap_cbor_type_t type,
+                              coap_cbor_item_t *item);
+
+/**
+ * @brief Look up text key \p key in the map that starts at the reader
+ *
+ * The map head must have been read, \p count is the number of pairs left or
+ * COAP_CBOR_INDEFINITE. On success the reader is positioned at the value,
+ * pairs before the key have been skipped.
+ *
+ * @return 0 on success, COAP_ERR_OPTION_NOT_FOUND if there is no such key,
+ * the reader is behind the map then, or COAP_ERR_PAYLOAD_INVALID
+ */
+coap_state_t coap_cbor_map_find(coap_cbor_reader_t *r, const uint64_t count,
+                                const char *key);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
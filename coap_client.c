@@ -0,0 +1,562 @@
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "coap.h"
+#include "coap_client.h"
+#include "coap_metrics.h"
+
+enum {
+    REQ_FREE,
+    REQ_WAIT_ACK,
+    REQ_WAIT_RSP,
+    REQ_OBSERVING,
+};
+
+#define OBSERVE_DEFAULT_MAX_AGE 60      //!< seconds, if a notification has no Max-Age
+#define OBSERVE_REORDER_MS      128000  //!< notifications this much newer always win
+
+/* an endpoint that responded to a group request, IPv4 mapped */
+struct coap_client_member
+{
+    uint8_t addr[16];
+    uint16_t port;
+    bool used;
+};
+
+/* --- PRIVATE -------------------------------------------------------------- */
+static uint32_t _rand(coap_client_t *client)
+{
+    uint32_t x = client->rand;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    client->rand = x;
+    return x;
+}
+
+/* bijective, so tokens of one client repeat only after 2^32 requests */
+static uint32_t _mix(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x85ebca6bu;
+    x ^= x >> 13;
+    x *= 0xc2b2ae35u;
+    x ^= x >> 16;
+    return x;
+}
+
+/* \p addr as the socket needs it, IPv4 mapped into IPv6 if it is one */
+static bool _peer(const coap_client_t *client, const struct sockaddr *addr,
+                  const socklen_t addrlen, struct sockaddr_storage *peer,
+                  socklen_t *peerlen)
+{
+    if ((addr->sa_family == AF_INET) && (client->family == AF_INET6) &&
+        (addrlen >= sizeof(struct sockaddr_in))) {
+        const struct sockaddr_in *in = (const struct sockaddr_in *)addr;
+        struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)peer;
+        memset(in6, 0, sizeof(*in6));
+        in6->sin6_family = AF_INET6;
+        in6->sin6_port = in->sin_port;
+        in6->sin6_addr.s6_addr[10] = 0xff;
+        in6->sin6_addr.s6_addr[11] = 0xff;
+        memcpy(&in6->sin6_addr.s6_addr[12], &in->sin_addr, 4);
+        *peerlen = sizeof(*in6);
+        return true;
+    }
+    if ((addr->sa_family != client->family) || (addrlen > sizeof(*peer))) {
+        return false;
+    }
+    memcpy(peer, addr, addrlen);
+    *peerlen = addrlen;
+    return true;
+}
+
+static bool _same_peer(const struct sockaddr_storage *a, const struct sockaddr_storage *b)
+{
+    if (a->ss_family != b->ss_family) {
+        return false;
+    }
+    if (a->ss_family == AF_INET6) {
+        const struct sockaddr_in6 *x = (const struct sockaddr_in6 *)a;
+        const struct sockaddr_in6 *y = (const struct sockaddr_in6 *)b;
+        return (x->sin6_port == y->sin6_port) &&
+               !memcmp(&x->sin6_addr, &y->sin6_addr, sizeof(x->sin6_addr));
+    }
+    const struct sockaddr_in *x = (const struct sockaddr_in *)a;
+    const struct sockaddr_in *y = (const struct sockaddr_in *)b;
+    return (x->sin_port == y->sin_port) && (x->sin_addr.s_addr == y->sin_addr.s_addr);
+}
+
+static bool _same_tok(const coap_packet_t *pkt, const uint8_t tok[COAP_CLIENT_TOKLEN])
+{
+    return (pkt->tok.len == COAP_CLIENT_TOKLEN) && !memcmp(pkt->tok.p, tok, COAP_CLIENT_TOKLEN);
+}
+
+/* whether \p peer has not responded to \p group before, then it has */
+static bool _member_new(coap_client_group_t *group, const struct sockaddr_storage *peer)
+{
+    coap_client_member_t key;
+    uint32_t h, w[4];
+
+    memset(&key, 0, sizeof(key));
+    if (peer->ss_family == AF_INET6) {
+        const struct sockaddr_in6 *in6 = (const struct sockaddr_in6 *)peer;
+        memcpy(key.addr, &in6->sin6_addr, sizeof(key.addr));
+        key.port = in6->sin6_port;
+    }
+    else {
+        const struct sockaddr_in *in = (const struct sockaddr_in *)peer;
+        key.addr[10] = 0xff;
+        key.addr[11] = 0xff;
+        memcpy(&key.addr[12], &in->sin_addr, 4);
+        key.port = in->sin_port;
+    }
+    memcpy(w, key.addr, sizeof(w));
+    h = _mix(w[0] ^ _mix(w[1] ^ _mix(w[2] ^ _mix(w[3] ^ key.port))));
+    for (size_t i = h & (group->cap - 1); ; i = (i + 1) & (group->cap - 1)) {
+        coap_client_member_t *m = &group->table[i];
+        if (!m->used) {
+            if (group->members == group->max_members) {
+                group->dropped++;
+                return false;
+            }
+            *m = key;
+            m->used = true;
+            group->members++;
+            return true;
+        }
+        if ((m->port == key.port) && !memcmp(m->addr, key.addr, sizeof(key.addr))) {
+            group->duplicates++;
+            return false;
+        }
+    }
+}
+
+/* hands the batch to the callback, at the end of the window the last time */
+static size_t _group_flush(coap_client_t *client, coap_client_group_t *group, const bool done)
+{
+    const size_t n = group->nbatch;
+
+    if (!n && !done) {
+        return 0;
+    }
+    group->nbatch = 0;
+    group->batches++;
+    if (done) {
+        coap_client_group_cancel(client, group);
+    }
+    group->cb(group->arg, group->batch, n, done);
+    return 1;
+}
+
+static size_t _group_receive(coap_client_t *client, coap_client_group_t *group,
+                             const uint8_t *buf, const size_t len,
+                             const struct sockaddr_storage *peer, const socklen_t peerlen)
+{
+    if (!_member_new(group, peer)) {
+        return 0;
+    }
+    coap_client_response_t *rsp = &group->batch[group->nbatch++];
+    memcpy(&rsp->addr, peer, peerlen);
+    rsp->addrlen = peerlen;
+    memcpy(rsp->dgram, buf, len);
+    coap_parse(rsp->dgram, len, &rsp->pkt);
+    client->received++;
+    return (group->nbatch == COAP_CLIENT_GROUP_BATCH) ? _group_flush(client, group, false) : 0;
+}
+
+static void _send_empty(coap_client_t *client, const uint8_t type, const uint16_t msgid,
+                        const struct sockaddr_storage *peer, const socklen_t peerlen)
+{
+    const uint8_t dgram[4] = { (COAP_VERSION << 6) | (type << 4), 0,
+                               (uint8_t)(msgid >> 8), (uint8_t)msgid };
+    sendto(client->fd, dgram, sizeof(dgram), MSG_DONTWAIT,
+           (const struct sockaddr *)peer, peerlen);
+}
+
+/* RFC 7641 section 3.4, \p v2 at \p t2 is newer than the last notification */
+static bool _fresher(const coap_client_request_t *req, const uint32_t v2, const uint32_t t2)
+{
+    const uint32_t v1 = req->seq;
+    return ((v1 < v2) && (v2 - v1 < (1u << 23))) ||
+           ((v1 > v2) && (v1 - v2 > (1u << 23))) ||
+           (t2 - req->at > OBSERVE_REORDER_MS);
+}
+
+/* observations entered and left move the observer gauge */
+static void _state(coap_client_request_t *req, const int state)
+{
+    COAP_METRICS_GAUGE(COAP_GAUGE_OBSERVERS,
+                       (int64_t)(state == REQ_OBSERVING) - (req->state == REQ_OBSERVING));
+    req->state = state;
+}
+
+/* the request is over, the callback may send the next one into its slot */
+static size_t _finish(coap_client_request_t *req, const coap_state_t state,
+                      const coap_packet_t *rsp)
+{
+    const coap_client_cb_t cb = req->cb;
+    void *arg = req->arg;
+    _state(req, REQ_FREE);
+    cb(arg, state, rsp);
+    return 1;
+}
+
+static size_t _deliver(coap_client_t *client, coap_client_request_t *req,
+                       const coap_packet_t *rsp, const uint32_t now)
+{
+    uint8_t count;
+    const coap_option_t *obs = coap_find_options(rsp, COAP_OPTION_OBSERVE, &count);
+
+    client->received++;
+    if (!req->observe || !obs || ((rsp->hdr.code >> 5) != 2)) {
+        return _finish(req, COAP_RSP_RECV, rsp);
+    }
+    const uint32_t seq = coap_decode_uint(&obs->buf);
+    if (req->notified && !_fresher(req, seq, now)) {
+        client->received--;
+        return 0;
+    }
+    const coap_option_t *max_age = coap_find_options(rsp, COAP_OPTION_MAX_AGE, &count);
+    const uint32_t age = max_age ? coap_decode_uint(&max_age->buf) : OBSERVE_DEFAULT_MAX_AGE;
+    _state(req, REQ_OBSERVING);
+    req->notified = true;
+    req->seq = seq;
+    req->at = now;
+    // the server has to notify again before the last one is stale
+    req->deadline = now + age * 1000 + COAP_CLIENT_ACK_TIMEOUT_MS;
+    req->cb(req->arg, COAP_RSP_RECV, rsp);
+    return 1;
+}
+
+static size_t _receive(coap_client_t *client, const uint8_t *buf, const size_t len,
+                       const struct sockaddr_storage *peer, const socklen_t peerlen,
+                       const uint32_t now)
+{
+    coap_packet_t pkt;
+
+    if (coap_parse(buf, len, &pkt) != COAP_SUCCESS) {
+        return 0;
+    }
+    if ((pkt.hdr.t == COAP_TYPE_ACK) || (pkt.hdr.t == COAP_TYPE_RESET)) {
+        for (size_t i = 0; i < COAP_CLIENT_MAX_REQUESTS; ++i) {
+            coap_client_request_t *req = &client->reqs[i];
+            if ((req->state != REQ_WAIT_ACK) || (req->msgid != pkt.hdr.id) ||
+                !_same_peer(&req->addr, peer)) {
+                continue;
+            }
+            if (pkt.hdr.t == COAP_TYPE_RESET) {
+                return _finish(req, COAP_ERR_RESPONSE, NULL);
+            }
+            if (pkt.hdr.code == COAP_RSPCODE_EMPTY) {
+                req->state = REQ_WAIT_RSP;
+                req->deadline = now + COAP_CLIENT_RSP_TIMEOUT_MS;
+                return 0;
+            }
+            if (_same_tok(&pkt, req->tok)) {
+                return _deliver(client, req, &pkt, now);
+            }
+            return 0;
+        }
+        return 0;
+    }
+    if (pkt.hdr.code < MAKE_RSPCODE(2, 0)) {
+        // requests and pings are not for a client
+        if (pkt.hdr.t == COAP_TYPE_CON) {
+            _send_empty(client, COAP_TYPE_RESET, pkt.hdr.id, peer, peerlen);
+        }
+        return 0;
+    }
+    for (size_t i = 0; i < COAP_CLIENT_MAX_REQUESTS; ++i) {
+        coap_client_request_t *req = &client->reqs[i];
+        if ((req->state == REQ_FREE) || !_same_tok(&pkt, req->tok) ||
+            !_same_peer(&req->addr, peer)) {
+            continue;
+        }
+        if (pkt.hdr.t == COAP_TYPE_CON) {
+            _send_empty(client, COAP_TYPE_ACK, pkt.hdr.id, peer, peerlen);
+        }
+        return _deliver(client, req, &pkt, now);
+    }
+    for (size_t i = 0; i < COAP_CLIENT_MAX_GROUPS; ++i) {
+        coap_client_group_t *group = client->groups[i];
+        if (!group || !_same_tok(&pkt, group->tok) || (len > COAP_CLIENT_DGRAM_SIZE)) {
+            continue;
+        }
+        if (pkt.hdr.t == COAP_TYPE_CON) {
+            _send_empty(client, COAP_TYPE_ACK, pkt.hdr.id, peer, peerlen);
+        }
+        return _group_receive(client, group, buf, len, peer, peerlen);
+    }
+    // e.g. notifications of a cancelled observation
+    _send_empty(client, COAP_TYPE_RESET, pkt.hdr.id, peer, peerlen);
+    return 0;
+}
+
+/* --- PUBLIC --------------------------------------------------------------- */
+coap_state_t coap_client_init(coap_client_t *client, const uint32_t seed)
+{
+    memset(client, 0, sizeof(*client));
+    client->family = AF_INET6;
+    client->fd = socket(AF_INET6, SOCK_DGRAM, 0);
+    if (client->fd >= 0) {
+        const int off = 0;
+        setsockopt(client->fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+    }
+    else {
+        client->family = AF_INET;
+        client->fd = socket(AF_INET, SOCK_DGRAM, 0);
+    }
+    if (client->fd < 0) {
+        return COAP_ERR;
+    }
+    fcntl(client->fd, F_SETFL, fcntl(client->fd, F_GETFL) | O_NONBLOCK);
+    client->tokgen = seed;
+    client->rand = _mix(seed) | 1;
+    client->msgid = (uint16_t)_rand(client);
+    return COAP_SUCCESS;
+}
+
+void coap_client_close(coap_client_t *client)
+{
+    if (client->fd >= 0) {
+        close(client->fd);
+    }
+    client->fd = -1;
+    for (size_t i = 0; i < COAP_CLIENT_MAX_REQUESTS; ++i) {
+        _state(&client->reqs[i], REQ_FREE);
+    }
+    for (size_t i = 0; i < COAP_CLIENT_MAX_GROUPS; ++i) {
+        if (client->groups[i]) {
+            coap_client_group_cancel(client, client->groups[i]);
+        }
+    }
+}
+
+int coap_client_send(coap_client_t *client, const coap_packet_t *pkt,
+                     const struct sockaddr *addr, const socklen_t addrlen,
+                     const uint32_t now, coap_client_cb_t cb, void *arg)
+{
+    coap_client_request_t *req = NULL;
+    int handle;
+    uint8_t count;
+
+    for (handle = 0; handle < COAP_CLIENT_MAX_REQUESTS; ++handle) {
+        if (client->reqs[handle].state == REQ_FREE) {
+            req = &client->reqs[handle];
+            break;
+        }
+    }
+    if (!req || !_peer(client, addr, addrlen, &req->addr, &req->addrlen)) {
+        return -1;
+    }
+    const uint32_t tok = _mix(client->tokgen++);
+    coap_packet_t out = *pkt;
+    req->tok[0] = (uint8_t)(tok >> 24);
+    req->tok[1] = (uint8_t)(tok >> 16);
+    req->tok[2] = (uint8_t)(tok >> 8);
+    req->tok[3] = (uint8_t)tok;
+    out.hdr.id = req->msgid = client->msgid++;
+    out.hdr.tkl = COAP_CLIENT_TOKLEN;
+    out.tok.p = req->tok;
+    out.tok.len = COAP_CLIENT_TOKLEN;
+    req->len = sizeof(req->dgram);
+    if (coap_build(&out, req->dgram, &req->len) != COAP_SUCCESS) {
+        return -1;
+    }
+    const coap_option_t *obs = coap_find_options(pkt, COAP_OPTION_OBSERVE, &count);
+    req->observe = obs && !coap_decode_uint(&obs->buf);
+    req->notified = false;
+    req->retransmits = 0;
+    req->cb = cb;
+    req->arg = arg;
+    if (pkt->hdr.t == COAP_TYPE_CON) {
+        // ACK_TIMEOUT to ACK_TIMEOUT * ACK_RANDOM_FACTOR
+        req->state = REQ_WAIT_ACK;
+        req->timeout = COAP_CLIENT_ACK_TIMEOUT_MS +
+                       _rand(client) % (COAP_CLIENT_ACK_TIMEOUT_MS / 2 + 1);
+    }
+    else {
+        req->state = REQ_WAIT_RSP;
+        req->timeout = COAP_CLIENT_RSP_TIMEOUT_MS;
+    }
+    req->deadline = now + req->timeout;
+    // a datagram lost here is the same as one lost on the way
+    sendto(client->fd, req->dgram, req->len, MSG_DONTWAIT,
+           (const struct sockaddr *)&req->addr, req->addrlen);
+    client->sent++;
+    return handle;
+}
+
+void coap_client_cancel(coap_client_t *client, const int handle)
+{
+    if ((handle >= 0) && (handle < COAP_CLIENT_MAX_REQUESTS)) {
+        _state(&client->reqs[handle], REQ_FREE);
+    }
+}
+
+coap_state_t coap_client_group_init(coap_client_group_t *group, const size_t max_members)
+{
+    memset(group, 0, sizeof(*group));
+    // at most half full, so that probes stay short
+    group->cap = 16;
+    while (group->cap < 2 * max_members) {
+        group->cap *= 2;
+    }
+    group->max_members = max_members;
+    group->table = calloc(group->cap, sizeof(*group->table));
+    group->batch = malloc(COAP_CLIENT_GROUP_BATCH * sizeof(*group->batch));
+    if (!group->table || !group->batch) {
+        coap_client_group_free(group);
+        return COAP_ERR_BUFFER_TOO_SMALL;
+    }
+    return COAP_SUCCESS;
+}
+
+void coap_client_group_free(coap_client_group_t *group)
+{
+    free(group->table);
+    free(group->batch);
+    memset(group, 0, sizeof(*group));
+}
+
+coap_state_t coap_client_group_send(coap_client_t *client, coap_client_group_t *group,
+                                    const coap_packet_t *pkt, const struct sockaddr *addr,
+                                    const socklen_t addrlen, const uint32_t now,
+                                    const uint32_t window_ms, coap_client_group_cb_t cb,
+                                    void *arg)
+{
+    uint8_t dgram[COAP_CLIENT_DGRAM_SIZE];
+    size_t len = sizeof(dgram);
+    struct sockaddr_storage peer;
+    socklen_t peerlen;
+    coap_client_group_t **slot = NULL;
+
+    for (size_t i = 0; (i < COAP_CLIENT_MAX_GROUPS) && !slot; ++i) {
+        slot = client->groups[i] ? NULL : &client->groups[i];
+    }
+    if (!slot || group->active || !_peer(client, addr, addrlen, &peer, &peerlen)) {
+        return COAP_ERR_BUFFER_TOO_SMALL;
+    }
+    const uint32_t tok = _mix(client->tokgen++);
+    coap_packet_t out = *pkt;
+    group->tok[0] = (uint8_t)(tok >> 24);
+    group->tok[1] = (uint8_t)(tok >> 16);
+    group->tok[2] = (uint8_t)(tok >> 8);
+    group->tok[3] = (uint8_t)tok;
+    out.hdr.t = COAP_TYPE_NONCON;
+    out.hdr.id = client->msgid++;
+    out.hdr.tkl = COAP_CLIENT_TOKLEN;
+    out.tok.p = group->tok;
+    out.tok.len = COAP_CLIENT_TOKLEN;
+    if (coap_build(&out, dgram, &len) != COAP_SUCCESS) {
+        return COAP_ERR_BUFFER_TOO_SMALL;
+    }
+    // thousands of responses may come within the Leisure of the servers;
+    // beyond net.core.rmem_max only with CAP_NET_ADMIN
+    const int rcvbuf = COAP_CLIENT_GROUP_RCVBUF;
+    if (setsockopt(client->fd, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof(rcvbuf))) {
+        setsockopt(client->fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    }
+    memset(group->table, 0, group->cap * sizeof(*group->table));
+    group->members = 0;
+    group->nbatch = 0;
+    group->deadline = now + window_ms;
+    group->cb = cb;
+    group->arg = arg;
+    group->active = true;
+    *slot = group;
+    sendto(client->fd, dgram, len, MSG_DONTWAIT, (const struct sockaddr *)&peer, peerlen);
+    client->sent++;
+    return COAP_SUCCESS;
+}
+
+void coap_client_group_cancel(coap_client_t *client, coap_client_group_t *group)
+{
+    for (size_t i = 0; i < COAP_CLIENT_MAX_GROUPS; ++i) {
+        if (client->groups[i] == group) {
+            client->groups[i] = NULL;
+        }
+    }
+    group->active = false;
+}
+
+size_t coap_client_process(coap_client_t *client, const uint32_t now)
+{
+    uint8_t buf[1500];
+    size_t n = 0;
+
+    for (;;) {
+        struct sockaddr_storage peer;
+        socklen_t peerlen = sizeof(peer);
+        const ssize_t len = recvfrom(client->fd, buf, sizeof(buf), MSG_DONTWAIT,
+                                     (struct sockaddr *)&peer, &peerlen);
+        if (len < 0) {
+            break;
+        }
+        n += _receive(client, buf, (size_t)len, &peer, peerlen, now);
+    }
+    for (size_t i = 0; i < COAP_CLIENT_MAX_REQUESTS; ++i) {
+        coap_client_request_t *req = &client->reqs[i];
+        if ((req->state == REQ_FREE) || ((int32_t)(now - req->deadline) < 0)) {
+            continue;
+        }
+        if ((req->state == REQ_WAIT_ACK) && (req->retransmits < COAP_CLIENT_MAX_RETRANSMIT)) {
+            req->retransmits++;
+            req->timeout *= 2;
+            req->deadline = now + req->timeout;
+            sendto(client->fd, req->dgram, req->len, MSG_DONTWAIT,
+                   (const struct sockaddr *)&req->addr, req->addrlen);
+            client->retransmissions++;
+            COAP_METRICS_INC(COAP_METRIC_RETRANSMITS);
+            continue;
+        }
+        n += _finish(req, COAP_ERR_TIMEOUT, NULL);
+    }
+    // what came in this round, then the end of windows
+    for (size_t i = 0; i < COAP_CLIENT_MAX_GROUPS; ++i) {
+        coap_client_group_t *group = client->groups[i];
+        if (group) {
+            n += _group_flush(client, group, false);
+        }
+        group = client->groups[i];
+        if (group && ((int32_t)(now - group->deadline) >= 0)) {
+            n += _group_flush(client, group, true);
+        }
+    }
+    return n;
+}
+
+int coap_client_timeout(const coap_client_t *client, const uint32_t now)
+{
+    int timeout = -1;
+    for (size_t i = 0; i < COAP_CLIENT_MAX_REQUESTS; ++i) {
+        const coap_client_request_t *req = &client->reqs[i];
+        if (req->state == REQ_FREE) {
+            continue;
+        }
+        const int32_t left = (int32_t)(req->deadline - now);
+        if ((timeout < 0) || (left < timeout)) {
+            timeout = (left < 0) ? 0 : left;
+        }
+    }
+    for (size_t i = 0; i < COAP_CLIENT_MAX_GROUPS; ++i) {
+        if (!client->groups[i]) {
+            continue;
+        }
+        const int32_t left = (int32_t)(client->groups[i]->deadline - now);
+        if ((timeout < 0) || (left < timeout)) {
+            timeout = (left < 0) ? 0 : left;
+        }
+    }
+    return timeout;
+}
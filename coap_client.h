@@ -0,0 +1,269 @@
+#ifndef COAP_CLIENT_H
+#define COAP_CLIENT_H 1
+
+/**
+ * @file coap_client.h
+ *
+ * Asynchronous CoAP client on one UDP socket. Requests get a token and a
+ * message ID from the client and are retransmitted with exponential back-off
+ * until acknowledged (RFC 7252 section 4.2); responses, piggybacked or
+ * separate, are matched by token and endpoint and passed to a callback.
+ * Requests with Observe 0 stay registered and pass every notification
+ * (RFC 7641), stale and reordered ones dropped, until cancelled.
+ *
+ * Group requests (RFC 7252 section 8.2) go to a multicast address once,
+ * non-confirmable, and collect the responses of all servers for one token
+ * during a window: the first response of each source endpoint is passed on,
+ * repeated ones are counted and dropped, and responses are handed to the
+ * callback in batches instead of one call each. The table of responders is
+ * allocated by coap_client_group_init for a given number of responders.
+ *
+ * Nothing blocks: poll client->fd for POLLIN and call coap_client_process
+ * whenever it is readable or coap_client_timeout has passed. The socket is
+ * IPv6 with IPv4 mapped addresses where available, IPv4 otherwise. Not
+ * thread safe.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <sys/socket.h>
+
+#include "coap.h"
+
+#ifndef COAP_CLIENT_MAX_REQUESTS
+#define COAP_CLIENT_MAX_REQUESTS    64      //!< requests and observations in flight
+#endif
+#ifndef COAP_CLIENT_ACK_TIMEOUT_MS
+#define COAP_CLIENT_ACK_TIMEOUT_MS  2000    //!< ACK_TIMEOUT, randomised by 1.5
+#endif
+#define COAP_CLIENT_MAX_RETRANSMIT  4       //!< MAX_RETRANSMIT
+#define COAP_CLIENT_RSP_TIMEOUT_MS  10000   //!< waiting for a separate or NON response
+#define COAP_CLIENT_DGRAM_SIZE      1152    //!< largest request, a 1024 byte block with options
+#define COAP_CLIENT_TOKLEN          4       //!< token length of requests
+#ifndef COAP_CLIENT_MAX_GROUPS
+#define COAP_CLIENT_MAX_GROUPS      4       //!< group requests collecting at a time
+#endif
+#define COAP_CLIENT_GROUP_BATCH     64      //!< responses per callback of a group
+#ifndef COAP_CLIENT_GROUP_RCVBUF
+#define COAP_CLIENT_GROUP_RCVBUF    (8 << 20) //!< socket buffer while collecting, bytes
+#endif
+
+/**
+ * @brief Called with the outcome of a request
+ *
+ * @param[in] arg As passed to coap_client_send
+ * @param[in] state COAP_RSP_RECV with the response in \p rsp, for an
+ * observation once per notification; COAP_ERR_TIMEOUT if no response came,
+ * or for an observation if no notification came within its Max-Age;
+ * COAP_ERR_RESPONSE if the server reset the request. The request is over
+ * afterwards unless it is an observation that got a notification.
+ * @param[in] rsp Response, valid during the call only
+ */
+typedef void (*coap_client_cb_t)(void *arg, const coap_state_t state,
+                                 const coap_packet_t *rsp);
+
+/**
+ * Request in flight, private
+ */
+typedef struct coap_client_request
+{
+    int state;              //!< free, waiting for the ACK, the response, or observing
+    uint8_t tok[COAP_CLIENT_TOKLEN];
+    uint16_t msgid;
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+    uint32_t deadline;      //!< ms, retransmission or giving up
+    uint32_t timeout;       //!< current ACK timeout, ms
+    uint8_t retransmits;
+    bool observe;           //!< registered with Observe 0
+    bool notified;          //!< got a notification, seq and at are valid
+    uint32_t seq;           //!< Observe value of the last notification
+    uint32_t at;            //!< when it came, ms
+    coap_client_cb_t cb;
+    void *arg;
+    size_t len;             //!< of dgram
+    uint8_t dgram[COAP_CLIENT_DGRAM_SIZE];
+} coap_client_request_t;
+
+/**
+ * Response to a group request
+ */
+typedef struct coap_client_response
+{
+    struct sockaddr_storage addr;   //!< source endpoint
+    socklen_t addrlen;
+    coap_packet_t pkt;              //!< response, pointing into dgram
+    uint8_t dgram[COAP_CLIENT_DGRAM_SIZE];
+} coap_client_response_t;
+
+/**
+ * @brief Called with a batch of responses to a group request
+ *
+ * @param[in] arg As passed to coap_client_group_send
+ * @param[in] rsps Responses of distinct endpoints, valid during the call only
+ * @param[in] n Number of \p rsps, may be 0 on the last call
+ * @param[in] done Whether the window is over, this is the last call
+ */
+typedef void (*coap_client_group_cb_t)(void *arg, const coap_client_response_t *rsps,
+                                       const size_t n, const bool done);
+
+typedef struct coap_client_member coap_client_member_t;
+
+/**
+ * Group request, set up with coap_client_group_init
+ */
+typedef struct coap_client_group
+{
+    bool active;                    //!< collecting responses
+    uint8_t tok[COAP_CLIENT_TOKLEN];
+    uint32_t deadline;              //!< end of the window, ms
+    coap_client_group_cb_t cb;
+    void *arg;
+    size_t max_members;             //!< distinct endpoints passed on at most
+    size_t members;                 //!< distinct endpoints passed on
+    size_t cap;                     //!< slots of table, a power of 2
+    coap_client_member_t *table;    //!< endpoints seen, open addressing
+    size_t nbatch;                  //!< responses in batch
+    coap_client_response_t *batch;  //!< COAP_CLIENT_GROUP_BATCH responses
+    uint32_t duplicates;            //!< responses of an endpoint seen already
+    uint32_t dropped;               //!< responses beyond max_members
+    uint32_t batches;               //!< callbacks made
+} coap_client_group_t;
+
+/**
+ * Client
+ */
+typedef struct coap_client
+{
+    int fd;                 //!< UDP socket, poll for POLLIN
+    int family;             //!< AF_INET6 or AF_INET
+    uint16_t msgid;
+    uint32_t tokgen;        //!< token generator
+    uint32_t rand;          //!< xorshift state of the back-off
+    uint32_t sent;          //!< requests sent, without retransmissions
+    uint32_t retransmissions;
+    uint32_t received;      //!< responses and notifications passed on
+    coap_client_request_t reqs[COAP_CLIENT_MAX_REQUESTS];
+    coap_client_group_t *groups[COAP_CLIENT_MAX_GROUPS];
+} coap_client_t;
+
+/**
+ * @brief Open the socket
+ *
+ * @param[out] client Client
+ * @param[in] seed Random seed of tokens and back-off, e.g. from getrandom
+ *
+ * @return 0 on success, or COAP_ERR if there is no socket
+ */
+coap_state_t coap_client_init(coap_client_t *client, const uint32_t seed);
+
+/**
+ * @brief Close the socket, requests in flight are dropped silently
+ */
+void coap_client_close(coap_client_t *client);
+
+/**
+ * @brief Send a request
+ *
+ * Message ID and token of \p pkt are replaced, a confirmable request is
+ * retransmitted until acknowledged. Add Observe 0 to register an
+ * observation, it lasts until cancelled or the server ends it.
+ *
+ * @param[in,out] client Client
+ * @param[in] pkt Request, CON or NON
+ * @param[in] addr Server, IPv4 or IPv6
+ * @param[in] addrlen Length of \p addr
+ * @param[in] now Current time in ms, any monotonic clock
+ * @param[in] cb Callback with the response
+ * @param[in] arg Passed to \p cb
+ *
+ * @return Handle of the request for coap_client_cancel, or -1 if
+ * COAP_CLIENT_MAX_REQUESTS are in flight or \p pkt does not build
+ */
+int coap_client_send(coap_client_t *client, const coap_packet_t *pkt,
+                     const struct sockaddr *addr, const socklen_t addrlen,
+                     const uint32_t now, coap_client_cb_t cb, void *arg);
+
+/**
+ * @brief Forget a request without calling back, also from its callback
+ *
+ * A cancelled observation is reset with the next notification.
+ */
+void coap_client_cancel(coap_client_t *client, const int handle);
+
+/**
+ * @brief Allocate the tables of a group request
+ *
+ * @param[out] group Group request
+ * @param[in] max_members Most endpoints expected to respond, responses of
+ * further ones are dropped
+ *
+ * @return 0 on success, or COAP_ERR_BUFFER_TOO_SMALL if out of memory
+ */
+coap_state_t coap_client_group_init(coap_client_group_t *group, const size_t max_members);
+
+/**
+ * @brief Free the tables of a group request, which must not be collecting
+ */
+void coap_client_group_free(coap_client_group_t *group);
+
+/**
+ * @brief Send a group request and collect its responses
+ *
+ * The token of \p pkt is replaced, the request is sent non-confirmable and
+ * not retransmitted. Responses of endpoints not seen before are passed to
+ * \p cb in batches of up to COAP_CLIENT_GROUP_BATCH, at the latest at the end
+ * of each coap_client_process; after \p window_ms \p cb is called a last time
+ * with done set and \p group can be sent again. The socket buffer is raised
+ * to COAP_CLIENT_GROUP_RCVBUF where allowed, so that bursts are not dropped
+ * before they are read.
+ *
+ * @param[in,out] client Client
+ * @param[in,out] group Group request, not collecting
+ * @param[in] pkt Request
+ * @param[in] addr Multicast address, IPv4 or IPv6
+ * @param[in] addrlen Length of \p addr
+ * @param[in] now Current time in ms
+ * @param[in] window_ms Time to collect responses, e.g. the Leisure of the
+ * servers and a round trip
+ * @param[in] cb Callback with the responses
+ * @param[in] arg Passed to \p cb
+ *
+ * @return 0 on success, or COAP_ERR_BUFFER_TOO_SMALL if COAP_CLIENT_MAX_GROUPS
+ * are collecting or \p pkt does not build
+ */
+coap_state_t coap_client_group_send(coap_client_t *client, coap_client_group_t *group,
+                                    const coap_packet_t *pkt, const struct sockaddr *addr,
+                                    const socklen_t addrlen, const uint32_t now,
+                                    const uint32_t window_ms, coap_client_group_cb_t cb,
+                                    void *arg);
+
+/**
+ * @brief Stop collecting without calling back, also from its callback
+ */
+void coap_client_group_cancel(coap_client_t *client, coap_client_group_t *group);
+
+/**
+ * @brief Receive, retransmit and time out
+ *
+ * @param[in,out] client Client
+ * @param[in] now Current time in ms
+ *
+ * @return Number of callbacks made
+ */
+size_t coap_client_process(coap_client_t *client, const uint32_t now);
+
+/**
+ * @brief Time until coap_client_process has to run next
+ *
+ * @return ms, e.g. for the timeout of poll, or -1 if nothing is pending
+ */
+int coap_client_timeout(const coap_client_t *client, const uint32_t now);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,1005 @@
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <openssl/core_names.h>
+#include <openssl/crypto.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <openssl/ssl.h>
+
+#include "coap.h"
+#include "coap_acl.h"
+#include "coap_dtls.h"
+
+/*
+ * Who may use the SSL of a session is decided by its state alone: the worker
+ * while it is SESSION_HANDSHAKE, the poll loop once the worker has stored
+ * SESSION_OPEN (release, the poll loop loads with acquire). Records the poll
+ * loop queued before are passed back to it unread, so they keep their order.
+ * pending counts the records queued to the worker; a slot is only reused when
+ * none are left, and hand-overs carry the generation of the slot.
+ */
+enum {
+    SESSION_HANDSHAKE,
+    SESSION_OPEN,
+    SESSION_DEAD,           //!< handshake failed, freed by the poll loop
+};
+
+enum {
+    HANDOVER_OPEN,          //!< handshake done, SSL belongs to the poll loop
+    HANDOVER_RESUMED,       //!< the same, abbreviated
+    HANDOVER_RECORD,        //!< record of an established session
+    HANDOVER_FAILED,
+};
+
+#define TIMER_INTERVAL_NS   10000000    //!< handshake retransmissions checked this often
+#define WAIT_MAX_MS         100
+
+typedef struct dtls_job
+{
+    uint32_t session;
+    uint32_t gen;
+    uint8_t kind;           //!< HANDOVER_*, for hand-overs
+    uint16_t len;
+    uint8_t data[COAP_DTLS_DGRAM_SIZE];
+} dtls_job_t;
+
+typedef struct dtls_ring
+{
+    dtls_job_t *jobs;
+    size_t head;
+    size_t count;
+} dtls_ring_t;
+
+struct coap_dtls_worker
+{
+    coap_dtls_t *dtls;
+    pthread_t thread;
+    bool started;
+    bool stop;
+    pthread_mutex_t lock;   //!< of both rings and stop
+    pthread_cond_t cond;
+    dtls_ring_t in;         //!< records from the poll loop
+    dtls_ring_t out;        //!< hand-overs to the poll loop
+    coap_dtls_session_t *handshakes;
+    uint64_t timers_ns;     //!< last retransmission check
+};
+
+/* --- PRIVATE -------------------------------------------------------------- */
+static uint64_t _now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/* address and port in network order, the session key */
+static size_t _addr_key(const struct sockaddr *addr, const socklen_t addrlen, uint8_t key[18])
+{
+    if ((addr->sa_family == AF_INET) && (addrlen >= sizeof(struct sockaddr_in))) {
+        const struct sockaddr_in *in = (const struct sockaddr_in *)addr;
+        memcpy(key, &in->sin_addr, 4);
+        memcpy(key + 4, &in->sin_port, 2);
+        return 6;
+    }
+    if ((addr->sa_family == AF_INET6) && (addrlen >= sizeof(struct sockaddr_in6))) {
+        const struct sockaddr_in6 *in6 = (const struct sockaddr_in6 *)addr;
+        memcpy(key, &in6->sin6_addr, 16);
+        memcpy(key + 16, &in6->sin6_port, 2);
+        return 18;
+    }
+    return 0;
+}
+
+// FNV-1a
+static uint32_t _hash(const uint8_t *key, const size_t len)
+{
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; ++i) {
+        h = (h ^ key[i]) * 16777619u;
+    }
+    return h;
+}
+
+static coap_dtls_session_t *_find(const coap_dtls_t *dtls, const uint8_t *key,
+                                  const size_t keylen, const uint32_t hash)
+{
+    const size_t mask = dtls->index_cap - 1;
+    for (size_t i = hash & mask; dtls->index[i]; i = (i + 1) & mask) {
+        coap_dtls_session_t *s = &dtls->sessions[dtls->index[i] - 1];
+        if ((s->hash == hash) && (s->keylen == keylen) && !memcmp(s->key, key, keylen)) {
+            return s;
+        }
+    }
+    return NULL;
+}
+
+static void _index_insert(coap_dtls_t *dtls, const coap_dtls_session_t *s)
+{
+    const size_t mask = dtls->index_cap - 1;
+    size_t i = s->hash & mask;
+    while (dtls->index[i]) {
+        i = (i + 1) & mask;
+    }
+    dtls->index[i] = (uint32_t)(s - dtls->sessions) + 1;
+}
+
+/* linear probing with backward shift, no deleted markers */
+static void _index_remove(coap_dtls_t *dtls, const coap_dtls_session_t *s)
+{
+    const size_t mask = dtls->index_cap - 1;
+    const uint32_t id = (uint32_t)(s - dtls->sessions) + 1;
+    size_t i = s->hash & mask;
+    while (dtls->index[i] != id) {
+        i = (i + 1) & mask;
+    }
+    for (size_t j = (i + 1) & mask; dtls->index[j]; j = (j + 1) & mask) {
+        const size_t home = dtls->sessions[dtls->index[j] - 1].hash & mask;
+        // move j to the hole at i unless its home lies cyclically in (i, j]
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            dtls->index[i] = dtls->index[j];
+            i = j;
+        }
+    }
+    dtls->index[i] = 0;
+}
+
+/* --- BIO ------------------------------------------------------------------ */
+// the record being processed goes in, flights and records go out on the socket
+static int _bio_write(BIO *bio, const char *data, int len)
+{
+    const coap_dtls_session_t *s = BIO_get_data(bio);
+    // a full socket buffer is a lost datagram, DTLS retransmits
+    sendto(s->dtls->fd, data, (size_t)len, 0, (const struct sockaddr *)&s->addr, s->addrlen);
+    return len;
+}
+
+static int _bio_read(BIO *bio, char *data, int size)
+{
+    coap_dtls_session_t *s = BIO_get_data(bio);
+    BIO_clear_retry_flags(bio);
+    if (!s->rxlen) {
+        BIO_set_retry_read(bio);
+        return -1;
+    }
+    const size_t n = (s->rxlen < (size_t)size) ? s->rxlen : (size_t)size;
+    memcpy(data, s->rx, n);
+    s->rxlen = 0;
+    return (int)n;
+}
+
+static long _bio_ctrl(BIO *bio, int cmd, long num, void *ptr)
+{
+    (void) bio;
+    (void) num;
+    (void) ptr;
+    switch (cmd) {
+    case BIO_CTRL_FLUSH:
+    case BIO_CTRL_DGRAM_SET_NEXT_TIMEOUT:
+        return 1;
+    case BIO_CTRL_DGRAM_QUERY_MTU:
+    case BIO_CTRL_DGRAM_GET_FALLBACK_MTU:
+        return COAP_DTLS_MTU;
+    default:
+        return 0;
+    }
+}
+
+static int _bio_create(BIO *bio)
+{
+    BIO_set_init(bio, 1);
+    return 1;
+}
+
+/* --- SESSIONS ------------------------------------------------------------- */
+static unsigned int _psk(SSL *ssl, const char *identity, unsigned char *psk,
+                         unsigned int max_psk_len)
+{
+    const coap_dtls_session_t *s = SSL_get_app_data(ssl);
+    const coap_dtls_config_t *config = &s->dtls->config;
+    return identity ? (unsigned int)config->psk(config->psk_ctx, identity, psk, max_psk_len) : 0;
+}
+
+static coap_dtls_session_t *_alloc(coap_dtls_t *dtls, const struct sockaddr *addr,
+                                   const socklen_t addrlen, const uint8_t *key,
+                                   const size_t keylen, const uint32_t hash)
+{
+    if (!dtls->nfree) {
+        return NULL;
+    }
+    coap_dtls_session_t *s = &dtls->sessions[dtls->free_slots[dtls->nfree - 1]];
+    BIO *bio = BIO_new(dtls->bio);
+    s->ssl = SSL_new(dtls->ctx);
+    if (!bio || !s->ssl) {
+        BIO_free(bio);
+        SSL_free(s->ssl);
+        s->ssl = NULL;
+        return NULL;
+    }
+    dtls->nfree--;
+    BIO_set_data(bio, s);
+    SSL_set_bio(s->ssl, bio, bio);
+    SSL_set_app_data(s->ssl, s);
+    SSL_set_mtu(s->ssl, COAP_DTLS_MTU);
+    SSL_set_accept_state(s->ssl);
+    memcpy(&s->addr, addr, addrlen);
+    s->addrlen = addrlen;
+    memcpy(s->key, key, keylen);
+    s->keylen = (uint8_t)keylen;
+    s->hash = hash;
+    s->gen++;
+    s->acl_gen = 0;
+    s->principal = COAP_ACL_ANONYMOUS;
+    s->state = SESSION_HANDSHAKE;
+    s->pending = 0;
+    s->started_ns = 0;
+    s->rxlen = 0;
+    s->next = NULL;
+    _index_insert(dtls, s);
+    return s;
+}
+
+/*
+ * \p keep leaves the session in the cache for resumption, as after a
+ * close_notify; SSL_free drops sessions that were not shut down
+ */
+static void _release(coap_dtls_t *dtls, coap_dtls_session_t *s, const bool keep)
+{
+    if (keep) {
+        SSL_set_shutdown(s->ssl, SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+    }
+    _index_remove(dtls, s);
+    SSL_free(s->ssl);
+    s->ssl = NULL;
+    dtls->free_slots[dtls->nfree++] = (uint32_t)(s - dtls->sessions);
+}
+
+// https://tools.ietf.org/html/rfc6347#section-4.1, epoch 0 handshake with a ClientHello
+static bool _client_hello(const uint8_t *buf, const size_t len)
+{
+    return (len >= 13 + 12) && (buf[0] == 22) && (buf[1] == 0xFE) &&
+           !buf[3] && !buf[4] && (buf[13] == 1);
+}
+
+/* --- COOKIES -------------------------------------------------------------- */
+static bool _cookie_key(coap_dtls_t *dtls, const unsigned i)
+{
+    static char digest[] = "SHA256";
+    const OSSL_PARAM params[] = {
+        OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, digest, 0),
+        OSSL_PARAM_construct_end()
+    };
+    uint8_t secret[32];
+    const bool ok = (RAND_bytes(secret, sizeof(secret)) == 1) &&
+                    EVP_MAC_init(dtls->cookie_mac[i], secret, sizeof(secret), params);
+    OPENSSL_cleanse(secret, sizeof(secret));
+    return ok;
+}
+
+/* HMAC of the address and the ClientHello \p body but its cookie */
+static bool _cookie(coap_dtls_t *dtls, const unsigned i, const uint8_t *key, const size_t keylen,
+                    const uint8_t *body, const size_t cookie_at, const size_t rest_at,
+                    const size_t end, uint8_t cookie[COAP_DTLS_COOKIE_SIZE])
+{
+    EVP_MAC_CTX *mac = dtls->cookie_mac[i];
+    uint8_t out[EVP_MAX_MD_SIZE];
+    size_t outlen;
+
+    // without a key the one of the last EVP_MAC_init is used again
+    if (!EVP_MAC_init(mac, NULL, 0, NULL) ||
+        !EVP_MAC_update(mac, key, keylen) ||
+        !EVP_MAC_update(mac, body, cookie_at) ||
+        !EVP_MAC_update(mac, body + rest_at, end - rest_at) ||
+        !EVP_MAC_final(mac, out, &outlen, sizeof(out))) {
+        ERR_clear_error();
+        return false;
+    }
+    memcpy(cookie, out, COAP_DTLS_COOKIE_SIZE);
+    return true;
+}
+
+/* DTLSv1_listen only gets ClientHellos with a cookie _datagram checked */
+static int _cookie_verified(SSL *ssl, const unsigned char *cookie, unsigned int len)
+{
+    (void) ssl;
+    (void) cookie;
+    (void) len;
+    return 1;
+}
+
+static int _cookie_generate(SSL *ssl, unsigned char *cookie, unsigned int *len)
+{
+    (void) ssl;
+    (void) cookie;
+    (void) len;
+    return 0;
+}
+
+/* --- WORKERS -------------------------------------------------------------- */
+static bool _push(dtls_ring_t *ring, const uint32_t session, const uint32_t gen,
+                  const uint8_t kind, const uint8_t *data, const size_t len)
+{
+    if (ring->count == COAP_DTLS_QUEUE_SIZE) {
+        return false;
+    }
+    dtls_job_t *job = &ring->jobs[(ring->head + ring->count++) % COAP_DTLS_QUEUE_SIZE];
+    job->session = session;
+    job->gen = gen;
+    job->kind = kind;
+    job->len = (uint16_t)len;
+    if (len) {
+        memcpy(job->data, data, len);
+    }
+    return true;
+}
+
+static bool _pop(dtls_ring_t *ring, dtls_job_t *job)
+{
+    if (!ring->count) {
+        return false;
+    }
+    const dtls_job_t *j = &ring->jobs[ring->head];
+    memcpy(job, j, offsetof(dtls_job_t, data) + j->len);
+    ring->head = (ring->head + 1) % COAP_DTLS_QUEUE_SIZE;
+    ring->count--;
+    return true;
+}
+
+/* the session may be the poll loop's already, \p idx and \p gen are taken before */
+static void _handover(struct coap_dtls_worker *w, const uint32_t idx, const uint32_t gen,
+                      const uint8_t kind, const uint8_t *data, const size_t len)
+{
+    coap_dtls_t *dtls = w->dtls;
+    if (!w->started) {
+        _push(&w->out, idx, gen, kind, data, len);
+        return;
+    }
+    pthread_mutex_lock(&w->lock);
+    const bool pushed = _push(&w->out, idx, gen, kind, data, len);
+    pthread_mutex_unlock(&w->lock);
+    if (pushed) {
+        const uint64_t one = 1;
+        if (write(dtls->wakefd, &one, sizeof(one)) < 0) {
+            // the counter is saturated, the poll loop is awake anyway
+        }
+    }
+}
+
+static void _unlink(struct coap_dtls_worker *w, const coap_dtls_session_t *s)
+{
+    for (coap_dtls_session_t **p = &w->handshakes; *p; p = &(*p)->next) {
+        if (*p == s) {
+            *p = s->next;
+            return;
+        }
+    }
+}
+
+static void _fail(struct coap_dtls_worker *w, coap_dtls_session_t *s)
+{
+    const uint32_t idx = (uint32_t)(s - w->dtls->sessions), gen = s->gen;
+    _unlink(w, s);
+    __atomic_store_n(&s->state, SESSION_DEAD, __ATOMIC_RELEASE);
+    _handover(w, idx, gen, HANDOVER_FAILED, NULL, 0);
+}
+
+static void _handshake(struct coap_dtls_worker *w, coap_dtls_session_t *s)
+{
+    if (!s->started_ns) {
+        s->started_ns = _now_ns();
+        s->next = w->handshakes;
+        w->handshakes = s;
+    }
+    const int rc = SSL_do_handshake(s->ssl);
+    if (rc == 1) {
+        const uint32_t idx = (uint32_t)(s - w->dtls->sessions), gen = s->gen;
+        const uint8_t kind = SSL_session_reused(s->ssl) ? HANDOVER_RESUMED : HANDOVER_OPEN;
+        _unlink(w, s);
+        __atomic_store_n(&s->state, SESSION_OPEN, __ATOMIC_RELEASE);
+        _handover(w, idx, gen, kind, NULL, 0);
+    }
+    else {
+        const int err = SSL_get_error(s->ssl, rc);
+        if ((err != SSL_ERROR_WANT_READ) && (err != SSL_ERROR_WANT_WRITE)) {
+            _fail(w, s);
+        }
+    }
+    ERR_clear_error();
+}
+
+/* retransmit flights, give up on handshakes taking too long */
+static void _timers(struct coap_dtls_worker *w)
+{
+    const uint64_t now = _now_ns();
+    if (now - w->timers_ns < TIMER_INTERVAL_NS) {
+        return;
+    }
+    w->timers_ns = now;
+    for (coap_dtls_session_t *s = w->handshakes, *next; s; s = next) {
+        struct timeval tv;
+        next = s->next;
+        if (now - s->started_ns > (uint64_t)COAP_DTLS_HANDSHAKE_MS * 1000000u) {
+            _fail(w, s);
+        }
+        else if (DTLSv1_get_timeout(s->ssl, &tv) && !tv.tv_sec && !tv.tv_usec &&
+                 (DTLSv1_handle_timeout(s->ssl) < 0)) {
+            _fail(w, s);
+        }
+    }
+    ERR_clear_error();
+}
+
+/* until the next retransmission, at most WAIT_MAX_MS */
+static unsigned _timeout_ms(const struct coap_dtls_worker *w)
+{
+    unsigned ms = WAIT_MAX_MS;
+    for (const coap_dtls_session_t *s = w->handshakes; s; s = s->next) {
+        struct timeval tv;
+        if (DTLSv1_get_timeout(s->ssl, &tv)) {
+            const unsigned t = (unsigned)(tv.tv_sec * 1000 + tv.tv_usec / 1000);
+            ms = (t < ms) ? t : ms;
+        }
+    }
+    return ms;
+}
+
+static void _job(struct coap_dtls_worker *w, dtls_job_t *job)
+{
+    coap_dtls_session_t *s = &w->dtls->sessions[job->session];
+    if (s->gen == job->gen) {
+        const int state = __atomic_load_n(&s->state, __ATOMIC_ACQUIRE);
+        if (state == SESSION_HANDSHAKE) {
+            s->rx = job->data;
+            s->rxlen = job->len;
+            _handshake(w, s);
+        }
+        else if (state == SESSION_OPEN) {
+            _handover(w, job->session, job->gen, HANDOVER_RECORD, job->data, job->len);
+        }
+    }
+    __atomic_fetch_sub(&s->pending, 1, __ATOMIC_RELEASE);
+}
+
+static void *_worker_main(void *arg)
+{
+    struct coap_dtls_worker *w = arg;
+    dtls_job_t *job = malloc(sizeof(*job));
+
+    pthread_mutex_lock(&w->lock);
+    while (!w->stop) {
+        if (!w->in.count) {
+            struct timespec deadline;
+            const unsigned ms = _timeout_ms(w);
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += (long)(ms % 1000) * 1000000 + 1000000;
+            deadline.tv_sec += ms / 1000 + deadline.tv_nsec / 1000000000;
+            deadline.tv_nsec %= 1000000000;
+            pthread_cond_timedwait(&w->cond, &w->lock, &deadline);
+        }
+        const bool have = job && _pop(&w->in, job);
+        pthread_mutex_unlock(&w->lock);
+        if (have) {
+            _job(w, job);
+        }
+        _timers(w);
+        pthread_mutex_lock(&w->lock);
+    }
+    pthread_mutex_unlock(&w->lock);
+    free(job);
+    return NULL;
+}
+
+/* --- POLL LOOP ------------------------------------------------------------ */
+static void _dispatch(coap_dtls_t *dtls, coap_dtls_session_t *s,
+                      const uint8_t *buf, const size_t len)
+{
+    coap_packet_t pkt, rsp;
+    uint8_t out[1152];  // a 1024 byte block with header and options
+    size_t outlen = sizeof(out);
+
+    if ((coap_parse(buf, len, &pkt) != COAP_SUCCESS) ||
+        !pkt.hdr.code || (pkt.hdr.code >> 5)) {
+        return;     // requests only, there is nothing outstanding
+    }
+    const coap_acl_table_t *acl = dtls->config.acl ? coap_acl_current(dtls->config.acl) : NULL;
+    if (acl && (s->acl_gen != acl->gen)) {
+        // on the first request of the session and after a reload
+        s->principal = coap_acl_psk(acl, SSL_get_psk_identity(s->ssl));
+        s->acl_gen = acl->gen;
+    }
+    coap_handle_request_acl(dtls->resources, coap_acl_mask(acl), s->principal, &pkt, &rsp);
+    if (coap_build(&rsp, out, &outlen) == COAP_SUCCESS) {
+        SSL_write(s->ssl, out, (int)outlen);
+    }
+}
+
+/* the records of an established session, s->rx */
+static void _read(coap_dtls_t *dtls, coap_dtls_session_t *s)
+{
+    uint8_t buf[COAP_DTLS_DGRAM_SIZE];
+    for (;;) {
+        const int n = SSL_read(s->ssl, buf, sizeof(buf));
+        if (n > 0) {
+            dtls->records++;
+            _dispatch(dtls, s, buf, (size_t)n);
+            continue;
+        }
+        const int err = SSL_get_error(s->ssl, n);
+        if (err == SSL_ERROR_ZERO_RETURN) {
+            SSL_shutdown(s->ssl);   // close_notify back, the session stays resumable
+        }
+        else if (err == SSL_ERROR_WANT_READ) {
+            break;
+        }
+        else {
+            dtls->failures++;
+        }
+        // the slot is not reused while the worker has records of it
+        if (__atomic_load_n(&s->pending, __ATOMIC_ACQUIRE)) {
+            __atomic_store_n(&s->state, SESSION_DEAD, __ATOMIC_RELEASE);
+        }
+        else {
+            _release(dtls, s, err == SSL_ERROR_ZERO_RETURN);
+        }
+        break;
+    }
+    ERR_clear_error();
+}
+
+static void _queue(coap_dtls_t *dtls, coap_dtls_session_t *s,
+                   const uint8_t *buf, const size_t len)
+{
+    const uint32_t idx = (uint32_t)(s - dtls->sessions);
+    struct coap_dtls_worker *w = &dtls->workers[idx % dtls->nworkers];
+
+    if (!w->started) {
+        s->rx = buf;
+        s->rxlen = len;
+        _handshake(w, s);
+        return;
+    }
+    pthread_mutex_lock(&w->lock);
+    if (_push(&w->in, idx, s->gen, 0, buf, len)) {
+        __atomic_fetch_add(&s->pending, 1, __ATOMIC_RELAXED);
+        pthread_cond_signal(&w->cond);
+    }
+    else {
+        dtls->drops++;
+    }
+    pthread_mutex_unlock(&w->lock);
+}
+
+/*
+ * let OpenSSL take the ClientHello with a valid cookie as if it had sent the
+ * HelloVerifyRequest, the record is kept for the handshake
+ */
+static bool _listen(coap_dtls_session_t *s, const uint8_t *buf, const size_t len)
+{
+    BIO_ADDR *peer = BIO_ADDR_new();
+    s->rx = buf;
+    s->rxlen = len;
+    const int rc = peer ? DTLSv1_listen(s->ssl, peer) : -1;
+    BIO_ADDR_free(peer);
+    ERR_clear_error();
+    return rc == 1;
+}
+
+static void _datagram(coap_dtls_t *dtls, const uint8_t *buf, const size_t len,
+                      const struct sockaddr *addr, const socklen_t addrlen,
+                      const uint32_t now_ms)
+{
+    uint8_t key[18];
+    const size_t keylen = _addr_key(addr, addrlen, key);
+    const uint32_t hash = _hash(key, keylen);
+    coap_dtls_session_t *s = keylen ? _find(dtls, key, keylen, hash) : NULL;
+    int state = s ? __atomic_load_n(&s->state, __ATOMIC_ACQUIRE) : SESSION_DEAD;
+    bool listened = false;
+
+    // new handshakes prove the address with a cookie before they get state
+    if (_client_hello(buf, len) && (state != SESSION_HANDSHAKE)) {
+        uint8_t hvr[COAP_DTLS_HVR_SIZE];
+        size_t hvrlen = sizeof(hvr);
+        if (coap_dtls_cookie_check(dtls, addr, addrlen, buf, len, hvr, &hvrlen) != COAP_SUCCESS) {
+            dtls->drops++;
+            return;
+        }
+        if (hvrlen) {
+            sendto(dtls->fd, hvr, hvrlen, 0, addr, addrlen);
+            dtls->hello_verifies++;
+            return;
+        }
+        // a new handshake replaces an established one, it may resume it
+        if (s && !__atomic_load_n(&s->pending, __ATOMIC_ACQUIRE)) {
+            _release(dtls, s, state == SESSION_OPEN);
+            s = NULL;
+        }
+        if (!s) {
+            if (!(s = _alloc(dtls, addr, addrlen, key, keylen, hash))) {
+                dtls->drops++;
+                return;
+            }
+            if (!_listen(s, buf, len)) {
+                _release(dtls, s, false);
+                dtls->drops++;
+                return;
+            }
+            listened = true;
+        }
+    }
+    else if (s && (state == SESSION_DEAD) && !__atomic_load_n(&s->pending, __ATOMIC_ACQUIRE)) {
+        _release(dtls, s, false);
+        s = NULL;
+    }
+    if (!s) {
+        dtls->drops++;
+        return;
+    }
+    s->last_ms = now_ms;
+    state = __atomic_load_n(&s->state, __ATOMIC_ACQUIRE);
+    if (listened) {
+        _queue(dtls, s, NULL, 0);
+    }
+    else if ((state == SESSION_OPEN) && !__atomic_load_n(&s->pending, __ATOMIC_ACQUIRE)) {
+        s->rx = buf;
+        s->rxlen = len;
+        _read(dtls, s);
+    }
+    else if (state != SESSION_DEAD) {
+        _queue(dtls, s, buf, len);
+    }
+}
+
+static void _handovers(coap_dtls_t *dtls, struct coap_dtls_worker *w, dtls_job_t *job)
+{
+    for (;;) {
+        if (w->started) {
+            pthread_mutex_lock(&w->lock);
+        }
+        const bool have = _pop(&w->out, job);
+        if (w->started) {
+            pthread_mutex_unlock(&w->lock);
+        }
+        if (!have) {
+            return;
+        }
+        coap_dtls_session_t *s = &dtls->sessions[job->session];
+        // counted even if the session is gone already
+        if (job->kind == HANDOVER_FAILED) {
+            dtls->failures++;
+            continue;   // freed once nothing is queued for it any more
+        }
+        if (job->kind != HANDOVER_RECORD) {
+            dtls->handshakes++;
+            dtls->resumed += (job->kind == HANDOVER_RESUMED) ? 1 : 0;
+        }
+        if (!s->ssl || (s->gen != job->gen) ||
+            (__atomic_load_n(&s->state, __ATOMIC_ACQUIRE) != SESSION_OPEN)) {
+            continue;
+        }
+        // records of the handshake datagram may be buffered already
+        s->rx = job->data;
+        s->rxlen = job->len;
+        _read(dtls, s);
+    }
+}
+
+static void _expire(coap_dtls_t *dtls, const uint32_t now_ms)
+{
+    for (size_t i = 0; i < dtls->config.max_sessions; ++i) {
+        coap_dtls_session_t *s = &dtls->sessions[i];
+        if (!s->ssl || __atomic_load_n(&s->pending, __ATOMIC_ACQUIRE)) {
+            continue;
+        }
+        const int state = __atomic_load_n(&s->state, __ATOMIC_ACQUIRE);
+        if (state == SESSION_DEAD) {
+            _release(dtls, s, false);
+        }
+        else if ((state == SESSION_OPEN) && (now_ms - s->last_ms > dtls->config.idle_ms)) {
+            _release(dtls, s, true);
+        }
+    }
+}
+
+/* --- PUBLIC --------------------------------------------------------------- */
+coap_state_t coap_dtls_init(coap_dtls_t *dtls, const int fd, coap_resource_t *resources,
+                            const coap_dtls_config_t *config)
+{
+    memset(dtls, 0, sizeof(*dtls));
+    dtls->fd = fd;
+    dtls->wakefd = -1;
+    dtls->resources = resources;
+    dtls->config = *config;
+    if (!dtls->config.ciphers) {
+        dtls->config.ciphers = COAP_DTLS_CIPHERS;
+    }
+    if (!dtls->config.max_sessions) {
+        dtls->config.max_sessions = COAP_DTLS_MAX_SESSIONS;
+    }
+    if (!dtls->config.idle_ms) {
+        dtls->config.idle_ms = COAP_DTLS_IDLE_MS;
+    }
+    if (dtls->config.workers > COAP_DTLS_MAX_WORKERS) {
+        dtls->config.workers = COAP_DTLS_MAX_WORKERS;
+    }
+    if (!config->psk && !config->cert_file) {
+        return COAP_ERR_UNSUPPORTED;
+    }
+
+    // the index stays below half full
+    const size_t max = dtls->config.max_sessions;
+    for (dtls->index_cap = 16; dtls->index_cap < 2 * max; dtls->index_cap <<= 1) {
+    }
+    dtls->nworkers = dtls->config.workers ? dtls->config.workers : 1;
+    dtls->sessions = calloc(max, sizeof(*dtls->sessions));
+    dtls->index = calloc(dtls->index_cap, sizeof(*dtls->index));
+    dtls->free_slots = malloc(max * sizeof(*dtls->free_slots));
+    dtls->workers = calloc(dtls->nworkers, sizeof(*dtls->workers));
+    if (!dtls->sessions || !dtls->index || !dtls->free_slots || !dtls->workers) {
+        coap_dtls_free(dtls);
+        return COAP_ERR_BUFFER_TOO_SMALL;
+    }
+    for (size_t i = 0; i < max; ++i) {
+        dtls->sessions[i].dtls = dtls;
+        dtls->free_slots[i] = (uint32_t)(max - 1 - i);
+    }
+    dtls->nfree = max;
+
+    SSL_CTX *ctx = SSL_CTX_new(DTLS_server_method());
+    BIO_METHOD *bio = BIO_meth_new(BIO_get_new_index() | BIO_TYPE_SOURCE_SINK, "coap_dtls");
+    dtls->ctx = ctx;
+    dtls->bio = bio;
+    if (!ctx || !bio) {
+        coap_dtls_free(dtls);
+        return COAP_ERR_BUFFER_TOO_SMALL;
+    }
+    BIO_meth_set_write(bio, _bio_write);
+    BIO_meth_set_read(bio, _bio_read);
+    BIO_meth_set_ctrl(bio, _bio_ctrl);
+    BIO_meth_set_create(bio, _bio_create);
+    SSL_CTX_set_min_proto_version(ctx, DTLS1_2_VERSION);
+    SSL_CTX_set_max_proto_version(ctx, DTLS1_2_VERSION);
+    SSL_CTX_set_options(ctx, SSL_OP_NO_QUERY_MTU | SSL_OP_NO_RENEGOTIATION);
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_set_session_id_context(ctx, (const unsigned char *)"yacoap", 6);
+    if (config->psk) {
+        SSL_CTX_set_psk_server_callback(ctx, _psk);
+    }
+    SSL_CTX_set_cookie_generate_cb(ctx, _cookie_generate);
+    SSL_CTX_set_cookie_verify_cb(ctx, _cookie_verified);
+    EVP_MAC *hmac = EVP_MAC_fetch(NULL, OSSL_MAC_NAME_HMAC, NULL);
+    for (unsigned i = 0; i < 2; ++i) {
+        dtls->cookie_mac[i] = hmac ? EVP_MAC_CTX_new(hmac) : NULL;
+        if (!dtls->cookie_mac[i] || !_cookie_key(dtls, i)) {
+            EVP_MAC_free(hmac);
+            ERR_clear_error();
+            coap_dtls_free(dtls);
+            return COAP_ERR_UNSUPPORTED;
+        }
+    }
+    EVP_MAC_free(hmac);     // referenced by the contexts
+    if (!SSL_CTX_set_cipher_list(ctx, dtls->config.ciphers) ||
+        (config->cert_file &&
+         ((SSL_CTX_use_certificate_chain_file(ctx, config->cert_file) != 1) ||
+          (SSL_CTX_use_PrivateKey_file(ctx, config->key_file, SSL_FILETYPE_PEM) != 1) ||
+          (SSL_CTX_check_private_key(ctx) != 1)))) {
+        ERR_clear_error();
+        coap_dtls_free(dtls);
+        return COAP_ERR_UNSUPPORTED;
+    }
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    dtls->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    for (unsigned i = 0; i < dtls->nworkers; ++i) {
+        struct coap_dtls_worker *w = &dtls->workers[i];
+        w->dtls = dtls;
+        w->in.jobs = malloc(COAP_DTLS_QUEUE_SIZE * sizeof(dtls_job_t));
+        w->out.jobs = malloc(COAP_DTLS_QUEUE_SIZE * sizeof(dtls_job_t));
+        if (!w->in.jobs || !w->out.jobs || (dtls->wakefd < 0)) {
+            coap_dtls_free(dtls);
+            return COAP_ERR_BUFFER_TOO_SMALL;
+        }
+        pthread_mutex_init(&w->lock, NULL);
+        pthread_cond_init(&w->cond, NULL);
+        w->started = dtls->config.workers &&
+                     !pthread_create(&w->thread, NULL, _worker_main, w);
+        if (dtls->config.workers && !w->started) {
+            coap_dtls_free(dtls);
+            return COAP_ERR_BUFFER_TOO_SMALL;
+        }
+    }
+    return COAP_SUCCESS;
+}
+
+void coap_dtls_free(coap_dtls_t *dtls)
+{
+    for (unsigned i = 0; dtls->workers && (i < dtls->nworkers); ++i) {
+        struct coap_dtls_worker *w = &dtls->workers[i];
+        if (w->started) {
+            pthread_mutex_lock(&w->lock);
+            w->stop = true;
+            pthread_cond_signal(&w->cond);
+            pthread_mutex_unlock(&w->lock);
+            pthread_join(w->thread, NULL);
+        }
+        if (w->in.jobs) {
+            pthread_mutex_destroy(&w->lock);
+            pthread_cond_destroy(&w->cond);
+        }
+        free(w->in.jobs);
+        free(w->out.jobs);
+    }
+    for (size_t i = 0; dtls->sessions && (i < dtls->config.max_sessions); ++i) {
+        SSL_free(dtls->sessions[i].ssl);
+    }
+    SSL_CTX_free(dtls->ctx);
+    BIO_meth_free(dtls->bio);
+    EVP_MAC_CTX_free(dtls->cookie_mac[0]);
+    EVP_MAC_CTX_free(dtls->cookie_mac[1]);
+    if (dtls->wakefd >= 0) {
+        close(dtls->wakefd);
+    }
+    free(dtls->sessions);
+    free(dtls->index);
+    free(dtls->free_slots);
+    free(dtls->workers);
+    dtls->sessions = NULL;
+    dtls->index = NULL;
+    dtls->free_slots = NULL;
+    dtls->workers = NULL;
+    dtls->ctx = NULL;
+    dtls->bio = NULL;
+    dtls->cookie_mac[0] = NULL;
+    dtls->cookie_mac[1] = NULL;
+    dtls->wakefd = -1;
+}
+
+size_t coap_dtls_pollfds(const coap_dtls_t *dtls, struct pollfd *fds, const size_t size)
+{
+    const int fd[2] = { dtls->fd, dtls->wakefd };
+    size_t n = 0;
+    for (size_t i = 0; (i < 2) && (n < size); ++i) {
+        fds[n].fd = fd[i];
+        fds[n].events = POLLIN;
+        fds[n].revents = 0;
+        n++;
+    }
+    return n;
+}
+
+void coap_dtls_process(coap_dtls_t *dtls, const uint32_t now_ms)
+{
+    static dtls_job_t job;  // hand-overs are copied out, only one caller
+    uint8_t buf[COAP_DTLS_DGRAM_SIZE];
+    uint64_t wake;
+
+    if (read(dtls->wakefd, &wake, sizeof(wake)) < 0) {
+        // nothing handed over since
+    }
+    // a batch, the rest stays readable for the next poll
+    for (int i = 0; i < 64; ++i) {
+        struct sockaddr_storage addr;
+        socklen_t addrlen = sizeof(addr);
+        const ssize_t n = recvfrom(dtls->fd, buf, sizeof(buf), MSG_DONTWAIT,
+                                   (struct sockaddr *)&addr, &addrlen);
+        if (n < 0) {
+            break;
+        }
+        _datagram(dtls, buf, (size_t)n, (struct sockaddr *)&addr, addrlen, now_ms);
+    }
+    for (unsigned i = 0; i < dtls->nworkers; ++i) {
+        _handovers(dtls, &dtls->workers[i], &job);
+        if (!dtls->workers[i].started) {
+            _timers(&dtls->workers[i]);
+            _handovers(dtls, &dtls->workers[i], &job);
+        }
+    }
+    if (now_ms - dtls->tick_ms >= COAP_DTLS_TICK_MS) {
+        dtls->tick_ms = now_ms;
+        _expire(dtls, now_ms);
+    }
+    if (!dtls->cookie_ms) {
+        dtls->cookie_ms = now_ms;   // the first secrets are from coap_dtls_init
+    }
+    else if (now_ms - dtls->cookie_ms >= COAP_DTLS_COOKIE_ROTATE_MS) {
+        dtls->cookie_ms = now_ms;
+        if (_cookie_key(dtls, dtls->cookie_cur ^ 1)) {
+            dtls->cookie_cur ^= 1;
+        }
+    }
+}
+
+coap_state_t coap_dtls_cookie_check(coap_dtls_t *dtls, const struct sockaddr *addr,
+                                    const socklen_t addrlen, const uint8_t *buf,
+                                    const size_t len, uint8_t *hvr, size_t *hvrlen)
+{
+    uint8_t key[18], cookie[COAP_DTLS_COOKIE_SIZE];
+    const size_t keylen = _addr_key(addr, addrlen, key);
+
+    if (!keylen || !_client_hello(buf, len)) {
+        return COAP_ERR_PAYLOAD_INVALID;
+    }
+    // one fragment in the record, https://tools.ietf.org/html/rfc6347#section-4.2.2
+    const size_t reclen = (size_t)buf[11] << 8 | buf[12];
+    const size_t msglen = (size_t)buf[14] << 16 | (size_t)buf[15] << 8 | buf[16];
+    const size_t offset = (size_t)buf[19] << 16 | (size_t)buf[20] << 8 | buf[21];
+    const size_t fraglen = (size_t)buf[22] << 16 | (size_t)buf[23] << 8 | buf[24];
+    if (offset || (fraglen != msglen) || (12 + msglen > reclen) || (13 + reclen > len)) {
+        return COAP_ERR_PAYLOAD_INVALID;
+    }
+    // version, random, session ID, then the cookie
+    const uint8_t *body = buf + 25;
+    size_t cookie_at = 2 + 32;
+    if (cookie_at >= msglen) {
+        return COAP_ERR_PAYLOAD_INVALID;
+    }
+    cookie_at += 1 + body[cookie_at];
+    if (cookie_at >= msglen) {
+        return COAP_ERR_PAYLOAD_INVALID;
+    }
+    const size_t rest_at = cookie_at + 1 + body[cookie_at];
+    if (rest_at > msglen) {
+        return COAP_ERR_PAYLOAD_INVALID;
+    }
+    if (*hvrlen < COAP_DTLS_HVR_SIZE) {
+        return COAP_ERR_BUFFER_TOO_SMALL;
+    }
+    // the cookie of the current secret is sent back if the one received is not valid
+    const bool sized = body[cookie_at] == COAP_DTLS_COOKIE_SIZE;
+    if (!_cookie(dtls, dtls->cookie_cur, key, keylen, body, cookie_at, rest_at, msglen, cookie)) {
+        return COAP_ERR_UNSUPPORTED;
+    }
+    if (sized && !CRYPTO_memcmp(cookie, body + cookie_at + 1, COAP_DTLS_COOKIE_SIZE)) {
+        *hvrlen = 0;
+        return COAP_SUCCESS;
+    }
+    if (sized && _cookie(dtls, dtls->cookie_cur ^ 1, key, keylen, body, cookie_at, rest_at, msglen, hvr) &&
+        !CRYPTO_memcmp(hvr, body + cookie_at + 1, COAP_DTLS_COOKIE_SIZE)) {
+        *hvrlen = 0;
+        return COAP_SUCCESS;
+    }
+    // record and message sequence numbers of the ClientHello, DTLS 1.0 version
+    static const uint8_t head[] = {
+        22, 0xFE, 0xFF, 0, 0, 0, 0, 0, 0, 0, 0, 0, 12 + 3 + COAP_DTLS_COOKIE_SIZE,
+        3, 0, 0, 3 + COAP_DTLS_COOKIE_SIZE, 0, 0, 0, 0, 0, 0, 0, 3 + COAP_DTLS_COOKIE_SIZE,
+        0xFE, 0xFF, COAP_DTLS_COOKIE_SIZE
+    };
+    memcpy(hvr, head, sizeof(head));
+    memcpy(hvr + 3, buf + 3, 8);
+    memcpy(hvr + 17, buf + 17, 2);
+    memcpy(hvr + sizeof(head), cookie, COAP_DTLS_COOKIE_SIZE);
+    *hvrlen = COAP_DTLS_HVR_SIZE;
+    return COAP_SUCCESS;
+}
+
+coap_state_t coap_dtls_send(coap_dtls_t *dtls, const struct sockaddr *addr,
+                            const socklen_t addrlen, const coap_packet_t *pkt)
+{
+    uint8_t key[18], buf[1152];
+    size_t buflen = sizeof(buf);
+    const size_t keylen = _addr_key(addr, addrlen, key);
+    coap_dtls_session_t *s = keylen ? _find(dtls, key, keylen, _hash(key, keylen)) : NULL;
+
+    if (!s || (__atomic_load_n(&s->state, __ATOMIC_ACQUIRE) != SESSION_OPEN)) {
+        return COAP_ERR_REQUEST_NOT_FOUND;
+    }
+    const coap_state_t rc = coap_build(pkt, buf, &buflen);
+    if (rc == COAP_SUCCESS) {
+        SSL_write(s->ssl, buf, (int)buflen);
+        ERR_clear_error();
+    }
+    return rc;
+}
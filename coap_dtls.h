@@ -0,0 +1,230 @@
+#ifndef COAP_DTLS_H
+#define COAP_DTLS_H 1
+
+/**
+ * @file coap_dtls.h
+ *
+ * DTLS 1.2 transport for coaps (RFC 7252 section 9) on OpenSSL 3, in PSK
+ * and certificate mode. Records are decrypted into datagrams for coap_parse,
+ * requests dispatched with coap_handle_request, and responses from
+ * coap_build encrypted again, all on one UDP socket of the application.
+ *
+ * Peers are kept in a session table allocated once, found by address in an
+ * open addressing hash index. Handshakes run on worker threads: the poll
+ * loop queues the records of a handshaking peer to the worker of its slot,
+ * which answers the flights itself and hands the session back when it is
+ * established, so handshakes, key exchanges with certificates in particular,
+ * never hold up application records. A ClientHello only gets a session once
+ * it returns the cookie of a HelloVerifyRequest (RFC 6347 section 4.2.1),
+ * which is checked without any state from the datagram and an HMAC secret
+ * rotated every COAP_DTLS_COOKIE_ROTATE_MS, so a flood of ClientHellos from
+ * spoofed addresses costs one HMAC each and no memory. Closed sessions stay in the server
+ * cache of OpenSSL for resumption with an abbreviated handshake, which is
+ * also how a client continues after a NAT rebinding: OpenSSL 3 does not
+ * implement Connection IDs (RFC 9146).
+ *
+ * With an ACL in the configuration, the PSK identity of a session is mapped
+ * to its principal when the session is established, and again after a
+ * reload of the policy, and requests are dispatched with
+ * coap_handle_request_acl.
+ *
+ * Call coap_dtls_process whenever a descriptor of coap_dtls_pollfds is
+ * readable or at least every COAP_DTLS_TICK_MS. Only the caller of
+ * coap_dtls_process touches the resources; the PSK callback runs on the
+ * workers and has to be thread safe.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <poll.h>
+#include <sys/socket.h>
+
+#include "coap.h"
+
+#ifndef COAP_DTLS_MAX_SESSIONS
+#define COAP_DTLS_MAX_SESSIONS      1024    //!< default of coap_dtls_config_t.max_sessions
+#endif
+#define COAP_DTLS_MTU               1232    //!< IPv6 minimum MTU without IP and UDP headers
+#define COAP_DTLS_DGRAM_SIZE        1536    //!< largest datagram received
+#define COAP_DTLS_MAX_WORKERS       16
+#define COAP_DTLS_QUEUE_SIZE        256     //!< records queued per worker
+#define COAP_DTLS_HANDSHAKE_MS      10000   //!< handshakes not done by then fail
+#define COAP_DTLS_IDLE_MS           300000  //!< default of coap_dtls_config_t.idle_ms
+#define COAP_DTLS_TICK_MS           1000    //!< idle sessions are expired this often
+#define COAP_DTLS_COOKIE_SIZE       16      //!< truncated HMAC-SHA256
+#define COAP_DTLS_COOKIE_ROTATE_MS  60000   //!< cookies of the previous secret stay valid
+#define COAP_DTLS_HVR_SIZE          (13 + 12 + 3 + COAP_DTLS_COOKIE_SIZE) //!< HelloVerifyRequest
+// RFC 7252 section 9.1.3.1 and 9.1.3.2 first, AES-GCM for clients without CCM
+#define COAP_DTLS_CIPHERS           "PSK-AES128-CCM8:ECDHE-ECDSA-AES128-CCM8:" \
+                                    "PSK-AES128-GCM-SHA256:ECDHE-ECDSA-AES128-GCM-SHA256:" \
+                                    "ECDHE-RSA-AES128-GCM-SHA256"
+
+/**
+ * @brief Key of a PSK identity, called on the workers
+ *
+ * @param[in] ctx coap_dtls_config_t.psk_ctx
+ * @param[in] identity Identity of the client
+ * @param[out] key Key
+ * @param[in] size Size of \p key
+ *
+ * @return Length of the key, 0 if the identity is unknown
+ */
+typedef size_t (*coap_dtls_psk_fn)(void *ctx, const char *identity,
+                                   uint8_t *key, const size_t size);
+
+/**
+ * Server configuration, unset fields get defaults
+ */
+typedef struct coap_dtls_config
+{
+    const char *cert_file;      //!< PEM certificate chain, NULL for PSK only
+    const char *key_file;       //!< PEM private key of cert_file
+    coap_dtls_psk_fn psk;       //!< PSK lookup, NULL for certificates only
+    void *psk_ctx;
+    const char *ciphers;        //!< OpenSSL cipher list, COAP_DTLS_CIPHERS
+    size_t max_sessions;        //!< peers at a time, COAP_DTLS_MAX_SESSIONS
+    unsigned workers;           //!< handshake threads, 0 for the calling thread
+    uint32_t idle_ms;           //!< sessions closed after, COAP_DTLS_IDLE_MS
+    struct coap_acl *acl;       //!< policy of the requests, NULL allows all
+} coap_dtls_config_t;
+
+struct coap_dtls_worker;
+struct coap_acl;
+
+/**
+ * Session of a peer, private
+ */
+typedef struct coap_dtls_session
+{
+    struct ssl_st *ssl;         //!< NULL if the slot is free
+    struct coap_dtls *dtls;
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+    uint8_t key[18];            //!< address and port, see _addr_key
+    uint8_t keylen;
+    uint32_t hash;              //!< of key
+    uint32_t gen;               //!< incremented when the slot is reused
+    int state;                  //!< who has ssl, changed atomically
+    unsigned pending;           //!< records queued to the worker, atomic
+    uint32_t last_ms;           //!< last record received
+    uint32_t acl_gen;           //!< of the ACL table principal was mapped with, 0 for none
+    uint8_t principal;          //!< of the PSK identity, see coap_acl.h
+    uint64_t started_ns;        //!< handshake start, on the worker
+    const uint8_t *rx;          //!< record for the BIO to read
+    size_t rxlen;
+    struct coap_dtls_session *next; //!< handshakes of the worker
+} coap_dtls_session_t;
+
+/**
+ * DTLS server
+ */
+typedef struct coap_dtls
+{
+    int fd;                     //!< UDP socket, made non-blocking
+    int wakefd;                 //!< eventfd the workers signal hand-overs with
+    coap_resource_t *resources;
+    struct ssl_ctx_st *ctx;
+    struct bio_method_st *bio;
+    struct evp_mac_ctx_st *cookie_mac[2];   //!< keyed with the current and the previous secret
+    unsigned cookie_cur;        //!< index of the current secret
+    uint32_t cookie_ms;         //!< last rotation
+    coap_dtls_config_t config;
+    coap_dtls_session_t *sessions;
+    uint32_t *index;            //!< session + 1 by address hash, 0 if empty
+    size_t index_cap;           //!< power of 2
+    uint32_t *free_slots;       //!< stack of free sessions
+    size_t nfree;
+    struct coap_dtls_worker *workers;
+    unsigned nworkers;          //!< at least 1, the inline one without threads
+    uint32_t tick_ms;           //!< last expiry of idle sessions
+    uint32_t handshakes;        //!< completed
+    uint32_t resumed;           //!< of them abbreviated
+    uint32_t records;           //!< application records received
+    uint32_t failures;          //!< handshakes failed and sessions aborted
+    uint32_t drops;             //!< records without session, table or queue full
+    uint32_t hello_verifies;    //!< ClientHellos answered without state
+} coap_dtls_t;
+
+/**
+ * @brief Set up a server and start its workers
+ *
+ * @param[out] dtls Server
+ * @param[in] fd Bound UDP socket
+ * @param[in] resources Resource table, shared with the UDP server
+ * @param[in] config Configuration, copied
+ *
+ * @return 0 on success, COAP_ERR_UNSUPPORTED if OpenSSL rejects the
+ * configuration, or COAP_ERR_BUFFER_TOO_SMALL if out of memory
+ */
+coap_state_t coap_dtls_init(coap_dtls_t *dtls, const int fd, coap_resource_t *resources,
+                            const coap_dtls_config_t *config);
+
+/**
+ * @brief Stop the workers, close all sessions and free the server
+ */
+void coap_dtls_free(coap_dtls_t *dtls);
+
+/**
+ * @brief Descriptors to poll for
+ *
+ * @param[in] dtls Server
+ * @param[out] fds Poll entries
+ * @param[in] size Entries in \p fds, 2 always fit
+ *
+ * @return Entries used
+ */
+size_t coap_dtls_pollfds(const coap_dtls_t *dtls, struct pollfd *fds, const size_t size);
+
+/**
+ * @brief Receive, decrypt, dispatch, encrypt and send, expire idle sessions
+ *
+ * @param[in,out] dtls Server
+ * @param[in] now_ms Monotonic milliseconds
+ */
+void coap_dtls_process(coap_dtls_t *dtls, const uint32_t now_ms);
+
+/**
+ * @brief Check the cookie of a ClientHello without any state
+ *
+ * The cookie is an HMAC over the address of the client and the ClientHello
+ * without message sequence and cookie, the fields that are the same when it
+ * is sent again. Called by coap_dtls_process, and only from its thread.
+ *
+ * @param[in] dtls Server
+ * @param[in] addr Client
+ * @param[in] addrlen Length of \p addr
+ * @param[in] buf Datagram starting with the ClientHello
+ * @param[in] len Length of \p buf
+ * @param[out] hvr HelloVerifyRequest with the cookie to send back
+ * @param[in,out] hvrlen Size of \p hvr, at least COAP_DTLS_HVR_SIZE, set to
+ * 0 if the cookie is valid, otherwise to the length of the HelloVerifyRequest
+ *
+ * @return 0 on success, COAP_ERR_PAYLOAD_INVALID if \p buf does not start
+ * with a ClientHello in one fragment, COAP_ERR_BUFFER_TOO_SMALL if \p hvr is,
+ * or COAP_ERR_UNSUPPORTED if the HMAC fails
+ */
+coap_state_t coap_dtls_cookie_check(coap_dtls_t *dtls, const struct sockaddr *addr,
+                                    const socklen_t addrlen, const uint8_t *buf,
+                                    const size_t len, uint8_t *hvr, size_t *hvrlen);
+
+/**
+ * @brief Send a message to an established peer, e.g. a separate response
+ *
+ * @param[in,out] dtls Server
+ * @param[in] addr Peer
+ * @param[in] addrlen Length of \p addr
+ * @param[in] pkt Message
+ *
+ * @return 0 on success, COAP_ERR_REQUEST_NOT_FOUND if there is no
+ * established session with \p addr, or the error of coap_build
+ */
+coap_state_t coap_dtls_send(coap_dtls_t *dtls, const struct sockaddr *addr,
+                            const socklen_t addrlen, const coap_packet_t *pkt);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,125 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "coap.h"
+#include "coap_echo.h"
+#include "coap_sha256.h"
+
+/* --- PRIVATE -------------------------------------------------------------- */
+
+/* the IP address without port, IPv4-mapped IPv6 addresses as IPv4 */
+static size_t _addr_key(const struct sockaddr *addr, const socklen_t addrlen, uint8_t key[16])
+{
+    static const uint8_t v4mapped[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
+
+    if ((addr->sa_family == AF_INET) && (addrlen >= sizeof(struct sockaddr_in))) {
+        memcpy(key, &((const struct sockaddr_in *)addr)->sin_addr, 4);
+        return 4;
+    }
+    if ((addr->sa_family == AF_INET6) && (addrlen >= sizeof(struct sockaddr_in6))) {
+        const uint8_t *a = (const uint8_t *)&((const struct sockaddr_in6 *)addr)->sin6_addr;
+        if (!memcmp(a, v4mapped, sizeof(v4mapped))) {
+            memcpy(key, a + 12, 4);
+            return 4;
+        }
+        memcpy(key, a, 16);
+        return 16;
+    }
+    return 0;
+}
+
+/* MAC of the timestamp at \p value over it and the address */
+static void _mac(const coap_echo_t *echo, const struct sockaddr *addr,
+                 const socklen_t addrlen, const uint8_t *value,
+                 uint8_t mac[COAP_SHA256_SIZE])
+{
+    uint8_t msg[4 + 16];
+
+    memcpy(msg, value, 4);
+    const size_t keylen = _addr_key(addr, addrlen, msg + 4);
+    coap_hmac_sha256(&echo->mac, msg, 4 + keylen, mac);
+}
+
+/* --- PUBLIC --------------------------------------------------------------- */
+
+coap_state_t coap_echo_init(coap_echo_t *echo, const uint8_t *key, const size_t keylen,
+                            const uint32_t lifetime_s)
+{
+    if (!key || (keylen < COAP_ECHO_MIN_KEY)) {
+        return COAP_ERR_SECURITY_CONTEXT;
+    }
+    memset(echo, 0, sizeof(*echo));
+    coap_hmac_sha256_init(&echo->mac, key, keylen);
+    echo->lifetime_s = lifetime_s ? lifetime_s : COAP_ECHO_LIFETIME;
+    return COAP_SUCCESS;
+}
+
+void coap_echo_make(const coap_echo_t *echo, const struct sockaddr *addr,
+                    const socklen_t addrlen, const uint32_t now_s,
+                    uint8_t value[COAP_ECHO_SIZE])
+{
+    uint8_t mac[COAP_SHA256_SIZE];
+
+    value[0] = (uint8_t)(now_s >> 24);
+    value[1] = (uint8_t)(now_s >> 16);
+    value[2] = (uint8_t)(now_s >> 8);
+    value[3] = (uint8_t)now_s;
+    _mac(echo, addr, addrlen, value, mac);
+    memcpy(value + 4, mac, COAP_ECHO_MAC_SIZE);
+}
+
+coap_state_t coap_echo_verify(coap_echo_t *echo, const coap_packet_t *inpkt,
+                              const struct sockaddr *addr, const socklen_t addrlen,
+                              const uint32_t now_s)
+{
+    uint8_t mac[COAP_SHA256_SIZE], diff = 0;
+    uint8_t count = 0;
+    const coap_option_t *opt = coap_find_options(inpkt, COAP_OPTION_ECHO, &count);
+
+    if (!opt) {
+        return COAP_ERR_OPTION_NOT_FOUND;
+    }
+    const uint8_t *value = opt->buf.p;
+    if ((count != 1) || (opt->buf.len != COAP_ECHO_SIZE)) {
+        echo->rejected++;
+        return COAP_ERR_SECURITY_CONTEXT;
+    }
+    const uint32_t ts = (uint32_t)value[0] << 24 | (uint32_t)value[1] << 16 |
+                        (uint32_t)value[2] << 8 | value[3];
+    // values from the future wrap around to a large age
+    if ((uint32_t)(now_s - ts) > echo->lifetime_s) {
+        echo->rejected++;
+        return COAP_ERR_TIMEOUT;
+    }
+    _mac(echo, addr, addrlen, value, mac);
+    // in constant time, the MAC must not be guessable byte by byte
+    for (size_t i = 0; i < COAP_ECHO_MAC_SIZE; ++i) {
+        diff |= mac[i] ^ value[4 + i];
+    }
+    if (diff) {
+        echo->rejected++;
+        return COAP_ERR_SECURITY_CONTEXT;
+    }
+    echo->verified++;
+    return COAP_SUCCESS;
+}
+
+coap_state_t coap_echo_challenge(coap_echo_t *echo, const coap_packet_t *inpkt,
+                                 const struct sockaddr *addr, const socklen_t addrlen,
+                                 const uint32_t now_s, uint8_t value[COAP_ECHO_SIZE],
+                                 coap_packet_t *pkt)
+{
+    const coap_msgtype_t type = (inpkt->hdr.t == COAP_TYPE_CON) ? COAP_TYPE_ACK : COAP_TYPE_NONCON;
+
+    coap_echo_make(echo, addr, addrlen, now_s, value);
+    coap_make_response(inpkt->hdr.id, &inpkt->tok, type, COAP_RSPCODE_UNAUTHORIZED,
+                       NULL, NULL, 0, pkt);
+    if (coap_add_option(pkt, COAP_OPTION_ECHO, value, COAP_ECHO_SIZE) != COAP_SUCCESS) {
+        return COAP_ERR_BUFFER_TOO_SMALL;
+    }
+    echo->challenges++;
+    return COAP_RSP_SEND;
+}
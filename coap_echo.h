@@ -0,0 +1,153 @@
+#ifndef COAP_ECHO_H
+#define COAP_ECHO_H 1
+
+/**
+ * @file coap_echo.h
+ *
+ * Echo option (RFC 9175 section 2) for a server to verify that a client can
+ * receive at its source address before it is sent more than a few times the
+ * size of its request, the amplification limit of section 2.4. Without it a
+ * spoofed request for a large resource makes the server flood a victim.
+ *
+ * The server keeps no state per client. An Echo value is a timestamp in
+ * seconds and a truncated HMAC-SHA256 of the timestamp and the IP address of
+ * the client, under a random key of the server; verifying one costs a single
+ * HMAC of two compressions. A response larger than COAP_ECHO_AMPLIFICATION
+ * times its request to a client that has not sent a valid value is replaced
+ * by a 4.01 Unauthorized with a fresh Echo value, which the client repeats in
+ * the request and in further requests to the server until the value expires.
+ * Unsafe requests change state, so they are challenged before their handler
+ * runs, whatever the size of the response: replacing the response afterwards
+ * would run the handler again on the retry, and run it for spoofed sources.
+ * Requests without Echo option never cost an HMAC, a challenge costs one.
+ *
+ * The address is bound without the port, so a value survives a NAT rebinding
+ * of the client. The key is the only secret, generate it from the random
+ * source of the system; a new key invalidates all values.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <sys/socket.h>
+
+#include "coap.h"
+#include "coap_sha256.h"
+
+#define COAP_ECHO_MIN_KEY       16      //!< bytes of the server key at least
+#define COAP_ECHO_MAC_SIZE      8       //!< truncated HMAC-SHA256
+#define COAP_ECHO_SIZE          (4 + COAP_ECHO_MAC_SIZE) //!< timestamp and MAC
+#ifndef COAP_ECHO_LIFETIME
+#define COAP_ECHO_LIFETIME      300     //!< default of coap_echo_init, seconds a value is valid
+#endif
+#define COAP_ECHO_AMPLIFICATION 3       //!< response bytes per request byte without Echo
+
+/**
+ * Echo state of a server, the key and counters
+ */
+typedef struct coap_echo
+{
+    coap_hmac_sha256_t mac;     //!< server key
+    uint32_t lifetime_s;        //!< seconds a value is valid
+    uint32_t challenges;        //!< responses replaced by a 4.01 with Echo
+    uint32_t verified;          //!< valid Echo values received
+    uint32_t rejected;          //!< invalid or expired Echo values received
+} coap_echo_t;
+
+/**
+ * @brief Set the key of a server
+ *
+ * @param[out] echo Echo state
+ * @param[in] key Random key
+ * @param[in] keylen Length of \p key, at least COAP_ECHO_MIN_KEY
+ * @param[in] lifetime_s Seconds a value is valid, 0 for COAP_ECHO_LIFETIME
+ *
+ * @return 0 on success, or COAP_ERR_SECURITY_CONTEXT if the key is too short
+ */
+coap_state_t coap_echo_init(coap_echo_t *echo, const uint8_t *key, const size_t keylen,
+                            const uint32_t lifetime_s);
+
+/**
+ * @brief Make the Echo value for a client
+ *
+ * @param[in] echo Echo state
+ * @param[in] addr Source address of the client
+ * @param[in] addrlen Length of \p addr
+ * @param[in] now_s Seconds of a clock that does not jump, e.g. CLOCK_MONOTONIC
+ * @param[out] value Echo value
+ */
+void coap_echo_make(const coap_echo_t *echo, const struct sockaddr *addr,
+                    const socklen_t addrlen, const uint32_t now_s,
+                    uint8_t value[COAP_ECHO_SIZE]);
+
+/**
+ * @brief Verify the Echo option of a request
+ *
+ * @param[in,out] echo Echo state, the counters are updated
+ * @param[in] inpkt Request
+ * @param[in] addr Source address of the request
+ * @param[in] addrlen Length of \p addr
+ * @param[in] now_s Seconds of the clock of coap_echo_make
+ *
+ * @return 0 if the value was made for the address of the request within the
+ * lifetime, COAP_ERR_OPTION_NOT_FOUND without Echo option, COAP_ERR_TIMEOUT
+ * if the value has expired, or COAP_ERR_SECURITY_CONTEXT if it was not made
+ * for this address or with this key
+ */
+coap_state_t coap_echo_verify(coap_echo_t *echo, const coap_packet_t *inpkt,
+                              const struct sockaddr *addr, const socklen_t addrlen,
+                              const uint32_t now_s);
+
+/**
+ * @brief Whether a response is too large for a client without a valid Echo
+ *
+ * @param[in] reqlen Length of the request datagram
+ * @param[in] rsplen Length of the response datagram
+ */
+static inline bool coap_echo_amplifies(const size_t reqlen, const size_t rsplen)
+{
+    return rsplen > COAP_ECHO_AMPLIFICATION * reqlen;
+}
+
+/**
+ * @brief Whether a request may be served before its source is proven
+ *
+ * Only GET is safe (RFC 7252 section 5.8); challenge anything else from a
+ * client without a valid Echo value before dispatching it.
+ *
+ * @param[in] inpkt Request
+ */
+static inline bool coap_echo_safe(const coap_packet_t *inpkt)
+{
+    return inpkt->hdr.code == COAP_METHOD_GET;
+}
+
+/**
+ * @brief Make a 4.01 Unauthorized with an Echo value for a request
+ *
+ * The response is an ACK to a confirmable request and non-confirmable
+ * otherwise, with the token of the request.
+ *
+ * @param[in,out] echo Echo state, the counters are updated
+ * @param[in] inpkt Request
+ * @param[in] addr Source address of the request
+ * @param[in] addrlen Length of \p addr
+ * @param[in] now_s Seconds of the clock of coap_echo_verify
+ * @param[out] value Echo value, \p pkt refers to it until it is built
+ * @param[out] pkt Response
+ *
+ * @return COAP_RSP_SEND, or COAP_ERR_BUFFER_TOO_SMALL if the option does
+ * not fit into \p pkt
+ */
+coap_state_t coap_echo_challenge(coap_echo_t *echo, const coap_packet_t *inpkt,
+                                 const struct sockaddr *addr, const socklen_t addrlen,
+                                 const uint32_t now_s, uint8_t value[COAP_ECHO_SIZE],
+                                 coap_packet_t *pkt);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,1022 @@
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "coap.h"
+#include "coap_client.h"
+#include "coap_gw.h"
+#include "coap_http.h"
+#include "coap_metrics.h"
+
+enum {
+    ENTRY_FREE,
+    ENTRY_USED,
+};
+
+enum {
+    CONN_READ,      //!< waiting for a request
+    CONN_WAIT,      //!< waiting for the CoAP response
+    CONN_WRITE,     //!< sending the response
+    CONN_EVENTS,    //!< event stream
+};
+
+#define GW_BLOCK_SZX    COAP_BLOCK_SZX_MAX
+
+static const char _event_stream[] = "text/event-stream";
+
+/* --- PRIVATE -------------------------------------------------------------- */
+static uint8_t _lower(const uint8_t c)
+{
+    return ((c >= 'A') && (c <= 'Z')) ? c + ('a' - 'A') : c;
+}
+
+/* case insensitive \p p of \p len against lower case \p s */
+static bool _ieq(const char *p, const size_t len, const char *s)
+{
+    if (len != strlen(s)) {
+        return false;
+    }
+    for (size_t i = 0; i < len; ++i) {
+        if (_lower((uint8_t)p[i]) != (uint8_t)s[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void _trim(const char **p, size_t *len)
+{
+    while (*len && ((**p == ' ') || (**p == '\t'))) {
+        (*p)++;
+        (*len)--;
+    }
+    while (*len && (((*p)[*len - 1] == ' ') || ((*p)[*len - 1] == '\t'))) {
+        (*len)--;
+    }
+}
+
+static uint64_t _hash(const char *uri, const int accept)
+{
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (const char *p = uri; *p; ++p) {
+        h = (h ^ (uint8_t)*p) * 0x100000001b3ull;
+    }
+    return (h ^ (uint32_t)accept) * 0x100000001b3ull;
+}
+
+static int _hex(const char c)
+{
+    const uint8_t l = _lower((uint8_t)c);
+    return ((l >= '0') && (l <= '9')) ? l - '0' :
+           ((l >= 'a') && (l <= 'f')) ? l - 'a' + 10 : -1;
+}
+
+static const char *_reason(const int status)
+{
+    switch (status) {
+    case 200: return "OK";
+    case 201: return "Created";
+    case 204: return "No Content";
+    case 400: return "Bad Request";
+    case 401: return "Unauthorized";
+    case 403: return "Forbidden";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 406: return "Not Acceptable";
+    case 412: return "Precondition Failed";
+    case 413: return "Payload Too Large";
+    case 414: return "URI Too Long";
+    case 415: return "Unsupported Media Type";
+    case 431: return "Request Header Fields Too Large";
+    case 501: return "Not Implemented";
+    case 502: return "Bad Gateway";
+    case 503: return "Service Unavailable";
+    case 504: return "Gateway Timeout";
+    default: return (status < 400) ? "OK" : (status < 500) ? "Bad Request" :
+                    "Internal Server Error";
+    }
+}
+
+/* {host} of a request, IPv4 or [IPv6] with optional port */
+static bool _resolve(const char *host, const size_t len,
+                     struct sockaddr_storage *addr, socklen_t *addrlen)
+{
+    const char *end = host + len, *ip = host, *port = NULL;
+    size_t iplen = len;
+    unsigned long p = COAP_DEFAULT_PORT;
+    char str[INET6_ADDRSTRLEN];
+
+    if (len && (host[0] == '[')) {
+        const char *bracket = memchr(host, ']', len);
+        if (!bracket || ((bracket + 1 < end) && (bracket[1] != ':'))) {
+            return false;
+        }
+        ip = host + 1;
+        iplen = (size_t)(bracket - ip);
+        port = (bracket + 1 < end) ? bracket + 2 : NULL;
+    }
+    else {
+        const char *colon = memchr(host, ':', len);
+        if (colon) {
+            iplen = (size_t)(colon - host);
+            port = colon + 1;
+        }
+    }
+    if (port) {
+        if ((port == end) || (end - port > 5)) {
+            return false;
+        }
+        p = 0;
+        for (const char *c = port; c < end; ++c) {
+            if ((*c < '0') || (*c > '9')) {
+                return false;
+            }
+            p = p * 10 + (unsigned long)(*c - '0');
+        }
+        if (!p || (p > 65535)) {
+            return false;
+        }
+    }
+    if (!iplen || (iplen >= sizeof(str))) {
+        return false;
+    }
+    memcpy(str, ip, iplen);
+    str[iplen] = '\0';
+    memset(addr, 0, sizeof(*addr));
+    struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)addr;
+    struct sockaddr_in *in = (struct sockaddr_in *)addr;
+    if ((ip != host) && (inet_pton(AF_INET6, str, &in6->sin6_addr) == 1)) {
+        in6->sin6_family = AF_INET6;
+        in6->sin6_port = htons((uint16_t)p);
+        *addrlen = sizeof(*in6);
+        return true;
+    }
+    if ((ip == host) && (inet_pton(AF_INET, str, &in->sin_addr) == 1)) {
+        in->sin_family = AF_INET;
+        in->sin_port = htons((uint16_t)p);
+        *addrlen = sizeof(*in);
+        return true;
+    }
+    return false;
+}
+
+/* percent-decodes \p s of \p len into \p scratch and adds it as option */
+static coap_state_t _add_decoded(coap_packet_t *pkt, const uint16_t num,
+                                 const char *s, const size_t len,
+                                 uint8_t **scratch, const uint8_t *end)
+{
+    uint8_t *start = *scratch;
+    for (size_t i = 0; i < len; ++i) {
+        uint8_t c = (uint8_t)s[i];
+        if (c == '%') {
+            if (i + 2 >= len) {
+                return COAP_ERR_PAYLOAD_INVALID;
+            }
+            const int hi = _hex(s[i + 1]), lo = _hex(s[i + 2]);
+            if ((hi < 0) || (lo < 0)) {
+                return COAP_ERR_PAYLOAD_INVALID;
+            }
+            c = (uint8_t)(hi << 4 | lo);
+            i += 2;
+        }
+        if (*scratch == end) {
+            return COAP_ERR_BUFFER_TOO_SMALL;
+        }
+        *(*scratch)++ = c;
+    }
+    return coap_add_option(pkt, num, start, (size_t)(*scratch - start));
+}
+
+/*
+ * GET for {path}?{query} of \p uri, the host already resolved; options
+ * point into \p scratch of COAP_GW_URI_SIZE bytes.
+ */
+static coap_state_t _make_request(const char *uri, const int accept, const bool observe,
+                                  const uint32_t block, coap_packet_t *pkt,
+                                  uint8_t *scratch)
+{
+    const uint8_t *end = scratch + COAP_GW_URI_SIZE;
+    const char *path = uri + strcspn(uri, "/?");
+    const char *query = strchr(path, '?');
+    const char *path_end = query ? query : path + strlen(path);
+    coap_state_t rc = COAP_SUCCESS;
+
+    memset(pkt, 0, sizeof(*pkt));
+    pkt->hdr.ver = COAP_VERSION;
+    pkt->hdr.t = COAP_TYPE_CON;
+    pkt->hdr.code = COAP_METHOD_GET;
+    if (observe) {
+        rc = coap_add_option(pkt, COAP_OPTION_OBSERVE, NULL, 0);
+    }
+    // "/a/b" has the segments "a" and "b", "/" and "" none
+    if ((*path == '/') && (path + 1 < path_end)) {
+        for (const char *s = path + 1; (rc == COAP_SUCCESS) && (s <= path_end);) {
+            const char *slash = memchr(s, '/', (size_t)(path_end - s));
+            const char *e = slash ? slash : path_end;
+            rc = _add_decoded(pkt, COAP_OPTION_URI_PATH, s, (size_t)(e - s), &scratch, end);
+            s = e + 1;
+        }
+    }
+    for (const char *s = query ? query + 1 : NULL; s && *s && (rc == COAP_SUCCESS);) {
+        const size_t n = strcspn(s, "&");
+        rc = _add_decoded(pkt, COAP_OPTION_URI_QUERY, s, n, &scratch, end);
+        s += n + (s[n] == '&');
+    }
+    if ((rc == COAP_SUCCESS) && (accept >= 0)) {
+        if (end - scratch < 4) {
+            return COAP_ERR_BUFFER_TOO_SMALL;
+        }
+        rc = coap_add_option(pkt, COAP_OPTION_ACCEPT, scratch,
+                             coap_encode_uint((uint32_t)accept, scratch));
+        scratch += 4;
+    }
+    if ((rc == COAP_SUCCESS) && block) {
+        if (end - scratch < 4) {
+            return COAP_ERR_BUFFER_TOO_SMALL;
+        }
+        rc = coap_add_option(pkt, COAP_OPTION_BLOCK2, scratch, coap_encode_uint(block, scratch));
+    }
+    return rc;
+}
+
+static int _index(const coap_gw_t *gw, const coap_gw_entry_t *entry)
+{
+    return (int)(entry - gw->entries);
+}
+
+static void _fetched(void *arg, const coap_state_t state, const coap_packet_t *rsp);
+static void _notified(void *arg, const coap_state_t state, const coap_packet_t *rsp);
+
+static bool _fetch(coap_gw_entry_t *entry, const uint32_t block)
+{
+    coap_gw_t *gw = entry->gw;
+    uint8_t scratch[COAP_GW_URI_SIZE];
+    coap_packet_t pkt;
+
+    if (_make_request(entry->uri, entry->accept, false, block, &pkt, scratch) != COAP_SUCCESS) {
+        return false;
+    }
+    entry->fetch = coap_client_send(gw->client, &pkt, (const struct sockaddr *)&entry->addr,
+                                    entry->addrlen, gw->now, _fetched, entry);
+    gw->coap_requests += (entry->fetch >= 0);
+    return entry->fetch >= 0;
+}
+
+static bool _observe(coap_gw_entry_t *entry)
+{
+    coap_gw_t *gw = entry->gw;
+    uint8_t scratch[COAP_GW_URI_SIZE];
+    coap_packet_t pkt;
+
+    if (_make_request(entry->uri, entry->accept, true, 0, &pkt, scratch) != COAP_SUCCESS) {
+        return false;
+    }
+    entry->observe = coap_client_send(gw->client, &pkt, (const struct sockaddr *)&entry->addr,
+                                      entry->addrlen, gw->now, _notified, entry);
+    gw->coap_requests += (entry->observe >= 0);
+    return entry->observe >= 0;
+}
+
+static void _close(coap_gw_t *gw, coap_gw_conn_t *conn)
+{
+    if (conn->entry >= 0) {
+        coap_gw_entry_t *entry = &gw->entries[conn->entry];
+        if (conn->state == CONN_WAIT) {
+            entry->waiters--;
+        }
+        else if ((conn->state == CONN_EVENTS) && !--entry->subscribers && (entry->observe >= 0)) {
+            // the last one left, notifications get reset from now on
+            coap_client_cancel(gw->client, entry->observe);
+            entry->observe = -1;
+        }
+    }
+    close(conn->fd);
+    conn->fd = -1;
+    conn->entry = -1;
+}
+
+static void _serve(coap_gw_t *gw, coap_gw_conn_t *conn);
+
+/* sends what it can, false if the connection is gone */
+static bool _flush(coap_gw_t *gw, coap_gw_conn_t *conn)
+{
+    while (conn->txoff < conn->txlen) {
+        const ssize_t n = send(conn->fd, conn->tx + conn->txoff, conn->txlen - conn->txoff,
+                               MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0) {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+                return true;
+            }
+            _close(gw, conn);
+            return false;
+        }
+        conn->txoff += (size_t)n;
+    }
+    conn->txoff = conn->txlen = 0;
+    if (conn->state == CONN_WRITE) {
+        if (conn->close) {
+            _close(gw, conn);
+            return false;
+        }
+        conn->state = CONN_READ;
+        _serve(gw, conn);
+    }
+    return conn->fd >= 0;
+}
+
+/* appends to the send buffer, a reader too slow for its events is dropped */
+static bool _queue(coap_gw_t *gw, coap_gw_conn_t *conn, const void *data, const size_t len)
+{
+    if (conn->txoff) {
+        memmove(conn->tx, conn->tx + conn->txoff, conn->txlen - conn->txoff);
+        conn->txlen -= conn->txoff;
+        conn->txoff = 0;
+    }
+    if (sizeof(conn->tx) - conn->txlen < len) {
+        _close(gw, conn);
+        return false;
+    }
+    memcpy(conn->tx + conn->txlen, data, len);
+    conn->txlen += len;
+    return _flush(gw, conn);
+}
+
+static void _respond(coap_gw_t *gw, coap_gw_conn_t *conn, const int status,
+                     const char *type, const int max_age,
+                     const uint8_t *body, const size_t len)
+{
+    char head[256];
+    int n = snprintf(head, sizeof(head), "HTTP/1.1 %d %s\r\nContent-Length: %zu\r\n",
+                     status, _reason(status), len);
+    if (type) {
+        n += snprintf(head + n, sizeof(head) - n, "Content-Type: %s\r\n", type);
+    }
+    if (max_age >= 0) {
+        n += snprintf(head + n, sizeof(head) - n, "Cache-Control: max-age=%d\r\n", max_age);
+    }
+    n += snprintf(head + n, sizeof(head) - n, "%s\r\n", conn->close ? "Connection: close\r\n" : "");
+    conn->state = CONN_WRITE;
+    conn->entry = -1;
+    // both fit, the send buffer is empty unless requests were pipelined
+    if (conn->txoff) {
+        memmove(conn->tx, conn->tx + conn->txoff, conn->txlen - conn->txoff);
+        conn->txlen -= conn->txoff;
+        conn->txoff = 0;
+    }
+    if (sizeof(conn->tx) - conn->txlen < (size_t)n + len) {
+        _close(gw, conn);
+        return;
+    }
+    memcpy(conn->tx + conn->txlen, head, (size_t)n);
+    memcpy(conn->tx + conn->txlen + n, body, len);
+    conn->txlen += (size_t)n + len;
+    _flush(gw, conn);
+}
+
+static void _respond_error(coap_gw_t *gw, coap_gw_conn_t *conn, const int status)
+{
+    const char *reason = _reason(status);
+    _respond(gw, conn, status, "text/plain", -1, (const uint8_t *)reason, strlen(reason));
+}
+
+static void _respond_entry(coap_gw_t *gw, coap_gw_conn_t *conn, const coap_gw_entry_t *entry)
+{
+    const char *type = (entry->content_format >= 0) ?
+                       coap_http_media_type((uint16_t)entry->content_format) : NULL;
+    const int32_t fresh = (int32_t)(entry->expires - gw->now);
+    if (!type && entry->len) {
+        type = "application/octet-stream";
+    }
+    _respond(gw, conn, coap_http_status_of(entry->code), type,
+             (fresh > 0) ? fresh / 1000 : 0, entry->body, entry->len);
+}
+
+/* all connections waiting for \p entry get its response, or \p status */
+static void _answer(coap_gw_t *gw, coap_gw_entry_t *entry, const int status)
+{
+    const int idx = _index(gw, entry);
+    for (size_t i = 0; entry->waiters && (i < gw->max_conns); ++i) {
+        coap_gw_conn_t *conn = &gw->conns[i];
+        if ((conn->fd < 0) || (conn->state != CONN_WAIT) || (conn->entry != idx)) {
+            continue;
+        }
+        entry->waiters--;
+        if (status) {
+            _respond_error(gw, conn, status);
+        }
+        else {
+            _respond_entry(gw, conn, entry);
+        }
+    }
+}
+
+static size_t _base64(const uint8_t *src, const size_t len, char *dst)
+{
+    static const char digits[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    size_t n = 0;
+    for (size_t i = 0; i < len; i += 3) {
+        const uint32_t v = (uint32_t)src[i] << 16 |
+                           ((i + 1 < len) ? (uint32_t)src[i + 1] << 8 : 0) |
+                           ((i + 2 < len) ? src[i + 2] : 0);
+        dst[n++] = digits[v >> 18];
+        dst[n++] = digits[(v >> 12) & 63];
+        dst[n++] = (i + 1 < len) ? digits[(v >> 6) & 63] : '=';
+        dst[n++] = (i + 2 < len) ? digits[v & 63] : '=';
+    }
+    return n;
+}
+
+/* text content formats go as they are, one data line per line */
+static bool _is_text(const int content_format)
+{
+    return (content_format == COAP_CONTENTTYPE_TXT_PLAIN) ||
+           (content_format == COAP_CONTENTTYPE_APP_LINKFORMAT) ||
+           (content_format == COAP_CONTENTTYPE_APP_XML) ||
+           (content_format == COAP_CONTENTTYPE_APP_JSON) ||
+           (content_format == COAP_CONTENTTYPE_APP_SENML_JSON);
+}
+
+/*
+ * Event of the current state of \p entry: the body of a 2.xx response, as
+ * text or base64 with event type base64, or event type error with the HTTP
+ * status. Returns its length, 0 if it does not fit.
+ */
+static size_t _format_event(const coap_gw_entry_t *entry, char *buf, const size_t size)
+{
+    int n = snprintf(buf, size, "id: %u\n", entry->events);
+    if ((entry->code >> 5) != 2) {
+        n += snprintf(buf + n, size - n, "event: error\ndata: %d\n\n",
+                      coap_http_status_of(entry->code));
+        return ((size_t)n < size) ? (size_t)n : 0;
+    }
+    if (!_is_text(entry->content_format)) {
+        if ((size_t)n + 20 + (entry->len + 2) / 3 * 4 > size) {
+            return 0;
+        }
+        n += snprintf(buf + n, size - n, "event: base64\ndata: ");
+        n += (int)_base64(entry->body, entry->len, buf + n);
+        memcpy(buf + n, "\n\n", 2);
+        return (size_t)n + 2;
+    }
+    size_t len = (size_t)n;
+    const uint8_t *p = entry->body, *end = entry->body + entry->len;
+    do {
+        const uint8_t *nl = memchr(p, '\n', (size_t)(end - p));
+        const uint8_t *e = nl ? nl : end;
+        size_t line = (size_t)(e - p);
+        if ((line > 0) && (p[line - 1] == '\r')) {
+            line--;
+        }
+        if (len + 6 + line + 3 > size) {
+            return 0;
+        }
+        memcpy(buf + len, "data: ", 6);
+        memcpy(buf + len + 6, p, line);
+        buf[len + 6 + line] = '\n';
+        len += 7 + line;
+        p = nl ? nl + 1 : end;
+    } while (p < end);
+    buf[len++] = '\n';
+    return len;
+}
+
+/* the current state of \p entry to all of its event streams */
+static void _publish(coap_gw_t *gw, coap_gw_entry_t *entry)
+{
+    static char event[COAP_GW_TX_SIZE];
+    const int idx = _index(gw, entry);
+    const size_t len = _format_event(entry, event, sizeof(event));
+
+    for (size_t i = 0; len && entry->subscribers && (i < gw->max_conns); ++i) {
+        coap_gw_conn_t *conn = &gw->conns[i];
+        if ((conn->fd >= 0) && (conn->state == CONN_EVENTS) && (conn->entry == idx)) {
+            gw->events++;
+            _queue(gw, conn, event, len);
+        }
+    }
+}
+
+static void _store(coap_gw_t *gw, coap_gw_entry_t *entry, const coap_packet_t *rsp)
+{
+    uint8_t count;
+    const coap_option_t *cf = coap_find_options(rsp, COAP_OPTION_CONTENT_FORMAT, &count);
+    const coap_option_t *age = coap_find_options(rsp, COAP_OPTION_MAX_AGE, &count);
+
+    entry->code = rsp->hdr.code;
+    entry->content_format = cf ? (int)coap_decode_uint(&cf->buf) : -1;
+    entry->max_age = age ? coap_decode_uint(&age->buf) : COAP_GW_DEFAULT_MAX_AGE;
+    entry->expires = gw->now + entry->max_age * 1000;
+    memcpy(entry->body, entry->stage, entry->staged);
+    entry->len = entry->staged;
+    entry->staged = 0;
+    entry->valid = true;
+}
+
+/* adds the payload of \p rsp to the stage, false if it does not fit */
+static bool _stage(coap_gw_entry_t *entry, const coap_packet_t *rsp, coap_block_t *block,
+                   bool *more)
+{
+    *more = false;
+    if (coap_get_block(rsp, COAP_OPTION_BLOCK2, block) == COAP_SUCCESS) {
+        if (block->num * COAP_BLOCK_SIZE(block->szx) != entry->staged) {
+            return false;
+        }
+        *more = block->more;
+    }
+    else {
+        entry->staged = 0;
+    }
+    if (rsp->payload.len > sizeof(entry->stage) - entry->staged) {
+        return false;
+    }
+    if (rsp->payload.len) {
+        memcpy(entry->stage + entry->staged, rsp->payload.p, rsp->payload.len);
+    }
+    entry->staged += rsp->payload.len;
+    return true;
+}
+
+static void _fetched(void *arg, const coap_state_t state, const coap_packet_t *rsp)
+{
+    coap_gw_entry_t *entry = arg;
+    coap_gw_t *gw = entry->gw;
+    coap_block_t block;
+    bool more;
+
+    entry->fetch = -1;
+    if ((state == COAP_RSP_RECV) && _stage(entry, rsp, &block, &more)) {
+        if (!more) {
+            _store(gw, entry, rsp);
+            _answer(gw, entry, 0);
+            if (entry->publish) {
+                entry->publish = false;
+                _publish(gw, entry);
+            }
+            return;
+        }
+        if (_fetch(entry, ((block.num + 1) << 4) | block.szx)) {
+            return;
+        }
+    }
+    entry->staged = 0;
+    entry->publish = false;
+    _answer(gw, entry, (state == COAP_ERR_TIMEOUT) ? 504 : 502);
+}
+
+static void _notified(void *arg, const coap_state_t state, const coap_packet_t *rsp)
+{
+    coap_gw_entry_t *entry = arg;
+    coap_gw_t *gw = entry->gw;
+    coap_block_t block;
+    uint8_t count;
+    bool more;
+
+    if (state != COAP_RSP_RECV) {
+        entry->observe = -1;
+        entry->retry = gw->now + COAP_GW_RETRY_MS;
+        return;
+    }
+    if (!coap_find_options(rsp, COAP_OPTION_OBSERVE, &count)) {
+        // not observable or the observation ended, ask again once stale
+        entry->observe = -1;
+        const coap_option_t *age = coap_find_options(rsp, COAP_OPTION_MAX_AGE, &count);
+        entry->retry = gw->now + (age ? coap_decode_uint(&age->buf) : COAP_GW_DEFAULT_MAX_AGE) * 1000;
+    }
+    entry->events++;
+    if (entry->fetch >= 0) {
+        // the running fetch brings a newer state anyway
+        entry->publish = true;
+        return;
+    }
+    if (!_stage(entry, rsp, &block, &more)) {
+        entry->staged = 0;
+        return;
+    }
+    if (more) {
+        // the rest of a large notification, RFC 7959 section 3.4
+        entry->publish = true;
+        if (!_fetch(entry, ((block.num + 1) << 4) | block.szx)) {
+            entry->publish = false;
+            entry->staged = 0;
+        }
+        return;
+    }
+    _store(gw, entry, rsp);
+    _answer(gw, entry, 0);
+    _publish(gw, entry);
+}
+
+static coap_gw_entry_t *_entry(coap_gw_t *gw, const char *uri, const int accept,
+                               const struct sockaddr_storage *addr, const socklen_t addrlen)
+{
+    const uint64_t hash = _hash(uri, accept);
+    coap_gw_entry_t *lru = NULL;
+
+    for (size_t i = 0; i < COAP_GW_CACHE_SIZE; ++i) {
+        coap_gw_entry_t *e = &gw->entries[i];
+        if (e->state == ENTRY_FREE) {
+            lru = lru && (lru->state == ENTRY_FREE) ? lru : e;
+            continue;
+        }
+        if ((e->hash == hash) && (e->accept == accept) && !strcmp(e->uri, uri)) {
+            return e;
+        }
+        const bool idle = !e->waiters && !e->subscribers && (e->fetch < 0) && (e->observe < 0);
+        if (idle && (!lru || ((lru->state != ENTRY_FREE) &&
+                              ((int32_t)(e->used - lru->used) < 0)))) {
+            lru = e;
+        }
+    }
+    if (lru) {
+        memset(lru, 0, offsetof(coap_gw_entry_t, body));
+        lru->state = ENTRY_USED;
+        lru->gw = gw;
+        lru->hash = hash;
+        strcpy(lru->uri, uri);
+        lru->accept = accept;
+        memcpy(&lru->addr, addr, addrlen);
+        lru->addrlen = addrlen;
+        lru->fetch = -1;
+        lru->observe = -1;
+        lru->content_format = -1;
+        lru->staged = 0;
+    }
+    return lru;
+}
+
+/*
+ * Accept header: the first media type with a content format, any if there
+ * is none or any type comes first, q values are ignored. Returns -2 if nothing
+ * acceptable has a content format.
+ */
+static int _accept(const char *v, size_t len, bool *events)
+{
+    bool any = !len;
+    *events = false;
+    for (size_t i = 0; i < len;) {
+        size_t j = i;
+        while ((j < len) && (v[j] != ',')) {
+            j++;
+        }
+        const char *t = v + i;
+        size_t tlen = j - i;
+        const char *semi = memchr(t, ';', tlen);
+        size_t typelen = semi ? (size_t)(semi - t) : tlen;
+        _trim(&t, &typelen);
+        if (_ieq(t, typelen, _event_stream)) {
+            *events = true;
+            return -1;
+        }
+        if (_ieq(t, typelen, "*/*")) {
+            any = true;
+        }
+        else if (!any) {
+            const int cf = coap_http_content_format((const uint8_t *)t, tlen - (size_t)(t - (v + i)));
+            if (cf >= 0) {
+                return cf;
+            }
+        }
+        i = j + 1;
+    }
+    return any ? -1 : -2;
+}
+
+/* handles the request of \p len bytes at the start of rx */
+static void _request(coap_gw_t *gw, coap_gw_conn_t *conn, const char *req, const size_t len)
+{
+    const char *sp1 = memchr(req, ' ', len);
+    const char *sp2 = sp1 ? memchr(sp1 + 1, ' ', len - (size_t)(sp1 + 1 - req)) : NULL;
+    const char *eol = strstr(req, "\r\n");
+    const char *accept_v = NULL;
+    size_t accept_len = 0;
+    bool keep_alive = false, events;
+
+    gw->http_requests++;
+    conn->close = true;
+    if (!sp1 || !sp2 || (eol < sp2) || ((eol - sp2 - 1) != 8) || memcmp(sp2 + 1, "HTTP/1.", 7)) {
+        _respond_error(gw, conn, 400);
+        return;
+    }
+    conn->close = false;
+    // headers of interest
+    for (const char *h = eol + 2; h < req + len - 2;) {
+        const char *e = strstr(h, "\r\n");
+        const char *colon = memchr(h, ':', (size_t)(e - h));
+        if (colon) {
+            const char *v = colon + 1;
+            size_t vlen = (size_t)(e - v);
+            _trim(&v, &vlen);
+            if (_ieq(h, (size_t)(colon - h), "accept")) {
+                accept_v = v;
+                accept_len = vlen;
+            }
+            else if (_ieq(h, (size_t)(colon - h), "connection")) {
+                keep_alive = _ieq(v, vlen, "keep-alive");
+                conn->close = _ieq(v, vlen, "close");
+            }
+        }
+        h = e + 2;
+    }
+    conn->close = conn->close || ((sp2[8] == '0') && !keep_alive);
+    if (((size_t)(sp1 - req) != 3) || memcmp(req, "GET", 3)) {
+        _respond_error(gw, conn, 405);
+        return;
+    }
+    const size_t prefix = strlen(COAP_GW_PREFIX);
+    const char *uri = sp1 + 1 + prefix;
+    if (((size_t)(sp2 - sp1 - 1) <= prefix) || memcmp(sp1 + 1, COAP_GW_PREFIX, prefix)) {
+        _respond_error(gw, conn, 404);
+        return;
+    }
+    char target[COAP_GW_URI_SIZE];
+    if ((size_t)(sp2 - uri) >= sizeof(target)) {
+        _respond_error(gw, conn, 414);
+        return;
+    }
+    memcpy(target, uri, (size_t)(sp2 - uri));
+    target[sp2 - uri] = '\0';
+    const int accept = _accept(accept_v, accept_len, &events);
+    if (accept == -2) {
+        _respond_error(gw, conn, 406);
+        return;
+    }
+
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+    uint8_t scratch[COAP_GW_URI_SIZE];
+    coap_packet_t pkt;
+    const coap_state_t rc = _make_request(target, accept, true, 1 << 4, &pkt, scratch);
+    if (!_resolve(target, strcspn(target, "/?"), &addr, &addrlen) ||
+        (rc == COAP_ERR_PAYLOAD_INVALID)) {
+        _respond_error(gw, conn, 400);
+        return;
+    }
+    if (rc != COAP_SUCCESS) {
+        _respond_error(gw, conn, 414);     // too many segments for COAP_MAX_OPTIONS
+        return;
+    }
+    if (gw->allow && !gw->allow(gw->allow_ctx, (const struct sockaddr *)&addr, addrlen)) {
+        _respond_error(gw, conn, 403);
+        return;
+    }
+    coap_gw_entry_t *entry = _entry(gw, target, accept, &addr, addrlen);
+    if (!entry) {
+        _respond_error(gw, conn, 503);
+        return;
+    }
+    entry->used = gw->now;
+    const bool fresh = entry->valid && ((int32_t)(entry->expires - gw->now) > 0);
+    if (events) {
+        static const char head[] = "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\n"
+                                   "Cache-Control: no-cache\r\n\r\n";
+        conn->state = CONN_EVENTS;
+        conn->entry = _index(gw, entry);
+        conn->close = true;
+        entry->subscribers++;
+        if ((entry->observe < 0) && !_observe(entry)) {
+            entry->retry = gw->now + COAP_GW_RETRY_MS;
+        }
+        COAP_METRICS_INC(fresh ? COAP_METRIC_CACHE_HIT : COAP_METRIC_CACHE_MISS);
+        if (_queue(gw, conn, head, sizeof(head) - 1) && fresh) {
+            char event[COAP_GW_TX_SIZE];
+            const size_t n = _format_event(entry, event, sizeof(event));
+            gw->cache_hits++;
+            gw->events += (n > 0);
+            _queue(gw, conn, event, n);
+        }
+        return;
+    }
+    if (fresh) {
+        gw->cache_hits++;
+        COAP_METRICS_INC(COAP_METRIC_CACHE_HIT);
+        _respond_entry(gw, conn, entry);
+        return;
+    }
+    COAP_METRICS_INC(COAP_METRIC_CACHE_MISS);
+    if (entry->fetch >= 0) {
+        gw->coalesced++;
+    }
+    else if (!_fetch(entry, 0)) {
+        _respond_error(gw, conn, 503);
+        return;
+    }
+    conn->state = CONN_WAIT;
+    conn->entry = _index(gw, entry);
+    entry->waiters++;
+}
+
+/* handles complete requests in rx while the connection is idle */
+static void _serve(coap_gw_t *gw, coap_gw_conn_t *conn)
+{
+    while ((conn->fd >= 0) && (conn->state == CONN_READ)) {
+        conn->rx[conn->rxlen] = '\0';
+        const char *end = strstr((const char *)conn->rx, "\r\n\r\n");
+        if (!end) {
+            if (conn->rxlen == sizeof(conn->rx) - 1) {
+                conn->rxlen = 0;
+                conn->close = true;
+                _respond_error(gw, conn, 431);
+            }
+            return;
+        }
+        // requests of a GET gateway have no body
+        const size_t len = (size_t)(end + 4 - (const char *)conn->rx);
+        char req[COAP_GW_RX_SIZE];
+        memcpy(req, conn->rx, len);
+        req[len] = '\0';
+        memmove(conn->rx, conn->rx + len, conn->rxlen - len);
+        conn->rxlen -= len;
+        _request(gw, conn, req, len);
+    }
+}
+
+static void _read(coap_gw_t *gw, coap_gw_conn_t *conn)
+{
+    uint8_t discard[256];
+    // event streams only listen for the close
+    const bool events = (conn->state == CONN_EVENTS);
+    uint8_t *buf = events ? discard : conn->rx + conn->rxlen;
+    const size_t size = events ? sizeof(discard) : sizeof(conn->rx) - 1 - conn->rxlen;
+    if (!size) {
+        return;
+    }
+    const ssize_t n = recv(conn->fd, buf, size, MSG_DONTWAIT);
+    if ((n == 0) || ((n < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK))) {
+        _close(gw, conn);
+        return;
+    }
+    if ((n > 0) && !events) {
+        conn->rxlen += (size_t)n;
+        _serve(gw, conn);
+    }
+}
+
+static void _accept_all(coap_gw_t *gw)
+{
+    for (;;) {
+        const int fd = accept(gw->lfd, NULL, NULL);
+        if (fd < 0) {
+            return;
+        }
+        coap_gw_conn_t *conn = NULL;
+        for (size_t i = 0; i < gw->max_conns; ++i) {
+            if (gw->conns[i].fd < 0) {
+                conn = &gw->conns[i];
+                break;
+            }
+        }
+        if (!conn) {
+            close(fd);
+            continue;
+        }
+        const int one = 1;
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        conn->fd = fd;
+        conn->state = CONN_READ;
+        conn->entry = -1;
+        conn->close = false;
+        conn->rxlen = conn->txlen = conn->txoff = 0;
+    }
+}
+
+/* --- PUBLIC --------------------------------------------------------------- */
+coap_state_t coap_gw_init(coap_gw_t *gw, const int lfd, coap_client_t *client,
+                          const size_t max_conns)
+{
+    memset(gw, 0, offsetof(coap_gw_t, entries));
+    for (size_t i = 0; i < COAP_GW_CACHE_SIZE; ++i) {
+        gw->entries[i].state = ENTRY_FREE;
+    }
+    gw->lfd = lfd;
+    gw->client = client;
+    gw->max_conns = max_conns;
+    gw->conns = malloc(max_conns * sizeof(*gw->conns));
+    gw->pollmap = malloc((max_conns + 1) * sizeof(*gw->pollmap));
+    if (!gw->conns || !gw->pollmap) {
+        coap_gw_free(gw);
+        return COAP_ERR_BUFFER_TOO_SMALL;
+    }
+    for (size_t i = 0; i < max_conns; ++i) {
+        gw->conns[i].fd = -1;
+    }
+    fcntl(lfd, F_SETFL, fcntl(lfd, F_GETFL) | O_NONBLOCK);
+    return COAP_SUCCESS;
+}
+
+void coap_gw_free(coap_gw_t *gw)
+{
+    for (size_t i = 0; gw->conns && (i < gw->max_conns); ++i) {
+        if (gw->conns[i].fd >= 0) {
+            _close(gw, &gw->conns[i]);
+        }
+    }
+    for (size_t i = 0; i < COAP_GW_CACHE_SIZE; ++i) {
+        coap_gw_entry_t *entry = &gw->entries[i];
+        if (entry->state == ENTRY_FREE) {
+            continue;
+        }
+        if (entry->fetch >= 0) {
+            coap_client_cancel(gw->client, entry->fetch);
+        }
+        if (entry->observe >= 0) {
+            coap_client_cancel(gw->client, entry->observe);
+        }
+        entry->state = ENTRY_FREE;
+    }
+    free(gw->conns);
+    free(gw->pollmap);
+    gw->conns = NULL;
+    gw->pollmap = NULL;
+    gw->max_conns = 0;
+}
+
+size_t coap_gw_pollfds(coap_gw_t *gw, struct pollfd *fds, const size_t size)
+{
+    size_t n = 0;
+    if (size) {
+        fds[0].fd = gw->lfd;
+        fds[0].events = POLLIN;
+        fds[0].revents = 0;
+        gw->pollmap[n++] = -1;
+    }
+    for (size_t i = 0; (i < gw->max_conns) && (n < size); ++i) {
+        const coap_gw_conn_t *conn = &gw->conns[i];
+        if (conn->fd < 0) {
+            continue;
+        }
+        fds[n].fd = conn->fd;
+        fds[n].events = 0;
+        if ((conn->state == CONN_EVENTS) || (conn->rxlen < sizeof(conn->rx) - 1)) {
+            fds[n].events |= POLLIN;
+        }
+        if (conn->txoff < conn->txlen) {
+            fds[n].events |= POLLOUT;
+        }
+        fds[n].revents = 0;
+        gw->pollmap[n++] = (int)i;
+    }
+    return n;
+}
+
+void coap_gw_process(coap_gw_t *gw, const struct pollfd *fds, const size_t nfds,
+                     const uint32_t now)
+{
+    gw->now = now;
+    for (size_t i = 0; i < nfds; ++i) {
+        if (!fds[i].revents) {
+            continue;
+        }
+        if (gw->pollmap[i] < 0) {
+            _accept_all(gw);
+            continue;
+        }
+        coap_gw_conn_t *conn = &gw->conns[gw->pollmap[i]];
+        if (conn->fd != fds[i].fd) {
+            continue;   // closed meanwhile
+        }
+        if ((fds[i].revents & POLLOUT) && !_flush(gw, conn)) {
+            continue;
+        }
+        if ((conn->fd >= 0) && (fds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+            _read(gw, conn);
+        }
+    }
+    // observe again for streams whose observation ended
+    for (size_t i = 0; i < COAP_GW_CACHE_SIZE; ++i) {
+        coap_gw_entry_t *entry = &gw->entries[i];
+        if ((entry->state != ENTRY_FREE) && entry->subscribers && (entry->observe < 0) &&
+            ((int32_t)(now - entry->retry) >= 0) && !_observe(entry)) {
+            entry->retry = now + COAP_GW_RETRY_MS;
+        }
+    }
+}
+
+int coap_gw_timeout(const coap_gw_t *gw, const uint32_t now)
+{
+    int timeout = -1;
+    for (size_t i = 0; i < COAP_GW_CACHE_SIZE; ++i) {
+        const coap_gw_entry_t *entry = &gw->entries[i];
+        if ((entry->state == ENTRY_FREE) || !entry->subscribers || (entry->observe >= 0)) {
+            continue;
+        }
+        const int32_t left = (int32_t)(entry->retry - now);
+        if ((timeout < 0) || (left < timeout)) {
+            timeout = (left < 0) ? 0 : left;
+        }
+    }
+    return timeout;
+}
@@ -0,0 +1,179 @@
+#ifndef COAP_GW_H
+#define COAP_GW_H 1
+
+/**
+ * @file coap_gw.h
+ *
+ * HTTP-to-CoAP gateway: a small HTTP/1.1 front-end that answers
+ * GET /coap/{host}/{path}?{query} with the CoAP resource coap://{host}/{path}
+ * fetched through the asynchronous client, e.g. for a web dashboard. The
+ * host is an IPv4 address or an IPv6 address in brackets, with an optional
+ * port; names are not resolved. Path segments and query parts share the
+ * options of a request with Observe, Accept and Block2, at most
+ * COAP_MAX_OPTIONS - 3 of them are accepted. A request with
+ * Accept: text/event-stream observes the resource instead and receives every
+ * notification as a server-sent event.
+ *
+ * Responses are kept in a shared cache for their Max-Age, and an observed
+ * resource stays fresh as long as anyone listens. Requests for a resource
+ * that is being fetched wait for that exchange, and all event streams of one
+ * resource share one observation, so a thousand viewers of a device cause one
+ * CoAP exchange. Bodies larger than a block are fetched block wise (Block2).
+ *
+ * The gateway runs in the event loop of the client: poll the descriptors of
+ * coap_gw_pollfds together with client->fd and call coap_gw_process and
+ * coap_client_process. It allocates its connection table once in
+ * coap_gw_init. Not thread safe.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <poll.h>
+#include <sys/socket.h>
+
+#include "coap.h"
+#include "coap_client.h"
+
+#ifndef COAP_GW_CACHE_SIZE
+#define COAP_GW_CACHE_SIZE      64      //!< resources cached or observed
+#endif
+#ifndef COAP_GW_BODY_SIZE
+#define COAP_GW_BODY_SIZE       4096    //!< largest resource, else 502
+#endif
+#define COAP_GW_URI_SIZE        192     //!< host, path and query of a request
+#define COAP_GW_RX_SIZE         1024    //!< request line and headers, else 431
+#define COAP_GW_TX_SIZE         (2 * COAP_GW_BODY_SIZE) //!< unsent response or events
+#define COAP_GW_DEFAULT_MAX_AGE 60      //!< seconds, responses without Max-Age
+#define COAP_GW_RETRY_MS        5000    //!< observe again after it failed
+#define COAP_GW_PREFIX          "/coap/"
+
+/**
+ * @brief Decides whether the gateway may send requests to \p addr
+ *
+ * @return true to allow
+ */
+typedef bool (*coap_gw_allow_t)(void *ctx, const struct sockaddr *addr,
+                                const socklen_t addrlen);
+
+/**
+ * Cached resource, private
+ */
+typedef struct coap_gw_entry
+{
+    int state;              //!< free or in use
+    struct coap_gw *gw;     //!< for the client callbacks
+    uint64_t hash;          //!< of uri and accept
+    char uri[COAP_GW_URI_SIZE]; //!< {host}/{path}?{query} as requested
+    int accept;             //!< content format asked for, -1 for any
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+    int fetch;              //!< client handle of the fetch in progress, -1 if none
+    int observe;            //!< client handle of the observation, -1 if none
+    uint32_t waiters;       //!< connections waiting for the fetch
+    uint32_t subscribers;   //!< event streams
+    uint32_t used;          //!< last request, ms
+    uint32_t expires;       //!< end of freshness, ms
+    uint32_t retry;         //!< observe again, ms
+    uint32_t events;        //!< notifications, the event ID
+    bool valid;             //!< body holds a response
+    bool publish;           //!< the fetch completes a notification
+    uint8_t code;
+    int content_format;     //!< -1 if none
+    uint32_t max_age;
+    size_t len;
+    uint8_t body[COAP_GW_BODY_SIZE];
+    size_t staged;          //!< of the block wise fetch in progress
+    uint8_t stage[COAP_GW_BODY_SIZE];
+} coap_gw_entry_t;
+
+/**
+ * HTTP connection, private
+ */
+typedef struct coap_gw_conn
+{
+    int fd;                 //!< -1 if unused
+    int state;              //!< reading, waiting, writing or streaming events
+    int entry;              //!< resource waited for or streamed, -1 if none
+    bool close;             //!< after the response
+    size_t rxlen;
+    size_t txlen;
+    size_t txoff;           //!< sent of tx
+    uint8_t rx[COAP_GW_RX_SIZE];
+    uint8_t tx[COAP_GW_TX_SIZE];
+} coap_gw_conn_t;
+
+/**
+ * Gateway
+ */
+typedef struct coap_gw
+{
+    int lfd;                //!< listening socket
+    coap_client_t *client;
+    coap_gw_allow_t allow;  //!< NULL allows all hosts
+    void *allow_ctx;
+    coap_gw_conn_t *conns;
+    int *pollmap;           //!< connection of each poll entry, -1 for lfd
+    size_t max_conns;
+    uint32_t now;           //!< ms, of the last call
+    uint32_t http_requests;
+    uint32_t cache_hits;    //!< answered from the cache
+    uint32_t coalesced;     //!< waited for a fetch in progress
+    uint32_t coap_requests; //!< fetches, blocks and observations
+    uint32_t events;        //!< server-sent events queued
+    coap_gw_entry_t entries[COAP_GW_CACHE_SIZE];
+} coap_gw_t;
+
+/**
+ * @brief Set up a gateway
+ *
+ * @param[out] gw Gateway
+ * @param[in] lfd Listening TCP socket, made non-blocking
+ * @param[in] client Client of the CoAP requests
+ * @param[in] max_conns Concurrent HTTP connections, more are refused
+ *
+ * @return 0 on success, or COAP_ERR_BUFFER_TOO_SMALL if out of memory
+ */
+coap_state_t coap_gw_init(coap_gw_t *gw, const int lfd, coap_client_t *client,
+                          const size_t max_conns);
+
+/**
+ * @brief Close all connections, cancel the CoAP requests and free the tables
+ */
+void coap_gw_free(coap_gw_t *gw);
+
+/**
+ * @brief Descriptors to poll for
+ *
+ * @param[in,out] gw Gateway, remembers the order for coap_gw_process
+ * @param[out] fds Poll entries, max_conns + 1 always fit
+ * @param[in] size Entries in \p fds
+ *
+ * @return Entries used
+ */
+size_t coap_gw_pollfds(coap_gw_t *gw, struct pollfd *fds, const size_t size);
+
+/**
+ * @brief Accept, read, answer and write as poll reported
+ *
+ * @param[in,out] gw Gateway
+ * @param[in] fds Entries of the last coap_gw_pollfds, with revents
+ * @param[in] nfds Number of \p fds
+ * @param[in] now Current time in ms, the clock of the client
+ */
+void coap_gw_process(coap_gw_t *gw, const struct pollfd *fds, const size_t nfds,
+                     const uint32_t now);
+
+/**
+ * @brief Time until coap_gw_process has to run next without poll events
+ *
+ * @return ms, or -1 if nothing is pending
+ */
+int coap_gw_timeout(const coap_gw_t *gw, const uint32_t now);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,1029 @@
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "coap.h"
+#include "coap_http.h"
+#include "coap_metrics.h"
+
+enum {
+    CONN_CLOSED,
+    CONN_CONNECTING,
+    CONN_IDLE,
+    CONN_BUSY,
+};
+
+enum {
+    EX_FREE,
+    EX_QUEUED,
+    EX_ACTIVE,
+};
+
+/* content formats with an HTTP media type, RFC 8075 section 6 */
+static const struct {
+    uint16_t content_format;
+    const char *type;
+} _media_types[] = {
+    { COAP_CONTENTTYPE_TXT_PLAIN, "text/plain;charset=utf-8" },
+    { COAP_CONTENTTYPE_APP_LINKFORMAT, "application/link-format" },
+    { COAP_CONTENTTYPE_APP_XML, "application/xml" },
+    { COAP_CONTENTTYPE_APP_OCTECT_STREAM, "application/octet-stream" },
+    { COAP_CONTENTTYPE_APP_EXI, "application/exi" },
+    { COAP_CONTENTTYPE_APP_JSON, "application/json" },
+    { COAP_CONTENTTYPE_APP_CBOR, "application/cbor" },
+    { COAP_CONTENTTYPE_APP_SENML_JSON, "application/senml+json" },
+    { COAP_CONTENTTYPE_APP_SENML_CBOR, "application/senml+cbor" },
+};
+
+/* --- PRIVATE -------------------------------------------------------------- */
+static uint8_t _lower(const uint8_t c)
+{
+    return ((c >= 'A') && (c <= 'Z')) ? c + ('a' - 'A') : c;
+}
+
+/* case insensitive \p p of \p len against lower case \p s */
+static bool _ieq(const uint8_t *p, const size_t len, const char *s)
+{
+    const size_t n = strlen(s);
+    if (len != n) {
+        return false;
+    }
+    for (size_t i = 0; i < n; ++i) {
+        if (_lower(p[i]) != (uint8_t)s[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool _is_ows(const uint8_t c)
+{
+    return (c == ' ') || (c == '\t');
+}
+
+/* \p p of \p len without surrounding whitespace */
+static void _trim(const uint8_t **p, size_t *len)
+{
+    while (*len && _is_ows(**p)) {
+        (*p)++;
+        (*len)--;
+    }
+    while (*len && _is_ows((*p)[*len - 1])) {
+        (*len)--;
+    }
+}
+
+static bool _put(uint8_t *buf, const size_t size, size_t *len,
+                 const void *s, const size_t n)
+{
+    if (size - *len < n) {
+        return false;
+    }
+    if (n) {
+        memcpy(buf + *len, s, n);
+    }
+    *len += n;
+    return true;
+}
+
+static bool _put_str(uint8_t *buf, const size_t size, size_t *len, const char *s)
+{
+    return _put(buf, size, len, s, strlen(s));
+}
+
+/* unreserved, sub-delims, ':' and '@' stay, RFC 3986 pchar; '&' separates
+ * query arguments and is encoded there */
+static bool _put_pct(uint8_t *buf, const size_t size, size_t *len,
+                     const coap_buffer_t *v, const bool query)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    for (size_t i = 0; i < v->len; ++i) {
+        const uint8_t c = v->p[i];
+        const bool keep = (((c | 0x20) >= 'a') && ((c | 0x20) <= 'z')) ||
+                          ((c >= '0') && (c <= '9')) ||
+                          (c && strchr("-._~!$'()*+,;=:@", c)) ||
+                          ((c == '&') && !query) ||
+                          (query && ((c == '/') || (c == '?')));
+        if (keep) {
+            if (!_put(buf, size, len, &c, 1)) {
+                return false;
+            }
+        }
+        else {
+            const uint8_t pct[3] = { '%', (uint8_t)hex[c >> 4], (uint8_t)hex[c & 15] };
+            if (!_put(buf, size, len, pct, 3)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static bool _parse_dec(const uint8_t *p, const size_t len, uint32_t *value)
+{
+    uint64_t v = 0;
+    if (!len || (len > 10)) {
+        return false;
+    }
+    for (size_t i = 0; i < len; ++i) {
+        if ((p[i] < '0') || (p[i] > '9')) {
+            return false;
+        }
+        v = v * 10 + (p[i] - '0');
+    }
+    if (v > UINT32_MAX) {
+        return false;
+    }
+    *value = (uint32_t)v;
+    return true;
+}
+
+/* offset behind the next CRLF from \p pos, 0 if there is none */
+static size_t _line_end(const uint8_t *p, const size_t len, size_t pos)
+{
+    const uint8_t *lf = (pos < len) ? memchr(p + pos, '\n', len - pos) : NULL;
+    if (!lf || (lf == p + pos) || (lf[-1] != '\r')) {
+        return 0;
+    }
+    return (size_t)(lf - p) + 1;
+}
+
+/* Cache-Control directives, max-age and the ones forbidding reuse */
+static void _cache_control(const uint8_t *v, const size_t len, int32_t *max_age)
+{
+    for (size_t i = 0; i < len;) {
+        size_t j = i;
+        while ((j < len) && (v[j] != ',')) {
+            j++;
+        }
+        const uint8_t *d = v + i;
+        size_t dlen = j - i;
+        uint32_t age;
+        _trim(&d, &dlen);
+        if ((dlen > 8) && _ieq(d, 8, "max-age=") && _parse_dec(d + 8, dlen - 8, &age)) {
+            if (*max_age != 0) {
+                *max_age = (age > INT32_MAX) ? INT32_MAX : (int32_t)age;
+            }
+        }
+        else if (_ieq(d, dlen, "no-cache") || _ieq(d, dlen, "no-store")) {
+            *max_age = 0;
+        }
+        i = j + 1;
+    }
+}
+
+/* last of the comma separated codings, e.g. "gzip, chunked" */
+static bool _is_chunked(const uint8_t *v, size_t len)
+{
+    const uint8_t *comma = NULL;
+    for (size_t i = 0; i < len; ++i) {
+        if (v[i] == ',') {
+            comma = v + i;
+        }
+    }
+    if (comma) {
+        len -= (size_t)(comma + 1 - v);
+        v = comma + 1;
+    }
+    _trim(&v, &len);
+    return _ieq(v, len, "chunked");
+}
+
+static bool _has_token(const uint8_t *v, const size_t len, const char *token)
+{
+    for (size_t i = 0; i < len;) {
+        size_t j = i;
+        while ((j < len) && (v[j] != ',')) {
+            j++;
+        }
+        const uint8_t *t = v + i;
+        size_t tlen = j - i;
+        _trim(&t, &tlen);
+        if (_ieq(t, tlen, token)) {
+            return true;
+        }
+        i = j + 1;
+    }
+    return false;
+}
+
+/*
+ * Chunked body at \p pos: checks it is complete, then with \p decode moves
+ * the chunk data together. Returns COAP_SUCCESS with the body length in
+ * \p bodylen and the end of the message in \p end.
+ */
+static coap_state_t _chunked(uint8_t *buf, const size_t len, const size_t pos,
+                             const bool decode, size_t *bodylen, size_t *end)
+{
+    size_t i = pos, out = pos;
+    for (;;) {
+        const size_t eol = _line_end(buf, len, i);
+        if (!eol) {
+            return ((len - i) > 256) ? COAP_ERR_PAYLOAD_INVALID : COAP_RSP_WAIT;
+        }
+        size_t size = 0, digits = 0;
+        for (; i < eol - 2; ++i, ++digits) {
+            const uint8_t c = _lower(buf[i]);
+            if ((c >= '0') && (c <= '9')) {
+                size = size * 16 + (c - '0');
+            }
+            else if ((c >= 'a') && (c <= 'f')) {
+                size = size * 16 + (c - 'a' + 10);
+            }
+            else {
+                break;  // chunk extension
+            }
+            if (size > COAP_HTTP_RX_SIZE) {
+                return COAP_ERR_PAYLOAD_INVALID;
+            }
+        }
+        if (!digits) {
+            return COAP_ERR_PAYLOAD_INVALID;
+        }
+        i = eol;
+        if (!size) {
+            // trailer fields up to an empty line
+            for (size_t t; (t = _line_end(buf, len, i)) != i + 2; i = t) {
+                if (!t) {
+                    return COAP_RSP_WAIT;
+                }
+            }
+            *bodylen = out - pos;
+            *end = i + 2;
+            return COAP_SUCCESS;
+        }
+        if (len - i < size + 2) {
+            return COAP_RSP_WAIT;
+        }
+        if ((buf[i + size] != '\r') || (buf[i + size + 1] != '\n')) {
+            return COAP_ERR_PAYLOAD_INVALID;
+        }
+        if (decode) {
+            memmove(buf + out, buf + i, size);
+        }
+        out += size;
+        i += size + 2;
+    }
+}
+
+static const coap_http_route_t *_route(const coap_http_proxy_t *proxy,
+                                       const coap_packet_t *inpkt)
+{
+    uint8_t count;
+    const coap_option_t *opt = coap_find_options(inpkt, COAP_OPTION_URI_PATH, &count);
+    for (size_t i = 0; opt && (i < proxy->nroutes); ++i) {
+        const char *path = proxy->routes[i].path;
+        if ((opt->buf.len == strlen(path)) && !memcmp(opt->buf.p, path, opt->buf.len)) {
+            return &proxy->routes[i];
+        }
+    }
+    return NULL;
+}
+
+/* GETs with the same path, query and Accept share one HTTP exchange */
+static uint64_t _coalesce_key(const coap_packet_t *inpkt)
+{
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < inpkt->numopts; ++i) {
+        const coap_option_t *o = &inpkt->opts[i];
+        if ((o->num != COAP_OPTION_URI_PATH) && (o->num != COAP_OPTION_URI_QUERY) &&
+            (o->num != COAP_OPTION_ACCEPT)) {
+            continue;
+        }
+        const uint8_t sep[2] = { (uint8_t)o->num, (uint8_t)o->buf.len };
+        for (size_t j = 0; j < sizeof(sep) + o->buf.len; ++j) {
+            h ^= (j < sizeof(sep)) ? sep[j] : o->buf.p[j - sizeof(sep)];
+            h *= 0x100000001b3ull;
+        }
+    }
+    return h ? h : 1;
+}
+
+/* moves the pool occupancy gauges along with the connection */
+static void _conn_state(coap_http_conn_t *c, const int state)
+{
+    COAP_METRICS_GAUGE(COAP_GAUGE_HTTP_POOL_OPEN,
+                       (int64_t)(state != CONN_CLOSED) - (c->state != CONN_CLOSED));
+    COAP_METRICS_GAUGE(COAP_GAUGE_HTTP_POOL_BUSY,
+                       (int64_t)((state == CONN_CONNECTING) || (state == CONN_BUSY)) -
+                       ((c->state == CONN_CONNECTING) || (c->state == CONN_BUSY)));
+    c->state = state;
+}
+
+static void _conn_close(coap_http_conn_t *c)
+{
+    if (c->fd >= 0) {
+        close(c->fd);
+    }
+    c->fd = -1;
+    _conn_state(c, CONN_CLOSED);
+    c->exchange = -1;
+    c->requests = 0;
+    c->rxlen = 0;
+}
+
+static bool _conn_open(coap_http_proxy_t *proxy, coap_http_conn_t *c)
+{
+    c->fd = socket(proxy->upstream.ss_family, SOCK_STREAM, 0);
+    if (c->fd < 0) {
+        return false;
+    }
+    fcntl(c->fd, F_SETFL, fcntl(c->fd, F_GETFL) | O_NONBLOCK);
+    if ((connect(c->fd, (const struct sockaddr *)&proxy->upstream,
+                 proxy->upstream_len) < 0) && (errno != EINPROGRESS)) {
+        _conn_close(c);
+        return false;
+    }
+    _conn_state(c, CONN_CONNECTING);
+    c->requests = 0;
+    c->rxlen = 0;
+    proxy->connects++;
+    return true;
+}
+
+/* answers all waiters of \p ex, with the HTTP response if \p rsp is set */
+static size_t _answer(coap_http_proxy_t *proxy, coap_http_exchange_t *ex,
+                      const coap_responsecode_t rspcode,
+                      const coap_http_response_t *rsp,
+                      coap_http_send_t send_cb, void *ctx)
+{
+    size_t n = 0;
+    int next;
+    for (int w = ex->waiters; w >= 0; w = next) {
+        coap_http_waiter_t *waiter = &proxy->waiters[w];
+        const coap_buffer_t tok = { waiter->tok, waiter->tkl };
+        uint8_t ct[4], maxage[4], scratch[4];
+        coap_packet_t req, pkt;
+
+        next = waiter->next;
+        coap_make_response(proxy->msgid++, &tok, COAP_TYPE_NONCON, rspcode,
+                           NULL, rsp ? rsp->body.p : NULL, rsp ? rsp->body.len : 0,
+                           &pkt);
+        if (rsp && (rsp->content_format >= 0)) {
+            coap_add_option(&pkt, COAP_OPTION_CONTENT_FORMAT, ct,
+                            coap_encode_uint((uint32_t)rsp->content_format, ct));
+        }
+        if (rsp && (rsp->max_age >= 0)) {
+            coap_add_option(&pkt, COAP_OPTION_MAX_AGE, maxage,
+                            coap_encode_uint((uint32_t)rsp->max_age, maxage));
+        }
+        // cut larger bodies into the requested block, or the first one
+        req.numopts = 0;
+        if (waiter->blocklen || pkt.payload.len) {
+            if (waiter->blocklen) {
+                coap_add_option(&req, COAP_OPTION_BLOCK2, waiter->block, waiter->blocklen);
+            }
+            coap_make_block2(&req, COAP_BLOCK_SZX_MAX, scratch, &pkt);
+        }
+        send_cb(ctx, (const struct sockaddr *)&waiter->addr, waiter->addrlen, &pkt);
+        waiter->next = proxy->free_waiters;
+        proxy->free_waiters = w;
+        n++;
+    }
+    ex->waiters = -1;
+    ex->state = EX_FREE;
+    return n;
+}
+
+/* the connection broke before the response was complete */
+static size_t _conn_failed(coap_http_proxy_t *proxy, coap_http_conn_t *c,
+                           coap_http_send_t send_cb, void *ctx)
+{
+    coap_http_exchange_t *ex = &proxy->exchanges[c->exchange];
+    // a reused connection the upstream closed meanwhile, try a fresh one
+    const bool retry = !c->rxlen && c->requests && !ex->retried &&
+                       (ex->method != COAP_METHOD_POST);
+    _conn_close(c);
+    if (retry) {
+        ex->retried = true;
+        ex->state = EX_QUEUED;
+        ex->sent = 0;
+        return 0;
+    }
+    return _answer(proxy, ex, COAP_RSPCODE_BAD_GATEWAY, NULL, send_cb, ctx);
+}
+
+/* connections for queued exchanges, oldest first */
+static void _dispatch(coap_http_proxy_t *proxy)
+{
+    for (;;) {
+        coap_http_exchange_t *oldest = NULL;
+        for (size_t i = 0; i < COAP_HTTP_MAX_EXCHANGES; ++i) {
+            coap_http_exchange_t *ex = &proxy->exchanges[i];
+            if ((ex->state == EX_QUEUED) && (!oldest || ((int32_t)(ex->seq - oldest->seq) < 0))) {
+                oldest = ex;
+            }
+        }
+        if (!oldest) {
+            return;
+        }
+        coap_http_conn_t *conn = NULL;
+        for (size_t i = 0; i < COAP_HTTP_POOL_SIZE; ++i) {
+            coap_http_conn_t *c = &proxy->conns[i];
+            if (c->state == CONN_IDLE) {
+                conn = c;
+                break;
+            }
+            if ((c->state == CONN_CLOSED) && !conn) {
+                conn = c;
+            }
+        }
+        if (!conn || ((conn->state == CONN_CLOSED) && !_conn_open(proxy, conn))) {
+            return;
+        }
+        if (conn->state == CONN_IDLE) {
+            _conn_state(conn, CONN_BUSY);
+        }
+        conn->exchange = (int)(oldest - proxy->exchanges);
+        conn->rxlen = 0;
+        oldest->state = EX_ACTIVE;
+        oldest->sent = 0;
+    }
+}
+
+static size_t _pump(coap_http_proxy_t *proxy, coap_http_conn_t *c,
+                    coap_http_send_t send_cb, void *ctx)
+{
+    if (c->state == CONN_CONNECTING) {
+        struct pollfd pfd = { c->fd, POLLOUT, 0 };
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (poll(&pfd, 1, 0) <= 0) {
+            return 0;
+        }
+        if ((getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0) || err) {
+            return _conn_failed(proxy, c, send_cb, ctx);
+        }
+        _conn_state(c, CONN_BUSY);
+    }
+    if (c->state == CONN_IDLE) {
+        // the upstream may close idle connections, or send garbage
+        uint8_t b;
+        const ssize_t n = recv(c->fd, &b, 1, MSG_DONTWAIT | MSG_PEEK);
+        if (!n || ((n < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK)) || (n > 0)) {
+            _conn_close(c);
+        }
+        return 0;
+    }
+    if (c->state != CONN_BUSY) {
+        return 0;
+    }
+    coap_http_exchange_t *ex = &proxy->exchanges[c->exchange];
+    while (ex->sent < ex->len) {
+        const ssize_t n = send(c->fd, ex->req + ex->sent, ex->len - ex->sent,
+                               MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0) {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+                return 0;
+            }
+            return _conn_failed(proxy, c, send_cb, ctx);
+        }
+        ex->sent += (size_t)n;
+        if (ex->sent == ex->len) {
+            proxy->upstream_requests++;
+        }
+    }
+    bool eof = false;
+    for (;;) {
+        if (c->rxlen == sizeof(c->rx)) {
+            break;
+        }
+        const ssize_t n = recv(c->fd, c->rx + c->rxlen, sizeof(c->rx) - c->rxlen,
+                               MSG_DONTWAIT);
+        if (n > 0) {
+            c->rxlen += (size_t)n;
+            continue;
+        }
+        if (!n) {
+            eof = true;
+        }
+        else if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+            return _conn_failed(proxy, c, send_cb, ctx);
+        }
+        break;
+    }
+    if (!c->rxlen) {
+        return eof ? _conn_failed(proxy, c, send_cb, ctx) : 0;
+    }
+    coap_http_response_t rsp;
+    const coap_state_t rc = coap_http_parse_response(c->rx, c->rxlen, eof, &rsp);
+    if ((rc == COAP_RSP_WAIT) && !eof && (c->rxlen < sizeof(c->rx))) {
+        return 0;
+    }
+    if (rc != COAP_SUCCESS) {
+        // malformed, cut short or larger than the receive buffer
+        _conn_close(c);
+        return _answer(proxy, ex, COAP_RSPCODE_BAD_GATEWAY, NULL, send_cb, ctx);
+    }
+    const size_t n = _answer(proxy, ex, coap_http_status(rsp.status, ex->method),
+                             &rsp, send_cb, ctx);
+    // bytes behind the response were never asked for, don't trust the rest
+    const bool reuse = !rsp.close && !eof && (rsp.len == c->rxlen);
+    c->exchange = -1;
+    c->requests++;
+    c->rxlen = 0;
+    _conn_state(c, CONN_IDLE);
+    if (!reuse) {
+        _conn_close(c);
+    }
+    return n;
+}
+
+/* --- PUBLIC --------------------------------------------------------------- */
+const char *coap_http_media_type(const uint16_t content_format)
+{
+    for (size_t i = 0; i < sizeof(_media_types) / sizeof(_media_types[0]); ++i) {
+        if (_media_types[i].content_format == content_format) {
+            return _media_types[i].type;
+        }
+    }
+    return NULL;
+}
+
+int coap_http_content_format(const uint8_t *type, const size_t len)
+{
+    const uint8_t *semi = memchr(type, ';', len);
+    const uint8_t *t = type;
+    size_t tlen = semi ? (size_t)(semi - type) : len;
+
+    _trim(&t, &tlen);
+    if (_ieq(t, tlen, "text/plain")) {
+        // any other charset has no content format
+        for (const uint8_t *p = semi; p; p = memchr(p + 1, ';', len - (size_t)(p + 1 - type))) {
+            const uint8_t *param = p + 1;
+            const uint8_t *next = memchr(param, ';', len - (size_t)(param - type));
+            size_t plen = next ? (size_t)(next - param) : len - (size_t)(param - type);
+            _trim(&param, &plen);
+            if ((plen > 8) && _ieq(param, 8, "charset=")) {
+                const uint8_t *cs = param + 8;
+                size_t cslen = plen - 8;
+                if ((cslen >= 2) && (cs[0] == '"') && (cs[cslen - 1] == '"')) {
+                    cs++;
+                    cslen -= 2;
+                }
+                if (!_ieq(cs, cslen, "utf-8") && !_ieq(cs, cslen, "us-ascii")) {
+                    return -1;
+                }
+            }
+            if (!next) {
+                break;
+            }
+        }
+        return COAP_CONTENTTYPE_TXT_PLAIN;
+    }
+    for (size_t i = 1; i < sizeof(_media_types) / sizeof(_media_types[0]); ++i) {
+        if (_ieq(t, tlen, _media_types[i].type)) {
+            return _media_types[i].content_format;
+        }
+    }
+    return -1;
+}
+
+coap_responsecode_t coap_http_status(const int status, const coap_method_t method)
+{
+    switch (status) {
+    case 200:
+    case 203:
+        return (method == COAP_METHOD_GET) ? COAP_RSPCODE_CONTENT :
+               (method == COAP_METHOD_DELETE) ? COAP_RSPCODE_DELETED :
+               COAP_RSPCODE_CHANGED;
+    case 201:
+        return COAP_RSPCODE_CREATED;
+    case 204:
+        return (method == COAP_METHOD_DELETE) ? COAP_RSPCODE_DELETED :
+               COAP_RSPCODE_CHANGED;
+    case 304:
+        return COAP_RSPCODE_VALID;
+    case 400:
+        return COAP_RSPCODE_BAD_REQUEST;
+    case 401:
+        return COAP_RSPCODE_UNAUTHORIZED;
+    case 403:
+        return COAP_RSPCODE_FORBIDDEN;
+    case 404:
+    case 410:
+        return COAP_RSPCODE_NOT_FOUND;
+    case 405:
+        return COAP_RSPCODE_METHOD_NOT_ALLOWED;
+    case 406:
+        return COAP_RSPCODE_NOT_ACCEPTABLE;
+    case 412:
+        return COAP_RSPCODE_PRECONDITION_FAILED;
+    case 413:
+        return COAP_RSPCODE_REQUEST_ENTITY_TO_LARGE;
+    case 415:
+        return COAP_RSPCODE_UNSUPPORTED_CONTENT_FMT;
+    case 501:
+        return COAP_RSPCODE_NOT_IMPLEMENTED;
+    case 502:
+        return COAP_RSPCODE_BAD_GATEWAY;
+    case 503:
+        return COAP_RSPCODE_SERVICE_UNAVAILABLE;
+    case 504:
+        return COAP_RSPCODE_GATEWAY_TIMEOUT;
+    default:
+        break;
+    }
+    if ((status >= 200) && (status < 300)) {
+        return (method == COAP_METHOD_GET) ? COAP_RSPCODE_CONTENT : COAP_RSPCODE_CHANGED;
+    }
+    if ((status >= 400) && (status < 500)) {
+        return COAP_RSPCODE_BAD_REQUEST;
+    }
+    if ((status >= 500) && (status < 600)) {
+        return COAP_RSPCODE_INTERNAL_SERVER_ERROR;
+    }
+    return COAP_RSPCODE_BAD_GATEWAY;
+}
+
+int coap_http_status_of(const uint8_t code)
+{
+    switch (code) {
+    case COAP_RSPCODE_CREATED:
+        return 201;
+    case COAP_RSPCODE_DELETED:
+    case COAP_RSPCODE_CHANGED:
+        return 204;
+    case COAP_RSPCODE_VALID:
+    case COAP_RSPCODE_CONTENT:
+        return 200;
+    case COAP_RSPCODE_UNAUTHORIZED:
+        return 401;
+    case COAP_RSPCODE_FORBIDDEN:
+        return 403;
+    case COAP_RSPCODE_NOT_FOUND:
+        return 404;
+    case COAP_RSPCODE_METHOD_NOT_ALLOWED:
+        return 405;
+    case COAP_RSPCODE_NOT_ACCEPTABLE:
+        return 406;
+    case COAP_RSPCODE_PRECONDITION_FAILED:
+        return 412;
+    case COAP_RSPCODE_REQUEST_ENTITY_TO_LARGE:
+        return 413;
+    case COAP_RSPCODE_UNSUPPORTED_CONTENT_FMT:
+        return 415;
+    case COAP_RSPCODE_NOT_IMPLEMENTED:
+        return 501;
+    case COAP_RSPCODE_BAD_GATEWAY:
+        return 502;
+    case COAP_RSPCODE_SERVICE_UNAVAILABLE:
+        return 503;
+    case COAP_RSPCODE_GATEWAY_TIMEOUT:
+        return 504;
+    default:
+        break;
+    }
+    switch (code >> 5) {
+    case 2:
+        return 200;
+    case 4:
+        return 400;
+    default:
+        return 500;
+    }
+}
+
+coap_state_t coap_http_make_request(const coap_packet_t *inpkt,
+                                    const char *target, const char *host,
+                                    uint8_t *buf, const size_t size,
+                                    size_t *len)
+{
+    static const char *methods[] = { NULL, "GET ", "POST ", "PUT ", "DELETE " };
+    const uint8_t code = inpkt->hdr.code;
+    uint8_t count;
+    size_t n = 0;
+    bool ok;
+
+    if (!code || (code > COAP_METHOD_DELETE)) {
+        return COAP_ERR_UNSUPPORTED;
+    }
+    ok = _put_str(buf, size, &n, methods[code]) && _put_str(buf, size, &n, target);
+    const coap_option_t *path = coap_find_options(inpkt, COAP_OPTION_URI_PATH, &count);
+    for (size_t i = 1; path && (i < count); ++i) {
+        ok = ok && _put_str(buf, size, &n, "/") && _put_pct(buf, size, &n, &path[i].buf, false);
+    }
+    if (!*target && (!path || (count < 2))) {
+        ok = ok && _put_str(buf, size, &n, "/");
+    }
+    const coap_option_t *query = coap_find_options(inpkt, COAP_OPTION_URI_QUERY, &count);
+    for (size_t i = 0; query && (i < count); ++i) {
+        ok = ok && _put_str(buf, size, &n, i ? "&" : "?") &&
+             _put_pct(buf, size, &n, &query[i].buf, true);
+    }
+    ok = ok && _put_str(buf, size, &n, " HTTP/1.1\r\nHost: ") &&
+         _put_str(buf, size, &n, host) && _put_str(buf, size, &n, "\r\n");
+
+    const coap_option_t *accept = coap_find_options(inpkt, COAP_OPTION_ACCEPT, &count);
+    if (accept) {
+        const char *type = coap_http_media_type((uint16_t)coap_decode_uint(&accept->buf));
+        if (!type) {
+            return COAP_ERR_UNSUPPORTED;
+        }
+        ok = ok && _put_str(buf, size, &n, "Accept: ") && _put_str(buf, size, &n, type) &&
+             _put_str(buf, size, &n, "\r\n");
+    }
+    if ((code == COAP_METHOD_POST) || (code == COAP_METHOD_PUT) || inpkt->payload.len) {
+        char length[32];
+        const coap_option_t *cf = coap_find_options(inpkt, COAP_OPTION_CONTENT_FORMAT, &count);
+        if (inpkt->payload.len) {
+            const char *type = cf ? coap_http_media_type((uint16_t)coap_decode_uint(&cf->buf)) :
+                               "application/octet-stream";
+            if (!type) {
+                return COAP_ERR_UNSUPPORTED;
+            }
+            ok = ok && _put_str(buf, size, &n, "Content-Type: ") &&
+                 _put_str(buf, size, &n, type) && _put_str(buf, size, &n, "\r\n");
+        }
+        snprintf(length, sizeof(length), "Content-Length: %zu\r\n", inpkt->payload.len);
+        ok = ok && _put_str(buf, size, &n, length);
+    }
+    ok = ok && _put_str(buf, size, &n, "\r\n") &&
+         _put(buf, size, &n, inpkt->payload.p, inpkt->payload.len);
+    *len = n;
+    return ok ? COAP_SUCCESS : COAP_ERR_BUFFER_TOO_SMALL;
+}
+
+coap_state_t coap_http_parse_response(uint8_t *buf, const size_t len,
+                                      const bool eof,
+                                      coap_http_response_t *rsp)
+{
+    static const uint8_t version[] = "HTTP/1.";
+    size_t pos = _line_end(buf, len, 0);
+    uint32_t length = 0;
+    bool has_length = false, chunked = false;
+
+    memset(rsp, 0, sizeof(*rsp));
+    rsp->content_format = -1;
+    rsp->max_age = -1;
+    if (!pos) {
+        return (eof || (len > 256)) ? COAP_ERR_PAYLOAD_INVALID : COAP_RSP_WAIT;
+    }
+    // HTTP/1.x 200 OK
+    if ((pos < 14) || memcmp(buf, version, 7) || ((buf[7] != '0') && (buf[7] != '1')) ||
+        (buf[8] != ' ') || (buf[9] < '1') || (buf[9] > '5') ||
+        (buf[10] < '0') || (buf[10] > '9') || (buf[11] < '0') || (buf[11] > '9') ||
+        ((buf[12] != ' ') && (buf[12] != '\r'))) {
+        return COAP_ERR_PAYLOAD_INVALID;
+    }
+    rsp->status = (buf[9] - '0') * 100 + (buf[10] - '0') * 10 + (buf[11] - '0');
+    rsp->close = (buf[7] == '0');
+    if (rsp->status < 200) {
+        return COAP_ERR_PAYLOAD_INVALID;    // nothing asks for interim responses
+    }
+    for (;;) {
+        const size_t eol = _line_end(buf, len, pos);
+        if (!eol) {
+            return eof ? COAP_ERR_PAYLOAD_INVALID : COAP_RSP_WAIT;
+        }
+        if (eol == pos + 2) {
+            pos = eol;
+            break;
+        }
+        const uint8_t *colon = memchr(buf + pos, ':', eol - pos);
+        if (!colon || (colon == buf + pos)) {
+            return COAP_ERR_PAYLOAD_INVALID;
+        }
+        const uint8_t *name = buf + pos;
+        const size_t namelen = (size_t)(colon - name);
+        const uint8_t *v = colon + 1;
+        size_t vlen = (size_t)(buf + eol - 2 - v);
+        _trim(&v, &vlen);
+        if (_ieq(name, namelen, "content-length")) {
+            uint32_t value;
+            // repeated only with the same value, RFC 7230 section 3.3.2
+            if (!_parse_dec(v, vlen, &value) || (has_length && (value != length))) {
+                return COAP_ERR_PAYLOAD_INVALID;
+            }
+            length = value;
+            has_length = true;
+        }
+        else if (_ieq(name, namelen, "transfer-encoding")) {
+            chunked = _is_chunked(v, vlen);
+        }
+        else if (_ieq(name, namelen, "content-type")) {
+            const uint8_t *semi = memchr(v, ';', vlen);
+            rsp->content_type.p = v;
+            rsp->content_type.len = semi ? (size_t)(semi - v) : vlen;
+            _trim(&rsp->content_type.p, &rsp->content_type.len);
+            rsp->content_format = coap_http_content_format(v, vlen);
+        }
+        else if (_ieq(name, namelen, "cache-control")) {
+            _cache_control(v, vlen, &rsp->max_age);
+        }
+        else if (_ieq(name, namelen, "connection")) {
+            if (_has_token(v, vlen, "close")) {
+                rsp->close = true;
+            }
+            else if (_has_token(v, vlen, "keep-alive")) {
+                rsp->close = false;
+            }
+        }
+        pos = eol;
+    }
+    rsp->body.p = buf + pos;
+    if ((rsp->status == 204) || (rsp->status == 304)) {
+        rsp->len = pos;
+        return COAP_SUCCESS;
+    }
+    if (chunked) {
+        size_t bodylen, end;
+        const coap_state_t rc = _chunked(buf, len, pos, false, &bodylen, &end);
+        if (rc != COAP_SUCCESS) {
+            return ((rc == COAP_RSP_WAIT) && eof) ? COAP_ERR_PAYLOAD_INVALID : rc;
+        }
+        _chunked(buf, len, pos, true, &bodylen, &end);
+        rsp->body.len = bodylen;
+        rsp->len = end;
+        return COAP_SUCCESS;
+    }
+    if (has_length) {
+        if (len - pos < length) {
+            return eof ? COAP_ERR_PAYLOAD_INVALID : COAP_RSP_WAIT;
+        }
+        rsp->body.len = length;
+        rsp->len = pos + length;
+        return COAP_SUCCESS;
+    }
+    // the body ends with the connection
+    if (!eof) {
+        return COAP_RSP_WAIT;
+    }
+    rsp->body.len = len - pos;
+    rsp->len = len;
+    rsp->close = true;
+    return COAP_SUCCESS;
+}
+
+coap_state_t coap_http_proxy_init(coap_http_proxy_t *proxy,
+                                  const coap_http_route_t *routes,
+                                  const size_t nroutes,
+                                  const struct sockaddr *upstream,
+                                  const socklen_t upstream_len,
+                                  const char *host)
+{
+    memset(proxy, 0, sizeof(*proxy));
+    if ((nroutes > COAP_HTTP_MAX_ROUTES) || (upstream_len > sizeof(proxy->upstream))) {
+        return COAP_ERR_BUFFER_TOO_SMALL;
+    }
+    proxy->routes = routes;
+    proxy->nroutes = nroutes;
+    memcpy(&proxy->upstream, upstream, upstream_len);
+    proxy->upstream_len = upstream_len;
+    proxy->host = host;
+    for (size_t i = 0; i < COAP_HTTP_POOL_SIZE; ++i) {
+        proxy->conns[i].fd = -1;
+        _conn_close(&proxy->conns[i]);
+    }
+    for (int i = 0; i < COAP_HTTP_MAX_WAITERS; ++i) {
+        proxy->waiters[i].next = i + 1 < COAP_HTTP_MAX_WAITERS ? i + 1 : -1;
+    }
+    for (size_t i = 0; i < COAP_HTTP_MAX_EXCHANGES; ++i) {
+        proxy->exchanges[i].waiters = -1;
+    }
+    return COAP_SUCCESS;
+}
+
+void coap_http_proxy_close(coap_http_proxy_t *proxy)
+{
+    for (size_t i = 0; i < COAP_HTTP_POOL_SIZE; ++i) {
+        _conn_close(&proxy->conns[i]);
+    }
+}
+
+coap_state_t coap_http_proxy_request(coap_http_proxy_t *proxy,
+                                     const coap_packet_t *inpkt,
+                                     const struct sockaddr *addr,
+                                     const socklen_t addrlen,
+                                     const uint32_t now,
+                                     coap_packet_t *pkt)
+{
+    const coap_http_route_t *route = _route(proxy, inpkt);
+    const coap_msgtype_t type = (inpkt->hdr.t == COAP_TYPE_CON) ?
+                                COAP_TYPE_ACK : COAP_TYPE_NONCON;
+    coap_responsecode_t rspcode = COAP_RSPCODE_SERVICE_UNAVAILABLE;
+    coap_http_exchange_t *ex = NULL;
+    uint8_t count;
+
+    if (!route) {
+        return COAP_ERR_REQUEST_NOT_FOUND;
+    }
+    proxy->now = now;
+    if (!inpkt->hdr.code || (inpkt->hdr.code > COAP_METHOD_DELETE)) {
+        return coap_make_response(inpkt->hdr.id, &inpkt->tok, type,
+                                  COAP_RSPCODE_METHOD_NOT_ALLOWED, NULL, NULL, 0, pkt);
+    }
+    const uint64_t key = (inpkt->hdr.code == COAP_METHOD_GET) ? _coalesce_key(inpkt) : 0;
+    for (size_t i = 0; key && (proxy->free_waiters >= 0) && (i < COAP_HTTP_MAX_EXCHANGES); ++i) {
+        if ((proxy->exchanges[i].state != EX_FREE) && (proxy->exchanges[i].key == key)) {
+            ex = &proxy->exchanges[i];
+            proxy->coalesced++;
+            break;
+        }
+    }
+    for (size_t i = 0; !ex && (proxy->free_waiters >= 0) && (i < COAP_HTTP_MAX_EXCHANGES); ++i) {
+        if (proxy->exchanges[i].state != EX_FREE) {
+            continue;
+        }
+        coap_http_exchange_t *e = &proxy->exchanges[i];
+        const coap_state_t rc = coap_http_make_request(inpkt, route->target, proxy->host,
+                                                       e->req, sizeof(e->req), &e->len);
+        if (rc == COAP_ERR_UNSUPPORTED) {
+            const coap_option_t *accept = coap_find_options(inpkt, COAP_OPTION_ACCEPT, &count);
+            rspcode = (accept && !coap_http_media_type((uint16_t)coap_decode_uint(&accept->buf))) ?
+                      COAP_RSPCODE_NOT_ACCEPTABLE : COAP_RSPCODE_UNSUPPORTED_CONTENT_FMT;
+            break;
+        }
+        if (rc != COAP_SUCCESS) {
+            rspcode = COAP_RSPCODE_REQUEST_ENTITY_TO_LARGE;
+            break;
+        }
+        e->state = EX_QUEUED;
+        e->seq = proxy->seq++;
+        e->key = key;
+        e->method = (coap_method_t)inpkt->hdr.code;
+        e->started = now;
+        e->retried = false;
+        e->waiters = -1;
+        e->sent = 0;
+        ex = e;
+    }
+    if (!ex) {
+        return coap_make_response(inpkt->hdr.id, &inpkt->tok, type, rspcode,
+                                  NULL, NULL, 0, pkt);
+    }
+    const int w = proxy->free_waiters;
+    coap_http_waiter_t *waiter = &proxy->waiters[w];
+    const coap_option_t *block = coap_find_options(inpkt, COAP_OPTION_BLOCK2, &count);
+    proxy->free_waiters = waiter->next;
+    memcpy(&waiter->addr, addr, addrlen);
+    waiter->addrlen = addrlen;
+    waiter->tkl = (inpkt->tok.len <= sizeof(waiter->tok)) ? (uint8_t)inpkt->tok.len : 0;
+    memcpy(waiter->tok, inpkt->tok.p, waiter->tkl);
+    waiter->blocklen = (block && (block->buf.len <= sizeof(waiter->block))) ?
+                       (uint8_t)block->buf.len : 0;
+    if (waiter->blocklen) {
+        memcpy(waiter->block, block->buf.p, waiter->blocklen);
+    }
+    waiter->next = ex->waiters;
+    ex->waiters = w;
+    _dispatch(proxy);
+    if (inpkt->hdr.t == COAP_TYPE_CON) {
+        return coap_make_response(inpkt->hdr.id, NULL, COAP_TYPE_ACK, COAP_RSPCODE_EMPTY,
+                                  NULL, NULL, 0, pkt);
+    }
+    return COAP_RSP_WAIT;
+}
+
+size_t coap_http_proxy_pollfds(const coap_http_proxy_t *proxy,
+                               struct pollfd *fds, const size_t size)
+{
+    size_t n = 0;
+    for (size_t i = 0; (i < COAP_HTTP_POOL_SIZE) && (n < size); ++i) {
+        const coap_http_conn_t *c = &proxy->conns[i];
+        if (c->state == CONN_CLOSED) {
+            continue;
+        }
+        fds[n].fd = c->fd;
+        fds[n].events = POLLIN;
+        if ((c->state == CONN_CONNECTING) ||
+            ((c->state == CONN_BUSY) &&
+             (proxy->exchanges[c->exchange].sent < proxy->exchanges[c->exchange].len))) {
+            fds[n].events |= POLLOUT;
+        }
+        fds[n++].revents = 0;
+    }
+    return n;
+}
+
+size_t coap_http_proxy_process(coap_http_proxy_t *proxy, const uint32_t now,
+                               coap_http_send_t send_cb, void *ctx)
+{
+    size_t n = 0;
+    proxy->now = now;
+    for (size_t i = 0; i < COAP_HTTP_POOL_SIZE; ++i) {
+        n += _pump(proxy, &proxy->conns[i], send_cb, ctx);
+    }
+    // give up on exchanges the upstream did not answer in time
+    for (size_t i = 0; i < COAP_HTTP_MAX_EXCHANGES; ++i) {
+        coap_http_exchange_t *ex = &proxy->exchanges[i];
+        if ((ex->state == EX_FREE) || ((now - ex->started) < COAP_HTTP_TIMEOUT_MS)) {
+            continue;
+        }
+        for (size_t j = 0; j < COAP_HTTP_POOL_SIZE; ++j) {
+            if ((proxy->conns[j].state != CONN_CLOSED) && (proxy->conns[j].exchange == (int)i)) {
+                _conn_close(&proxy->conns[j]);
+            }
+        }
+        n += _answer(proxy, ex, COAP_RSPCODE_GATEWAY_TIMEOUT, NULL, send_cb, ctx);
+    }
+    _dispatch(proxy);
+    return n;
+}
@@ -0,0 +1,297 @@
+#ifndef COAP_HTTP_H
+#define COAP_HTTP_H 1
+
+/**
+ * @file coap_http.h
+ *
+ * CoAP-to-HTTP/1.1 cross-proxy (RFC 7252 section 10.2, with the media type
+ * and status code mapping of RFC 8075). Requests to configured paths are
+ * translated into HTTP requests to one upstream server, e.g. a local
+ * backend; the response comes back with its status mapped to a CoAP
+ * response code, Content-Type to Content-Format and Cache-Control max-age to
+ * Max-Age.
+ *
+ * HTTP requests go over a small pool of keep-alive connections instead of a
+ * connection each. A GET identical to one already waiting for the upstream,
+ * same path, query and Accept, joins it, so a burst of requests for one
+ * resource costs one HTTP exchange. The proxy never blocks: a confirmable
+ * request is acknowledged at once and answered with a separate
+ * non-confirmable response, call coap_http_proxy_process from the event
+ * loop, e.g. whenever poll on the descriptors of coap_http_proxy_pollfds
+ * returns.
+ *
+ * The mapping functions are usable on their own, they do not need sockets.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <poll.h>
+#include <sys/socket.h>
+
+#include "coap.h"
+
+#ifndef COAP_HTTP_POOL_SIZE
+#define COAP_HTTP_POOL_SIZE     4       //!< keep-alive connections to the upstream
+#endif
+#ifndef COAP_HTTP_MAX_EXCHANGES
+#define COAP_HTTP_MAX_EXCHANGES 32      //!< HTTP requests waiting or in flight
+#endif
+#ifndef COAP_HTTP_MAX_WAITERS
+#define COAP_HTTP_MAX_WAITERS   128     //!< CoAP requests waiting for them
+#endif
+#define COAP_HTTP_TX_SIZE       1536    //!< longest HTTP request, headers and body
+#define COAP_HTTP_RX_SIZE       4096    //!< longest HTTP response
+#define COAP_HTTP_TIMEOUT_MS    5000    //!< upstream answers within, else 5.04
+#define COAP_HTTP_MAX_ROUTES    4       //!< proxied path prefixes
+
+/**
+ * Response of the upstream, views into the receive buffer
+ */
+typedef struct coap_http_response
+{
+    int status;             //!< status code, e.g. 200
+    coap_buffer_t content_type; //!< media type without parameters, empty if none
+    int content_format;     //!< CoAP content format of it, or -1
+    int32_t max_age;        //!< seconds from Cache-Control, -1 if none
+    bool close;             //!< connection closes after the response
+    coap_buffer_t body;     //!< body, chunked transfer coding removed
+    size_t len;             //!< bytes of the response in the buffer
+} coap_http_response_t;
+
+/**
+ * Proxied path prefix
+ */
+typedef struct coap_http_route
+{
+    const char *path;       //!< first Uri-Path segment, e.g. "api"
+    const char *target;     //!< HTTP path it stands for, e.g. "/v1", "" for the root
+} coap_http_route_t;
+
+/**
+ * Connection to the upstream, private
+ */
+typedef struct coap_http_conn
+{
+    int fd;                 //!< socket, -1 if closed
+    int state;              //!< closed, connecting, idle or busy
+    int exchange;           //!< exchange in flight, -1 if none
+    uint32_t requests;      //!< requests answered on this connection
+    size_t rxlen;           //!< bytes in rx
+    uint8_t rx[COAP_HTTP_RX_SIZE];
+} coap_http_conn_t;
+
+/**
+ * HTTP request and the CoAP requests waiting for it, private
+ */
+typedef struct coap_http_exchange
+{
+    int state;              //!< free, queued or in flight
+    uint32_t seq;           //!< queue order
+    uint64_t key;           //!< coalescing key of a GET, 0 if none
+    coap_method_t method;
+    uint32_t started;       //!< time it was queued, ms
+    bool retried;           //!< sent again after a reused connection closed
+    int waiters;            //!< first waiter, -1 if none
+    size_t len;             //!< length of req
+    size_t sent;            //!< bytes of req sent
+    uint8_t req[COAP_HTTP_TX_SIZE];
+} coap_http_exchange_t;
+
+/**
+ * CoAP request waiting for an exchange, private
+ */
+typedef struct coap_http_waiter
+{
+    int next;               //!< next waiter of the exchange, or free list, -1 at the end
+    struct sockaddr_storage addr; //!< requester
+    socklen_t addrlen;
+    uint8_t tok[8];
+    uint8_t tkl;
+    uint8_t block[3];       //!< Block2 option of the request
+    uint8_t blocklen;       //!< its length, 0 if none
+} coap_http_waiter_t;
+
+/**
+ * Proxy
+ */
+typedef struct coap_http_proxy
+{
+    const coap_http_route_t *routes;
+    size_t nroutes;
+    struct sockaddr_storage upstream;       //!< HTTP server
+    socklen_t upstream_len;
+    const char *host;                       //!< Host header
+    uint16_t msgid;                         //!< of separate responses
+    uint32_t seq;                           //!< queue order of the next exchange
+    uint32_t now;                           //!< ms, of the last call
+    int free_waiters;                       //!< free list
+    uint32_t connects;                      //!< connections opened
+    uint32_t upstream_requests;             //!< HTTP requests sent
+    uint32_t coalesced;                     //!< requests that joined another
+    coap_http_conn_t conns[COAP_HTTP_POOL_SIZE];
+    coap_http_exchange_t exchanges[COAP_HTTP_MAX_EXCHANGES];
+    coap_http_waiter_t waiters[COAP_HTTP_MAX_WAITERS];
+} coap_http_proxy_t;
+
+/**
+ * @brief Called with each response of the proxy, to be built and sent to
+ * \p addr
+ */
+typedef void (*coap_http_send_t)(void *ctx, const struct sockaddr *addr,
+                                 const socklen_t addrlen,
+                                 const coap_packet_t *pkt);
+
+/**
+ * @brief HTTP media type of a CoAP content format, e.g. "application/json"
+ *
+ * @return Media type, or NULL for content formats without one
+ */
+const char *coap_http_media_type(const uint16_t content_format);
+
+/**
+ * @brief CoAP content format of an HTTP media type, parameters ignored but
+ * for text/plain, which has to be UTF-8 or US-ASCII
+ *
+ * @return Content format, or -1 if there is none
+ */
+int coap_http_content_format(const uint8_t *type, const size_t len);
+
+/**
+ * @brief CoAP response code of an HTTP status
+ *
+ * 2xx depend on the method, e.g. 200 answers GET with 2.05 Content and
+ * DELETE with 2.02 Deleted. Redirects are not followed and become 5.02 Bad
+ * Gateway, codes without CoAP equivalent the generic 4.00 or 5.00.
+ */
+coap_responsecode_t coap_http_status(const int status, const coap_method_t method);
+
+/**
+ * @brief HTTP status of a CoAP response code, the other way round
+ *
+ * 2.05 Content and 2.03 Valid become 200, codes without HTTP equivalent the
+ * generic 400 or 500, e.g. 4.02 Bad Option.
+ */
+int coap_http_status_of(const uint8_t code);
+
+/**
+ * @brief Translate a CoAP request into an HTTP/1.1 request
+ *
+ * The path is \p target followed by the Uri-Path options behind the first,
+ * percent-encoded, and the Uri-Query options. Accept and Content-Format
+ * become Accept and Content-Type headers.
+ *
+ * @param[in] inpkt Request
+ * @param[in] target HTTP path of the first Uri-Path segment, e.g. "/v1"
+ * @param[in] host Host header
+ * @param[out] buf HTTP request
+ * @param[in] size Size of \p buf
+ * @param[out] len Length of the request
+ *
+ * @return 0 on success, COAP_ERR_BUFFER_TOO_SMALL, or COAP_ERR_UNSUPPORTED
+ * for methods or content formats HTTP has no equivalent of
+ */
+coap_state_t coap_http_make_request(const coap_packet_t *inpkt,
+                                    const char *target, const char *host,
+                                    uint8_t *buf, const size_t size,
+                                    size_t *len);
+
+/**
+ * @brief Parse an HTTP/1.1 response
+ *
+ * Call it again as more of the response arrives. Chunked bodies are decoded
+ * in place once complete, \p buf is modified then.
+ *
+ * @param[in,out] buf Response received so far
+ * @param[in] len Bytes in \p buf
+ * @param[in] eof The connection closed, which ends a body without length
+ * @param[out] rsp Response
+ *
+ * @return 0 if the response is complete, COAP_RSP_WAIT if more is needed,
+ * or COAP_ERR_PAYLOAD_INVALID if it is malformed
+ */
+coap_state_t coap_http_parse_response(uint8_t *buf, const size_t len,
+                                      const bool eof,
+                                      coap_http_response_t *rsp);
+
+/**
+ * @brief Set up a proxy
+ *
+ * @param[out] proxy Proxy
+ * @param[in] routes Proxied path prefixes, kept by reference
+ * @param[in] nroutes Number of \p routes, at most COAP_HTTP_MAX_ROUTES
+ * @param[in] upstream Address of the HTTP server
+ * @param[in] upstream_len Length of \p upstream
+ * @param[in] host Host header, e.g. "localhost:8080"
+ *
+ * @return 0 on success, or COAP_ERR_BUFFER_TOO_SMALL
+ */
+coap_state_t coap_http_proxy_init(coap_http_proxy_t *proxy,
+                                  const coap_http_route_t *routes,
+                                  const size_t nroutes,
+                                  const struct sockaddr *upstream,
+                                  const socklen_t upstream_len,
+                                  const char *host);
+
+/**
+ * @brief Close all connections, pending requests are dropped
+ */
+void coap_http_proxy_close(coap_http_proxy_t *proxy);
+
+/**
+ * @brief Handle a CoAP request
+ *
+ * @param[in,out] proxy Proxy
+ * @param[in] inpkt Request
+ * @param[in] addr Requester, its response is passed to the send callback
+ * @param[in] addrlen Length of \p addr
+ * @param[in] now Current time in ms, any monotonic clock
+ * @param[out] pkt Immediate response
+ *
+ * @return COAP_ERR_REQUEST_NOT_FOUND for paths without route, left to
+ * coap_handle_request; COAP_ACK_SEND with an empty ACK in \p pkt for a
+ * confirmable request, COAP_RSP_WAIT for a non-confirmable one, both answered
+ * later; or COAP_RSP_SEND with an error response in \p pkt, e.g. 5.03 if
+ * the proxy is at capacity
+ */
+coap_state_t coap_http_proxy_request(coap_http_proxy_t *proxy,
+                                     const coap_packet_t *inpkt,
+                                     const struct sockaddr *addr,
+                                     const socklen_t addrlen,
+                                     const uint32_t now,
+                                     coap_packet_t *pkt);
+
+/**
+ * @brief Descriptors to poll for
+ *
+ * @param[in] proxy Proxy
+ * @param[out] fds Poll entries, COAP_HTTP_POOL_SIZE always fit
+ * @param[in] size Entries in \p fds
+ *
+ * @return Entries used
+ */
+size_t coap_http_proxy_pollfds(const coap_http_proxy_t *proxy,
+                               struct pollfd *fds, const size_t size);
+
+/**
+ * @brief Make progress: connect, send, receive and answer
+ *
+ * Never blocks. Answers waiting requests through \p send, with 5.04 Gateway
+ * Timeout if the upstream has not answered within COAP_HTTP_TIMEOUT_MS.
+ *
+ * @param[in,out] proxy Proxy
+ * @param[in] now Current time in ms
+ * @param[in] send Callback sending a response
+ * @param[in] ctx Passed to \p send
+ *
+ * @return Number of responses passed to \p send
+ */
+size_t coap_http_proxy_process(coap_http_proxy_t *proxy, const uint32_t now,
+                               coap_http_send_t send, void *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
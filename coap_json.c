@@ -0,0 +1,1178 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "coap.h"
+#include "coap_json.h"
+
+/* reader states, what the next token may be */
+#define JSON_VALUE          0   //!< a value, at the top level, after ':' or ','
+#define JSON_VALUE_OR_END   1   //!< after '['
+#define JSON_KEY_OR_END     2   //!< after '{'
+#define JSON_KEY            3   //!< after ',' in an object
+#define JSON_NEXT           4   //!< after a value, ',' or the end
+#define JSON_DONE           5   //!< top level value complete
+
+#define JSON_NUMBER_MAX     64  //!< longest number converted with strtod
+
+#define JSON_HIDDEN_BIT     ((uint64_t)1 << 52)
+#define JSON_MANTISSA_MASK  (JSON_HIDDEN_BIT - 1)
+
+/**
+ * Unnormalised binary floating point number f * 2^e for Grisu2
+ */
+typedef struct json_fp
+{
+    uint64_t f;
+    int e;
+} json_fp_t;
+
+/*
+ * Normalised 10^k for k = -348, -340, ..., 340, rounded to 64 bits, see
+ * Loitsch, Printing Floating-Point Numbers Quickly and Accurately with
+ * Integers, PLDI 2010
+ */
+static const json_fp_t json_cached_pow10[] = {
+    {0xFA8FD5A0081C0288ULL, -1220},
+    {0xBAAEE17FA23EBF76ULL, -1193},
+    {0x8B16FB203055AC76ULL, -1166},
+    {0xCF42894A5DCE35EAULL, -1140},
+    {0x9A6BB0AA55653B2DULL, -1113},
+    {0xE61ACF033D1A45DFULL, -1087},
+    {0xAB70FE17C79AC6CAULL, -1060},
+    {0xFF77B1FCBEBCDC4FULL, -1034},
+    {0xBE5691EF416BD60CULL, -1007},
+    {0x8DD01FAD907FFC3CULL, -980},
+    {0xD3515C2831559A83ULL, -954},
+    {0x9D71AC8FADA6C9B5ULL, -927},
+    {0xEA9C227723EE8BCBULL, -901},
+    {0xAECC49914078536DULL, -874},
+    {0x823C12795DB6CE57ULL, -847},
+    {0xC21094364DFB5637ULL, -821},
+    {0x9096EA6F3848984FULL, -794},
+    {0xD77485CB25823AC7ULL, -768},
+    {0xA086CFCD97BF97F4ULL, -741},
+    {0xEF340A98172AACE5ULL, -715},
+    {0xB23867FB2A35B28EULL, -688},
+    {0x84C8D4DFD2C63F3BULL, -661},
+    {0xC5DD44271AD3CDBAULL, -635},
+    {0x936B9FCEBB25C996ULL, -608},
+    {0xDBAC6C247D62A584ULL, -582},
+    {0xA3AB66580D5FDAF6ULL, -555},
+    {0xF3E2F893DEC3F126ULL, -529},
+    {0xB5B5ADA8AAFF80B8ULL, -502},
+    {0x87625F056C7C4A8BULL, -475},
+    {0xC9BCFF6034C13053ULL, -449},
+    {0x964E858C91BA2655ULL, -422},
+    {0xDFF9772470297EBDULL, -396},
+    {0xA6DFBD9FB8E5B88FULL, -369},
+    {0xF8A95FCF88747D94ULL, -343},
+    {0xB94470938FA89BCFULL, -316},
+    {0x8A08F0F8BF0F156BULL, -289},
+    {0xCDB02555653131B6ULL, -263},
+    {0x993FE2C6D07B7FACULL, -236},
+    {0xE45C10C42A2B3B06ULL, -210},
+    {0xAA242499697392D3ULL, -183},
+    {0xFD87B5F28300CA0EULL, -157},
+    {0xBCE5086492111AEBULL, -130},
+    {0x8CBCCC096F5088CCULL, -103},
+    {0xD1B71758E219652CULL, -77},
+    {0x9C40000000000000ULL, -50},
+    {0xE8D4A51000000000ULL, -24},
+    {0xAD78EBC5AC620000ULL, 3},
+    {0x813F3978F8940984ULL, 30},
+    {0xC097CE7BC90715B3ULL, 56},
+    {0x8F7E32CE7BEA5C70ULL, 83},
+    {0xD5D238A4ABE98068ULL, 109},
+    {0x9F4F2726179A2245ULL, 136},
+    {0xED63A231D4C4FB27ULL, 162},
+    {0xB0DE65388CC8ADA8ULL, 189},
+    {0x83C7088E1AAB65DBULL, 216},
+    {0xC45D1DF942711D9AULL, 242},
+    {0x924D692CA61BE758ULL, 269},
+    {0xDA01EE641A708DEAULL, 295},
+    {0xA26DA3999AEF774AULL, 322},
+    {0xF209787BB47D6B85ULL, 348},
+    {0xB454E4A179DD1877ULL, 375},
+    {0x865B86925B9BC5C2ULL, 402},
+    {0xC83553C5C8965D3DULL, 428},
+    {0x952AB45CFA97A0B3ULL, 455},
+    {0xDE469FBD99A05FE3ULL, 481},
+    {0xA59BC234DB398C25ULL, 508},
+    {0xF6C69A72A3989F5CULL, 534},
+    {0xB7DCBF5354E9BECEULL, 561},
+    {0x88FCF317F22241E2ULL, 588},
+    {0xCC20CE9BD35C78A5ULL, 614},
+    {0x98165AF37B2153DFULL, 641},
+    {0xE2A0B5DC971F303AULL, 667},
+    {0xA8D9D1535CE3B396ULL, 694},
+    {0xFB9B7CD9A4A7443CULL, 720},
+    {0xBB764C4CA7A44410ULL, 747},
+    {0x8BAB8EEFB6409C1AULL, 774},
+    {0xD01FEF10A657842CULL, 800},
+    {0x9B10A4E5E9913129ULL, 827},
+    {0xE7109BFBA19C0C9DULL, 853},
+    {0xAC2820D9623BF429ULL, 880},
+    {0x80444B5E7AA7CF85ULL, 907},
+    {0xBF21E44003ACDD2DULL, 933},
+    {0x8E679C2F5E44FF8FULL, 960},
+    {0xD433179D9C8CB841ULL, 986},
+    {0x9E19DB92B4E31BA9ULL, 1013},
+    {0xEB96BF6EBADF77D9ULL, 1039},
+    {0xAF87023B9BF0EE6BULL, 1066},
+};
+
+static const uint64_t json_pow10[] = {
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL,
+    100000000ULL, 1000000000ULL, 10000000000ULL, 100000000000ULL,
+    1000000000000ULL, 10000000000000ULL, 100000000000000ULL,
+    1000000000000000ULL, 10000000000000000ULL, 100000000000000000ULL,
+    1000000000000000000ULL, 10000000000000000000ULL
+};
+
+/* exactly representable powers of ten, for the fast path of coap_json_number */
+static const double json_exact_pow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static const char json_digits[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+/* short escape of each byte in strings, 'u' for \u00XX, 0 for none */
+static const uint8_t json_escape[256] = {
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+    ['"'] = '"', ['\\'] = '\\',
+};
+
+/* --- PRIVATE -------------------------------------------------------------- */
+static json_fp_t _fp_normalize(json_fp_t v)
+{
+    while (!(v.f & ((uint64_t)1 << 63))) {
+        v.f <<= 1;
+        v.e--;
+    }
+    return v;
+}
+
+/* upper 64 bits of the 128 bit product, rounded */
+static json_fp_t _fp_mul(const json_fp_t a, const json_fp_t b)
+{
+    const uint64_t mask = 0xFFFFFFFF;
+    const uint64_t a1 = a.f >> 32, a0 = a.f & mask;
+    const uint64_t b1 = b.f >> 32, b0 = b.f & mask;
+    const uint64_t p11 = a1 * b1, p01 = a0 * b1, p10 = a1 * b0, p00 = a0 * b0;
+    uint64_t mid = (p00 >> 32) + (p10 & mask) + (p01 & mask) + ((uint64_t)1 << 31);
+    json_fp_t r = { p11 + (p10 >> 32) + (p01 >> 32) + (mid >> 32), a.e + b.e + 64 };
+    return r;
+}
+
+/* boundaries m- and m+ of the rounding interval of v, with the exponent of m+ */
+static void _fp_boundaries(const json_fp_t v, json_fp_t *minus, json_fp_t *plus)
+{
+    json_fp_t pl = { (v.f << 1) + 1, v.e - 1 };
+    while (!(pl.f & (JSON_HIDDEN_BIT << 1))) {
+        pl.f <<= 1;
+        pl.e--;
+    }
+    pl.f <<= 10;
+    pl.e -= 10;
+    // the interval is asymmetric at powers of two
+    json_fp_t mi = { (v.f << 1) - 1, v.e - 1 };
+    if (v.f == JSON_HIDDEN_BIT) {
+        mi.f = (v.f << 2) - 1;
+        mi.e = v.e - 2;
+    }
+    mi.f <<= mi.e - pl.e;
+    mi.e = pl.e;
+    *minus = mi;
+    *plus = pl;
+}
+
+/* cached power c = 10^-k such that the product with 2^e has an exponent in
+ * [-60, -32] */
+static json_fp_t _cached_pow10(const int e, int *k)
+{
+    const double dk = (-61 - e) * 0.30102999566398114 + 347;
+    int ik = (int)dk;
+    if (dk - ik > 0.0) {
+        ik++;
+    }
+    const unsigned index = (unsigned)((ik >> 3) + 1);
+    *k = -(-348 + (int)(index << 3));
+    return json_cached_pow10[index];
+}
+
+static int _count_digits(const uint32_t n)
+{
+    int d = 1;
+    while ((d < 10) && (n >= json_pow10[d])) {
+        d++;
+    }
+    return d;
+}
+
+/* moves the last digit towards w while the result stays in the interval */
+static void _round_weed(char *buf, const int len, const uint64_t delta,
+                        uint64_t rest, const uint64_t ten_kappa, const uint64_t wp_w)
+{
+    while ((rest < wp_w) && (delta - rest >= ten_kappa) &&
+           ((rest + ten_kappa < wp_w) || (wp_w - rest > rest + ten_kappa - wp_w))) {
+        buf[len - 1]--;
+        rest += ten_kappa;
+    }
+}
+
+/* shortest digits of w within (m-, m+), value is digits * 10^k */
+static int _digit_gen(const json_fp_t w, const json_fp_t mp, uint64_t delta,
+                      char *buf, int *k)
+{
+    const int shift = -mp.e;
+    const uint64_t one = (uint64_t)1 << shift;
+    const uint64_t wp_w = mp.f - w.f;
+    uint32_t p1 = (uint32_t)(mp.f >> shift);
+    uint64_t p2 = mp.f & (one - 1);
+    int kappa = _count_digits(p1);
+    int len = 0;
+
+    while (kappa > 0) {
+        const uint32_t div = (uint32_t)json_pow10[kappa - 1];
+        const uint32_t d = p1 / div;
+        p1 %= div;
+        if (d || len) {
+            buf[len++] = (char)('0' + d);
+        }
+        kappa--;
+        const uint64_t rest = ((uint64_t)p1 << shift) + p2;
+        if (rest <= delta) {
+            *k += kappa;
+            _round_weed(buf, len, delta, rest, json_pow10[kappa] << shift, wp_w);
+            return len;
+        }
+    }
+    for (;;) {
+        p2 *= 10;
+        delta *= 10;
+        const char d = (char)(p2 >> shift);
+        if (d || len) {
+            buf[len++] = (char)('0' + d);
+        }
+        p2 &= one - 1;
+        kappa--;
+        if (p2 < delta) {
+            *k += kappa;
+            const int index = -kappa;
+            _round_weed(buf, len, delta, p2, one,
+                        wp_w * ((index < 20) ? json_pow10[index] : 0));
+            return len;
+        }
+    }
+}
+
+/* Grisu2, digits of a positive finite value and its decimal exponent */
+static int _grisu2(const double value, char *buf, int *k)
+{
+    uint64_t bits;
+    json_fp_t v, minus, plus;
+
+    memcpy(&bits, &value, sizeof(bits));
+    const int biased = (int)((bits >> 52) & 0x7FF);
+    v.f = bits & JSON_MANTISSA_MASK;
+    if (biased) {
+        v.f += JSON_HIDDEN_BIT;
+        v.e = biased - 1075;
+    }
+    else {
+        v.e = -1074;
+    }
+    _fp_boundaries(v, &minus, &plus);
+    const json_fp_t c = _cached_pow10(plus.e, k);
+    const json_fp_t w = _fp_mul(_fp_normalize(v), c);
+    json_fp_t wp = _fp_mul(plus, c);
+    json_fp_t wm = _fp_mul(minus, c);
+    // stay inside the interval despite the rounding of the products
+    wm.f++;
+    wp.f--;
+    return _digit_gen(w, wp, wp.f - wm.f, buf, k);
+}
+
+static int _write_exponent(int e, char *buf)
+{
+    int n = 0;
+    if (e < 0) {
+        buf[n++] = '-';
+        e = -e;
+    }
+    if (e >= 100) {
+        buf[n++] = (char)('0' + e / 100);
+        e %= 100;
+        memcpy(buf + n, json_digits + 2 * e, 2);
+        return n + 2;
+    }
+    if (e >= 10) {
+        memcpy(buf + n, json_digits + 2 * e, 2);
+        return n + 2;
+    }
+    buf[n++] = (char)('0' + e);
+    return n;
+}
+
+/* places the decimal point in digits * 10^k */
+static size_t _prettify(char *buf, const int len, const int k)
+{
+    const int kk = len + k;     // 10^(kk - 1) <= value < 10^kk
+
+    if ((k >= 0) && (kk <= 21)) {
+        // 1234e7 -> 12340000000
+        memset(buf + len, '0', (size_t)k);
+        return (size_t)kk;
+    }
+    if ((kk > 0) && (kk <= 21)) {
+        // 1234e-2 -> 12.34
+        memmove(buf + kk + 1, buf + kk, (size_t)(len - kk));
+        buf[kk] = '.';
+        return (size_t)len + 1;
+    }
+    if ((kk > -6) && (kk <= 0)) {
+        // 1234e-6 -> 0.001234
+        const int offset = 2 - kk;
+        memmove(buf + offset, buf, (size_t)len);
+        buf[0] = '0';
+        buf[1] = '.';
+        memset(buf + 2, '0', (size_t)(offset - 2));
+        return (size_t)(len + offset);
+    }
+    if (len == 1) {
+        // 1e30
+        buf[1] = 'e';
+        return 2 + _write_exponent(kk - 1, buf + 2);
+    }
+    // 1234e30 -> 1.234e33
+    memmove(buf + 2, buf + 1, (size_t)(len - 1));
+    buf[1] = '.';
+    buf[len + 1] = 'e';
+    return (size_t)len + 2 + _write_exponent(kk - 1, buf + len + 2);
+}
+
+/* decimal digits of \p value at the end of \p buf, returns the first one */
+static char *_format_uint(uint64_t value, char *end)
+{
+    char *p = end;
+    while (value >= 100) {
+        const unsigned i = (unsigned)(value % 100) * 2;
+        value /= 100;
+        p -= 2;
+        memcpy(p, json_digits + i, 2);
+    }
+    if (value >= 10) {
+        p -= 2;
+        memcpy(p, json_digits + value * 2, 2);
+    }
+    else {
+        *--p = (char)('0' + value);
+    }
+    return p;
+}
+
+static uint8_t *_reserve(coap_json_writer_t *w, const size_t n)
+{
+    if (w->err != COAP_SUCCESS) {
+        return NULL;
+    }
+    if (w->len - w->pos < n) {
+        w->err = COAP_ERR_BUFFER_TOO_SMALL;
+        return NULL;
+    }
+    uint8_t *p = w->p + w->pos;
+    w->pos += n;
+    return p;
+}
+
+static coap_state_t _put_bytes(coap_json_writer_t *w, const void *data,
+                               const size_t len)
+{
+    uint8_t *p = _reserve(w, len);
+    if (!p) {
+        return w->err;
+    }
+    memcpy(p, data, len);
+    return COAP_SUCCESS;
+}
+
+/* comma in front of all but the first member or element, none after a key */
+static coap_state_t _separate(coap_json_writer_t *w)
+{
+    const uint32_t bit = (uint32_t)1 << w->depth;
+    if (w->err != COAP_SUCCESS) {
+        return w->err;
+    }
+    if (w->key) {
+        w->key = false;
+        return COAP_SUCCESS;
+    }
+    if (w->members & bit) {
+        return _put_bytes(w, ",", 1);
+    }
+    w->members |= bit;
+    return COAP_SUCCESS;
+}
+
+static coap_state_t _put_value(coap_json_writer_t *w, const void *data,
+                               const size_t len)
+{
+    if (_separate(w) != COAP_SUCCESS) {
+        return w->err;
+    }
+    return _put_bytes(w, data, len);
+}
+
+static coap_state_t _put_quoted(coap_json_writer_t *w, const uint8_t *s,
+                                const size_t len)
+{
+    static const char hex[] = "0123456789abcdef";
+    size_t start = 0;
+
+    _put_bytes(w, "\"", 1);
+    for (size_t i = 0; i < len; ++i) {
+        const uint8_t esc = json_escape[s[i]];
+        if (!esc) {
+            continue;
+        }
+        _put_bytes(w, s + start, i - start);
+        if (esc == 'u') {
+            const char u[6] = { '\\', 'u', '0', '0', hex[s[i] >> 4], hex[s[i] & 0xF] };
+            _put_bytes(w, u, sizeof(u));
+        }
+        else {
+            const char e[2] = { '\\', (char)esc };
+            _put_bytes(w, e, sizeof(e));
+        }
+        start = i + 1;
+    }
+    _put_bytes(w, s + start, len - start);
+    return _put_bytes(w, "\"", 1);
+}
+
+static coap_state_t _begin(coap_json_writer_t *w, const char c)
+{
+    if (_separate(w) != COAP_SUCCESS) {
+        return w->err;
+    }
+    if (w->depth >= COAP_JSON_MAX_DEPTH) {
+        w->err = COAP_ERR_UNSUPPORTED;
+        return w->err;
+    }
+    if (_put_bytes(w, &c, 1) != COAP_SUCCESS) {
+        return w->err;
+    }
+    w->depth++;
+    w->members &= ~((uint32_t)1 << w->depth);
+    return COAP_SUCCESS;
+}
+
+static coap_state_t _end(coap_json_writer_t *w, const char c)
+{
+    if (w->err != COAP_SUCCESS) {
+        return w->err;
+    }
+    if (!w->depth || w->key) {
+        w->err = COAP_ERR_UNSUPPORTED;
+        return w->err;
+    }
+    if (_put_bytes(w, &c, 1) != COAP_SUCCESS) {
+        return w->err;
+    }
+    w->depth--;
+    return COAP_SUCCESS;
+}
+
+static void _skip_ws(coap_json_reader_t *r)
+{
+    while ((r->pos < r->len) &&
+           ((r->p[r->pos] == ' ') || (r->p[r->pos] == '\n') ||
+            (r->p[r->pos] == '\r') || (r->p[r->pos] == '\t'))) {
+        r->pos++;
+    }
+}
+
+static bool _is_digit(const uint8_t c)
+{
+    return (c >= '0') && (c <= '9');
+}
+
+static int _hex(const uint8_t c)
+{
+    if (_is_digit(c)) {
+        return c - '0';
+    }
+    if ((c >= 'a') && (c <= 'f')) {
+        return c - 'a' + 10;
+    }
+    if ((c >= 'A') && (c <= 'F')) {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+/* four hex digits at \p p, -1 if invalid */
+static long _hex4(const uint8_t *p)
+{
+    long v = 0;
+    for (int i = 0; i < 4; ++i) {
+        const int h = _hex(p[i]);
+        if (h < 0) {
+            return -1;
+        }
+        v = (v << 4) | h;
+    }
+    return v;
+}
+
+static void _after_value(coap_json_reader_t *r)
+{
+    r->state = r->depth ? JSON_NEXT : JSON_DONE;
+}
+
+/* string starting at the quote, escapes are validated but kept */
+static coap_state_t _read_string(coap_json_reader_t *r, coap_json_token_t *tok)
+{
+    const uint8_t *p = r->p;
+    size_t i = r->pos + 1;
+    tok->escaped = false;
+    for (;;) {
+        // plain characters, the common case
+        while ((i < r->len) && (p[i] >= 0x20) && (p[i] != '"') && (p[i] != '\\')) {
+            i++;
+        }
+        if ((i >= r->len) || (p[i] < 0x20)) {
+            return COAP_ERR_PAYLOAD_INVALID;
+        }
+        if (p[i] == '"') {
+            break;
+        }
+        if (i + 1 >= r->len) {
+            return COAP_ERR_PAYLOAD_INVALID;
+        }
+        const uint8_t e = p[i + 1];
+        if (e == 'u') {
+            if ((r->len - i < 6) || (_hex4(p + i + 2) < 0)) {
+                return COAP_ERR_PAYLOAD_INVALID;
+            }
+            i += 6;
+        }
+        else if (e && strchr("\"\\/bfnrt", e)) {
+            i += 2;
+        }
+        else {
+            return COAP_ERR_PAYLOAD_INVALID;
+        }
+        tok->escaped = true;
+    }
+    tok->str.p = p + r->pos + 1;
+    tok->str.len = i - r->pos - 1;
+    r->pos = i + 1;
+    return COAP_SUCCESS;
+}
+
+/* -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)? */
+static coap_state_t _read_number(coap_json_reader_t *r, coap_json_token_t *tok)
+{
+    const uint8_t *p = r->p;
+    size_t i = r->pos;
+
+    if (p[i] == '-') {
+        i++;
+    }
+    if ((i < r->len) && (p[i] == '0')) {
+        i++;
+    }
+    else if ((i < r->len) && _is_digit(p[i])) {
+        while ((i < r->len) && _is_digit(p[i])) {
+            i++;
+        }
+    }
+    else {
+        return COAP_ERR_PAYLOAD_INVALID;
+    }
+    if ((i < r->len) && (p[i] == '.')) {
+        if ((++i >= r->len) || !_is_digit(p[i])) {
+            return COAP_ERR_PAYLOAD_INVALID;
+        }
+        while ((i < r->len) && _is_digit(p[i])) {
+            i++;
+        }
+    }
+    if ((i < r->len) && ((p[i] == 'e') || (p[i] == 'E'))) {
+        if ((++i < r->len) && ((p[i] == '+') || (p[i] == '-'))) {
+            i++;
+        }
+        if ((i >= r->len) || !_is_digit(p[i])) {
+            return COAP_ERR_PAYLOAD_INVALID;
+        }
+        while ((i < r->len) && _is_digit(p[i])) {
+            i++;
+        }
+    }
+    tok->type = COAP_JSON_NUMBER;
+    tok->str.p = p + r->pos;
+    tok->str.len = i - r->pos;
+    r->pos = i;
+    return COAP_SUCCESS;
+}
+
+static coap_state_t _read_literal(coap_json_reader_t *r, const char *lit)
+{
+    const size_t n = strlen(lit);
+    if ((r->len - r->pos < n) || memcmp(r->p + r->pos, lit, n)) {
+        return COAP_ERR_PAYLOAD_INVALID;
+    }
+    r->pos += n;
+    return COAP_SUCCESS;
+}
+
+static coap_state_t _read_end(coap_json_reader_t *r, coap_json_token_t *tok)
+{
+    const bool object = r->objects & ((uint32_t)1 << r->depth);
+    if (!r->depth || (r->p[r->pos] != (object ? '}' : ']'))) {
+        return COAP_ERR_PAYLOAD_INVALID;
+    }
+    r->pos++;
+    r->depth--;
+    tok->type = COAP_JSON_END;
+    _after_value(r);
+    return COAP_SUCCESS;
+}
+
+static coap_state_t _read_value(coap_json_reader_t *r, coap_json_token_t *tok)
+{
+    const uint8_t c = r->p[r->pos];
+    coap_state_t rc;
+
+    switch (c) {
+    case '{':
+    case '[':
+        if (r->depth >= COAP_JSON_MAX_DEPTH) {
+            return COAP_ERR_PAYLOAD_INVALID;
+        }
+        r->pos++;
+        r->depth++;
+        if (c == '{') {
+            r->objects |= (uint32_t)1 << r->depth;
+            r->state = JSON_KEY_OR_END;
+            tok->type = COAP_JSON_OBJECT;
+        }
+        else {
+            r->objects &= ~((uint32_t)1 << r->depth);
+            r->state = JSON_VALUE_OR_END;
+            tok->type = COAP_JSON_ARRAY;
+        }
+        return COAP_SUCCESS;
+    case '"':
+        tok->type = COAP_JSON_STRING;
+        rc = _read_string(r, tok);
+        break;
+    case 't':
+    case 'f':
+        tok->type = COAP_JSON_BOOL;
+        tok->b = (c == 't');
+        rc = _read_literal(r, tok->b ? "true" : "false");
+        break;
+    case 'n':
+        tok->type = COAP_JSON_NULL;
+        rc = _read_literal(r, "null");
+        break;
+    default:
+        rc = _read_number(r, tok);
+        break;
+    }
+    if (rc == COAP_SUCCESS) {
+        _after_value(r);
+    }
+    return rc;
+}
+
+static coap_state_t _next(coap_json_reader_t *r, coap_json_token_t *tok)
+{
+    tok->escaped = false;
+    tok->b = false;
+    tok->str.p = NULL;
+    tok->str.len = 0;
+    _skip_ws(r);
+    if (r->pos >= r->len) {
+        return COAP_ERR_PAYLOAD_INVALID;
+    }
+    if (r->state == JSON_NEXT) {
+        if (r->p[r->pos] != ',') {
+            return _read_end(r, tok);
+        }
+        r->pos++;
+        r->state = (r->objects & ((uint32_t)1 << r->depth)) ? JSON_KEY : JSON_VALUE;
+        _skip_ws(r);
+        if (r->pos >= r->len) {
+            return COAP_ERR_PAYLOAD_INVALID;
+        }
+    }
+    switch (r->state) {
+    case JSON_DONE:
+        return COAP_ERR_PAYLOAD_INVALID;
+    case JSON_KEY_OR_END:
+        if (r->p[r->pos] == '}') {
+            return _read_end(r, tok);
+        }
+        // fall through
+    case JSON_KEY:
+        if (r->p[r->pos] != '"') {
+            return COAP_ERR_PAYLOAD_INVALID;
+        }
+        if (_read_string(r, tok) != COAP_SUCCESS) {
+            return COAP_ERR_PAYLOAD_INVALID;
+        }
+        tok->type = COAP_JSON_KEY;
+        _skip_ws(r);
+        if ((r->pos >= r->len) || (r->p[r->pos] != ':')) {
+            return COAP_ERR_PAYLOAD_INVALID;
+        }
+        r->pos++;
+        r->state = JSON_VALUE;
+        return COAP_SUCCESS;
+    case JSON_VALUE_OR_END:
+        if (r->p[r->pos] == ']') {
+            return _read_end(r, tok);
+        }
+        // fall through
+    default:
+        return _read_value(r, tok);
+    }
+}
+
+/* UTF-8 encoding of code point \p cp */
+static size_t _utf8(const uint32_t cp, uint8_t *out)
+{
+    if (cp < 0x80) {
+        out[0] = (uint8_t)cp;
+        return 1;
+    }
+    if (cp < 0x800) {
+        out[0] = (uint8_t)(0xC0 | (cp >> 6));
+        out[1] = (uint8_t)(0x80 | (cp & 0x3F));
+        return 2;
+    }
+    if (cp < 0x10000) {
+        out[0] = (uint8_t)(0xE0 | (cp >> 12));
+        out[1] = (uint8_t)(0x80 | ((cp >> 6) & 0x3F));
+        out[2] = (uint8_t)(0x80 | (cp & 0x3F));
+        return 3;
+    }
+    out[0] = (uint8_t)(0xF0 | (cp >> 18));
+    out[1] = (uint8_t)(0x80 | ((cp >> 12) & 0x3F));
+    out[2] = (uint8_t)(0x80 | ((cp >> 6) & 0x3F));
+    out[3] = (uint8_t)(0x80 | (cp & 0x3F));
+    return 4;
+}
+
+/* --- PUBLIC --------------------------------------------------------------- */
+size_t coap_json_format_double(const double value, char *buf)
+{
+    size_t n = 0;
+    int k = 0;
+
+    if (!isfinite(value)) {
+        return 0;
+    }
+    if (signbit(value)) {
+        buf[n++] = '-';
+    }
+    if (value == 0) {
+        buf[n++] = '0';
+        return n;
+    }
+    const int len = _grisu2(fabs(value), buf + n, &k);
+    return n + _prettify(buf + n, len, k);
+}
+
+void coap_json_writer_init(coap_json_writer_t *w, uint8_t *buf, const size_t len)
+{
+    w->p = buf;
+    w->len = len;
+    w->pos = 0;
+    w->err = COAP_SUCCESS;
+    w->depth = 0;
+    w->members = 0;
+    w->key = false;
+}
+
+coap_state_t coap_json_begin_object(coap_json_writer_t *w)
+{
+    return _begin(w, '{');
+}
+
+coap_state_t coap_json_end_object(coap_json_writer_t *w)
+{
+    return _end(w, '}');
+}
+
+coap_state_t coap_json_begin_array(coap_json_writer_t *w)
+{
+    return _begin(w, '[');
+}
+
+coap_state_t coap_json_end_array(coap_json_writer_t *w)
+{
+    return _end(w, ']');
+}
+
+coap_state_t coap_json_put_key(coap_json_writer_t *w,
+                               const char *key, const size_t len)
+{
+    if ((_separate(w) != COAP_SUCCESS) ||
+        (_put_quoted(w, (const uint8_t *)key, len) != COAP_SUCCESS) ||
+        (_put_bytes(w, ":", 1) != COAP_SUCCESS)) {
+        return w->err;
+    }
+    w->key = true;
+    return COAP_SUCCESS;
+}
+
+coap_state_t coap_json_put_string(coap_json_writer_t *w,
+                                  const char *text, const size_t len)
+{
+    if (_separate(w) != COAP_SUCCESS) {
+        return w->err;
+    }
+    return _put_quoted(w, (const uint8_t *)text, len);
+}
+
+coap_state_t coap_json_put_base64url(coap_json_writer_t *w,
+                                     const uint8_t *data, const size_t len)
+{
+    static const char alphabet[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+    const size_t rest = len % 3;
+    uint8_t *p;
+
+    if ((_separate(w) != COAP_SUCCESS) ||
+        !(p = _reserve(w, 2 + len / 3 * 4 + (rest ? rest + 1 : 0)))) {
+        return w->err;
+    }
+    *p++ = '"';
+    for (size_t i = 0; i < len; i += 3) {
+        uint32_t v = (uint32_t)data[i] << 16;
+        if (i + 1 < len) {
+            v |= (uint32_t)data[i + 1] << 8;
+        }
+        if (i + 2 < len) {
+            v |= data[i + 2];
+        }
+        *p++ = alphabet[v >> 18];
+        *p++ = alphabet[(v >> 12) & 0x3F];
+        if (i + 1 < len) {
+            *p++ = alphabet[(v >> 6) & 0x3F];
+        }
+        if (i + 2 < len) {
+            *p++ = alphabet[v & 0x3F];
+        }
+    }
+    *p = '"';
+    return COAP_SUCCESS;
+}
+
+coap_state_t coap_json_put_uint(coap_json_writer_t *w, const uint64_t value)
+{
+    char buf[20];
+    const char *p = _format_uint(value, buf + sizeof(buf));
+    return _put_value(w, p, (size_t)(buf + sizeof(buf) - p));
+}
+
+coap_state_t coap_json_put_int(coap_json_writer_t *w, const int64_t value)
+{
+    char buf[21];
+    // magnitude without overflow for INT64_MIN
+    char *p = _format_uint((value < 0) ? -(uint64_t)value : (uint64_t)value,
+                           buf + sizeof(buf));
+    if (value < 0) {
+        *--p = '-';
+    }
+    return _put_value(w, p, (size_t)(buf + sizeof(buf) - p));
+}
+
+coap_state_t coap_json_put_double(coap_json_writer_t *w, const double value)
+{
+    char buf[COAP_JSON_DOUBLE_LEN];
+    const size_t n = coap_json_format_double(value, buf);
+    if (!n) {
+        if (w->err == COAP_SUCCESS) {
+            w->err = COAP_ERR_UNSUPPORTED;
+        }
+        return w->err;
+    }
+    return _put_value(w, buf, n);
+}
+
+coap_state_t coap_json_put_bool(coap_json_writer_t *w, const bool value)
+{
+    return _put_value(w, value ? "true" : "false", value ? 4 : 5);
+}
+
+coap_state_t coap_json_put_null(coap_json_writer_t *w)
+{
+    return _put_value(w, "null", 4);
+}
+
+coap_state_t coap_json_put_raw(coap_json_writer_t *w,
+                               const char *json, const size_t len)
+{
+    return _put_value(w, json, len);
+}
+
+void coap_json_reader_init(coap_json_reader_t *r,
+                           const uint8_t *buf, const size_t len)
+{
+    r->p = buf;
+    r->len = len;
+    r->pos = 0;
+    r->depth = 0;
+    r->objects = 0;
+    r->state = JSON_VALUE;
+}
+
+bool coap_json_at_end(const coap_json_reader_t *r)
+{
+    coap_json_reader_t tmp = *r;
+    _skip_ws(&tmp);
+    return (r->state == JSON_DONE) && (tmp.pos == tmp.len);
+}
+
+coap_state_t coap_json_next(coap_json_reader_t *r, coap_json_token_t *tok)
+{
+    const coap_json_reader_t start = *r;
+    const coap_state_t rc = _next(r, tok);
+    if (rc != COAP_SUCCESS) {
+        *r = start;
+    }
+    return rc;
+}
+
+coap_state_t coap_json_skip(coap_json_reader_t *r)
+{
+    const coap_json_reader_t start = *r;
+    coap_json_token_t tok;
+
+    if (coap_json_next(r, &tok) != COAP_SUCCESS) {
+        return COAP_ERR_PAYLOAD_INVALID;
+    }
+    if ((tok.type == COAP_JSON_KEY) || (tok.type == COAP_JSON_END)) {
+        *r = start;
+        return COAP_ERR_PAYLOAD_INVALID;
+    }
+    if ((tok.type == COAP_JSON_OBJECT) || (tok.type == COAP_JSON_ARRAY)) {
+        // the reader tracks nesting, read on until it is closed
+        const uint8_t depth = r->depth;
+        while (r->depth >= depth) {
+            if (coap_json_next(r, &tok) != COAP_SUCCESS) {
+                *r = start;
+                return COAP_ERR_PAYLOAD_INVALID;
+            }
+        }
+    }
+    return COAP_SUCCESS;
+}
+
+coap_state_t coap_json_expect(coap_json_reader_t *r,
+                              const coap_json_type_t type,
+                              coap_json_token_t *tok)
+{
+    const coap_json_reader_t start = *r;
+    if (coap_json_next(r, tok) != COAP_SUCCESS) {
+        return COAP_ERR_PAYLOAD_INVALID;
+    }
+    if (tok->type != type) {
+        *r = start;
+        return COAP_ERR_PAYLOAD_INVALID;
+    }
+    return COAP_SUCCESS;
+}
+
+coap_state_t coap_json_find_key(coap_json_reader_t *r, const char *key)
+{
+    const coap_json_reader_t start = *r;
+    const size_t keylen = strlen(key);
+    coap_json_token_t tok;
+
+    if (!(r->objects & ((uint32_t)1 << r->depth))) {
+        return COAP_ERR_PAYLOAD_INVALID;
+    }
+    for (;;) {
+        if (coap_json_next(r, &tok) != COAP_SUCCESS) {
+            break;
+        }
+        if (tok.type == COAP_JSON_END) {
+            return COAP_ERR_OPTION_NOT_FOUND;
+        }
+        if ((tok.str.len == keylen) && !memcmp(tok.str.p, key, keylen)) {
+            return COAP_SUCCESS;
+        }
+        if (coap_json_skip(r) != COAP_SUCCESS) {
+            break;
+        }
+    }
+    *r = start;
+    return COAP_ERR_PAYLOAD_INVALID;
+}
+
+coap_state_t coap_json_number(const coap_json_token_t *tok, double *value)
+{
+    const uint8_t *s = tok->str.p;
+    const size_t n = tok->str.len;
+    size_t i = 0;
+    uint64_t m = 0;
+    int digits = 0, exp10 = 0;
+
+    if ((tok->type != COAP_JSON_NUMBER) || !n) {
+        return COAP_ERR_PAYLOAD_INVALID;
+    }
+    const bool neg = (s[0] == '-');
+    i = neg;
+    // significant digits up to 19 go into m, the exponent keeps the rest
+    for (; (i < n) && _is_digit(s[i]); ++i) {
+        if (digits < 19) {
+            m = m * 10 + (s[i] - '0');
+            digits += (m != 0);
+        }
+        else {
+            digits++;
+            exp10++;
+        }
+    }
+    if ((i < n) && (s[i] == '.')) {
+        for (++i; (i < n) && _is_digit(s[i]); ++i) {
+            if (digits < 19) {
+                m = m * 10 + (s[i] - '0');
+                digits += (m != 0);
+                exp10--;
+            }
+            else {
+                digits++;
+            }
+        }
+    }
+    if ((i < n) && ((s[i] == 'e') || (s[i] == 'E'))) {
+        bool eneg = false;
+        int e = 0;
+        if ((++i < n) && ((s[i] == '+') || (s[i] == '-'))) {
+            eneg = (s[i++] == '-');
+        }
+        for (; (i < n) && _is_digit(s[i]); ++i) {
+            if (e < 10000) {
+                e = e * 10 + (s[i] - '0');
+            }
+        }
+        exp10 += eneg ? -e : e;
+    }
+    if (i != n) {
+        return COAP_ERR_PAYLOAD_INVALID;
+    }
+    if (!m) {
+        *value = neg ? -0.0 : 0.0;
+        return COAP_SUCCESS;
+    }
+    // exact if m and 10^|exp10| are both exact doubles (Clinger's fast path)
+    if ((digits <= 15) && (exp10 >= -22) && (exp10 <= 22)) {
+        double d = (double)m;
+        d = (exp10 < 0) ? d / json_exact_pow10[-exp10] : d * json_exact_pow10[exp10];
+        *value = neg ? -d : d;
+        return COAP_SUCCESS;
+    }
+    // strtod needs a terminated copy, the payload is not
+    char num[JSON_NUMBER_MAX];
+    if (n >= sizeof(num)) {
+        return COAP_ERR_UNSUPPORTED;
+    }
+    memcpy(num, s, n);
+    num[n] = '\0';
+    *value = strtod(num, NULL);
+    return COAP_SUCCESS;
+}
+
+coap_state_t coap_json_int(const coap_json_token_t *tok, int64_t *value)
+{
+    const uint8_t *s = tok->str.p;
+    const size_t n = tok->str.len;
+    uint64_t m = 0;
+
+    if ((tok->type != COAP_JSON_NUMBER) || !n) {
+        return COAP_ERR_PAYLOAD_INVALID;
+    }
+    const bool neg = (s[0] == '-');
+    if (n == neg) {
+        return COAP_ERR_PAYLOAD_INVALID;
+    }
+    // INT64_MIN has one more than INT64_MAX
+    const uint64_t limit = (uint64_t)INT64_MAX + neg;
+    for (size_t i = neg; i < n; ++i) {
+        if (!_is_digit(s[i]) || (m > (limit - (s[i] - '0')) / 10)) {
+            return COAP_ERR_PAYLOAD_INVALID;
+        }
+        m = m * 10 + (s[i] - '0');
+    }
+    *value = neg ? (int64_t)(0 - m) : (int64_t)m;
+    return COAP_SUCCESS;
+}
+
+coap_state_t coap_json_unescape(const coap_json_token_t *tok,
+                                uint8_t *out, size_t *len)
+{
+    static const char from[] = "\"\\/bfnrt";
+    static const char to[] = "\"\\/\b\f\n\r\t";
+    const uint8_t *s = tok->str.p;
+    const size_t n = tok->str.len;
+    size_t o = 0;
+
+    if ((tok->type != COAP_JSON_KEY) && (tok->type != COAP_JSON_STRING)) {
+        return COAP_ERR_PAYLOAD_INVALID;
+    }
+    // the output never overtakes the input, so out may alias it
+    for (size_t i = 0; i < n;) {
+        if (s[i] != '\\') {
+            out[o++] = s[i++];
+            continue;
+        }
+        if (i + 1 >= n) {
+            return COAP_ERR_PAYLOAD_INVALID;
+        }
+        if (s[i + 1] != 'u') {
+            const char *e = s[i + 1] ? strchr(from, s[i + 1]) : NULL;
+            if (!e) {
+                return COAP_ERR_PAYLOAD_INVALID;
+            }
+            out[o++] = (uint8_t)to[e - from];
+            i += 2;
+            continue;
+        }
+        long cp = (n - i >= 6) ? _hex4(s + i + 2) : -1;
+        i += 6;
+        if ((cp >= 0xDC00) && (cp <= 0xDFFF)) {
+            return COAP_ERR_PAYLOAD_INVALID;
+        }
+        if ((cp >= 0xD800) && (cp <= 0xDBFF)) {
+            // surrogate pair
+            const long lo = ((n - i >= 6) && (s[i] == '\\') && (s[i + 1] == 'u')) ?
+                            _hex4(s + i + 2) : -1;
+            if ((lo < 0xDC00) || (lo > 0xDFFF)) {
+                return COAP_ERR_PAYLOAD_INVALID;
+            }
+            cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+            i += 6;
+        }
+        if (cp < 0) {
+            return COAP_ERR_PAYLOAD_INVALID;
+        }
+        o += _utf8((uint32_t)cp, out + o);
+    }
+    *len = o;
+    return COAP_SUCCESS;
+}
@@ -0,0 +1,250 @@
+#ifndef COAP_JSON_H
+#define COAP_JSON_H 1
+
+/**
+ * @file coap_json.h
+ *
+ * JSON (RFC 8259) for payloads of content format 50. The writer puts values
+ * straight into a caller buffer, e.g. the one the response payload points to,
+ * and formats doubles with Grisu2, the shortest digits that read back exactly
+ * in nearly all cases, without going through printf. The reader tokenizes a
+ * payload in place, strings and numbers are views into it; strings can be
+ * unescaped in place. Neither allocates.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "coap.h"
+
+#ifndef COAP_JSON_MAX_DEPTH
+#define COAP_JSON_MAX_DEPTH 16      //!< nesting limit of writer and reader
+#endif
+
+#define COAP_JSON_DOUBLE_LEN 32     //!< buffer size for coap_json_format_double
+
+/**
+ * Token types
+ */
+typedef enum
+{
+    COAP_JSON_OBJECT                = 0,    //!< start of an object
+    COAP_JSON_ARRAY,                        //!< start of an array
+    COAP_JSON_END,                          //!< end of the innermost object or array
+    COAP_JSON_KEY,                          //!< member name, str, the value follows
+    COAP_JSON_STRING,                       //!< str
+    COAP_JSON_NUMBER,                       //!< str, see coap_json_number
+    COAP_JSON_BOOL,                         //!< b
+    COAP_JSON_NULL,
+} coap_json_type_t;
+
+/**
+ * Token
+ *
+ * str points into the tokenized buffer, strings without the quotes and with
+ * escapes kept, numbers as they appear.
+ */
+typedef struct coap_json_token
+{
+    coap_json_type_t type;
+    coap_buffer_t str;      //!< COAP_JSON_KEY, COAP_JSON_STRING, COAP_JSON_NUMBER
+    bool escaped;           //!< str holds escapes, see coap_json_unescape
+    bool b;                 //!< COAP_JSON_BOOL
+} coap_json_token_t;
+
+/**
+ * Encoder state, errors are sticky so that a sequence of puts can be checked
+ * once at the end. Commas and colons are inserted by the writer.
+ */
+typedef struct coap_json_writer
+{
+    uint8_t *p;             //!< output buffer
+    size_t len;             //!< size of p
+    size_t pos;             //!< bytes written
+    coap_state_t err;       //!< first error, COAP_SUCCESS if none
+    uint8_t depth;          //!< open objects and arrays
+    uint32_t members;       //!< bit per depth, set once it has a member
+    bool key;               //!< a key has been written, its value follows
+} coap_json_writer_t;
+
+/**
+ * Decoder state
+ */
+typedef struct coap_json_reader
+{
+    const uint8_t *p;       //!< JSON text
+    size_t len;             //!< length of p
+    size_t pos;             //!< offset of the next token
+    uint8_t depth;          //!< open objects and arrays
+    uint32_t objects;       //!< bit per depth, set for objects
+    uint8_t state;          //!< what may follow, private
+} coap_json_reader_t;
+
+/**
+ * @brief Format \p value as a JSON number
+ *
+ * Digits are generated with Grisu2, numbers from 1e-6 up to 1e21 are written
+ * without exponent, integral ones without fraction, e.g. 21.5, 1700000000,
+ * 1e+300 as 1e300.
+ *
+ * @param[in] value Value to format
+ * @param[out] buf At least COAP_JSON_DOUBLE_LEN bytes, not terminated
+ *
+ * @return Length of the number, or 0 if \p value is not finite
+ */
+size_t coap_json_format_double(const double value, char *buf);
+
+/**
+ * @brief Start encoding into \p buf
+ */
+void coap_json_writer_init(coap_json_writer_t *w, uint8_t *buf, const size_t len);
+
+/**
+ * @brief Open or close an object or array
+ *
+ * @return 0 on success, COAP_ERR_BUFFER_TOO_SMALL if it does not fit or an
+ * earlier put failed, or COAP_ERR_UNSUPPORTED if nested deeper than
+ * COAP_JSON_MAX_DEPTH
+ */
+coap_state_t coap_json_begin_object(coap_json_writer_t *w);
+coap_state_t coap_json_end_object(coap_json_writer_t *w);
+coap_state_t coap_json_begin_array(coap_json_writer_t *w);
+coap_state_t coap_json_end_array(coap_json_writer_t *w);
+
+/**
+ * @brief Encode the name of an object member, its value has to follow
+ */
+coap_state_t coap_json_put_key(coap_json_writer_t *w,
+                               const char *key, const size_t len);
+
+/**
+ * @brief Encode \p len bytes of UTF-8 text as a string, escaping quotes,
+ * backslashes and control characters
+ */
+coap_state_t coap_json_put_string(coap_json_writer_t *w,
+                                  const char *text, const size_t len);
+
+/**
+ * @brief Encode binary data as a base64url string without padding
+ * (RFC 4648 section 5), as SenML does for data values
+ */
+coap_state_t coap_json_put_base64url(coap_json_writer_t *w,
+                                     const uint8_t *data, const size_t len);
+
+coap_state_t coap_json_put_uint(coap_json_writer_t *w, const uint64_t value);
+coap_state_t coap_json_put_int(coap_json_writer_t *w, const int64_t value);
+
+/**
+ * @brief Encode a number, see coap_json_format_double
+ *
+ * @return 0 on success, COAP_ERR_BUFFER_TOO_SMALL if it does not fit, or
+ * COAP_ERR_UNSUPPORTED for infinities and NaN, which JSON cannot represent
+ */
+coap_state_t coap_json_put_double(coap_json_writer_t *w, const double value);
+
+coap_state_t coap_json_put_bool(coap_json_writer_t *w, const bool value);
+coap_state_t coap_json_put_null(coap_json_writer_t *w);
+
+/**
+ * @brief Append an already encoded value, e.g. one passed through from a
+ * request without decoding it
+ */
+coap_state_t coap_json_put_raw(coap_json_writer_t *w,
+                               const char *json, const size_t len);
+
+/**
+ * @brief Start tokenizing \p len bytes at \p buf, e.g. inpkt->payload
+ */
+void coap_json_reader_init(coap_json_reader_t *r,
+                           const uint8_t *buf, const size_t len);
+
+/**
+ * @brief True if the top level value has been read and only whitespace
+ * follows
+ */
+bool coap_json_at_end(const coap_json_reader_t *r);
+
+/**
+ * @brief Read the next token
+ *
+ * The structure is validated as tokens are read: a key is only returned
+ * inside an object, followed by its value, members and elements are
+ * separated by commas, and COAP_JSON_END matches the innermost object or
+ * array.
+ *
+ * @param[in,out] r Reader
+ * @param[out] tok Token
+ *
+ * @return 0 on success, or COAP_ERR_PAYLOAD_INVALID if the input is
+ * truncated, not well-formed or nested deeper than COAP_JSON_MAX_DEPTH, the
+ * reader does not advance then
+ */
+coap_state_t coap_json_next(coap_json_reader_t *r, coap_json_token_t *tok);
+
+/**
+ * @brief Skip the next value including everything nested in it
+ */
+coap_state_t coap_json_skip(coap_json_reader_t *r);
+
+/**
+ * @brief Read the next token and check its type
+ *
+ * @return 0 on success, or COAP_ERR_PAYLOAD_INVALID on other types
+ */
+coap_state_t coap_json_expect(coap_json_reader_t *r,
+                              const coap_json_type_t type,
+                              coap_json_token_t *tok);
+
+/**
+ * @brief Advance to the value of member \p key of the object being read
+ *
+ * Keys are compared as they appear, without unescaping. Members before it
+ * are skipped.
+ *
+ * @return 0 if found, the value is the next token, or
+ * COAP_ERR_OPTION_NOT_FOUND if the object ends without it, the reader is
+ * behind the object then, or COAP_ERR_PAYLOAD_INVALID
+ */
+coap_state_t coap_json_find_key(coap_json_reader_t *r, const char *key);
+
+/**
+ * @brief Convert a number token
+ *
+ * Numbers of up to 15 significant digits with a decimal exponent up to 22 are
+ * converted exactly without strtod.
+ *
+ * @return 0 on success, or COAP_ERR_PAYLOAD_INVALID if \p tok is no number,
+ * or COAP_ERR_UNSUPPORTED if it is too long to convert
+ */
+coap_state_t coap_json_number(const coap_json_token_t *tok, double *value);
+
+/**
+ * @brief Convert a number token without fraction and exponent
+ *
+ * @return 0 on success, or COAP_ERR_PAYLOAD_INVALID if \p tok is no integer
+ * or out of range of int64_t
+ */
+coap_state_t coap_json_int(const coap_json_token_t *tok, int64_t *value);
+
+/**
+ * @brief Unescape a string token, \\uXXXX to UTF-8
+ *
+ * The result is never longer than the token, so \p out may be the token
+ * itself to unescape in place, e.g. in the receive buffer.
+ *
+ * @param[in] tok COAP_JSON_KEY or COAP_JSON_STRING token
+ * @param[out] out At least tok->str.len bytes, not terminated
+ * @param[out] len Length of the unescaped string
+ *
+ * @return 0 on success, or COAP_ERR_PAYLOAD_INVALID for invalid escapes or
+ * unpaired surrogates
+ */
+coap_state_t coap_json_unescape(const coap_json_token_t *tok,
+                                uint8_t *out, size_t *len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,402 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "coap.h"
+#include "coap_link.h"
+
+/* result of _scan_link besides coap_state_t, the link may continue in the
+ * next block */
+#define LINK_INCOMPLETE     COAP_RSP_WAIT
+
+/* character classes of _cls */
+#define CLS_WS              0x01    //!< whitespace between links
+#define CLS_PARMNAME        0x02    //!< attr-char of RFC 5987, and '*' for title*
+#define CLS_PTOKEN          0x04    //!< ptokenchar of RFC 6690
+#define CLS_TARGET          0x08    //!< in a URI reference, all but '<' and '>'
+
+/* --- PRIVATE -------------------------------------------------------------- */
+/* one lookup per byte instead of a chain of comparisons */
+static const uint8_t _cls[256] = {
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x01, 0x00, 0x00, 0x01, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x01, 0x0e, 0x08, 0x0e, 0x0e, 0x0c, 0x0e, 0x0c, 0x0c, 0x0c, 0x0e, 0x0e, 0x08, 0x0e, 0x0e, 0x0c,
+    0x0e, 0x0e, 0x0e, 0x0e, 0x0e, 0x0e, 0x0e, 0x0e, 0x0e, 0x0e, 0x0c, 0x08, 0x04, 0x0c, 0x04, 0x0c,
+    0x0c, 0x0e, 0x0e, 0x0e, 0x0e, 0x0e, 0x0e, 0x0e, 0x0e, 0x0e, 0x0e, 0x0e, 0x0e, 0x0e, 0x0e, 0x0e,
+    0x0e, 0x0e, 0x0e, 0x0e, 0x0e, 0x0e, 0x0e, 0x0e, 0x0e, 0x0e, 0x0e, 0x0c, 0x08, 0x0c, 0x0e, 0x0e,
+    0x0e, 0x0e, 0x0e, 0x0e, 0x0e, 0x0e, 0x0e, 0x0e, 0x0e, 0x0e, 0x0e, 0x0e, 0x0e, 0x0e, 0x0e, 0x0e,
+    0x0e, 0x0e, 0x0e, 0x0e, 0x0e, 0x0e, 0x0e, 0x0e, 0x0e, 0x0e, 0x0e, 0x0c, 0x0e, 0x0c, 0x0e, 0x08,
+    0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08,
+    0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08,
+    0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08,
+    0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08,
+    0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08,
+    0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08,
+    0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08,
+    0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08,
+};
+
+static bool _is_ws(const uint8_t c)
+{
+    return _cls[c] & CLS_WS;
+}
+
+static bool _is_parmname(const uint8_t c)
+{
+    return _cls[c] & CLS_PARMNAME;
+}
+
+static bool _is_ptoken(const uint8_t c)
+{
+    return _cls[c] & CLS_PTOKEN;
+}
+
+static size_t _skip_ws(const uint8_t *p, const size_t len, size_t pos)
+{
+    while ((pos < len) && _is_ws(p[pos])) {
+        pos++;
+    }
+    return pos;
+}
+
+/*
+ * Offset of the quote closing the string that starts at \p pos, or \p len.
+ * Quoted values make up most of a typical document, memchr skips them faster
+ * than a loop over the bytes; a quote is escaped by an odd run of
+ * backslashes before it.
+ */
+static size_t _quote_end(const uint8_t *p, const size_t len, size_t pos)
+{
+    const uint8_t *q;
+    while ((q = memchr(p + pos, '"', len - pos))) {
+        size_t i = (size_t)(q - p), n = 0;
+        while ((i - n > pos) && (p[i - n - 1] == '\\')) {
+            n++;
+        }
+        if (!(n & 1)) {
+            return i;
+        }
+        pos = i + 1;
+    }
+    return len;
+}
+
+/*
+ * Scans the link at \p pos, which is not whitespace. On success \p next is
+ * behind the comma that ends it, or at the end. Unless \p last, a link that
+ * reaches the end of the buffer may continue and is LINK_INCOMPLETE.
+ */
+static coap_state_t _scan_link(const uint8_t *p, const size_t len, size_t pos,
+                               const bool last, coap_link_t *link, size_t *next)
+{
+    const coap_state_t end = last ? COAP_ERR_PAYLOAD_INVALID : LINK_INCOMPLETE;
+    size_t start;
+
+    if (p[pos] != '<') {
+        return COAP_ERR_PAYLOAD_INVALID;
+    }
+    start = ++pos;
+    while ((pos < len) && (_cls[p[pos]] & CLS_TARGET)) {
+        pos++;
+    }
+    if (pos >= len) {
+        return end;
+    }
+    if (p[pos] != '>') {
+        return COAP_ERR_PAYLOAD_INVALID;
+    }
+    link->target.p = p + start;
+    link->target.len = pos - start;
+    start = ++pos;
+    // ;name or ;name=ptoken or ;name="quoted"
+    while ((pos < len) && (p[pos] == ';')) {
+        const size_t name = ++pos;
+        while ((pos < len) && _is_parmname(p[pos])) {
+            pos++;
+        }
+        if (pos >= len) {
+            // a complete name at the end of the document is a valid parameter
+            if (last && (pos > name)) {
+                break;
+            }
+            return end;
+        }
+        if (pos == name) {
+            return COAP_ERR_PAYLOAD_INVALID;
+        }
+        if (p[pos] != '=') {
+            continue;
+        }
+        if (++pos >= len) {
+            return end;
+        }
+        if (p[pos] == '"') {
+            pos = _quote_end(p, len, pos + 1);
+            if (pos >= len) {
+                return end;
+            }
+            pos++;
+        }
+        else {
+            const size_t value = pos;
+            while ((pos < len) && _is_ptoken(p[pos])) {
+                pos++;
+            }
+            if (pos == value) {
+                return COAP_ERR_PAYLOAD_INVALID;
+            }
+        }
+    }
+    link->params.p = p + start;
+    link->params.len = pos - start;
+    pos = _skip_ws(p, len, pos);
+    if (pos >= len) {
+        // more parameters may follow in the next block
+        if (!last) {
+            return LINK_INCOMPLETE;
+        }
+        *next = pos;
+        return COAP_SUCCESS;
+    }
+    if (p[pos] != ',') {
+        return COAP_ERR_PAYLOAD_INVALID;
+    }
+    *next = pos + 1;
+    return COAP_SUCCESS;
+}
+
+static bool _buf_equal_str(const coap_buffer_t *buf, const char *str)
+{
+    const size_t len = strlen(str);
+    return (buf->len == len) && !memcmp(buf->p, str, len);
+}
+
+/* \p value against \p pattern, a trailing '*' matches a prefix */
+static bool _value_match(const uint8_t *value, const size_t len,
+                         const char *pattern, const size_t plen)
+{
+    if (plen && (pattern[plen - 1] == '*')) {
+        return (len >= plen - 1) && !memcmp(value, pattern, plen - 1);
+    }
+    return (len == plen) && !memcmp(value, pattern, plen);
+}
+
+static bool _filter_match(const coap_link_t *link, const coap_link_filter_t *f)
+{
+    const size_t plen = f->value ? strlen(f->value) : 0;
+    coap_link_attr_t attr;
+    size_t pos = 0;
+
+    if (!strcmp(f->name, "href")) {
+        return !f->value || _value_match(link->target.p, link->target.len,
+                                         f->value, plen);
+    }
+    while (coap_link_attr_next(link, &pos, &attr) == COAP_SUCCESS) {
+        if (!_buf_equal_str(&attr.name, f->name)) {
+            continue;
+        }
+        if (!f->value || _value_match(attr.value.p, attr.value.len, f->value, plen)) {
+            return true;
+        }
+        if (!attr.quoted) {
+            continue;
+        }
+        // space separated values, e.g. rt="temperature-c sensor"
+        for (size_t i = 0; i < attr.value.len;) {
+            size_t j = i;
+            while ((j < attr.value.len) && (attr.value.p[j] != ' ')) {
+                j++;
+            }
+            if ((j > i) && _value_match(attr.value.p + i, j - i, f->value, plen)) {
+                return true;
+            }
+            i = j + 1;
+        }
+    }
+    return false;
+}
+
+/* --- PUBLIC --------------------------------------------------------------- */
+void coap_link_reader_init(coap_link_reader_t *r,
+                           const uint8_t *buf, const size_t len)
+{
+    r->p = buf;
+    r->len = len;
+    r->pos = 0;
+}
+
+bool coap_link_at_end(const coap_link_reader_t *r)
+{
+    return _skip_ws(r->p, r->len, r->pos) >= r->len;
+}
+
+coap_state_t coap_link_next(coap_link_reader_t *r, coap_link_t *link)
+{
+    const size_t pos = _skip_ws(r->p, r->len, r->pos);
+    size_t next;
+
+    if (pos >= r->len) {
+        return COAP_ERR_OPTION_NOT_FOUND;
+    }
+    if (_scan_link(r->p, r->len, pos, true, link, &next) != COAP_SUCCESS) {
+        return COAP_ERR_PAYLOAD_INVALID;
+    }
+    r->pos = next;
+    return COAP_SUCCESS;
+}
+
+coap_state_t coap_link_find(coap_link_reader_t *r,
+                            const coap_link_filter_t *filters,
+                            const size_t count, coap_link_t *link)
+{
+    coap_state_t rc;
+    while ((rc = coap_link_next(r, link)) == COAP_SUCCESS) {
+        if (coap_link_match(link, filters, count)) {
+            return COAP_SUCCESS;
+        }
+    }
+    return rc;
+}
+
+coap_state_t coap_link_attr_next(const coap_link_t *link, size_t *pos,
+                                 coap_link_attr_t *attr)
+{
+    // the parameters have been validated by _scan_link
+    const uint8_t *p = link->params.p;
+    const size_t len = link->params.len;
+    size_t i = *pos;
+
+    if ((i >= len) || (p[i] != ';')) {
+        return COAP_ERR_OPTION_NOT_FOUND;
+    }
+    attr->name.p = p + ++i;
+    while ((i < len) && _is_parmname(p[i])) {
+        i++;
+    }
+    attr->name.len = (size_t)(p + i - attr->name.p);
+    attr->value.p = NULL;
+    attr->value.len = 0;
+    attr->quoted = false;
+    if ((i < len) && (p[i] == '=')) {
+        if (p[++i] == '"') {
+            const size_t start = ++i;
+            i = _quote_end(p, len, i);
+            attr->value.p = p + start;
+            attr->value.len = i++ - start;
+            attr->quoted = true;
+        }
+        else {
+            const size_t start = i;
+            while ((i < len) && _is_ptoken(p[i])) {
+                i++;
+            }
+            attr->value.p = p + start;
+            attr->value.len = i - start;
+        }
+    }
+    *pos = i;
+    return COAP_SUCCESS;
+}
+
+coap_state_t coap_link_attr_find(const coap_link_t *link, const char *name,
+                                 coap_link_attr_t *attr)
+{
+    size_t pos = 0;
+    while (coap_link_attr_next(link, &pos, attr) == COAP_SUCCESS) {
+        if (_buf_equal_str(&attr->name, name)) {
+            return COAP_SUCCESS;
+        }
+    }
+    return COAP_ERR_OPTION_NOT_FOUND;
+}
+
+bool coap_link_match(const coap_link_t *link,
+                     const coap_link_filter_t *filters, const size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        if (!_filter_match(link, &filters[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void coap_link_stream_init(coap_link_stream_t *s, uint8_t *carry,
+                           const size_t size)
+{
+    coap_link_reader_init(&s->r, NULL, 0);
+    s->last = false;
+    s->carry = carry;
+    s->size = size;
+    s->carry_len = 0;
+}
+
+void coap_link_stream_feed(coap_link_stream_t *s, const uint8_t *block,
+                           const size_t len, const bool last)
+{
+    coap_link_reader_init(&s->r, block, len);
+    s->last = last;
+}
+
+coap_state_t coap_link_stream_next(coap_link_stream_t *s, coap_link_t *link)
+{
+    coap_link_reader_t *r = &s->r;
+    coap_state_t rc;
+    size_t next;
+
+    if (s->carry_len) {
+        // complete the split link with the start of this block
+        const size_t n = ((s->size - s->carry_len) < (r->len - r->pos)) ?
+                         (s->size - s->carry_len) : (r->len - r->pos);
+        const bool all = (r->pos + n == r->len);
+        memcpy(s->carry + s->carry_len, r->p + r->pos, n);
+        rc = _scan_link(s->carry, s->carry_len + n, 0, s->last && all, link, &next);
+        if (rc == COAP_SUCCESS) {
+            // the link ends in this block, the rest is read in place
+            r->pos += next - s->carry_len;
+            s->carry_len = 0;
+            return COAP_SUCCESS;
+        }
+        if (rc != LINK_INCOMPLETE) {
+            return rc;
+        }
+        if (!all) {
+            return COAP_ERR_BUFFER_TOO_SMALL;
+        }
+        s->carry_len += n;
+        r->pos = r->len;
+        return COAP_RSP_WAIT;
+    }
+    r->pos = _skip_ws(r->p, r->len, r->pos);
+    if (r->pos >= r->len) {
+        return s->last ? COAP_RSP_RECV : COAP_RSP_WAIT;
+    }
+    rc = _scan_link(r->p, r->len, r->pos, s->last, link, &next);
+    if (rc == COAP_SUCCESS) {
+        r->pos = next;
+        return COAP_SUCCESS;
+    }
+    if (rc != LINK_INCOMPLETE) {
+        return rc;
+    }
+    if (r->len - r->pos > s->size) {
+        return COAP_ERR_BUFFER_TOO_SMALL;
+    }
+    s->carry_len = r->len - r->pos;
+    memcpy(s->carry, r->p + r->pos, s->carry_len);
+    r->pos = r->len;
+    return COAP_RSP_WAIT;
+}
+
+coap_state_t coap_link_stream_find(coap_link_stream_t *s,
+                                   const coap_link_filter_t *filters,
+                                   const size_t count, coap_link_t *link)
+{
+    coap_state_t rc;
+    while ((rc = coap_link_stream_next(s, link)) == COAP_SUCCESS) {
+        if (coap_link_match(link, filters, count)) {
+            return COAP_SUCCESS;
+        }
+    }
+    return rc;
+}
@@ -0,0 +1,189 @@
+#ifndef COAP_LINK_H
+#define COAP_LINK_H 1
+
+/**
+ * @file coap_link.h
+ *
+ * CoRE Link Format (RFC 6690) parser for discovery results, e.g. the payload
+ * of /.well-known/core. Links and their attributes are returned as views into
+ * the payload, nothing is copied. A streaming mode parses a document served
+ * block wise (Block2) as the blocks arrive, only a link split across two
+ * blocks is copied into a caller buffer. Filters select links by attribute
+ * as in the query filtering of RFC 6690 section 4.1, e.g. rt=temperature.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "coap.h"
+
+/**
+ * Link, views into the document
+ */
+typedef struct coap_link
+{
+    coap_buffer_t target;   //!< URI reference between < and >
+    coap_buffer_t params;   //!< link parameters behind >, see coap_link_attr_next
+} coap_link_t;
+
+/**
+ * Link parameter
+ */
+typedef struct coap_link_attr
+{
+    coap_buffer_t name;     //!< parameter name, e.g. rt
+    coap_buffer_t value;    //!< value without quotes, escapes kept, empty if none
+    bool quoted;            //!< value was a quoted string
+} coap_link_attr_t;
+
+/**
+ * Link filter, see coap_link_match
+ */
+typedef struct coap_link_filter
+{
+    const char *name;       //!< parameter name, or "href" for the target
+    const char *value;      //!< value, a trailing '*' matches a prefix, NULL
+                            //!< matches any link with the parameter
+} coap_link_filter_t;
+
+/**
+ * Reader over a complete document
+ */
+typedef struct coap_link_reader
+{
+    const uint8_t *p;       //!< document
+    size_t len;             //!< length of p
+    size_t pos;             //!< offset of the next link
+} coap_link_reader_t;
+
+/**
+ * Reader over a document arriving block wise
+ */
+typedef struct coap_link_stream
+{
+    coap_link_reader_t r;   //!< current block
+    bool last;              //!< r holds the last block
+    uint8_t *carry;         //!< link split across blocks
+    size_t size;            //!< size of carry
+    size_t carry_len;       //!< bytes in carry
+} coap_link_stream_t;
+
+/**
+ * @brief Start reading the document of \p len bytes at \p buf
+ */
+void coap_link_reader_init(coap_link_reader_t *r,
+                           const uint8_t *buf, const size_t len);
+
+/**
+ * @brief True if all links have been read
+ */
+bool coap_link_at_end(const coap_link_reader_t *r);
+
+/**
+ * @brief Read the next link
+ *
+ * Whitespace around the commas separating links is accepted.
+ *
+ * @param[in,out] r Reader
+ * @param[out] link Link
+ *
+ * @return 0 on success, COAP_ERR_OPTION_NOT_FOUND at the end of the document
+ * or COAP_ERR_PAYLOAD_INVALID if the link is malformed, the reader does not
+ * advance then
+ */
+coap_state_t coap_link_next(coap_link_reader_t *r, coap_link_t *link);
+
+/**
+ * @brief Read up to the next link matching all of \p count filters
+ *
+ * @return 0 on success, COAP_ERR_OPTION_NOT_FOUND if no further link matches
+ * or COAP_ERR_PAYLOAD_INVALID
+ */
+coap_state_t coap_link_find(coap_link_reader_t *r,
+                            const coap_link_filter_t *filters,
+                            const size_t count, coap_link_t *link);
+
+/**
+ * @brief Iterate the parameters of a link
+ *
+ * @param[in] link Link
+ * @param[in,out] pos Offset into link->params, 0 for the first parameter
+ * @param[out] attr Parameter
+ *
+ * @return 0 on success, or COAP_ERR_OPTION_NOT_FOUND behind the last one
+ */
+coap_state_t coap_link_attr_next(const coap_link_t *link, size_t *pos,
+                                 coap_link_attr_t *attr);
+
+/**
+ * @brief Find the first parameter named \p name
+ *
+ * @return 0 on success, or COAP_ERR_OPTION_NOT_FOUND
+ */
+coap_state_t coap_link_attr_find(const coap_link_t *link, const char *name,
+                                 coap_link_attr_t *attr);
+
+/**
+ * @brief Check a link against filters
+ *
+ * A filter matches if the link has a parameter \p name whose value equals
+ * \p value, or for quoted values holds it as one of its space separated
+ * values, as relation types like rt and if do. A trailing '*' in \p value
+ * matches any value starting with the part before it.
+ *
+ * @return True if all \p count filters match
+ */
+bool coap_link_match(const coap_link_t *link,
+                     const coap_link_filter_t *filters, const size_t count);
+
+/**
+ * @brief Start reading a document block wise
+ *
+ * @param[out] s Stream
+ * @param[in] carry Buffer for a link split across two blocks, at least as
+ * long as the longest link
+ * @param[in] size Size of \p carry
+ */
+void coap_link_stream_init(coap_link_stream_t *s, uint8_t *carry,
+                           const size_t size);
+
+/**
+ * @brief Pass the next block, after coap_link_stream_next asked for it
+ *
+ * @param[in,out] s Stream
+ * @param[in] block Block payload, e.g. rsppkt->payload.p
+ * @param[in] len Length of \p block
+ * @param[in] last No more blocks follow, i.e. the Block2 M bit is clear or
+ * the response had no Block2 option
+ */
+void coap_link_stream_feed(coap_link_stream_t *s, const uint8_t *block,
+                           const size_t len, const bool last);
+
+/**
+ * @brief Read the next link
+ *
+ * Links point into the current block, or into the carry buffer if the link
+ * was split; those stay valid until the next call.
+ *
+ * @return 0 on success, COAP_RSP_WAIT if the block is used up and the next
+ * one has to be fed, COAP_RSP_RECV at the end of the document,
+ * COAP_ERR_BUFFER_TOO_SMALL if a split link does not fit the carry buffer or
+ * COAP_ERR_PAYLOAD_INVALID
+ */
+coap_state_t coap_link_stream_next(coap_link_stream_t *s, coap_link_t *link);
+
+/**
+ * @brief Read up to the next link matching all of \p count filters
+ *
+ * @return As coap_link_stream_next
+ */
+coap_state_t coap_link_stream_find(coap_link_stream_t *s,
+                                   const coap_link_filter_t *filters,
+                                   const size_t count, coap_link_t *link);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,430 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE     // memfd_create, file seals
+#endif
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "coap.h"
+#include "coap_local.h"
+
+#define LOCAL_MAGIC     0x594c4331u     // "YLC1"
+#define LOCAL_FDS       4               // memory, eventfds of requests and responses, liveness
+
+#if COAP_LOCAL_SLOTS & (COAP_LOCAL_SLOTS - 1)
+#error "COAP_LOCAL_SLOTS must be a power of 2"
+#endif
+
+/* --- PRIVATE -------------------------------------------------------------- */
+static void _signal(const int fd)
+{
+    const uint64_t one = 1;
+    if (write(fd, &one, sizeof(one)) < 0) {
+        // the counter is at its maximum, the peer is woken anyway
+    }
+}
+
+static void _close(coap_local_channel_t *ch)
+{
+    munmap(ch->shm, sizeof(*ch->shm));
+    close(ch->memfd);
+    close(ch->rxfd);
+    close(ch->txfd);
+    close(ch->livefd);
+    ch->shm = NULL;
+}
+
+/* parse, dispatch and build, the same as for a UDP request */
+static bool _serve(coap_local_t *local, const uint8_t *in, const size_t inlen,
+                   uint8_t *out, size_t *outlen)
+{
+    coap_packet_t pkt, rsp;
+    const size_t size = *outlen;
+
+    if (coap_parse(in, inlen, &pkt) != COAP_SUCCESS) {
+        return false;
+    }
+    local->requests++;
+    coap_handle_request(local->resources, &pkt, &rsp);
+    if (coap_build(&rsp, out, outlen) != COAP_SUCCESS) {
+        coap_make_response(pkt.hdr.id, &pkt.tok, COAP_TYPE_ACK,
+                           COAP_RSPCODE_INTERNAL_SERVER_ERROR, NULL, NULL, 0, &rsp);
+        *outlen = size;
+        return coap_build(&rsp, out, outlen) == COAP_SUCCESS;
+    }
+    return true;
+}
+
+/* the memory a client handed over, checked before it is trusted with anything */
+static void _attach(coap_local_t *local, const int fds[LOCAL_FDS])
+{
+    struct stat st;
+    coap_local_channel_t *ch = NULL;
+    int type = 0;
+    socklen_t typelen = sizeof(type);
+
+    for (size_t i = 0; (i < local->max_channels) && !ch; ++i) {
+        ch = local->channels[i].shm ? NULL : &local->channels[i];
+    }
+    // sealed, so that it cannot shrink under the mapping and fault; anything
+    // but a memfd has no seals, -1
+    const int seals = fcntl(fds[0], F_GET_SEALS);
+    if (!ch || fstat(fds[0], &st) || (st.st_size < (off_t)sizeof(coap_local_shm_t)) ||
+        (seals < 0) || !(seals & F_SEAL_SHRINK) ||
+        (fcntl(fds[1], F_SETFL, O_NONBLOCK) < 0) || (fcntl(fds[2], F_SETFL, O_NONBLOCK) < 0) ||
+        // a connected socket hangs up when the client is gone, a datagram one never does
+        getsockopt(fds[3], SOL_SOCKET, SO_TYPE, &type, &typelen) || (type != SOCK_SEQPACKET)) {
+        goto refuse;
+    }
+    void *p = mmap(NULL, sizeof(coap_local_shm_t), PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+    if (p == MAP_FAILED) {
+        goto refuse;
+    }
+    ch->shm = p;
+    ch->memfd = fds[0];
+    ch->rxfd = fds[1];
+    ch->txfd = fds[2];
+    ch->livefd = fds[3];
+    ch->rx = &ch->shm->requests;
+    ch->tx = &ch->shm->responses;
+    if (ch->shm->magic != LOCAL_MAGIC) {
+        _close(ch);
+        local->refused++;
+        return;
+    }
+    local->attached++;
+    // requests may have been sent before
+    _signal(ch->rxfd);
+    return;
+refuse:
+    for (size_t i = 0; i < LOCAL_FDS; ++i) {
+        close(fds[i]);
+    }
+    local->refused++;
+}
+
+/* datagrams of the socket, requests and channels handed over */
+static void _receive(coap_local_t *local)
+{
+    uint8_t buf[COAP_LOCAL_DGRAM_SIZE], out[COAP_LOCAL_DGRAM_SIZE];
+    union {
+        struct cmsghdr hdr;
+        uint8_t buf[CMSG_SPACE(LOCAL_FDS * sizeof(int))];
+    } control;
+    struct sockaddr_un from;
+
+    for (;;) {
+        struct iovec iov = { buf, sizeof(buf) };
+        struct msghdr msg = {
+            .msg_name = &from, .msg_namelen = sizeof(from), .msg_iov = &iov, .msg_iovlen = 1,
+            .msg_control = control.buf, .msg_controllen = sizeof(control.buf)
+        };
+        const ssize_t n = recvmsg(local->fd, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+        if (n < 0) {
+            return;
+        }
+        const struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+        if (c && (c->cmsg_level == SOL_SOCKET) && (c->cmsg_type == SCM_RIGHTS)) {
+            int fds[LOCAL_FDS];
+            // the buffer is padded, it can take in more than LOCAL_FDS
+            const size_t nfds = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            if ((nfds == LOCAL_FDS) && !(msg.msg_flags & MSG_CTRUNC)) {
+                memcpy(fds, CMSG_DATA(c), sizeof(fds));
+                _attach(local, fds);
+                continue;
+            }
+            for (size_t i = 0; i < nfds; ++i) {
+                int fd;
+                memcpy(&fd, CMSG_DATA(c) + i * sizeof(int), sizeof(fd));
+                close(fd);
+            }
+            local->refused++;
+            continue;
+        }
+        size_t outlen = sizeof(out);
+        if (msg.msg_flags & MSG_TRUNC) {
+            local->dropped++;
+        }
+        // unbound clients cannot be answered
+        else if ((msg.msg_namelen > sizeof(sa_family_t)) &&
+                 _serve(local, buf, (size_t)n, out, &outlen)) {
+            sendto(local->fd, out, outlen, MSG_DONTWAIT, (struct sockaddr *)&from,
+                   msg.msg_namelen);
+        }
+    }
+}
+
+/* requests of a channel, answered in the slots of the responses */
+static void _channel(coap_local_t *local, coap_local_channel_t *ch)
+{
+    const uint8_t *in;
+    size_t len;
+
+    coap_local_wakeup(ch);
+    if (__atomic_load_n(&ch->shm->closed, __ATOMIC_ACQUIRE)) {
+        _close(ch);
+        return;
+    }
+    // a ring at a time, then the others get their turn
+    for (size_t i = 0; i < COAP_LOCAL_SLOTS; ++i) {
+        if (!(in = coap_local_peek(ch, &len))) {
+            return;
+        }
+        size_t outlen;
+        uint8_t *out = coap_local_reserve(ch, &outlen);
+        if (!out) {
+            local->dropped++;
+        }
+        else if (_serve(local, in, len, out, &outlen)) {
+            coap_local_commit(ch, outlen);
+        }
+        coap_local_release(ch);
+    }
+    _signal(ch->rxfd);
+}
+
+/* --- PUBLIC --------------------------------------------------------------- */
+int coap_local_socket(const char *path)
+{
+    struct sockaddr_un sun;
+    socklen_t len = sizeof(sa_family_t);
+
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    if (path) {
+        const size_t n = strlen(path);
+        if (n >= sizeof(sun.sun_path)) {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        memcpy(sun.sun_path, path, n);
+        len = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + n + 1);
+        unlink(path);
+    }
+    const int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    // without a path the kernel binds an abstract address, see unix(7)
+    if ((fd >= 0) && bind(fd, (struct sockaddr *)&sun, len)) {
+        const int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    return fd;
+}
+
+coap_state_t coap_local_init(coap_local_t *local, const int fd, coap_resource_t *resources,
+                             const size_t max_channels)
+{
+    memset(local, 0, sizeof(*local));
+    local->fd = fd;
+    local->resources = resources;
+    local->max_channels = max_channels;
+    local->channels = calloc(max_channels ? max_channels : 1, sizeof(*local->channels));
+    local->pollmap = malloc((2 * max_channels + 1) * sizeof(*local->pollmap));
+    if (!local->channels || !local->pollmap) {
+        coap_local_free(local);
+        return COAP_ERR_BUFFER_TOO_SMALL;
+    }
+    return COAP_SUCCESS;
+}
+
+void coap_local_free(coap_local_t *local)
+{
+    for (size_t i = 0; local->channels && (i < local->max_channels); ++i) {
+        if (local->channels[i].shm) {
+            _close(&local->channels[i]);
+        }
+    }
+    free(local->channels);
+    free(local->pollmap);
+    local->channels = NULL;
+    local->pollmap = NULL;
+    local->max_channels = 0;
+}
+
+size_t coap_local_pollfds(coap_local_t *local, struct pollfd *fds, const size_t size)
+{
+    size_t n = 0;
+    if (size) {
+        fds[0].fd = local->fd;
+        fds[0].events = POLLIN;
+        fds[0].revents = 0;
+        local->pollmap[n++] = -1;
+    }
+    for (size_t i = 0; (i < local->max_channels) && (n + 1 < size); ++i) {
+        if (!local->channels[i].shm) {
+            continue;
+        }
+        fds[n].fd = local->channels[i].rxfd;
+        fds[n].events = POLLIN;
+        fds[n].revents = 0;
+        local->pollmap[n++] = (int)i;
+        // only hangs up, the client never writes to it
+        fds[n].fd = local->channels[i].livefd;
+        fds[n].events = 0;
+        fds[n].revents = 0;
+        local->pollmap[n++] = (int)i;
+    }
+    return n;
+}
+
+void coap_local_process(coap_local_t *local, const struct pollfd *fds, const size_t nfds)
+{
+    for (size_t i = 0; i < nfds; ++i) {
+        if (!fds[i].revents) {
+            continue;
+        }
+        if (local->pollmap[i] < 0) {
+            _receive(local);
+            continue;
+        }
+        coap_local_channel_t *ch = &local->channels[local->pollmap[i]];
+        if (ch->shm && (ch->rxfd == fds[i].fd)) {
+            _channel(local, ch);
+        }
+        // exited or crashed without coap_local_channel_close
+        else if (ch->shm && (ch->livefd == fds[i].fd)) {
+            _close(ch);
+            local->lost++;
+        }
+    }
+}
+
+coap_state_t coap_local_channel_open(coap_local_channel_t *ch, const int fd,
+                                     const struct sockaddr *addr, const socklen_t addrlen)
+{
+    union {
+        struct cmsghdr hdr;
+        uint8_t buf[CMSG_SPACE(LOCAL_FDS * sizeof(int))];
+    } control;
+    int fds[LOCAL_FDS], live[2] = { -1, -1 };
+
+    memset(ch, 0, sizeof(*ch));
+    fds[0] = memfd_create("coap-local", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    fds[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    fds[2] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, live)) {
+        live[0] = live[1] = -1;
+    }
+    // the server gets one end, the other closes with the process
+    fds[3] = live[1];
+    ch->memfd = fds[0];
+    ch->txfd = fds[1];
+    ch->rxfd = fds[2];
+    ch->livefd = live[0];
+    void *p = MAP_FAILED;
+    if ((fds[0] >= 0) && (fds[1] >= 0) && (fds[2] >= 0) && (live[0] >= 0) &&
+        !ftruncate(fds[0], sizeof(coap_local_shm_t)) &&
+        !fcntl(fds[0], F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL)) {
+        p = mmap(NULL, sizeof(coap_local_shm_t), PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+    }
+    if (p == MAP_FAILED) {
+        for (size_t i = 0; i < LOCAL_FDS; ++i) {
+            if (fds[i] >= 0) {
+                close(fds[i]);
+            }
+        }
+        if (live[0] >= 0) {
+            close(live[0]);
+        }
+        return COAP_ERR_BUFFER_TOO_SMALL;
+    }
+    ch->shm = p;
+    ch->shm->magic = LOCAL_MAGIC;
+    ch->rx = &ch->shm->responses;
+    ch->tx = &ch->shm->requests;
+
+    // no payload, only the descriptors
+    struct iovec iov = { NULL, 0 };
+    struct msghdr msg = {
+        .msg_name = (void *)addr, .msg_namelen = addrlen, .msg_iov = &iov, .msg_iovlen = 1,
+        .msg_control = control.buf, .msg_controllen = sizeof(control.buf)
+    };
+    struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type = SCM_RIGHTS;
+    c->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(c), fds, sizeof(fds));
+    const ssize_t sent = sendmsg(fd, &msg, 0);
+    close(live[1]);
+    if (sent < 0) {
+        _close(ch);
+        return COAP_ERR_UNSUPPORTED;
+    }
+    return COAP_SUCCESS;
+}
+
+void coap_local_channel_close(coap_local_channel_t *ch)
+{
+    if (!ch->shm) {
+        return;
+    }
+    __atomic_store_n(&ch->shm->closed, 1, __ATOMIC_RELEASE);
+    _signal(ch->txfd);
+    _close(ch);
+}
+
+uint8_t *coap_local_reserve(coap_local_channel_t *ch, size_t *size)
+{
+    const uint32_t head = ch->tx->head;
+    const uint32_t tail = __atomic_load_n(&ch->tx->tail, __ATOMIC_ACQUIRE);
+
+    if (head - tail >= COAP_LOCAL_SLOTS) {
+        return NULL;
+    }
+    *size = COAP_LOCAL_DGRAM_SIZE;
+    return ch->tx->slots[head & (COAP_LOCAL_SLOTS - 1)].dgram;
+}
+
+void coap_local_commit(coap_local_channel_t *ch, const size_t len)
+{
+    const uint32_t head = ch->tx->head;
+
+    ch->tx->slots[head & (COAP_LOCAL_SLOTS - 1)].len = (uint32_t)len;
+    __atomic_store_n(&ch->tx->head, head + 1, __ATOMIC_RELEASE);
+    // against coap_local_release: either the peer sees the message before
+    // it sleeps, or it has taken all before and is woken
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ch->tx->tail, __ATOMIC_RELAXED) == head) {
+        _signal(ch->txfd);
+    }
+}
+
+const uint8_t *coap_local_peek(coap_local_channel_t *ch, size_t *len)
+{
+    const uint32_t tail = ch->rx->tail;
+    const uint32_t head = __atomic_load_n(&ch->rx->head, __ATOMIC_ACQUIRE);
+
+    // a peer that broke the ring only stalls its own channel
+    if ((head == tail) || (head - tail > COAP_LOCAL_SLOTS)) {
+        return NULL;
+    }
+    const coap_local_slot_t *slot = &ch->rx->slots[tail & (COAP_LOCAL_SLOTS - 1)];
+    const uint32_t n = __atomic_load_n(&slot->len, __ATOMIC_RELAXED);
+    *len = (n <= COAP_LOCAL_DGRAM_SIZE) ? n : 0;
+    return slot->dgram;
+}
+
+void coap_local_release(coap_local_channel_t *ch)
+{
+    __atomic_store_n(&ch->rx->tail, ch->rx->tail + 1, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void coap_local_wakeup(coap_local_channel_t *ch)
+{
+    uint64_t count;
+    if (read(ch->rxfd, &count, sizeof(count)) < 0) {
+        // nothing to consume, e.g. a message seen before the wakeup
+    }
+}
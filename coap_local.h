@@ -0,0 +1,229 @@
+#ifndef COAP_LOCAL_H
+#define COAP_LOCAL_H 1
+
+/**
+ * @file coap_local.h
+ *
+ * CoAP between processes of one host without the UDP stack. Two transports
+ * feed the same parse, dispatch and build as the UDP server, with the
+ * resource table shared:
+ *
+ * - Unix domain datagram sockets: one CoAP message per datagram, as over
+ *   UDP, responses go back to the address of the client, so clients bind
+ *   one, coap_local_socket(NULL) an abstract one of its own.
+ * - Shared memory channels: a client maps a memfd holding two single
+ *   producer, single consumer rings of datagram slots, requests and
+ *   responses, and hands it to the server over the socket with an eventfd
+ *   for each direction and one end of a socket pair, the other end staying
+ *   with the client. Requests are parsed where the client built them and
+ *   responses built into the slot the client reads them from; nothing is
+ *   copied and, while the peer is busy, nothing is a system call: an eventfd
+ *   is only written when the ring was empty before.
+ *
+ * The server runs in the poll loop of the application like the WebSocket
+ * server: poll the descriptors of coap_local_pollfds and pass them to
+ * coap_local_process. Channels are kept in a table allocated once by
+ * coap_local_init. Whoever may connect to the socket may use the resources:
+ * protect it with file permissions. The server trusts nothing in a channel,
+ * a client can only garble its own messages. A client that exits or crashes
+ * without coap_local_channel_close closes its end of the socket pair with
+ * the process, and the server frees the channel when its end hangs up;
+ * children forked by the client hold the end too, until they exit or exec.
+ *
+ * Not thread safe, but server and client of a channel may be threads of one
+ * process.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include "coap.h"
+
+#define COAP_LOCAL_DGRAM_SIZE   1152    //!< largest message, a 1024 byte block with options
+#ifndef COAP_LOCAL_SLOTS
+#define COAP_LOCAL_SLOTS        64      //!< messages in flight per direction, a power of 2
+#endif
+#define COAP_LOCAL_CACHELINE    64
+
+/**
+ * Message in a ring, private
+ */
+typedef struct coap_local_slot
+{
+    uint32_t len;
+    uint8_t dgram[COAP_LOCAL_DGRAM_SIZE];
+} coap_local_slot_t;
+
+/**
+ * Ring of one direction, private; head and tail count messages and are
+ * written by one side each, on cache lines of their own
+ */
+typedef struct coap_local_ring
+{
+    uint32_t head;          //!< written by the producer
+    uint8_t pad0[COAP_LOCAL_CACHELINE - sizeof(uint32_t)];
+    uint32_t tail;          //!< written by the consumer
+    uint8_t pad1[COAP_LOCAL_CACHELINE - sizeof(uint32_t)];
+    coap_local_slot_t slots[COAP_LOCAL_SLOTS];
+} coap_local_ring_t;
+
+/**
+ * Shared memory of a channel, private
+ */
+typedef struct coap_local_shm
+{
+    uint32_t magic;
+    uint32_t closed;        //!< set by the client when it leaves
+    uint8_t pad[COAP_LOCAL_CACHELINE - 2 * sizeof(uint32_t)];
+    coap_local_ring_t requests;
+    coap_local_ring_t responses;
+} coap_local_shm_t;
+
+/**
+ * Shared memory channel, one end
+ */
+typedef struct coap_local_channel
+{
+    coap_local_shm_t *shm;  //!< NULL if closed
+    int memfd;
+    int rxfd;               //!< eventfd, readable when rx has messages
+    int txfd;               //!< eventfd of the peer
+    int livefd;             //!< socket pair, the server's end hangs up with the client
+    coap_local_ring_t *rx;  //!< responses of a client, requests of the server
+    coap_local_ring_t *tx;
+} coap_local_channel_t;
+
+/**
+ * Local server
+ */
+typedef struct coap_local
+{
+    int fd;                 //!< Unix domain datagram socket
+    coap_resource_t *resources;
+    coap_local_channel_t *channels;
+    int *pollmap;           //!< channel of each poll entry, -1 for fd
+    size_t max_channels;
+    uint32_t requests;      //!< dispatched to the resources
+    uint32_t attached;      //!< channels handed over
+    uint32_t dropped;       //!< responses to full rings, messages too large
+    uint32_t refused;       //!< channels refused, the table was full or the memory bad
+    uint32_t lost;          //!< channels freed, the client was gone without closing
+} coap_local_t;
+
+/**
+ * @brief Open a Unix domain datagram socket, non-blocking
+ *
+ * @param[in] path File to bind to, replaced if it exists, or NULL for an
+ * abstract address chosen by the kernel, for clients
+ *
+ * @return The socket, or -1 with errno set
+ */
+int coap_local_socket(const char *path);
+
+/**
+ * @brief Set up a server
+ *
+ * @param[out] local Server
+ * @param[in] fd Socket of coap_local_socket
+ * @param[in] resources Resource table, shared with the UDP server
+ * @param[in] max_channels Concurrent shared memory channels, more are refused
+ *
+ * @return 0 on success, or COAP_ERR_BUFFER_TOO_SMALL if out of memory
+ */
+coap_state_t coap_local_init(coap_local_t *local, const int fd, coap_resource_t *resources,
+                             const size_t max_channels);
+
+/**
+ * @brief Close all channels and free the table, the socket stays open
+ */
+void coap_local_free(coap_local_t *local);
+
+/**
+ * @brief Descriptors to poll for
+ *
+ * @param[in,out] local Server, remembers the order for coap_local_process
+ * @param[out] fds Poll entries, 2 * max_channels + 1 always fit
+ * @param[in] size Entries in \p fds
+ *
+ * @return Entries used
+ */
+size_t coap_local_pollfds(coap_local_t *local, struct pollfd *fds, const size_t size);
+
+/**
+ * @brief Attach channels and answer the requests poll reported
+ *
+ * @param[in,out] local Server
+ * @param[in] fds Entries of the last coap_local_pollfds, with revents
+ * @param[in] nfds Number of \p fds
+ */
+void coap_local_process(coap_local_t *local, const struct pollfd *fds, const size_t nfds);
+
+/**
+ * @brief Open a shared memory channel to a server
+ *
+ * @param[out] ch Channel, client end
+ * @param[in] fd Socket of coap_local_socket(NULL)
+ * @param[in] addr Address of the server socket
+ * @param[in] addrlen Length of \p addr
+ *
+ * @return 0 on success, COAP_ERR_BUFFER_TOO_SMALL if the memory cannot be
+ * set up, or COAP_ERR_UNSUPPORTED if it cannot be handed over
+ */
+coap_state_t coap_local_channel_open(coap_local_channel_t *ch, const int fd,
+                                     const struct sockaddr *addr, const socklen_t addrlen);
+
+/**
+ * @brief Leave the channel, the server closes its end with the next wakeup
+ */
+void coap_local_channel_close(coap_local_channel_t *ch);
+
+/**
+ * @brief Free slot to build the next outgoing message in
+ *
+ * @param[in] ch Channel
+ * @param[out] size Size of the slot, COAP_LOCAL_DGRAM_SIZE
+ *
+ * @return The slot, or NULL if COAP_LOCAL_SLOTS messages wait for the peer
+ */
+uint8_t *coap_local_reserve(coap_local_channel_t *ch, size_t *size);
+
+/**
+ * @brief Pass the message built in the reserved slot to the peer
+ *
+ * @param[in] ch Channel
+ * @param[in] len Length of the message
+ */
+void coap_local_commit(coap_local_channel_t *ch, const size_t len);
+
+/**
+ * @brief Next incoming message, in place
+ *
+ * @param[in] ch Channel
+ * @param[out] len Length of the message
+ *
+ * @return The message, valid until coap_local_release, or NULL if none
+ */
+const uint8_t *coap_local_peek(coap_local_channel_t *ch, size_t *len);
+
+/**
+ * @brief Give the slot of the message of coap_local_peek back to the peer
+ */
+void coap_local_release(coap_local_channel_t *ch);
+
+/**
+ * @brief Consume the wakeup after poll reported ch->rxfd, then peek until NULL
+ */
+void coap_local_wakeup(coap_local_channel_t *ch);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
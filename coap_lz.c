@@ -0,0 +1,207 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "coap.h"
+#include "coap_lz.h"
+
+/* limits of the LZ4 block format */
+#define LZ_MINMATCH         4       //!< shortest match
+#define LZ_LASTLITERALS     5       //!< the last bytes are always literals
+#define LZ_MFLIMIT          12      //!< no match starts in the last bytes
+#define LZ_MAX_OFFSET       65535   //!< 16 bit match offset
+#define LZ_RUN_MASK         15      //!< length nibble, more bytes follow
+
+/* --- PRIVATE -------------------------------------------------------------- */
+static uint32_t _read32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t _hash(const uint32_t v)
+{
+    return (v * 2654435761u) >> (32 - COAP_LZ_HASH_LOG);
+}
+
+/* length beyond the nibble, as 255 255 ... rest */
+static uint8_t *_put_length(uint8_t *op, const uint8_t *oend, size_t len)
+{
+    for (; len >= 255; len -= 255) {
+        if (op >= oend) {
+            return NULL;
+        }
+        *op++ = 255;
+    }
+    if (op >= oend) {
+        return NULL;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+static bool _get_length(const uint8_t **ip, const uint8_t *iend, size_t *len)
+{
+    uint8_t b;
+    do {
+        if (*ip >= iend) {
+            return false;
+        }
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return true;
+}
+
+/*
+ * Writes a sequence of \p litlen literals and a match of \p matchlen bytes
+ * at \p offset back, or only the literals if \p matchlen is 0 for the last
+ * sequence. Returns the end of the output, NULL if it does not fit.
+ */
+static uint8_t *_put_sequence(uint8_t *op, const uint8_t *oend,
+                              const uint8_t *lit, const size_t litlen,
+                              const size_t offset, const size_t matchlen)
+{
+    uint8_t *token = op++;
+    if (token >= oend) {
+        return NULL;
+    }
+    *token = (uint8_t)(((litlen < LZ_RUN_MASK) ? litlen : LZ_RUN_MASK) << 4);
+    if ((litlen >= LZ_RUN_MASK) &&
+        !(op = _put_length(op, oend, litlen - LZ_RUN_MASK))) {
+        return NULL;
+    }
+    if ((size_t)(oend - op) < litlen) {
+        return NULL;
+    }
+    memcpy(op, lit, litlen);
+    op += litlen;
+    if (!matchlen) {
+        return op;
+    }
+    if (oend - op < 2) {
+        return NULL;
+    }
+    *op++ = offset & 0xFF;
+    *op++ = (offset >> 8) & 0xFF;
+    const size_t n = matchlen - LZ_MINMATCH;
+    *token |= (n < LZ_RUN_MASK) ? n : LZ_RUN_MASK;
+    if (n >= LZ_RUN_MASK) {
+        return _put_length(op, oend, n - LZ_RUN_MASK);
+    }
+    return op;
+}
+
+/* --- PUBLIC --------------------------------------------------------------- */
+size_t coap_lz_compress(const uint8_t *src, const size_t len,
+                        uint8_t *dst, const size_t size)
+{
+    uint32_t table[1 << COAP_LZ_HASH_LOG];
+    const uint8_t *ip = src, *anchor = src;
+    const uint8_t *iend = src + len;
+    uint8_t *op = dst;
+    const uint8_t *oend = dst + size;
+
+    if (len > LZ_MFLIMIT) {
+        const uint8_t *mflimit = iend - LZ_MFLIMIT;
+        const uint8_t *matchlimit = iend - LZ_LASTLITERALS;
+        // positions start at src, candidates are verified anyway
+        memset(table, 0, sizeof(table));
+        ip++;
+        while (ip < mflimit) {
+            const uint32_t seq = _read32(ip);
+            const uint32_t h = _hash(seq);
+            const uint8_t *ref = src + table[h];
+            table[h] = (uint32_t)(ip - src);
+            if ((ip - ref > LZ_MAX_OFFSET) || (ref >= ip) || (_read32(ref) != seq)) {
+                // skip faster through data that does not compress
+                ip += 1 + ((ip - anchor) >> 6);
+                continue;
+            }
+            while ((ip > anchor) && (ref > src) && (ip[-1] == ref[-1])) {
+                ip--;
+                ref--;
+            }
+            const uint8_t *end = ip + LZ_MINMATCH;
+            const uint8_t *r = ref + LZ_MINMATCH;
+            while ((end < matchlimit) && (*end == *r)) {
+                end++;
+                r++;
+            }
+            op = _put_sequence(op, oend, anchor, (size_t)(ip - anchor),
+                               (size_t)(ip - ref), (size_t)(end - ip));
+            if (!op) {
+                return 0;
+            }
+            ip = anchor = end;
+            // the position just before the match end often starts the next
+            if (ip - 2 < mflimit) {
+                table[_hash(_read32(ip - 2))] = (uint32_t)(ip - 2 - src);
+            }
+        }
+    }
+    op = _put_sequence(op, oend, anchor, (size_t)(iend - anchor), 0, 0);
+    return op ? (size_t)(op - dst) : 0;
+}
+
+coap_state_t coap_lz_decompress(const uint8_t *src, const size_t len,
+                                uint8_t *dst, const size_t size,
+                                size_t *outlen)
+{
+    const uint8_t *ip = src;
+    const uint8_t *iend = src + len;
+    uint8_t *op = dst;
+
+    if (!len) {
+        return COAP_ERR_PAYLOAD_INVALID;
+    }
+    while (ip < iend) {
+        const uint8_t token = *ip++;
+        size_t n = token >> 4;
+        if ((n == LZ_RUN_MASK) && !_get_length(&ip, iend, &n)) {
+            return COAP_ERR_PAYLOAD_INVALID;
+        }
+        if ((size_t)(iend - ip) < n) {
+            return COAP_ERR_PAYLOAD_INVALID;
+        }
+        if (size - (size_t)(op - dst) < n) {
+            return COAP_ERR_BUFFER_TOO_SMALL;
+        }
+        memcpy(op, ip, n);
+        op += n;
+        ip += n;
+        if (ip >= iend) {
+            break;      // the last sequence has no match
+        }
+        if (iend - ip < 2) {
+            return COAP_ERR_PAYLOAD_INVALID;
+        }
+        const size_t offset = ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        if (!offset || (offset > (size_t)(op - dst))) {
+            return COAP_ERR_PAYLOAD_INVALID;
+        }
+        n = token & LZ_RUN_MASK;
+        if ((n == LZ_RUN_MASK) && !_get_length(&ip, iend, &n)) {
+            return COAP_ERR_PAYLOAD_INVALID;
+        }
+        n += LZ_MINMATCH;
+        if (size - (size_t)(op - dst) < n) {
+            return COAP_ERR_BUFFER_TOO_SMALL;
+        }
+        const uint8_t *ref = op - offset;
+        if (offset >= n) {
+            memcpy(op, ref, n);
+            op += n;
+        }
+        else {
+            // overlapping match repeats the last offset bytes
+            while (n--) {
+                *op++ = *ref++;
+            }
+        }
+    }
+    *outlen = (size_t)(op - dst);
+    return COAP_SUCCESS;
+}
@@ -0,0 +1,82 @@
+#ifndef COAP_LZ_H
+#define COAP_LZ_H 1
+
+/**
+ * @file coap_lz.h
+ *
+ * Experimental content coding for large text payloads, e.g. link-format or
+ * JSON documents served block wise. Documents are compressed in the LZ4 block
+ * format, so that any LZ4 implementation decodes them, by a small bundled
+ * compressor without allocation. A compressed representation is meant to be
+ * made once, when the document is built or changes, and kept next to the
+ * plain one; handlers serve whichever the request accepts and never compress
+ * per request.
+ *
+ * The coded representations use private content formats from the
+ * experimental range of RFC 7252 section 12.3, COAP_CONTENTTYPE_LZ4_BASE plus
+ * the content format of the plain document.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "coap.h"
+
+#ifndef COAP_CONTENTTYPE_LZ4_BASE
+#define COAP_CONTENTTYPE_LZ4_BASE 65000 //!< first private content format
+#endif
+
+#define COAP_CONTENTTYPE_TXT_PLAIN_LZ4      (COAP_CONTENTTYPE_LZ4_BASE + COAP_CONTENTTYPE_TXT_PLAIN)
+#define COAP_CONTENTTYPE_APP_LINKFORMAT_LZ4 (COAP_CONTENTTYPE_LZ4_BASE + COAP_CONTENTTYPE_APP_LINKFORMAT)
+#define COAP_CONTENTTYPE_APP_JSON_LZ4       (COAP_CONTENTTYPE_LZ4_BASE + COAP_CONTENTTYPE_APP_JSON)
+
+#ifndef COAP_LZ_HASH_LOG
+#define COAP_LZ_HASH_LOG 12     //!< match finder of 2^n entries, 4 bytes each on the stack
+#endif
+
+/**
+ * @brief Worst case size of \p len bytes compressed, incompressible input
+ * grows by its literal length bytes and the final token
+ */
+#define COAP_LZ_BOUND(len)  ((len) + (len) / 255 + 16)
+
+/**
+ * @brief Compress \p len bytes at \p src
+ *
+ * Greedy matching with a hash table of the last position of each 4 byte
+ * sequence. Documents of repeated paths and attribute names typically
+ * shrink to a fifth or less, link-format discovery results to about a tenth.
+ *
+ * @param[in] src Document
+ * @param[in] len Length of \p src
+ * @param[out] dst Compressed document, COAP_LZ_BOUND(len) bytes always fit
+ * @param[in] size Size of \p dst
+ *
+ * @return Length of the compressed document, or 0 if it does not fit
+ */
+size_t coap_lz_compress(const uint8_t *src, const size_t len,
+                        uint8_t *dst, const size_t size);
+
+/**
+ * @brief Decompress an LZ4 block
+ *
+ * @param[in] src Compressed document, e.g. the reassembled Block2 payloads
+ * @param[in] len Length of \p src
+ * @param[out] dst Document
+ * @param[in] size Size of \p dst
+ * @param[out] outlen Length of the document
+ *
+ * @return 0 on success, COAP_ERR_BUFFER_TOO_SMALL if the document does not
+ * fit, or COAP_ERR_PAYLOAD_INVALID if \p src is malformed or refers to data
+ * before its start
+ */
+coap_state_t coap_lz_decompress(const uint8_t *src, const size_t len,
+                                uint8_t *dst, const size_t size,
+                                size_t *outlen);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,239 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE     // struct in6_pktinfo
+#endif
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "coap.h"
+#include "coap_mcast.h"
+
+#if COAP_MCAST_LEISURE_MS >= COAP_MCAST_SLOT_MS * (COAP_MCAST_WHEEL_SLOTS - 1)
+#error "COAP_MCAST_WHEEL_SLOTS do not span the default Leisure"
+#endif
+
+/* --- PRIVATE -------------------------------------------------------------- */
+static uint32_t _rand(coap_mcast_t *mcast)
+{
+    uint32_t x = mcast->rand;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    mcast->rand = x;
+    return x;
+}
+
+static inline uint32_t _slot(const uint32_t ms)
+{
+    return (ms / COAP_MCAST_SLOT_MS) & (COAP_MCAST_WHEEL_SLOTS - 1);
+}
+
+/* --- PUBLIC --------------------------------------------------------------- */
+coap_state_t coap_mcast_join(const int fd, const unsigned ifindex, const unsigned scope)
+{
+    struct sockaddr_storage local;
+    socklen_t len = sizeof(local);
+    const int on = 1;
+    int v6only = 0;
+    socklen_t optlen = sizeof(v6only);
+    struct ip_mreqn mreq;
+
+    if (getsockname(fd, (struct sockaddr *)&local, &len) ||
+        ((local.ss_family != AF_INET) && (local.ss_family != AF_INET6))) {
+        return COAP_ERR_UNSUPPORTED;
+    }
+    if (local.ss_family == AF_INET6) {
+        struct ipv6_mreq mreq6;
+        memset(&mreq6, 0, sizeof(mreq6));
+        mreq6.ipv6mr_multiaddr.s6_addr[0] = 0xff;
+        mreq6.ipv6mr_multiaddr.s6_addr[1] = (uint8_t)(scope & 0x0f);
+        mreq6.ipv6mr_multiaddr.s6_addr[15] = 0xfd;
+        mreq6.ipv6mr_interface = ifindex;
+        if (setsockopt(fd, IPPROTO_IPV6, IPV6_JOIN_GROUP, &mreq6, sizeof(mreq6)) ||
+            setsockopt(fd, IPPROTO_IPV6, IPV6_RECVPKTINFO, &on, sizeof(on))) {
+            return COAP_ERR_UNSUPPORTED;
+        }
+        getsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, &optlen);
+        if (v6only) {
+            return COAP_SUCCESS;
+        }
+    }
+    // IPv4, also on dual stack IPv6 sockets
+    memset(&mreq, 0, sizeof(mreq));
+    inet_pton(AF_INET, COAP_MCAST_IPV4, &mreq.imr_multiaddr);
+    mreq.imr_ifindex = (int)ifindex;
+    if (setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) ||
+        setsockopt(fd, IPPROTO_IP, IP_PKTINFO, &on, sizeof(on))) {
+        return COAP_ERR_UNSUPPORTED;
+    }
+    return COAP_SUCCESS;
+}
+
+ssize_t coap_mcast_recvfrom(const int fd, uint8_t *buf, const size_t size,
+                            struct sockaddr *addr, socklen_t *addrlen, bool *multicast)
+{
+    union {
+        struct cmsghdr hdr;
+        uint8_t buf[COAP_MCAST_CONTROL_SIZE];
+    } control;
+    struct iovec iov = { buf, size };
+    struct msghdr msg = {
+        .msg_name = addr, .msg_namelen = *addrlen, .msg_iov = &iov, .msg_iovlen = 1,
+        .msg_control = control.buf, .msg_controllen = sizeof(control.buf)
+    };
+
+    const ssize_t n = recvmsg(fd, &msg, 0);
+    *multicast = false;
+    if (n < 0) {
+        return n;
+    }
+    *addrlen = msg.msg_namelen;
+    *multicast = coap_mcast_destination(&msg);
+    return n;
+}
+
+bool coap_mcast_destination(const struct msghdr *msg)
+{
+    bool multicast = false;
+
+    for (struct cmsghdr *c = CMSG_FIRSTHDR(msg); c; c = CMSG_NXTHDR((struct msghdr *)msg, c)) {
+        if ((c->cmsg_level == IPPROTO_IP) && (c->cmsg_type == IP_PKTINFO)) {
+            struct in_pktinfo info;
+            memcpy(&info, CMSG_DATA(c), sizeof(info));
+            multicast |= IN_MULTICAST(ntohl(info.ipi_addr.s_addr));
+        }
+        else if ((c->cmsg_level == IPPROTO_IPV6) && (c->cmsg_type == IPV6_PKTINFO)) {
+            // IPv4 datagrams on dual stack sockets come IPv4 mapped
+            struct in6_pktinfo info;
+            uint32_t v4;
+            memcpy(&info, CMSG_DATA(c), sizeof(info));
+            memcpy(&v4, &info.ipi6_addr.s6_addr[12], sizeof(v4));
+            multicast |= IN6_IS_ADDR_MULTICAST(&info.ipi6_addr) ||
+                         (IN6_IS_ADDR_V4MAPPED(&info.ipi6_addr) && IN_MULTICAST(ntohl(v4)));
+        }
+    }
+    return multicast;
+}
+
+coap_state_t coap_mcast_init(coap_mcast_t *mcast, const int fd, const uint32_t leisure_ms,
+                             const uint32_t now, const uint32_t seed)
+{
+    memset(mcast, 0, sizeof(*mcast));
+    mcast->fd = fd;
+    mcast->leisure_ms = leisure_ms ? leisure_ms : COAP_MCAST_LEISURE_MS;
+    if (mcast->leisure_ms >= COAP_MCAST_SLOT_MS * (COAP_MCAST_WHEEL_SLOTS - 1)) {
+        return COAP_ERR_BUFFER_TOO_SMALL;
+    }
+    mcast->now = now;
+    mcast->rand = seed | 1;
+    mcast->msgid = (uint16_t)_rand(mcast);
+    for (size_t i = COAP_MCAST_PENDING; i--; ) {
+        mcast->pool[i].next = mcast->free;
+        mcast->free = &mcast->pool[i];
+    }
+    return COAP_SUCCESS;
+}
+
+coap_state_t coap_mcast_response(coap_mcast_t *mcast, const coap_packet_t *inpkt,
+                                 coap_packet_t *pkt)
+{
+    const uint8_t cls = pkt->hdr.code >> 5;
+
+    mcast->requests++;
+    // multicast requests are non-confirmable, and errors and nothing found
+    // are not worth the traffic of all servers
+    if ((inpkt->hdr.t == COAP_TYPE_CON) || (pkt->hdr.t == COAP_TYPE_RESET) ||
+        (pkt->hdr.code == 0) || (cls == 4) || (cls == 5) ||
+        ((pkt->hdr.code == COAP_RSPCODE_CONTENT) && !pkt->payload.len)) {
+        mcast->suppressed++;
+        return COAP_RSP_RECV;
+    }
+    pkt->hdr.t = COAP_TYPE_NONCON;
+    pkt->hdr.id = mcast->msgid++;
+    return COAP_RSP_SEND;
+}
+
+coap_state_t coap_mcast_delay(coap_mcast_t *mcast, const uint8_t *buf, const size_t len,
+                              const struct sockaddr *addr, const socklen_t addrlen,
+                              const uint32_t now)
+{
+    // the wheel spans the Leisure from the last tick
+    coap_mcast_tick(mcast, now);
+    coap_mcast_rsp_t *rsp = mcast->free;
+    if (!rsp || (len > sizeof(rsp->dgram)) || (addrlen > sizeof(rsp->addr))) {
+        mcast->dropped++;
+        return COAP_ERR_BUFFER_TOO_SMALL;
+    }
+    mcast->free = rsp->next;
+    rsp->due = now + _rand(mcast) % (mcast->leisure_ms + 1);
+    memcpy(&rsp->addr, addr, addrlen);
+    rsp->addrlen = addrlen;
+    memcpy(rsp->dgram, buf, len);
+    rsp->len = len;
+    coap_mcast_rsp_t **slot = &mcast->wheel[_slot(rsp->due)];
+    rsp->next = *slot;
+    *slot = rsp;
+    mcast->pending++;
+    return COAP_RSP_WAIT;
+}
+
+size_t coap_mcast_tick(coap_mcast_t *mcast, const uint32_t now)
+{
+    size_t sent = 0;
+
+    if ((int32_t)(now - mcast->now) < 0) {
+        return 0;
+    }
+    uint32_t steps = now / COAP_MCAST_SLOT_MS - mcast->now / COAP_MCAST_SLOT_MS;
+    if (steps >= COAP_MCAST_WHEEL_SLOTS) {
+        steps = COAP_MCAST_WHEEL_SLOTS - 1;
+    }
+    // the slot of the last tick again, it may hold responses due later in it
+    for (uint32_t i = 0; (i <= steps) && mcast->pending; ++i) {
+        const uint32_t slot = (_slot(now) - steps + i) & (COAP_MCAST_WHEEL_SLOTS - 1);
+        coap_mcast_rsp_t **p = &mcast->wheel[slot];
+        while (*p) {
+            coap_mcast_rsp_t *rsp = *p;
+            if ((int32_t)(rsp->due - now) > 0) {
+                p = &rsp->next;
+                continue;
+            }
+            sendto(mcast->fd, rsp->dgram, rsp->len, 0, (struct sockaddr *)&rsp->addr,
+                   rsp->addrlen);
+            *p = rsp->next;
+            rsp->next = mcast->free;
+            mcast->free = rsp;
+            mcast->pending--;
+            sent++;
+        }
+    }
+    mcast->now = now;
+    mcast->sent += (uint32_t)sent;
+    return sent;
+}
+
+int coap_mcast_timeout(const coap_mcast_t *mcast, const uint32_t now)
+{
+    if (!mcast->pending) {
+        return -1;
+    }
+    // all responses are due within a round from the last tick, the first
+    // slot holding any holds the next
+    for (uint32_t i = 0; i < COAP_MCAST_WHEEL_SLOTS; ++i) {
+        const coap_mcast_rsp_t *rsp = mcast->wheel[_slot(mcast->now + i * COAP_MCAST_SLOT_MS)];
+        if (!rsp) {
+            continue;
+        }
+        int32_t next = INT32_MAX;
+        for (; rsp; rsp = rsp->next) {
+            const int32_t left = (int32_t)(rsp->due - now);
+            next = (left < next) ? left : next;
+        }
+        return (next > 0) ? (int)next : 0;
+    }
+    return 0;
+}
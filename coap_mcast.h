@@ -0,0 +1,201 @@
+#ifndef COAP_MCAST_H
+#define COAP_MCAST_H 1
+
+/**
+ * @file coap_mcast.h
+ *
+ * Multicast requests to the server (RFC 7252 section 8), e.g. a discovery of
+ * /.well-known/core sent to all nodes at once. coap_mcast_join makes the
+ * server socket a member of the All CoAP Nodes groups, 224.0.1.187 and
+ * ff0X::fd of a scope, and coap_mcast_recvfrom tells from the packet info of
+ * a datagram whether it was sent to a group.
+ *
+ * Responses to multicast requests follow section 8.2: confirmable requests
+ * are ignored, so are responses without anything useful, errors and empty
+ * 2.05 Content, e.g. a discovery whose filter matches nothing; the others
+ * are sent non-confirmable and only after a random delay of up to the
+ * Leisure, so that the answers of many servers spread out instead of
+ * arriving at the client at once. Delayed responses wait built, in a pool
+ * allocated with the state, on a timer wheel driven by coap_mcast_tick.
+ *
+ * Not thread safe.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include "coap.h"
+
+#define COAP_MCAST_IPV4             "224.0.1.187"   //!< All CoAP Nodes, IPv4
+#define COAP_MCAST_SCOPE_LINK       2       //!< ff02::fd
+#define COAP_MCAST_SCOPE_REALM      3       //!< ff03::fd
+#define COAP_MCAST_SCOPE_ADMIN      4       //!< ff04::fd
+#define COAP_MCAST_SCOPE_SITE       5       //!< ff05::fd
+#define COAP_MCAST_LEISURE_MS       5000    //!< DEFAULT_LEISURE
+#ifndef COAP_MCAST_PENDING
+#define COAP_MCAST_PENDING          64      //!< responses waiting at a time
+#endif
+#define COAP_MCAST_SLOT_MS          16      //!< resolution of the delays
+#ifndef COAP_MCAST_WHEEL_SLOTS
+#define COAP_MCAST_WHEEL_SLOTS      512     //!< a power of 2, spanning the longest Leisure
+#endif
+#define COAP_MCAST_DGRAM_SIZE       1152    //!< largest response, a 1024 byte block with options
+/** packet info of either family, struct in_pktinfo and in6_pktinfo */
+#define COAP_MCAST_CONTROL_SIZE     (CMSG_SPACE(12) + CMSG_SPACE(20))
+
+/**
+ * Delayed response, private
+ */
+typedef struct coap_mcast_rsp
+{
+    struct coap_mcast_rsp *next;    //!< wheel slot or free list
+    uint32_t due;                   //!< ms
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+    size_t len;                     //!< of dgram
+    uint8_t dgram[COAP_MCAST_DGRAM_SIZE];
+} coap_mcast_rsp_t;
+
+/**
+ * Multicast state of a server socket
+ */
+typedef struct coap_mcast
+{
+    int fd;                         //!< server socket, responses are sent on it
+    uint32_t leisure_ms;            //!< longest delay
+    uint32_t now;                   //!< time of the last tick, ms
+    uint32_t rand;                  //!< xorshift state of the delays
+    uint16_t msgid;                 //!< of the non-confirmable responses
+    size_t pending;                 //!< responses waiting
+    coap_mcast_rsp_t *free;
+    coap_mcast_rsp_t *wheel[COAP_MCAST_WHEEL_SLOTS];   //!< responses by due time
+    coap_mcast_rsp_t pool[COAP_MCAST_PENDING];
+    uint32_t requests;              //!< multicast requests answered or not
+    uint32_t suppressed;            //!< of them not answered
+    uint32_t sent;                  //!< delayed responses sent
+    uint32_t dropped;               //!< responses dropped, the pool was full
+} coap_mcast_t;
+
+/**
+ * @brief Join the All CoAP Nodes groups on a server socket
+ *
+ * IPv4 sockets join 224.0.1.187. IPv6 sockets join ff0X::fd of \p scope and,
+ * unless IPv6 only, 224.0.1.187 for IPv4 mapped requests. The packet info
+ * coap_mcast_recvfrom needs is turned on.
+ *
+ * @param[in] fd Server socket, bound to the wildcard address and the port
+ * @param[in] ifindex Interface to join on, 0 lets the routing table choose
+ * @param[in] scope Scope of the IPv6 group, e.g. COAP_MCAST_SCOPE_LINK
+ *
+ * @return 0 on success, or COAP_ERR_UNSUPPORTED if the socket cannot join
+ */
+coap_state_t coap_mcast_join(const int fd, const unsigned ifindex, const unsigned scope);
+
+/**
+ * @brief Receive a datagram, like recvfrom, and whether it was multicast
+ *
+ * @param[in] fd Server socket, see coap_mcast_join
+ * @param[out] buf Datagram
+ * @param[in] size Size of \p buf
+ * @param[out] addr Source address
+ * @param[in,out] addrlen Size of \p addr, then length of the address
+ * @param[out] multicast Whether the destination was a multicast address
+ *
+ * @return Length of the datagram, or -1 with errno set
+ */
+ssize_t coap_mcast_recvfrom(const int fd, uint8_t *buf, const size_t size,
+                            struct sockaddr *addr, socklen_t *addrlen, bool *multicast);
+
+/**
+ * @brief Whether a datagram received with recvmsg was multicast
+ *
+ * For a receive of one's own that also takes other ancillary data, e.g. the
+ * stamps of coap_tstamp_delay, in a msg_control with COAP_MCAST_CONTROL_SIZE
+ * bytes for the packet info.
+ *
+ * @param[in] msg Message of recvmsg
+ *
+ * @return Whether the destination was a multicast address
+ */
+bool coap_mcast_destination(const struct msghdr *msg);
+
+/**
+ * @brief Set up the multicast state of a server socket
+ *
+ * @param[out] mcast Multicast state
+ * @param[in] fd Server socket
+ * @param[in] leisure_ms Longest delay of responses, 0 for COAP_MCAST_LEISURE_MS
+ * @param[in] now Current time in ms, see coap_mcast_tick
+ * @param[in] seed Random seed of the delays and message IDs
+ *
+ * @return 0 on success, or COAP_ERR_BUFFER_TOO_SMALL if the wheel does not
+ * span \p leisure_ms
+ */
+coap_state_t coap_mcast_init(coap_mcast_t *mcast, const int fd, const uint32_t leisure_ms,
+                             const uint32_t now, const uint32_t seed);
+
+/**
+ * @brief Decide on the response to a multicast request
+ *
+ * Responses to confirmable requests, errors, empty 2.05 Content and empty
+ * messages are suppressed. The others become non-confirmable with a message
+ * ID of \p mcast, piggybacked responses made by coap_handle_request included.
+ *
+ * @param[in,out] mcast Multicast state
+ * @param[in] inpkt Request, received by multicast
+ * @param[in,out] pkt Response
+ *
+ * @return COAP_RSP_SEND to delay \p pkt with coap_mcast_delay, or
+ * COAP_RSP_RECV if it is not sent
+ */
+coap_state_t coap_mcast_response(coap_mcast_t *mcast, const coap_packet_t *inpkt,
+                                 coap_packet_t *pkt);
+
+/**
+ * @brief Send a built response after a random delay within the Leisure
+ *
+ * @param[in,out] mcast Multicast state
+ * @param[in] buf Response datagram, copied
+ * @param[in] len Length of \p buf
+ * @param[in] addr Address of the client
+ * @param[in] addrlen Length of \p addr
+ * @param[in] now Current time in ms
+ *
+ * @return COAP_RSP_WAIT, or COAP_ERR_BUFFER_TOO_SMALL if the response is
+ * too large or COAP_MCAST_PENDING responses are waiting already
+ */
+coap_state_t coap_mcast_delay(coap_mcast_t *mcast, const uint8_t *buf, const size_t len,
+                              const struct sockaddr *addr, const socklen_t addrlen,
+                              const uint32_t now);
+
+/**
+ * @brief Advance the clock and send the responses due
+ *
+ * Call it whenever coap_mcast_timeout has passed, e.g. with a monotonic
+ * clock in ms; each COAP_MCAST_SLOT_MS passed costs one wheel slot.
+ *
+ * @param[in,out] mcast Multicast state
+ * @param[in] now Current time in ms
+ *
+ * @return Number of responses sent
+ */
+size_t coap_mcast_tick(coap_mcast_t *mcast, const uint32_t now);
+
+/**
+ * @brief Milliseconds until the next response is due, to poll for
+ *
+ * @return The time until the next call of coap_mcast_tick, -1 if no
+ * response is waiting
+ */
+int coap_mcast_timeout(const coap_mcast_t *mcast, const uint32_t now);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,405 @@
+#define _POSIX_C_SOURCE 200112L
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#include "coap.h"
+#include "coap_metrics.h"
+#include "coap_cbor.h"
+
+/**
+ * Counters of one thread, cache line aligned so that threads do not share
+ * lines. A thread that exits hands its shard, counts and all, over to the
+ * next thread that starts reporting. The last shard is shared by all
+ * threads beyond COAP_METRICS_MAX_SHARDS - 1 at a time, updates to it are
+ * atomic read-modify-writes.
+ */
+typedef struct coap_metrics_shard
+{
+    uint64_t counters[COAP_METRIC_MAX];
+    uint64_t errors[COAP_METRIC_ERR_MAX][COAP_METRICS_NUM_ERRORS];
+    uint64_t hist[COAP_HIST_MAX][COAP_METRICS_BUCKETS];
+    uint64_t hist_sum[COAP_HIST_MAX];
+    uint64_t gauges[COAP_GAUGE_MAX];        //!< deltas, in two's complement
+} __attribute__((aligned(64))) coap_metrics_shard_t;
+
+static coap_metrics_shard_t shards[COAP_METRICS_MAX_SHARDS];
+static bool owned[COAP_METRICS_MAX_SHARDS - 1];
+static unsigned nshards;
+static unsigned nshared;
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+static pthread_key_t key;
+static bool keyed;
+static __thread coap_metrics_shard_t *local;
+static __thread bool local_shared;
+
+const coap_resource_path_t coap_metrics_path = {2, {".well-known", "metrics"}};
+const coap_representations_t coap_metrics_representations = {
+    COAP_METRICS_REPRESENTATIONS,
+    {COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_TXT_PLAIN),
+     COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_APP_CBOR)},
+    {coap_metrics_handler, coap_metrics_handler}
+};
+
+#ifndef COAP_METRICS_BLOCK_SZX
+#define COAP_METRICS_BLOCK_SZX 5    //!< serve 512 byte blocks
+#endif
+
+static const char *counter_names[COAP_METRIC_MAX] = {
+    "yacoap_parsed_total",
+    "yacoap_built_total",
+    "yacoap_requests_total",
+    "yacoap_requests_not_found_total",
+    "yacoap_separate_acks_total",
+    "yacoap_requests_denied_total",
+    "yacoap_responses_2xx_total",
+    "yacoap_responses_4xx_total",
+    "yacoap_responses_5xx_total",
+    "yacoap_requests_shed_total",
+    "yacoap_retransmits_total",
+    "yacoap_cache_hits_total",
+    "yacoap_cache_misses_total",
+};
+
+static const char *gauge_names[COAP_GAUGE_MAX] = {
+    "yacoap_observers",
+    "yacoap_http_pool_open",
+    "yacoap_http_pool_busy",
+};
+
+static const char *hist_names[COAP_HIST_MAX] = {
+    "yacoap_handler_duration_ns",
+    "yacoap_kernel_to_user_ns",
+    "yacoap_user_to_send_ns",
+};
+
+static const char *error_sources[COAP_METRIC_ERR_MAX] = {
+    "parse",
+    "build",
+};
+
+static const char *error_names[COAP_METRICS_NUM_ERRORS] = {
+    "COAP_ERR",
+    "COAP_ERR_HEADER_TOO_SHORT",
+    "COAP_ERR_VERSION_NOT_1",
+    "COAP_ERR_TOKEN_TOO_SHORT",
+    "COAP_ERR_OPTION_TOO_SHORT_FOR_HEADER",
+    "COAP_ERR_OPTION_TOO_SHORT",
+    "COAP_ERR_OPTION_OVERRUNS_PACKET",
+    "COAP_ERR_OPTION_TOO_BIG",
+    "COAP_ERR_OPTION_LEN_INVALID",
+    "COAP_ERR_BUFFER_TOO_SMALL",
+    "COAP_ERR_UNSUPPORTED",
+    "COAP_ERR_OPTION_DELTA_INVALID",
+    "COAP_ERR_OPTION_NOT_FOUND",
+    "COAP_ERR_REQUEST_NOT_FOUND",
+    "COAP_ERR_REQUEST_MSGID_MISMATCH",
+    "COAP_ERR_REQUEST_TOKEN_MISMATCH",
+    "COAP_ERR_RESPONSE",
+    "COAP_ERR_PAYLOAD_INVALID",
+    "COAP_ERR_TIMEOUT",
+    "COAP_ERR_SECURITY_CONTEXT",
+    "COAP_ERR_REPLAY",
+    "COAP_ERR_DECRYPT",
+};
+
+/* --- PRIVATE -------------------------------------------------------------- */
+/* thread exit, the counts written so far go to the next owner */
+static void _release(void *shard)
+{
+    const coap_metrics_shard_t *sh = shard;
+
+    local = NULL;
+    __atomic_fetch_sub(&nshards, 1, __ATOMIC_RELAXED);
+    if (sh == &shards[COAP_METRICS_MAX_SHARDS - 1]) {
+        __atomic_fetch_sub(&nshared, 1, __ATOMIC_RELAXED);
+    }
+    else {
+        __atomic_store_n(&owned[sh - shards], false, __ATOMIC_RELEASE);
+    }
+}
+
+static void _key(void)
+{
+    keyed = !pthread_key_create(&key, _release);
+}
+
+/* a shard of its own if one is free, else the shared one */
+static coap_metrics_shard_t *_claim(void)
+{
+    for (unsigned i = 0; keyed && (i < COAP_METRICS_MAX_SHARDS - 1); ++i) {
+        bool taken = false;
+        if (!__atomic_load_n(&owned[i], __ATOMIC_RELAXED) &&
+            __atomic_compare_exchange_n(&owned[i], &taken, true, false,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            return &shards[i];
+        }
+    }
+    return &shards[COAP_METRICS_MAX_SHARDS - 1];
+}
+
+static coap_metrics_shard_t *_shard(void)
+{
+    if (!local) {
+        pthread_once(&once, _key);
+        local = _claim();
+        local_shared = (local == &shards[COAP_METRICS_MAX_SHARDS - 1]);
+        // counted while the thread lives, _release takes it back
+        if (keyed && !pthread_setspecific(key, local)) {
+            __atomic_fetch_add(&nshards, 1, __ATOMIC_RELAXED);
+            if (local_shared) {
+                __atomic_fetch_add(&nshared, 1, __ATOMIC_RELAXED);
+            }
+        }
+        else if (!local_shared) {
+            __atomic_store_n(&owned[local - shards], false, __ATOMIC_RELEASE);
+            local = &shards[COAP_METRICS_MAX_SHARDS - 1];
+            local_shared = true;
+        }
+    }
+    return local;
+}
+
+/* single writer per shard, a relaxed load and store is enough */
+static void _add(uint64_t *counter, const uint64_t n)
+{
+    if (local_shared) {
+        __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+    }
+    else {
+        __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + n,
+                         __ATOMIC_RELAXED);
+    }
+}
+
+static unsigned _bucket(const uint64_t value)
+{
+    unsigned b = value ? 64 - __builtin_clzll(value) : 0;
+    return (b < COAP_METRICS_BUCKETS) ? b : COAP_METRICS_BUCKETS - 1;
+}
+
+/* --- PUBLIC --------------------------------------------------------------- */
+void coap_metrics_add(const coap_metric_t id, const uint64_t n)
+{
+    _add(&_shard()->counters[id], n);
+}
+
+void coap_metrics_error(const coap_metric_err_t src, const coap_state_t state)
+{
+    if ((state >= COAP_ERR) && (state < COAP_ERR_MAX)) {
+        _add(&_shard()->errors[src][state - COAP_ERR], 1);
+    }
+}
+
+void coap_metrics_observe(const coap_hist_t hist, const uint64_t value)
+{
+    coap_metrics_shard_t *s = _shard();
+    _add(&s->hist[hist][_bucket(value)], 1);
+    _add(&s->hist_sum[hist], value);
+}
+
+void coap_metrics_gauge(const coap_gauge_t id, const int64_t delta)
+{
+    _add(&_shard()->gauges[id], (uint64_t)delta);
+}
+
+uint64_t coap_metrics_clock_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void coap_metrics_snapshot(coap_metrics_snapshot_t *snap)
+{
+    memset(snap, 0, sizeof(*snap));
+    snap->shards = __atomic_load_n(&nshards, __ATOMIC_RELAXED);
+    snap->shared = __atomic_load_n(&nshared, __ATOMIC_RELAXED);
+    for (unsigned s = 0; s < COAP_METRICS_MAX_SHARDS; ++s) {
+        const coap_metrics_shard_t *sh = &shards[s];
+        for (int i = 0; i < COAP_METRIC_MAX; ++i) {
+            snap->counters[i] += __atomic_load_n(&sh->counters[i], __ATOMIC_RELAXED);
+        }
+        for (int i = 0; i < COAP_METRIC_ERR_MAX; ++i) {
+            for (int j = 0; j < COAP_METRICS_NUM_ERRORS; ++j) {
+                snap->errors[i][j] += __atomic_load_n(&sh->errors[i][j], __ATOMIC_RELAXED);
+            }
+        }
+        for (int i = 0; i < COAP_HIST_MAX; ++i) {
+            for (int j = 0; j < COAP_METRICS_BUCKETS; ++j) {
+                snap->hist[i][j] += __atomic_load_n(&sh->hist[i][j], __ATOMIC_RELAXED);
+            }
+            snap->hist_sum[i] += __atomic_load_n(&sh->hist_sum[i], __ATOMIC_RELAXED);
+        }
+        // a level raised on one thread may be lowered on another
+        for (int i = 0; i < COAP_GAUGE_MAX; ++i) {
+            snap->gauges[i] = (int64_t)((uint64_t)snap->gauges[i] +
+                                        __atomic_load_n(&sh->gauges[i], __ATOMIC_RELAXED));
+        }
+    }
+}
+
+size_t coap_metrics_format_prometheus(const coap_metrics_snapshot_t *snap,
+                                      char *buf, const size_t buflen)
+{
+    size_t len = 0;
+    int n;
+#define _APPEND(...) do { \
+        n = snprintf(buf + len, buflen - len, __VA_ARGS__); \
+        if ((n < 0) || ((size_t)n >= buflen - len)) { \
+            return 0; \
+        } \
+        len += n; \
+    } while (0)
+
+    if (!buflen) {
+        return 0;
+    }
+    buf[0] = '\0';
+    for (int i = 0; i < COAP_METRIC_MAX; ++i) {
+        _APPEND("# TYPE %s counter\n%s %llu\n", counter_names[i],
+                counter_names[i], (unsigned long long)snap->counters[i]);
+    }
+    _APPEND("# TYPE yacoap_errors_total counter\n");
+    for (int i = 0; i < COAP_METRIC_ERR_MAX; ++i) {
+        for (int j = 0; j < COAP_METRICS_NUM_ERRORS; ++j) {
+            if (snap->errors[i][j]) {
+                _APPEND("yacoap_errors_total{source=\"%s\",state=\"%s\"} %llu\n",
+                        error_sources[i], error_names[j],
+                        (unsigned long long)snap->errors[i][j]);
+            }
+        }
+    }
+    for (int i = 0; i < COAP_HIST_MAX; ++i) {
+        uint64_t count = 0;
+        int last = 0;
+        for (int j = 0; j < COAP_METRICS_BUCKETS; ++j) {
+            if (snap->hist[i][j]) {
+                last = j;
+            }
+        }
+        _APPEND("# TYPE %s histogram\n", hist_names[i]);
+        // bucket j holds values below 2^j
+        for (int j = 0; j <= last; ++j) {
+            count += snap->hist[i][j];
+            _APPEND("%s_bucket{le=\"%llu\"} %llu\n", hist_names[i],
+                    (1ull << j) - 1, (unsigned long long)count);
+        }
+        _APPEND("%s_bucket{le=\"+Inf\"} %llu\n%s_sum %llu\n%s_count %llu\n",
+                hist_names[i], (unsigned long long)count,
+                hist_names[i], (unsigned long long)snap->hist_sum[i],
+                hist_names[i], (unsigned long long)count);
+    }
+    for (int i = 0; i < COAP_GAUGE_MAX; ++i) {
+        _APPEND("# TYPE %s gauge\n%s %lld\n", gauge_names[i],
+                gauge_names[i], (long long)snap->gauges[i]);
+    }
+    _APPEND("# TYPE yacoap_metrics_shards gauge\nyacoap_metrics_shards %u\n",
+            snap->shards);
+    _APPEND("# TYPE yacoap_metrics_shared gauge\nyacoap_metrics_shared %u\n",
+            snap->shared);
+#undef _APPEND
+    return len;
+}
+
+size_t coap_metrics_format_cbor(const coap_metrics_snapshot_t *snap,
+                                uint8_t *buf, const size_t buflen)
+{
+    coap_cbor_writer_t w;
+    coap_cbor_writer_init(&w, buf, buflen);
+    coap_cbor_put_map(&w, COAP_METRIC_MAX + 1 + COAP_HIST_MAX + COAP_GAUGE_MAX + 2);
+    for (int i = 0; i < COAP_METRIC_MAX; ++i) {
+        coap_cbor_put_text(&w, counter_names[i], strlen(counter_names[i]));
+        coap_cbor_put_uint(&w, snap->counters[i]);
+    }
+    coap_cbor_put_text(&w, "yacoap_errors_total", 19);
+    coap_cbor_put_map(&w, COAP_METRIC_ERR_MAX);
+    for (int i = 0; i < COAP_METRIC_ERR_MAX; ++i) {
+        uint64_t nonzero = 0;
+        for (int j = 0; j < COAP_METRICS_NUM_ERRORS; ++j) {
+            nonzero += (snap->errors[i][j] != 0);
+        }
+        coap_cbor_put_text(&w, error_sources[i], strlen(error_sources[i]));
+        coap_cbor_put_map(&w, nonzero);
+        for (int j = 0; j < COAP_METRICS_NUM_ERRORS; ++j) {
+            if (snap->errors[i][j]) {
+                coap_cbor_put_text(&w, error_names[j], strlen(error_names[j]));
+                coap_cbor_put_uint(&w, snap->errors[i][j]);
+            }
+        }
+    }
+    for (int i = 0; i < COAP_HIST_MAX; ++i) {
+        uint64_t count = 0;
+        int buckets = 0;
+        for (int j = 0; j < COAP_METRICS_BUCKETS; ++j) {
+            if (snap->hist[i][j]) {
+                buckets = j + 1;
+            }
+            count += snap->hist[i][j];
+        }
+        coap_cbor_put_text(&w, hist_names[i], strlen(hist_names[i]));
+        coap_cbor_put_map(&w, 3);
+        coap_cbor_put_text(&w, "buckets", 7);
+        coap_cbor_put_array(&w, buckets);
+        for (int j = 0; j < buckets; ++j) {
+            coap_cbor_put_uint(&w, snap->hist[i][j]);
+        }
+        coap_cbor_put_text(&w, "sum", 3);
+        coap_cbor_put_uint(&w, snap->hist_sum[i]);
+        coap_cbor_put_text(&w, "count", 5);
+        coap_cbor_put_uint(&w, count);
+    }
+    // a snapshot can catch a level lowered before it was raised
+    for (int i = 0; i < COAP_GAUGE_MAX; ++i) {
+        coap_cbor_put_text(&w, gauge_names[i], strlen(gauge_names[i]));
+        coap_cbor_put_uint(&w, (snap->gauges[i] > 0) ? (uint64_t)snap->gauges[i] : 0);
+    }
+    coap_cbor_put_text(&w, "yacoap_metrics_shards", 21);
+    coap_cbor_put_uint(&w, snap->shards);
+    coap_cbor_put_text(&w, "yacoap_metrics_shared", 21);
+    coap_cbor_put_uint(&w, snap->shared);
+    return (w.err == COAP_SUCCESS) ? w.pos : 0;
+}
+
+int coap_metrics_handler(const coap_resource_t *resource,
+                         const coap_packet_t *inpkt,
+                         coap_packet_t *pkt)
+{
+    // documents are kept per representation, so that text and CBOR clients
+    // reading block wise at the same time do not invalidate each other
+    static __thread uint8_t doc[COAP_METRICS_REPRESENTATIONS][COAP_METRICS_BUFLEN];
+    static __thread size_t doclen[COAP_METRICS_REPRESENTATIONS];
+    static __thread uint8_t scratch[4];
+    coap_block_t block;
+
+    const int rep = resource->reps ? coap_select_representation(resource, inpkt) : 0;
+    if ((rep < 0) || (rep >= COAP_METRICS_REPRESENTATIONS)) {
+        return coap_make_response(inpkt->hdr.id, &inpkt->tok,
+                                  COAP_TYPE_ACK, COAP_RSPCODE_NOT_ACCEPTABLE,
+                                  NULL, NULL, 0, pkt);
+    }
+    const bool cbor = (rep == 1);
+    if ((coap_get_block(inpkt, COAP_OPTION_BLOCK2, &block) != COAP_SUCCESS) ||
+        (block.num == 0) || !doclen[rep]) {
+        coap_metrics_snapshot_t snap;
+        coap_metrics_snapshot(&snap);
+        doclen[rep] = cbor ?
+            coap_metrics_format_cbor(&snap, doc[rep], sizeof(doc[rep])) :
+            coap_metrics_format_prometheus(&snap, (char *)doc[rep], sizeof(doc[rep]));
+        if (!doclen[rep]) {
+            return coap_make_response(inpkt->hdr.id, &inpkt->tok,
+                                      COAP_TYPE_ACK,
+                                      COAP_RSPCODE_INTERNAL_SERVER_ERROR,
+                                      NULL, NULL, 0, pkt);
+        }
+    }
+    coap_make_response(inpkt->hdr.id, &inpkt->tok,
+                       COAP_TYPE_ACK, COAP_RSPCODE_CONTENT,
+                       coap_metrics_representations.content_type[rep],
+                       doc[rep], doclen[rep], pkt);
+    return coap_make_block2(inpkt, COAP_METRICS_BLOCK_SZX, scratch, pkt);
+}
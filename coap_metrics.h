@@ -0,0 +1,206 @@
+#ifndef COAP_METRICS_H
+#define COAP_METRICS_H 1
+
+/**
+ * @file coap_metrics.h
+ *
+ * Runtime counters and histograms, compiled in with YACOAP_METRICS
+ * (make METRICS=1). Every thread updates its own shard, readers sum up all
+ * shards without stopping the writers. The shard of a thread that exits is
+ * taken over by the next thread, so threads can come and go; only threads
+ * beyond COAP_METRICS_MAX_SHARDS - 1 alive at the same time share one. The
+ * optional resource COAP_METRICS_RESOURCE serves them as Prometheus text
+ * format, or as CBOR with Accept: 60.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "coap.h"
+
+#ifndef COAP_METRICS_MAX_SHARDS
+#define COAP_METRICS_MAX_SHARDS 16  //!< shards, the last one shared by threads beyond
+#endif
+#ifndef COAP_METRICS_BUFLEN
+#define COAP_METRICS_BUFLEN 8192    //!< size of the serialised metrics
+#endif
+#define COAP_METRICS_BUCKETS 32     //!< log2 histogram buckets
+
+/**
+ * Counters
+ */
+typedef enum
+{
+    COAP_METRIC_PARSED              = 0,    //!< datagrams parsed
+    COAP_METRIC_BUILT,                      //!< datagrams built
+    COAP_METRIC_REQUESTS,                   //!< requests dispatched
+    COAP_METRIC_NOT_FOUND,                  //!< requests without resource
+    COAP_METRIC_SEPARATE_ACKS,              //!< empty ACKs for separate responses
+    COAP_METRIC_DENIED,                     //!< requests denied by the ACL
+    COAP_METRIC_RSP_2XX,                    //!< handler responses by class
+    COAP_METRIC_RSP_4XX,
+    COAP_METRIC_RSP_5XX,
+    COAP_METRIC_SHED,                       //!< requests shed on queueing delay
+    COAP_METRIC_RETRANSMITS,                //!< confirmable requests the client sent again
+    COAP_METRIC_CACHE_HIT,                  //!< gateway requests answered from the cache
+    COAP_METRIC_CACHE_MISS,                 //!< gateway requests waiting for the device
+    COAP_METRIC_MAX,    // this has to be the last counter
+} coap_metric_t;
+
+/**
+ * Histograms, in power of two buckets
+ */
+typedef enum
+{
+    COAP_HIST_HANDLER_NS            = 0,    //!< time spent in handlers
+    COAP_HIST_KERNEL_TO_USER_NS,            //!< time in the socket queue
+    COAP_HIST_USER_TO_SEND_NS,              //!< from the receive to the response sent
+    COAP_HIST_MAX,      // this has to be the last histogram
+} coap_hist_t;
+
+/**
+ * Gauges, levels that go up and down
+ */
+typedef enum
+{
+    COAP_GAUGE_OBSERVERS            = 0,    //!< client requests with an active observation
+    COAP_GAUGE_HTTP_POOL_OPEN,              //!< upstream HTTP connections open
+    COAP_GAUGE_HTTP_POOL_BUSY,              //!< of them connecting or carrying an exchange
+    COAP_GAUGE_MAX,     // this has to be the last gauge
+} coap_gauge_t;
+
+/**
+ * Errors by coap_state_t are counted per source
+ */
+typedef enum
+{
+    COAP_METRIC_ERR_PARSE           = 0,    //!< coap_parse failures
+    COAP_METRIC_ERR_BUILD,                  //!< coap_build failures
+    COAP_METRIC_ERR_MAX,
+} coap_metric_err_t;
+
+#define COAP_METRICS_NUM_ERRORS (COAP_ERR_MAX - COAP_ERR)
+
+/**
+ * Sum of all shards at one point in time
+ */
+typedef struct coap_metrics_snapshot
+{
+    uint64_t counters[COAP_METRIC_MAX];
+    uint64_t errors[COAP_METRIC_ERR_MAX][COAP_METRICS_NUM_ERRORS];
+    uint64_t hist[COAP_HIST_MAX][COAP_METRICS_BUCKETS];
+    uint64_t hist_sum[COAP_HIST_MAX];
+    int64_t gauges[COAP_GAUGE_MAX];
+    unsigned shards;                        //!< threads reporting, until they exit
+    unsigned shared;                        //!< of them on the shared shard
+} coap_metrics_snapshot_t;
+
+#if YACOAP_METRICS
+
+#define COAP_METRICS_INC(id)                coap_metrics_add((id), 1)
+#define COAP_METRICS_ERROR(src, state)      coap_metrics_error((src), (state))
+#define COAP_METRICS_OBSERVE(hist, value)   coap_metrics_observe((hist), (value))
+#define COAP_METRICS_GAUGE(id, delta)       coap_metrics_gauge((id), (delta))
+#define COAP_METRICS_CLOCK()                coap_metrics_clock_ns()
+
+#else /* YACOAP_METRICS */
+
+#define COAP_METRICS_INC(id)                do {} while (0)
+#define COAP_METRICS_ERROR(src, state)      do {} while (0)
+#define COAP_METRICS_OBSERVE(hist, value)   do {} while (0)
+#define COAP_METRICS_GAUGE(id, delta)       do {} while (0)
+#define COAP_METRICS_CLOCK()                (0)
+
+#endif /* YACOAP_METRICS */
+
+/**
+ * @brief Add \p n to counter \p id of the calling thread
+ */
+void coap_metrics_add(const coap_metric_t id, const uint64_t n);
+
+/**
+ * @brief Count an error, \p state is ignored unless it is an error code
+ */
+void coap_metrics_error(const coap_metric_err_t src, const coap_state_t state);
+
+/**
+ * @brief Add \p value to histogram \p hist of the calling thread
+ */
+void coap_metrics_observe(const coap_hist_t hist, const uint64_t value);
+
+/**
+ * @brief Move gauge \p id by \p delta, the level is the sum over all threads
+ */
+void coap_metrics_gauge(const coap_gauge_t id, const int64_t delta);
+
+/**
+ * @brief Monotonic clock in nanoseconds, for latency histograms
+ */
+uint64_t coap_metrics_clock_ns(void);
+
+/**
+ * @brief Sum up all shards
+ *
+ * Safe to call while other threads update their counters, each value is
+ * read atomically but the snapshot is not one consistent cut.
+ *
+ * @param[out] snap Pointer to the snapshot to fill
+ */
+void coap_metrics_snapshot(coap_metrics_snapshot_t *snap);
+
+/**
+ * @brief Serialise a snapshot in Prometheus text exposition format
+ *
+ * @param[in] snap Pointer to the snapshot
+ * @param[out] buf Char buffer the text is written to, NUL terminated
+ * @param[in] buflen Size of \p buf
+ *
+ * @return Length of the text, or 0 if \p buf is too small
+ */
+size_t coap_metrics_format_prometheus(const coap_metrics_snapshot_t *snap,
+                                      char *buf, const size_t buflen);
+
+/**
+ * @brief Serialise a snapshot as a CBOR map
+ *
+ * Counters and gauges map their name to the value, yacoap_errors_total maps each source
+ * to a map of state names and counts, histograms map to a map with "buckets"
+ * (counts below 2^i, up to the last non empty one), "sum" and "count".
+ *
+ * @return Length of the encoding, or 0 if \p buf is too small
+ */
+size_t coap_metrics_format_cbor(const coap_metrics_snapshot_t *snap,
+                                uint8_t *buf, const size_t buflen);
+
+/**
+ * @brief Resource handler serving the metrics, block wise if needed
+ *
+ * Serves both representations of coap_metrics_representations, text or with
+ * Accept: 60 CBOR; other Accept values are answered with 4.06. A snapshot is
+ * taken for the first block and kept per thread and representation, so that
+ * the following blocks of a Block2 transfer belong to the same document.
+ */
+int coap_metrics_handler(const coap_resource_t *resource,
+                         const coap_packet_t *inpkt,
+                         coap_packet_t *pkt);
+
+#define COAP_METRICS_REPRESENTATIONS 2  //!< text/plain and CBOR
+
+extern const coap_resource_path_t coap_metrics_path; //!< /.well-known/metrics
+extern const coap_representations_t coap_metrics_representations;
+
+/**
+ * Resource table entry of the metrics endpoint
+ */
+#define COAP_METRICS_RESOURCE \
+    {COAP_RDY, COAP_METHOD_GET, COAP_TYPE_ACK, \
+        coap_metrics_handler, &coap_metrics_path, \
+        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_TXT_PLAIN), \
+        &coap_metrics_representations}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,947 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "coap.h"
+#include "coap_cbor.h"
+#include "coap_oscore.h"
+#include "coap_sha256.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define OSCORE_AESNI 1
+#include <emmintrin.h>
+#include <wmmintrin.h>
+#else
+#define OSCORE_AESNI 0
+#endif
+
+#define OSCORE_FLAG_K       0x08    //!< kid present
+#define OSCORE_FLAG_H       0x10    //!< kid context present
+#define OSCORE_FLAG_N       0x07    //!< Partial IV length
+#define OSCORE_FLAG_RESERVED 0xE0
+#define OSCORE_MAX_OUTER    4       //!< class U options and Observe per message
+#define OSCORE_OUTER_SIZE   520     //!< their values
+#define OSCORE_AAD_SIZE     48
+#define OSCORE_INFO_SIZE    48
+
+/**
+ * Option kept in the outer message, value copied as the buffer is rewritten
+ */
+typedef struct oscore_outer
+{
+    uint16_t num;
+    uint16_t len;
+    uint16_t at;            //!< value in the copy buffer
+} oscore_outer_t;
+
+static const uint8_t aes_sbox[256] = {
+    0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+    0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+    0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+    0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+    0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+    0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+    0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+    0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+    0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+    0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+    0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+    0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+    0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+    0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+    0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+    0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16,
+};
+
+/* --- PRIVATE -------------------------------------------------------------- */
+static inline uint32_t _ror(const uint32_t x, const unsigned n)
+{
+    return (x >> n) | (x << (32 - n));
+}
+
+static inline uint8_t _xtime(const uint8_t x)
+{
+    return (uint8_t)((x << 1) ^ ((x >> 7) * 0x1b));
+}
+
+/* AES-128 key schedule, the same round key bytes for both implementations */
+static void _aes_expand(const uint8_t key[16], uint8_t rk[176])
+{
+    uint8_t rcon = 1;
+
+    memcpy(rk, key, 16);
+    for (size_t i = 16; i < 176; i += 4) {
+        uint8_t t[4] = { rk[i - 4], rk[i - 3], rk[i - 2], rk[i - 1] };
+        if (!(i % 16)) {
+            const uint8_t t0 = t[0];
+            t[0] = aes_sbox[t[1]] ^ rcon;
+            t[1] = aes_sbox[t[2]];
+            t[2] = aes_sbox[t[3]];
+            t[3] = aes_sbox[t0];
+            rcon = _xtime(rcon);
+        }
+        for (size_t j = 0; j < 4; ++j) {
+            rk[i + j] = rk[i - 16 + j] ^ t[j];
+        }
+    }
+}
+
+static inline uint32_t _load_le(const uint8_t *p)
+{
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static inline void _store_le(uint8_t *p, const uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+/* MixColumns of a column, row n in byte n */
+static inline uint32_t _mix(const uint32_t w)
+{
+    const uint32_t a = w ^ _ror(w, 8);
+    const uint32_t x = ((a & 0x7f7f7f7f) << 1) ^ (((a >> 7) & 0x01010101) * 0x1b);
+    return w ^ x ^ a ^ _ror(a, 16);
+}
+
+/* SubBytes and ShiftRows, column c of the result from the diagonal at c */
+static inline void _sub_shift(const uint8_t s[16], uint8_t t[16])
+{
+    for (int c = 0; c < 4; ++c) {
+        t[4 * c] = aes_sbox[s[4 * c]];
+        t[4 * c + 1] = aes_sbox[s[(4 * c + 5) & 15]];
+        t[4 * c + 2] = aes_sbox[s[(4 * c + 10) & 15]];
+        t[4 * c + 3] = aes_sbox[s[(4 * c + 15) & 15]];
+    }
+}
+
+static void _aes_encrypt(const uint8_t rk[176], uint8_t block[16])
+{
+    uint8_t s[16], t[16];
+
+    for (int i = 0; i < 16; ++i) {
+        s[i] = block[i] ^ rk[i];
+    }
+    for (int round = 1; round < 10; ++round) {
+        _sub_shift(s, t);
+        for (int c = 0; c < 4; ++c) {
+            _store_le(s + 4 * c, _mix(_load_le(t + 4 * c)) ^ _load_le(rk + 16 * round + 4 * c));
+        }
+    }
+    _sub_shift(s, t);
+    for (int i = 0; i < 16; ++i) {
+        block[i] = t[i] ^ rk[160 + i];
+    }
+}
+
+/* first CBC-MAC block B0 with M = 8, L = 2 and associated data, and A0 */
+static void _ccm_blocks(const uint8_t nonce[COAP_OSCORE_NONCE_SIZE], const size_t len,
+                        uint8_t b0[16], uint8_t a0[16])
+{
+    b0[0] = 0x40 | ((COAP_OSCORE_TAG_SIZE - 2) / 2) << 3 | (2 - 1);
+    memcpy(b0 + 1, nonce, COAP_OSCORE_NONCE_SIZE);
+    b0[14] = (uint8_t)(len >> 8);
+    b0[15] = (uint8_t)len;
+    a0[0] = 2 - 1;
+    memcpy(a0 + 1, nonce, COAP_OSCORE_NONCE_SIZE);
+    a0[14] = a0[15] = 0;
+}
+
+/* AES-CCM, \p data en- or decrypted in place and the tag before XOR with S0 in \p mac */
+static void _ccm_portable(const uint8_t rk[176], const uint8_t nonce[COAP_OSCORE_NONCE_SIZE],
+                          const uint8_t *aad, const size_t aadlen, uint8_t *data,
+                          const size_t len, const bool decrypt, uint8_t mac[COAP_OSCORE_TAG_SIZE])
+{
+    uint8_t x[16], a[16], s[16];
+
+    _ccm_blocks(nonce, len, x, a);
+    _aes_encrypt(rk, x);
+    // associated data with its 16 bit length, shorter than 0xff00 bytes
+    x[0] ^= (uint8_t)(aadlen >> 8);
+    x[1] ^= (uint8_t)aadlen;
+    for (size_t i = 0, pos = 2; i < aadlen; ++i) {
+        x[pos++] ^= aad[i];
+        if ((pos == 16) || (i + 1 == aadlen)) {
+            _aes_encrypt(rk, x);
+            pos = 0;
+        }
+    }
+    for (size_t off = 0, ctr = 1; off < len; off += 16, ++ctr) {
+        const size_t n = (len - off < 16) ? len - off : 16;
+        memcpy(s, a, 16);
+        s[14] = (uint8_t)(ctr >> 8);
+        s[15] = (uint8_t)ctr;
+        _aes_encrypt(rk, s);
+        for (size_t i = 0; i < n; ++i) {
+            const uint8_t m = decrypt ? data[off + i] ^ s[i] : data[off + i];
+            x[i] ^= m;
+            data[off + i] ^= s[i];
+        }
+        _aes_encrypt(rk, x);
+    }
+    _aes_encrypt(rk, a);
+    for (size_t i = 0; i < COAP_OSCORE_TAG_SIZE; ++i) {
+        mac[i] = x[i] ^ a[i];
+    }
+}
+
+#if OSCORE_AESNI
+#define OSCORE_TARGET __attribute__((target("aes,sse2")))
+
+static inline OSCORE_TARGET __attribute__((always_inline))
+__m128i _ni_load(const uint8_t *p, const size_t n)
+{
+    uint8_t tmp[16] = { 0 };
+    if (n == 16) {
+        return _mm_loadu_si128((const __m128i *)p);
+    }
+    memcpy(tmp, p, n);
+    return _mm_loadu_si128((const __m128i *)tmp);
+}
+
+static inline OSCORE_TARGET __attribute__((always_inline))
+void _ni_store(uint8_t *p, const __m128i v, const size_t n)
+{
+    uint8_t tmp[16];
+    if (n == 16) {
+        _mm_storeu_si128((__m128i *)p, v);
+        return;
+    }
+    _mm_storeu_si128((__m128i *)tmp, v);
+    memcpy(p, tmp, n);
+}
+
+static inline OSCORE_TARGET __attribute__((always_inline))
+__m128i _ni_encrypt(const __m128i rk[11], __m128i x)
+{
+    x = _mm_xor_si128(x, rk[0]);
+    for (int i = 1; i < 10; ++i) {
+        x = _mm_aesenc_si128(x, rk[i]);
+    }
+    return _mm_aesenclast_si128(x, rk[10]);
+}
+
+/* two independent blocks, so that the AES units overlap the CBC-MAC and CTR chains */
+static inline OSCORE_TARGET __attribute__((always_inline))
+void _ni_encrypt2(const __m128i rk[11], __m128i *x, __m128i *y)
+{
+    __m128i a = _mm_xor_si128(*x, rk[0]), b = _mm_xor_si128(*y, rk[0]);
+    for (int i = 1; i < 10; ++i) {
+        a = _mm_aesenc_si128(a, rk[i]);
+        b = _mm_aesenc_si128(b, rk[i]);
+    }
+    *x = _mm_aesenclast_si128(a, rk[10]);
+    *y = _mm_aesenclast_si128(b, rk[10]);
+}
+
+static OSCORE_TARGET
+void _ccm_aesni(const uint8_t rkb[176], const uint8_t nonce[COAP_OSCORE_NONCE_SIZE],
+                const uint8_t *aad, const size_t aadlen, uint8_t *data,
+                const size_t len, const bool decrypt, uint8_t mac[COAP_OSCORE_TAG_SIZE])
+{
+    uint8_t b0[16], a0[16], blk[16];
+    __m128i rk[11], x, s0, m = _mm_setzero_si128();
+    bool pending = false;
+
+    for (int i = 0; i < 11; ++i) {
+        rk[i] = _mm_load_si128((const __m128i *)(rkb + 16 * i));
+    }
+    _ccm_blocks(nonce, len, b0, a0);
+    x = _mm_loadu_si128((const __m128i *)b0);
+    s0 = _mm_loadu_si128((const __m128i *)a0);
+    _ni_encrypt2(rk, &x, &s0);
+    memset(blk, 0, sizeof(blk));
+    blk[0] = (uint8_t)(aadlen >> 8);
+    blk[1] = (uint8_t)aadlen;
+    for (size_t i = 0, pos = 2; i < aadlen; ++i) {
+        blk[pos++] = aad[i];
+        if ((pos == 16) || (i + 1 == aadlen)) {
+            x = _ni_encrypt(rk, _mm_xor_si128(x, _mm_loadu_si128((const __m128i *)blk)));
+            memset(blk, 0, sizeof(blk));
+            pos = 0;
+        }
+    }
+    for (size_t off = 0, ctr = 1; off < len; off += 16, ++ctr) {
+        const size_t n = (len - off < 16) ? len - off : 16;
+        a0[14] = (uint8_t)(ctr >> 8);
+        a0[15] = (uint8_t)ctr;
+        __m128i s = _mm_loadu_si128((const __m128i *)a0);
+        const __m128i in = _ni_load(data + off, n);
+        if (!decrypt) {
+            x = _mm_xor_si128(x, in);
+            _ni_encrypt2(rk, &x, &s);
+            _ni_store(data + off, _mm_xor_si128(in, s), n);
+            continue;
+        }
+        // the MAC of the previous plaintext block next to this key stream block
+        if (pending) {
+            x = _mm_xor_si128(x, m);
+            _ni_encrypt2(rk, &x, &s);
+        }
+        else {
+            s = _ni_encrypt(rk, s);
+        }
+        _ni_store(data + off, _mm_xor_si128(in, s), n);
+        m = _ni_load(data + off, n);
+        pending = true;
+    }
+    if (pending) {
+        x = _ni_encrypt(rk, _mm_xor_si128(x, m));
+    }
+    _ni_store(blk, _mm_xor_si128(x, s0), 16);
+    memcpy(mac, blk, COAP_OSCORE_TAG_SIZE);
+}
+#endif
+
+static bool _aesni_supported(void)
+{
+#if OSCORE_AESNI
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("aes") && __builtin_cpu_supports("sse2");
+#else
+    return false;
+#endif
+}
+
+static void _ccm(const coap_oscore_ctx_t *ctx, const uint8_t rk[176],
+                 const uint8_t nonce[COAP_OSCORE_NONCE_SIZE], const uint8_t *aad,
+                 const size_t aadlen, uint8_t *data, const size_t len, const bool decrypt,
+                 uint8_t mac[COAP_OSCORE_TAG_SIZE])
+{
+#if OSCORE_AESNI
+    if (ctx->aesni) {
+        _ccm_aesni(rk, nonce, aad, aadlen, data, len, decrypt, mac);
+        return;
+    }
+#else
+    (void) ctx;
+#endif
+    _ccm_portable(rk, nonce, aad, aadlen, data, len, decrypt, mac);
+}
+
+/* HKDF-SHA256 of an output up to 32 bytes with info [id, id_context, alg, type, L] */
+static coap_state_t _derive(const coap_oscore_params_t *params, const coap_hmac_sha256_t *prk,
+                            const coap_buffer_t *id, const char *type, const size_t outlen,
+                            uint8_t *out)
+{
+    uint8_t info[OSCORE_INFO_SIZE], okm[COAP_SHA256_SIZE];
+    coap_cbor_writer_t w;
+
+    coap_cbor_writer_init(&w, info, sizeof(info));
+    coap_cbor_put_array(&w, 5);
+    coap_cbor_put_bytes(&w, id->p, id->len);
+    if (params->id_context.p) {
+        coap_cbor_put_bytes(&w, params->id_context.p, params->id_context.len);
+    }
+    else {
+        coap_cbor_put_null(&w);
+    }
+    coap_cbor_put_uint(&w, COAP_OSCORE_ALG);
+    coap_cbor_put_text(&w, type, strlen(type));
+    coap_cbor_put_uint(&w, outlen);
+    if ((w.err != COAP_SUCCESS) || (w.pos == sizeof(info))) {
+        return COAP_ERR_SECURITY_CONTEXT;
+    }
+    info[w.pos] = 1;    // the block counter of HKDF-Expand
+    coap_hmac_sha256(prk, info, w.pos + 1, okm);
+    memcpy(out, okm, outlen);
+    return COAP_SUCCESS;
+}
+
+/* Enc_structure ["Encrypt0", h'', external_aad] of RFC 8613 section 5.4 */
+static size_t _aad(const uint8_t *kid, const size_t kidlen, const uint8_t *piv,
+                   const size_t pivlen, uint8_t aad[OSCORE_AAD_SIZE])
+{
+    uint8_t ext[OSCORE_AAD_SIZE];
+    coap_cbor_writer_t w;
+
+    coap_cbor_writer_init(&w, ext, sizeof(ext));
+    coap_cbor_put_array(&w, 5);
+    coap_cbor_put_uint(&w, 1);
+    coap_cbor_put_array(&w, 1);
+    coap_cbor_put_uint(&w, COAP_OSCORE_ALG);
+    coap_cbor_put_bytes(&w, kid, kidlen);
+    coap_cbor_put_bytes(&w, piv, pivlen);
+    coap_cbor_put_bytes(&w, ext, 0);
+    const size_t extlen = w.pos;
+    coap_cbor_writer_init(&w, aad, OSCORE_AAD_SIZE);
+    coap_cbor_put_array(&w, 3);
+    coap_cbor_put_text(&w, "Encrypt0", 8);
+    coap_cbor_put_bytes(&w, ext, 0);
+    coap_cbor_put_bytes(&w, ext, extlen);
+    return w.pos;
+}
+
+/* AEAD nonce of RFC 8613 section 5.2 */
+static void _nonce(const coap_oscore_ctx_t *ctx, const uint8_t *id, const size_t idlen,
+                   const uint8_t *piv, const size_t pivlen,
+                   uint8_t nonce[COAP_OSCORE_NONCE_SIZE])
+{
+    memset(nonce, 0, COAP_OSCORE_NONCE_SIZE);
+    nonce[0] = (uint8_t)idlen;
+    memcpy(nonce + 1 + COAP_OSCORE_MAX_ID - idlen, id, idlen);
+    memcpy(nonce + COAP_OSCORE_NONCE_SIZE - pivlen, piv, pivlen);
+    for (size_t i = 0; i < COAP_OSCORE_NONCE_SIZE; ++i) {
+        nonce[i] ^= ctx->common_iv[i];
+    }
+}
+
+/* sequence number in as few bytes as possible, 0 in one */
+static size_t _piv_encode(const uint64_t seq, uint8_t piv[COAP_OSCORE_MAX_PIV])
+{
+    size_t n = 1;
+    while ((n < COAP_OSCORE_MAX_PIV) && (seq >> (8 * n))) {
+        ++n;
+    }
+    for (size_t i = 0; i < n; ++i) {
+        piv[i] = (uint8_t)(seq >> (8 * (n - 1 - i)));
+    }
+    return n;
+}
+
+static uint64_t _piv_decode(const uint8_t *piv, const size_t pivlen)
+{
+    uint64_t seq = 0;
+    for (size_t i = 0; i < pivlen; ++i) {
+        seq = (seq << 8) | piv[i];
+    }
+    return seq;
+}
+
+static bool _replay_check(const coap_oscore_ctx_t *ctx, const uint64_t seq)
+{
+    if (!ctx->replay_init || (seq > ctx->replay_max)) {
+        return true;
+    }
+    const uint64_t behind = ctx->replay_max - seq;
+    return (behind < COAP_OSCORE_REPLAY_WINDOW) && !((ctx->replay_window >> behind) & 1);
+}
+
+static void _replay_update(coap_oscore_ctx_t *ctx, const uint64_t seq)
+{
+    if (!ctx->replay_init) {
+        ctx->replay_init = true;
+        ctx->replay_max = seq;
+        ctx->replay_window = 1;
+    }
+    else if (seq > ctx->replay_max) {
+        const uint64_t shift = seq - ctx->replay_max;
+        ctx->replay_window = (shift < COAP_OSCORE_REPLAY_WINDOW) ?
+                             (ctx->replay_window << shift) | 1 : 1;
+        ctx->replay_max = seq;
+    }
+    else {
+        ctx->replay_window |= UINT64_C(1) << (ctx->replay_max - seq);
+    }
+}
+
+/*
+ * Next option at \p off before \p end: returns 1 with \p off at its value and
+ * \p num advanced, 0 at the payload marker or the end, -1 if malformed.
+ */
+static int _next_option(const uint8_t *buf, const size_t end, size_t *off,
+                        uint32_t *num, size_t *vallen)
+{
+    size_t p = *off;
+    uint32_t v[2];
+
+    if ((p >= end) || (buf[p] == 0xFF)) {
+        return 0;
+    }
+    v[0] = buf[p] >> 4;
+    v[1] = buf[p] & 0x0F;
+    ++p;
+    for (int i = 0; i < 2; ++i) {
+        if (v[i] == 13) {
+            if (p + 1 > end) {
+                return -1;
+            }
+            v[i] = 13 + buf[p++];
+        }
+        else if (v[i] == 14) {
+            if (p + 2 > end) {
+                return -1;
+            }
+            v[i] = 269 + ((uint32_t)buf[p] << 8 | buf[p + 1]);
+            p += 2;
+        }
+        else if (v[i] == 15) {
+            return -1;
+        }
+    }
+    if ((end - p < v[1]) || (*num + v[0] > 0xFFFF)) {
+        return -1;
+    }
+    *num += v[0];
+    *vallen = v[1];
+    *off = p;
+    return 1;
+}
+
+static inline size_t _ext_size(const size_t v)
+{
+    return (v < 13) ? 0 : (v < 269) ? 1 : 2;
+}
+
+static inline size_t _option_size(const uint32_t delta, const size_t len)
+{
+    return 1 + _ext_size(delta) + _ext_size(len);
+}
+
+/* option header, returns its length */
+static size_t _put_option(uint8_t *p, const uint32_t delta, const size_t len)
+{
+    const size_t v[2] = { delta, len };
+    size_t n = 1;
+
+    p[0] = 0;
+    for (int i = 0; i < 2; ++i) {
+        const unsigned shift = i ? 0 : 4;
+        if (v[i] < 13) {
+            p[0] |= (uint8_t)(v[i] << shift);
+        }
+        else if (v[i] < 269) {
+            p[0] |= (uint8_t)(13 << shift);
+            p[n++] = (uint8_t)(v[i] - 13);
+        }
+        else {
+            p[0] |= (uint8_t)(14 << shift);
+            p[n++] = (uint8_t)((v[i] - 269) >> 8);
+            p[n++] = (uint8_t)(v[i] - 269);
+        }
+    }
+    return n;
+}
+
+static inline bool _is_class_u(const uint32_t num)
+{
+    return (num == COAP_OPTION_URI_HOST) || (num == COAP_OPTION_URI_PORT) ||
+           (num == COAP_OPTION_PROXY_SCHEME);
+}
+
+static bool _keep_outer(oscore_outer_t *outer, size_t *nouter, uint8_t *values,
+                        size_t *used, const uint32_t num, const uint8_t *val,
+                        const size_t len)
+{
+    if ((*nouter == OSCORE_MAX_OUTER) || (len > OSCORE_OUTER_SIZE - *used)) {
+        return false;
+    }
+    outer[*nouter].num = (uint16_t)num;
+    outer[*nouter].len = (uint16_t)len;
+    outer[*nouter].at = (uint16_t)*used;
+    memcpy(values + *used, val, len);
+    *used += len;
+    ++*nouter;
+    return true;
+}
+
+/* header and value of a kept outer option at \p w if it fits before \p limit */
+static bool _put_outer(uint8_t *buf, size_t *w, const size_t limit, uint32_t *last,
+                       const oscore_outer_t *o, const uint8_t *values)
+{
+    const size_t n = _option_size(o->num - *last, o->len) + o->len;
+    if (*w + n > limit) {
+        return false;
+    }
+    *w += _put_option(buf + *w, o->num - *last, o->len);
+    memcpy(buf + *w, values + o->at, o->len);
+    *w += o->len;
+    *last = o->num;
+    return true;
+}
+
+/* --- PUBLIC --------------------------------------------------------------- */
+coap_state_t coap_oscore_derive(coap_oscore_ctx_t *ctx, const coap_oscore_params_t *params)
+{
+    static const uint8_t none[1] = { 0 };
+    const coap_buffer_t empty = { none, 0 };
+    uint8_t prk[COAP_SHA256_SIZE];
+    coap_hmac_sha256_t mac;
+
+    if (!params->master_secret.p || !params->master_secret.len ||
+        (params->sender_id.len > COAP_OSCORE_MAX_ID) ||
+        (params->recipient_id.len > COAP_OSCORE_MAX_ID) ||
+        (params->id_context.p && (params->id_context.len > COAP_OSCORE_MAX_ID_CONTEXT))) {
+        return COAP_ERR_SECURITY_CONTEXT;
+    }
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->sender_idlen = (uint8_t)params->sender_id.len;
+    memcpy(ctx->sender_id, params->sender_id.len ? params->sender_id.p : none, ctx->sender_idlen);
+    ctx->recipient_idlen = (uint8_t)params->recipient_id.len;
+    memcpy(ctx->recipient_id, params->recipient_id.len ? params->recipient_id.p : none,
+           ctx->recipient_idlen);
+    if (params->id_context.p) {
+        ctx->has_id_context = true;
+        ctx->id_contextlen = (uint8_t)params->id_context.len;
+        memcpy(ctx->id_context, params->id_context.p, ctx->id_contextlen);
+    }
+    // HKDF-Extract, an empty salt is a key of zeros to HMAC
+    coap_hmac_sha256_init(&mac, params->master_salt.p ? params->master_salt.p : none,
+                          params->master_salt.len);
+    coap_hmac_sha256(&mac, params->master_secret.p, params->master_secret.len, prk);
+    coap_hmac_sha256_init(&mac, prk, sizeof(prk));
+    if ((_derive(params, &mac, params->sender_id.len ? &params->sender_id : &empty,
+                 "Key", COAP_OSCORE_KEY_SIZE, ctx->sender_key) != COAP_SUCCESS) ||
+        (_derive(params, &mac, params->recipient_id.len ? &params->recipient_id : &empty,
+                 "Key", COAP_OSCORE_KEY_SIZE, ctx->recipient_key) != COAP_SUCCESS) ||
+        (_derive(params, &mac, &empty, "IV", COAP_OSCORE_NONCE_SIZE,
+                 ctx->common_iv) != COAP_SUCCESS)) {
+        return COAP_ERR_SECURITY_CONTEXT;
+    }
+    _aes_expand(ctx->sender_key, ctx->sender_rk);
+    _aes_expand(ctx->recipient_key, ctx->recipient_rk);
+    ctx->aesni = _aesni_supported();
+    return COAP_SUCCESS;
+}
+
+coap_state_t coap_oscore_protect(coap_oscore_ctx_t *ctx, uint8_t *buf, size_t *len,
+                                 const size_t size, coap_oscore_request_t *request)
+{
+    uint8_t head[4 + COAP_MAX_TOKLEN], values[OSCORE_OUTER_SIZE];
+    uint8_t opt[1 + COAP_OSCORE_MAX_PIV + 1 + COAP_OSCORE_MAX_ID_CONTEXT + COAP_OSCORE_MAX_ID];
+    uint8_t piv[COAP_OSCORE_MAX_PIV], nonce[COAP_OSCORE_NONCE_SIZE], aad[OSCORE_AAD_SIZE];
+    oscore_outer_t outer[OSCORE_MAX_OUTER + 1];
+    coap_oscore_request_t own;
+    size_t nouter = 0, used = 0, pivlen = 0, optlen = 0, vallen;
+    uint32_t num = 0, last = 0;
+    bool observe = false;
+
+    if (*len < 4) {
+        return COAP_ERR_HEADER_TOO_SHORT;
+    }
+    if ((buf[0] >> 6) != 1) {
+        return COAP_ERR_VERSION_NOT_1;
+    }
+    const size_t tkl = buf[0] & 0x0F;
+    const uint8_t code = buf[1];
+    const bool is_request = !(code >> 5);
+    if ((tkl > COAP_MAX_TOKLEN) || (*len < 4 + tkl)) {
+        return COAP_ERR_TOKEN_TOO_SHORT;
+    }
+    if (!code) {
+        return COAP_ERR_UNSUPPORTED;
+    }
+    if (!request) {
+        if (!is_request) {
+            return COAP_ERR_REQUEST_NOT_FOUND;
+        }
+        request = &own;
+    }
+    memcpy(head, buf, 4 + tkl);
+
+    // plaintext of code, class E options and payload to the front of buf
+    size_t r = 4 + tkl, w = 1;
+    buf[0] = code;
+    for (;;) {
+        const int rc = _next_option(buf, *len, &r, &num, &vallen);
+        if (rc < 0) {
+            return COAP_ERR_OPTION_LEN_INVALID;
+        }
+        if (!rc) {
+            break;
+        }
+        const size_t val = r;
+        r += vallen;
+        if ((num == COAP_OPTION_OSCORE) || (num == COAP_OPTION_PROXY_URI)) {
+            return COAP_ERR_UNSUPPORTED;
+        }
+        observe |= (num == COAP_OPTION_OBSERVE);
+        if (_is_class_u(num) || (num == COAP_OPTION_OBSERVE)) {
+            if (!_keep_outer(outer, &nouter, values, &used, num, buf + val, vallen)) {
+                return COAP_ERR_BUFFER_TOO_SMALL;
+            }
+            if (_is_class_u(num)) {
+                continue;
+            }
+        }
+        const size_t hdr = _option_size(num - last, vallen);
+        if (w + hdr > val) {
+            return COAP_ERR_BUFFER_TOO_SMALL;
+        }
+        memmove(buf + w + hdr, buf + val, vallen);
+        _put_option(buf + w, num - last, vallen);
+        w += hdr + vallen;
+        last = num;
+    }
+    if (r < *len) {
+        if (r + 1 == *len) {
+            return COAP_ERR_PAYLOAD_INVALID;
+        }
+        buf[w++] = 0xFF;
+        memmove(buf + w, buf + r + 1, *len - r - 1);
+        w += *len - r - 1;
+    }
+    const size_t ptlen = w;
+
+    // Partial IV for requests and notifications, kid and kid context for requests
+    if (is_request || observe) {
+        if (ctx->sender_seq > COAP_OSCORE_MAX_SEQ) {
+            return COAP_ERR_SECURITY_CONTEXT;
+        }
+        pivlen = _piv_encode(ctx->sender_seq++, piv);
+    }
+    uint8_t flags = (uint8_t)pivlen;
+    if (is_request) {
+        flags |= OSCORE_FLAG_K | (ctx->has_id_context ? OSCORE_FLAG_H : 0);
+    }
+    if (flags) {
+        opt[optlen++] = flags;
+        memcpy(opt + optlen, piv, pivlen);
+        optlen += pivlen;
+        if (flags & OSCORE_FLAG_H) {
+            opt[optlen++] = ctx->id_contextlen;
+            memcpy(opt + optlen, ctx->id_context, ctx->id_contextlen);
+            optlen += ctx->id_contextlen;
+        }
+        if (flags & OSCORE_FLAG_K) {
+            memcpy(opt + optlen, ctx->sender_id, ctx->sender_idlen);
+            optlen += ctx->sender_idlen;
+        }
+    }
+    if (is_request) {
+        request->kidlen = ctx->sender_idlen;
+        memcpy(request->kid, ctx->sender_id, ctx->sender_idlen);
+        request->pivlen = (uint8_t)pivlen;
+        memcpy(request->piv, piv, pivlen);
+    }
+
+    // the OSCORE option in order between the kept options
+    size_t at = 0;
+    while ((at < nouter) && (outer[at].num < COAP_OPTION_OSCORE)) {
+        ++at;
+    }
+    memmove(outer + at + 1, outer + at, (nouter - at) * sizeof(outer[0]));
+    outer[at].num = COAP_OPTION_OSCORE;
+    outer[at].len = (uint16_t)optlen;
+    outer[at].at = (uint16_t)used;
+    if (optlen > sizeof(values) - used) {
+        return COAP_ERR_BUFFER_TOO_SMALL;
+    }
+    memcpy(values + used, opt, optlen);
+    ++nouter;
+    size_t outerlen = 0;
+    last = 0;
+    for (size_t i = 0; i < nouter; ++i) {
+        outerlen += _option_size(outer[i].num - last, outer[i].len) + outer[i].len;
+        last = outer[i].num;
+    }
+    const size_t ct = 4 + tkl + outerlen + 1;
+    if (ct + ptlen + COAP_OSCORE_TAG_SIZE > size) {
+        return COAP_ERR_BUFFER_TOO_SMALL;
+    }
+    memmove(buf + ct, buf, ptlen);
+
+    // outer message, POST or FETCH for Observe, 2.04 Changed or 2.05 Content
+    memcpy(buf, head, 4 + tkl);
+    buf[1] = is_request ? (uint8_t)(observe ? 5 : COAP_METHOD_POST) :
+             (uint8_t)(observe ? COAP_RSPCODE_CONTENT : COAP_RSPCODE_CHANGED);
+    w = 4 + tkl;
+    last = 0;
+    for (size_t i = 0; i < nouter; ++i) {
+        _put_outer(buf, &w, ct, &last, &outer[i], values);
+    }
+    buf[w] = 0xFF;
+
+    const coap_oscore_request_t *bound = request;
+    const size_t aadlen = _aad(bound->kid, bound->kidlen, bound->piv, bound->pivlen, aad);
+    if (pivlen) {
+        _nonce(ctx, ctx->sender_id, ctx->sender_idlen, piv, pivlen, nonce);
+    }
+    else {
+        _nonce(ctx, bound->kid, bound->kidlen, bound->piv, bound->pivlen, nonce);
+    }
+    _ccm(ctx, ctx->sender_rk, nonce, aad, aadlen, buf + ct, ptlen, false, buf + ct + ptlen);
+    *len = ct + ptlen + COAP_OSCORE_TAG_SIZE;
+    return COAP_SUCCESS;
+}
+
+coap_state_t coap_oscore_unprotect(coap_oscore_ctx_t *ctx, uint8_t *buf, size_t *len,
+                                   coap_oscore_request_t *request)
+{
+    uint8_t values[OSCORE_OUTER_SIZE], nonce[COAP_OSCORE_NONCE_SIZE], aad[OSCORE_AAD_SIZE];
+    uint8_t mac[COAP_OSCORE_TAG_SIZE];
+    oscore_outer_t outer[OSCORE_MAX_OUTER];
+    coap_oscore_request_t own;
+    size_t nouter = 0, used = 0, vallen, optat = 0, optlen = 0;
+    uint32_t num = 0;
+    bool found = false;
+
+    if (*len < 4) {
+        return COAP_ERR_HEADER_TOO_SHORT;
+    }
+    if ((buf[0] >> 6) != 1) {
+        return COAP_ERR_VERSION_NOT_1;
+    }
+    const size_t tkl = buf[0] & 0x0F;
+    const bool is_request = !(buf[1] >> 5);
+    if ((tkl > COAP_MAX_TOKLEN) || (*len < 4 + tkl)) {
+        return COAP_ERR_TOKEN_TOO_SHORT;
+    }
+    if (!request) {
+        if (!is_request) {
+            return COAP_ERR_REQUEST_NOT_FOUND;
+        }
+        request = &own;
+    }
+
+    // outer options, the class U ones are kept and the OSCORE option parsed
+    size_t r = 4 + tkl;
+    for (;;) {
+        const int rc = _next_option(buf, *len, &r, &num, &vallen);
+        if (rc < 0) {
+            return COAP_ERR_PAYLOAD_INVALID;
+        }
+        if (!rc) {
+            break;
+        }
+        if (num == COAP_OPTION_OSCORE) {
+            if (found) {
+                return COAP_ERR_PAYLOAD_INVALID;
+            }
+            found = true;
+            optat = r;
+            optlen = vallen;
+        }
+        else if (_is_class_u(num) &&
+                 !_keep_outer(outer, &nouter, values, &used, num, buf + r, vallen)) {
+            return COAP_ERR_PAYLOAD_INVALID;
+        }
+        r += vallen;
+    }
+    if (!found) {
+        return COAP_ERR_OPTION_NOT_FOUND;
+    }
+    if ((r == *len) || (*len - r - 1 < 1 + COAP_OSCORE_TAG_SIZE)) {
+        return COAP_ERR_PAYLOAD_INVALID;
+    }
+    const size_t ct = r + 1, ptlen = *len - ct - COAP_OSCORE_TAG_SIZE;
+
+    const uint8_t *opt = buf + optat, *piv = opt, *kid = opt, *kidctx = opt;
+    size_t pivlen = 0, kidlen = 0, kidctxlen = 0, p = 1;
+    const uint8_t flags = optlen ? opt[0] : 0;
+    if ((flags & OSCORE_FLAG_RESERVED) || ((flags & OSCORE_FLAG_N) > COAP_OSCORE_MAX_PIV) ||
+        (optlen && !flags)) {
+        return COAP_ERR_PAYLOAD_INVALID;
+    }
+    pivlen = flags & OSCORE_FLAG_N;
+    if (optlen && (p + pivlen > optlen)) {
+        return COAP_ERR_PAYLOAD_INVALID;
+    }
+    piv = opt + p;
+    p += pivlen;
+    if (flags & OSCORE_FLAG_H) {
+        if ((p >= optlen) || (p + 1 + opt[p] > optlen)) {
+            return COAP_ERR_PAYLOAD_INVALID;
+        }
+        kidctxlen = opt[p];
+        kidctx = opt + p + 1;
+        p += 1 + kidctxlen;
+    }
+    if (flags & OSCORE_FLAG_K) {
+        kid = opt + p;
+        kidlen = optlen - p;
+    }
+    else if (optlen && (p != optlen)) {
+        return COAP_ERR_PAYLOAD_INVALID;
+    }
+    const uint64_t seq = _piv_decode(piv, pivlen);
+
+    size_t aadlen;
+    if (is_request) {
+        if (!pivlen || !(flags & OSCORE_FLAG_K)) {
+            return COAP_ERR_PAYLOAD_INVALID;
+        }
+        if ((kidlen != ctx->recipient_idlen) || memcmp(kid, ctx->recipient_id, kidlen) ||
+            ((flags & OSCORE_FLAG_H) &&
+             (!ctx->has_id_context || (kidctxlen != ctx->id_contextlen) ||
+              memcmp(kidctx, ctx->id_context, kidctxlen)))) {
+            return COAP_ERR_SECURITY_CONTEXT;
+        }
+        if (!_replay_check(ctx, seq)) {
+            return COAP_ERR_REPLAY;
+        }
+        aadlen = _aad(kid, kidlen, piv, pivlen, aad);
+        _nonce(ctx, kid, kidlen, piv, pivlen, nonce);
+    }
+    else {
+        if (pivlen && !_replay_check(ctx, seq)) {
+            return COAP_ERR_REPLAY;
+        }
+        aadlen = _aad(request->kid, request->kidlen, request->piv, request->pivlen, aad);
+        if (pivlen) {
+            _nonce(ctx, ctx->recipient_id, ctx->recipient_idlen, piv, pivlen, nonce);
+        }
+        else {
+            _nonce(ctx, request->kid, request->kidlen, request->piv, request->pivlen, nonce);
+        }
+    }
+    if (is_request) {
+        // before decrypting in place, kid and piv are in the outer options
+        request->kidlen = (uint8_t)kidlen;
+        memcpy(request->kid, kid, kidlen);
+        request->pivlen = (uint8_t)pivlen;
+        memcpy(request->piv, piv, pivlen);
+    }
+    _ccm(ctx, ctx->recipient_rk, nonce, aad, aadlen, buf + ct, ptlen, true, mac);
+    uint8_t diff = 0;
+    for (size_t i = 0; i < COAP_OSCORE_TAG_SIZE; ++i) {
+        diff |= mac[i] ^ buf[ct + ptlen + i];
+    }
+    if (diff) {
+        return COAP_ERR_DECRYPT;
+    }
+    if (pivlen) {
+        _replay_update(ctx, seq);
+    }
+
+    // inner code, class E options merged with the kept class U options, payload
+    const size_t end = ct + ptlen;
+    if (!buf[ct]) {
+        return COAP_ERR_PAYLOAD_INVALID;
+    }
+    buf[1] = buf[ct];
+    size_t w = 4 + tkl, u = 0;
+    uint32_t last = 0;
+    r = ct + 1;
+    num = 0;
+    for (;;) {
+        const size_t start = r;
+        const int rc = _next_option(buf, end, &r, &num, &vallen);
+        if (rc < 0) {
+            return COAP_ERR_PAYLOAD_INVALID;
+        }
+        for (; (u < nouter) && (!rc || (outer[u].num <= num)); ++u) {
+            if (!_put_outer(buf, &w, start, &last, &outer[u], values)) {
+                return COAP_ERR_BUFFER_TOO_SMALL;
+            }
+        }
+        if (!rc) {
+            break;
+        }
+        if (_is_class_u(num) || (num == COAP_OPTION_OSCORE)) {
+            return COAP_ERR_PAYLOAD_INVALID;
+        }
+        const size_t hdr = _option_size(num - last, vallen);
+        if (w + hdr > r) {
+            return COAP_ERR_BUFFER_TOO_SMALL;
+        }
+        memmove(buf + w + hdr, buf + r, vallen);
+        _put_option(buf + w, num - last, vallen);
+        w += hdr + vallen;
+        r += vallen;
+        last = num;
+    }
+    if (r < end) {
+        if (r + 1 == end) {
+            return COAP_ERR_PAYLOAD_INVALID;
+        }
+        buf[w++] = 0xFF;
+        memmove(buf + w, buf + r + 1, end - r - 1);
+        w += end - r - 1;
+    }
+    *len = w;
+    return COAP_SUCCESS;
+}
@@ -0,0 +1,158 @@
+#ifndef COAP_OSCORE_H
+#define COAP_OSCORE_H 1
+
+/**
+ * @file coap_oscore.h
+ *
+ * Object Security for Constrained RESTful Environments (RFC 8613) with
+ * AES-CCM-16-64-128 and HKDF-SHA256, the mandatory algorithms. A message is
+ * protected and unprotected in place in its datagram buffer: the code, the
+ * options of class E and the payload are encrypted into the payload of an
+ * outer POST or 2.04 Changed message with the OSCORE option, the options of
+ * class U (Uri-Host, Uri-Port, Proxy-Scheme) stay outside for proxies. No
+ * other library is needed; AES runs on AES-NI where the processor has it,
+ * decided at run time, and on a portable implementation otherwise.
+ *
+ * A security context is derived once per peer from the master secret with
+ * coap_oscore_derive. Requests get the next sender sequence number as
+ * Partial IV, received requests are checked against a sliding replay window
+ * of the recipient. Responses reuse the nonce of their request, except
+ * Observe notifications, which carry a Partial IV of their own.
+ *
+ * Messages must not have the Proxy-Uri option, split it into Uri-Host,
+ * Uri-Port, Proxy-Scheme and the path and query options first (RFC 8613
+ * section 4.1.3.3).
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+
+#include "coap.h"
+
+#define COAP_OSCORE_ALG             10      //!< AES-CCM-16-64-128, COSE algorithm
+#define COAP_OSCORE_KEY_SIZE        16
+#define COAP_OSCORE_NONCE_SIZE      13
+#define COAP_OSCORE_TAG_SIZE        8
+#define COAP_OSCORE_MAX_ID          7       //!< nonce size - 6
+#define COAP_OSCORE_MAX_PIV         5
+#define COAP_OSCORE_MAX_SEQ         ((UINT64_C(1) << 40) - 1)
+#ifndef COAP_OSCORE_MAX_ID_CONTEXT
+#define COAP_OSCORE_MAX_ID_CONTEXT  16
+#endif
+#define COAP_OSCORE_REPLAY_WINDOW   64      //!< sequence numbers below the highest one
+/**
+ * @brief Bytes a protected message grows by at most: the OSCORE option, the
+ * payload marker, the code that is also encrypted and the tag
+ */
+#define COAP_OSCORE_OVERHEAD        (3 + 1 + COAP_OSCORE_MAX_PIV + 1 + \
+                                     COAP_OSCORE_MAX_ID_CONTEXT + COAP_OSCORE_MAX_ID + \
+                                     1 + 1 + COAP_OSCORE_TAG_SIZE)
+
+/**
+ * Input of coap_oscore_derive, buffers with a NULL pointer are absent
+ */
+typedef struct coap_oscore_params
+{
+    coap_buffer_t master_secret;
+    coap_buffer_t master_salt;  //!< empty by default
+    coap_buffer_t sender_id;    //!< up to COAP_OSCORE_MAX_ID bytes, may be empty
+    coap_buffer_t recipient_id; //!< up to COAP_OSCORE_MAX_ID bytes, may be empty
+    coap_buffer_t id_context;   //!< up to COAP_OSCORE_MAX_ID_CONTEXT bytes, optional
+} coap_oscore_params_t;
+
+/**
+ * Security context with a peer
+ */
+typedef struct coap_oscore_ctx
+{
+    uint8_t sender_id[COAP_OSCORE_MAX_ID];
+    uint8_t sender_idlen;
+    uint8_t recipient_id[COAP_OSCORE_MAX_ID];
+    uint8_t recipient_idlen;
+    uint8_t id_context[COAP_OSCORE_MAX_ID_CONTEXT];
+    uint8_t id_contextlen;
+    bool has_id_context;        //!< sent in the kid context of requests
+    bool aesni;                 //!< AES-NI in use, clear it to force the portable code
+    uint8_t sender_key[COAP_OSCORE_KEY_SIZE];
+    uint8_t recipient_key[COAP_OSCORE_KEY_SIZE];
+    uint8_t common_iv[COAP_OSCORE_NONCE_SIZE];
+    uint8_t sender_rk[176] __attribute__((aligned(16)));    //!< expanded sender key
+    uint8_t recipient_rk[176] __attribute__((aligned(16))); //!< expanded recipient key
+    uint64_t sender_seq;        //!< next Partial IV
+    uint64_t replay_max;        //!< highest sequence number received
+    uint64_t replay_window;     //!< bit n set if replay_max - n was received
+    bool replay_init;           //!< a sequence number was received
+} coap_oscore_ctx_t;
+
+/**
+ * Request a response is bound to, kid and Partial IV of the request
+ */
+typedef struct coap_oscore_request
+{
+    uint8_t kid[COAP_OSCORE_MAX_ID];
+    uint8_t kidlen;
+    uint8_t piv[COAP_OSCORE_MAX_PIV];
+    uint8_t pivlen;
+} coap_oscore_request_t;
+
+/**
+ * @brief Derive a security context (RFC 8613 section 3.2)
+ *
+ * @param[out] ctx Security context, sequence number and replay window reset
+ * @param[in] params Master secret, salt and identifiers
+ *
+ * @return 0 on success, or COAP_ERR_SECURITY_CONTEXT if an identifier is too
+ * long or the master secret is missing
+ */
+coap_state_t coap_oscore_derive(coap_oscore_ctx_t *ctx, const coap_oscore_params_t *params);
+
+/**
+ * @brief Protect a message in place
+ *
+ * @param[in,out] ctx Security context, the sequence number is used up by
+ * requests and notifications
+ * @param[in,out] buf Datagram, e.g. from coap_build
+ * @param[in,out] len Length of the message in \p buf, set to the length of
+ * the protected message
+ * @param[in] size Size of \p buf, \p len + COAP_OSCORE_OVERHEAD always fits
+ * @param[in,out] request Set for a request to bind its response to, the
+ * request of a response
+ *
+ * @return 0 on success, COAP_ERR_BUFFER_TOO_SMALL if the protected message
+ * does not fit, COAP_ERR_UNSUPPORTED for Proxy-Uri, empty or already
+ * protected messages, COAP_ERR_SECURITY_CONTEXT if the sequence numbers are
+ * used up, or the error of parsing the message
+ */
+coap_state_t coap_oscore_protect(coap_oscore_ctx_t *ctx, uint8_t *buf, size_t *len,
+                                 const size_t size, coap_oscore_request_t *request);
+
+/**
+ * @brief Verify and decrypt a message in place
+ *
+ * The replay window is only updated once the message is authentic. The
+ * content of \p buf is undefined if this fails.
+ *
+ * @param[in,out] ctx Security context
+ * @param[in,out] buf Datagram
+ * @param[in,out] len Length of the message in \p buf, set to the length of
+ * the unprotected message for coap_parse
+ * @param[in,out] request Set for a request to protect its response with, the
+ * request of a response
+ *
+ * @return 0 on success, COAP_ERR_OPTION_NOT_FOUND without OSCORE option,
+ * COAP_ERR_SECURITY_CONTEXT if the kid or kid context is not the one of
+ * \p ctx, COAP_ERR_REPLAY for a sequence number received before or left
+ * behind by the replay window, COAP_ERR_DECRYPT if the tag does not match,
+ * or COAP_ERR_PAYLOAD_INVALID if the message is malformed
+ */
+coap_state_t coap_oscore_unprotect(coap_oscore_ctx_t *ctx, uint8_t *buf, size_t *len,
+                                   coap_oscore_request_t *request);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
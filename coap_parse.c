@@ -4,6 +4,8 @@
 #include <arpa/inet.h>
 
 #include "coap.h"
+#include "coap_trace.h"
+#include "coap_metrics.h"
 
 /* --- PRIVATE -------------------------------------------------------------- */
 static coap_state_t _parse_token(const uint8_t *buf,
@@ -12,13 +14,13 @@ static coap_state_t _parse_token(const uint8_t *buf,
 static coap_state_t _parse_header(const uint8_t *buf,
                                   const size_t buflen,
                                   coap_header_t *hdr);
-static coap_state_t _parse_options_payload(const uint8_t *buf,
-                                           const size_t buflen,
-                                           coap_packet_t *pkt);
-static coap_state_t _parse_option(const uint8_t **buf,
-                                  const size_t buflen,
-                                  coap_option_t *option,
-                                  uint16_t *running_delta);
+static inline coap_state_t _parse_options_payload(const uint8_t *p,
+                                                  const uint8_t *end,
+                                                  coap_packet_t *pkt);
+static inline coap_state_t _parse_option(const uint8_t **buf,
+                                         const size_t buflen,
+                                         coap_option_t *option,
+                                         uint16_t *running_delta);
 
 static coap_state_t _parse_header(const uint8_t *buf,
                                   const size_t buflen,
@@ -27,13 +29,12 @@ static coap_state_t _parse_header(const uint8_t *buf,
     if (buflen < sizeof(coap_raw_header_t)) {
         return COAP_ERR_HEADER_TOO_SHORT;
     }
-    coap_raw_header_t *r = (coap_raw_header_t*)buf;
-    /* parse header from raw buffer */
-    hdr->ver = r->hdr.ver;
-    hdr->t = r->hdr.t;
-    hdr->tkl = r->hdr.tkl;
-    hdr->code = r->hdr.code;
-    hdr->id = ntohs(r->hdr.id);
+    /* parse header from raw buffer, byte wise as buf may be unaligned */
+    hdr->ver = (buf[0] & 0xC0) >> 6;
+    hdr->t = (buf[0] & 0x30) >> 4;
+    hdr->tkl = buf[0] & 0x0F;
+    hdr->code = buf[1];
+    hdr->id = (buf[2] << 8) | buf[3];
     if (hdr->ver != 1) {
         return COAP_ERR_VERSION_NOT_1;
     }
@@ -60,14 +61,15 @@ static coap_state_t _parse_token(const uint8_t *buf,
     return COAP_SUCCESS;
 }
 
-static coap_state_t _parse_option(const uint8_t **buf,
-                                  const size_t buflen,
-                                  coap_option_t *option,
-                                  uint16_t *running_delta)
+static inline __attribute__((always_inline))
+coap_state_t _parse_option(const uint8_t **buf,
+                           const size_t buflen,
+                           coap_option_t *option,
+                           uint16_t *running_delta)
 {
     const uint8_t *p = *buf;
-    uint8_t headlen = 1;
-    uint16_t len, delta;
+    size_t headlen = 1;
+    uint32_t len, delta;
 
     if (buflen < headlen) {
         return COAP_ERR_OPTION_TOO_SHORT_FOR_HEADER;
@@ -75,73 +77,71 @@ static coap_state_t _parse_option(const uint8_t **buf,
     delta = (p[0] & 0xF0) >> 4;
     len = p[0] & 0x0F;
 
-    /* FIXME: untested and may be buggy */
+    /* extended delta and length follow the first byte in this order */
     if (delta == 13) {
-        headlen++;
-        if (buflen < headlen)
+        if (buflen < headlen + 1) {
             return COAP_ERR_OPTION_TOO_SHORT_FOR_HEADER;
-        delta = p[1] + 13;
-        p++;
+        }
+        delta = p[headlen] + 13;
+        headlen++;
     }
     else if (delta == 14) {
-        headlen += 2;
-        if (buflen < headlen) {
+        if (buflen < headlen + 2) {
             return COAP_ERR_OPTION_TOO_SHORT_FOR_HEADER;
         }
-        delta = ((p[1] << 8) | p[2]) + 269;
-        p+=2;
+        delta = ((p[headlen] << 8) | p[headlen + 1]) + 269;
+        headlen += 2;
     }
     else if (delta == 15) {
         return COAP_ERR_OPTION_DELTA_INVALID;
     }
 
     if (len == 13) {
-        headlen++;
-        if (buflen < headlen) {
+        if (buflen < headlen + 1) {
             return COAP_ERR_OPTION_TOO_SHORT_FOR_HEADER;
         }
-        len = p[1] + 13;
-        p++;
+        len = p[headlen] + 13;
+        headlen++;
     }
     else if (len == 14) {
-        headlen += 2;
-        if (buflen < headlen) {
+        if (buflen < headlen + 2) {
             return COAP_ERR_OPTION_TOO_SHORT_FOR_HEADER;
         }
-        len = ((p[1] << 8) | p[2]) + 269;
-        p += 2;
+        len = ((p[headlen] << 8) | p[headlen + 1]) + 269;
+        headlen += 2;
     }
     else if (len == 15) {
         return COAP_ERR_OPTION_LEN_INVALID;
     }
 
-    if ((p + 1 + len) > (*buf + buflen)) {
+    if (headlen + len > buflen) {
         return COAP_ERR_OPTION_TOO_BIG;
     }
+    /* option numbers are 16 bit, see RFC 7252 section 12.2 */
+    if (*running_delta + delta > 0xFFFF) {
+        return COAP_ERR_OPTION_DELTA_INVALID;
+    }
     /* set option header */
     option->num = delta + *running_delta;
-    option->buf.p = p+1;
+    option->buf.p = p + headlen;
     option->buf.len = len;
     /* advance buffer cursor */
-    *buf = p + 1 + len;
+    *buf = p + headlen + len;
     *running_delta += delta;
 
     return COAP_SUCCESS;
 }
 
-// http://tools.ietf.org/html/rfc7252#section-3.1
-static coap_state_t _parse_options_payload(const uint8_t *buf,
-                                           const size_t buflen,
-                                           coap_packet_t *pkt)
+// http://tools.ietf.org/html/rfc7252#section-3.1, from the end of the token on,
+// inlined with _parse_option into both parsers, it is the hot path
+static inline __attribute__((always_inline))
+coap_state_t _parse_options_payload(const uint8_t *p,
+                                    const uint8_t *end,
+                                    coap_packet_t *pkt)
 {
     size_t optionIndex = 0;
     uint16_t delta = 0;
-    const uint8_t *p = buf + sizeof(coap_raw_header_t) + pkt->hdr.tkl;
-    const uint8_t *end = buf + buflen;
     int rc;
-    if (p > end) {
-        return COAP_ERR_OPTION_OVERRUNS_PACKET;
-    }
 
     /* Note: 0xFF is payload marker */
     while ((optionIndex < COAP_MAX_OPTIONS) && (p < end) && (*p != 0xFF)) {
@@ -173,16 +173,94 @@ coap_state_t coap_parse(const uint8_t *buf,
     /* parse header, token, options, and payload */
     rc = _parse_header(buf, buflen, &pkt->hdr);
     if(rc) {
+        COAP_TRACE_PARSE(rc, (rc == COAP_ERR_HEADER_TOO_SHORT) ? 0 : pkt->hdr.id,
+                         (rc == COAP_ERR_HEADER_TOO_SHORT) ? 0 : pkt->hdr.code,
+                         buflen);
+        COAP_METRICS_ERROR(COAP_METRIC_ERR_PARSE, rc);
         return rc;
     }
     rc = _parse_token(buf, buflen, pkt);
     if(rc) {
+        COAP_TRACE_PARSE(rc, pkt->hdr.id, pkt->hdr.code, buflen);
+        COAP_METRICS_ERROR(COAP_METRIC_ERR_PARSE, rc);
         return rc;
     }
+    // the token fits, see _parse_token
     pkt->numopts = COAP_MAX_OPTIONS;
-    rc = _parse_options_payload(buf, buflen, pkt);
+    rc = _parse_options_payload(buf + sizeof(coap_raw_header_t) + pkt->hdr.tkl,
+                                buf + buflen, pkt);
+    COAP_TRACE_PARSE(rc, pkt->hdr.id, pkt->hdr.code, buflen);
     if(rc) {
+        COAP_METRICS_ERROR(COAP_METRIC_ERR_PARSE, rc);
+        return rc;
+    }
+    COAP_METRICS_INC(COAP_METRIC_PARSED);
+    return COAP_SUCCESS;
+}
+
+// https://tools.ietf.org/html/rfc8323#section-3.2
+coap_state_t coap_parse_tcp(const uint8_t *buf, const size_t buflen,
+                            const coap_framing_t framing, coap_packet_t *pkt,
+                            size_t *msglen)
+{
+    static const uint8_t extlen[16] = { [13] = 1, [14] = 2, [15] = 4 };
+    size_t len, head;
+    int rc;
+
+    *msglen = 0;
+    if (buflen < 2) {
+        return COAP_ERR_HEADER_TOO_SHORT;
+    }
+    len = buf[0] >> 4;
+    head = 2 + extlen[len];
+    if (buflen < head) {
+        return COAP_ERR_HEADER_TOO_SHORT;
+    }
+    pkt->hdr.ver = COAP_VERSION;
+    pkt->hdr.t = COAP_TYPE_NONCON;
+    pkt->hdr.tkl = buf[0] & 0x0F;
+    pkt->hdr.code = buf[head - 1];
+    pkt->hdr.id = 0;
+    if (framing == COAP_FRAMING_WS) {
+        // the frame has the length, https://tools.ietf.org/html/rfc8323#section-4.4
+        rc = len ? COAP_ERR_UNSUPPORTED :
+             (buflen < head + pkt->hdr.tkl) ? COAP_ERR_TOKEN_TOO_SHORT : COAP_SUCCESS;
+        len = buflen - head - pkt->hdr.tkl;
+    }
+    else {
+        if (len == 13) {
+            len = buf[1] + 13;
+        }
+        else if (len == 14) {
+            len = ((buf[1] << 8) | buf[2]) + 269;
+        }
+        else if (len == 15) {
+            len = ((size_t)buf[1] << 24 | (size_t)buf[2] << 16 | (size_t)buf[3] << 8 | buf[4]) +
+                  65805;
+        }
+        rc = COAP_SUCCESS;
+    }
+    if ((rc == COAP_SUCCESS) && (pkt->hdr.tkl > 8)) {
+        rc = COAP_ERR_TOKEN_TOO_SHORT;
+    }
+    if (rc) {
+        COAP_TRACE_PARSE(rc, 0, pkt->hdr.code, buflen);
+        COAP_METRICS_ERROR(COAP_METRIC_ERR_PARSE, rc);
+        return rc;
+    }
+    *msglen = head + pkt->hdr.tkl + len;
+    if (buflen < *msglen) {
+        return COAP_ERR_HEADER_TOO_SHORT;   // not all there yet
+    }
+    pkt->tok.len = pkt->hdr.tkl;
+    pkt->tok.p = pkt->hdr.tkl ? buf + head : NULL;
+    pkt->numopts = COAP_MAX_OPTIONS;
+    rc = _parse_options_payload(buf + head + pkt->hdr.tkl, buf + *msglen, pkt);
+    COAP_TRACE_PARSE(rc, 0, pkt->hdr.code, *msglen);
+    if (rc) {
+        COAP_METRICS_ERROR(COAP_METRIC_ERR_PARSE, rc);
         return rc;
     }
+    COAP_METRICS_INC(COAP_METRIC_PARSED);
     return COAP_SUCCESS;
 }
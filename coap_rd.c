@@ -0,0 +1,1181 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "coap.h"
+#include "coap_link.h"
+#include "coap_rd.h"
+
+#define RD_NO_LINK          UINT32_MAX  //!< posting of a registration attribute
+#define RD_KEY_EMPTY        0           //!< unused index slot
+#define RD_KEY_DELETED      1           //!< index slot of a key without postings
+#define RD_KEY_MIN_CAP      1024        //!< initial index slots
+#define RD_RES_FANOUT       4           //!< assumed links per registration
+
+/* key kinds */
+#define RD_KIND_IDENTITY    'e'         //!< endpoint name and sector
+#define RD_KIND_REG         'r'         //!< registration attribute
+#define RD_KIND_LINK        'l'         //!< link attribute or href
+
+/**
+ * Entry of the list of registrations or links with one attribute value
+ */
+struct coap_rd_posting
+{
+    coap_rd_posting_t *next;
+    coap_rd_posting_t *prev;
+    coap_rd_reg_t *reg;
+    uint32_t link;          //!< offset of the link in reg->doc, or RD_NO_LINK
+};
+
+/**
+ * Index entry, an attribute value and its postings
+ */
+struct coap_rd_key
+{
+    uint64_t hash;          //!< hash of kind, name and value, see _key_hash
+    coap_rd_posting_t *head;
+    uint32_t count;         //!< postings
+};
+
+/**
+ * Registration, one allocation with its postings, attributes and document
+ */
+struct coap_rd_reg
+{
+    uint32_t id;
+    uint32_t lifetime;      //!< seconds
+    uint32_t expiry;        //!< time it expires
+    coap_rd_reg_t *next;    //!< wheel slot list
+    coap_rd_reg_t *prev;
+    coap_link_t attrs;      //!< registration attributes as link parameters
+    const uint8_t *doc;     //!< registered links
+    size_t doclen;
+    size_t size;            //!< bytes allocated
+    uint32_t nposts;
+    coap_rd_posting_t posts[];
+};
+
+/**
+ * Query parameter
+ */
+typedef struct _rd_param
+{
+    coap_buffer_t name;
+    coap_buffer_t value;
+    bool has_value;         //!< name=value, else only name
+    bool escaped;           //!< value is stored text, already escaped
+} _rd_param_t;
+
+/**
+ * Bounded text being built
+ */
+typedef struct _rd_text
+{
+    uint8_t *p;
+    size_t size;
+    size_t len;
+    bool overflow;
+} _rd_text_t;
+
+/**
+ * Part of the lookup result that goes into the response block
+ */
+typedef struct _rd_window
+{
+    uint8_t *buf;
+    size_t size;            //!< block size
+    size_t skip;            //!< result bytes before the block
+    size_t pos;             //!< result bytes produced
+} _rd_window_t;
+
+/**
+ * Context of key enumeration callbacks
+ */
+typedef struct _rd_keys_ctx
+{
+    coap_rd_t *rd;
+    coap_rd_reg_t *reg;
+    uint32_t n;             //!< postings passed
+} _rd_keys_ctx_t;
+
+typedef void (*_rd_key_cb)(_rd_keys_ctx_t *ctx, const uint64_t hash,
+                           const uint32_t link);
+
+static const uint8_t _ct_linkformat[2] = COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_APP_LINKFORMAT);
+
+/* --- PRIVATE -------------------------------------------------------------- */
+static uint64_t _fnv(uint64_t h, const uint8_t *p, const size_t len)
+{
+    for (size_t i = 0; i < len; ++i) {
+        h ^= p[i];
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+static uint64_t _key_hash(const uint8_t kind, const uint8_t *name,
+                          const size_t namelen, const uint8_t *value,
+                          const size_t valuelen)
+{
+    const uint8_t sep = 0;
+    uint64_t h = _fnv(0xcbf29ce484222325ull, &kind, 1);
+    h = _fnv(h, name, namelen);
+    h = _fnv(_fnv(h, &sep, 1), value, valuelen);
+    // 0 and 1 mark free slots
+    return (h <= RD_KEY_DELETED) ? h + 2 : h;
+}
+
+static size_t _key_slot(const coap_rd_t *rd, const uint64_t hash)
+{
+    return (size_t)(hash ^ (hash >> 32)) & (rd->key_cap - 1);
+}
+
+static coap_rd_key_t *_key_find(const coap_rd_t *rd, const uint64_t hash)
+{
+    for (size_t i = _key_slot(rd, hash);; i = (i + 1) & (rd->key_cap - 1)) {
+        coap_rd_key_t *k = &rd->keys[i];
+        if (k->hash == hash) {
+            return k;
+        }
+        if (k->hash == RD_KEY_EMPTY) {
+            return NULL;
+        }
+    }
+}
+
+/* existing or new key, the table has room, see _key_reserve */
+static coap_rd_key_t *_key_get(coap_rd_t *rd, const uint64_t hash)
+{
+    coap_rd_key_t *deleted = NULL;
+    for (size_t i = _key_slot(rd, hash);; i = (i + 1) & (rd->key_cap - 1)) {
+        coap_rd_key_t *k = &rd->keys[i];
+        if (k->hash == hash) {
+            return k;
+        }
+        if ((k->hash == RD_KEY_DELETED) && !deleted) {
+            deleted = k;
+        }
+        else if (k->hash == RD_KEY_EMPTY) {
+            if (!deleted) {
+                deleted = k;
+                rd->key_used++;
+            }
+            deleted->hash = hash;
+            deleted->head = NULL;
+            deleted->count = 0;
+            return deleted;
+        }
+    }
+}
+
+/* room for \p n more keys below 70% load, rehashes without deleted keys */
+static bool _key_reserve(coap_rd_t *rd, const size_t n)
+{
+    if ((rd->key_used + n) * 10 <= rd->key_cap * 7) {
+        return true;
+    }
+    size_t live = 0;
+    for (size_t i = 0; i < rd->key_cap; ++i) {
+        live += rd->keys[i].hash > RD_KEY_DELETED;
+    }
+    size_t cap = rd->key_cap;
+    while ((live + n) * 2 > cap) {
+        cap *= 2;
+    }
+    coap_rd_key_t *keys = calloc(cap, sizeof(*keys));
+    if (!keys) {
+        return false;
+    }
+    coap_rd_key_t *old = rd->keys;
+    const size_t oldcap = rd->key_cap;
+    rd->keys = keys;
+    rd->key_cap = cap;
+    rd->key_used = live;
+    for (size_t i = 0; i < oldcap; ++i) {
+        if (old[i].hash > RD_KEY_DELETED) {
+            size_t j = _key_slot(rd, old[i].hash);
+            while (keys[j].hash != RD_KEY_EMPTY) {
+                j = (j + 1) & (cap - 1);
+            }
+            keys[j] = old[i];
+        }
+    }
+    rd->mem += (cap - oldcap) * sizeof(*keys);
+    free(old);
+    return true;
+}
+
+static void _key_count(_rd_keys_ctx_t *ctx, const uint64_t hash,
+                       const uint32_t link)
+{
+    (void) hash;
+    (void) link;
+    ctx->n++;
+}
+
+static void _key_insert(_rd_keys_ctx_t *ctx, const uint64_t hash,
+                        const uint32_t link)
+{
+    coap_rd_key_t *k = _key_get(ctx->rd, hash);
+    coap_rd_posting_t *p = &ctx->reg->posts[ctx->n++];
+    p->reg = ctx->reg;
+    p->link = link;
+    p->prev = NULL;
+    p->next = k->head;
+    if (k->head) {
+        k->head->prev = p;
+    }
+    k->head = p;
+    k->count++;
+}
+
+static void _key_remove(_rd_keys_ctx_t *ctx, const uint64_t hash,
+                        const uint32_t link)
+{
+    (void) link;
+    coap_rd_key_t *k = _key_find(ctx->rd, hash);
+    coap_rd_posting_t *p = &ctx->reg->posts[ctx->n++];
+    if (p->prev) {
+        p->prev->next = p->next;
+    }
+    else {
+        k->head = p->next;
+    }
+    if (p->next) {
+        p->next->prev = p->prev;
+    }
+    if (!--k->count) {
+        k->hash = RD_KEY_DELETED;
+        k->head = NULL;
+    }
+}
+
+/* keys of the values of all parameters, and of each of space separated ones */
+static void _attr_keys(const uint8_t kind, const coap_link_t *link,
+                       const uint32_t off, _rd_key_cb cb, _rd_keys_ctx_t *ctx)
+{
+    coap_link_attr_t attr;
+    size_t pos = 0;
+
+    while (coap_link_attr_next(link, &pos, &attr) == COAP_SUCCESS) {
+        const uint8_t *v = attr.value.p;
+        const size_t len = attr.value.len;
+        if (!len) {
+            continue;
+        }
+        cb(ctx, _key_hash(kind, attr.name.p, attr.name.len, v, len), off);
+        if (!attr.quoted || !memchr(v, ' ', len)) {
+            continue;
+        }
+        for (size_t i = 0; i < len;) {
+            size_t j = i;
+            while ((j < len) && (v[j] != ' ')) {
+                j++;
+            }
+            if (j > i) {
+                cb(ctx, _key_hash(kind, attr.name.p, attr.name.len, v + i, j - i), off);
+            }
+            i = j + 1;
+        }
+    }
+}
+
+static uint64_t _identity_hash(const coap_link_t *attrs)
+{
+    coap_link_attr_t ep, d;
+    coap_link_attr_find(attrs, "ep", &ep);
+    if (coap_link_attr_find(attrs, "d", &d) != COAP_SUCCESS) {
+        d.value.p = NULL;
+        d.value.len = 0;
+    }
+    return _key_hash(RD_KIND_IDENTITY, d.value.p, d.value.len,
+                     ep.value.p, ep.value.len);
+}
+
+/*
+ * Passes all index keys of a registration to \p cb in the same order every
+ * time, so the n-th key belongs to the n-th posting. Returns
+ * COAP_ERR_PAYLOAD_INVALID if the document is malformed.
+ */
+static coap_state_t _keys(const coap_link_t *attrs, const uint8_t *doc,
+                          const size_t doclen, _rd_key_cb cb,
+                          _rd_keys_ctx_t *ctx)
+{
+    static const uint8_t href[] = "href";
+    coap_link_reader_t r;
+    coap_link_t link;
+    coap_state_t rc;
+
+    cb(ctx, _identity_hash(attrs), RD_NO_LINK);
+    _attr_keys(RD_KIND_REG, attrs, RD_NO_LINK, cb, ctx);
+    coap_link_reader_init(&r, doc, doclen);
+    for (uint32_t off = 0; (rc = coap_link_next(&r, &link)) == COAP_SUCCESS;
+         off = (uint32_t)r.pos) {
+        cb(ctx, _key_hash(RD_KIND_LINK, href, sizeof(href) - 1,
+                          link.target.p, link.target.len), off);
+        _attr_keys(RD_KIND_LINK, &link, off, cb, ctx);
+    }
+    return (rc == COAP_ERR_OPTION_NOT_FOUND) ? COAP_SUCCESS : rc;
+}
+
+static void _text_put(_rd_text_t *t, const void *s, const size_t len)
+{
+    if (t->size - t->len < len) {
+        t->overflow = true;
+        return;
+    }
+    memcpy(t->p + t->len, s, len);
+    t->len += len;
+}
+
+static void _text_put_escaped(_rd_text_t *t, const coap_buffer_t *v)
+{
+    for (size_t i = 0; i < v->len; ++i) {
+        if ((v->p[i] == '"') || (v->p[i] == '\\')) {
+            _text_put(t, "\\", 1);
+        }
+        _text_put(t, &v->p[i], 1);
+    }
+}
+
+/* registration attributes as link parameters, ;name="value" */
+static void _text_put_params(_rd_text_t *t, const _rd_param_t *params,
+                             const size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        _text_put(t, ";", 1);
+        _text_put(t, params[i].name.p, params[i].name.len);
+        if (!params[i].has_value) {
+            continue;
+        }
+        _text_put(t, "=\"", 2);
+        if (params[i].escaped) {
+            _text_put(t, params[i].value.p, params[i].value.len);
+        }
+        else {
+            _text_put_escaped(t, &params[i].value);
+        }
+        _text_put(t, "\"", 1);
+    }
+}
+
+static bool _buf_equal_str(const coap_buffer_t *buf, const char *str)
+{
+    const size_t len = strlen(str);
+    return (buf->len == len) && !memcmp(buf->p, str, len);
+}
+
+static bool _parse_uint(const coap_buffer_t *buf, uint32_t *value)
+{
+    uint64_t v = 0;
+    if (!buf->len || (buf->len > 10)) {
+        return false;
+    }
+    for (size_t i = 0; i < buf->len; ++i) {
+        if ((buf->p[i] < '0') || (buf->p[i] > '9')) {
+            return false;
+        }
+        v = v * 10 + (buf->p[i] - '0');
+    }
+    if (v > UINT32_MAX) {
+        return false;
+    }
+    *value = (uint32_t)v;
+    return true;
+}
+
+/* Uri-Query options as name=value pairs, false if malformed or too many */
+static bool _params(const coap_packet_t *inpkt, _rd_param_t *params, size_t *n)
+{
+    uint8_t count;
+    size_t total = 0;
+    const coap_option_t *opt = coap_find_options(inpkt, COAP_OPTION_URI_QUERY, &count);
+
+    if (!opt) {
+        count = 0;
+    }
+    if (count > COAP_RD_MAX_PARAMS) {
+        return false;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        const coap_buffer_t *q = &opt[i].buf;
+        const uint8_t *eq = q->len ? memchr(q->p, '=', q->len) : NULL;
+        _rd_param_t *p = &params[i];
+        p->name.p = q->p;
+        p->name.len = eq ? (size_t)(eq - q->p) : q->len;
+        p->has_value = (eq != NULL);
+        p->escaped = false;
+        p->value.p = eq ? eq + 1 : NULL;
+        p->value.len = eq ? q->len - p->name.len - 1 : 0;
+        if (!p->name.len) {
+            return false;
+        }
+        for (size_t j = 0; j < p->name.len; ++j) {
+            const uint8_t c = p->name.p[j];
+            if (!(((c | 0x20) >= 'a') && ((c | 0x20) <= 'z')) &&
+                !((c >= '0') && (c <= '9')) && (c != '-') && (c != '_') && (c != '.')) {
+                return false;
+            }
+        }
+        total += q->len;
+    }
+    *n = count;
+    return total <= COAP_RD_MAX_TEXT;
+}
+
+static const _rd_param_t *_param_find(const _rd_param_t *params, const size_t n,
+                                      const char *name)
+{
+    for (size_t i = 0; i < n; ++i) {
+        if (_buf_equal_str(&params[i].name, name)) {
+            return &params[i];
+        }
+    }
+    return NULL;
+}
+
+static void _wheel_insert(coap_rd_t *rd, coap_rd_reg_t *reg)
+{
+    coap_rd_reg_t **slot = &rd->wheel[reg->expiry & (COAP_RD_WHEEL_SLOTS - 1)];
+    reg->prev = NULL;
+    reg->next = *slot;
+    if (*slot) {
+        (*slot)->prev = reg;
+    }
+    *slot = reg;
+}
+
+static void _wheel_remove(coap_rd_t *rd, coap_rd_reg_t *reg)
+{
+    if (reg->prev) {
+        reg->prev->next = reg->next;
+    }
+    else {
+        rd->wheel[reg->expiry & (COAP_RD_WHEEL_SLOTS - 1)] = reg->next;
+    }
+    if (reg->next) {
+        reg->next->prev = reg->prev;
+    }
+}
+
+/*
+ * Builds and indexes a registration of \p params and \p doc; it is not yet
+ * reachable by id or expiry, see _reg_install. Returns NULL with \p rc set
+ * to COAP_ERR_PAYLOAD_INVALID or COAP_ERR_BUFFER_TOO_SMALL.
+ */
+static coap_rd_reg_t *_reg_create(coap_rd_t *rd, const _rd_param_t *params,
+                                  const size_t n, const uint8_t *doc,
+                                  const size_t doclen, coap_state_t *rc)
+{
+    uint8_t buf[2 * COAP_RD_MAX_TEXT + 4 * COAP_RD_MAX_PARAMS];
+    _rd_text_t text = { buf, sizeof(buf), 0, false };
+    _rd_keys_ctx_t ctx = { rd, NULL, 0 };
+    coap_link_t attrs;
+
+    _text_put_params(&text, params, n);
+    if (text.overflow) {
+        *rc = COAP_ERR_PAYLOAD_INVALID;
+        return NULL;
+    }
+    attrs.target.p = NULL;
+    attrs.target.len = 0;
+    attrs.params.p = buf;
+    attrs.params.len = text.len;
+    if ((*rc = _keys(&attrs, doc, doclen, _key_count, &ctx)) != COAP_SUCCESS) {
+        return NULL;
+    }
+    const size_t size = sizeof(coap_rd_reg_t) + ctx.n * sizeof(coap_rd_posting_t) +
+                        text.len + doclen;
+    coap_rd_reg_t *reg = _key_reserve(rd, ctx.n) ? malloc(size) : NULL;
+    if (!reg) {
+        *rc = COAP_ERR_BUFFER_TOO_SMALL;
+        return NULL;
+    }
+    uint8_t *p = (uint8_t *)&reg->posts[ctx.n];
+    memcpy(p, buf, text.len);
+    if (doclen) {
+        memcpy(p + text.len, doc, doclen);
+    }
+    reg->attrs.target = attrs.target;
+    reg->attrs.params.p = p;
+    reg->attrs.params.len = text.len;
+    reg->doc = p + text.len;
+    reg->doclen = doclen;
+    reg->size = size;
+    reg->nposts = ctx.n;
+    ctx.reg = reg;
+    ctx.n = 0;
+    _keys(&reg->attrs, reg->doc, reg->doclen, _key_insert, &ctx);
+    rd->mem += size;
+    return reg;
+}
+
+static void _reg_install(coap_rd_t *rd, coap_rd_reg_t *reg, const uint32_t id,
+                         const uint32_t lifetime)
+{
+    reg->id = id;
+    reg->lifetime = lifetime;
+    reg->expiry = rd->now + lifetime;
+    rd->regs[id] = reg;
+    rd->count++;
+    rd->gen++;
+    _wheel_insert(rd, reg);
+}
+
+/* unindexes and frees a registration not installed */
+static void _reg_free(coap_rd_t *rd, coap_rd_reg_t *reg)
+{
+    _rd_keys_ctx_t ctx = { rd, reg, 0 };
+    _keys(&reg->attrs, reg->doc, reg->doclen, _key_remove, &ctx);
+    rd->mem -= reg->size;
+    free(reg);
+}
+
+/* removes \p reg, its id returns to the free ones if \p release */
+static void _reg_drop(coap_rd_t *rd, coap_rd_reg_t *reg, const bool release)
+{
+    _wheel_remove(rd, reg);
+    rd->regs[reg->id] = NULL;
+    if (release) {
+        rd->free_ids[rd->num_free++] = reg->id;
+    }
+    rd->count--;
+    rd->gen++;
+    _reg_free(rd, reg);
+}
+
+/* other registration of the same endpoint name and sector as \p reg */
+static coap_rd_reg_t *_reg_find_ep(const coap_rd_t *rd, const coap_rd_reg_t *reg)
+{
+    const coap_link_t *attrs = &reg->attrs;
+    const coap_rd_key_t *k = _key_find(rd, _identity_hash(attrs));
+    coap_link_attr_t ep, d, ep2, d2;
+    const bool has_d = coap_link_attr_find(attrs, "d", &d) == COAP_SUCCESS;
+
+    coap_link_attr_find(attrs, "ep", &ep);
+    for (const coap_rd_posting_t *p = k ? k->head : NULL; p; p = p->next) {
+        const bool has_d2 = coap_link_attr_find(&p->reg->attrs, "d", &d2) == COAP_SUCCESS;
+        if ((p->reg != reg) && (p->link == RD_NO_LINK) &&
+            (coap_link_attr_find(&p->reg->attrs, "ep", &ep2) == COAP_SUCCESS) &&
+            (ep.value.len == ep2.value.len) &&
+            !memcmp(ep.value.p, ep2.value.p, ep.value.len) &&
+            ((has_d ? d.value.len : 0) == (has_d2 ? d2.value.len : 0)) &&
+            (!has_d || !d.value.len || !memcmp(d.value.p, d2.value.p, d.value.len))) {
+            return p->reg;
+        }
+    }
+    return NULL;
+}
+
+static coap_state_t _respond(const coap_packet_t *inpkt,
+                             const coap_responsecode_t rspcode,
+                             coap_packet_t *pkt)
+{
+    const coap_msgtype_t type = (inpkt->hdr.t == COAP_TYPE_CON) ?
+                                COAP_TYPE_ACK : COAP_TYPE_NONCON;
+    return coap_make_response(inpkt->hdr.id, &inpkt->tok, type, rspcode,
+                              NULL, NULL, 0, pkt);
+}
+
+static bool _is_linkformat(const coap_packet_t *inpkt)
+{
+    uint8_t count;
+    const coap_option_t *opt = coap_find_options(inpkt, COAP_OPTION_CONTENT_FORMAT, &count);
+    return !opt || (coap_decode_uint(&opt->buf) == COAP_CONTENTTYPE_APP_LINKFORMAT);
+}
+
+/* lt parameter if any, false if it is malformed */
+static bool _lifetime(const _rd_param_t *params, const size_t n,
+                      uint32_t *lifetime)
+{
+    const _rd_param_t *lt = _param_find(params, n, "lt");
+    return !lt || (_parse_uint(&lt->value, lifetime) && *lifetime &&
+                   (*lifetime <= INT32_MAX));
+}
+
+static coap_state_t _register(coap_rd_t *rd, const coap_packet_t *inpkt,
+                              const char *source, coap_packet_t *pkt)
+{
+    _rd_param_t params[COAP_RD_MAX_PARAMS + 1];
+    size_t n, m = 0;
+    uint32_t lifetime = COAP_RD_DEFAULT_LIFETIME;
+    coap_state_t rc;
+
+    if (!_is_linkformat(inpkt)) {
+        return _respond(inpkt, COAP_RSPCODE_UNSUPPORTED_CONTENT_FMT, pkt);
+    }
+    if (!_params(inpkt, params, &n) ||
+        !_lifetime(params, n, &lifetime)) {
+        return _respond(inpkt, COAP_RSPCODE_BAD_REQUEST, pkt);
+    }
+    const _rd_param_t *ep = _param_find(params, n, "ep");
+    if (!ep || !ep->value.len || (ep->value.len > COAP_RD_MAX_EP_LEN)) {
+        return _respond(inpkt, COAP_RSPCODE_BAD_REQUEST, pkt);
+    }
+    // lt is kept apart, the others become registration attributes
+    for (size_t i = 0; i < n; ++i) {
+        if (!_buf_equal_str(&params[i].name, "lt")) {
+            params[m++] = params[i];
+        }
+    }
+    if (!_param_find(params, m, "base") && source) {
+        params[m].name.p = (const uint8_t *)"base";
+        params[m].name.len = 4;
+        params[m].value.p = (const uint8_t *)source;
+        params[m].value.len = strlen(source);
+        params[m].has_value = true;
+        params[m++].escaped = false;
+    }
+    coap_rd_reg_t *reg = _reg_create(rd, params, m, inpkt->payload.p,
+                                     inpkt->payload.len, &rc);
+    if (!reg) {
+        return _respond(inpkt, (rc == COAP_ERR_PAYLOAD_INVALID) ?
+                        COAP_RSPCODE_BAD_REQUEST : COAP_RSPCODE_SERVICE_UNAVAILABLE, pkt);
+    }
+    // registering again replaces the registration and keeps its location
+    coap_rd_reg_t *old = _reg_find_ep(rd, reg);
+    uint32_t id;
+    if (old) {
+        id = old->id;
+        _reg_drop(rd, old, false);
+    }
+    else if (rd->num_free) {
+        id = rd->free_ids[--rd->num_free];
+    }
+    else {
+        _reg_free(rd, reg);
+        return _respond(inpkt, COAP_RSPCODE_SERVICE_UNAVAILABLE, pkt);
+    }
+    _reg_install(rd, reg, id, lifetime);
+
+    int len = 0;
+    char digits[10];
+    do {
+        digits[len++] = '0' + id % 10;
+        id /= 10;
+    } while (id);
+    for (int i = 0; i < len; ++i) {
+        rd->location[i] = digits[len - 1 - i];
+    }
+    _respond(inpkt, COAP_RSPCODE_CREATED, pkt);
+    coap_add_option(pkt, COAP_OPTION_LOCATION_PATH, (const uint8_t *)"rd", 2);
+    coap_add_option(pkt, COAP_OPTION_LOCATION_PATH, (const uint8_t *)rd->location, len);
+    return COAP_RSP_SEND;
+}
+
+static coap_state_t _update(coap_rd_t *rd, coap_rd_reg_t *reg,
+                            const coap_packet_t *inpkt, coap_packet_t *pkt)
+{
+    _rd_param_t params[2 * COAP_RD_MAX_PARAMS + 1];
+    size_t n, m = 0;
+    uint32_t lifetime = reg->lifetime;
+    coap_rd_reg_t *update;
+    coap_state_t rc;
+
+    if (!_is_linkformat(inpkt)) {
+        return _respond(inpkt, COAP_RSPCODE_UNSUPPORTED_CONTENT_FMT, pkt);
+    }
+    if (!_params(inpkt, params, &n) ||
+        !_lifetime(params, n, &lifetime) ||
+        _param_find(params, n, "ep") || _param_find(params, n, "d")) {
+        return _respond(inpkt, COAP_RSPCODE_BAD_REQUEST, pkt);
+    }
+    if (!n && !inpkt->payload.len) {
+        // plain refresh, the common case, only moves the expiry
+        _wheel_remove(rd, reg);
+        reg->expiry = rd->now + lifetime;
+        _wheel_insert(rd, reg);
+        return _respond(inpkt, COAP_RSPCODE_CHANGED, pkt);
+    }
+    // stored attributes not given again, then the given ones but lt
+    coap_link_attr_t attr;
+    size_t pos = 0;
+    while (coap_link_attr_next(&reg->attrs, &pos, &attr) == COAP_SUCCESS) {
+        bool given = false;
+        for (size_t i = 0; i < n; ++i) {
+            given |= (params[i].name.len == attr.name.len) &&
+                     !memcmp(params[i].name.p, attr.name.p, attr.name.len);
+        }
+        if (!given && (m <= COAP_RD_MAX_PARAMS)) {
+            params[n + m].name = attr.name;
+            params[n + m].value = attr.value;
+            params[n + m].has_value = attr.value.p != NULL;
+            params[n + m++].escaped = true;
+        }
+    }
+    size_t k = 0;
+    for (size_t i = 0; i < n + m; ++i) {
+        if ((i >= n) || !_buf_equal_str(&params[i].name, "lt")) {
+            params[k++] = params[i];
+        }
+    }
+    // an update without links keeps the registered ones
+    if (inpkt->payload.len) {
+        update = _reg_create(rd, params, k, inpkt->payload.p, inpkt->payload.len, &rc);
+    }
+    else {
+        update = _reg_create(rd, params, k, reg->doc, reg->doclen, &rc);
+    }
+    if (!update) {
+        return _respond(inpkt, (rc == COAP_ERR_PAYLOAD_INVALID) ?
+                        COAP_RSPCODE_BAD_REQUEST : COAP_RSPCODE_SERVICE_UNAVAILABLE, pkt);
+    }
+    const uint32_t id = reg->id;
+    _reg_drop(rd, reg, false);
+    _reg_install(rd, update, id, lifetime);
+    return _respond(inpkt, COAP_RSPCODE_CHANGED, pkt);
+}
+
+/*
+ * Next result of a lookup: a registration, or for resource lookups one of
+ * its links at offset \p link. Postings of the same registration and link
+ * follow each other, e.g. for rt="a a", only the first counts.
+ */
+static bool _iter_next(const coap_rd_t *rd, coap_rd_iter_t *it, const bool res,
+                       const coap_rd_reg_t **reg, size_t *link)
+{
+    for (;;) {
+        if (it->reg) {
+            coap_link_reader_t r;
+            coap_link_t l;
+            coap_link_reader_init(&r, it->reg->doc, it->reg->doclen);
+            r.pos = it->link;
+            if (coap_link_next(&r, &l) == COAP_SUCCESS) {
+                *reg = it->reg;
+                *link = it->link;
+                it->link = r.pos;
+                return true;
+            }
+            it->reg = NULL;
+        }
+        const coap_rd_reg_t *next;
+        if (it->indexed) {
+            const coap_rd_posting_t *p = it->post;
+            if (!p) {
+                return false;
+            }
+            it->post = p->next;
+            if (p->prev && (p->prev->reg == p->reg) && (p->prev->link == p->link)) {
+                continue;
+            }
+            if (res && (p->link != RD_NO_LINK)) {
+                *reg = p->reg;
+                *link = p->link;
+                return true;
+            }
+            next = p->reg;
+        }
+        else {
+            while ((it->id < rd->max_regs) && !rd->regs[it->id]) {
+                it->id++;
+            }
+            if (it->id >= rd->max_regs) {
+                return false;
+            }
+            next = rd->regs[it->id++];
+        }
+        if (!res) {
+            *reg = next;
+            return true;
+        }
+        it->reg = next;
+        it->link = 0;
+    }
+}
+
+/*
+ * Starts \p it at the postings of the most selective filter with an exact
+ * value, or at a scan if there is none. Returns false if an exact filter
+ * matches nothing, so the result is empty.
+ */
+static bool _plan(const coap_rd_t *rd, const bool res,
+                  const coap_link_filter_t *filters, const size_t n,
+                  coap_rd_iter_t *it)
+{
+    const coap_rd_key_t *best = NULL;
+    size_t cost = SIZE_MAX;
+
+    memset(it, 0, sizeof(*it));
+    for (size_t i = 0; i < n; ++i) {
+        const char *name = filters[i].name;
+        const char *value = filters[i].value;
+        const size_t vlen = value ? strlen(value) : 0;
+        if (!vlen || (value[vlen - 1] == '*') || (!res && !strcmp(name, "href"))) {
+            continue;
+        }
+        const coap_rd_key_t *kr = _key_find(rd, _key_hash(RD_KIND_REG,
+                                            (const uint8_t *)name, strlen(name),
+                                            (const uint8_t *)value, vlen));
+        const coap_rd_key_t *kl = !res ? NULL : _key_find(rd, _key_hash(RD_KIND_LINK,
+                                            (const uint8_t *)name, strlen(name),
+                                            (const uint8_t *)value, vlen));
+        if (!kr && !kl) {
+            return false;
+        }
+        // a value of both registrations and links needs the union, skip
+        if (kr && kl) {
+            continue;
+        }
+        const size_t c = kl ? kl->count : res ? kr->count * RD_RES_FANOUT : kr->count;
+        if (c < cost) {
+            cost = c;
+            best = kl ? kl : kr;
+        }
+    }
+    if (best) {
+        it->indexed = true;
+        it->post = best->head;
+    }
+    return true;
+}
+
+static bool _matches(const coap_rd_reg_t *reg, const coap_link_t *link,
+                     const coap_link_filter_t *filters, const size_t n)
+{
+    if (!link) {
+        return coap_link_match(&reg->attrs, filters, n);
+    }
+    // resource lookups match attributes of the link or its registration
+    for (size_t i = 0; i < n; ++i) {
+        if (!coap_link_match(link, &filters[i], 1) &&
+            !coap_link_match(&reg->attrs, &filters[i], 1)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* copies the part of \p len bytes that falls into the block */
+static void _emit(_rd_window_t *w, const void *s, const size_t len)
+{
+    const size_t end = w->pos + len;
+    const size_t lo = (w->pos > w->skip) ? w->pos : w->skip;
+    const size_t hi = (end < w->skip + w->size) ? end : w->skip + w->size;
+    if (lo < hi) {
+        memcpy(w->buf + (lo - w->skip), (const uint8_t *)s + (lo - w->pos), hi - lo);
+    }
+    w->pos = end;
+}
+
+static void _emit_str(_rd_window_t *w, const char *s)
+{
+    _emit(w, s, strlen(s));
+}
+
+static void _render_ep(_rd_window_t *w, const coap_rd_reg_t *reg)
+{
+    char id[11];
+    int len = 0;
+    char digits[10];
+    uint32_t v = reg->id;
+    do {
+        digits[len++] = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    for (int i = 0; i < len; ++i) {
+        id[i] = digits[len - 1 - i];
+    }
+    _emit_str(w, "</rd/");
+    _emit(w, id, len);
+    _emit_str(w, ">");
+    _emit(w, reg->attrs.params.p, reg->attrs.params.len);
+}
+
+/* the link with its target resolved against the base of the registration */
+static void _render_res(_rd_window_t *w, const coap_rd_reg_t *reg,
+                        const coap_link_t *link)
+{
+    static const uint8_t scheme[] = "://";
+    coap_link_attr_t base, anchor;
+    const coap_buffer_t *t = &link->target;
+    bool absolute = false;
+
+    for (size_t i = 0; !absolute && (i + 3 <= t->len); ++i) {
+        absolute = !memcmp(t->p + i, scheme, 3);
+    }
+    const bool has_base = coap_link_attr_find(&reg->attrs, "base", &base) == COAP_SUCCESS;
+    _emit_str(w, "<");
+    if (!absolute && has_base) {
+        _emit(w, base.value.p, base.value.len);
+        if (!t->len || (t->p[0] != '/')) {
+            _emit_str(w, "/");
+        }
+    }
+    _emit(w, t->p, t->len);
+    _emit_str(w, ">");
+    _emit(w, link->params.p, link->params.len);
+    if (has_base && (coap_link_attr_find(link, "anchor", &anchor) != COAP_SUCCESS)) {
+        _emit_str(w, ";anchor=\"");
+        _emit(w, base.value.p, base.value.len);
+        _emit_str(w, "\"");
+    }
+}
+
+/* hash of the Uri-Path and Uri-Query options and the block size */
+static uint64_t _query_hash(const coap_packet_t *inpkt, const uint8_t szx)
+{
+    uint64_t h = _fnv(0xcbf29ce484222325ull, &szx, 1);
+    for (size_t i = 0; i < inpkt->numopts; ++i) {
+        const coap_option_t *o = &inpkt->opts[i];
+        if ((o->num == COAP_OPTION_URI_PATH) || (o->num == COAP_OPTION_URI_QUERY)) {
+            const uint8_t sep[2] = { (uint8_t)o->num, (uint8_t)o->buf.len };
+            h = _fnv(_fnv(h, sep, 2), o->buf.p, o->buf.len);
+        }
+    }
+    return h ? h : 1;
+}
+
+static coap_state_t _lookup(coap_rd_t *rd, const coap_packet_t *inpkt,
+                            const bool res, coap_packet_t *pkt)
+{
+    _rd_param_t params[COAP_RD_MAX_PARAMS];
+    coap_link_filter_t filters[COAP_RD_MAX_PARAMS];
+    char text[COAP_RD_MAX_TEXT + 2 * COAP_RD_MAX_PARAMS];
+    size_t n, nfilters = 0, used = 0;
+    uint32_t page = 0, count = UINT32_MAX;
+    coap_block_t block = { 0, false, COAP_RD_BLOCK_SZX };
+    const bool blockwise = coap_get_block(inpkt, COAP_OPTION_BLOCK2, &block) == COAP_SUCCESS;
+
+    if (!_params(inpkt, params, &n)) {
+        return _respond(inpkt, COAP_RSPCODE_BAD_REQUEST, pkt);
+    }
+    for (size_t i = 0; i < n; ++i) {
+        const _rd_param_t *p = &params[i];
+        if (_buf_equal_str(&p->name, "page") || _buf_equal_str(&p->name, "count")) {
+            if (!_parse_uint(&p->value, (p->name.p[0] == 'p') ? &page : &count)) {
+                return _respond(inpkt, COAP_RSPCODE_BAD_REQUEST, pkt);
+            }
+            continue;
+        }
+        // filters are C strings
+        filters[nfilters].name = text + used;
+        memcpy(text + used, p->name.p, p->name.len);
+        used += p->name.len;
+        text[used++] = '\0';
+        filters[nfilters].value = NULL;
+        if (p->has_value) {
+            filters[nfilters].value = text + used;
+            memcpy(text + used, p->value.p, p->value.len);
+            used += p->value.len;
+            text[used++] = '\0';
+        }
+        nfilters++;
+    }
+    if (block.szx > COAP_BLOCK_SZX_MAX) {
+        block.szx = COAP_BLOCK_SZX_MAX;
+    }
+    const uint64_t first = (uint64_t)page * (count == UINT32_MAX ? 0 : count);
+    const uint64_t query = _query_hash(inpkt, block.szx);
+    _rd_window_t w = { rd->out, COAP_BLOCK_SIZE(block.szx), 0, 0 };
+    coap_rd_iter_t it, before;
+    uint32_t matched = 0, emitted = 0;
+    bool more = false, any = true;
+
+    if (block.num && (rd->cursor.query == query) && (rd->cursor.gen == rd->gen) &&
+        (rd->cursor.num == block.num)) {
+        // continue where the previous block stopped
+        it = rd->cursor.it;
+        matched = rd->cursor.matched;
+        emitted = rd->cursor.emitted;
+        w.skip = rd->cursor.partial;
+    }
+    else {
+        w.skip = (size_t)block.num * w.size;
+        any = _plan(rd, res, filters, nfilters, &it);
+    }
+    while (any && (emitted < count)) {
+        const coap_rd_reg_t *reg;
+        coap_link_t link;
+        size_t off = 0;
+
+        before = it;
+        if (!_iter_next(rd, &it, res, &reg, &off)) {
+            break;
+        }
+        if (res) {
+            coap_link_reader_t r;
+            coap_link_reader_init(&r, reg->doc, reg->doclen);
+            r.pos = off;
+            coap_link_next(&r, &link);
+        }
+        if (!_matches(reg, res ? &link : NULL, filters, nfilters) ||
+            (matched++ < first)) {
+            continue;
+        }
+        const size_t start = w.pos;
+        if (emitted++) {
+            _emit_str(&w, ",");
+        }
+        if (res) {
+            _render_res(&w, reg, &link);
+        }
+        else {
+            _render_ep(&w, reg);
+        }
+        if (w.pos > w.skip + w.size) {
+            more = true;
+            rd->cursor.query = query;
+            rd->cursor.gen = rd->gen;
+            rd->cursor.num = block.num + 1;
+            rd->cursor.it = before;
+            rd->cursor.matched = matched - 1;
+            rd->cursor.emitted = emitted - 1;
+            rd->cursor.partial = w.skip + w.size - start;
+            break;
+        }
+    }
+    if (block.num && (w.pos <= w.skip)) {
+        return _respond(inpkt, COAP_RSPCODE_BAD_OPTION, pkt);
+    }
+    const size_t len = (w.pos <= w.skip) ? 0 : (more ? w.size : w.pos - w.skip);
+    const coap_msgtype_t type = (inpkt->hdr.t == COAP_TYPE_CON) ?
+                                COAP_TYPE_ACK : COAP_TYPE_NONCON;
+    coap_make_response(inpkt->hdr.id, &inpkt->tok, type, COAP_RSPCODE_CONTENT,
+                       _ct_linkformat, rd->out, len, pkt);
+    if (more || blockwise) {
+        const size_t optlen = coap_encode_uint((block.num << 4) | (more << 3) | block.szx,
+                                               rd->scratch);
+        coap_add_option(pkt, COAP_OPTION_BLOCK2, rd->scratch, optlen);
+    }
+    return COAP_RSP_SEND;
+}
+
+enum {
+    RD_PATH_NONE,
+    RD_PATH_RD,         //!< /rd
+    RD_PATH_REG,        //!< /rd/{id}
+    RD_PATH_EP,         //!< /rd-lookup/ep
+    RD_PATH_RES,        //!< /rd-lookup/res
+};
+
+static int _path(const coap_rd_t *rd, const coap_packet_t *inpkt, uint32_t *id)
+{
+    uint8_t count;
+    const coap_option_t *opt = coap_find_options(inpkt, COAP_OPTION_URI_PATH, &count);
+
+    if (!opt) {
+        return RD_PATH_NONE;
+    }
+    if (_buf_equal_str(&opt[0].buf, "rd")) {
+        if (count == 1) {
+            return RD_PATH_RD;
+        }
+        if ((count == 2) && _parse_uint(&opt[1].buf, id) && (*id < rd->max_regs)) {
+            return RD_PATH_REG;
+        }
+        // unknown ids are answered here, not by the resources
+        *id = UINT32_MAX;
+        return (count == 2) ? RD_PATH_REG : RD_PATH_NONE;
+    }
+    if ((count == 2) && _buf_equal_str(&opt[0].buf, "rd-lookup")) {
+        if (_buf_equal_str(&opt[1].buf, "ep")) {
+            return RD_PATH_EP;
+        }
+        if (_buf_equal_str(&opt[1].buf, "res")) {
+            return RD_PATH_RES;
+        }
+    }
+    return RD_PATH_NONE;
+}
+
+/* --- PUBLIC --------------------------------------------------------------- */
+coap_state_t coap_rd_init(coap_rd_t *rd, const uint32_t max_regs,
+                          const uint32_t now)
+{
+    memset(rd, 0, sizeof(*rd));
+    rd->regs = calloc(max_regs, sizeof(*rd->regs));
+    rd->free_ids = malloc(max_regs * sizeof(*rd->free_ids));
+    rd->keys = calloc(RD_KEY_MIN_CAP, sizeof(*rd->keys));
+    if (!max_regs || !rd->regs || !rd->free_ids || !rd->keys) {
+        coap_rd_free(rd);
+        return COAP_ERR_BUFFER_TOO_SMALL;
+    }
+    // lowest ids first
+    for (uint32_t i = 0; i < max_regs; ++i) {
+        rd->free_ids[i] = max_regs - 1 - i;
+    }
+    rd->num_free = max_regs;
+    rd->max_regs = max_regs;
+    rd->key_cap = RD_KEY_MIN_CAP;
+    rd->now = now;
+    rd->mem = max_regs * (sizeof(*rd->regs) + sizeof(*rd->free_ids)) +
+              RD_KEY_MIN_CAP * sizeof(*rd->keys);
+    return COAP_SUCCESS;
+}
+
+void coap_rd_free(coap_rd_t *rd)
+{
+    for (uint32_t i = 0; rd->regs && (i < rd->max_regs); ++i) {
+        free(rd->regs[i]);
+    }
+    free(rd->regs);
+    free(rd->free_ids);
+    free(rd->keys);
+    memset(rd, 0, sizeof(*rd));
+}
+
+uint32_t coap_rd_tick(coap_rd_t *rd, const uint32_t now)
+{
+    uint32_t removed = 0;
+    if ((int32_t)(now - rd->now) <= 0) {
+        return 0;
+    }
+    uint32_t steps = now - rd->now;
+    if (steps > COAP_RD_WHEEL_SLOTS) {
+        steps = COAP_RD_WHEEL_SLOTS;
+    }
+    rd->now = now;
+    for (uint32_t t = now - steps + 1; steps--; ++t) {
+        coap_rd_reg_t *reg = rd->wheel[t & (COAP_RD_WHEEL_SLOTS - 1)];
+        while (reg) {
+            coap_rd_reg_t *next = reg->next;
+            // later rounds of the wheel stay
+            if ((int32_t)(reg->expiry - now) <= 0) {
+                _reg_drop(rd, reg, true);
+                removed++;
+            }
+            reg = next;
+        }
+    }
+    return removed;
+}
+
+coap_state_t coap_rd_handle_request(coap_rd_t *rd, const coap_packet_t *inpkt,
+                                    const char *source, coap_packet_t *pkt)
+{
+    uint32_t id = 0;
+    const int path = _path(rd, inpkt, &id);
+    const coap_method_t method = (coap_method_t)inpkt->hdr.code;
+
+    switch (path) {
+    case RD_PATH_RD:
+        if (method != COAP_METHOD_POST) {
+            return _respond(inpkt, COAP_RSPCODE_METHOD_NOT_ALLOWED, pkt);
+        }
+        return _register(rd, inpkt, source, pkt);
+    case RD_PATH_REG: {
+        coap_rd_reg_t *reg = (id < rd->max_regs) ? rd->regs[id] : NULL;
+        if ((method != COAP_METHOD_POST) && (method != COAP_METHOD_DELETE)) {
+            return _respond(inpkt, COAP_RSPCODE_METHOD_NOT_ALLOWED, pkt);
+        }
+        if (!reg) {
+            return _respond(inpkt, COAP_RSPCODE_NOT_FOUND, pkt);
+        }
+        if (method == COAP_METHOD_POST) {
+            return _update(rd, reg, inpkt, pkt);
+        }
+        _reg_drop(rd, reg, true);
+        return _respond(inpkt, COAP_RSPCODE_DELETED, pkt);
+    }
+    case RD_PATH_EP:
+    case RD_PATH_RES:
+        if (method != COAP_METHOD_GET) {
+            return _respond(inpkt, COAP_RSPCODE_METHOD_NOT_ALLOWED, pkt);
+        }
+        return _lookup(rd, inpkt, path == RD_PATH_RES, pkt);
+    default:
+        return COAP_ERR_REQUEST_NOT_FOUND;
+    }
+}
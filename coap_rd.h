@@ -0,0 +1,150 @@
+#ifndef COAP_RD_H
+#define COAP_RD_H 1
+
+/**
+ * @file coap_rd.h
+ *
+ * Resource Directory (RFC 9176) on top of the server. Endpoints register by
+ * POSTing their links in link-format to /rd and are answered with the
+ * location /rd/{id} of their registration, which they refresh with an
+ * empty POST before their lifetime runs out and remove with DELETE. Clients
+ * find registrations at /rd-lookup/ep and resources at /rd-lookup/res, with
+ * query filters as in RFC 6690, e.g. ?rt=temperature or ?ep=node1, and the
+ * page and count parameters; results are served block wise (Block2).
+ *
+ * Every attribute value of registrations and links is kept in a hash index,
+ * so a lookup with an exact filter walks the matches of its most selective
+ * filter instead of all registrations; only prefix filters like rt=temp*
+ * scan. Lifetimes expire on a timer wheel driven by coap_rd_tick.
+ *
+ * Unlike the rest of the library the directory allocates: its tables once
+ * in coap_rd_init and one block per registration, holding the registered
+ * document, about 32 bytes per indexed value besides. It is not thread safe.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "coap.h"
+
+#ifndef COAP_RD_WHEEL_SLOTS
+#define COAP_RD_WHEEL_SLOTS     4096    //!< timer wheel of one second slots, a power of 2
+#endif
+#define COAP_RD_DEFAULT_LIFETIME 90000  //!< lt if a registration does not set it, in seconds
+#define COAP_RD_MAX_EP_LEN      63      //!< longest endpoint name
+#define COAP_RD_MAX_PARAMS      8       //!< query parameters per request
+#define COAP_RD_MAX_TEXT        512     //!< total length of the query parameters
+#define COAP_RD_BLOCK_SZX       6       //!< block size of lookups unless requested, 1024 bytes
+
+typedef struct coap_rd_reg coap_rd_reg_t;
+typedef struct coap_rd_posting coap_rd_posting_t;
+typedef struct coap_rd_key coap_rd_key_t;
+
+/**
+ * Position in the results of a lookup, private
+ */
+typedef struct coap_rd_iter
+{
+    const coap_rd_posting_t *post;  //!< next posting of an indexed lookup
+    uint32_t id;                    //!< next registration of a scan
+    const coap_rd_reg_t *reg;       //!< registration whose links are returned
+    size_t link;                    //!< offset of its next link
+    bool indexed;                   //!< post, else scan by id
+} coap_rd_iter_t;
+
+/**
+ * Where the last lookup transfer stopped, so that the next block continues
+ * there instead of rendering all results before it again, private
+ */
+typedef struct coap_rd_cursor
+{
+    uint64_t query;         //!< hash of the lookup request, 0 if none
+    uint32_t gen;           //!< directory generation the results belong to
+    uint32_t num;           //!< block number continuing here
+    coap_rd_iter_t it;      //!< iterator before the result crossing the block
+    uint32_t matched;       //!< results matched before it
+    uint32_t emitted;       //!< results written before it
+    size_t partial;         //!< bytes of it in earlier blocks
+} coap_rd_cursor_t;
+
+/**
+ * Resource directory
+ */
+typedef struct coap_rd
+{
+    coap_rd_reg_t **regs;                   //!< registrations by id
+    uint32_t *free_ids;                     //!< stack of unused ids
+    uint32_t num_free;                      //!< entries on free_ids
+    uint32_t max_regs;                      //!< size of regs
+    uint32_t count;                         //!< registrations
+    size_t mem;                             //!< bytes allocated
+    coap_rd_key_t *keys;                    //!< index, open addressing
+    size_t key_cap;                         //!< slots of keys, a power of 2
+    size_t key_used;                        //!< slots in use or deleted
+    coap_rd_reg_t *wheel[COAP_RD_WHEEL_SLOTS]; //!< registrations by expiry
+    uint32_t now;                           //!< time of the last tick, seconds
+    uint32_t gen;                           //!< changes with every registration change
+    coap_rd_cursor_t cursor;                //!< continuation of the last lookup
+    uint8_t out[COAP_BLOCK_SIZE(COAP_BLOCK_SZX_MAX)]; //!< lookup response payload
+    char location[11];                      //!< id of a new registration
+    uint8_t scratch[4];                     //!< Block2 option value
+} coap_rd_t;
+
+/**
+ * @brief Set up an empty directory
+ *
+ * @param[out] rd Directory
+ * @param[in] max_regs Most registrations at a time
+ * @param[in] now Current time in seconds, see coap_rd_tick
+ *
+ * @return 0 on success, or COAP_ERR_BUFFER_TOO_SMALL if the tables cannot be
+ * allocated
+ */
+coap_state_t coap_rd_init(coap_rd_t *rd, const uint32_t max_regs,
+                          const uint32_t now);
+
+/**
+ * @brief Remove all registrations and free the tables
+ */
+void coap_rd_free(coap_rd_t *rd);
+
+/**
+ * @brief Advance the clock and remove expired registrations
+ *
+ * Call it at least before each request, e.g. with time(NULL) or a monotonic
+ * clock; each second passed costs one wheel slot, ticks after a pause of
+ * more than COAP_RD_WHEEL_SLOTS seconds visit every slot once.
+ *
+ * @param[in,out] rd Directory
+ * @param[in] now Current time in seconds
+ *
+ * @return Number of registrations removed
+ */
+uint32_t coap_rd_tick(coap_rd_t *rd, const uint32_t now);
+
+/**
+ * @brief Handle a request to the directory
+ *
+ * Serves POST /rd (registration), POST and DELETE /rd/{id} (update and
+ * removal), and GET /rd-lookup/ep and /rd-lookup/res. Registrations without
+ * base parameter get \p source as base URI. The payload of lookup responses
+ * points into \p rd and stays valid until the next call.
+ *
+ * @param[in,out] rd Directory
+ * @param[in] inpkt Request
+ * @param[in] source Base URI of the requesting endpoint, e.g.
+ * "coap://[2001:db8::1]:5683"
+ * @param[out] pkt Response
+ *
+ * @return COAP_RSP_SEND, or COAP_ERR_REQUEST_NOT_FOUND for requests to
+ * other paths, which are left to coap_handle_request then
+ */
+coap_state_t coap_rd_handle_request(coap_rd_t *rd, const coap_packet_t *inpkt,
+                                    const char *source, coap_packet_t *pkt);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,580 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "coap.h"
+#include "coap_cbor.h"
+#include "coap_json.h"
+#include "coap_senml.h"
+
+/* CBOR labels, https://tools.ietf.org/html/rfc8428#section-6 */
+#define SENML_BVER  -1
+#define SENML_BN    -2
+#define SENML_BT    -3
+#define SENML_BU    -4
+#define SENML_BV    -5
+#define SENML_BS    -6
+#define SENML_N     0
+#define SENML_U     1
+#define SENML_V     2
+#define SENML_VS    3
+#define SENML_VB    4
+#define SENML_S     5
+#define SENML_T     6
+#define SENML_UT    7
+#define SENML_VD    8
+#define SENML_UNKNOWN   100     //!< ignored
+#define SENML_MUST_UNDERSTAND   -100
+
+#define SENML_CBOR_HEAD 3   //!< reserved for the array head, up to 65535 records
+
+/**
+ * Base values in effect while unpacking
+ */
+typedef struct senml_state
+{
+    coap_buffer_t name;
+    coap_buffer_t unit;
+    double time;
+    double value;
+    double sum;
+} senml_state_t;
+
+static const struct { const char *name; int label; } json_labels[] = {
+    {"bver", SENML_BVER}, {"bn", SENML_BN}, {"bt", SENML_BT}, {"bu", SENML_BU},
+    {"bv", SENML_BV}, {"bs", SENML_BS}, {"n", SENML_N}, {"u", SENML_U},
+    {"v", SENML_V}, {"vs", SENML_VS}, {"vb", SENML_VB}, {"s", SENML_S},
+    {"t", SENML_T}, {"ut", SENML_UT}, {"vd", SENML_VD},
+};
+
+/* --- PRIVATE -------------------------------------------------------------- */
+static bool _buf_equal_str(const coap_buffer_t *buf, const char *str)
+{
+    size_t len = str ? strlen(str) : 0;
+    return str && (buf->len == len) && !memcmp(buf->p, str, len);
+}
+
+static void _pack_json(coap_senml_pack_t *pack, const coap_senml_record_t *rec,
+                       const bool with_base, const bool with_unit)
+{
+    coap_json_writer_t *w = &pack->w.json;
+
+    coap_json_begin_object(w);
+    if (with_base && pack->base.name) {
+        coap_json_put_key(w, "bn", 2);
+        coap_json_put_string(w, pack->base.name, strlen(pack->base.name));
+    }
+    if (with_base && pack->base.time) {
+        coap_json_put_key(w, "bt", 2);
+        coap_json_put_double(w, pack->base.time);
+    }
+    if (with_base && pack->base.unit) {
+        coap_json_put_key(w, "bu", 2);
+        coap_json_put_string(w, pack->base.unit, strlen(pack->base.unit));
+    }
+    if (rec->name.len) {
+        coap_json_put_key(w, "n", 1);
+        coap_json_put_string(w, (const char *)rec->name.p, rec->name.len);
+    }
+    if (with_unit) {
+        coap_json_put_key(w, "u", 1);
+        coap_json_put_string(w, (const char *)rec->unit.p, rec->unit.len);
+    }
+    switch (rec->kind) {
+    case COAP_SENML_VALUE:
+        coap_json_put_key(w, "v", 1);
+        coap_json_put_double(w, rec->value);
+        break;
+    case COAP_SENML_STRING:
+        coap_json_put_key(w, "vs", 2);
+        coap_json_put_string(w, (const char *)rec->str.p, rec->str.len);
+        break;
+    case COAP_SENML_BOOL:
+        coap_json_put_key(w, "vb", 2);
+        coap_json_put_bool(w, rec->boolean);
+        break;
+    case COAP_SENML_DATA:
+        coap_json_put_key(w, "vd", 2);
+        coap_json_put_base64url(w, rec->str.p, rec->str.len);
+        break;
+    default:
+        break;
+    }
+    if (rec->has_sum) {
+        coap_json_put_key(w, "s", 1);
+        coap_json_put_double(w, rec->sum);
+    }
+    if (rec->time && (rec->time != pack->base.time)) {
+        coap_json_put_key(w, "t", 1);
+        coap_json_put_double(w, rec->time - pack->base.time);
+    }
+    coap_json_end_object(w);
+}
+
+static void _pack_cbor(coap_senml_pack_t *pack, const coap_senml_record_t *rec,
+                       const bool with_base, const bool with_unit)
+{
+    coap_cbor_writer_t *w = &pack->w.cbor;
+    bool bn = with_base && pack->base.name;
+    bool bt = with_base && pack->base.time;
+    bool bu = with_base && pack->base.unit;
+
+    coap_cbor_put_map(w, bn + bt + bu + (rec->name.len > 0) + with_unit +
+                      (rec->kind != COAP_SENML_NONE) + rec->has_sum +
+                      (rec->time && (rec->time != pack->base.time)));
+    if (bn) {
+        coap_cbor_put_int(w, SENML_BN);
+        coap_cbor_put_text(w, pack->base.name, strlen(pack->base.name));
+    }
+    if (bt) {
+        coap_cbor_put_int(w, SENML_BT);
+        coap_cbor_put_double(w, pack->base.time);
+    }
+    if (bu) {
+        coap_cbor_put_int(w, SENML_BU);
+        coap_cbor_put_text(w, pack->base.unit, strlen(pack->base.unit));
+    }
+    if (rec->name.len) {
+        coap_cbor_put_int(w, SENML_N);
+        coap_cbor_put_text(w, (const char *)rec->name.p, rec->name.len);
+    }
+    if (with_unit) {
+        coap_cbor_put_int(w, SENML_U);
+        coap_cbor_put_text(w, (const char *)rec->unit.p, rec->unit.len);
+    }
+    switch (rec->kind) {
+    case COAP_SENML_VALUE:
+        coap_cbor_put_int(w, SENML_V);
+        coap_cbor_put_double(w, rec->value);
+        break;
+    case COAP_SENML_STRING:
+        coap_cbor_put_int(w, SENML_VS);
+        coap_cbor_put_text(w, (const char *)rec->str.p, rec->str.len);
+        break;
+    case COAP_SENML_BOOL:
+        coap_cbor_put_int(w, SENML_VB);
+        coap_cbor_put_bool(w, rec->boolean);
+        break;
+    case COAP_SENML_DATA:
+        coap_cbor_put_int(w, SENML_VD);
+        coap_cbor_put_bytes(w, rec->str.p, rec->str.len);
+        break;
+    default:
+        break;
+    }
+    if (rec->has_sum) {
+        coap_cbor_put_int(w, SENML_S);
+        coap_cbor_put_double(w, rec->sum);
+    }
+    if (rec->time && (rec->time != pack->base.time)) {
+        coap_cbor_put_int(w, SENML_T);
+        coap_cbor_put_double(w, rec->time - pack->base.time);
+    }
+}
+
+/**
+ * Decoded value of either format
+ */
+typedef struct senml_value
+{
+    bool is_num;
+    double num;
+    bool is_bool;
+    bool b;
+    bool is_str;
+    coap_buffer_t str;
+} senml_value_t;
+
+/* applies label \p label of the current object to the record or the state */
+static coap_state_t _apply(senml_state_t *st, coap_senml_record_t *rec,
+                           const int label, const senml_value_t *v)
+{
+    switch (label) {
+    case SENML_BVER:
+    case SENML_UT:
+        return v->is_num ? COAP_SUCCESS : COAP_ERR_PAYLOAD_INVALID;
+    case SENML_BT:
+    case SENML_BV:
+    case SENML_BS:
+    case SENML_V:
+    case SENML_S:
+    case SENML_T:
+        if (!v->is_num) {
+            return COAP_ERR_PAYLOAD_INVALID;
+        }
+        if (label == SENML_BT) {
+            st->time = v->num;
+        }
+        else if (label == SENML_BV) {
+            st->value = v->num;
+        }
+        else if (label == SENML_BS) {
+            st->sum = v->num;
+        }
+        else if (label == SENML_V) {
+            rec->kind = COAP_SENML_VALUE;
+            rec->value = v->num;
+        }
+        else if (label == SENML_S) {
+            rec->has_sum = true;
+            rec->sum = v->num;
+        }
+        else {
+            rec->time = v->num;
+        }
+        return COAP_SUCCESS;
+    case SENML_BN:
+    case SENML_BU:
+    case SENML_N:
+    case SENML_U:
+    case SENML_VS:
+    case SENML_VD:
+        if (!v->is_str) {
+            return COAP_ERR_PAYLOAD_INVALID;
+        }
+        if (label == SENML_BN) {
+            st->name = v->str;
+        }
+        else if (label == SENML_BU) {
+            st->unit = v->str;
+        }
+        else if (label == SENML_N) {
+            rec->name = v->str;
+        }
+        else if (label == SENML_U) {
+            rec->unit = v->str;
+        }
+        else {
+            rec->kind = (label == SENML_VS) ? COAP_SENML_STRING : COAP_SENML_DATA;
+            rec->str = v->str;
+        }
+        return COAP_SUCCESS;
+    case SENML_VB:
+        if (!v->is_bool) {
+            return COAP_ERR_PAYLOAD_INVALID;
+        }
+        rec->kind = COAP_SENML_BOOL;
+        rec->boolean = v->b;
+        return COAP_SUCCESS;
+    default:
+        return COAP_SUCCESS;
+    }
+}
+
+/* resolves a decoded object against the base values, false if it only sets
+ * base values */
+static bool _resolve(const senml_state_t *st, coap_senml_record_t *rec,
+                     const bool has_time)
+{
+    if (!rec->name.len && (rec->kind == COAP_SENML_NONE) && !rec->has_sum) {
+        return false;
+    }
+    rec->base_name = st->name;
+    if (!rec->unit.p) {
+        rec->unit = st->unit;
+    }
+    if (rec->kind == COAP_SENML_VALUE) {
+        rec->value += st->value;
+    }
+    if (rec->has_sum) {
+        rec->sum += st->sum;
+    }
+    rec->time = (has_time ? rec->time : 0) + st->time;
+    return true;
+}
+
+static int _json_label(const coap_buffer_t *key)
+{
+    for (size_t i = 0; i < sizeof(json_labels) / sizeof(json_labels[0]); ++i) {
+        if (_buf_equal_str(key, json_labels[i].name)) {
+            return json_labels[i].label;
+        }
+    }
+    // labels ending with _ must be understood, https://tools.ietf.org/html/rfc8428#section-4.4
+    if (key->len && (key->p[key->len - 1] == '_')) {
+        return SENML_MUST_UNDERSTAND;
+    }
+    return SENML_UNKNOWN;
+}
+
+static coap_state_t _unpack_json(const coap_buffer_t *payload,
+                                 coap_senml_record_t *records, size_t *count)
+{
+    coap_json_reader_t r;
+    coap_json_token_t tok;
+    senml_state_t st;
+    size_t n = 0;
+
+    memset(&st, 0, sizeof(st));
+    coap_json_reader_init(&r, payload->p, payload->len);
+    if (coap_json_expect(&r, COAP_JSON_ARRAY, &tok) != COAP_SUCCESS) {
+        return COAP_ERR_PAYLOAD_INVALID;
+    }
+    for (;;) {
+        coap_senml_record_t rec;
+        bool has_time = false;
+        if (coap_json_next(&r, &tok) != COAP_SUCCESS) {
+            return COAP_ERR_PAYLOAD_INVALID;
+        }
+        if (tok.type == COAP_JSON_END) {
+            break;
+        }
+        if (tok.type != COAP_JSON_OBJECT) {
+            return COAP_ERR_PAYLOAD_INVALID;
+        }
+        memset(&rec, 0, sizeof(rec));
+        // the reader only returns keys or the end inside an object
+        while ((coap_json_next(&r, &tok) == COAP_SUCCESS) &&
+               (tok.type == COAP_JSON_KEY)) {
+            senml_value_t v;
+            const int label = _json_label(&tok.str);
+            if (label == SENML_MUST_UNDERSTAND) {
+                return COAP_ERR_PAYLOAD_INVALID;
+            }
+            if (label == SENML_UNKNOWN) {
+                if (coap_json_skip(&r) != COAP_SUCCESS) {
+                    return COAP_ERR_PAYLOAD_INVALID;
+                }
+                continue;
+            }
+            if (coap_json_next(&r, &tok) != COAP_SUCCESS) {
+                return COAP_ERR_PAYLOAD_INVALID;
+            }
+            memset(&v, 0, sizeof(v));
+            switch (tok.type) {
+            case COAP_JSON_NUMBER:
+                v.is_num = true;
+                if (coap_json_number(&tok, &v.num) != COAP_SUCCESS) {
+                    return COAP_ERR_PAYLOAD_INVALID;
+                }
+                break;
+            case COAP_JSON_STRING:
+                v.is_str = true;
+                v.str = tok.str;
+                break;
+            case COAP_JSON_BOOL:
+                v.is_bool = true;
+                v.b = tok.b;
+                break;
+            default:
+                return COAP_ERR_PAYLOAD_INVALID;
+            }
+            if (_apply(&st, &rec, label, &v) != COAP_SUCCESS) {
+                return COAP_ERR_PAYLOAD_INVALID;
+            }
+            has_time |= (label == SENML_T);
+        }
+        if (tok.type != COAP_JSON_END) {
+            return COAP_ERR_PAYLOAD_INVALID;
+        }
+        if (_resolve(&st, &rec, has_time)) {
+            if (n == *count) {
+                return COAP_ERR_BUFFER_TOO_SMALL;
+            }
+            records[n++] = rec;
+        }
+    }
+    if (!coap_json_at_end(&r)) {
+        return COAP_ERR_PAYLOAD_INVALID;
+    }
+    *count = n;
+    return COAP_SUCCESS;
+}
+
+static coap_state_t _unpack_cbor(const coap_buffer_t *payload,
+                                 coap_senml_record_t *records, size_t *count)
+{
+    coap_cbor_reader_t r;
+    coap_cbor_item_t array, map, key, item;
+    senml_state_t st;
+    size_t n = 0;
+
+    memset(&st, 0, sizeof(st));
+    coap_cbor_reader_init(&r, payload->p, payload->len);
+    if (coap_cbor_expect(&r, COAP_CBOR_ARRAY, &array) != COAP_SUCCESS) {
+        return COAP_ERR_PAYLOAD_INVALID;
+    }
+    for (uint64_t i = 0; (array.v.count == COAP_CBOR_INDEFINITE) || (i < array.v.count); ++i) {
+        coap_senml_record_t rec;
+        bool has_time = false;
+        if ((array.v.count == COAP_CBOR_INDEFINITE) &&
+            (coap_cbor_peek(&r, &item) == COAP_SUCCESS) &&
+            (item.type == COAP_CBOR_BREAK)) {
+            coap_cbor_next(&r, &item);
+            break;
+        }
+        if ((coap_cbor_expect(&r, COAP_CBOR_MAP, &map) != COAP_SUCCESS) ||
+            (map.v.count == COAP_CBOR_INDEFINITE)) {
+            return COAP_ERR_PAYLOAD_INVALID;
+        }
+        memset(&rec, 0, sizeof(rec));
+        for (uint64_t j = 0; j < map.v.count; ++j) {
+            senml_value_t v;
+            if (coap_cbor_next(&r, &key) != COAP_SUCCESS) {
+                return COAP_ERR_PAYLOAD_INVALID;
+            }
+            if (((key.type != COAP_CBOR_UINT) && (key.type != COAP_CBOR_NEGINT)) ||
+                ((key.type == COAP_CBOR_UINT) && (key.v.u > SENML_VD)) ||
+                ((key.type == COAP_CBOR_NEGINT) && (key.v.i < SENML_BS))) {
+                // text labels and unknown numbers are extensions
+                if (coap_cbor_skip(&r) != COAP_SUCCESS) {
+                    return COAP_ERR_PAYLOAD_INVALID;
+                }
+                continue;
+            }
+            if (coap_cbor_next(&r, &item) != COAP_SUCCESS) {
+                return COAP_ERR_PAYLOAD_INVALID;
+            }
+            memset(&v, 0, sizeof(v));
+            switch (item.type) {
+            case COAP_CBOR_UINT:
+                v.is_num = true;
+                v.num = (double)item.v.u;
+                break;
+            case COAP_CBOR_NEGINT:
+                v.is_num = true;
+                v.num = (double)item.v.i;
+                break;
+            case COAP_CBOR_FLOAT:
+                v.is_num = true;
+                v.num = item.v.f;
+                break;
+            case COAP_CBOR_BOOL:
+                v.is_bool = true;
+                v.b = item.v.b;
+                break;
+            case COAP_CBOR_TEXT:
+            case COAP_CBOR_BYTES:
+                if (!item.v.str.p) {
+                    return COAP_ERR_PAYLOAD_INVALID;
+                }
+                // vd is a byte string, all other strings text
+                if ((item.type == COAP_CBOR_BYTES) != (key.v.i == SENML_VD)) {
+                    return COAP_ERR_PAYLOAD_INVALID;
+                }
+                v.is_str = true;
+                v.str = item.v.str;
+                break;
+            default:
+                return COAP_ERR_PAYLOAD_INVALID;
+            }
+            if (_apply(&st, &rec, (int)key.v.i, &v) != COAP_SUCCESS) {
+                return COAP_ERR_PAYLOAD_INVALID;
+            }
+            has_time |= (key.v.i == SENML_T);
+        }
+        if (_resolve(&st, &rec, has_time)) {
+            if (n == *count) {
+                return COAP_ERR_BUFFER_TOO_SMALL;
+            }
+            records[n++] = rec;
+        }
+    }
+    if (!coap_cbor_at_end(&r)) {
+        return COAP_ERR_PAYLOAD_INVALID;
+    }
+    *count = n;
+    return COAP_SUCCESS;
+}
+
+/* --- PUBLIC --------------------------------------------------------------- */
+coap_state_t coap_senml_pack_init(coap_senml_pack_t *pack,
+                                  const coap_content_type_t format,
+                                  const coap_senml_base_t *base,
+                                  uint8_t *buf, const size_t len)
+{
+    if ((format != COAP_CONTENTTYPE_APP_SENML_JSON) &&
+        (format != COAP_CONTENTTYPE_APP_SENML_CBOR)) {
+        return COAP_ERR_UNSUPPORTED;
+    }
+    pack->format = format;
+    memset(&pack->base, 0, sizeof(pack->base));
+    if (base) {
+        pack->base = *base;
+    }
+    pack->count = 0;
+    // JSON "[" and room for the closing "]", CBOR array head
+    if (format == COAP_CONTENTTYPE_APP_SENML_JSON) {
+        if (len < 2) {
+            return COAP_ERR_BUFFER_TOO_SMALL;
+        }
+        coap_json_writer_init(&pack->w.json, buf, len);
+        coap_json_begin_array(&pack->w.json);
+    }
+    else {
+        if (len < SENML_CBOR_HEAD) {
+            return COAP_ERR_BUFFER_TOO_SMALL;
+        }
+        coap_cbor_writer_init(&pack->w.cbor, buf, len);
+        pack->w.cbor.pos = SENML_CBOR_HEAD;
+    }
+    return COAP_SUCCESS;
+}
+
+coap_state_t coap_senml_pack_add(coap_senml_pack_t *pack,
+                                 const coap_senml_record_t *rec)
+{
+    const bool with_unit = rec->unit.len && !_buf_equal_str(&rec->unit, pack->base.unit);
+    coap_state_t rc;
+
+    if (pack->format == COAP_CONTENTTYPE_APP_SENML_JSON) {
+        const coap_json_writer_t saved = pack->w.json;
+        pack->w.json.len--;     // keep room for "]"
+        _pack_json(pack, rec, !pack->count, with_unit);
+        pack->w.json.len = saved.len;
+        rc = pack->w.json.err;
+        if (rc != COAP_SUCCESS) {
+            pack->w.json = saved;
+            return rc;
+        }
+    }
+    else {
+        const size_t pos = pack->w.cbor.pos;
+        _pack_cbor(pack, rec, !pack->count, with_unit);
+        rc = pack->w.cbor.err;
+        if (rc != COAP_SUCCESS) {
+            pack->w.cbor.pos = pos;
+            pack->w.cbor.err = COAP_SUCCESS;
+            return rc;
+        }
+    }
+    pack->count++;
+    return COAP_SUCCESS;
+}
+
+size_t coap_senml_pack_finish(coap_senml_pack_t *pack)
+{
+    if (pack->format == COAP_CONTENTTYPE_APP_SENML_JSON) {
+        coap_json_end_array(&pack->w.json);
+        return pack->w.json.pos;
+    }
+    // write the array head in front of the records, then close the gap
+    uint8_t *p = pack->w.cbor.p;
+    coap_cbor_writer_t head;
+    uint8_t tmp[SENML_CBOR_HEAD + 6];
+    coap_cbor_writer_init(&head, tmp, sizeof(tmp));
+    coap_cbor_put_array(&head, pack->count);
+    size_t gap = SENML_CBOR_HEAD - head.pos;
+    if (head.pos > SENML_CBOR_HEAD) {
+        // more records than the head reserved for, cannot happen below 65536
+        return 0;
+    }
+    memmove(p + head.pos, p + SENML_CBOR_HEAD, pack->w.cbor.pos - SENML_CBOR_HEAD);
+    memcpy(p, tmp, head.pos);
+    pack->w.cbor.pos -= gap;
+    return pack->w.cbor.pos;
+}
+
+coap_state_t coap_senml_unpack(const coap_buffer_t *payload,
+                               const coap_content_type_t format,
+                               coap_senml_record_t *records,
+                               size_t *count)
+{
+    if (format == COAP_CONTENTTYPE_APP_SENML_JSON) {
+        return _unpack_json(payload, records, count);
+    }
+    if (format == COAP_CONTENTTYPE_APP_SENML_CBOR) {
+        return _unpack_cbor(payload, records, count);
+    }
+    return COAP_ERR_UNSUPPORTED;
+}
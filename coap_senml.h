@@ -0,0 +1,137 @@
+#ifndef COAP_SENML_H
+#define COAP_SENML_H 1
+
+/**
+ * @file coap_senml.h
+ *
+ * SenML (RFC 8428) packs in JSON and CBOR. Packing appends records to a
+ * datagram or Block2 buffer until it is full, with base name, time and unit
+ * written once per pack. Unpacking resolves base values into a caller array
+ * of records whose strings are views into the payload.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "coap.h"
+#include "coap_cbor.h"
+#include "coap_json.h"
+
+/**
+ * Kind of value a record carries
+ */
+typedef enum
+{
+    COAP_SENML_NONE                 = 0,    //!< no value, e.g. only a sum
+    COAP_SENML_VALUE,                       //!< v, numeric
+    COAP_SENML_STRING,                      //!< vs
+    COAP_SENML_BOOL,                        //!< vb
+    COAP_SENML_DATA,                        //!< vd
+} coap_senml_kind_t;
+
+/**
+ * Base values of a pack, see https://tools.ietf.org/html/rfc8428#section-4.1
+ */
+typedef struct coap_senml_base
+{
+    const char *name;       //!< bn, prefix of all record names, or NULL
+    double time;            //!< bt, record times are relative to it, or 0
+    const char *unit;       //!< bu, unit of records without one, or NULL
+} coap_senml_base_t;
+
+/**
+ * Resolved record
+ *
+ * When packing, base_name is ignored and time is absolute, 0 for none.
+ * When unpacking, all fields are resolved against the base values in effect:
+ * base_name holds bn, time is bt + t, value bv + v, sum bs + s, unit u or bu.
+ * Strings point into the payload, JSON strings are not unescaped.
+ */
+typedef struct coap_senml_record
+{
+    coap_buffer_t base_name;    //!< bn in effect, unpack only
+    coap_buffer_t name;         //!< n, appended to the base name
+    coap_buffer_t unit;         //!< u
+    coap_senml_kind_t kind;     //!< which value is set
+    double value;               //!< v
+    coap_buffer_t str;          //!< vs, or vd (base64url text in JSON)
+    bool boolean;               //!< vb
+    bool has_sum;               //!< s is set
+    double sum;                 //!< s
+    double time;                //!< t, absolute
+} coap_senml_record_t;
+
+/**
+ * Pack being written
+ */
+typedef struct coap_senml_pack
+{
+    coap_content_type_t format;     //!< SenML JSON or CBOR content format
+    union {
+        coap_cbor_writer_t cbor;    //!< SenML CBOR
+        coap_json_writer_t json;    //!< SenML JSON
+    } w;                            //!< output buffer
+    coap_senml_base_t base;         //!< written with the first record
+    size_t count;                   //!< records in the pack
+} coap_senml_pack_t;
+
+/**
+ * @brief Start a pack
+ *
+ * @param[out] pack Pack to initialise
+ * @param[in] format COAP_CONTENTTYPE_APP_SENML_JSON or _CBOR
+ * @param[in] base Base values, or NULL; the strings must stay valid
+ * @param[out] buf Buffer the pack is written to, e.g. the response payload
+ * @param[in] len Size of \p buf, the maximum payload size
+ *
+ * @return 0 on success, COAP_ERR_UNSUPPORTED for other formats or
+ * COAP_ERR_BUFFER_TOO_SMALL if \p buf cannot even hold an empty pack
+ */
+coap_state_t coap_senml_pack_init(coap_senml_pack_t *pack,
+                                  const coap_content_type_t format,
+                                  const coap_senml_base_t *base,
+                                  uint8_t *buf, const size_t len);
+
+/**
+ * @brief Append a record
+ *
+ * A record that does not fit leaves the pack as it was, so that the caller
+ * can finish and send it and continue with a new pack.
+ *
+ * @return 0 on success, or COAP_ERR_BUFFER_TOO_SMALL if the record does not
+ * fit
+ */
+coap_state_t coap_senml_pack_add(coap_senml_pack_t *pack,
+                                 const coap_senml_record_t *rec);
+
+/**
+ * @brief Close the pack
+ *
+ * @return Length of the pack in bytes
+ */
+size_t coap_senml_pack_finish(coap_senml_pack_t *pack);
+
+/**
+ * @brief Decode a pack into an array of resolved records
+ *
+ * @param[in] payload Payload to decode, e.g. inpkt->payload
+ * @param[in] format COAP_CONTENTTYPE_APP_SENML_JSON or _CBOR
+ * @param[out] records Records to fill
+ * @param[in,out] count Capacity of \p records, then the records decoded
+ *
+ * @return 0 on success, COAP_ERR_BUFFER_TOO_SMALL if the pack holds more
+ * than \p count records, the first ones are decoded then,
+ * COAP_ERR_PAYLOAD_INVALID if the pack is malformed or COAP_ERR_UNSUPPORTED
+ * for other formats
+ */
+coap_state_t coap_senml_unpack(const coap_buffer_t *payload,
+                               const coap_content_type_t format,
+                               coap_senml_record_t *records,
+                               size_t *count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
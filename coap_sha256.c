@@ -0,0 +1,205 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "coap_sha256.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SHA256_SHANI 1
+#include <immintrin.h>
+#else
+#define SHA256_SHANI 0
+#endif
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+/* --- PRIVATE -------------------------------------------------------------- */
+static inline uint32_t _ror(const uint32_t x, const unsigned n)
+{
+    return (x >> n) | (x << (32 - n));
+}
+
+static void _block(uint32_t h[8], const uint8_t *p)
+{
+    uint32_t w[64], a, b, c, d, e, f, g, k;
+
+    for (int i = 0; i < 16; ++i) {
+        w[i] = (uint32_t)p[4 * i] << 24 | (uint32_t)p[4 * i + 1] << 16 |
+               (uint32_t)p[4 * i + 2] << 8 | p[4 * i + 3];
+    }
+    for (int i = 16; i < 64; ++i) {
+        const uint32_t s0 = _ror(w[i - 15], 7) ^ _ror(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        const uint32_t s1 = _ror(w[i - 2], 17) ^ _ror(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    a = h[0]; b = h[1]; c = h[2]; d = h[3]; e = h[4]; f = h[5]; g = h[6]; k = h[7];
+    for (int i = 0; i < 64; ++i) {
+        const uint32_t t1 = k + (_ror(e, 6) ^ _ror(e, 11) ^ _ror(e, 25)) +
+                            ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+        const uint32_t t2 = (_ror(a, 2) ^ _ror(a, 13) ^ _ror(a, 22)) +
+                            ((a & b) ^ (a & c) ^ (b & c));
+        k = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+    h[4] += e; h[5] += f; h[6] += g; h[7] += k;
+}
+
+#if SHA256_SHANI
+/* the same compression on the SHA extensions, four rounds per two instructions */
+__attribute__((target("sha,sse4.1")))
+static void _block_shani(uint32_t h[8], const uint8_t *p)
+{
+    const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i w[4], tmp, state0, state1;
+
+    // h as ABEF and CDGH, the operand order of sha256rnds2
+    tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&h[0]), 0xB1);
+    state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&h[4]), 0x1B);
+    state0 = _mm_alignr_epi8(tmp, state1, 8);
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+    const __m128i abef = state0, cdgh = state1;
+
+    for (int i = 0; i < 4; ++i) {
+        w[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + 16 * i)), bswap);
+    }
+    for (int i = 0; i < 16; ++i) {
+        const __m128i msg = _mm_add_epi32(w[i & 3], _mm_loadu_si128((const __m128i *)&sha256_k[4 * i]));
+        state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+        state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0E));
+        if (i < 12) {
+            // the next four words of the schedule replace the ones just used
+            tmp = _mm_sha256msg1_epu32(w[i & 3], w[(i + 1) & 3]);
+            tmp = _mm_add_epi32(tmp, _mm_alignr_epi8(w[(i + 3) & 3], w[(i + 2) & 3], 4));
+            w[i & 3] = _mm_sha256msg2_epu32(tmp, w[(i + 3) & 3]);
+        }
+    }
+
+    state0 = _mm_add_epi32(state0, abef);
+    state1 = _mm_add_epi32(state1, cdgh);
+    tmp = _mm_shuffle_epi32(state0, 0x1B);
+    state1 = _mm_shuffle_epi32(state1, 0xB1);
+    _mm_storeu_si128((__m128i *)&h[0], _mm_blend_epi16(tmp, state1, 0xF0));
+    _mm_storeu_si128((__m128i *)&h[4], _mm_alignr_epi8(state1, tmp, 8));
+}
+#endif
+
+static bool _shani_supported(void)
+{
+#if SHA256_SHANI
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sha") && __builtin_cpu_supports("sse4.1");
+#else
+    return false;
+#endif
+}
+
+static inline void _compress(coap_sha256_t *s, const uint8_t *p)
+{
+#if SHA256_SHANI
+    if (s->shani) {
+        _block_shani(s->h, p);
+        return;
+    }
+#endif
+    _block(s->h, p);
+}
+
+/* --- PUBLIC --------------------------------------------------------------- */
+void coap_sha256_init(coap_sha256_t *s)
+{
+    static const uint32_t iv[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    memcpy(s->h, iv, sizeof(iv));
+    s->buflen = 0;
+    s->total = 0;
+    s->shani = _shani_supported();
+}
+
+void coap_sha256_update(coap_sha256_t *s, const uint8_t *p, size_t len)
+{
+    s->total += len;
+    while (len) {
+        if (!s->buflen && (len >= COAP_SHA256_BLOCK_SIZE)) {
+            _compress(s, p);
+            p += COAP_SHA256_BLOCK_SIZE;
+            len -= COAP_SHA256_BLOCK_SIZE;
+            continue;
+        }
+        const size_t room = COAP_SHA256_BLOCK_SIZE - s->buflen;
+        const size_t n = (room < len) ? room : len;
+        memcpy(s->buf + s->buflen, p, n);
+        s->buflen += n;
+        p += n;
+        len -= n;
+        if (s->buflen == COAP_SHA256_BLOCK_SIZE) {
+            _compress(s, s->buf);
+            s->buflen = 0;
+        }
+    }
+}
+
+void coap_sha256_final(coap_sha256_t *s, uint8_t out[COAP_SHA256_SIZE])
+{
+    const uint64_t bits = s->total * 8;
+    uint8_t pad[COAP_SHA256_BLOCK_SIZE + 8] = { 0x80 };
+    const size_t padlen = ((s->buflen < 56) ? 56 : 120) - s->buflen;
+
+    for (int i = 0; i < 8; ++i) {
+        pad[padlen + i] = (uint8_t)(bits >> (56 - 8 * i));
+    }
+    coap_sha256_update(s, pad, padlen + 8);
+    for (int i = 0; i < 8; ++i) {
+        out[4 * i] = (uint8_t)(s->h[i] >> 24);
+        out[4 * i + 1] = (uint8_t)(s->h[i] >> 16);
+        out[4 * i + 2] = (uint8_t)(s->h[i] >> 8);
+        out[4 * i + 3] = (uint8_t)s->h[i];
+    }
+}
+
+void coap_hmac_sha256_init(coap_hmac_sha256_t *mac, const uint8_t *key, size_t keylen)
+{
+    uint8_t pad[COAP_SHA256_BLOCK_SIZE], hashed[COAP_SHA256_SIZE];
+
+    if (keylen > sizeof(pad)) {
+        coap_sha256_init(&mac->inner);
+        coap_sha256_update(&mac->inner, key, keylen);
+        coap_sha256_final(&mac->inner, hashed);
+        key = hashed;
+        keylen = sizeof(hashed);
+    }
+    memset(pad, 0x36, sizeof(pad));
+    for (size_t i = 0; i < keylen; ++i) {
+        pad[i] ^= key[i];
+    }
+    coap_sha256_init(&mac->inner);
+    coap_sha256_update(&mac->inner, pad, sizeof(pad));
+    for (size_t i = 0; i < sizeof(pad); ++i) {
+        pad[i] ^= 0x36 ^ 0x5c;
+    }
+    coap_sha256_init(&mac->outer);
+    coap_sha256_update(&mac->outer, pad, sizeof(pad));
+}
+
+void coap_hmac_sha256(const coap_hmac_sha256_t *mac, const uint8_t *data, const size_t len,
+                      uint8_t out[COAP_SHA256_SIZE])
+{
+    coap_sha256_t s = mac->inner;
+
+    coap_sha256_update(&s, data, len);
+    coap_sha256_final(&s, out);
+    s = mac->outer;
+    coap_sha256_update(&s, out, COAP_SHA256_SIZE);
+    coap_sha256_final(&s, out);
+}
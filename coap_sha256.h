@@ -0,0 +1,86 @@
+#ifndef COAP_SHA256_H
+#define COAP_SHA256_H 1
+
+/**
+ * @file coap_sha256.h
+ *
+ * SHA-256 and HMAC-SHA256 (RFC 6234, RFC 2104) for the modules that need a
+ * hash or a MAC without a crypto library: the key derivation of OSCORE and
+ * the Echo values of coap_echo. An HMAC key is prepared once, so that each
+ * MAC of a short message costs two compressions. They run on the SHA
+ * extensions where the processor has them, decided at run time, and on a
+ * portable implementation otherwise.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define COAP_SHA256_SIZE        32
+#define COAP_SHA256_BLOCK_SIZE  64
+
+/**
+ * Hash state
+ */
+typedef struct coap_sha256
+{
+    uint32_t h[8];
+    uint8_t buf[COAP_SHA256_BLOCK_SIZE];
+    size_t buflen;
+    uint64_t total;         //!< bytes hashed
+    bool shani;             //!< SHA extensions in use, clear it to force the portable code
+} coap_sha256_t;
+
+/**
+ * HMAC key, the hash states after the inner and the outer padded key
+ */
+typedef struct coap_hmac_sha256
+{
+    coap_sha256_t inner;
+    coap_sha256_t outer;
+} coap_hmac_sha256_t;
+
+/**
+ * @brief Start a hash
+ */
+void coap_sha256_init(coap_sha256_t *s);
+
+/**
+ * @brief Hash \p len more bytes at \p p
+ */
+void coap_sha256_update(coap_sha256_t *s, const uint8_t *p, size_t len);
+
+/**
+ * @brief Finish a hash, \p s has to be started again to be reused
+ */
+void coap_sha256_final(coap_sha256_t *s, uint8_t out[COAP_SHA256_SIZE]);
+
+/**
+ * @brief Prepare an HMAC key
+ *
+ * @param[out] mac Key
+ * @param[in] key Key bytes, hashed first if longer than a block
+ * @param[in] keylen Length of \p key, may be 0
+ */
+void coap_hmac_sha256_init(coap_hmac_sha256_t *mac, const uint8_t *key, const size_t keylen);
+
+/**
+ * @brief HMAC-SHA256 of \p len bytes at \p data
+ *
+ * @param[in] mac Key from coap_hmac_sha256_init, unchanged
+ * @param[in] data Message
+ * @param[in] len Length of \p data
+ * @param[out] out MAC
+ */
+void coap_hmac_sha256(const coap_hmac_sha256_t *mac, const uint8_t *data, const size_t len,
+                      uint8_t out[COAP_SHA256_SIZE]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef COAP_TRACE_H
+#define COAP_TRACE_H 1
+
+/**
+ * @file coap_trace.h
+ *
+ * Static USDT probes, see tools/bpftrace for sample scripts. Probes are
+ * compiled in with YACOAP_USDT (make USDT=1) and require <sys/sdt.h>
+ * (systemtap-sdt-dev). Each probe is a single nop until a tracer attaches,
+ * arguments that are costly to compute are guarded by the probe semaphore.
+ *
+ * Provider yacoap, probes and arguments:
+ *   receive(len, msgid)
+ *   parse(state, msgid, code, len)
+ *   dispatch(msgid, code, path_hash, resource_index or -1)
+ *   handler_start(msgid, code, path_hash)
+ *   handler_end(msgid, state, rspcode, payload_len)
+ *   build(state, msgid, code, len)
+ *   send(len, msgid)
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if YACOAP_USDT
+
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+#define COAP_TRACE_SEMAPHORE(name)  yacoap_##name##_semaphore
+
+/**
+ * @brief Declare/define the semaphore of a probe, the tracer increments it
+ * while attached
+ */
+#define COAP_TRACE_SEMAPHORE_DECLARE(name) \
+    extern unsigned short COAP_TRACE_SEMAPHORE(name)
+#define COAP_TRACE_SEMAPHORE_DEFINE(name) \
+    unsigned short COAP_TRACE_SEMAPHORE(name) \
+    __attribute__((section(".probes"), used)) = 0
+
+COAP_TRACE_SEMAPHORE_DECLARE(receive);
+COAP_TRACE_SEMAPHORE_DECLARE(parse);
+COAP_TRACE_SEMAPHORE_DECLARE(dispatch);
+COAP_TRACE_SEMAPHORE_DECLARE(handler_start);
+COAP_TRACE_SEMAPHORE_DECLARE(handler_end);
+COAP_TRACE_SEMAPHORE_DECLARE(build);
+COAP_TRACE_SEMAPHORE_DECLARE(send);
+
+/**
+ * @brief True if a tracer is attached to probe \p name
+ */
+#define COAP_TRACE_ENABLED(name) \
+    __builtin_expect(COAP_TRACE_SEMAPHORE(name) != 0, 0)
+
+#define COAP_TRACE_RECEIVE(len, msgid) \
+    DTRACE_PROBE2(yacoap, receive, len, msgid)
+#define COAP_TRACE_PARSE(state, msgid, code, len) \
+    DTRACE_PROBE4(yacoap, parse, state, msgid, code, len)
+#define COAP_TRACE_DISPATCH(msgid, code, hash, index) \
+    DTRACE_PROBE4(yacoap, dispatch, msgid, code, hash, index)
+#define COAP_TRACE_HANDLER_START(msgid, code, hash) \
+    DTRACE_PROBE3(yacoap, handler_start, msgid, code, hash)
+#define COAP_TRACE_HANDLER_END(msgid, state, rspcode, len) \
+    DTRACE_PROBE4(yacoap, handler_end, msgid, state, rspcode, len)
+#define COAP_TRACE_BUILD(state, msgid, code, len) \
+    DTRACE_PROBE4(yacoap, build, state, msgid, code, len)
+#define COAP_TRACE_SEND(len, msgid) \
+    DTRACE_PROBE2(yacoap, send, len, msgid)
+
+#else /* YACOAP_USDT */
+
+#define COAP_TRACE_ENABLED(name)                            (0)
+#define COAP_TRACE_RECEIVE(len, msgid)                      do {} while (0)
+#define COAP_TRACE_PARSE(state, msgid, code, len)           do {} while (0)
+#define COAP_TRACE_DISPATCH(msgid, code, hash, index)       do {} while (0)
+#define COAP_TRACE_HANDLER_START(msgid, code, hash)         do {} while (0)
+#define COAP_TRACE_HANDLER_END(msgid, state, rspcode, len)  do {} while (0)
+#define COAP_TRACE_BUILD(state, msgid, code, len)           do {} while (0)
+#define COAP_TRACE_SEND(len, msgid)                         do {} while (0)
+
+#endif /* YACOAP_USDT */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,169 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE     // recvmmsg
+#endif
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <linux/net_tstamp.h>
+#include <sys/socket.h>
+
+#include "coap.h"
+#include "coap_metrics.h"
+#include "coap_tstamp.h"
+
+/* --- PRIVATE -------------------------------------------------------------- */
+static uint64_t _clock(const clockid_t id)
+{
+    struct timespec now;
+    clock_gettime(id, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+/* the stamp of a datagram, CLOCK_REALTIME ns, or 0 */
+static uint64_t _stamp(const struct msghdr *msg)
+{
+    struct timespec stamp[3];
+
+    if (msg->msg_flags & MSG_CTRUNC) {
+        return 0;
+    }
+    for (struct cmsghdr *c = CMSG_FIRSTHDR(msg); c; c = CMSG_NXTHDR((struct msghdr *)msg, c)) {
+        if ((c->cmsg_level != SOL_SOCKET) ||
+            ((c->cmsg_type != SCM_TIMESTAMPING) && (c->cmsg_type != SCM_TIMESTAMPNS))) {
+            continue;
+        }
+        // the software stamp comes first in both
+        memcpy(stamp, CMSG_DATA(c), sizeof(stamp[0]));
+        if (stamp[0].tv_sec || stamp[0].tv_nsec) {
+            return (uint64_t)stamp[0].tv_sec * 1000000000u + (uint64_t)stamp[0].tv_nsec;
+        }
+    }
+    return 0;
+}
+
+/* stamps are on the realtime clock, a step of it can make them later than now */
+static uint64_t _delay(coap_tstamp_t *ts, const uint64_t stamp, const uint64_t now)
+{
+    if (!stamp) {
+        ts->unstamped++;
+        return 0;
+    }
+    ts->stamped++;
+    const uint64_t delay = (now > stamp) ? now - stamp : 0;
+    COAP_METRICS_OBSERVE(COAP_HIST_KERNEL_TO_USER_NS, delay);
+    return delay;
+}
+
+/* --- PUBLIC --------------------------------------------------------------- */
+coap_state_t coap_tstamp_init(coap_tstamp_t *ts, const int fd, const uint64_t target_ns,
+                              const uint64_t interval_ns)
+{
+    const int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+    const int on = 1;
+
+    memset(ts, 0, sizeof(*ts));
+    ts->target_ns = target_ns ? target_ns : COAP_TSTAMP_TARGET_NS;
+    ts->interval_ns = interval_ns ? interval_ns : COAP_TSTAMP_INTERVAL_NS;
+    ts->interval_min = UINT64_MAX;
+    ts->interval_end = _clock(CLOCK_MONOTONIC) + ts->interval_ns;
+    if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) &&
+        setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on))) {
+        return COAP_ERR_UNSUPPORTED;
+    }
+    return COAP_SUCCESS;
+}
+
+ssize_t coap_tstamp_recvfrom(coap_tstamp_t *ts, const int fd, uint8_t *buf, const size_t size,
+                             struct sockaddr *addr, socklen_t *addrlen, uint64_t *delay_ns)
+{
+    union {
+        struct cmsghdr hdr;
+        uint8_t buf[COAP_TSTAMP_CONTROL_SIZE];
+    } control;
+    struct iovec iov = { buf, size };
+    struct msghdr msg = {
+        .msg_name = addr, .msg_namelen = *addrlen, .msg_iov = &iov, .msg_iovlen = 1,
+        .msg_control = control.buf, .msg_controllen = sizeof(control.buf)
+    };
+
+    *delay_ns = 0;
+    const ssize_t n = recvmsg(fd, &msg, 0);
+    if (n < 0) {
+        return n;
+    }
+    *delay_ns = coap_tstamp_delay(ts, &msg);
+    *addrlen = msg.msg_namelen;
+    return n;
+}
+
+uint64_t coap_tstamp_delay(coap_tstamp_t *ts, const struct msghdr *msg)
+{
+    const uint64_t now = _clock(CLOCK_REALTIME);
+    ts->received = _clock(CLOCK_MONOTONIC);
+    return _delay(ts, _stamp(msg), now);
+}
+
+int coap_tstamp_recvmmsg(coap_tstamp_t *ts, const int fd, struct mmsghdr *msgs,
+                         const unsigned vlen, const int flags, uint64_t *delay_ns)
+{
+    const int n = recvmmsg(fd, msgs, vlen, flags, NULL);
+    if (n <= 0) {
+        return n;
+    }
+    const uint64_t now = _clock(CLOCK_REALTIME);
+    ts->received = _clock(CLOCK_MONOTONIC);
+    for (int i = 0; i < n; ++i) {
+        delay_ns[i] = _delay(ts, _stamp(&msgs[i].msg_hdr), now);
+    }
+    return n;
+}
+
+bool coap_tstamp_admit(coap_tstamp_t *ts, const uint64_t delay_ns)
+{
+    if (!delay_ns) {
+        return true;
+    }
+    if (delay_ns < ts->interval_min) {
+        ts->interval_min = delay_ns;
+    }
+    // a standing queue is one that stayed above the target a whole interval
+    if (ts->received >= ts->interval_end) {
+        ts->shedding = ts->interval_min > ts->target_ns;
+        ts->interval_min = UINT64_MAX;
+        ts->interval_end = ts->received + ts->interval_ns;
+    }
+    if (ts->shedding && (delay_ns > ts->target_ns)) {
+        ts->shed++;
+        COAP_METRICS_INC(COAP_METRIC_SHED);
+        return false;
+    }
+    return true;
+}
+
+coap_state_t coap_tstamp_reject(const coap_packet_t *inpkt, coap_packet_t *pkt)
+{
+    static const uint8_t max_age[] = { COAP_TSTAMP_RETRY_S };
+
+    if (inpkt->hdr.t != COAP_TYPE_CON) {
+        return COAP_RSP_RECV;
+    }
+    coap_make_response(inpkt->hdr.id, &inpkt->tok, COAP_TYPE_ACK,
+                       COAP_RSPCODE_SERVICE_UNAVAILABLE, NULL, NULL, 0, pkt);
+    coap_add_option(pkt, COAP_OPTION_MAX_AGE, max_age, sizeof(max_age));
+    return COAP_RSP_SEND;
+}
+
+void coap_tstamp_sent(const coap_tstamp_t *ts, const size_t n)
+{
+#if YACOAP_METRICS
+    const uint64_t spent = _clock(CLOCK_MONOTONIC) - ts->received;
+    for (size_t i = 0; i < n; ++i) {
+        COAP_METRICS_OBSERVE(COAP_HIST_USER_TO_SEND_NS, spent);
+    }
+#else
+    (void)ts;
+    (void)n;
+#endif
+}
@@ -0,0 +1,157 @@
+#ifndef COAP_TSTAMP_H
+#define COAP_TSTAMP_H 1
+
+/**
+ * @file coap_tstamp.h
+ *
+ * How long requests wait in the socket queue, and load shedding on it. The
+ * kernel stamps each datagram as it reaches the socket, with
+ * SO_TIMESTAMPING software receive stamps, or SO_TIMESTAMPNS where that is
+ * refused, and hands the stamp over as ancillary data of recvmsg or
+ * recvmmsg. The time from the stamp to the return of the receive is the
+ * queueing delay of the request, the time from there to the response sent
+ * is the time the server spent on it; with YACOAP_METRICS both go into the
+ * histograms yacoap_kernel_to_user_ns and yacoap_user_to_send_ns.
+ *
+ * A queue that never drains within an interval is a standing queue, load
+ * the server cannot keep up with, while bursts drain by themselves. As
+ * with CoDel, once the smallest delay of an interval is above the target,
+ * requests that waited longer than the target are shed for the next
+ * interval: confirmable ones answered with 5.03 and Max-Age, so that the
+ * client backs off instead of retransmitting into the queue, the others
+ * dropped, all before they reach a handler. Datagrams without a stamp are
+ * always admitted.
+ *
+ * Not thread safe, one state per socket and thread.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "coap.h"
+
+#define COAP_TSTAMP_TARGET_NS       5000000     //!< acceptable standing delay, 5 ms
+#define COAP_TSTAMP_INTERVAL_NS     100000000   //!< to tell a burst from a standing queue
+#define COAP_TSTAMP_RETRY_S         2           //!< Max-Age of 5.03, seconds
+/** ancillary data of a stamp, the size of msg_control with recvmmsg */
+#define COAP_TSTAMP_CONTROL_SIZE    CMSG_SPACE(3 * sizeof(struct timespec))
+
+struct mmsghdr;             // <sys/socket.h> declares it with _GNU_SOURCE
+
+/**
+ * Queueing delay and shedding state of a server socket
+ */
+typedef struct coap_tstamp
+{
+    uint64_t target_ns;
+    uint64_t interval_ns;
+    uint64_t interval_end;  //!< monotonic ns
+    uint64_t interval_min;  //!< smallest delay of the interval so far
+    uint64_t received;      //!< monotonic ns the last receive returned
+    bool shedding;          //!< the last interval had a standing queue
+    uint32_t stamped;       //!< datagrams with a stamp
+    uint32_t unstamped;     //!< datagrams without
+    uint32_t shed;          //!< requests not admitted
+} coap_tstamp_t;
+
+/**
+ * @brief Turn on receive stamps of a socket and set up the shedding
+ *
+ * @param[out] ts State
+ * @param[in] fd Server socket
+ * @param[in] target_ns Delay tolerated, 0 for COAP_TSTAMP_TARGET_NS
+ * @param[in] interval_ns Interval of the minimum, 0 for COAP_TSTAMP_INTERVAL_NS
+ *
+ * @return 0 on success, or COAP_ERR_UNSUPPORTED if the socket takes neither
+ * SO_TIMESTAMPING nor SO_TIMESTAMPNS
+ */
+coap_state_t coap_tstamp_init(coap_tstamp_t *ts, const int fd, const uint64_t target_ns,
+                              const uint64_t interval_ns);
+
+/**
+ * @brief Receive a datagram, like recvfrom, and its queueing delay
+ *
+ * @param[in,out] ts State
+ * @param[in] fd Server socket
+ * @param[out] buf Datagram
+ * @param[in] size Size of \p buf
+ * @param[out] addr Source address
+ * @param[in,out] addrlen Size of \p addr, then length of the address
+ * @param[out] delay_ns Time in the socket queue, 0 without a stamp
+ *
+ * @return Length of the datagram, or -1 with errno set
+ */
+ssize_t coap_tstamp_recvfrom(coap_tstamp_t *ts, const int fd, uint8_t *buf, const size_t size,
+                             struct sockaddr *addr, socklen_t *addrlen, uint64_t *delay_ns);
+
+/**
+ * @brief Queueing delay of a datagram received with recvmsg
+ *
+ * For a receive of one's own that also takes other ancillary data, e.g. the
+ * packet info of coap_mcast_destination; call it right after recvmsg
+ * returns, with COAP_TSTAMP_CONTROL_SIZE bytes of msg_control for the stamp.
+ *
+ * @param[in,out] ts State
+ * @param[in] msg Message of recvmsg
+ *
+ * @return Time in the socket queue, 0 without a stamp
+ */
+uint64_t coap_tstamp_delay(coap_tstamp_t *ts, const struct msghdr *msg);
+
+/**
+ * @brief Receive datagrams, like recvmmsg, and their queueing delays
+ *
+ * @param[in,out] ts State
+ * @param[in] fd Server socket
+ * @param[in,out] msgs Messages, each with COAP_TSTAMP_CONTROL_SIZE bytes of
+ * msg_control
+ * @param[in] vlen Number of \p msgs
+ * @param[in] flags Flags of recvmmsg, e.g. MSG_DONTWAIT
+ * @param[out] delay_ns Time in the socket queue per datagram, 0 without a stamp
+ *
+ * @return Number of datagrams received, or -1 with errno set
+ */
+int coap_tstamp_recvmmsg(coap_tstamp_t *ts, const int fd, struct mmsghdr *msgs,
+                         const unsigned vlen, const int flags, uint64_t *delay_ns);
+
+/**
+ * @brief Decide whether to serve a request
+ *
+ * @param[in,out] ts State
+ * @param[in] delay_ns Queueing delay of the request
+ *
+ * @return false if it is shed, see coap_tstamp_reject
+ */
+bool coap_tstamp_admit(coap_tstamp_t *ts, const uint64_t delay_ns);
+
+/**
+ * @brief Response to a request shed
+ *
+ * @param[in] inpkt Request
+ * @param[out] pkt Response, 5.03 Service Unavailable with Max-Age
+ *
+ * @return COAP_RSP_SEND for a confirmable request, COAP_RSP_RECV if the
+ * request is dropped
+ */
+coap_state_t coap_tstamp_reject(const coap_packet_t *inpkt, coap_packet_t *pkt);
+
+/**
+ * @brief Record the time from the last receive to the responses sent
+ *
+ * @param[in] ts State
+ * @param[in] n Responses sent since, the batch of a recvmmsg
+ */
+void coap_tstamp_sent(const coap_tstamp_t *ts, const size_t n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,683 @@
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "coap.h"
+#include "coap_ws.h"
+
+enum {
+    CONN_HANDSHAKE,         //!< waiting for the upgrade request
+    CONN_OPEN,
+    CONN_CLOSING,           //!< closed after the send buffer
+};
+
+// close status codes, https://tools.ietf.org/html/rfc6455#section-7.4.1
+#define WS_CLOSE_NORMAL         1000
+#define WS_CLOSE_PROTOCOL       1002
+#define WS_CLOSE_UNSUPPORTED    1003
+#define WS_CLOSE_TOO_BIG        1009
+
+#define WS_CSM_MAX_MESSAGE_SIZE 2   //!< CSM option, https://tools.ietf.org/html/rfc8323#section-5.3.1
+
+static const char _guid[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+/* --- PRIVATE -------------------------------------------------------------- */
+static uint32_t _rol(const uint32_t x, const int n)
+{
+    return (x << n) | (x >> (32 - n));
+}
+
+static void _sha1_block(uint32_t h[5], const uint8_t *p)
+{
+    uint32_t w[80];
+    for (int i = 0; i < 16; ++i) {
+        w[i] = (uint32_t)p[4 * i] << 24 | (uint32_t)p[4 * i + 1] << 16 |
+               (uint32_t)p[4 * i + 2] << 8 | p[4 * i + 3];
+    }
+    for (int i = 16; i < 80; ++i) {
+        w[i] = _rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+    for (int i = 0; i < 80; ++i) {
+        const uint32_t f = (i < 20) ? ((b & c) | (~b & d)) + 0x5A827999 :
+                           (i < 40) ? (b ^ c ^ d) + 0x6ED9EBA1 :
+                           (i < 60) ? ((b & c) | (b & d) | (c & d)) + 0x8F1BBCDC :
+                                      (b ^ c ^ d) + 0xCA62C1D6;
+        const uint32_t t = _rol(a, 5) + f + e + w[i];
+        e = d;
+        d = c;
+        c = _rol(b, 30);
+        b = a;
+        a = t;
+    }
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+}
+
+/* SHA-1 of a message short enough for two blocks, the handshake only */
+static void _sha1(const uint8_t *msg, const size_t len, uint8_t digest[20])
+{
+    uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+    uint8_t block[128] = { 0 };
+    const size_t blocks = (len + 8) / 64 + 1;
+
+    memcpy(block, msg, len);
+    block[len] = 0x80;
+    for (int i = 0; i < 8; ++i) {
+        block[blocks * 64 - 1 - i] = (uint8_t)(((uint64_t)len * 8) >> (8 * i));
+    }
+    for (size_t i = 0; i < blocks; ++i) {
+        _sha1_block(h, block + 64 * i);
+    }
+    for (int i = 0; i < 20; ++i) {
+        digest[i] = (uint8_t)(h[i / 4] >> (24 - 8 * (i % 4)));
+    }
+}
+
+static uint8_t _lower(const uint8_t c)
+{
+    return ((c >= 'A') && (c <= 'Z')) ? c + ('a' - 'A') : c;
+}
+
+/* case insensitive \p p of \p len against lower case \p s */
+static bool _ieq(const char *p, const size_t len, const char *s)
+{
+    if (len != strlen(s)) {
+        return false;
+    }
+    for (size_t i = 0; i < len; ++i) {
+        if (_lower((uint8_t)p[i]) != (uint8_t)s[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* comma separated header value \p v of \p len has token \p s */
+static bool _has_token(const char *v, const size_t len, const char *s)
+{
+    for (size_t i = 0; i < len;) {
+        size_t j = i;
+        while ((j < len) && (v[j] != ',')) {
+            j++;
+        }
+        size_t b = i, e = j;
+        while ((b < e) && ((v[b] == ' ') || (v[b] == '\t'))) {
+            b++;
+        }
+        while ((e > b) && ((v[e - 1] == ' ') || (v[e - 1] == '\t'))) {
+            e--;
+        }
+        if (_ieq(v + b, e - b, s)) {
+            return true;
+        }
+        i = j + 1;
+    }
+    return false;
+}
+
+static void _close(coap_ws_conn_t *conn)
+{
+    close(conn->fd);
+    conn->fd = -1;
+}
+
+/* sends what it can, false if the connection is gone */
+static bool _flush(coap_ws_conn_t *conn)
+{
+    while (conn->txoff < conn->txlen) {
+        const ssize_t n = send(conn->fd, conn->tx + conn->txoff, conn->txlen - conn->txoff,
+                               MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0) {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+                return true;
+            }
+            _close(conn);
+            return false;
+        }
+        conn->txoff += (size_t)n;
+    }
+    conn->txoff = conn->txlen = 0;
+    if (conn->state == CONN_CLOSING) {
+        _close(conn);
+        return false;
+    }
+    return true;
+}
+
+/* appends a frame to the send buffer, a peer that does not read is dropped */
+static bool _queue(coap_ws_conn_t *conn, const coap_ws_opcode_t opcode,
+                   const uint8_t *payload, const size_t len)
+{
+    if (conn->txoff) {
+        memmove(conn->tx, conn->tx + conn->txoff, conn->txlen - conn->txoff);
+        conn->txlen -= conn->txoff;
+        conn->txoff = 0;
+    }
+    if (sizeof(conn->tx) - conn->txlen < 10 + len) {
+        _close(conn);
+        return false;
+    }
+    conn->txlen += coap_ws_frame_header(conn->tx + conn->txlen, opcode, len);
+    if (len) {
+        memcpy(conn->tx + conn->txlen, payload, len);
+    }
+    conn->txlen += len;
+    return true;
+}
+
+/* close frame with \p status, the connection ends once it is sent */
+static void _fail(coap_ws_t *ws, coap_ws_conn_t *conn, const uint16_t status)
+{
+    const uint8_t payload[2] = { status >> 8, status & 0xFF };
+    ws->errors += (status != WS_CLOSE_NORMAL);
+    if (_queue(conn, COAP_WS_CLOSE, payload, sizeof(payload))) {
+        conn->state = CONN_CLOSING;
+    }
+}
+
+static bool _signal(coap_ws_conn_t *conn, const coap_signalcode_t code,
+                    const coap_buffer_t *tok, const coap_option_t *opt)
+{
+    uint8_t buf[32];
+    size_t len = sizeof(buf);
+    coap_packet_t pkt;
+
+    memset(&pkt, 0, sizeof(pkt));
+    pkt.hdr.ver = COAP_VERSION;
+    pkt.hdr.code = code;
+    if (tok && tok->len) {
+        pkt.hdr.tkl = (uint8_t)tok->len;
+        pkt.tok = *tok;
+    }
+    if (opt) {
+        pkt.numopts = 1;
+        pkt.opts[0] = *opt;
+    }
+    return (coap_build_tcp(&pkt, COAP_FRAMING_WS, buf, &len) == COAP_SUCCESS) &&
+           _queue(conn, COAP_WS_BINARY, buf, len);
+}
+
+/* one CoAP message of a binary frame */
+static bool _message(coap_ws_t *ws, coap_ws_conn_t *conn, const uint8_t *buf, const size_t len)
+{
+    coap_packet_t pkt, rsp;
+    size_t msglen;
+
+    if (coap_parse_tcp(buf, len, COAP_FRAMING_WS, &pkt, &msglen) != COAP_SUCCESS) {
+        // message format error, https://tools.ietf.org/html/rfc8323#section-5.6
+        if (_signal(conn, COAP_SIGNAL_ABORT, NULL, NULL)) {
+            _fail(ws, conn, WS_CLOSE_PROTOCOL);
+        }
+        return false;
+    }
+    if ((pkt.hdr.code >> 5) == 7) {
+        ws->signals++;
+        switch (pkt.hdr.code) {
+        case COAP_SIGNAL_PING:
+            return _signal(conn, COAP_SIGNAL_PONG, &pkt.tok, NULL);
+        case COAP_SIGNAL_RELEASE:
+        case COAP_SIGNAL_ABORT:
+            _fail(ws, conn, WS_CLOSE_NORMAL);
+            return false;
+        default:
+            return true;    // CSM and Pong, nothing is sent that needs them
+        }
+    }
+    if ((pkt.hdr.code == COAP_RSPCODE_EMPTY) || (pkt.hdr.code >> 5)) {
+        return true;        // empty, https://tools.ietf.org/html/rfc8323#section-4.4, or a response
+    }
+    uint8_t out[COAP_WS_MAX_MESSAGE];
+    size_t outlen = sizeof(out);
+    ws->requests++;
+    coap_handle_request(ws->resources, &pkt, &rsp);
+    if (coap_build_tcp(&rsp, COAP_FRAMING_WS, out, &outlen) != COAP_SUCCESS) {
+        coap_make_response(0, &pkt.tok, COAP_TYPE_ACK, COAP_RSPCODE_INTERNAL_SERVER_ERROR,
+                           NULL, NULL, 0, &rsp);
+        outlen = sizeof(out);
+        coap_build_tcp(&rsp, COAP_FRAMING_WS, out, &outlen);
+    }
+    return _queue(conn, COAP_WS_BINARY, out, outlen);
+}
+
+/* frames in rx, messages assembled at its start */
+static void _frames(coap_ws_t *ws, coap_ws_conn_t *conn)
+{
+    size_t pos = conn->msglen;
+    coap_ws_frame_t f;
+
+    while ((conn->fd >= 0) && (conn->state == CONN_OPEN)) {
+        const coap_state_t rc = coap_ws_parse_frame(conn->rx + pos, conn->rxlen - pos, true, &f);
+        if (rc == COAP_ERR_HEADER_TOO_SHORT) {
+            if (f.headlen && (conn->msglen + f.headlen + f.len >= sizeof(conn->rx))) {
+                _fail(ws, conn, WS_CLOSE_TOO_BIG);
+            }
+            break;
+        }
+        if (rc != COAP_SUCCESS) {
+            _fail(ws, conn, WS_CLOSE_PROTOCOL);
+            break;
+        }
+        pos += f.headlen + f.len;
+        if (f.opcode >= COAP_WS_CLOSE) {
+            if (f.opcode == COAP_WS_PING) {
+                _queue(conn, COAP_WS_PONG, f.payload, f.len);
+            }
+            else if (f.opcode == COAP_WS_CLOSE) {
+                // echo the status, https://tools.ietf.org/html/rfc6455#section-5.5.1
+                if (_queue(conn, COAP_WS_CLOSE, f.payload, (f.len >= 2) ? 2 : 0)) {
+                    conn->state = CONN_CLOSING;
+                }
+            }
+            continue;
+        }
+        if ((f.opcode == COAP_WS_CONTINUATION) != conn->fragmented) {
+            _fail(ws, conn, WS_CLOSE_PROTOCOL);
+            break;
+        }
+        if (f.opcode == COAP_WS_TEXT) {
+            _fail(ws, conn, WS_CLOSE_UNSUPPORTED);    // CoAP goes in binary frames
+            break;
+        }
+        if (f.fin && !conn->fragmented) {
+            _message(ws, conn, f.payload, f.len);
+            continue;
+        }
+        memmove(conn->rx + conn->msglen, f.payload, f.len);
+        conn->msglen += f.len;
+        conn->fragmented = !f.fin;
+        if (f.fin) {
+            _message(ws, conn, conn->rx, conn->msglen);
+            conn->msglen = 0;
+        }
+    }
+    if (conn->fd >= 0) {
+        memmove(conn->rx + conn->msglen, conn->rx + pos, conn->rxlen - pos);
+        conn->rxlen = conn->msglen + conn->rxlen - pos;
+    }
+}
+
+static void _handshake(coap_ws_t *ws, coap_ws_conn_t *conn)
+{
+    static const char bad[] = "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\n"
+                              "Connection: close\r\n\r\n";
+    static const char not_found[] = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n"
+                                    "Connection: close\r\n\r\n";
+    static const char version[] = "HTTP/1.1 426 Upgrade Required\r\nContent-Length: 0\r\n"
+                                  "Sec-WebSocket-Version: 13\r\nConnection: close\r\n\r\n";
+    char *req = (char *)conn->rx;
+    const char *end, *key = NULL;
+    size_t keylen = 0;
+    bool upgrade = false, connection = false, protocol = false, v13 = false;
+    const char *rsp = bad;
+
+    conn->rx[conn->rxlen] = '\0';
+    if (!(end = strstr(req, "\r\n\r\n"))) {
+        if (conn->rxlen == sizeof(conn->rx) - 1) {
+            conn->state = CONN_CLOSING;
+            memcpy(conn->tx, bad, sizeof(bad) - 1);
+            conn->txlen = sizeof(bad) - 1;
+        }
+        return;
+    }
+    const size_t reqlen = (size_t)(end + 4 - req);
+    const char *eol = strstr(req, "\r\n");
+    const size_t pathlen = strlen(COAP_WS_PATH);
+    if (strncmp(req, "GET ", 4) || (eol - req < 4 + 9) || strncmp(eol - 9, " HTTP/1.1", 9)) {
+        goto reject;
+    }
+    if (((size_t)(eol - req) != 4 + pathlen + 9) || strncmp(req + 4, COAP_WS_PATH, pathlen)) {
+        rsp = not_found;
+        goto reject;
+    }
+    for (const char *h = eol + 2; h < end;) {
+        const char *e = strstr(h, "\r\n");
+        const char *colon = memchr(h, ':', (size_t)(e - h));
+        if (colon) {
+            const char *v = colon + 1;
+            size_t vlen = (size_t)(e - v);
+            while (vlen && ((*v == ' ') || (*v == '\t'))) {
+                v++;
+                vlen--;
+            }
+            while (vlen && ((v[vlen - 1] == ' ') || (v[vlen - 1] == '\t'))) {
+                vlen--;
+            }
+            const size_t nlen = (size_t)(colon - h);
+            if (_ieq(h, nlen, "upgrade")) {
+                upgrade = _has_token(v, vlen, "websocket");
+            }
+            else if (_ieq(h, nlen, "connection")) {
+                connection = _has_token(v, vlen, "upgrade");
+            }
+            else if (_ieq(h, nlen, "sec-websocket-key")) {
+                key = v;
+                keylen = vlen;
+            }
+            else if (_ieq(h, nlen, "sec-websocket-version")) {
+                v13 = _ieq(v, vlen, "13");
+            }
+            else if (_ieq(h, nlen, "sec-websocket-protocol")) {
+                protocol = protocol || _has_token(v, vlen, "coap");
+            }
+        }
+        h = e + 2;
+    }
+    if (!v13) {
+        rsp = version;
+    }
+    if (!upgrade || !connection || !protocol || !v13 || (keylen != 24)) {
+        goto reject;
+    }
+
+    char accept[COAP_WS_ACCEPT_LEN + 1];
+    coap_ws_accept_key(key, keylen, accept);
+    conn->txlen = (size_t)snprintf((char *)conn->tx, sizeof(conn->tx),
+                                   "HTTP/1.1 101 Switching Protocols\r\n"
+                                   "Upgrade: websocket\r\nConnection: Upgrade\r\n"
+                                   "Sec-WebSocket-Accept: %s\r\n"
+                                   "Sec-WebSocket-Protocol: coap\r\n\r\n", accept);
+    conn->state = CONN_OPEN;
+    memmove(conn->rx, conn->rx + reqlen, conn->rxlen - reqlen);
+    conn->rxlen -= reqlen;
+    ws->connections++;
+
+    // the CSM comes first, https://tools.ietf.org/html/rfc8323#section-5.3
+    uint8_t size[4];
+    const coap_option_t max_message = {
+        WS_CSM_MAX_MESSAGE_SIZE, { size, coap_encode_uint(COAP_WS_MAX_MESSAGE, size) }
+    };
+    if (_signal(conn, COAP_SIGNAL_CSM, NULL, &max_message)) {
+        _frames(ws, conn);
+    }
+    return;
+
+reject:
+    conn->state = CONN_CLOSING;
+    conn->txlen = strlen(rsp);
+    memcpy(conn->tx, rsp, conn->txlen);
+}
+
+static void _read(coap_ws_t *ws, coap_ws_conn_t *conn)
+{
+    // room for the 0 the handshake is terminated with
+    const size_t size = sizeof(conn->rx) - 1 - conn->rxlen;
+    const ssize_t n = size ? recv(conn->fd, conn->rx + conn->rxlen, size, MSG_DONTWAIT) : 0;
+    if ((size && (n == 0)) || ((n < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK))) {
+        _close(conn);
+        return;
+    }
+    if (n <= 0) {
+        return;
+    }
+    conn->rxlen += (size_t)n;
+    if (conn->state == CONN_HANDSHAKE) {
+        _handshake(ws, conn);
+    }
+    else if (conn->state == CONN_OPEN) {
+        _frames(ws, conn);
+    }
+    else {
+        conn->rxlen = 0;    // closing, the rest is of no interest
+    }
+}
+
+static void _accept_all(coap_ws_t *ws)
+{
+    for (;;) {
+        const int fd = accept(ws->lfd, NULL, NULL);
+        if (fd < 0) {
+            return;
+        }
+        coap_ws_conn_t *conn = NULL;
+        for (size_t i = 0; i < ws->max_conns; ++i) {
+            if (ws->conns[i].fd < 0) {
+                conn = &ws->conns[i];
+                break;
+            }
+        }
+        if (!conn) {
+            close(fd);
+            continue;
+        }
+        const int one = 1;
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        conn->fd = fd;
+        conn->state = CONN_HANDSHAKE;
+        conn->fragmented = false;
+        conn->msglen = conn->rxlen = conn->txlen = conn->txoff = 0;
+    }
+}
+
+/* --- PUBLIC --------------------------------------------------------------- */
+void coap_ws_mask(uint8_t *buf, const size_t len, const uint8_t key[4])
+{
+    uint32_t k32;
+    size_t i = 0;
+
+    // the key repeated in memory order, blocks of 4n bytes keep its phase
+    memcpy(&k32, key, sizeof(k32));
+#if defined(__AVX2__)
+    const __m256i k256 = _mm256_set1_epi32((int)k32);
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(buf + i));
+        _mm256_storeu_si256((__m256i *)(buf + i), _mm256_xor_si256(v, k256));
+    }
+#endif
+#if defined(__SSE2__)
+    const __m128i k128 = _mm_set1_epi32((int)k32);
+    for (; i + 64 <= len; i += 64) {
+        __m128i v0 = _mm_loadu_si128((const __m128i *)(buf + i));
+        __m128i v1 = _mm_loadu_si128((const __m128i *)(buf + i + 16));
+        __m128i v2 = _mm_loadu_si128((const __m128i *)(buf + i + 32));
+        __m128i v3 = _mm_loadu_si128((const __m128i *)(buf + i + 48));
+        _mm_storeu_si128((__m128i *)(buf + i), _mm_xor_si128(v0, k128));
+        _mm_storeu_si128((__m128i *)(buf + i + 16), _mm_xor_si128(v1, k128));
+        _mm_storeu_si128((__m128i *)(buf + i + 32), _mm_xor_si128(v2, k128));
+        _mm_storeu_si128((__m128i *)(buf + i + 48), _mm_xor_si128(v3, k128));
+    }
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+        _mm_storeu_si128((__m128i *)(buf + i), _mm_xor_si128(v, k128));
+    }
+#endif
+    const uint64_t k64 = (uint64_t)k32 << 32 | k32;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t w;
+        memcpy(&w, buf + i, sizeof(w));
+        w ^= k64;
+        memcpy(buf + i, &w, sizeof(w));
+    }
+    for (; i < len; ++i) {
+        buf[i] ^= key[i & 3];
+    }
+}
+
+// https://tools.ietf.org/html/rfc6455#section-5.2
+coap_state_t coap_ws_parse_frame(uint8_t *buf, const size_t buflen, const bool masked,
+                                 coap_ws_frame_t *frame)
+{
+    frame->headlen = 0;
+    frame->len = 0;
+    if (buflen < 2) {
+        return COAP_ERR_HEADER_TOO_SHORT;
+    }
+    const uint8_t opcode = buf[0] & 0x0F;
+    const bool mask = buf[1] & 0x80;
+    uint64_t len = buf[1] & 0x7F;
+    size_t headlen = 2 + (len == 126) * 2 + (len == 127) * 8 + mask * 4;
+
+    // no extensions, known opcodes, control frames short and not fragmented
+    if ((buf[0] & 0x70) || (mask != masked) || ((opcode > COAP_WS_BINARY) && (opcode < COAP_WS_CLOSE)) ||
+        (opcode > COAP_WS_PONG) || ((opcode >= COAP_WS_CLOSE) && (!(buf[0] & 0x80) || (len > 125)))) {
+        return COAP_ERR_UNSUPPORTED;
+    }
+    if (buflen < headlen) {
+        return COAP_ERR_HEADER_TOO_SHORT;
+    }
+    if (len == 126) {
+        len = (uint64_t)buf[2] << 8 | buf[3];
+    }
+    else if (len == 127) {
+        len = 0;
+        for (int i = 0; i < 8; ++i) {
+            len = len << 8 | buf[2 + i];
+        }
+        if (len >> 63) {
+            return COAP_ERR_UNSUPPORTED;
+        }
+    }
+    frame->fin = buf[0] & 0x80;
+    frame->opcode = opcode;
+    frame->headlen = headlen;
+    frame->len = (len > SIZE_MAX - headlen) ? SIZE_MAX - headlen : (size_t)len;
+    frame->payload = buf + headlen;
+    if (buflen - headlen < len) {
+        return COAP_ERR_HEADER_TOO_SHORT;
+    }
+    if (mask) {
+        coap_ws_mask(frame->payload, frame->len, buf + headlen - 4);
+    }
+    return COAP_SUCCESS;
+}
+
+size_t coap_ws_frame_header(uint8_t *buf, const coap_ws_opcode_t opcode, const size_t len)
+{
+    buf[0] = 0x80 | opcode;
+    if (len < 126) {
+        buf[1] = (uint8_t)len;
+        return 2;
+    }
+    if (len <= 0xFFFF) {
+        buf[1] = 126;
+        buf[2] = (uint8_t)(len >> 8);
+        buf[3] = (uint8_t)len;
+        return 4;
+    }
+    buf[1] = 127;
+    for (int i = 0; i < 8; ++i) {
+        buf[9 - i] = (uint8_t)((uint64_t)len >> (8 * i));
+    }
+    return 10;
+}
+
+void coap_ws_accept_key(const char *key, const size_t keylen,
+                        char accept[COAP_WS_ACCEPT_LEN + 1])
+{
+    static const char digits[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    uint8_t msg[64 + sizeof(_guid)], digest[21];
+    const size_t len = (keylen > 64) ? 64 : keylen;
+
+    memcpy(msg, key, len);
+    memcpy(msg + len, _guid, sizeof(_guid) - 1);
+    _sha1(msg, len + sizeof(_guid) - 1, digest);
+    digest[20] = 0;
+    for (size_t i = 0, n = 0; i < 21; i += 3) {
+        const uint32_t v = (uint32_t)digest[i] << 16 | (uint32_t)digest[i + 1] << 8 |
+                           ((i + 2 < 21) ? digest[i + 2] : 0);
+        accept[n++] = digits[v >> 18];
+        accept[n++] = digits[(v >> 12) & 63];
+        accept[n++] = digits[(v >> 6) & 63];
+        accept[n++] = (i + 2 < 20) ? digits[v & 63] : '=';
+    }
+    accept[COAP_WS_ACCEPT_LEN] = '\0';
+}
+
+coap_state_t coap_ws_init(coap_ws_t *ws, const int lfd, coap_resource_t *resources,
+                          const size_t max_conns)
+{
+    memset(ws, 0, sizeof(*ws));
+    ws->lfd = lfd;
+    ws->resources = resources;
+    ws->max_conns = max_conns;
+    ws->conns = malloc(max_conns * sizeof(*ws->conns));
+    ws->pollmap = malloc((max_conns + 1) * sizeof(*ws->pollmap));
+    if (!ws->conns || !ws->pollmap) {
+        coap_ws_free(ws);
+        return COAP_ERR_BUFFER_TOO_SMALL;
+    }
+    for (size_t i = 0; i < max_conns; ++i) {
+        ws->conns[i].fd = -1;
+    }
+    fcntl(lfd, F_SETFL, fcntl(lfd, F_GETFL) | O_NONBLOCK);
+    return COAP_SUCCESS;
+}
+
+void coap_ws_free(coap_ws_t *ws)
+{
+    for (size_t i = 0; ws->conns && (i < ws->max_conns); ++i) {
+        if (ws->conns[i].fd >= 0) {
+            _close(&ws->conns[i]);
+        }
+    }
+    free(ws->conns);
+    free(ws->pollmap);
+    ws->conns = NULL;
+    ws->pollmap = NULL;
+    ws->max_conns = 0;
+}
+
+size_t coap_ws_pollfds(coap_ws_t *ws, struct pollfd *fds, const size_t size)
+{
+    size_t n = 0;
+    if (size) {
+        fds[0].fd = ws->lfd;
+        fds[0].events = POLLIN;
+        fds[0].revents = 0;
+        ws->pollmap[n++] = -1;
+    }
+    for (size_t i = 0; (i < ws->max_conns) && (n < size); ++i) {
+        const coap_ws_conn_t *conn = &ws->conns[i];
+        if (conn->fd < 0) {
+            continue;
+        }
+        fds[n].fd = conn->fd;
+        fds[n].events = POLLIN | ((conn->txoff < conn->txlen) ? POLLOUT : 0);
+        fds[n].revents = 0;
+        ws->pollmap[n++] = (int)i;
+    }
+    return n;
+}
+
+void coap_ws_process(coap_ws_t *ws, const struct pollfd *fds, const size_t nfds)
+{
+    for (size_t i = 0; i < nfds; ++i) {
+        if (!fds[i].revents) {
+            continue;
+        }
+        if (ws->pollmap[i] < 0) {
+            _accept_all(ws);
+            continue;
+        }
+        coap_ws_conn_t *conn = &ws->conns[ws->pollmap[i]];
+        if (conn->fd != fds[i].fd) {
+            continue;   // closed meanwhile
+        }
+        if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+            _read(ws, conn);
+        }
+        // answers go out right away, what does not fit waits for POLLOUT
+        if ((conn->fd >= 0) && (conn->txoff < conn->txlen)) {
+            _flush(conn);
+        }
+    }
+}
@@ -0,0 +1,184 @@
+#ifndef COAP_WS_H
+#define COAP_WS_H 1
+
+/**
+ * @file coap_ws.h
+ *
+ * CoAP over WebSockets (RFC 8323 section 4), for browsers and networks that
+ * only let WebSockets through. Clients upgrade GET /.well-known/coap with
+ * the subprotocol "coap"; each binary frame then carries one CoAP message in
+ * the framing of the reliable transports (coap_parse_tcp, coap_build_tcp),
+ * without type, message ID or retransmissions. Requests are dispatched with
+ * coap_handle_request to the same resource table as the UDP server.
+ * Signaling: both sides start with a CSM, Ping is answered with Pong,
+ * Release and Abort end the connection.
+ *
+ * Like the HTTP-to-CoAP gateway the server runs in the poll loop of the
+ * application: poll the descriptors of coap_ws_pollfds and pass them to
+ * coap_ws_process. Connections are kept in a table allocated once by
+ * coap_ws_init. Not thread safe.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <poll.h>
+
+#include "coap.h"
+
+#ifndef COAP_WS_MAX_MESSAGE
+#define COAP_WS_MAX_MESSAGE     1152    //!< Max-Message-Size, a 1024 byte block with options
+#endif
+#define COAP_WS_RX_SIZE         2048    //!< handshake or message with frame headers
+#define COAP_WS_TX_SIZE         4096    //!< unsent frames
+#define COAP_WS_PATH            "/.well-known/coap"
+#define COAP_WS_ACCEPT_LEN      28      //!< Sec-WebSocket-Accept, base64 of a SHA-1
+
+/**
+ * Frame opcodes, see https://tools.ietf.org/html/rfc6455#section-5.2
+ */
+typedef enum
+{
+    COAP_WS_CONTINUATION        = 0,
+    COAP_WS_TEXT                = 1,
+    COAP_WS_BINARY              = 2,
+    COAP_WS_CLOSE               = 8,
+    COAP_WS_PING                = 9,
+    COAP_WS_PONG                = 10,
+} coap_ws_opcode_t;
+
+/**
+ * Parsed frame, see coap_ws_parse_frame
+ */
+typedef struct coap_ws_frame
+{
+    bool fin;               //!< last frame of the message
+    uint8_t opcode;         //!< coap_ws_opcode_t
+    size_t headlen;         //!< bytes before the payload
+    size_t len;             //!< payload length
+    uint8_t *payload;       //!< unmasked in place
+} coap_ws_frame_t;
+
+/**
+ * Connection, private
+ */
+typedef struct coap_ws_conn
+{
+    int fd;                 //!< -1 if unused
+    int state;              //!< handshake, open or closing
+    bool fragmented;        //!< a message is being assembled
+    size_t msglen;          //!< assembled at the start of rx
+    size_t rxlen;
+    size_t txlen;
+    size_t txoff;           //!< sent of tx
+    uint8_t rx[COAP_WS_RX_SIZE];
+    uint8_t tx[COAP_WS_TX_SIZE];
+} coap_ws_conn_t;
+
+/**
+ * WebSocket server
+ */
+typedef struct coap_ws
+{
+    int lfd;                //!< listening socket
+    coap_resource_t *resources;
+    coap_ws_conn_t *conns;
+    int *pollmap;           //!< connection of each poll entry, -1 for lfd
+    size_t max_conns;
+    uint32_t connections;   //!< upgraded
+    uint32_t requests;      //!< dispatched to the resources
+    uint32_t signals;       //!< signaling messages received
+    uint32_t errors;        //!< connections failed or aborted
+} coap_ws_t;
+
+/**
+ * @brief XOR \p buf with the masking key of a frame
+ *
+ * SIMD where the target has it, 8 bytes at a time otherwise.
+ *
+ * @param[in,out] buf Payload, from its first byte
+ * @param[in] len Length of \p buf
+ * @param[in] key Masking key of the frame
+ */
+void coap_ws_mask(uint8_t *buf, const size_t len, const uint8_t key[4]);
+
+/**
+ * @brief Parse a frame header and unmask its payload in place
+ *
+ * @param[in,out] buf Received bytes
+ * @param[in] buflen Length of \p buf
+ * @param[in] masked Frames must be masked, from clients, or must not
+ * @param[out] frame Frame, headlen and len already set if the header is
+ * complete but the payload not
+ *
+ * @return 0 on success, COAP_ERR_HEADER_TOO_SHORT if incomplete, or
+ * COAP_ERR_UNSUPPORTED for frames RFC 6455 does not allow
+ */
+coap_state_t coap_ws_parse_frame(uint8_t *buf, const size_t buflen, const bool masked,
+                                 coap_ws_frame_t *frame);
+
+/**
+ * @brief Write the header of an unmasked, final frame, as sent by servers
+ *
+ * @param[out] buf At least 10 bytes
+ * @param[in] opcode Frame opcode
+ * @param[in] len Payload length
+ *
+ * @return Header length
+ */
+size_t coap_ws_frame_header(uint8_t *buf, const coap_ws_opcode_t opcode, const size_t len);
+
+/**
+ * @brief Sec-WebSocket-Accept for Sec-WebSocket-Key \p key
+ *
+ * @param[in] key Key of the client
+ * @param[in] keylen Length of \p key
+ * @param[out] accept COAP_WS_ACCEPT_LEN characters and a terminating 0
+ */
+void coap_ws_accept_key(const char *key, const size_t keylen,
+                        char accept[COAP_WS_ACCEPT_LEN + 1]);
+
+/**
+ * @brief Set up a server
+ *
+ * @param[out] ws Server
+ * @param[in] lfd Listening TCP socket, made non-blocking
+ * @param[in] resources Resource table, shared with the UDP server
+ * @param[in] max_conns Concurrent connections, more are refused
+ *
+ * @return 0 on success, or COAP_ERR_BUFFER_TOO_SMALL if out of memory
+ */
+coap_state_t coap_ws_init(coap_ws_t *ws, const int lfd, coap_resource_t *resources,
+                          const size_t max_conns);
+
+/**
+ * @brief Close all connections and free the table
+ */
+void coap_ws_free(coap_ws_t *ws);
+
+/**
+ * @brief Descriptors to poll for
+ *
+ * @param[in,out] ws Server, remembers the order for coap_ws_process
+ * @param[out] fds Poll entries, max_conns + 1 always fit
+ * @param[in] size Entries in \p fds
+ *
+ * @return Entries used
+ */
+size_t coap_ws_pollfds(coap_ws_t *ws, struct pollfd *fds, const size_t size);
+
+/**
+ * @brief Accept, upgrade, read, dispatch and write as poll reported
+ *
+ * @param[in,out] ws Server
+ * @param[in] fds Entries of the last coap_ws_pollfds, with revents
+ * @param[in] nfds Number of \p fds
+ */
+void coap_ws_process(coap_ws_t *ws, const struct pollfd *fds, const size_t nfds);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,566 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE     // syscall
+#endif
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <linux/bpf.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "coap.h"
+#include "coap_xdp.h"
+
+#ifndef AF_XDP
+#define AF_XDP          44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP         283
+#endif
+
+#define XDP_ETH_LEN     14
+#define XDP_IP4_LEN     20
+#define XDP_IP6_LEN     40
+#define XDP_UDP_LEN     8
+#define XDP_TTL         64
+#define XDP_KICKS       4               // sendto per batch, the kernel sends 32 frames each
+
+#if (COAP_XDP_FRAMES & (COAP_XDP_FRAMES - 1)) || (COAP_XDP_RING_SIZE & (COAP_XDP_RING_SIZE - 1))
+#error "COAP_XDP_FRAMES and COAP_XDP_RING_SIZE must be powers of 2"
+#endif
+
+/* BPF instructions, as the kernel documents them */
+#define _MOV_REG(dst, src)          { BPF_ALU64 | BPF_MOV | BPF_X, dst, src, 0, 0 }
+#define _MOV_IMM(dst, imm)          { BPF_ALU64 | BPF_MOV | BPF_K, dst, 0, 0, imm }
+#define _ADD_IMM(dst, imm)          { BPF_ALU64 | BPF_ADD | BPF_K, dst, 0, 0, imm }
+#define _ADD_REG(dst, src)          { BPF_ALU64 | BPF_ADD | BPF_X, dst, src, 0, 0 }
+#define _AND_IMM(dst, imm)          { BPF_ALU64 | BPF_AND | BPF_K, dst, 0, 0, imm }
+#define _BE16(dst)                  { BPF_ALU | BPF_END | BPF_TO_BE, dst, 0, 0, 16 }
+#define _LDX(size, dst, src, off)   { BPF_LDX | size | BPF_MEM, dst, src, off, 0 }
+#define _JGT_REG(dst, src, off)     { BPF_JMP | BPF_JGT | BPF_X, dst, src, off, 0 }
+#define _JLT_IMM(dst, imm, off)     { BPF_JMP | BPF_JLT | BPF_K, dst, 0, off, imm }
+#define _JEQ_IMM(dst, imm, off)     { BPF_JMP | BPF_JEQ | BPF_K, dst, 0, off, imm }
+#define _JNE_IMM(dst, imm, off)     { BPF_JMP | BPF_JNE | BPF_K, dst, 0, off, imm }
+#define _JA(off)                    { BPF_JMP | BPF_JA, 0, 0, off, 0 }
+#define _LD_MAP(dst, fd)            { BPF_LD | BPF_DW | BPF_IMM, dst, BPF_PSEUDO_MAP_FD, 0, fd }, \
+                                    { 0, 0, 0, 0, 0 }
+#define _CALL(fn)                   { BPF_JMP | BPF_CALL, 0, 0, 0, fn }
+#define _EXIT()                     { BPF_JMP | BPF_EXIT, 0, 0, 0, 0 }
+
+/* --- PRIVATE -------------------------------------------------------------- */
+static int _bpf(const int cmd, union bpf_attr *attr)
+{
+    return (int)syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+/*
+ * The steering program, it redirects exactly the frames coap_xdp_respond
+ * takes for a request and passes the others to the kernel, which serves
+ * them as it would without the program. Packet loads compare against values
+ * loaded in network order, so the constants are htons'd, and lengths are
+ * swapped to host order before they are compared. Jump offsets count the
+ * instructions skipped: PASS is instruction 67, V6 38, REDIRECT 61.
+ */
+static int _program(const int map, const uint16_t port)
+{
+    const int32_t p = htons(port);
+    const struct bpf_insn insns[] = {
+        /*  0 */ _MOV_REG(BPF_REG_6, BPF_REG_1),
+        /*  1 */ _LDX(BPF_W, BPF_REG_2, BPF_REG_6, offsetof(struct xdp_md, data)),
+        /*  2 */ _LDX(BPF_W, BPF_REG_3, BPF_REG_6, offsetof(struct xdp_md, data_end)),
+        /*  3 */ _MOV_REG(BPF_REG_4, BPF_REG_2),
+        /*  4 */ _ADD_IMM(BPF_REG_4, XDP_ETH_LEN + XDP_IP4_LEN + XDP_UDP_LEN),
+        /*  5 */ _JGT_REG(BPF_REG_4, BPF_REG_3, 61),
+        /*  6 */ _LDX(BPF_B, BPF_REG_5, BPF_REG_2, 0),              // destination MAC
+        /*  7 */ _AND_IMM(BPF_REG_5, 0x01),
+        /*  8 */ _JNE_IMM(BPF_REG_5, 0, 58),
+        /*  9 */ _LDX(BPF_H, BPF_REG_5, BPF_REG_2, 12),             // EtherType
+        /* 10 */ _JEQ_IMM(BPF_REG_5, htons(0x86dd), 27),
+        /* 11 */ _JNE_IMM(BPF_REG_5, htons(0x0800), 55),
+        /* 12 */ _LDX(BPF_B, BPF_REG_5, BPF_REG_2, 14),             // version, IHL
+        /* 13 */ _JNE_IMM(BPF_REG_5, 0x45, 53),
+        /* 14 */ _LDX(BPF_B, BPF_REG_5, BPF_REG_2, 23),             // protocol
+        /* 15 */ _JNE_IMM(BPF_REG_5, IPPROTO_UDP, 51),
+        /* 16 */ _LDX(BPF_H, BPF_REG_5, BPF_REG_2, 20),             // MF, fragment offset
+        /* 17 */ _AND_IMM(BPF_REG_5, htons(0x3fff)),
+        /* 18 */ _JNE_IMM(BPF_REG_5, 0, 48),
+        /* 19 */ _LDX(BPF_B, BPF_REG_5, BPF_REG_2, 30),             // destination
+        /* 20 */ _JEQ_IMM(BPF_REG_5, 0xff, 46),
+        /* 21 */ _AND_IMM(BPF_REG_5, 0xf0),
+        /* 22 */ _JEQ_IMM(BPF_REG_5, 0xe0, 44),
+        /* 23 */ _LDX(BPF_H, BPF_REG_5, BPF_REG_2, 16),             // total length
+        /* 24 */ _BE16(BPF_REG_5),
+        /* 25 */ _AND_IMM(BPF_REG_5, 0xffff),                       // bounded for the verifier
+        /* 26 */ _LDX(BPF_H, BPF_REG_7, BPF_REG_2, 38),             // UDP length
+        /* 27 */ _BE16(BPF_REG_7),
+        /* 28 */ _JLT_IMM(BPF_REG_7, XDP_UDP_LEN, 38),
+        /* 29 */ _ADD_IMM(BPF_REG_7, XDP_IP4_LEN),
+        /* 30 */ _JGT_REG(BPF_REG_7, BPF_REG_5, 36),
+        /* 31 */ _MOV_REG(BPF_REG_4, BPF_REG_2),
+        /* 32 */ _ADD_REG(BPF_REG_4, BPF_REG_5),
+        /* 33 */ _ADD_IMM(BPF_REG_4, XDP_ETH_LEN),
+        /* 34 */ _JGT_REG(BPF_REG_4, BPF_REG_3, 32),
+        /* 35 */ _LDX(BPF_H, BPF_REG_5, BPF_REG_2, 36),             // UDP port
+        /* 36 */ _JNE_IMM(BPF_REG_5, p, 30),
+        /* 37 */ _JA(23),
+        /* 38 */ _MOV_REG(BPF_REG_4, BPF_REG_2),
+        /* 39 */ _ADD_IMM(BPF_REG_4, XDP_ETH_LEN + XDP_IP6_LEN + XDP_UDP_LEN),
+        /* 40 */ _JGT_REG(BPF_REG_4, BPF_REG_3, 26),
+        /* 41 */ _LDX(BPF_B, BPF_REG_5, BPF_REG_2, 14),             // version
+        /* 42 */ _AND_IMM(BPF_REG_5, 0xf0),
+        /* 43 */ _JNE_IMM(BPF_REG_5, 0x60, 23),
+        /* 44 */ _LDX(BPF_B, BPF_REG_5, BPF_REG_2, 20),             // next header
+        /* 45 */ _JNE_IMM(BPF_REG_5, IPPROTO_UDP, 21),
+        /* 46 */ _LDX(BPF_B, BPF_REG_5, BPF_REG_2, 38),             // destination
+        /* 47 */ _JEQ_IMM(BPF_REG_5, 0xff, 19),
+        /* 48 */ _LDX(BPF_H, BPF_REG_5, BPF_REG_2, 18),             // payload length
+        /* 49 */ _BE16(BPF_REG_5),
+        /* 50 */ _AND_IMM(BPF_REG_5, 0xffff),
+        /* 51 */ _LDX(BPF_H, BPF_REG_7, BPF_REG_2, 58),             // UDP length
+        /* 52 */ _BE16(BPF_REG_7),
+        /* 53 */ _JLT_IMM(BPF_REG_7, XDP_UDP_LEN, 13),
+        /* 54 */ _JGT_REG(BPF_REG_7, BPF_REG_5, 12),
+        /* 55 */ _MOV_REG(BPF_REG_4, BPF_REG_2),
+        /* 56 */ _ADD_REG(BPF_REG_4, BPF_REG_5),
+        /* 57 */ _ADD_IMM(BPF_REG_4, XDP_ETH_LEN + XDP_IP6_LEN),
+        /* 58 */ _JGT_REG(BPF_REG_4, BPF_REG_3, 8),
+        /* 59 */ _LDX(BPF_H, BPF_REG_5, BPF_REG_2, 56),             // UDP port
+        /* 60 */ _JNE_IMM(BPF_REG_5, p, 6),
+        /* 61 */ _LDX(BPF_W, BPF_REG_2, BPF_REG_6, offsetof(struct xdp_md, rx_queue_index)),
+        /* 62 */ _LD_MAP(BPF_REG_1, map),
+        /* 64 */ _MOV_IMM(BPF_REG_3, XDP_PASS),                     // if the socket is gone
+        /* 65 */ _CALL(BPF_FUNC_redirect_map),
+        /* 66 */ _EXIT(),
+        /* 67 */ _MOV_IMM(BPF_REG_0, XDP_PASS),
+        /* 68 */ _EXIT(),
+    };
+    static const char license[] = "GPL";    // bpf_redirect_map is GPL only
+    union bpf_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.prog_type = BPF_PROG_TYPE_XDP;
+    attr.insns = (uintptr_t)insns;
+    attr.insn_cnt = sizeof(insns) / sizeof(insns[0]);
+    attr.license = (uintptr_t)license;
+    return _bpf(BPF_PROG_LOAD, &attr);
+}
+
+static int _ring(coap_xdp_ring_t *ring, const int fd, const struct xdp_ring_offset *off,
+                 const uint32_t n, const size_t desc, const off_t pgoff)
+{
+    ring->maplen = off->desc + n * desc;
+    ring->map = mmap(NULL, ring->maplen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     fd, pgoff);
+    if (ring->map == MAP_FAILED) {
+        ring->map = NULL;
+        return -1;
+    }
+    ring->producer = (uint32_t *)((uint8_t *)ring->map + off->producer);
+    ring->consumer = (uint32_t *)((uint8_t *)ring->map + off->consumer);
+    ring->flags = (uint32_t *)((uint8_t *)ring->map + off->flags);
+    ring->descs = (uint8_t *)ring->map + off->desc;
+    ring->mask = n - 1;
+    return 0;
+}
+
+static int _rings(coap_xdp_t *xdp)
+{
+    struct xdp_mmap_offsets off;
+    socklen_t len = sizeof(off);
+    int n = COAP_XDP_FRAMES;
+
+    if ((setsockopt(xdp->fd, SOL_XDP, XDP_UMEM_FILL_RING, &n, sizeof(n)) < 0) ||
+        (setsockopt(xdp->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &n, sizeof(n)) < 0)) {
+        return -1;
+    }
+    n = COAP_XDP_RING_SIZE;
+    if ((setsockopt(xdp->fd, SOL_XDP, XDP_RX_RING, &n, sizeof(n)) < 0) ||
+        (setsockopt(xdp->fd, SOL_XDP, XDP_TX_RING, &n, sizeof(n)) < 0) ||
+        (getsockopt(xdp->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &len) < 0)) {
+        return -1;
+    }
+    if ((_ring(&xdp->fill, xdp->fd, &off.fr, COAP_XDP_FRAMES, sizeof(uint64_t),
+               XDP_UMEM_PGOFF_FILL_RING) < 0) ||
+        (_ring(&xdp->comp, xdp->fd, &off.cr, COAP_XDP_FRAMES, sizeof(uint64_t),
+               XDP_UMEM_PGOFF_COMPLETION_RING) < 0) ||
+        (_ring(&xdp->rx, xdp->fd, &off.rx, COAP_XDP_RING_SIZE, sizeof(struct xdp_desc),
+               XDP_PGOFF_RX_RING) < 0) ||
+        (_ring(&xdp->tx, xdp->fd, &off.tx, COAP_XDP_RING_SIZE, sizeof(struct xdp_desc),
+               XDP_PGOFF_TX_RING) < 0)) {
+        return -1;
+    }
+    return 0;
+}
+
+static void _unmap(coap_xdp_ring_t *ring)
+{
+    if (ring->map) {
+        munmap(ring->map, ring->maplen);
+        ring->map = NULL;
+    }
+}
+
+/* one's complement sum of big endian 16 bit words */
+static uint32_t _sum(const uint8_t *p, const size_t len, uint32_t sum)
+{
+    size_t i;
+    for (i = 0; i + 1 < len; i += 2) {
+        sum += (uint32_t)p[i] << 8 | p[i + 1];
+    }
+    if (i < len) {
+        sum += (uint32_t)p[i] << 8;
+    }
+    return sum;
+}
+
+static uint16_t _fold(uint32_t sum)
+{
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return (uint16_t)~sum;
+}
+
+static void _put16(uint8_t *p, const uint16_t v)
+{
+    p[0] = (uint8_t)(v >> 8);
+    p[1] = (uint8_t)v;
+}
+
+static uint16_t _get16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+/* sent frames, and frames not answered, are received into again */
+static void _fill(coap_xdp_t *xdp, const uint64_t *addrs, const uint32_t n)
+{
+    uint64_t *fill = xdp->fill.descs;
+    uint32_t prod = *xdp->fill.producer;
+
+    // the ring holds every chunk of the UMEM, it is never full
+    for (uint32_t i = 0; i < n; ++i) {
+        fill[prod++ & xdp->fill.mask] = addrs[i] & ~(uint64_t)(COAP_XDP_FRAME_SIZE - 1);
+    }
+    __atomic_store_n(xdp->fill.producer, prod, __ATOMIC_RELEASE);
+}
+
+static void _recycle(coap_xdp_t *xdp)
+{
+    const uint64_t *comp = xdp->comp.descs;
+    uint64_t addrs[COAP_XDP_BATCH];
+    uint32_t cons = *xdp->comp.consumer;
+    const uint32_t prod = __atomic_load_n(xdp->comp.producer, __ATOMIC_ACQUIRE);
+
+    while (cons != prod) {
+        uint32_t n = 0;
+        while ((cons != prod) && (n < COAP_XDP_BATCH)) {
+            addrs[n++] = comp[cons++ & xdp->comp.mask];
+        }
+        __atomic_store_n(xdp->comp.consumer, cons, __ATOMIC_RELEASE);
+        xdp->responses += n;
+        _fill(xdp, addrs, n);
+    }
+}
+
+/* --- PUBLIC --------------------------------------------------------------- */
+coap_state_t coap_xdp_respond(coap_resource_t *resources, const uint16_t port,
+                              uint8_t *frame, const size_t len, const size_t size,
+                              size_t *off, size_t *outlen)
+{
+    coap_packet_t pkt, rsp;
+    const uint8_t *ip = frame + XDP_ETH_LEN;
+    size_t iplen, udplen, hdrlen;
+    bool v6;
+
+    // broadcast and multicast frames, whatever the IP destination
+    if ((len < XDP_ETH_LEN + XDP_IP4_LEN + XDP_UDP_LEN) || (frame[0] & 0x01)) {
+        return COAP_ERR_UNSUPPORTED;
+    }
+    switch (_get16(frame + 12)) {
+    case 0x0800:
+        iplen = _get16(ip + 2);
+        if ((ip[0] != 0x45) || (ip[9] != IPPROTO_UDP) || (_get16(ip + 6) & 0x3fff) ||
+            ((ip[16] & 0xf0) == 0xe0) || (ip[16] == 0xff) ||
+            (iplen < XDP_IP4_LEN + XDP_UDP_LEN) || (iplen > len - XDP_ETH_LEN)) {
+            return COAP_ERR_UNSUPPORTED;
+        }
+        v6 = false;
+        hdrlen = XDP_IP4_LEN;
+        break;
+    case 0x86dd:
+        if (len < XDP_ETH_LEN + XDP_IP6_LEN + XDP_UDP_LEN) {
+            return COAP_ERR_UNSUPPORTED;
+        }
+        iplen = XDP_IP6_LEN + _get16(ip + 4);
+        if (((ip[0] >> 4) != 6) || (ip[6] != IPPROTO_UDP) || (ip[24] == 0xff) ||
+            (iplen < XDP_IP6_LEN + XDP_UDP_LEN) || (iplen > len - XDP_ETH_LEN)) {
+            return COAP_ERR_UNSUPPORTED;
+        }
+        v6 = true;
+        hdrlen = XDP_IP6_LEN;
+        break;
+    default:
+        return COAP_ERR_UNSUPPORTED;
+    }
+    const uint8_t *udp = ip + hdrlen;
+    udplen = _get16(udp + 4);
+    if ((_get16(udp + 2) != port) || (udplen < XDP_UDP_LEN) || (udplen > iplen - hdrlen)) {
+        return COAP_ERR_UNSUPPORTED;
+    }
+    // corrupted on the way, the kernel would have dropped it; a UDP checksum
+    // of 0 is none, allowed over IPv4 only
+    const uint16_t check = _get16(udp + 6);
+    uint32_t sum = v6 ? _sum(ip + 8, 32, IPPROTO_UDP) : _sum(ip + 12, 8, IPPROTO_UDP);
+    if ((!v6 && _fold(_sum(ip, XDP_IP4_LEN, 0))) || (v6 && !check) ||
+        (check && _fold(_sum(udp, udplen, sum + (uint32_t)udplen)))) {
+        return COAP_ERR_PAYLOAD_INVALID;
+    }
+    coap_state_t rc = coap_parse(udp + XDP_UDP_LEN, udplen - XDP_UDP_LEN, &pkt);
+    if (rc != COAP_SUCCESS) {
+        return rc;
+    }
+    coap_handle_request(resources, &pkt, &rsp);
+
+    // behind the request, aligned
+    hdrlen += XDP_ETH_LEN + XDP_UDP_LEN;
+    *off = (len + 7) & ~(size_t)7;
+    if ((size < *off) || (size - *off <= hdrlen)) {
+        return COAP_ERR_BUFFER_TOO_SMALL;
+    }
+    uint8_t *out = frame + *off;
+    uint8_t *oip = out + XDP_ETH_LEN;
+    uint8_t *oudp = out + hdrlen - XDP_UDP_LEN;
+    size_t room = size - *off - hdrlen;
+    size_t coaplen = (room < COAP_XDP_DGRAM_SIZE) ? room : COAP_XDP_DGRAM_SIZE;
+    const size_t max = coaplen;
+
+    if (coap_build(&rsp, oudp + XDP_UDP_LEN, &coaplen) != COAP_SUCCESS) {
+        coap_make_response(pkt.hdr.id, &pkt.tok, COAP_TYPE_ACK,
+                           COAP_RSPCODE_INTERNAL_SERVER_ERROR, NULL, NULL, 0, &rsp);
+        coaplen = max;
+        rc = coap_build(&rsp, oudp + XDP_UDP_LEN, &coaplen);
+        if (rc != COAP_SUCCESS) {
+            return rc;
+        }
+    }
+
+    // back to where the request came from
+    memcpy(out, frame + 6, 6);
+    memcpy(out + 6, frame, 6);
+    memcpy(out + 12, frame + 12, 2);
+    if (v6) {
+        oip[0] = 0x60;
+        oip[1] = oip[2] = oip[3] = 0;
+        _put16(oip + 4, (uint16_t)(XDP_UDP_LEN + coaplen));
+        oip[6] = IPPROTO_UDP;
+        oip[7] = XDP_TTL;
+        memcpy(oip + 8, ip + 24, 16);
+        memcpy(oip + 24, ip + 8, 16);
+        sum = _sum(oip + 8, 32, IPPROTO_UDP);
+    }
+    else {
+        oip[0] = 0x45;
+        oip[1] = 0;
+        _put16(oip + 2, (uint16_t)(XDP_IP4_LEN + XDP_UDP_LEN + coaplen));
+        _put16(oip + 4, 0);
+        _put16(oip + 6, 0x4000);    // DF
+        oip[8] = XDP_TTL;
+        oip[9] = IPPROTO_UDP;
+        _put16(oip + 10, 0);
+        memcpy(oip + 12, ip + 16, 4);
+        memcpy(oip + 16, ip + 12, 4);
+        _put16(oip + 10, _fold(_sum(oip, XDP_IP4_LEN, 0)));
+        sum = _sum(oip + 12, 8, IPPROTO_UDP);
+    }
+    memcpy(oudp, udp + 2, 2);
+    memcpy(oudp + 2, udp, 2);
+    _put16(oudp + 4, (uint16_t)(XDP_UDP_LEN + coaplen));
+    _put16(oudp + 6, 0);
+    sum = _sum(oudp, XDP_UDP_LEN + coaplen, sum + XDP_UDP_LEN + (uint32_t)coaplen);
+    const uint16_t csum = _fold(sum);
+    _put16(oudp + 6, csum ? csum : 0xffff);
+
+    *outlen = hdrlen + coaplen;
+    return COAP_RSP_SEND;
+}
+
+coap_state_t coap_xdp_init(coap_xdp_t *xdp, const unsigned ifindex, const unsigned queue,
+                           const uint16_t port, coap_resource_t *resources)
+{
+    const size_t umemlen = (size_t)COAP_XDP_FRAMES * COAP_XDP_FRAME_SIZE;
+    union bpf_attr attr;
+    struct sockaddr_xdp sxdp;
+    int err;
+
+    memset(xdp, 0, sizeof(*xdp));
+    xdp->prog = xdp->map = xdp->link = -1;
+    xdp->port = port;
+    xdp->resources = resources;
+    xdp->fd = socket(AF_XDP, SOCK_RAW | SOCK_CLOEXEC, 0);
+    xdp->umem = mmap(NULL, umemlen, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (xdp->umem == MAP_FAILED) {
+        xdp->umem = NULL;
+    }
+    if ((xdp->fd < 0) || !xdp->umem) {
+        goto fail;
+    }
+
+    struct xdp_umem_reg reg = {
+        .addr = (uintptr_t)xdp->umem,
+        .len = umemlen,
+        .chunk_size = COAP_XDP_FRAME_SIZE,
+    };
+    if ((setsockopt(xdp->fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) < 0) ||
+        (_rings(xdp) < 0)) {
+        goto fail;
+    }
+    for (uint32_t i = 0; i < COAP_XDP_FRAMES; ++i) {
+        ((uint64_t *)xdp->fill.descs)[i] = (uint64_t)i * COAP_XDP_FRAME_SIZE;
+    }
+    __atomic_store_n(xdp->fill.producer, COAP_XDP_FRAMES, __ATOMIC_RELEASE);
+
+    // copy mode, the only one generic XDP has
+    memset(&sxdp, 0, sizeof(sxdp));
+    sxdp.sxdp_family = AF_XDP;
+    sxdp.sxdp_ifindex = ifindex;
+    sxdp.sxdp_queue_id = queue;
+    sxdp.sxdp_flags = XDP_COPY | XDP_USE_NEED_WAKEUP;
+    if (bind(xdp->fd, (struct sockaddr *)&sxdp, sizeof(sxdp)) < 0) {
+        goto fail;
+    }
+
+    memset(&attr, 0, sizeof(attr));
+    attr.map_type = BPF_MAP_TYPE_XSKMAP;
+    attr.key_size = sizeof(uint32_t);
+    attr.value_size = sizeof(uint32_t);
+    attr.max_entries = queue + 1;
+    xdp->map = _bpf(BPF_MAP_CREATE, &attr);
+    if (xdp->map < 0) {
+        goto fail;
+    }
+    const uint32_t key = queue;
+    const uint32_t value = (uint32_t)xdp->fd;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = (uint32_t)xdp->map;
+    attr.key = (uintptr_t)&key;
+    attr.value = (uintptr_t)&value;
+    if (_bpf(BPF_MAP_UPDATE_ELEM, &attr) < 0) {
+        goto fail;
+    }
+    xdp->prog = _program(xdp->map, port);
+    if (xdp->prog < 0) {
+        goto fail;
+    }
+
+    // a link detaches itself when closed, even if the process dies
+    memset(&attr, 0, sizeof(attr));
+    attr.link_create.prog_fd = (uint32_t)xdp->prog;
+    attr.link_create.target_ifindex = ifindex;
+    attr.link_create.attach_type = BPF_XDP;
+    attr.link_create.flags = XDP_FLAGS_SKB_MODE;
+    xdp->link = _bpf(BPF_LINK_CREATE, &attr);
+    if (xdp->link < 0) {
+        goto fail;
+    }
+    return COAP_SUCCESS;
+
+fail:
+    err = errno;
+    coap_xdp_free(xdp);
+    errno = err;
+    return COAP_ERR_UNSUPPORTED;
+}
+
+void coap_xdp_free(coap_xdp_t *xdp)
+{
+    const int fds[] = { xdp->link, xdp->prog, xdp->map, xdp->fd };
+
+    for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); ++i) {
+        if (fds[i] >= 0) {
+            close(fds[i]);
+        }
+    }
+    xdp->link = xdp->prog = xdp->map = xdp->fd = -1;
+    _unmap(&xdp->fill);
+    _unmap(&xdp->comp);
+    _unmap(&xdp->rx);
+    _unmap(&xdp->tx);
+    if (xdp->umem) {
+        munmap(xdp->umem, (size_t)COAP_XDP_FRAMES * COAP_XDP_FRAME_SIZE);
+        xdp->umem = NULL;
+    }
+}
+
+size_t coap_xdp_process(coap_xdp_t *xdp)
+{
+    const struct xdp_desc *rx = xdp->rx.descs;
+    struct xdp_desc *tx = xdp->tx.descs;
+    uint64_t drops[COAP_XDP_BATCH];
+    uint32_t ndrops = 0;
+    size_t answered = 0;
+
+    _recycle(xdp);
+
+    uint32_t cons = *xdp->rx.consumer;
+    const uint32_t avail = __atomic_load_n(xdp->rx.producer, __ATOMIC_ACQUIRE) - cons;
+    const uint32_t n = (avail < COAP_XDP_BATCH) ? avail : COAP_XDP_BATCH;
+    uint32_t prod = *xdp->tx.producer;
+    const uint32_t room = COAP_XDP_RING_SIZE -
+                          (prod - __atomic_load_n(xdp->tx.consumer, __ATOMIC_ACQUIRE));
+
+    for (uint32_t i = 0; i < n; ++i) {
+        const struct xdp_desc *d = &rx[cons++ & xdp->rx.mask];
+        const size_t in = d->addr & (COAP_XDP_FRAME_SIZE - 1);
+        size_t off, outlen;
+        coap_state_t rc = COAP_ERR_BUFFER_TOO_SMALL;
+
+        if ((answered < room) &&
+            ((rc = coap_xdp_respond(xdp->resources, xdp->port, xdp->umem + d->addr, d->len,
+                                    COAP_XDP_FRAME_SIZE - in, &off, &outlen)) == COAP_RSP_SEND)) {
+            tx[prod & xdp->tx.mask].addr = d->addr + off;
+            tx[prod & xdp->tx.mask].len = (uint32_t)outlen;
+            tx[prod & xdp->tx.mask].options = 0;
+            prod++;
+            answered++;
+            continue;
+        }
+        // the program should have passed it, the kernel cannot have it back now
+        if (rc == COAP_ERR_UNSUPPORTED) {
+            xdp->unserved++;
+        }
+        else {
+            xdp->dropped++;
+        }
+        drops[ndrops++] = d->addr;
+    }
+    __atomic_store_n(xdp->rx.consumer, cons, __ATOMIC_RELEASE);
+    xdp->requests += (uint32_t)answered;
+    if (ndrops) {
+        _fill(xdp, drops, ndrops);
+    }
+
+    if (answered) {
+        __atomic_store_n(xdp->tx.producer, prod, __ATOMIC_RELEASE);
+        // copy mode sends from within sendto, a bounded number of frames a call
+        for (int k = 0; (k < XDP_KICKS) &&
+                        (__atomic_load_n(xdp->tx.consumer, __ATOMIC_ACQUIRE) != prod); ++k) {
+            if ((sendto(xdp->fd, NULL, 0, MSG_DONTWAIT, NULL, 0) < 0) &&
+                (errno != EAGAIN) && (errno != EBUSY) && (errno != ENOBUFS)) {
+                break;
+            }
+        }
+        _recycle(xdp);
+    }
+    if (__atomic_load_n(xdp->fill.flags, __ATOMIC_RELAXED) & XDP_RING_NEED_WAKEUP) {
+        recvfrom(xdp->fd, NULL, 0, MSG_DONTWAIT, NULL, NULL);
+    }
+    return answered;
+}
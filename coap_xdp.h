@@ -0,0 +1,137 @@
+#ifndef COAP_XDP_H
+#define COAP_XDP_H 1
+
+/**
+ * @file coap_xdp.h
+ *
+ * Requests received and answered on an AF_XDP socket, past the UDP stack
+ * of the kernel (Linux 5.9 or later, CAP_NET_ADMIN and CAP_BPF). A small
+ * XDP program, assembled in coap_xdp.c so that neither clang nor libbpf is
+ * needed, redirects unicast UDP datagrams to the CoAP port to the socket and
+ * passes everything else, ARP included, to the kernel. It is attached in
+ * generic (SKB) mode, so that any interface works, veth and loopback too,
+ * and detached when the socket is freed.
+ *
+ * Frames arrive in a memory area shared with the kernel, the UMEM. Each
+ * request is parsed there with coap_parse, dispatched with
+ * coap_handle_request, and its response built behind it in the same frame,
+ * Ethernet, IPv4 or IPv6 and UDP headers included, and transmitted from
+ * there; the frame goes back to the kernel once the transmission completes.
+ * The program redirects exactly the frames coap_xdp_respond takes: frames
+ * with IP options, extension headers or fragments, broadcast and multicast
+ * requests and malformed headers go to the kernel and the UDP server, as
+ * they would without the program.
+ *
+ * Not thread safe. Poll xdp->fd for POLLIN and call coap_xdp_process.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <linux/if_xdp.h>
+
+#include "coap.h"
+
+#define COAP_XDP_FRAME_SIZE     4096    //!< UMEM chunk, a request and its response
+#ifndef COAP_XDP_FRAMES
+#define COAP_XDP_FRAMES         4096    //!< chunks in the UMEM, a power of 2
+#endif
+#ifndef COAP_XDP_RING_SIZE
+#define COAP_XDP_RING_SIZE      2048    //!< descriptors of the RX and TX rings, a power of 2
+#endif
+#define COAP_XDP_BATCH          64      //!< requests per coap_xdp_process
+#define COAP_XDP_DGRAM_SIZE     1152    //!< largest response, a 1024 byte block with options
+
+/**
+ * Ring shared with the kernel, private
+ */
+typedef struct coap_xdp_ring
+{
+    uint32_t *producer;
+    uint32_t *consumer;
+    uint32_t *flags;
+    void *descs;            //!< struct xdp_desc or UMEM addresses
+    uint32_t mask;
+    void *map;
+    size_t maplen;
+} coap_xdp_ring_t;
+
+/**
+ * AF_XDP server on one queue of an interface
+ */
+typedef struct coap_xdp
+{
+    int fd;                 //!< AF_XDP socket
+    int prog;               //!< XDP program
+    int map;                //!< XSKMAP of the program
+    int link;               //!< attachment to the interface
+    uint16_t port;          //!< served, host order
+    coap_resource_t *resources;
+    uint8_t *umem;
+    coap_xdp_ring_t fill, comp, rx, tx;
+    uint32_t requests;      //!< dispatched to the resources
+    uint32_t responses;     //!< transmitted
+    uint32_t dropped;       //!< requests not answered, corrupted, malformed or no room to send
+    uint32_t unserved;      //!< frames redirected but not taken, 0 unless the program is wrong
+} coap_xdp_t;
+
+/**
+ * @brief Answer a request in an Ethernet frame, behind it in the same buffer
+ *
+ * The request stays in place while the response is built, payload and
+ * token of the response may point into it.
+ *
+ * @param[in] resources Resource table
+ * @param[in] port UDP port served, host order
+ * @param[in] frame Received frame, from the Ethernet header
+ * @param[in] len Length of the frame
+ * @param[in] size Bytes at \p frame, the response goes behind the request
+ * @param[out] off Offset of the response frame from \p frame
+ * @param[out] outlen Length of the response frame
+ *
+ * @return COAP_RSP_SEND if a response was built, COAP_ERR_UNSUPPORTED if
+ * the frame is not a unicast UDP datagram to \p port without IP options,
+ * extension headers or fragmentation, or its lengths do not add up,
+ * COAP_ERR_PAYLOAD_INVALID if its IPv4 header or UDP checksum is wrong, or
+ * an IPv6 datagram has none, COAP_ERR_BUFFER_TOO_SMALL if the response does
+ * not fit, or the error of coap_parse
+ */
+coap_state_t coap_xdp_respond(coap_resource_t *resources, const uint16_t port,
+                              uint8_t *frame, const size_t len, const size_t size,
+                              size_t *off, size_t *outlen);
+
+/**
+ * @brief Open an AF_XDP socket and steer the requests of a queue to it
+ *
+ * @param[out] xdp Server
+ * @param[in] ifindex Interface
+ * @param[in] queue Receive queue, 0 for veth and single queue interfaces
+ * @param[in] port UDP port to serve, host order, e.g. COAP_DEFAULT_PORT
+ * @param[in] resources Resource table, shared with the UDP server
+ *
+ * @return 0 on success, or COAP_ERR_UNSUPPORTED with errno set if the
+ * kernel or the privileges do not allow it
+ */
+coap_state_t coap_xdp_init(coap_xdp_t *xdp, const unsigned ifindex, const unsigned queue,
+                           const uint16_t port, coap_resource_t *resources);
+
+/**
+ * @brief Detach the program and close the socket
+ */
+void coap_xdp_free(coap_xdp_t *xdp);
+
+/**
+ * @brief Answer up to COAP_XDP_BATCH requests and recycle sent frames
+ *
+ * @return Number of requests answered
+ */
+size_t coap_xdp_process(coap_xdp_t *xdp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
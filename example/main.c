@@ -1,3 +1,9 @@
+#if YACOAP_HTTP_PROXY || YACOAP_WS || YACOAP_DTLS || YACOAP_ECHO || YACOAP_ACL || YACOAP_MCAST || YACOAP_LOCAL || YACOAP_XDP
+#define _POSIX_C_SOURCE 200112L
+#endif
+#if YACOAP_ACL
+#define _DEFAULT_SOURCE     // SA_RESTART
+#endif
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -7,10 +13,190 @@
 
 #include "coap.h"
 #include "coap_dump.h"
+#include "coap_trace.h"
+#if YACOAP_RD
+#include <time.h>
+#include "coap_rd.h"
+
+#define RD_MAX_REGISTRATIONS 100000
+#endif
+#if YACOAP_HTTP_PROXY
+#include <time.h>
+#include "coap_http.h"
+
+#define PROXY_UPSTREAM_PORT 8080
+
+/* requests to /api/... go to http://localhost:8080/... */
+static const coap_http_route_t proxy_routes[] = {{ "api", "" }};
+
+static uint32_t proxy_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+static void proxy_send(void *ctx, const struct sockaddr *addr,
+                       const socklen_t addrlen, const coap_packet_t *pkt)
+{
+    uint8_t buf[1152];
+    size_t buflen = sizeof(buf);
+    if (coap_build(pkt, buf, &buflen) == COAP_SUCCESS)
+        sendto(*(const int *)ctx, buf, buflen, 0, addr, addrlen);
+}
+#define POLL_PROXY COAP_HTTP_POOL_SIZE
+#else
+#define POLL_PROXY 0
+#endif
+#if YACOAP_WS
+#include "coap_ws.h"
+
+#define WS_PORT 8000
+#define WS_MAX_CONNS 64
+#define POLL_WS (WS_MAX_CONNS + 1)
+#else
+#define POLL_WS 0
+#endif
+#if YACOAP_LOCAL
+#include "coap_local.h"
+
+#define LOCAL_PATH "coap.sock"
+#define LOCAL_MAX_CHANNELS 16
+#define POLL_LOCAL (2 * LOCAL_MAX_CHANNELS + 1)
+#else
+#define POLL_LOCAL 0
+#endif
+#if YACOAP_TSTAMP
+#include "coap_tstamp.h"
+#endif
+#if YACOAP_XDP
+#include <net/if.h>
+#include <poll.h>
+#include "coap_xdp.h"
+
+#define POLL_XDP 1
+#else
+#define POLL_XDP 0
+#endif
+#if YACOAP_DTLS
+#include <string.h>
+#include <time.h>
+#include "coap_dtls.h"
+
+#define DTLS_WORKERS 2
+#define POLL_DTLS 2
+
+/* demo credentials, identity "yacoap" with key "secretPSK" */
+static size_t dtls_psk(void *ctx, const char *identity, uint8_t *key, const size_t size)
+{
+    static const char secret[] = "secretPSK";
+    (void) ctx;
+    if (strcmp(identity, "yacoap") || (size < sizeof(secret) - 1))
+        return 0;
+    memcpy(key, secret, sizeof(secret) - 1);
+    return sizeof(secret) - 1;
+}
+
+static uint32_t dtls_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+#else
+#define POLL_DTLS 0
+#endif
+#if YACOAP_ECHO
+#include <sys/random.h>
+#include <time.h>
+#include "coap_echo.h"
+
+static uint32_t echo_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)ts.tv_sec;
+}
+#endif
+#if YACOAP_MCAST
+#include <poll.h>
+#include <sys/random.h>
+#include <time.h>
+#include "coap_mcast.h"
+
+static uint32_t mcast_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+#endif
+#if YACOAP_MCAST && YACOAP_TSTAMP
+/* one receive for both, the packet info and the stamp */
+static ssize_t mcast_tstamp_recvfrom(coap_tstamp_t *tstamp, int fd, uint8_t *buf, size_t size,
+                                     struct sockaddr *addr, socklen_t *addrlen,
+                                     bool *multicast, uint64_t *delay)
+{
+    union {
+        struct cmsghdr hdr;
+        uint8_t buf[COAP_MCAST_CONTROL_SIZE + COAP_TSTAMP_CONTROL_SIZE];
+    } control;
+    struct iovec iov = { buf, size };
+    struct msghdr msg = {
+        .msg_name = addr, .msg_namelen = *addrlen, .msg_iov = &iov, .msg_iovlen = 1,
+        .msg_control = control.buf, .msg_controllen = sizeof(control.buf)
+    };
+    const ssize_t n = recvmsg(fd, &msg, 0);
+
+    if (n < 0)
+        return n;
+    *delay = coap_tstamp_delay(tstamp, &msg);
+    *multicast = coap_mcast_destination(&msg);
+    *addrlen = msg.msg_namelen;
+    return n;
+}
+#endif
 
 extern void resource_setup(const coap_resource_t *resources);
 extern coap_resource_t resources[];
 
+#if YACOAP_ACL
+#include <signal.h>
+#include "coap_acl.h"
+
+#define ACL_POLICY "coap-acl.policy"
+
+static volatile sig_atomic_t acl_reload = 1;
+
+static void acl_sighup(int sig)
+{
+    (void) sig;
+    acl_reload = 1;
+}
+
+/* compile the policy and put it in force, a broken one keeps the old */
+static void acl_load(coap_acl_t *acl)
+{
+    static char policy[65536];
+    coap_acl_table_t *table;
+    unsigned line = 0;
+    int rc;
+    FILE *f = fopen(ACL_POLICY, "r");
+    if (!f) {
+        printf("%s not found, all requests allowed\n", ACL_POLICY);
+        return;
+    }
+    const size_t n = fread(policy, 1, sizeof(policy), f);
+    fclose(f);
+    if ((rc = coap_acl_compile(policy, n, resources, &table, &line)) != COAP_SUCCESS) {
+        printf("%s:%u: policy rejected rc=%d\n", ACL_POLICY, line, rc);
+        return;
+    }
+    // requests are only dispatched on this thread, the old table is unused
+    coap_acl_free(coap_acl_swap(acl, table));
+}
+#endif
+
 int main(void)
 {
     int fd;
@@ -19,7 +205,7 @@ int main(void)
 #else /* IPV6 */
     struct sockaddr_in servaddr, cliaddr;
 #endif /* IPV6 */
-    uint8_t buf[1024];
+    uint8_t buf[1152];  // a 1024 byte block with header and options
 
 #ifdef IPV6
     fd = socket(AF_INET6,SOCK_DGRAM,0);
@@ -40,14 +226,181 @@ int main(void)
     bind(fd,(struct sockaddr *)&servaddr, sizeof(servaddr));
 
     resource_setup(resources);
+#if YACOAP_RD
+    static coap_rd_t rd;
+    if (coap_rd_init(&rd, RD_MAX_REGISTRATIONS, (uint32_t)time(NULL)) != COAP_SUCCESS)
+        return 1;
+#endif
+#if YACOAP_HTTP_PROXY
+    static coap_http_proxy_t proxy;
+    struct sockaddr_in upstream;
+    bzero(&upstream, sizeof(upstream));
+    upstream.sin_family = AF_INET;
+    upstream.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    upstream.sin_port = htons(PROXY_UPSTREAM_PORT);
+    coap_http_proxy_init(&proxy, proxy_routes, 1, (struct sockaddr *)&upstream,
+                         sizeof(upstream), "localhost:8080");
+#endif
+#if YACOAP_WS
+    // ws://host:8000/.well-known/coap, the same resources as over UDP
+    static coap_ws_t ws;
+    struct sockaddr_in wsaddr;
+    int lfd = socket(AF_INET, SOCK_STREAM, 0), one = 1;
+    bzero(&wsaddr, sizeof(wsaddr));
+    wsaddr.sin_family = AF_INET;
+    wsaddr.sin_addr.s_addr = htonl(INADDR_ANY);
+    wsaddr.sin_port = htons(WS_PORT);
+    setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(lfd, (struct sockaddr *)&wsaddr, sizeof(wsaddr)) || listen(lfd, 64) ||
+        (coap_ws_init(&ws, lfd, resources, WS_MAX_CONNS) != COAP_SUCCESS))
+        return 1;
+#endif
+#if YACOAP_LOCAL
+    // agents on this host, over coap.sock and shared memory channels
+    static coap_local_t local;
+    if (coap_local_init(&local, coap_local_socket(LOCAL_PATH), resources,
+                        LOCAL_MAX_CHANNELS) != COAP_SUCCESS || (local.fd < 0))
+        return 1;
+#endif
+#if YACOAP_TSTAMP
+    // how long requests wait in the socket, shedding them if they wait too long
+    static coap_tstamp_t tstamp;
+    if (coap_tstamp_init(&tstamp, fd, 0, 0) != COAP_SUCCESS)
+        return 1;
+#endif
+#if YACOAP_XDP
+    // unicast requests to the CoAP port on XDP_INTERFACE, past the UDP stack
+    static coap_xdp_t xdp;
+    if (coap_xdp_init(&xdp, if_nametoindex(XDP_INTERFACE), 0, COAP_DEFAULT_PORT,
+                      resources) != COAP_SUCCESS)
+        return 1;
+#endif
+#if YACOAP_ACL
+    // principals by source prefix over UDP, by PSK identity over DTLS
+    static coap_acl_t acl;
+    struct sigaction sa;
+    bzero(&sa, sizeof(sa));
+    sa.sa_handler = acl_sighup;
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGHUP, &sa, NULL);
+#endif
+#if YACOAP_DTLS
+    // coaps://host:5684, the same resources as over UDP
+    static coap_dtls_t dtls;
+    coap_dtls_config_t dtls_config = { .psk = dtls_psk, .workers = DTLS_WORKERS };
+#if YACOAP_ACL
+    dtls_config.acl = &acl;
+#endif
+    struct sockaddr_in dtlsaddr;
+    int dfd = socket(AF_INET, SOCK_DGRAM, 0);
+    bzero(&dtlsaddr, sizeof(dtlsaddr));
+    dtlsaddr.sin_family = AF_INET;
+    dtlsaddr.sin_addr.s_addr = htonl(INADDR_ANY);
+    dtlsaddr.sin_port = htons(COAPS_DEFAULT_PORT);
+    if (bind(dfd, (struct sockaddr *)&dtlsaddr, sizeof(dtlsaddr)) ||
+        (coap_dtls_init(&dtls, dfd, resources, &dtls_config) != COAP_SUCCESS))
+        return 1;
+#endif
+#if YACOAP_MCAST
+    // discovery by multicast, answers spread over the Leisure
+    static coap_mcast_t mcast;
+    uint32_t mcast_seed;
+    if ((getrandom(&mcast_seed, sizeof(mcast_seed), 0) != sizeof(mcast_seed)) ||
+        (coap_mcast_join(fd, 0, COAP_MCAST_SCOPE_LINK) != COAP_SUCCESS) ||
+        (coap_mcast_init(&mcast, fd, 0, mcast_now(), mcast_seed) != COAP_SUCCESS))
+        return 1;
+    bool multicast = false;
+#endif
+#if YACOAP_ECHO
+    // large responses only to clients that proved their address, RFC 9175 section 2.4
+    static coap_echo_t echo;
+    uint8_t echo_key[32], echo_value[COAP_ECHO_SIZE];
+    if ((getrandom(echo_key, sizeof(echo_key), 0) != sizeof(echo_key)) ||
+        (coap_echo_init(&echo, echo_key, sizeof(echo_key), 0) != COAP_SUCCESS))
+        return 1;
+#endif
 
     while(1)
     {
         int n, rc;
         socklen_t len = sizeof(cliaddr);
         coap_packet_t pkt;
+#if YACOAP_TSTAMP
+        uint64_t delay = 0;
+#endif
+
+#if YACOAP_ACL
+        if (acl_reload) {
+            acl_reload = 0;
+            acl_load(&acl);
+        }
+#endif
 
+#if YACOAP_HTTP_PROXY || YACOAP_WS || YACOAP_DTLS || YACOAP_MCAST || YACOAP_LOCAL || YACOAP_XDP
+        // wait for requests, the upstream, WebSocket, DTLS, local and XDP clients at the same time
+        struct pollfd fds[1 + POLL_PROXY + POLL_WS + POLL_DTLS + POLL_LOCAL + POLL_XDP] = {{ fd, POLLIN, 0 }};
+        size_t nfds = 1;
+#if YACOAP_HTTP_PROXY
+        nfds += coap_http_proxy_pollfds(&proxy, fds + nfds, POLL_PROXY);
+#endif
+#if YACOAP_WS
+        const size_t wsfds = nfds;
+        nfds += coap_ws_pollfds(&ws, fds + nfds, POLL_WS);
+        const size_t nwsfds = nfds - wsfds;
+#endif
+#if YACOAP_DTLS
+        nfds += coap_dtls_pollfds(&dtls, fds + nfds, POLL_DTLS);
+#endif
+#if YACOAP_LOCAL
+        const size_t localfds = nfds;
+        nfds += coap_local_pollfds(&local, fds + nfds, POLL_LOCAL);
+#endif
+#if YACOAP_XDP
+        const size_t xdpfd = nfds;
+        fds[nfds++] = (struct pollfd){ xdp.fd, POLLIN, 0 };
+#endif
+        int timeout = 100;
+#if YACOAP_MCAST
+        const int due = coap_mcast_timeout(&mcast, mcast_now());
+        if ((due >= 0) && (due < timeout))
+            timeout = due;
+#endif
+        poll(fds, nfds, timeout);
+#if YACOAP_MCAST
+        coap_mcast_tick(&mcast, mcast_now());
+#endif
+#if YACOAP_HTTP_PROXY
+        coap_http_proxy_process(&proxy, proxy_now(), proxy_send, &fd);
+#endif
+#if YACOAP_WS
+        coap_ws_process(&ws, fds + wsfds, nwsfds);
+#endif
+#if YACOAP_LOCAL
+        coap_local_process(&local, fds + localfds, nfds - localfds);
+#endif
+#if YACOAP_XDP
+        if (fds[xdpfd].revents)
+            coap_xdp_process(&xdp);
+#endif
+#if YACOAP_DTLS
+        coap_dtls_process(&dtls, dtls_now());
+#endif
+        if (!(fds[0].revents & POLLIN))
+            continue;
+#endif
+#if YACOAP_MCAST && YACOAP_TSTAMP
+        n = mcast_tstamp_recvfrom(&tstamp, fd, buf, sizeof(buf), (struct sockaddr *)&cliaddr,
+                                  &len, &multicast, &delay);
+#elif YACOAP_MCAST
+        n = coap_mcast_recvfrom(fd, buf, sizeof(buf), (struct sockaddr *)&cliaddr, &len,
+                                &multicast);
+#elif YACOAP_TSTAMP
+        n = coap_tstamp_recvfrom(&tstamp, fd, buf, sizeof(buf), (struct sockaddr *)&cliaddr,
+                                 &len, &delay);
+#else
         n = recvfrom(fd, buf, sizeof(buf), 0, (struct sockaddr *)&cliaddr, &len);
+#endif
+        COAP_TRACE_RECEIVE(n, (n >= 4) ? (buf[2] << 8 | buf[3]) : 0);
 #ifdef YACOAP_DEBUG
         printf("Received: ");
         coap_dump(buf, n, true);
@@ -63,9 +416,84 @@ int main(void)
 #ifdef YACOAP_DEBUG
             coap_dump_packet(&pkt);
 #endif
-            coap_handle_request(resources, &pkt, &rsppkt);
+#if YACOAP_TSTAMP
+            // a standing queue, answered 5.03 before any handler runs
+            if (!coap_tstamp_admit(&tstamp, delay)) {
+                if (coap_tstamp_reject(&pkt, &rsppkt) != COAP_RSP_SEND)
+                    continue;
+#if YACOAP_MCAST
+                // suppressed like any other error to a group
+                if (multicast && (coap_mcast_response(&mcast, &pkt, &rsppkt) != COAP_RSP_SEND))
+                    continue;
+#endif
+                if (coap_build(&rsppkt, buf, &buflen) == COAP_SUCCESS)
+                    sendto(fd, buf, buflen, 0, (struct sockaddr *)&cliaddr, sizeof(cliaddr));
+                continue;
+            }
+#endif
+            rc = COAP_ERR_REQUEST_NOT_FOUND;
+#if YACOAP_ECHO
+            // verified now, the response overwrites the value in buf
+            const bool proven = coap_echo_verify(&echo, &pkt, (struct sockaddr *)&cliaddr,
+                                                 len, echo_now()) == COAP_SUCCESS;
+            // unsafe ones change state, challenged before a handler runs and not after
+            if (!proven && !coap_echo_safe(&pkt)) {
+                if (coap_echo_challenge(&echo, &pkt, (struct sockaddr *)&cliaddr, len,
+                                        echo_now(), echo_value, &rsppkt) != COAP_RSP_SEND)
+                    continue;
+                rc = COAP_RSP_SEND;
+            }
+#endif
+#if YACOAP_RD
+            // registrations get the source address as base URI
+            char addr[INET6_ADDRSTRLEN], source[INET6_ADDRSTRLEN + 16];
+#ifdef IPV6
+            inet_ntop(AF_INET6, &cliaddr.sin6_addr, addr, sizeof(addr));
+            snprintf(source, sizeof(source), "coap://[%s]:%u", addr, ntohs(cliaddr.sin6_port));
+#else /* IPV6 */
+            inet_ntop(AF_INET, &cliaddr.sin_addr, addr, sizeof(addr));
+            snprintf(source, sizeof(source), "coap://%s:%u", addr, ntohs(cliaddr.sin_port));
+#endif /* IPV6 */
+            coap_rd_tick(&rd, (uint32_t)time(NULL));
+            if (rc == COAP_ERR_REQUEST_NOT_FOUND)
+                rc = coap_rd_handle_request(&rd, &pkt, source, &rsppkt);
+#endif
+#if YACOAP_HTTP_PROXY
+            if (rc == COAP_ERR_REQUEST_NOT_FOUND)
+                rc = coap_http_proxy_request(&proxy, &pkt, (struct sockaddr *)&cliaddr, len,
+                                             proxy_now(), &rsppkt);
+            if (rc == COAP_RSP_WAIT)
+                continue;   // non-confirmable, answered once the upstream has
+#endif
+#if YACOAP_ACL
+            if (rc == COAP_ERR_REQUEST_NOT_FOUND) {
+                const coap_acl_table_t *table = coap_acl_current(&acl);
+                coap_handle_request_acl(resources, coap_acl_mask(table),
+                                        coap_acl_addr(table, (struct sockaddr *)&cliaddr, len),
+                                        &pkt, &rsppkt);
+            }
+#else
+            if (rc == COAP_ERR_REQUEST_NOT_FOUND)
+                coap_handle_request(resources, &pkt, &rsppkt);
+#endif
+#if YACOAP_MCAST
+            // RFC 7252 section 8.2, useful answers only and non-confirmable
+            if (multicast && (coap_mcast_response(&mcast, &pkt, &rsppkt) != COAP_RSP_SEND))
+                continue;
+#endif
 
-            if ((rc = coap_build(&rsppkt, buf, &buflen)) > COAP_ERR)
+            rc = coap_build(&rsppkt, buf, &buflen);
+#if YACOAP_ECHO
+            // the token and message ID stay in place, the challenge reuses them
+            if ((rc <= COAP_ERR) && !proven && coap_echo_safe(&pkt) &&
+                coap_echo_amplifies(n, buflen) &&
+                (coap_echo_challenge(&echo, &pkt, (struct sockaddr *)&cliaddr, len,
+                                     echo_now(), echo_value, &rsppkt) == COAP_RSP_SEND)) {
+                buflen = sizeof(buf);
+                rc = coap_build(&rsppkt, buf, &buflen);
+            }
+#endif
+            if (rc > COAP_ERR)
                 printf("coap_build failed rc=%d\n", rc);
             else
             {
@@ -78,7 +506,17 @@ int main(void)
                 coap_dump_packet(&rsppkt);
 #endif
 
+#if YACOAP_MCAST
+                if (multicast)
+                    coap_mcast_delay(&mcast, buf, buflen, (struct sockaddr *)&cliaddr, len,
+                                     mcast_now());
+                else
+#endif
                 sendto(fd, buf, buflen, 0, (struct sockaddr *)&cliaddr, sizeof(cliaddr));
+                COAP_TRACE_SEND(buflen, rsppkt.hdr.id);
+#if YACOAP_TSTAMP
+                coap_tstamp_sent(&tstamp, 1);
+#endif
             }
         }
     }
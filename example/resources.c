@@ -2,14 +2,23 @@
 #include <stdio.h>
 #include <string.h>
 #include "coap.h"
+#include "coap_cbor.h"
+#include "coap_json.h"
+#include "coap_lz.h"
+#include "coap_metrics.h"
 
 static char light = '0';
 const uint16_t rsplen = 128;
 static char rsp[128] = "";
+/* rsp compressed once, served to clients accepting it */
+static uint8_t rsp_lz[COAP_LZ_BOUND(128)];
+static size_t rsp_lz_len;
 
 void resource_setup(const coap_resource_t *resources)
 {
     coap_make_link_format(resources, rsp, rsplen);
+    rsp_lz_len = coap_lz_compress((const uint8_t *)rsp, strlen(rsp),
+                                  rsp_lz, sizeof(rsp_lz));
     printf("resources: %s\n", rsp);
 }
 
@@ -18,14 +27,31 @@ static int handle_get_well_known_core(const coap_resource_t *resource,
                                       const coap_packet_t *inpkt,
                                       coap_packet_t *pkt)
 {
+    static uint8_t scratch[4];
     printf("handle_get_well_known_core\n");
-    return coap_make_response(inpkt->hdr.id, &inpkt->tok,
-                              COAP_TYPE_ACK, COAP_RSPCODE_CONTENT,
-                              resource->content_type,
-                              (const uint8_t *)rsp, strlen(rsp),
-                              pkt);
+    if (coap_select_representation(resource, inpkt) == 1) {
+        coap_make_response(inpkt->hdr.id, &inpkt->tok,
+                           COAP_TYPE_ACK, COAP_RSPCODE_CONTENT,
+                           resource->reps->content_type[1],
+                           rsp_lz, rsp_lz_len, pkt);
+    }
+    else {
+        coap_make_response(inpkt->hdr.id, &inpkt->tok,
+                           COAP_TYPE_ACK, COAP_RSPCODE_CONTENT,
+                           resource->content_type,
+                           (const uint8_t *)rsp, strlen(rsp), pkt);
+    }
+    return coap_make_block2(inpkt, COAP_BLOCK_SZX_MAX, scratch, pkt);
 }
 
+/* link-format, or with Accept: 65040 compressed */
+static const coap_representations_t reps_well_known_core = {
+    2,
+    {COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_APP_LINKFORMAT),
+     COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_APP_LINKFORMAT_LZ4)},
+    {handle_get_well_known_core, handle_get_well_known_core}
+};
+
 static const coap_resource_path_t path_light = {1, {"light"}};
 static int handle_get_light(const coap_resource_t *resource,
                             const coap_packet_t *inpkt,
@@ -39,6 +65,52 @@ static int handle_get_light(const coap_resource_t *resource,
                               pkt);
 }
 
+static int handle_get_light_json(const coap_resource_t *resource,
+                                 const coap_packet_t *inpkt,
+                                 coap_packet_t *pkt)
+{
+    static const uint8_t ct[2] = COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_APP_JSON);
+    static uint8_t buf[16];
+    coap_json_writer_t w;
+    (void) resource;
+    printf("handle_get_light_json\n");
+    coap_json_writer_init(&w, buf, sizeof(buf));
+    coap_json_begin_object(&w);
+    coap_json_put_key(&w, "light", 5);
+    coap_json_put_bool(&w, light == '1');
+    coap_json_end_object(&w);
+    return coap_make_response(inpkt->hdr.id, &inpkt->tok,
+                              COAP_TYPE_ACK, COAP_RSPCODE_CONTENT,
+                              ct, buf, w.pos, pkt);
+}
+
+static int handle_get_light_cbor(const coap_resource_t *resource,
+                                 const coap_packet_t *inpkt,
+                                 coap_packet_t *pkt)
+{
+    static const uint8_t ct[2] = COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_APP_CBOR);
+    static uint8_t buf[16];
+    coap_cbor_writer_t w;
+    (void) resource;
+    printf("handle_get_light_cbor\n");
+    coap_cbor_writer_init(&w, buf, sizeof(buf));
+    coap_cbor_put_map(&w, 1);
+    coap_cbor_put_text(&w, "light", 5);
+    coap_cbor_put_bool(&w, light == '1');
+    return coap_make_response(inpkt->hdr.id, &inpkt->tok,
+                              COAP_TYPE_ACK, COAP_RSPCODE_CONTENT,
+                              ct, buf, w.pos, pkt);
+}
+
+/* text/plain "0" or "1", or {"light": false} with Accept: 50 or 60 */
+static const coap_representations_t reps_light = {
+    3,
+    {COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_TXT_PLAIN),
+     COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_APP_JSON),
+     COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_APP_CBOR)},
+    {handle_get_light, handle_get_light_json, handle_get_light_cbor}
+};
+
 static int handle_put_light(const coap_resource_t *resource,
                             const coap_packet_t *inpkt,
                             coap_packet_t *pkt)
@@ -69,14 +141,18 @@ coap_resource_t resources[] =
 {
     {COAP_RDY, COAP_METHOD_GET, COAP_TYPE_ACK,
         handle_get_well_known_core, &path_well_known_core,
-        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_APP_LINKFORMAT)},
+        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_APP_LINKFORMAT),
+        &reps_well_known_core},
     {COAP_RDY, COAP_METHOD_GET, COAP_TYPE_ACK,
         handle_get_light, &path_light,
-        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_TXT_PLAIN)},
+        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_TXT_PLAIN), &reps_light},
     {COAP_RDY, COAP_METHOD_PUT, COAP_TYPE_ACK,
         handle_put_light, &path_light,
-        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_NONE)},
+        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_NONE), NULL},
+#if YACOAP_METRICS
+    COAP_METRICS_RESOURCE,
+#endif /* YACOAP_METRICS */
     {(coap_state_t)0, (coap_method_t)0, (coap_msgtype_t)0,
         NULL, NULL,
-        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_NONE)}
+        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_NONE), NULL}
 };
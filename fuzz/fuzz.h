@@ -0,0 +1,17 @@
+#ifndef FUZZ_H
+#define FUZZ_H 1
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @brief libFuzzer entry point, implemented by each fuzz target
+ *
+ * @param[in] data Input to run through the target
+ * @param[in] size Length of \p data in bytes
+ *
+ * @return Always 0
+ */
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+#endif
@@ -0,0 +1,113 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "coap.h"
+#include "coap_acl.h"
+#include "fuzz.h"
+
+/*
+ * Compiles the input as a policy against a fixed resource table. A compiled
+ * table has to stay within COAP_ACL_MAX_PRINCIPALS, every identity in it has
+ * to map back to its own principal or to one of a longer prefix, and a
+ * request dispatched with it has to be answered by the handler exactly when
+ * the bitset allows its principal.
+ */
+
+static int handled;
+
+static int _handler(const coap_resource_t *resource, const coap_packet_t *inpkt,
+                    coap_packet_t *pkt)
+{
+    handled++;
+    return coap_make_response(inpkt->hdr.id, &inpkt->tok, COAP_TYPE_ACK,
+                              COAP_RSPCODE_CONTENT, resource->content_type, NULL, 0, pkt);
+}
+
+static const coap_resource_path_t path_a = {1, {"a"}};
+static const coap_resource_path_t path_ab = {2, {"a", "b"}};
+
+static coap_resource_t resources[] =
+{
+    {COAP_RDY, COAP_METHOD_GET, COAP_TYPE_ACK, _handler, &path_a,
+        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_NONE), NULL},
+    {COAP_RDY, COAP_METHOD_PUT, COAP_TYPE_ACK, _handler, &path_ab,
+        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_NONE), NULL},
+    {(coap_state_t)0, (coap_method_t)0, (coap_msgtype_t)0, NULL, NULL,
+        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_NONE), NULL}
+};
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    coap_acl_table_t *table = NULL;
+    unsigned line = 0;
+    coap_packet_t req, rsp;
+
+    const coap_state_t rc = coap_acl_compile((const char *)data, size, resources, &table, &line);
+    if (rc != COAP_SUCCESS) {
+        if (table || !line || ((rc != COAP_ERR_PAYLOAD_INVALID) &&
+                               (rc != COAP_ERR_BUFFER_TOO_SMALL))) {
+            abort();
+        }
+        return 0;
+    }
+    if (!table || (table->nresources != 2) || !table->nprincipals ||
+        (table->nprincipals > COAP_ACL_MAX_PRINCIPALS)) {
+        abort();
+    }
+    for (size_t i = 0; i < table->nids; ++i) {
+        const coap_acl_identity_t *id = &table->ids[i];
+        char psk[COAP_ACL_MAX_ID + 1];
+        uint8_t p = id->principal;
+
+        if ((p == COAP_ACL_ANONYMOUS) || (p >= table->nprincipals)) {
+            abort();
+        }
+        if (id->type == COAP_ACL_PSK) {
+            memcpy(psk, id->id, id->len);
+            psk[id->len] = '\0';
+            p = coap_acl_psk(table, psk);
+        }
+        else if (id->type == COAP_ACL_KID) {
+            p = coap_acl_kid(table, id->id, id->len);
+        }
+        else if (id->family == AF_INET) {
+            struct sockaddr_in a;
+            memset(&a, 0, sizeof(a));
+            a.sin_family = AF_INET;
+            memcpy(&a.sin_addr, id->id, sizeof(a.sin_addr));
+            p = coap_acl_addr(table, (const struct sockaddr *)&a, sizeof(a));
+        }
+        else {
+            struct sockaddr_in6 a;
+            memset(&a, 0, sizeof(a));
+            a.sin6_family = AF_INET6;
+            memcpy(&a.sin6_addr, id->id, sizeof(a.sin6_addr));
+            p = coap_acl_addr(table, (const struct sockaddr *)&a, sizeof(a));
+        }
+        // a name of two identities, or a longer prefix of the same address
+        if ((p == COAP_ACL_ANONYMOUS) || (p >= table->nprincipals)) {
+            abort();
+        }
+    }
+
+    memset(&req, 0, sizeof(req));
+    req.hdr.ver = 1;
+    req.hdr.t = COAP_TYPE_CON;
+    req.hdr.code = COAP_METHOD_GET;
+    coap_add_option(&req, COAP_OPTION_URI_PATH, (const uint8_t *)"a", 1);
+    for (unsigned p = 0; p < table->nprincipals; ++p) {
+        handled = 0;
+        coap_handle_request_acl(resources, coap_acl_mask(table), (uint8_t)p, &req, &rsp);
+        if ((handled == 1) != coap_acl_allowed(table, 0, (uint8_t)p) ||
+            ((rsp.hdr.code == COAP_RSPCODE_FORBIDDEN) != (!handled && p)) ||
+            ((rsp.hdr.code == COAP_RSPCODE_UNAUTHORIZED) != (!handled && !p))) {
+            abort();
+        }
+    }
+    coap_acl_free(table);
+    return 0;
+}
@@ -0,0 +1,90 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "coap.h"
+#include "coap_cbor.h"
+#include "fuzz.h"
+
+/*
+ * Pulls every item out of the input with coap_cbor_next and, separately,
+ * coap_cbor_skip. Each decoded scalar is encoded again and has to decode to
+ * the same value, strings have to point into the input.
+ */
+static void _roundtrip(const coap_cbor_item_t *item)
+{
+    uint8_t buf[16];
+    coap_cbor_writer_t w;
+    coap_cbor_reader_t r;
+    coap_cbor_item_t again;
+
+    coap_cbor_writer_init(&w, buf, sizeof(buf));
+    switch (item->type) {
+    case COAP_CBOR_UINT:
+        coap_cbor_put_uint(&w, item->v.u);
+        break;
+    case COAP_CBOR_NEGINT:
+        coap_cbor_put_int(&w, item->v.i);
+        break;
+    case COAP_CBOR_FLOAT:
+        coap_cbor_put_double(&w, item->v.f);
+        break;
+    case COAP_CBOR_BOOL:
+        coap_cbor_put_bool(&w, item->v.b);
+        break;
+    default:
+        return;
+    }
+    coap_cbor_reader_init(&r, buf, w.pos);
+    if ((w.err != COAP_SUCCESS) ||
+        (coap_cbor_next(&r, &again) != COAP_SUCCESS) ||
+        !coap_cbor_at_end(&r) || (again.type != item->type)) {
+        abort();
+    }
+    if ((item->type == COAP_CBOR_FLOAT) && (item->v.f != item->v.f)) {
+        if (again.v.f == again.v.f) {
+            abort();
+        }
+    }
+    else if ((item->type == COAP_CBOR_FLOAT) ? (again.v.f != item->v.f) :
+             (item->type == COAP_CBOR_BOOL) ? (again.v.b != item->v.b) :
+             (again.v.u != item->v.u)) {
+        abort();
+    }
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    coap_cbor_reader_t r;
+    coap_cbor_item_t item;
+
+    coap_cbor_reader_init(&r, data, size);
+    while (!coap_cbor_at_end(&r)) {
+        size_t pos = r.pos;
+        if (coap_cbor_next(&r, &item) != COAP_SUCCESS) {
+            if (r.pos != pos) {
+                abort();
+            }
+            break;
+        }
+        if (((item.type == COAP_CBOR_BYTES) || (item.type == COAP_CBOR_TEXT)) &&
+            item.v.str.p &&
+            ((item.v.str.p < data) || (item.v.str.p + item.v.str.len > data + size))) {
+            abort();
+        }
+        _roundtrip(&item);
+    }
+
+    coap_cbor_reader_init(&r, data, size);
+    while (!coap_cbor_at_end(&r)) {
+        size_t pos = r.pos;
+        if (coap_cbor_skip(&r) != COAP_SUCCESS) {
+            break;
+        }
+        if ((r.pos <= pos) || (r.pos > size)) {
+            abort();
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,119 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "coap.h"
+#include "coap_dtls.h"
+#include "fuzz.h"
+
+/*
+ * The input is a datagram from a client for coap_dtls_cookie_check, which
+ * must stay in bounds and answer only ClientHellos. If the first byte is odd
+ * the datagram is sent again with the cookie of the HelloVerifyRequest,
+ * which then has to be valid, and goes through a server on loopback, so that
+ * OpenSSL gets the ClientHello after the cookie check.
+ */
+
+static coap_dtls_t dtls;
+static int client = -1;
+static struct sockaddr_in addr = { .sin_family = AF_INET };
+
+static size_t psk(void *ctx, const char *identity, uint8_t *key, const size_t size)
+{
+    (void) ctx;
+    (void) identity;
+    (void) key;
+    (void) size;
+    return 0;
+}
+
+static coap_resource_t resources[] =
+{
+    {(coap_state_t)0, (coap_method_t)0, (coap_msgtype_t)0,
+        NULL, NULL,
+        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_NONE), NULL}
+};
+
+static void _init(void)
+{
+    const coap_dtls_config_t config = { .psk = psk, .max_sessions = 4 };
+    socklen_t len = sizeof(addr);
+    const int fd = socket(AF_INET, SOCK_DGRAM, 0);
+
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    client = socket(AF_INET, SOCK_DGRAM, 0);
+    if ((fd < 0) || (client < 0) || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+        getsockname(fd, (struct sockaddr *)&addr, &len) ||
+        connect(client, (struct sockaddr *)&addr, sizeof(addr)) ||
+        getsockname(client, (struct sockaddr *)&addr, &len) ||
+        (coap_dtls_init(&dtls, fd, resources, &config) != COAP_SUCCESS)) {
+        abort();
+    }
+}
+
+/* \p hello with the cookie of \p hvr, as a client sends it again */
+static size_t _with_cookie(uint8_t *out, const uint8_t *hello, const size_t len, const uint8_t *hvr)
+{
+    const size_t cookie_at = 25 + 2 + 32 + 1 + hello[25 + 2 + 32];
+    const size_t oldlen = hello[cookie_at], cookielen = hvr[27];
+    const size_t reclen = ((size_t)hello[11] << 8 | hello[12]) - oldlen + cookielen;
+    const size_t msglen = ((size_t)hello[15] << 8 | hello[16]) - oldlen + cookielen;
+
+    memcpy(out, hello, cookie_at);
+    out[cookie_at] = (uint8_t)cookielen;
+    memcpy(out + cookie_at + 1, hvr + 28, cookielen);
+    memcpy(out + cookie_at + 1 + cookielen, hello + cookie_at + 1 + oldlen,
+           len - cookie_at - 1 - oldlen);
+    out[11] = (uint8_t)(reclen >> 8);
+    out[12] = (uint8_t)reclen;
+    out[14] = out[22] = 0;
+    out[15] = out[23] = (uint8_t)(msglen >> 8);
+    out[16] = out[24] = (uint8_t)msglen;
+    return len - oldlen + cookielen;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    uint8_t hvr[COAP_DTLS_HVR_SIZE], again[COAP_DTLS_DGRAM_SIZE + 256];
+    size_t hvrlen = sizeof(hvr);
+
+    if (!size || (size > COAP_DTLS_DGRAM_SIZE)) {
+        return 0;
+    }
+    if (client < 0) {
+        _init();
+    }
+    const coap_state_t rc = coap_dtls_cookie_check(&dtls, (struct sockaddr *)&addr, sizeof(addr),
+                                                   data + 1, size - 1, hvr, &hvrlen);
+    if (rc != COAP_SUCCESS) {
+        if ((rc != COAP_ERR_PAYLOAD_INVALID) || (hvrlen != sizeof(hvr))) {
+            abort();
+        }
+        return 0;
+    }
+    if (!(data[0] & 1) || !hvrlen) {
+        return 0;
+    }
+    // a HelloVerifyRequest, the ClientHello with its cookie passes
+    if ((hvrlen != COAP_DTLS_HVR_SIZE) || (hvr[0] != 22) || (hvr[13] != 3)) {
+        abort();
+    }
+    const size_t n = _with_cookie(again, data + 1, size - 1, hvr);
+    hvrlen = sizeof(hvr);
+    if ((coap_dtls_cookie_check(&dtls, (struct sockaddr *)&addr, sizeof(addr),
+                                again, n, hvr, &hvrlen) != COAP_SUCCESS) || hvrlen) {
+        abort();
+    }
+    if (n <= COAP_DTLS_DGRAM_SIZE) {
+        send(client, again, n, 0);
+        coap_dtls_process(&dtls, 1);
+        while (recv(client, again, sizeof(again), MSG_DONTWAIT) > 0) {
+        }
+    }
+    return 0;
+}
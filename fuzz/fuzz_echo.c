@@ -0,0 +1,67 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "coap.h"
+#include "coap_echo.h"
+#include "fuzz.h"
+
+#define FUZZ_ECHO_NOW   1000000u
+
+/*
+ * Parses the input as a request and verifies its Echo option, which a fuzzer
+ * cannot forge: a value that is not one of the server fails. Then the request
+ * is challenged, the 4.01 has to build and parse with the token of the
+ * request, and its Echo value has to verify for the address it was made for
+ * and for no other.
+ */
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    static const uint8_t key[COAP_ECHO_MIN_KEY] = { 0x5a };
+    static coap_echo_t echo;
+    struct sockaddr_in a, b;
+    uint8_t value[COAP_ECHO_SIZE], buf[64];
+    size_t len = sizeof(buf);
+    coap_packet_t in, out;
+    uint8_t count;
+
+    if (!echo.lifetime_s && (coap_echo_init(&echo, key, sizeof(key), 0) != COAP_SUCCESS)) {
+        abort();
+    }
+    if (coap_parse(data, size, &in) != COAP_SUCCESS) {
+        return 0;
+    }
+    memset(&a, 0, sizeof(a));
+    a.sin_family = AF_INET;
+    a.sin_addr.s_addr = htonl(0xc0000201);
+    b = a;
+    b.sin_addr.s_addr = htonl(0xc0000202);
+    const coap_state_t rc = coap_echo_verify(&echo, &in, (struct sockaddr *)&a, sizeof(a),
+                                             FUZZ_ECHO_NOW);
+    if ((rc != COAP_ERR_OPTION_NOT_FOUND) && (rc != COAP_ERR_TIMEOUT) &&
+        (rc != COAP_ERR_SECURITY_CONTEXT)) {
+        abort();
+    }
+
+    if (coap_echo_challenge(&echo, &in, (struct sockaddr *)&a, sizeof(a), FUZZ_ECHO_NOW,
+                            value, &out) != COAP_RSP_SEND) {
+        abort();
+    }
+    if ((coap_build(&out, buf, &len) != COAP_SUCCESS) ||
+        (len > 4 + in.tok.len + 2 + COAP_ECHO_SIZE) ||
+        (coap_parse(buf, len, &out) != COAP_SUCCESS) ||
+        (out.hdr.code != COAP_RSPCODE_UNAUTHORIZED) || (out.tok.len != in.tok.len) ||
+        !coap_find_options(&out, COAP_OPTION_ECHO, &count) || (count != 1)) {
+        abort();
+    }
+    if ((coap_echo_verify(&echo, &out, (struct sockaddr *)&a, sizeof(a),
+                          FUZZ_ECHO_NOW) != COAP_SUCCESS) ||
+        (coap_echo_verify(&echo, &out, (struct sockaddr *)&b, sizeof(b),
+                          FUZZ_ECHO_NOW) != COAP_ERR_SECURITY_CONTEXT)) {
+        abort();
+    }
+    return 0;
+}
@@ -0,0 +1,95 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "coap.h"
+#include "coap_client.h"
+#include "coap_gw.h"
+#include "fuzz.h"
+
+/*
+ * Sends the input as request bytes to the HTTP-to-CoAP gateway over a local
+ * stream socket and closes the sending side. Every request must be answered
+ * with an HTTP/1.1 status line and the gateway must drop the connection
+ * afterwards. No host is allowed, so requests end at the 403 after all the
+ * parsing and nothing is sent over the network.
+ */
+
+static coap_client_t client;
+static coap_gw_t gw;
+static struct sockaddr_un addr;
+static socklen_t addrlen;
+
+static bool _deny(void *ctx, const struct sockaddr *a, const socklen_t len)
+{
+    (void) ctx;
+    (void) a;
+    (void) len;
+    return false;
+}
+
+static bool _open(const coap_gw_t *g)
+{
+    for (size_t i = 0; i < g->max_conns; ++i) {
+        if (g->conns[i].fd >= 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void _init(void)
+{
+    const int lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    addr.sun_family = AF_UNIX;
+    // abstract, unique per process
+    addrlen = offsetof(struct sockaddr_un, sun_path) + 1 +
+              snprintf(addr.sun_path + 1, sizeof(addr.sun_path) - 1, "fuzz_gw.%d", (int)getpid());
+    if ((lfd < 0) || bind(lfd, (struct sockaddr *)&addr, addrlen) || listen(lfd, 4) ||
+        (coap_client_init(&client, 1) != COAP_SUCCESS) ||
+        (coap_gw_init(&gw, lfd, &client, 2) != COAP_SUCCESS)) {
+        abort();
+    }
+    gw.allow = _deny;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    struct pollfd fds[3];
+    char rsp[16];
+    size_t rsplen = 0;
+
+    if (!addrlen) {
+        _init();
+    }
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if ((fd < 0) || connect(fd, (struct sockaddr *)&addr, addrlen) ||
+        (send(fd, data, size, MSG_NOSIGNAL) != (ssize_t)size) || shutdown(fd, SHUT_WR)) {
+        abort();
+    }
+    for (int round = 0; (round < 64) && (!round || _open(&gw)); ++round) {
+        const size_t n = coap_gw_pollfds(&gw, fds, sizeof(fds) / sizeof(fds[0]));
+        poll(fds, n, 10);
+        coap_gw_process(&gw, fds, n, 0);
+    }
+    if (_open(&gw)) {
+        abort();
+    }
+    // something was answered, that is
+    for (ssize_t n; (n = recv(fd, rsp + rsplen, sizeof(rsp) - rsplen, 0)) > 0;) {
+        rsplen += (size_t)n;
+        if (rsplen == sizeof(rsp)) {
+            break;
+        }
+    }
+    if (rsplen && ((rsplen < 12) || memcmp(rsp, "HTTP/1.1 ", 9))) {
+        abort();
+    }
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,70 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "coap.h"
+#include "coap_http.h"
+#include "fuzz.h"
+
+/*
+ * Parses the input as an HTTP response from a buffer of its exact size, as
+ * received so far and at the end of the connection; body and length have to
+ * stay within the buffer, and a response complete before the end must not
+ * change with it. Then translates the input, if it is a CoAP request, into an
+ * HTTP request into buffers of several sizes.
+ */
+static void _parse(const uint8_t *data, size_t size)
+{
+    coap_http_response_t rsp, eof;
+    uint8_t *buf = malloc(size ? size : 1);
+    uint8_t *copy = malloc(size ? size : 1);
+
+    memcpy(buf, data, size);
+    memcpy(copy, data, size);
+    const coap_state_t rc = coap_http_parse_response(buf, size, false, &rsp);
+    const coap_state_t rc_eof = coap_http_parse_response(copy, size, true, &eof);
+    if ((rc != COAP_SUCCESS) && (rc != COAP_RSP_WAIT) && (rc != COAP_ERR_PAYLOAD_INVALID)) {
+        abort();
+    }
+    if ((rc_eof == COAP_RSP_WAIT) || ((rc == COAP_ERR_PAYLOAD_INVALID) && (rc_eof != rc))) {
+        abort();
+    }
+    if (rc == COAP_SUCCESS) {
+        if ((rsp.len > size) || (rsp.body.p < buf) ||
+            (rsp.body.p + rsp.body.len > buf + rsp.len) ||
+            (rc_eof != COAP_SUCCESS) || (eof.len != rsp.len) ||
+            (eof.body.len != rsp.body.len) || (eof.status != rsp.status) ||
+            memcmp(rsp.body.p, eof.body.p, rsp.body.len)) {
+            abort();
+        }
+    }
+    if ((rc_eof == COAP_SUCCESS) &&
+        ((eof.len > size) || (eof.body.p < copy) || (eof.body.p + eof.body.len > copy + size))) {
+        abort();
+    }
+    free(buf);
+    free(copy);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    coap_packet_t pkt;
+    size_t len;
+
+    _parse(data, size);
+    _parse(data, size / 2);
+    if (coap_parse(data, size, &pkt) != COAP_SUCCESS) {
+        return 0;
+    }
+    for (size_t limit = 1; limit <= COAP_HTTP_TX_SIZE * 2; limit *= 4) {
+        uint8_t *out = malloc(limit);
+        const coap_state_t rc = coap_http_make_request(&pkt, "/v1", "localhost",
+                                                       out, limit, &len);
+        if ((rc == COAP_SUCCESS) && (len > limit)) {
+            abort();
+        }
+        free(out);
+    }
+    return 0;
+}
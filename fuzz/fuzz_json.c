@@ -0,0 +1,136 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "coap.h"
+#include "coap_json.h"
+#include "fuzz.h"
+
+/*
+ * Tokenizes the input, strings and numbers have to point into it. A well
+ * formed document is written again token by token with coap_json_writer and
+ * has to tokenize to the same tokens, unescaped strings and numbers equal.
+ */
+static bool _unescape(const coap_json_token_t *tok, uint8_t *out, size_t *len)
+{
+    if ((tok->type != COAP_JSON_KEY) && (tok->type != COAP_JSON_STRING)) {
+        *len = 0;
+        return true;
+    }
+    return coap_json_unescape(tok, out, len) == COAP_SUCCESS;
+}
+
+static bool _write(coap_json_writer_t *w, const coap_json_reader_t *r,
+                   const coap_json_token_t *tok, uint8_t *tmp)
+{
+    size_t len;
+    switch (tok->type) {
+    case COAP_JSON_OBJECT:
+        coap_json_begin_object(w);
+        break;
+    case COAP_JSON_ARRAY:
+        coap_json_begin_array(w);
+        break;
+    case COAP_JSON_END:
+        // the level just closed is one above the reader's depth
+        if (r->objects & ((uint32_t)1 << (r->depth + 1))) {
+            coap_json_end_object(w);
+        }
+        else {
+            coap_json_end_array(w);
+        }
+        break;
+    case COAP_JSON_KEY:
+    case COAP_JSON_STRING:
+        if (!_unescape(tok, tmp, &len)) {
+            return false;
+        }
+        if (tok->type == COAP_JSON_KEY) {
+            coap_json_put_key(w, (const char *)tmp, len);
+        }
+        else {
+            coap_json_put_string(w, (const char *)tmp, len);
+        }
+        break;
+    case COAP_JSON_NUMBER:
+        coap_json_put_raw(w, (const char *)tok->str.p, tok->str.len);
+        break;
+    case COAP_JSON_BOOL:
+        coap_json_put_bool(w, tok->b);
+        break;
+    case COAP_JSON_NULL:
+        coap_json_put_null(w);
+        break;
+    }
+    return true;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    coap_json_reader_t r, again;
+    coap_json_token_t tok, tok2;
+    coap_json_writer_t w;
+    uint8_t *out = malloc(size + 1);
+    uint8_t *tmp = malloc(size + 1);
+    uint8_t *tmp2 = malloc(size + 1);
+    bool ok = true;
+
+    coap_json_reader_init(&r, data, size);
+    coap_json_writer_init(&w, out, size + 1);
+    while (!coap_json_at_end(&r)) {
+        size_t pos = r.pos;
+        if (coap_json_next(&r, &tok) != COAP_SUCCESS) {
+            if (r.pos != pos) {
+                abort();
+            }
+            ok = false;
+            break;
+        }
+        if (tok.str.p && ((tok.str.p < data) || (tok.str.p + tok.str.len > data + size))) {
+            abort();
+        }
+        if (tok.type == COAP_JSON_NUMBER) {
+            double d;
+            int64_t i;
+            coap_json_number(&tok, &d);
+            coap_json_int(&tok, &i);
+        }
+        ok = ok && _write(&w, &r, &tok, tmp);
+    }
+    // unescaped strings and minimal whitespace are never longer
+    if (ok && (w.err != COAP_SUCCESS)) {
+        abort();
+    }
+    if (ok) {
+        coap_json_reader_init(&r, data, size);
+        coap_json_reader_init(&again, out, w.pos);
+        while (!coap_json_at_end(&r)) {
+            size_t len, len2;
+            if ((coap_json_next(&r, &tok) != COAP_SUCCESS) ||
+                (coap_json_next(&again, &tok2) != COAP_SUCCESS) ||
+                (tok.type != tok2.type) || (tok.b != tok2.b) ||
+                !_unescape(&tok, tmp, &len) || !_unescape(&tok2, tmp2, &len2) ||
+                (len != len2) || memcmp(tmp, tmp2, len) ||
+                ((tok.type == COAP_JSON_NUMBER) &&
+                 ((tok.str.len != tok2.str.len) ||
+                  memcmp(tok.str.p, tok2.str.p, tok.str.len)))) {
+                abort();
+            }
+        }
+        if (!coap_json_at_end(&again)) {
+            abort();
+        }
+    }
+
+    coap_json_reader_init(&r, data, size);
+    if (coap_json_skip(&r) == COAP_SUCCESS) {
+        if ((r.pos > size) || (r.depth != 0)) {
+            abort();
+        }
+    }
+    free(out);
+    free(tmp);
+    free(tmp2);
+    return 0;
+}
@@ -0,0 +1,76 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "coap.h"
+#include "coap_link.h"
+#include "fuzz.h"
+
+/*
+ * Reads the input as a link format document, all views have to point into
+ * it. The first byte sets a block size, streaming the rest block by block
+ * has to produce the same links as reading it at once.
+ */
+static void _check_view(const coap_buffer_t *b, const uint8_t *data, size_t size)
+{
+    if (b->len && ((b->p < data) || (b->p + b->len > data + size))) {
+        abort();
+    }
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    coap_link_reader_t r;
+    coap_link_stream_t s;
+    coap_link_t link, again;
+    coap_link_attr_t attr;
+    coap_state_t rc, src;
+
+    if (!size) {
+        return 0;
+    }
+    const size_t block = (data[0] % 64) + 1;
+    data++;
+    size--;
+    uint8_t *carry = malloc(size + 1);
+    coap_link_reader_init(&r, data, size);
+    coap_link_stream_init(&s, carry, size + 1);
+    size_t fed = (size < block) ? size : block;
+    coap_link_stream_feed(&s, data, fed, fed == size);
+
+    for (;;) {
+        size_t pos = 0;
+        rc = coap_link_next(&r, &link);
+        while ((src = coap_link_stream_next(&s, &again)) == COAP_RSP_WAIT) {
+            const size_t n = (size - fed < block) ? size - fed : block;
+            coap_link_stream_feed(&s, data + fed, n, fed + n == size);
+            fed += n;
+        }
+        if (rc != COAP_SUCCESS) {
+            break;
+        }
+        if ((src != COAP_SUCCESS) ||
+            (link.target.len != again.target.len) || (link.params.len != again.params.len) ||
+            memcmp(link.target.p, again.target.p, link.target.len) ||
+            memcmp(link.params.p, again.params.p, link.params.len)) {
+            abort();
+        }
+        _check_view(&link.target, data, size);
+        _check_view(&link.params, data, size);
+        while (coap_link_attr_next(&link, &pos, &attr) == COAP_SUCCESS) {
+            _check_view(&attr.name, data, size);
+            _check_view(&attr.value, data, size);
+            if (pos > link.params.len) {
+                abort();
+            }
+        }
+    }
+    // both have to end the same way, at the end or on the same error
+    if (((rc == COAP_ERR_OPTION_NOT_FOUND) != (src == COAP_RSP_RECV)) ||
+        ((rc == COAP_ERR_PAYLOAD_INVALID) != (src == COAP_ERR_PAYLOAD_INVALID))) {
+        abort();
+    }
+    free(carry);
+    return 0;
+}
@@ -0,0 +1,46 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "coap.h"
+#include "coap_lz.h"
+#include "fuzz.h"
+
+#define FUZZ_LZ_MAX     65536   //!< longest input compressed
+
+/*
+ * Decompresses the input as an LZ4 block into buffers of several sizes, which
+ * must not be overrun. Then compresses the input, which has to decompress to
+ * the input again, and must fail cleanly into a buffer one byte too small.
+ */
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    static uint8_t packed[COAP_LZ_BOUND(FUZZ_LZ_MAX)];
+    static uint8_t out[FUZZ_LZ_MAX];
+    size_t len, n;
+
+    for (size_t limit = 1; limit <= sizeof(out); limit *= 16) {
+        uint8_t *tight = malloc(limit);
+        coap_state_t rc = coap_lz_decompress(data, size, tight, limit, &n);
+        if ((rc == COAP_SUCCESS) && (n > limit)) {
+            abort();
+        }
+        free(tight);
+    }
+    if (size > FUZZ_LZ_MAX) {
+        return 0;
+    }
+    len = coap_lz_compress(data, size, packed, sizeof(packed));
+    if (!len || (len > COAP_LZ_BOUND(size))) {
+        abort();
+    }
+    if ((coap_lz_decompress(packed, len, out, size, &n) != COAP_SUCCESS) ||
+        (n != size) || memcmp(out, data, size)) {
+        abort();
+    }
+    if (coap_lz_compress(data, size, packed, len - 1)) {
+        abort();
+    }
+    return 0;
+}
@@ -0,0 +1,83 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "coap.h"
+#include "coap_oscore.h"
+#include "fuzz.h"
+
+#define FUZZ_OSCORE_MAX 2048    //!< longest input
+
+/*
+ * The input is a received message, unprotected as a request by the server
+ * and as a response by the client, which must stay in bounds and never grow
+ * it. Then the input is protected by the client as a message to send, which
+ * must fit in COAP_OSCORE_OVERHEAD more bytes and be unprotected by the
+ * server to the input again.
+ */
+
+static coap_oscore_ctx_t client, server;
+static bool ready;
+static const coap_oscore_request_t request = { .kidlen = 0, .piv = { 0x14 }, .pivlen = 1 };
+
+static void _init(void)
+{
+    static const uint8_t secret[16] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16 };
+    static const uint8_t id[1] = { 1 };
+    coap_oscore_params_t params = {
+        .master_secret = { secret, sizeof(secret) },
+        .sender_id = { id, 0 },
+        .recipient_id = { id, 1 },
+    };
+    if (coap_oscore_derive(&client, &params) != COAP_SUCCESS) {
+        abort();
+    }
+    params.sender_id.len = 1;
+    params.recipient_id.len = 0;
+    if (coap_oscore_derive(&server, &params) != COAP_SUCCESS) {
+        abort();
+    }
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    static uint8_t buf[FUZZ_OSCORE_MAX + COAP_OSCORE_OVERHEAD];
+    coap_oscore_request_t req;
+    size_t len;
+
+    if (size > FUZZ_OSCORE_MAX) {
+        return 0;
+    }
+    if (!ready) {
+        _init();
+        ready = true;
+    }
+    memcpy(buf, data, size);
+    len = size;
+    if ((coap_oscore_unprotect(&server, buf, &len, &req) == COAP_SUCCESS) && (len > size)) {
+        abort();
+    }
+    memcpy(buf, data, size);
+    len = size;
+    req = request;
+    if ((coap_oscore_unprotect(&client, buf, &len, &req) == COAP_SUCCESS) && (len > size)) {
+        abort();
+    }
+
+    memcpy(buf, data, size);
+    len = size;
+    req = request;
+    if (coap_oscore_protect(&client, buf, &len, sizeof(buf), &req) != COAP_SUCCESS) {
+        return 0;
+    }
+    if (len > size + COAP_OSCORE_OVERHEAD) {
+        abort();
+    }
+    if ((coap_oscore_unprotect(&server, buf, &len, &req) != COAP_SUCCESS) ||
+        (len != size) || memcmp(buf, data, size)) {
+        abort();
+    }
+    return 0;
+}
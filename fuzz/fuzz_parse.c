@@ -0,0 +1,33 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "coap.h"
+#include "fuzz.h"
+
+/*
+ * coap_parse must not read outside of the datagram, and everything it returns
+ * has to point into the datagram.
+ */
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    coap_packet_t pkt;
+    volatile uint8_t sink = 0;
+
+    if (coap_parse(data, size, &pkt) != COAP_SUCCESS) {
+        return 0;
+    }
+    for (size_t i = 0; i < pkt.tok.len; ++i) {
+        sink ^= pkt.tok.p[i];
+    }
+    for (size_t i = 0; i < pkt.numopts; ++i) {
+        for (size_t j = 0; j < pkt.opts[i].buf.len; ++j) {
+            sink ^= pkt.opts[i].buf.p[j];
+        }
+    }
+    for (size_t i = 0; i < pkt.payload.len; ++i) {
+        sink ^= pkt.payload.p[i];
+    }
+    (void) sink;
+    return 0;
+}
@@ -0,0 +1,58 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "coap.h"
+#include "coap_rd.h"
+#include "fuzz.h"
+
+/*
+ * Runs a sequence of requests against a small resource directory. The input
+ * is a list of datagrams, each preceded by its length byte; a length of 0
+ * advances the clock by the next byte in seconds instead. Every response
+ * has to build, registrations and free ids have to add up, and freeing the
+ * directory at the end must not leak.
+ */
+#define FUZZ_RD_REGS 8
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    coap_rd_t *rd = malloc(sizeof(*rd));
+    uint32_t now = 100;
+    uint8_t buf[1280];
+
+    if (coap_rd_init(rd, FUZZ_RD_REGS, now) != COAP_SUCCESS) {
+        abort();
+    }
+    while (size) {
+        const size_t len = *data++;
+        size--;
+        if (!len) {
+            if (size) {
+                now += *data++;
+                size--;
+                coap_rd_tick(rd, now);
+            }
+            continue;
+        }
+        const size_t n = (len < size) ? len : size;
+        coap_packet_t pkt, rsp;
+        if (coap_parse(data, n, &pkt) == COAP_SUCCESS) {
+            size_t buflen = sizeof(buf);
+            const coap_state_t rc = coap_rd_handle_request(rd, &pkt, "coap://[2001:db8::1]:5683", &rsp);
+            if ((rc != COAP_ERR_REQUEST_NOT_FOUND) &&
+                ((rc != COAP_RSP_SEND) || (coap_build(&rsp, buf, &buflen) != COAP_SUCCESS))) {
+                abort();
+            }
+        }
+        if ((rd->count > FUZZ_RD_REGS) || (rd->count + rd->num_free != FUZZ_RD_REGS)) {
+            abort();
+        }
+        data += n;
+        size -= n;
+    }
+    coap_rd_free(rd);
+    free(rd);
+    return 0;
+}
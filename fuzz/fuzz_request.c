@@ -0,0 +1,111 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "coap.h"
+#include "fuzz.h"
+
+/* sample resource table, same shape as the example server */
+static char rsp[128] = "";
+static char light = '0';
+
+static const coap_resource_path_t path_well_known_core = {2, {".well-known", "core"}};
+static int handle_get_well_known_core(const coap_resource_t *resource,
+                                      const coap_packet_t *inpkt,
+                                      coap_packet_t *pkt)
+{
+    return coap_make_response(inpkt->hdr.id, &inpkt->tok,
+                              COAP_TYPE_ACK, COAP_RSPCODE_CONTENT,
+                              resource->content_type,
+                              (const uint8_t *)rsp, strlen(rsp),
+                              pkt);
+}
+
+static const coap_resource_path_t path_light = {1, {"light"}};
+static int handle_get_light(const coap_resource_t *resource,
+                            const coap_packet_t *inpkt,
+                            coap_packet_t *pkt)
+{
+    return coap_make_response(inpkt->hdr.id, &inpkt->tok,
+                              COAP_TYPE_ACK, COAP_RSPCODE_CONTENT,
+                              resource->content_type,
+                              (const uint8_t *)&light, 1,
+                              pkt);
+}
+
+/* text/plain and JSON from one handler, anything else is 4.06 */
+static const coap_representations_t reps_light = {
+    2,
+    {COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_TXT_PLAIN),
+     COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_APP_JSON)},
+    {handle_get_light, handle_get_light}
+};
+
+static int handle_put_light(const coap_resource_t *resource,
+                            const coap_packet_t *inpkt,
+                            coap_packet_t *pkt)
+{
+    if (inpkt->payload.len == 0) {
+        return coap_make_response(inpkt->hdr.id, &inpkt->tok,
+                                  COAP_TYPE_ACK, COAP_RSPCODE_BAD_REQUEST,
+                                  NULL, NULL, 0,
+                                  pkt);
+    }
+    light = (inpkt->payload.p[0] == '1') ? '1' : '0';
+    return coap_make_response(inpkt->hdr.id, &inpkt->tok,
+                              COAP_TYPE_ACK, COAP_RSPCODE_CHANGED,
+                              resource->content_type,
+                              (const uint8_t *)&light, 1,
+                              pkt);
+}
+
+static const coap_resource_path_t path_separate = {1, {"separate"}};
+static int handle_get_separate(const coap_resource_t *resource,
+                               const coap_packet_t *inpkt,
+                               coap_packet_t *pkt)
+{
+    return coap_make_response(inpkt->hdr.id, &inpkt->tok,
+                              resource->msg_type, COAP_RSPCODE_CONTENT,
+                              resource->content_type,
+                              (const uint8_t *)path_separate.items[0], 8,
+                              pkt);
+}
+
+static coap_resource_t resources[] =
+{
+    {COAP_RDY, COAP_METHOD_GET, COAP_TYPE_ACK,
+        handle_get_well_known_core, &path_well_known_core,
+        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_APP_LINKFORMAT), NULL},
+    {COAP_RDY, COAP_METHOD_GET, COAP_TYPE_ACK,
+        handle_get_light, &path_light,
+        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_TXT_PLAIN), &reps_light},
+    {COAP_RDY, COAP_METHOD_PUT, COAP_TYPE_ACK,
+        handle_put_light, &path_light,
+        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_NONE), NULL},
+    {COAP_RDY, COAP_METHOD_GET, COAP_TYPE_NONCON,
+        handle_get_separate, &path_separate,
+        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_TXT_PLAIN), NULL},
+    {(coap_state_t)0, (coap_method_t)0, (coap_msgtype_t)0,
+        NULL, NULL,
+        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_NONE), NULL}
+};
+
+/*
+ * Parse, dispatch and build a response like the example server does.
+ */
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    coap_packet_t pkt, rsppkt;
+    uint8_t buf[1024];
+    size_t buflen = sizeof(buf);
+
+    if (!rsp[0]) {
+        coap_make_link_format(resources, rsp, sizeof(rsp));
+    }
+    if (coap_parse(data, size, &pkt) > COAP_ERR) {
+        return 0;
+    }
+    coap_handle_request(resources, &pkt, &rsppkt);
+    coap_build(&rsppkt, buf, &buflen);
+    return 0;
+}
@@ -0,0 +1,53 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "coap.h"
+#include "fuzz.h"
+
+static bool _buf_equal(const coap_buffer_t *a, const coap_buffer_t *b)
+{
+    return (a->len == b->len) && (!a->len || !memcmp(a->p, b->p, a->len));
+}
+
+/*
+ * Every packet coap_parse accepts has to survive coap_build and a second
+ * coap_parse unchanged.
+ */
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    coap_packet_t pkt, pkt2;
+    uint8_t buf[2048];
+    size_t buflen = sizeof(buf);
+
+    if (coap_parse(data, size, &pkt) != COAP_SUCCESS) {
+        return 0;
+    }
+    if (coap_build(&pkt, buf, &buflen) != COAP_SUCCESS) {
+        /* only a too small buffer is acceptable */
+        if (size < sizeof(buf)) {
+            abort();
+        }
+        return 0;
+    }
+    if (buflen > size) {
+        abort();
+    }
+    if (coap_parse(buf, buflen, &pkt2) != COAP_SUCCESS) {
+        abort();
+    }
+    if (memcmp(&pkt.hdr, &pkt2.hdr, sizeof(pkt.hdr)) ||
+        !_buf_equal(&pkt.tok, &pkt2.tok) ||
+        (pkt.numopts != pkt2.numopts) ||
+        !_buf_equal(&pkt.payload, &pkt2.payload)) {
+        abort();
+    }
+    for (size_t i = 0; i < pkt.numopts; ++i) {
+        if ((pkt.opts[i].num != pkt2.opts[i].num) ||
+            !_buf_equal(&pkt.opts[i].buf, &pkt2.opts[i].buf)) {
+            abort();
+        }
+    }
+    return 0;
+}
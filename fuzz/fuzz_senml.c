@@ -0,0 +1,50 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#include "coap.h"
+#include "coap_senml.h"
+#include "fuzz.h"
+
+#define FUZZ_RECORDS 16
+
+/*
+ * The first byte selects the format, even for SenML JSON, odd for CBOR.
+ * Decoded strings have to point into the input, and every pack that decodes
+ * has to pack again.
+ */
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    coap_senml_record_t records[FUZZ_RECORDS];
+    coap_senml_pack_t pack;
+    uint8_t buf[4096];
+    size_t count = FUZZ_RECORDS;
+
+    if (!size) {
+        return 0;
+    }
+    coap_content_type_t format = (data[0] & 1) ? COAP_CONTENTTYPE_APP_SENML_CBOR :
+                                                 COAP_CONTENTTYPE_APP_SENML_JSON;
+    coap_buffer_t payload = { data + 1, size - 1 };
+    if (coap_senml_unpack(&payload, format, records, &count) != COAP_SUCCESS) {
+        return 0;
+    }
+    coap_senml_pack_init(&pack, format, NULL, buf, sizeof(buf));
+    for (size_t i = 0; i < count; ++i) {
+        const coap_senml_record_t *rec = &records[i];
+        const coap_buffer_t *strs[] = { &rec->base_name, &rec->name, &rec->unit, &rec->str };
+        for (size_t j = 0; j < sizeof(strs) / sizeof(strs[0]); ++j) {
+            if (strs[j]->len && ((strs[j]->p < payload.p) ||
+                                 (strs[j]->p + strs[j]->len > payload.p + payload.len))) {
+                abort();
+            }
+        }
+        coap_state_t rc = coap_senml_pack_add(&pack, rec);
+        // non finite values have no JSON representation
+        if ((rc != COAP_SUCCESS) && (rc != COAP_ERR_UNSUPPORTED)) {
+            abort();
+        }
+    }
+    coap_senml_pack_finish(&pack);
+    return 0;
+}
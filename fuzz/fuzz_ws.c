@@ -0,0 +1,188 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "coap.h"
+#include "coap_ws.h"
+#include "fuzz.h"
+
+/*
+ * The first byte selects what the rest of the input is:
+ * 0: a message of the TCP framing, 1: of the WebSocket framing, whatever
+ *    coap_parse_tcp accepts has to survive coap_build_tcp and a second
+ *    coap_parse_tcp unchanged
+ * 2: a client frame for coap_ws_parse_frame, which must stay in bounds
+ * 3: what a client sends after a valid upgrade, over a local stream socket
+ *    to the server, which has to close the connection once the client did
+ */
+
+static coap_ws_t ws;
+static struct sockaddr_un addr;
+static socklen_t addrlen;
+
+static const char upgrade[] = "GET /.well-known/coap HTTP/1.1\r\nHost: fuzz\r\n"
+                              "Upgrade: websocket\r\nConnection: Upgrade\r\n"
+                              "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+                              "Sec-WebSocket-Protocol: coap\r\n"
+                              "Sec-WebSocket-Version: 13\r\n\r\n";
+
+static const coap_resource_path_t path_echo = {1, {"echo"}};
+
+static int handle_echo(const coap_resource_t *resource,
+                       const coap_packet_t *inpkt,
+                       coap_packet_t *pkt)
+{
+    return coap_make_response(inpkt->hdr.id, &inpkt->tok,
+                              COAP_TYPE_ACK, COAP_RSPCODE_CONTENT,
+                              resource->content_type,
+                              inpkt->payload.p, inpkt->payload.len, pkt);
+}
+
+static coap_resource_t resources[] =
+{
+    {COAP_RDY, COAP_METHOD_POST, COAP_TYPE_ACK,
+        handle_echo, &path_echo,
+        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_APP_OCTECT_STREAM), NULL},
+    {(coap_state_t)0, (coap_method_t)0, (coap_msgtype_t)0,
+        NULL, NULL,
+        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_NONE), NULL}
+};
+
+static bool _buf_equal(const coap_buffer_t *a, const coap_buffer_t *b)
+{
+    return (a->len == b->len) && (!a->len || !memcmp(a->p, b->p, a->len));
+}
+
+static void _roundtrip(const uint8_t *data, size_t size, const coap_framing_t framing)
+{
+    coap_packet_t pkt, pkt2;
+    uint8_t buf[2048];
+    size_t buflen = sizeof(buf), msglen, msglen2;
+
+    if (coap_parse_tcp(data, size, framing, &pkt, &msglen) != COAP_SUCCESS) {
+        return;
+    }
+    if ((msglen > size) || ((framing == COAP_FRAMING_WS) && (msglen != size))) {
+        abort();
+    }
+    if (coap_build_tcp(&pkt, framing, buf, &buflen) != COAP_SUCCESS) {
+        /* only a too small buffer is acceptable */
+        if (size < sizeof(buf)) {
+            abort();
+        }
+        return;
+    }
+    // the length is encoded as short as it goes, the rest is the same
+    if ((buflen > msglen) ||
+        (coap_parse_tcp(buf, buflen, framing, &pkt2, &msglen2) != COAP_SUCCESS) ||
+        (msglen2 != buflen)) {
+        abort();
+    }
+    if (memcmp(&pkt.hdr, &pkt2.hdr, sizeof(pkt.hdr)) ||
+        !_buf_equal(&pkt.tok, &pkt2.tok) ||
+        (pkt.numopts != pkt2.numopts) ||
+        !_buf_equal(&pkt.payload, &pkt2.payload)) {
+        abort();
+    }
+    for (size_t i = 0; i < pkt.numopts; ++i) {
+        if ((pkt.opts[i].num != pkt2.opts[i].num) ||
+            !_buf_equal(&pkt.opts[i].buf, &pkt2.opts[i].buf)) {
+            abort();
+        }
+    }
+}
+
+static void _frame(const uint8_t *data, size_t size)
+{
+    uint8_t *buf = malloc(size ? size : 1);
+    coap_ws_frame_t frame;
+
+    memcpy(buf, data, size);
+    const coap_state_t rc = coap_ws_parse_frame(buf, size, true, &frame);
+    if ((rc == COAP_SUCCESS) &&
+        ((frame.headlen + frame.len > size) || (frame.payload != buf + frame.headlen))) {
+        abort();
+    }
+    free(buf);
+}
+
+static bool _open(const coap_ws_t *w)
+{
+    for (size_t i = 0; i < w->max_conns; ++i) {
+        if (w->conns[i].fd >= 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void _pump(const int fd, const int rounds)
+{
+    struct pollfd fds[3];
+    char sink[4096];
+    for (int round = 0; round < rounds; ++round) {
+        const size_t n = coap_ws_pollfds(&ws, fds, sizeof(fds) / sizeof(fds[0]));
+        poll(fds, n, round ? 10 : 0);
+        coap_ws_process(&ws, fds, n);
+        // read what is sent back so the server is never blocked on it
+        while (recv(fd, sink, sizeof(sink), MSG_DONTWAIT) > 0) {
+        }
+        if (round && !_open(&ws)) {
+            return;
+        }
+    }
+}
+
+static void _server(const uint8_t *data, size_t size)
+{
+    if (!addrlen) {
+        const int lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+        addr.sun_family = AF_UNIX;
+        // abstract, unique per process
+        addrlen = offsetof(struct sockaddr_un, sun_path) + 1 +
+                  snprintf(addr.sun_path + 1, sizeof(addr.sun_path) - 1, "fuzz_ws.%d", (int)getpid());
+        if ((lfd < 0) || bind(lfd, (struct sockaddr *)&addr, addrlen) || listen(lfd, 4) ||
+            (coap_ws_init(&ws, lfd, resources, 2) != COAP_SUCCESS)) {
+            abort();
+        }
+    }
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if ((fd < 0) || connect(fd, (struct sockaddr *)&addr, addrlen) ||
+        (send(fd, upgrade, sizeof(upgrade) - 1, MSG_NOSIGNAL) != sizeof(upgrade) - 1) ||
+        (send(fd, data, size, MSG_NOSIGNAL) != (ssize_t)size)) {
+        abort();
+    }
+    _pump(fd, 4);
+    close(fd);
+    _pump(-1, 64);
+    if (_open(&ws)) {
+        abort();
+    }
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    if (!size) {
+        return 0;
+    }
+    switch (data[0] & 3) {
+    case 0:
+        _roundtrip(data + 1, size - 1, COAP_FRAMING_TCP);
+        break;
+    case 1:
+        _roundtrip(data + 1, size - 1, COAP_FRAMING_WS);
+        break;
+    case 2:
+        _frame(data + 1, size - 1);
+        break;
+    default:
+        _server(data + 1, size - 1);
+        break;
+    }
+    return 0;
+}
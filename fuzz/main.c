@@ -0,0 +1,198 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "fuzz.h"
+
+/*
+ * Standalone driver for the fuzz targets, for toolchains without libFuzzer.
+ * It runs every corpus file through the target once, and with -n additionally
+ * runs that many randomly mutated corpus inputs. Build it with sanitizers,
+ * the input of a failing run is written to crash-<pid>.
+ */
+
+#define FUZZ_MAX_INPUT  2048    //!< maximum size of a (mutated) input
+#define FUZZ_MAX_CORPUS 4096    //!< maximum number of corpus files
+
+typedef struct fuzz_input
+{
+    size_t len;
+    uint8_t data[FUZZ_MAX_INPUT];
+} fuzz_input_t;
+
+static fuzz_input_t *corpus;
+static size_t ncorpus;
+static fuzz_input_t current;
+
+extern void __sanitizer_set_death_callback(void (*callback)(void)) __attribute__((weak));
+
+/* --- PRIVATE -------------------------------------------------------------- */
+static void _dump_current(void)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "crash-%d", (int)getpid());
+    int fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0) {
+        if (write(fd, current.data, current.len) < 0) {
+            /* nothing left to do */
+        }
+        close(fd);
+    }
+}
+
+static void _on_signal(int sig)
+{
+    _dump_current();
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+static void _load_file(const char *file)
+{
+    if (ncorpus == FUZZ_MAX_CORPUS) {
+        return;
+    }
+    FILE *f = fopen(file, "rb");
+    if (!f) {
+        perror(file);
+        return;
+    }
+    fuzz_input_t *in = &corpus[ncorpus++];
+    in->len = fread(in->data, 1, sizeof(in->data), f);
+    fclose(f);
+}
+
+static void _load(const char *path)
+{
+    struct stat st;
+    if (stat(path, &st)) {
+        perror(path);
+        return;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        _load_file(path);
+        return;
+    }
+    DIR *dir = opendir(path);
+    struct dirent *ent;
+    while (dir && (ent = readdir(dir))) {
+        char file[1024];
+        if (ent->d_name[0] == '.') {
+            continue;
+        }
+        snprintf(file, sizeof(file), "%s/%s", path, ent->d_name);
+        _load_file(file);
+    }
+    if (dir) {
+        closedir(dir);
+    }
+}
+
+/* xorshift64*, deterministic per seed so that runs can be repeated */
+static uint64_t _rand(uint64_t *state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717ull;
+}
+
+static void _mutate(fuzz_input_t *in, uint64_t *rng)
+{
+    static const uint8_t interesting[] = {
+        0x00, 0x01, 0x0C, 0x0D, 0x0E, 0x0F, 0x7F, 0x80, 0xD0, 0xE0, 0xFF
+    };
+    int rounds = 1 + _rand(rng) % 4;
+    while (rounds--) {
+        size_t pos = in->len ? _rand(rng) % in->len : 0;
+        switch (_rand(rng) % 6) {
+        case 0:     /* flip a bit */
+            if (in->len) {
+                in->data[pos] ^= 1 << (_rand(rng) % 8);
+            }
+            break;
+        case 1:     /* interesting byte, option nibbles and payload marker */
+            if (in->len) {
+                in->data[pos] = interesting[_rand(rng) % sizeof(interesting)];
+            }
+            break;
+        case 2:     /* random byte */
+            if (in->len) {
+                in->data[pos] = (uint8_t)_rand(rng);
+            }
+            break;
+        case 3:     /* insert a byte */
+            if (in->len < FUZZ_MAX_INPUT) {
+                memmove(in->data + pos + 1, in->data + pos, in->len - pos);
+                in->data[pos] = (uint8_t)_rand(rng);
+                in->len++;
+            }
+            break;
+        case 4:     /* delete a byte */
+            if (in->len) {
+                memmove(in->data + pos, in->data + pos + 1, in->len - pos - 1);
+                in->len--;
+            }
+            break;
+        default:    /* truncate */
+            in->len = pos;
+            break;
+        }
+    }
+}
+
+/* --- MAIN ----------------------------------------------------------------- */
+int main(int argc, char *argv[])
+{
+    unsigned long iterations = 0;
+    uint64_t seed = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:s:")) != -1) {
+        switch (opt) {
+        case 'n':
+            iterations = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            seed = strtoull(optarg, NULL, 0) | 1;
+            break;
+        default:
+            fprintf(stderr, "USAGE: %s [-n iterations] [-s seed] corpus...\n", argv[0]);
+            return 1;
+        }
+    }
+    corpus = calloc(FUZZ_MAX_CORPUS, sizeof(*corpus));
+    if (!corpus) {
+        return 1;
+    }
+    for (int i = optind; i < argc; ++i) {
+        _load(argv[i]);
+    }
+    if (__sanitizer_set_death_callback) {
+        __sanitizer_set_death_callback(_dump_current);
+    }
+    signal(SIGABRT, _on_signal);
+    signal(SIGSEGV, _on_signal);
+
+    for (size_t i = 0; i < ncorpus; ++i) {
+        current = corpus[i];
+        LLVMFuzzerTestOneInput(current.data, current.len);
+    }
+    fprintf(stderr, "%s: %zu corpus inputs ok\n", argv[0], ncorpus);
+    if (!ncorpus || !iterations) {
+        return 0;
+    }
+    for (unsigned long n = 0; n < iterations; ++n) {
+        current = corpus[_rand(&seed) % ncorpus];
+        _mutate(&current, &seed);
+        LLVMFuzzerTestOneInput(current.data, current.len);
+    }
+    fprintf(stderr, "%s: %lu mutated inputs ok\n", argv[0], iterations);
+    return 0;
+}
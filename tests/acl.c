@@ -0,0 +1,289 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include "coap.h"
+#include "coap_acl.h"
+
+/*
+ * Tests the ACL: policies compiled against a resource table into bitsets per
+ * method and path, wildcards, identities by PSK identity, key ID and longest
+ * source prefix, malformed policies with the line of the error, requests
+ * allowed and denied with 4.01 and 4.03 by coap_handle_request_acl, and the
+ * generations of reloaded tables. Exits non-zero if any check fails.
+ */
+
+static int failures;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+static int handled;
+
+static int _handler(const coap_resource_t *resource, const coap_packet_t *inpkt,
+                    coap_packet_t *pkt)
+{
+    handled++;
+    return coap_make_response(inpkt->hdr.id, &inpkt->tok, COAP_TYPE_ACK,
+                              COAP_RSPCODE_CONTENT, resource->content_type, NULL, 0, pkt);
+}
+
+static const coap_resource_path_t path_core = {2, {".well-known", "core"}};
+static const coap_resource_path_t path_light = {1, {"light"}};
+static const coap_resource_path_t path_rd = {1, {"rd"}};
+static const coap_resource_path_t path_rd_ep = {2, {"rd", "ep"}};
+
+static coap_resource_t resources[] =
+{
+    {COAP_RDY, COAP_METHOD_GET, COAP_TYPE_ACK, _handler, &path_core,
+        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_APP_LINKFORMAT), NULL},
+    {COAP_RDY, COAP_METHOD_GET, COAP_TYPE_ACK, _handler, &path_light,
+        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_TXT_PLAIN), NULL},
+    {COAP_RDY, COAP_METHOD_PUT, COAP_TYPE_ACK, _handler, &path_light,
+        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_TXT_PLAIN), NULL},
+    {COAP_RDY, COAP_METHOD_POST, COAP_TYPE_ACK, _handler, &path_rd,
+        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_NONE), NULL},
+    {COAP_RDY, COAP_METHOD_DELETE, COAP_TYPE_ACK, _handler, &path_rd_ep,
+        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_NONE), NULL},
+    {(coap_state_t)0, (coap_method_t)0, (coap_msgtype_t)0, NULL, NULL,
+        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_NONE), NULL}
+};
+
+static const char policy[] =
+    "# sample policy\n"
+    "principal sensor psk sensor-01\n"
+    "principal sensor kid 0a0B\n"
+    "principal admin  prefix 192.0.2.0/24\n"
+    "principal lab    prefix 192.0.2.128/25   # longer, wins\n"
+    "principal admin  prefix 2001:db8::/32\n"
+    "principal host   prefix 198.51.100.7\n"
+    "\n"
+    "\tallow *            GET     /.well-known/core\n"
+    "allow sensor,lab   GET,PUT /light\n"
+    "allow admin        *       /rd/*\n"
+    "allow anonymous    GET     /light\r\n";
+
+/* --- HELPERS -------------------------------------------------------------- */
+static struct sockaddr_in _v4(const char *ip)
+{
+    struct sockaddr_in a;
+    memset(&a, 0, sizeof(a));
+    a.sin_family = AF_INET;
+    inet_pton(AF_INET, ip, &a.sin_addr);
+    return a;
+}
+
+static struct sockaddr_in6 _v6(const char *ip)
+{
+    struct sockaddr_in6 a;
+    memset(&a, 0, sizeof(a));
+    a.sin6_family = AF_INET6;
+    inet_pton(AF_INET6, ip, &a.sin6_addr);
+    return a;
+}
+
+static uint8_t _addr(const coap_acl_table_t *t, const char *ip)
+{
+    if (strchr(ip, ':')) {
+        const struct sockaddr_in6 a = _v6(ip);
+        return coap_acl_addr(t, (const struct sockaddr *)&a, sizeof(a));
+    }
+    const struct sockaddr_in a = _v4(ip);
+    return coap_acl_addr(t, (const struct sockaddr *)&a, sizeof(a));
+}
+
+/* the response code to a request of \p principal */
+static uint8_t _request(const coap_acl_table_t *t, const coap_method_t method,
+                        const char *seg1, const char *seg2, const uint8_t principal)
+{
+    coap_packet_t req, rsp;
+
+    memset(&req, 0, sizeof(req));
+    req.hdr.ver = 1;
+    req.hdr.t = COAP_TYPE_CON;
+    req.hdr.code = method;
+    req.hdr.id = 1;
+    coap_add_option(&req, COAP_OPTION_URI_PATH, (const uint8_t *)seg1, strlen(seg1));
+    if (seg2) {
+        coap_add_option(&req, COAP_OPTION_URI_PATH, (const uint8_t *)seg2, strlen(seg2));
+    }
+    coap_handle_request_acl(resources, coap_acl_mask(t), principal, &req, &rsp);
+    return rsp.hdr.code;
+}
+
+static coap_state_t _compile(const char *text, unsigned *line)
+{
+    coap_acl_table_t *t = NULL;
+    const coap_state_t rc = coap_acl_compile(text, strlen(text), resources, &t, line);
+    CHECK((rc == COAP_SUCCESS) == (t != NULL));
+    coap_acl_free(t);
+    return rc;
+}
+
+static coap_acl_table_t *_table(const char *text)
+{
+    coap_acl_table_t *t = NULL;
+    coap_acl_compile(text, strlen(text), resources, &t, NULL);
+    return t;
+}
+
+/* --- TESTS ---------------------------------------------------------------- */
+static void _test_compile(void)
+{
+    coap_acl_table_t *t;
+    unsigned line = 0;
+
+    CHECK(coap_acl_compile(policy, strlen(policy), resources, &t, &line) == COAP_SUCCESS);
+    if (!t) {
+        return;
+    }
+    CHECK(t->nresources == 5);
+    CHECK(t->nprincipals == 5);     // anonymous, sensor, admin, lab, host
+    CHECK(t->allow[0] == ~(coap_acl_mask_t)0);
+    CHECK(t->allow[1] == ((1 << 0) | (1 << 1) | (1 << 3)));
+    CHECK(t->allow[2] == ((1 << 1) | (1 << 3)));
+    CHECK(t->allow[3] == (1 << 2));
+    CHECK(t->allow[4] == (1 << 2));
+    for (int p = 0; p < COAP_ACL_MAX_PRINCIPALS; ++p) {
+        CHECK(coap_acl_allowed(t, 0, (uint8_t)p));
+    }
+    CHECK(!coap_acl_allowed(t, 0, COAP_ACL_MAX_PRINCIPALS));
+    CHECK(coap_acl_allowed(NULL, 4, 0));
+
+    // identities
+    CHECK(coap_acl_psk(t, "sensor-01") == 1);
+    CHECK(coap_acl_psk(t, "sensor-0") == COAP_ACL_ANONYMOUS);
+    CHECK(coap_acl_psk(t, NULL) == COAP_ACL_ANONYMOUS);
+    CHECK(coap_acl_kid(t, (const uint8_t *)"\x0a\x0b", 2) == 1);
+    CHECK(coap_acl_kid(t, (const uint8_t *)"\x0a", 1) == COAP_ACL_ANONYMOUS);
+    CHECK(_addr(t, "192.0.2.1") == 2);
+    CHECK(_addr(t, "192.0.2.127") == 2);
+    CHECK(_addr(t, "192.0.2.128") == 3);
+    CHECK(_addr(t, "192.0.2.255") == 3);
+    CHECK(_addr(t, "192.0.3.1") == COAP_ACL_ANONYMOUS);
+    CHECK(_addr(t, "::ffff:192.0.2.200") == 3);
+    CHECK(_addr(t, "2001:db8:1::5") == 2);
+    CHECK(_addr(t, "2001:db9::5") == COAP_ACL_ANONYMOUS);
+    CHECK(_addr(t, "198.51.100.7") == 4);
+    CHECK(_addr(t, "198.51.100.6") == COAP_ACL_ANONYMOUS);
+    CHECK(coap_acl_psk(NULL, "sensor-01") == COAP_ACL_ANONYMOUS);
+    coap_acl_free(t);
+
+    // IPv4-mapped prefixes are IPv4 prefixes
+    CHECK((t = _table("principal m prefix ::ffff:203.0.113.0/120\n")));
+    CHECK(t && (_addr(t, "203.0.113.9") == 1) && (_addr(t, "::ffff:203.0.113.9") == 1) &&
+          (_addr(t, "203.0.114.9") == COAP_ACL_ANONYMOUS));
+    coap_acl_free(t);
+
+    // an empty policy denies all
+    CHECK((t = _table("")));
+    CHECK(t && (t->allow[0] == 0) && (t->nprincipals == 1));
+    coap_acl_free(t);
+    // forward references, and a catch-all
+    CHECK((t = _table("allow x * /*\nprincipal x psk a\n")));
+    CHECK(t && (t->allow[0] == 2) && (t->allow[4] == 2));
+    coap_acl_free(t);
+}
+
+static void _test_errors(void)
+{
+    coap_acl_table_t *t = NULL;
+    unsigned line = 0;
+    char big[8192];
+    size_t n = 0;
+
+    CHECK(_compile("principal a psk x\nallow b GET /light\n", &line) == COAP_ERR_PAYLOAD_INVALID);
+    CHECK(line == 2);
+    CHECK(_compile("\n\nallow * GOT /light\n", &line) == COAP_ERR_PAYLOAD_INVALID);
+    CHECK(line == 3);
+    CHECK(_compile("allow * GET light\n", &line) == COAP_ERR_PAYLOAD_INVALID);
+    CHECK(_compile("allow * GET /light extra\n", &line) == COAP_ERR_PAYLOAD_INVALID);
+    CHECK(_compile("allow * GET\n", &line) == COAP_ERR_PAYLOAD_INVALID);
+    CHECK(_compile("deny * GET /light\n", &line) == COAP_ERR_PAYLOAD_INVALID);
+    CHECK(_compile("principal anonymous psk x\n", &line) == COAP_ERR_PAYLOAD_INVALID);
+    CHECK(_compile("principal * psk x\n", &line) == COAP_ERR_PAYLOAD_INVALID);
+    CHECK(_compile("principal a,b psk x\n", &line) == COAP_ERR_PAYLOAD_INVALID);
+    CHECK(_compile("principal a cert x\n", &line) == COAP_ERR_PAYLOAD_INVALID);
+    CHECK(_compile("principal a kid 0\n", &line) == COAP_ERR_PAYLOAD_INVALID);
+    CHECK(_compile("principal a kid 0g\n", &line) == COAP_ERR_PAYLOAD_INVALID);
+    CHECK(_compile("principal a prefix 192.0.2.0/33\n", &line) == COAP_ERR_PAYLOAD_INVALID);
+    CHECK(_compile("principal a prefix 192.0.2/24\n", &line) == COAP_ERR_PAYLOAD_INVALID);
+    CHECK(_compile("principal a prefix 2001:db8::/\n", &line) == COAP_ERR_PAYLOAD_INVALID);
+    CHECK(_compile("principal a prefix 2001:db8::/129\n", &line) == COAP_ERR_PAYLOAD_INVALID);
+    CHECK(_compile("principal a prefix ::/0\n", &line) == COAP_SUCCESS);
+    CHECK(coap_acl_compile("principal a psk x\0y\n", 20, resources, &t, &line) == COAP_ERR_PAYLOAD_INVALID);
+    // 63 named principals fit, the 64th does not
+    for (int i = 1; i < COAP_ACL_MAX_PRINCIPALS; ++i) {
+        n += (size_t)snprintf(big + n, sizeof(big) - n, "principal p%d psk id%d\n", i, i);
+    }
+    CHECK(_compile(big, &line) == COAP_SUCCESS);
+    snprintf(big + n, sizeof(big) - n, "principal p64 psk id64\n");
+    CHECK(_compile(big, &line) == COAP_ERR_BUFFER_TOO_SMALL);
+    CHECK(line == COAP_ACL_MAX_PRINCIPALS);
+}
+
+static void _test_dispatch(void)
+{
+    coap_acl_table_t *t;
+
+    CHECK(coap_acl_compile(policy, strlen(policy), resources, &t, NULL) == COAP_SUCCESS);
+    if (!t) {
+        return;
+    }
+    handled = 0;
+    CHECK(_request(t, COAP_METHOD_GET, ".well-known", "core", 0) == COAP_RSPCODE_CONTENT);
+    CHECK(_request(t, COAP_METHOD_GET, "light", NULL, 0) == COAP_RSPCODE_CONTENT);
+    CHECK(_request(t, COAP_METHOD_PUT, "light", NULL, 0) == COAP_RSPCODE_UNAUTHORIZED);
+    CHECK(_request(t, COAP_METHOD_PUT, "light", NULL, 1) == COAP_RSPCODE_CONTENT);
+    CHECK(_request(t, COAP_METHOD_PUT, "light", NULL, 2) == COAP_RSPCODE_FORBIDDEN);
+    CHECK(_request(t, COAP_METHOD_POST, "rd", NULL, 2) == COAP_RSPCODE_CONTENT);
+    CHECK(_request(t, COAP_METHOD_DELETE, "rd", "ep", 2) == COAP_RSPCODE_CONTENT);
+    CHECK(_request(t, COAP_METHOD_DELETE, "rd", "ep", 3) == COAP_RSPCODE_FORBIDDEN);
+    CHECK(_request(t, COAP_METHOD_GET, "light", NULL, 200) == COAP_RSPCODE_FORBIDDEN);
+    CHECK(handled == 5);
+    // the lookup answers first, the ACL only guards handlers
+    CHECK(_request(t, COAP_METHOD_GET, "dark", NULL, 0) != COAP_RSPCODE_UNAUTHORIZED);
+    CHECK(_request(t, COAP_METHOD_DELETE, "light", NULL, 1) == COAP_RSPCODE_METHOD_NOT_ALLOWED);
+    // without table everything is allowed
+    CHECK(_request(NULL, COAP_METHOD_PUT, "light", NULL, 0) == COAP_RSPCODE_CONTENT);
+    CHECK(handled == 6);
+    coap_acl_free(t);
+}
+
+static void _test_reload(void)
+{
+    static const char open_policy[] = "allow * * /*\n";
+    coap_acl_t acl = { NULL, 0 };
+    coap_acl_table_t *a, *b;
+
+    CHECK(coap_acl_current(&acl) == NULL);
+    CHECK(coap_acl_compile(policy, strlen(policy), resources, &a, NULL) == COAP_SUCCESS);
+    CHECK(coap_acl_compile(open_policy, strlen(open_policy), resources, &b, NULL) == COAP_SUCCESS);
+    CHECK(coap_acl_swap(&acl, a) == NULL);
+    CHECK((coap_acl_current(&acl) == a) && (a->gen == 1));
+    CHECK(_request(coap_acl_current(&acl), COAP_METHOD_PUT, "light", NULL, 0) == COAP_RSPCODE_UNAUTHORIZED);
+    CHECK(coap_acl_swap(&acl, b) == a);
+    CHECK((coap_acl_current(&acl) == b) && (b->gen == 2));
+    CHECK(_request(coap_acl_current(&acl), COAP_METHOD_PUT, "light", NULL, 0) == COAP_RSPCODE_CONTENT);
+    coap_acl_free(a);
+    CHECK(coap_acl_swap(&acl, NULL) == b);
+    coap_acl_free(b);
+}
+
+/* --- MAIN ----------------------------------------------------------------- */
+int main(void)
+{
+    _test_compile();
+    _test_errors();
+    _test_dispatch();
+    _test_reload();
+    printf("%s\n", failures ? "FAILED" : "PASSED");
+    return failures ? 1 : 0;
+}
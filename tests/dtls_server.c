@@ -0,0 +1,674 @@
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+#include "coap.h"
+#include "coap_acl.h"
+#include "coap_dtls.h"
+
+/*
+ * Tests the DTLS transport with OpenSSL clients on loopback, in this
+ * process. Checks PSK handshakes and requests with handshakes on the
+ * calling thread, resumption from another port as after a NAT rebinding, a
+ * new handshake replacing an established session, rejected identities, the
+ * stateless cookie exchange with a flood of ClientHellos and secret rotation,
+ * datagrams without a session, idle expiry, access control by PSK identity
+ * across a policy reload, and many concurrent handshakes and requests with
+ * worker threads. Exits non-zero if any check fails.
+ */
+
+#define CLIENTS         64
+#define ROUNDS          10      //!< requests per client
+#define WAIT_MS         5000
+
+typedef struct client
+{
+    int fd;
+    SSL *ssl;
+    const char *identity;
+} client_t;
+
+static coap_dtls_t dtls;
+static coap_acl_t acl;          //!< of the server, if server_acl
+static bool server_acl;
+static uint16_t port;
+static SSL_CTX *ctx;
+static client_t clients[CLIENTS];
+static int failures;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+/* --- RESOURCES ------------------------------------------------------------ */
+static const coap_resource_path_t path_hello = {1, {"hello"}};
+static const coap_resource_path_t path_echo = {1, {"echo"}};
+
+static int handle_get_hello(const coap_resource_t *resource,
+                            const coap_packet_t *inpkt,
+                            coap_packet_t *pkt)
+{
+    return coap_make_response(inpkt->hdr.id, &inpkt->tok,
+                              COAP_TYPE_ACK, COAP_RSPCODE_CONTENT,
+                              resource->content_type,
+                              (const uint8_t *)"world", 5, pkt);
+}
+
+static int handle_put_echo(const coap_resource_t *resource,
+                           const coap_packet_t *inpkt,
+                           coap_packet_t *pkt)
+{
+    return coap_make_response(inpkt->hdr.id, &inpkt->tok,
+                              COAP_TYPE_ACK, COAP_RSPCODE_CHANGED,
+                              resource->content_type,
+                              inpkt->payload.p, inpkt->payload.len, pkt);
+}
+
+static coap_resource_t resources[] =
+{
+    {COAP_RDY, COAP_METHOD_GET, COAP_TYPE_ACK,
+        handle_get_hello, &path_hello,
+        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_TXT_PLAIN), NULL},
+    {COAP_RDY, COAP_METHOD_PUT, COAP_TYPE_ACK,
+        handle_put_echo, &path_echo,
+        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_APP_OCTECT_STREAM), NULL},
+    {(coap_state_t)0, (coap_method_t)0, (coap_msgtype_t)0,
+        NULL, NULL,
+        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_NONE), NULL}
+};
+
+static const char secret[] = "secretPSK";
+
+static size_t server_psk(void *ctx, const char *identity, uint8_t *key, const size_t size)
+{
+    (void) ctx;
+    if (strcmp(identity, "yacoap") || (size < sizeof(secret) - 1)) {
+        return 0;
+    }
+    memcpy(key, secret, sizeof(secret) - 1);
+    return sizeof(secret) - 1;
+}
+
+static unsigned int client_psk(SSL *ssl, const char *hint, char *identity,
+                               unsigned int max_identity_len, unsigned char *psk,
+                               unsigned int max_psk_len)
+{
+    const client_t *c = SSL_get_app_data(ssl);
+    (void) hint;
+    if ((strlen(c->identity) >= max_identity_len) || (max_psk_len < sizeof(secret) - 1)) {
+        return 0;
+    }
+    strcpy(identity, c->identity);
+    memcpy(psk, secret, sizeof(secret) - 1);
+    return sizeof(secret) - 1;
+}
+
+/* --- PRIVATE -------------------------------------------------------------- */
+static uint32_t _now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+/* one round of the event loop of the server */
+static void _pump(int timeout)
+{
+    struct pollfd fds[2];
+    const size_t n = coap_dtls_pollfds(&dtls, fds, 2);
+    poll(fds, n, timeout);
+    coap_dtls_process(&dtls, _now_ms());
+}
+
+static bool _server(const unsigned workers, const uint32_t idle_ms)
+{
+    struct sockaddr_in addr = { .sin_family = AF_INET };
+    socklen_t len = sizeof(addr);
+    const coap_dtls_config_t config = {
+        .psk = server_psk, .workers = workers, .idle_ms = idle_ms, .max_sessions = 2 * CLIENTS,
+        .acl = server_acl ? &acl : NULL
+    };
+
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    const int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if ((fd < 0) || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+        getsockname(fd, (struct sockaddr *)&addr, &len) ||
+        (coap_dtls_init(&dtls, fd, resources, &config) != COAP_SUCCESS)) {
+        perror("server");
+        return false;
+    }
+    port = ntohs(addr.sin_port);
+    return true;
+}
+
+static void _server_free(void)
+{
+    const int fd = dtls.fd;
+    coap_dtls_free(&dtls);
+    close(fd);
+}
+
+/* a new connection on the socket of \p c */
+static void _connect(client_t *c, SSL_SESSION *session)
+{
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port) };
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    BIO *bio = BIO_new_dgram(c->fd, BIO_NOCLOSE);
+    BIO_ctrl(bio, BIO_CTRL_DGRAM_SET_CONNECTED, 0, &addr);
+    c->ssl = SSL_new(ctx);
+    SSL_set_bio(c->ssl, bio, bio);
+    SSL_set_app_data(c->ssl, c);
+    SSL_set_mtu(c->ssl, COAP_DTLS_MTU);
+    if (session) {
+        SSL_set_session(c->ssl, session);
+    }
+    SSL_set_connect_state(c->ssl);
+}
+
+/* a new socket, so a new source port */
+static bool _open(client_t *c, const char *identity, SSL_SESSION *session)
+{
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port) };
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    c->identity = identity;
+    c->fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if ((c->fd < 0) || connect(c->fd, (struct sockaddr *)&addr, sizeof(addr))) {
+        return false;
+    }
+    fcntl(c->fd, F_SETFL, O_NONBLOCK);
+    _connect(c, session);
+    return true;
+}
+
+/* without \p notify as if the client went away, the session stays resumable */
+static void _close(client_t *c, const bool notify)
+{
+    if (notify) {
+        SSL_shutdown(c->ssl);
+    }
+    else {
+        SSL_set_shutdown(c->ssl, SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+    }
+    SSL_free(c->ssl);
+    close(c->fd);
+    c->ssl = NULL;
+    c->fd = -1;
+    ERR_clear_error();
+}
+
+/* 1 done, 0 in progress, -1 failed */
+static int _step(client_t *c)
+{
+    struct timeval tv;
+    const int rc = SSL_do_handshake(c->ssl);
+    if (rc == 1) {
+        return 1;
+    }
+    if (SSL_get_error(c->ssl, rc) != SSL_ERROR_WANT_READ) {
+        ERR_clear_error();
+        return -1;
+    }
+    if (DTLSv1_get_timeout(c->ssl, &tv) && !tv.tv_sec && !tv.tv_usec) {
+        DTLSv1_handle_timeout(c->ssl);
+    }
+    return 0;
+}
+
+static bool _handshake(client_t *c)
+{
+    const uint32_t start = _now_ms();
+    int rc;
+    while (!(rc = _step(c)) && (_now_ms() - start < WAIT_MS)) {
+        _pump(1);
+    }
+    return rc == 1;
+}
+
+static size_t _request(uint8_t *buf, const coap_method_t method, const char *path,
+                       const uint16_t id, const uint8_t *payload, const size_t len)
+{
+    static const uint8_t tok[] = { 0x5a, 0xa5 };
+    coap_packet_t pkt;
+    size_t buflen = 256;
+
+    memset(&pkt, 0, sizeof(pkt));
+    pkt.hdr.ver = COAP_VERSION;
+    pkt.hdr.t = COAP_TYPE_CON;
+    pkt.hdr.code = method;
+    pkt.hdr.id = id;
+    pkt.hdr.tkl = sizeof(tok);
+    pkt.tok.p = tok;
+    pkt.tok.len = sizeof(tok);
+    coap_add_option(&pkt, COAP_OPTION_URI_PATH, (const uint8_t *)path, strlen(path));
+    pkt.payload.p = payload;
+    pkt.payload.len = len;
+    return (coap_build(&pkt, buf, &buflen) == COAP_SUCCESS) ? buflen : 0;
+}
+
+/* the next record, parsed into \p pkt pointing into \p buf */
+static bool _response(client_t *c, coap_packet_t *pkt, uint8_t *buf, const size_t size)
+{
+    const uint32_t start = _now_ms();
+    do {
+        const int n = SSL_read(c->ssl, buf, (int)size);
+        if (n > 0) {
+            return coap_parse(buf, (size_t)n, pkt) == COAP_SUCCESS;
+        }
+        ERR_clear_error();
+        _pump(1);
+    } while (_now_ms() - start < WAIT_MS);
+    return false;
+}
+
+static bool _get_hello(client_t *c, const uint16_t id)
+{
+    uint8_t req[256], rsp[COAP_DTLS_DGRAM_SIZE];
+    coap_packet_t pkt;
+    const size_t n = _request(req, COAP_METHOD_GET, "hello", id, NULL, 0);
+    return (SSL_write(c->ssl, req, (int)n) == (int)n) && _response(c, &pkt, rsp, sizeof(rsp)) &&
+           (pkt.hdr.id == id) && (pkt.hdr.code == COAP_RSPCODE_CONTENT) &&
+           (pkt.payload.len == 5) && !memcmp(pkt.payload.p, "world", 5);
+}
+
+static uint8_t _code(client_t *c, const coap_method_t method, const char *path,
+                     const uint16_t id)
+{
+    uint8_t req[256], rsp[COAP_DTLS_DGRAM_SIZE];
+    coap_packet_t pkt;
+    const size_t n = _request(req, method, path, id, (const uint8_t *)"x", 1);
+    if ((SSL_write(c->ssl, req, (int)n) != (int)n) || !_response(c, &pkt, rsp, sizeof(rsp)) ||
+        (pkt.hdr.id != id)) {
+        return 0;
+    }
+    return pkt.hdr.code;
+}
+
+static bool _policy(const char *text)
+{
+    coap_acl_table_t *table;
+    if (coap_acl_compile(text, strlen(text), resources, &table, NULL) != COAP_SUCCESS) {
+        return false;
+    }
+    coap_acl_free(coap_acl_swap(&acl, table));
+    return true;
+}
+
+static size_t _sessions(void)
+{
+    return dtls.config.max_sessions - dtls.nfree;
+}
+
+/* --- TESTS ---------------------------------------------------------------- */
+static void _test_config(void)
+{
+    coap_dtls_t d;
+    const coap_dtls_config_t none = { .workers = 1 };
+    const coap_dtls_config_t bad = { .psk = server_psk, .ciphers = "NO-SUCH-CIPHER" };
+    const coap_dtls_config_t missing = { .cert_file = "/nonexistent.pem", .key_file = "/nonexistent.pem" };
+    const int fd = socket(AF_INET, SOCK_DGRAM, 0);
+
+    CHECK(coap_dtls_init(&d, fd, resources, &none) == COAP_ERR_UNSUPPORTED);
+    coap_dtls_free(&d);
+    CHECK(coap_dtls_init(&d, fd, resources, &bad) == COAP_ERR_UNSUPPORTED);
+    CHECK(coap_dtls_init(&d, fd, resources, &missing) == COAP_ERR_UNSUPPORTED);
+    close(fd);
+}
+
+static void _test_inline(void)
+{
+    uint8_t req[256], rsp[COAP_DTLS_DGRAM_SIZE];
+    coap_packet_t pkt;
+    client_t c, d;
+
+    if (!_server(0, 0)) {
+        failures++;
+        return;
+    }
+    // full handshake, requests
+    CHECK(_open(&c, "yacoap", NULL));
+    CHECK(_handshake(&c));
+    CHECK(!SSL_session_reused(c.ssl));
+    CHECK(_get_hello(&c, 1));
+    const size_t n = _request(req, COAP_METHOD_PUT, "echo", 2, (const uint8_t *)"payload", 7);
+    CHECK(SSL_write(c.ssl, req, (int)n) == (int)n);
+    CHECK(_response(&c, &pkt, rsp, sizeof(rsp)) && (pkt.hdr.code == COAP_RSPCODE_CHANGED) &&
+          (pkt.payload.len == 7) && !memcmp(pkt.payload.p, "payload", 7));
+    CHECK((dtls.handshakes == 1) && !dtls.resumed && (dtls.records == 2));
+    CHECK(_sessions() == 1);
+
+    // after a NAT rebinding records come from another port and are dropped,
+    // the client resumes from there
+    SSL_SESSION *session = SSL_get1_session(c.ssl);
+    const uint32_t dropped = dtls.drops;
+    CHECK(_open(&d, "yacoap", NULL));
+    SSL_free(d.ssl);
+    BIO_set_fd(SSL_get_rbio(c.ssl), d.fd, BIO_NOCLOSE);
+    CHECK(SSL_write(c.ssl, req, (int)n) == (int)n);
+    for (int i = 0; i < 10; ++i) {
+        _pump(1);
+    }
+    CHECK(dtls.drops == dropped + 1);
+    _close(&c, false);
+    _connect(&d, session);
+    CHECK(_handshake(&d));
+    CHECK(SSL_session_reused(d.ssl));
+    CHECK(_get_hello(&d, 3));
+    CHECK((dtls.handshakes == 2) && (dtls.resumed == 1));
+
+    // close_notify frees the session, it stays resumable
+    _close(&d, true);
+    for (int i = 0; (i < 100) && _sessions(); ++i) {
+        _pump(1);
+    }
+    CHECK(_sessions() == 1);    // the one of the rebound port, still open
+    CHECK(_open(&d, "yacoap", session));
+    CHECK(_handshake(&d));
+    CHECK(SSL_session_reused(d.ssl));
+    _close(&d, true);
+    SSL_SESSION_free(session);
+
+    // an unknown identity fails the handshake, the slot is freed
+    const uint32_t failed = dtls.failures;
+    CHECK(_open(&d, "nobody", NULL));
+    CHECK(!_handshake(&d));
+    _close(&d, false);
+    for (int i = 0; i < 10; ++i) {
+        _pump(1);
+    }
+    CHECK(dtls.failures == failed + 1);
+
+    // no session without a ClientHello
+    const uint32_t drops = dtls.drops;
+    const size_t sessions = _sessions();
+    CHECK(_open(&d, "yacoap", NULL));
+    CHECK(send(d.fd, "garbage", 7, 0) == 7);
+    CHECK(send(d.fd, req, n, 0) == (ssize_t)n);
+    for (int i = 0; i < 10; ++i) {
+        _pump(1);
+    }
+    CHECK(dtls.drops == drops + 2);
+    CHECK(_sessions() == sessions);
+
+    // a new handshake on the same port replaces an established session
+    CHECK(_handshake(&d));
+    CHECK(_get_hello(&d, 4));
+    SSL_free(d.ssl);
+    _connect(&d, NULL);
+    CHECK(_handshake(&d));
+    CHECK(_get_hello(&d, 5));
+    CHECK(_sessions() == sessions + 1);
+    _close(&d, false);
+
+    CHECK(dtls.hello_verifies == dtls.handshakes + 1);  // and the unknown identity
+    printf("inline: %u handshakes, %u resumed, %u records, %u failures, %u drops, %u cookies\n",
+           dtls.handshakes, dtls.resumed, dtls.records, dtls.failures, dtls.drops,
+           dtls.hello_verifies);
+
+    // idle sessions expire
+    _server_free();
+    if (!_server(0, 50)) {
+        failures++;
+        return;
+    }
+    CHECK(_open(&c, "yacoap", NULL));
+    CHECK(_handshake(&c));
+    CHECK(_sessions() == 1);
+    const uint32_t start = _now_ms();
+    while (_sessions() && (_now_ms() - start < WAIT_MS)) {
+        _pump(10);
+    }
+    CHECK(!_sessions());
+    CHECK(SSL_write(c.ssl, req, (int)n) == (int)n);
+    for (int i = 0; i < 10; ++i) {
+        _pump(1);
+    }
+    CHECK(!_sessions());
+    _close(&c, false);
+    _server_free();
+}
+
+/* the first ClientHello of a client, as sent */
+static size_t _capture_hello(uint8_t *buf, const size_t size)
+{
+    struct sockaddr_in addr = { .sin_family = AF_INET };
+    socklen_t len = sizeof(addr);
+    const uint16_t server = port;
+    client_t c;
+    ssize_t n = -1;
+
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    const int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if ((fd < 0) || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+        getsockname(fd, (struct sockaddr *)&addr, &len)) {
+        return 0;
+    }
+    port = ntohs(addr.sin_port);
+    if (_open(&c, "yacoap", NULL)) {
+        _step(&c);
+        n = recv(fd, buf, size, 0);
+    }
+    _close(&c, false);
+    close(fd);
+    port = server;
+    return (n > 0) ? (size_t)n : 0;
+}
+
+/* \p hello with the cookie of \p hvr, as sent again */
+static size_t _with_cookie(uint8_t *out, const uint8_t *hello, const size_t len, const uint8_t *hvr)
+{
+    const size_t cookielen = hvr[27];
+    const size_t sid_at = 25 + 2 + 32, cookie_at = sid_at + 1 + hello[sid_at];
+    const size_t msglen = (size_t)hello[14] << 16 | (size_t)hello[15] << 8 | hello[16];
+    const size_t reclen = (size_t)hello[11] << 8 | hello[12];
+
+    memcpy(out, hello, cookie_at);
+    out[cookie_at] = (uint8_t)cookielen;
+    memcpy(out + cookie_at + 1, hvr + 28, cookielen);
+    memcpy(out + cookie_at + 1 + cookielen, hello + cookie_at + 1, len - cookie_at - 1);
+    out[11] = (uint8_t)((reclen + cookielen) >> 8);
+    out[12] = (uint8_t)(reclen + cookielen);
+    out[16] = out[24] = (uint8_t)(msglen + cookielen);
+    out[15] = out[23] = (uint8_t)((msglen + cookielen) >> 8);
+    out[18] = 1;    // message sequence
+    return len + cookielen;
+}
+
+static void _test_cookies(void)
+{
+    uint8_t hello[COAP_DTLS_DGRAM_SIZE], again[COAP_DTLS_DGRAM_SIZE];
+    uint8_t hvr[COAP_DTLS_HVR_SIZE], hvr2[COAP_DTLS_HVR_SIZE];
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(5683) };
+    struct sockaddr_in other = { .sin_family = AF_INET, .sin_port = htons(5684) };
+    size_t hvrlen = sizeof(hvr), hvrlen2 = sizeof(hvr2);
+
+    if (!_server(0, 0)) {
+        failures++;
+        return;
+    }
+    addr.sin_addr.s_addr = other.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    const size_t len = _capture_hello(hello, sizeof(hello));
+    CHECK(len > 25);
+
+    // the HelloVerifyRequest echoes the sequence numbers, the cookie is bound to the address
+    CHECK(coap_dtls_cookie_check(&dtls, (struct sockaddr *)&addr, sizeof(addr), hello, len,
+                                 hvr, &hvrlen) == COAP_SUCCESS);
+    CHECK((hvrlen == COAP_DTLS_HVR_SIZE) && (hvr[13] == 3) && (hvr[27] == COAP_DTLS_COOKIE_SIZE));
+    CHECK(!memcmp(hvr + 3, hello + 3, 8) && !memcmp(hvr + 17, hello + 17, 2));
+    const size_t n = _with_cookie(again, hello, len, hvr);
+    hvrlen2 = sizeof(hvr2);
+    CHECK(coap_dtls_cookie_check(&dtls, (struct sockaddr *)&addr, sizeof(addr), again, n,
+                                 hvr2, &hvrlen2) == COAP_SUCCESS);
+    CHECK(hvrlen2 == 0);
+    hvrlen2 = sizeof(hvr2);
+    CHECK(coap_dtls_cookie_check(&dtls, (struct sockaddr *)&other, sizeof(other), again, n,
+                                 hvr2, &hvrlen2) == COAP_SUCCESS);
+    CHECK(hvrlen2 == COAP_DTLS_HVR_SIZE);
+    again[n - 1] ^= 1;  // other parameters
+    hvrlen2 = sizeof(hvr2);
+    CHECK(coap_dtls_cookie_check(&dtls, (struct sockaddr *)&addr, sizeof(addr), again, n,
+                                 hvr2, &hvrlen2) == COAP_SUCCESS);
+    CHECK(hvrlen2 == COAP_DTLS_HVR_SIZE);
+    again[n - 1] ^= 1;
+
+    // cookies of the previous secret stay valid for one rotation
+    const uint32_t now = _now_ms();
+    coap_dtls_process(&dtls, now);
+    hvrlen = sizeof(hvr);
+    coap_dtls_cookie_check(&dtls, (struct sockaddr *)&addr, sizeof(addr), hello, len, hvr, &hvrlen);
+    _with_cookie(again, hello, len, hvr);
+    coap_dtls_process(&dtls, now + COAP_DTLS_COOKIE_ROTATE_MS);
+    hvrlen2 = sizeof(hvr2);
+    coap_dtls_cookie_check(&dtls, (struct sockaddr *)&addr, sizeof(addr), again, n, hvr2, &hvrlen2);
+    CHECK(hvrlen2 == 0);
+    coap_dtls_process(&dtls, now + 2 * COAP_DTLS_COOKIE_ROTATE_MS);
+    hvrlen2 = sizeof(hvr2);
+    coap_dtls_cookie_check(&dtls, (struct sockaddr *)&addr, sizeof(addr), again, n, hvr2, &hvrlen2);
+    CHECK(hvrlen2 == COAP_DTLS_HVR_SIZE);
+
+    // fragments and truncated ClientHellos are not answered
+    hvrlen2 = sizeof(hvr2);
+    CHECK(coap_dtls_cookie_check(&dtls, (struct sockaddr *)&addr, sizeof(addr), hello, 40,
+                                 hvr2, &hvrlen2) == COAP_ERR_PAYLOAD_INVALID);
+    memcpy(again, hello, len);
+    again[24] ^= 1;
+    CHECK(coap_dtls_cookie_check(&dtls, (struct sockaddr *)&addr, sizeof(addr), again, len,
+                                 hvr2, &hvrlen2) == COAP_ERR_PAYLOAD_INVALID);
+
+    // a flood from many ports gets HelloVerifyRequests and no sessions
+    client_t flood[CLIENTS];
+    for (size_t i = 0; i < CLIENTS; ++i) {
+        CHECK(_open(&flood[i], "yacoap", NULL));
+        for (int j = 0; j < 10; ++j) {
+            CHECK(send(flood[i].fd, hello, len, 0) == (ssize_t)len);
+        }
+        _pump(0);
+    }
+    for (int i = 0; (i < 100) && (dtls.hello_verifies < 10 * CLIENTS); ++i) {
+        _pump(1);
+    }
+    CHECK(dtls.hello_verifies == 10 * CLIENTS);
+    CHECK(_sessions() == 0);
+    // the cookie of another address does not get one either
+    CHECK(send(flood[0].fd, again, n, 0) == (ssize_t)n);
+    _pump(10);
+    CHECK(_sessions() == 0);
+    // with the cookie the ClientHello is answered, the handshake completes
+    while (recv(flood[1].fd, again, sizeof(again), 0) > 0) {
+    }
+    CHECK(_handshake(&flood[1]));
+    CHECK(_get_hello(&flood[1], 1));
+    CHECK(_sessions() == 1);
+    for (size_t i = 0; i < CLIENTS; ++i) {
+        _close(&flood[i], false);
+    }
+    printf("cookies: %u HelloVerifyRequests, %zu sessions\n", dtls.hello_verifies, _sessions());
+    _server_free();
+}
+
+static void _test_acl(void)
+{
+    client_t c;
+
+    server_acl = true;
+    CHECK(_policy("principal user psk yacoap\nallow user GET /hello\n"));
+    if (!_server(0, 0)) {
+        failures++;
+        return;
+    }
+    CHECK(_open(&c, "yacoap", NULL));
+    CHECK(_handshake(&c));
+    CHECK(_code(&c, COAP_METHOD_GET, "hello", 1) == COAP_RSPCODE_CONTENT);
+    CHECK(_code(&c, COAP_METHOD_PUT, "echo", 2) == COAP_RSPCODE_FORBIDDEN);
+    // the session is mapped again with the new policy, yacoap is not named
+    CHECK(_policy("allow * PUT /echo\n"));
+    CHECK(_code(&c, COAP_METHOD_GET, "hello", 3) == COAP_RSPCODE_UNAUTHORIZED);
+    CHECK(_code(&c, COAP_METHOD_PUT, "echo", 4) == COAP_RSPCODE_CHANGED);
+    CHECK(dtls.records == 4);
+    _close(&c, true);
+    _server_free();
+    coap_acl_free(coap_acl_swap(&acl, NULL));
+    server_acl = false;
+}
+
+static void _test_workers(void)
+{
+    size_t done = 0, ok = 0;
+
+    if (!_server(4, 0)) {
+        failures++;
+        return;
+    }
+    const uint32_t start = _now_ms();
+    for (size_t i = 0; i < CLIENTS; ++i) {
+        CHECK(_open(&clients[i], "yacoap", NULL));
+    }
+    // all handshakes at the same time
+    int state[CLIENTS] = { 0 };
+    while ((done < CLIENTS) && (_now_ms() - start < WAIT_MS)) {
+        for (size_t i = 0; i < CLIENTS; ++i) {
+            if (!state[i] && (state[i] = _step(&clients[i]))) {
+                done++;
+            }
+        }
+        _pump(1);
+    }
+    for (size_t i = 0; i < CLIENTS; ++i) {
+        CHECK(state[i] == 1);
+    }
+    const uint32_t handshaken = _now_ms();
+    for (size_t r = 0; r < ROUNDS; ++r) {
+        for (size_t i = 0; i < CLIENTS; ++i) {
+            ok += _get_hello(&clients[i], (uint16_t)(r * CLIENTS + i));
+        }
+    }
+    CHECK(ok == CLIENTS * ROUNDS);
+    CHECK((dtls.handshakes == CLIENTS) && (dtls.records == CLIENTS * ROUNDS));
+    CHECK(!dtls.failures && !dtls.drops);
+    for (size_t i = 0; i < CLIENTS; ++i) {
+        _close(&clients[i], true);
+    }
+    for (int i = 0; (i < 100) && _sessions(); ++i) {
+        _pump(1);
+    }
+    CHECK(!_sessions());
+    printf("workers: %d handshakes in %u ms, %zu requests in %u ms\n",
+           CLIENTS, handshaken - start, ok, _now_ms() - handshaken);
+    _server_free();
+}
+
+/* --- MAIN ----------------------------------------------------------------- */
+int main(void)
+{
+    ctx = SSL_CTX_new(DTLS_client_method());
+    if (!ctx) {
+        return 1;
+    }
+    SSL_CTX_set_min_proto_version(ctx, DTLS1_2_VERSION);
+    SSL_CTX_set_options(ctx, SSL_OP_NO_QUERY_MTU);
+    SSL_CTX_set_cipher_list(ctx, "PSK-AES128-CCM8");
+    SSL_CTX_set_psk_client_callback(ctx, client_psk);
+
+    _test_config();
+    _test_inline();
+    _test_cookies();
+    _test_acl();
+    _test_workers();
+
+    SSL_CTX_free(ctx);
+    printf("%s\n", failures ? "FAILED" : "PASSED");
+    return failures ? 1 : 0;
+}
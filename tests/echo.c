@@ -0,0 +1,349 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include "coap.h"
+#include "coap_echo.h"
+#include "coap_sha256.h"
+
+/*
+ * Tests the Echo option: SHA-256 and HMAC-SHA256 against the test vectors of
+ * FIPS 180-2 and RFC 4231 on the SHA extensions and the portable code,
+ * values bound to the address and the lifetime, tampered values, and the
+ * amplification limit of a server: a large response to an unverified client
+ * becomes a 4.01 with Echo, the request with that value gets the full
+ * response, small responses always pass. Unsafe requests from a client
+ * without a value are challenged before the handler runs, and run once.
+ * Exits non-zero if any check fails.
+ */
+
+#define NOW 1000000u
+
+static int failures;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+static const uint8_t key[16] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16 };
+static const uint8_t tok[2] = { 0xbe, 0xef };
+static uint8_t large[512];
+static unsigned handled;
+
+/* --- HELPERS -------------------------------------------------------------- */
+static size_t _hex(const char *hex, uint8_t *out)
+{
+    size_t n = 0;
+    for (; hex[0] && hex[1]; hex += 2) {
+        unsigned v;
+        sscanf(hex, "%2x", &v);
+        out[n++] = (uint8_t)v;
+    }
+    return n;
+}
+
+static struct sockaddr_in _v4(const char *ip, const uint16_t port)
+{
+    struct sockaddr_in a;
+    memset(&a, 0, sizeof(a));
+    a.sin_family = AF_INET;
+    a.sin_port = htons(port);
+    inet_pton(AF_INET, ip, &a.sin_addr);
+    return a;
+}
+
+static struct sockaddr_in6 _v6(const char *ip, const uint16_t port)
+{
+    struct sockaddr_in6 a;
+    memset(&a, 0, sizeof(a));
+    a.sin6_family = AF_INET6;
+    a.sin6_port = htons(port);
+    inet_pton(AF_INET6, ip, &a.sin6_addr);
+    return a;
+}
+
+/* a request, with an Echo value if \p value is not NULL */
+static void _request_method(coap_packet_t *pkt, const coap_method_t method,
+                            const coap_msgtype_t type, const uint8_t *value, const size_t len)
+{
+    memset(pkt, 0, sizeof(*pkt));
+    pkt->hdr.ver = 1;
+    pkt->hdr.t = type;
+    pkt->hdr.tkl = sizeof(tok);
+    pkt->hdr.code = method;
+    pkt->hdr.id = 0x4711;
+    pkt->tok = (coap_buffer_t){ tok, sizeof(tok) };
+    coap_add_option(pkt, COAP_OPTION_URI_PATH, (const uint8_t *)"large", 5);
+    if (value) {
+        coap_add_option(pkt, COAP_OPTION_ECHO, value, len);
+    }
+}
+
+/* a GET, with an Echo value if \p value is not NULL */
+static void _request(coap_packet_t *pkt, const coap_msgtype_t type, const uint8_t *value,
+                     const size_t len)
+{
+    _request_method(pkt, COAP_METHOD_GET, type, value, len);
+}
+
+/* what a server loop does with a request for a response of \p rsplen bytes */
+static coap_state_t _serve(coap_echo_t *echo, const coap_packet_t *req,
+                           const struct sockaddr *addr, const socklen_t addrlen,
+                           const size_t rsplen, uint32_t now, uint8_t *rsp, size_t *len)
+{
+    uint8_t reqbuf[128], value[COAP_ECHO_SIZE];
+    size_t reqlen = sizeof(reqbuf);
+    coap_packet_t in, out;
+
+    if ((coap_build(req, reqbuf, &reqlen) != COAP_SUCCESS) ||
+        (coap_parse(reqbuf, reqlen, &in) != COAP_SUCCESS)) {
+        return COAP_ERR;
+    }
+    const bool proven = coap_echo_verify(echo, &in, addr, addrlen, now) == COAP_SUCCESS;
+    // unsafe, challenged before the handler
+    if (proven || coap_echo_safe(&in)) {
+        handled++;
+        coap_make_response(in.hdr.id, &in.tok, COAP_TYPE_ACK, COAP_RSPCODE_CONTENT,
+                           NULL, large, rsplen, &out);
+        if (coap_build(&out, rsp, len) != COAP_SUCCESS) {
+            return COAP_ERR;
+        }
+        if (proven || !coap_echo_amplifies(reqlen, *len)) {
+            return COAP_RSP_SEND;
+        }
+    }
+    if (coap_echo_challenge(echo, &in, addr, addrlen, now, value, &out) != COAP_RSP_SEND) {
+        return COAP_ERR;
+    }
+    *len = 1152;
+    if (coap_build(&out, rsp, len) != COAP_SUCCESS) {
+        return COAP_ERR;
+    }
+    return COAP_RSP_WAIT;
+}
+
+/* --- TESTS ---------------------------------------------------------------- */
+static void _test_sha256(const bool shani)
+{
+    static uint8_t million[1000000];
+    uint8_t out[COAP_SHA256_SIZE], expect[COAP_SHA256_SIZE], data[200];
+    coap_sha256_t s;
+    coap_hmac_sha256_t mac;
+
+    coap_sha256_init(&s);
+    s.shani &= shani;
+    coap_sha256_update(&s, (const uint8_t *)"abc", 3);
+    coap_sha256_final(&s, out);
+    _hex("ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad", expect);
+    CHECK(!memcmp(out, expect, sizeof(out)));
+    // two blocks, fed in pieces
+    static const char *two = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+    coap_sha256_init(&s);
+    s.shani &= shani;
+    for (size_t i = 0; i < strlen(two); i += 5) {
+        coap_sha256_update(&s, (const uint8_t *)two + i, (strlen(two) - i < 5) ? strlen(two) - i : 5);
+    }
+    coap_sha256_final(&s, out);
+    _hex("248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1", expect);
+    CHECK(!memcmp(out, expect, sizeof(out)));
+    memset(million, 'a', sizeof(million));
+    coap_sha256_init(&s);
+    s.shani &= shani;
+    coap_sha256_update(&s, million, sizeof(million));
+    coap_sha256_final(&s, out);
+    _hex("cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0", expect);
+    CHECK(!memcmp(out, expect, sizeof(out)));
+    // RFC 4231 test case 2, a short key
+    coap_hmac_sha256_init(&mac, (const uint8_t *)"Jefe", 4);
+    mac.inner.shani &= shani;
+    mac.outer.shani &= shani;
+    coap_hmac_sha256(&mac, (const uint8_t *)"what do ya want for nothing?", 28, out);
+    _hex("5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843", expect);
+    CHECK(!memcmp(out, expect, sizeof(out)));
+    // RFC 4231 test case 6, a key longer than a block is hashed first
+    memset(data, 0xaa, 131);
+    coap_hmac_sha256_init(&mac, data, 131);
+    mac.inner.shani &= shani;
+    mac.outer.shani &= shani;
+    coap_hmac_sha256(&mac, (const uint8_t *)"Test Using Larger Than Block-Size Key - Hash Key First", 54, out);
+    _hex("60e431591ee0b67f0d8a26aacbf5b77f8e0bc6213728c5140546040f0ee37f54", expect);
+    CHECK(!memcmp(out, expect, sizeof(out)));
+    // the prepared key is not changed by a MAC
+    coap_hmac_sha256(&mac, (const uint8_t *)"Test Using Larger Than Block-Size Key - Hash Key First", 54, out);
+    CHECK(!memcmp(out, expect, sizeof(out)));
+}
+
+static void _test_verify(void)
+{
+    const struct sockaddr_in a = _v4("192.0.2.1", 5683), a2 = _v4("192.0.2.1", 40000);
+    const struct sockaddr_in b = _v4("192.0.2.2", 5683);
+    const struct sockaddr_in6 c = _v6("2001:db8::1", 5683), m = _v6("::ffff:192.0.2.1", 1);
+    uint8_t value[COAP_ECHO_SIZE], other[COAP_ECHO_SIZE], buf[128];
+    coap_echo_t echo, echo2;
+    coap_packet_t pkt, in;
+    size_t len;
+
+    CHECK(coap_echo_init(&echo, key, 15, 0) == COAP_ERR_SECURITY_CONTEXT);
+    CHECK(coap_echo_init(&echo, key, sizeof(key), 0) == COAP_SUCCESS);
+    CHECK(echo.lifetime_s == COAP_ECHO_LIFETIME);
+    _request(&pkt, COAP_TYPE_CON, NULL, 0);
+    CHECK(coap_echo_verify(&echo, &pkt, (struct sockaddr *)&a, sizeof(a), NOW) == COAP_ERR_OPTION_NOT_FOUND);
+
+    // valid through a parsed datagram, for any port of the address
+    coap_echo_make(&echo, (struct sockaddr *)&a, sizeof(a), NOW, value);
+    _request(&pkt, COAP_TYPE_CON, value, sizeof(value));
+    len = sizeof(buf);
+    CHECK(coap_build(&pkt, buf, &len) == COAP_SUCCESS);
+    CHECK(coap_parse(buf, len, &in) == COAP_SUCCESS);
+    CHECK(coap_echo_verify(&echo, &in, (struct sockaddr *)&a, sizeof(a), NOW) == COAP_SUCCESS);
+    CHECK(coap_echo_verify(&echo, &in, (struct sockaddr *)&a2, sizeof(a2), NOW + 1) == COAP_SUCCESS);
+    CHECK(coap_echo_verify(&echo, &in, (struct sockaddr *)&m, sizeof(m), NOW) == COAP_SUCCESS);
+    CHECK(coap_echo_verify(&echo, &in, (struct sockaddr *)&b, sizeof(b), NOW) == COAP_ERR_SECURITY_CONTEXT);
+    CHECK(coap_echo_verify(&echo, &in, (struct sockaddr *)&c, sizeof(c), NOW) == COAP_ERR_SECURITY_CONTEXT);
+    // lifetime, and values from the future
+    CHECK(coap_echo_verify(&echo, &in, (struct sockaddr *)&a, sizeof(a), NOW + COAP_ECHO_LIFETIME) == COAP_SUCCESS);
+    CHECK(coap_echo_verify(&echo, &in, (struct sockaddr *)&a, sizeof(a), NOW + COAP_ECHO_LIFETIME + 1) == COAP_ERR_TIMEOUT);
+    CHECK(coap_echo_verify(&echo, &in, (struct sockaddr *)&a, sizeof(a), NOW - 1) == COAP_ERR_TIMEOUT);
+    CHECK(echo.verified == 4);
+    CHECK(echo.rejected == 4);
+    // across the wrap of the clock
+    coap_echo_make(&echo, (struct sockaddr *)&a, sizeof(a), UINT32_MAX - 5, other);
+    _request(&pkt, COAP_TYPE_CON, other, sizeof(other));
+    CHECK(coap_echo_verify(&echo, &pkt, (struct sockaddr *)&a, sizeof(a), 10) == COAP_SUCCESS);
+    // IPv6
+    coap_echo_make(&echo, (struct sockaddr *)&c, sizeof(c), NOW, other);
+    _request(&pkt, COAP_TYPE_CON, other, sizeof(other));
+    CHECK(coap_echo_verify(&echo, &pkt, (struct sockaddr *)&c, sizeof(c), NOW) == COAP_SUCCESS);
+    CHECK(coap_echo_verify(&echo, &pkt, (struct sockaddr *)&a, sizeof(a), NOW) == COAP_ERR_SECURITY_CONTEXT);
+    // another key
+    CHECK(coap_echo_init(&echo2, large, 32, 60) == COAP_SUCCESS);
+    _request(&pkt, COAP_TYPE_CON, value, sizeof(value));
+    CHECK(coap_echo_verify(&echo2, &pkt, (struct sockaddr *)&a, sizeof(a), NOW) == COAP_ERR_SECURITY_CONTEXT);
+    // every byte counts, the length and the number of options too
+    for (size_t i = 0; i < sizeof(value); ++i) {
+        memcpy(other, value, sizeof(other));
+        other[i] ^= (i < 4) ? 0x01 : 0x80;
+        _request(&pkt, COAP_TYPE_CON, other, sizeof(other));
+        CHECK(coap_echo_verify(&echo, &pkt, (struct sockaddr *)&a, sizeof(a), NOW) != COAP_SUCCESS);
+    }
+    _request(&pkt, COAP_TYPE_CON, value, sizeof(value) - 1);
+    CHECK(coap_echo_verify(&echo, &pkt, (struct sockaddr *)&a, sizeof(a), NOW) == COAP_ERR_SECURITY_CONTEXT);
+    _request(&pkt, COAP_TYPE_CON, value, sizeof(value));
+    coap_add_option(&pkt, COAP_OPTION_ECHO, value, sizeof(value));
+    CHECK(coap_echo_verify(&echo, &pkt, (struct sockaddr *)&a, sizeof(a), NOW) == COAP_ERR_SECURITY_CONTEXT);
+}
+
+static void _test_amplification(void)
+{
+    const struct sockaddr_in a = _v4("198.51.100.7", 5683), b = _v4("198.51.100.8", 5683);
+    uint8_t rsp[1152];
+    size_t len = sizeof(rsp);
+    coap_echo_t echo;
+    coap_packet_t req, out;
+    uint8_t count;
+
+    CHECK(coap_echo_init(&echo, key, sizeof(key), 0) == COAP_SUCCESS);
+    // small responses need no Echo
+    _request(&req, COAP_TYPE_CON, NULL, 0);
+    CHECK(_serve(&echo, &req, (struct sockaddr *)&a, sizeof(a), 10, NOW, rsp, &len) == COAP_RSP_SEND);
+    CHECK(echo.challenges == 0);
+
+    // a large one is replaced by a 4.01 with Echo, small enough itself
+    len = sizeof(rsp);
+    CHECK(_serve(&echo, &req, (struct sockaddr *)&a, sizeof(a), sizeof(large), NOW, rsp, &len) == COAP_RSP_WAIT);
+    CHECK(len <= COAP_ECHO_AMPLIFICATION * 12);
+    CHECK(coap_parse(rsp, len, &out) == COAP_SUCCESS);
+    CHECK(out.hdr.code == COAP_RSPCODE_UNAUTHORIZED);
+    CHECK(out.hdr.t == COAP_TYPE_ACK);
+    CHECK(out.hdr.id == 0x4711);
+    CHECK((out.tok.len == sizeof(tok)) && !memcmp(out.tok.p, tok, sizeof(tok)));
+    CHECK(!out.payload.len);
+    const coap_option_t *opt = coap_find_options(&out, COAP_OPTION_ECHO, &count);
+    CHECK(opt && (count == 1) && (opt->buf.len == COAP_ECHO_SIZE));
+    CHECK(echo.challenges == 1);
+    if (!opt) {
+        return;
+    }
+
+    // the request again with the value gets the full response, later too
+    uint8_t value[COAP_ECHO_SIZE];
+    memcpy(value, opt->buf.p, sizeof(value));
+    _request(&req, COAP_TYPE_CON, value, sizeof(value));
+    len = sizeof(rsp);
+    CHECK(_serve(&echo, &req, (struct sockaddr *)&a, sizeof(a), sizeof(large), NOW + 1, rsp, &len) == COAP_RSP_SEND);
+    CHECK(len > sizeof(large));
+    len = sizeof(rsp);
+    CHECK(_serve(&echo, &req, (struct sockaddr *)&a, sizeof(a), sizeof(large), NOW + 60, rsp, &len) == COAP_RSP_SEND);
+    // not from another address, nor once it has expired
+    len = sizeof(rsp);
+    CHECK(_serve(&echo, &req, (struct sockaddr *)&b, sizeof(b), sizeof(large), NOW + 1, rsp, &len) == COAP_RSP_WAIT);
+    len = sizeof(rsp);
+    CHECK(_serve(&echo, &req, (struct sockaddr *)&a, sizeof(a), sizeof(large),
+                 NOW + COAP_ECHO_LIFETIME + 1, rsp, &len) == COAP_RSP_WAIT);
+    CHECK(echo.challenges == 3);
+
+    // non-confirmable requests get a non-confirmable challenge
+    _request(&req, COAP_TYPE_NONCON, NULL, 0);
+    len = sizeof(rsp);
+    CHECK(_serve(&echo, &req, (struct sockaddr *)&a, sizeof(a), sizeof(large), NOW, rsp, &len) == COAP_RSP_WAIT);
+    CHECK((coap_parse(rsp, len, &out) == COAP_SUCCESS) && (out.hdr.t == COAP_TYPE_NONCON));
+    CHECK(coap_echo_amplifies(10, 30) == false);
+    CHECK(coap_echo_amplifies(10, 31) == true);
+}
+
+static void _test_unsafe(void)
+{
+    const struct sockaddr_in a = _v4("198.51.100.7", 5683);
+    uint8_t rsp[1152];
+    size_t len = sizeof(rsp);
+    coap_echo_t echo;
+    coap_packet_t req, out;
+    uint8_t count;
+
+    CHECK(coap_echo_init(&echo, key, sizeof(key), 0) == COAP_SUCCESS);
+    // a POST is challenged before its handler runs, small response or not
+    handled = 0;
+    _request_method(&req, COAP_METHOD_POST, COAP_TYPE_CON, NULL, 0);
+    CHECK(!coap_echo_safe(&req));
+    CHECK(_serve(&echo, &req, (struct sockaddr *)&a, sizeof(a), 1, NOW, rsp, &len) == COAP_RSP_WAIT);
+    CHECK(handled == 0);
+    CHECK((coap_parse(rsp, len, &out) == COAP_SUCCESS) && (out.hdr.code == COAP_RSPCODE_UNAUTHORIZED));
+    const coap_option_t *opt = coap_find_options(&out, COAP_OPTION_ECHO, &count);
+    CHECK(opt && (count == 1));
+    if (!opt) {
+        return;
+    }
+
+    // the retry with the value runs it once, even with a large response
+    uint8_t value[COAP_ECHO_SIZE];
+    memcpy(value, opt->buf.p, sizeof(value));
+    _request_method(&req, COAP_METHOD_POST, COAP_TYPE_CON, value, sizeof(value));
+    len = sizeof(rsp);
+    CHECK(_serve(&echo, &req, (struct sockaddr *)&a, sizeof(a), sizeof(large), NOW + 1, rsp, &len) == COAP_RSP_SEND);
+    CHECK((handled == 1) && (len > sizeof(large)));
+    for (coap_method_t m = COAP_METHOD_PUT; m <= COAP_METHOD_DELETE; ++m) {
+        _request_method(&req, m, COAP_TYPE_NONCON, NULL, 0);
+        len = sizeof(rsp);
+        CHECK(_serve(&echo, &req, (struct sockaddr *)&a, sizeof(a), 1, NOW, rsp, &len) == COAP_RSP_WAIT);
+    }
+    CHECK((handled == 1) && (echo.challenges == 3));
+}
+
+/* --- MAIN ----------------------------------------------------------------- */
+int main(void)
+{
+    memset(large, 'x', sizeof(large));
+    _test_sha256(true);
+    _test_sha256(false);
+    _test_verify();
+    _test_amplification();
+    _test_unsafe();
+    printf("%s\n", failures ? "FAILED" : "PASSED");
+    return failures ? 1 : 0;
+}
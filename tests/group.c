@@ -0,0 +1,273 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "coap.h"
+#include "coap_client.h"
+#include "coap_mcast.h"
+
+/*
+ * Tests group requests of the client: a GET sent to 224.0.1.187 over
+ * loopback, read by a server socket that joined the group, and answered by
+ * 10,000 endpoints, each bound to an address of its own in 127.0.0.0/8 and
+ * some responding twice. All distinct endpoints must be passed on once, in
+ * batches, duplicates counted, and the last callback made at the end of the
+ * window; then a group of fewer members than responders drops the rest,
+ * and confirmable responses are acknowledged. Skipped if the host has no
+ * multicast route over loopback. Exits non-zero if any check fails.
+ */
+
+#define PORT        5690
+#define RESPONDERS  10000
+#define DUPLICATE   10      // every tenth endpoint responds twice
+#define WINDOW_MS   1500
+#define WAIT_MS     5000
+
+static int failures;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+typedef struct
+{
+    size_t responses;
+    size_t calls;
+    size_t largest;
+    size_t done;
+    size_t bad;
+    uint32_t done_at;
+    uint8_t seen[RESPONDERS];
+} result_t;
+
+/* --- HELPERS -------------------------------------------------------------- */
+static uint32_t _now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+static void _collect(void *arg, const coap_client_response_t *rsps, const size_t n,
+                     const bool done)
+{
+    result_t *r = arg;
+
+    r->calls++;
+    r->largest = (n > r->largest) ? n : r->largest;
+    for (size_t i = 0; i < n; ++i) {
+        unsigned id = 0;
+        for (size_t j = 0; j < rsps[i].pkt.payload.len; ++j) {
+            id = id * 10 + (rsps[i].pkt.payload.p[j] - '0');
+        }
+        if ((rsps[i].pkt.hdr.code != COAP_RSPCODE_CONTENT) || (id >= RESPONDERS) ||
+            r->seen[id]++) {
+            r->bad++;
+        }
+        r->responses++;
+    }
+    if (done) {
+        r->done++;
+        r->done_at = _now_ms();
+    }
+}
+
+/* server socket in the All CoAP Nodes group on loopback */
+static int _server(void)
+{
+    struct sockaddr_in sin = { .sin_family = AF_INET, .sin_port = htons(PORT) };
+    const int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    const struct timeval tv = { 1, 0 };
+
+    if ((fd < 0) || bind(fd, (struct sockaddr *)&sin, sizeof(sin)) ||
+        (coap_mcast_join(fd, if_nametoindex("lo"), COAP_MCAST_SCOPE_LINK) != COAP_SUCCESS)) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    return fd;
+}
+
+static coap_state_t _group_get(coap_client_t *client, coap_client_group_t *group,
+                               result_t *r)
+{
+    struct sockaddr_in sin = { .sin_family = AF_INET, .sin_port = htons(PORT) };
+    coap_packet_t pkt;
+
+    inet_pton(AF_INET, COAP_MCAST_IPV4, &sin.sin_addr);
+    memset(&pkt, 0, sizeof(pkt));
+    pkt.hdr.ver = 1;
+    pkt.hdr.t = COAP_TYPE_NONCON;
+    pkt.hdr.code = COAP_METHOD_GET;
+    coap_add_option(&pkt, COAP_OPTION_URI_PATH, (const uint8_t *)"sensors", 7);
+    return coap_client_group_send(client, group, &pkt, (struct sockaddr *)&sin, sizeof(sin),
+                                  _now_ms(), WINDOW_MS, _collect, r);
+}
+
+/* the group request as the servers see it, token and client port */
+static bool _request(const int server, uint8_t tok[COAP_CLIENT_TOKLEN], uint16_t *port)
+{
+    uint8_t buf[256];
+    struct sockaddr_in6 from;
+    socklen_t fromlen = sizeof(from);
+    coap_packet_t pkt;
+
+    const ssize_t n = recvfrom(server, buf, sizeof(buf), 0, (struct sockaddr *)&from, &fromlen);
+    if ((n <= 0) || (coap_parse(buf, (size_t)n, &pkt) != COAP_SUCCESS) ||
+        (pkt.hdr.t != COAP_TYPE_NONCON) || (pkt.tok.len != COAP_CLIENT_TOKLEN)) {
+        return false;
+    }
+    memcpy(tok, pkt.tok.p, COAP_CLIENT_TOKLEN);
+    *port = ((struct sockaddr_in *)&from)->sin_port;
+    return true;
+}
+
+/* a response of endpoint \p id from 127.1.x.y, returns its socket */
+static int _respond(const unsigned id, const uint8_t type, const uint8_t *tok,
+                    const uint16_t port, const int copies)
+{
+    struct sockaddr_in src = { .sin_family = AF_INET };
+    struct sockaddr_in dst = { .sin_family = AF_INET, .sin_port = port };
+    uint8_t buf[32] = {
+        0x40 | (type << 4) | COAP_CLIENT_TOKLEN, COAP_RSPCODE_CONTENT,
+        (uint8_t)(id >> 8), (uint8_t)id
+    };
+    const int fd = socket(AF_INET, SOCK_DGRAM, 0);
+
+    src.sin_addr.s_addr = htonl(0x7f010000 | ((id / 250) << 8) | (id % 250 + 1));
+    dst.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if ((fd < 0) || bind(fd, (struct sockaddr *)&src, sizeof(src))) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    memcpy(&buf[4], tok, COAP_CLIENT_TOKLEN);
+    size_t len = 4 + COAP_CLIENT_TOKLEN;
+    buf[len++] = 0xff;
+    len += (size_t)snprintf((char *)&buf[len], sizeof(buf) - len, "%u", id);
+    for (int i = 0; i < copies; ++i) {
+        sendto(fd, buf, len, 0, (struct sockaddr *)&dst, sizeof(dst));
+    }
+    return fd;
+}
+
+static void _pump(coap_client_t *client, const result_t *r)
+{
+    const uint32_t start = _now_ms();
+    while (!r->done && (_now_ms() - start < WAIT_MS)) {
+        coap_client_process(client, _now_ms());
+        usleep(1000);
+    }
+}
+
+/* --- TESTS ---------------------------------------------------------------- */
+static void _test_thousands(coap_client_t *client, const int server)
+{
+    static result_t r;
+    coap_client_group_t group;
+    uint8_t tok[COAP_CLIENT_TOKLEN];
+    uint16_t port;
+
+    CHECK(coap_client_group_init(&group, RESPONDERS) == COAP_SUCCESS);
+    const uint32_t start = _now_ms();
+    CHECK(_group_get(client, &group, &r) == COAP_SUCCESS);
+    CHECK(_group_get(client, &group, &r) == COAP_ERR_BUFFER_TOO_SMALL);
+    CHECK(_request(server, tok, &port));
+    for (unsigned id = 0; id < RESPONDERS; ++id) {
+        const int fd = _respond(id, COAP_TYPE_NONCON, tok, port, (id % DUPLICATE) ? 1 : 2);
+        CHECK(fd >= 0);
+        close(fd);
+        // a client would be polling meanwhile
+        if (!(id % 500)) {
+            coap_client_process(client, _now_ms());
+        }
+    }
+    const uint32_t sent = _now_ms();
+    _pump(client, &r);
+    CHECK(r.responses == RESPONDERS);
+    CHECK(r.bad == 0);
+    CHECK(group.duplicates == RESPONDERS / DUPLICATE);
+    CHECK(group.dropped == 0);
+    CHECK(r.largest <= COAP_CLIENT_GROUP_BATCH);
+    CHECK(r.calls == group.batches);
+    CHECK(r.done == 1);
+    CHECK(r.done_at - start >= WINDOW_MS);
+    CHECK(!group.active);
+    printf("%u responses: %u duplicates, %u dropped, %u callbacks, sent in %u ms\n",
+           (unsigned)r.responses, group.duplicates, group.dropped, group.batches,
+           sent - start);
+    coap_client_group_free(&group);
+}
+
+static void _test_members(coap_client_t *client, const int server)
+{
+    static result_t r;
+    coap_client_group_t group;
+    uint8_t tok[COAP_CLIENT_TOKLEN];
+    uint16_t port;
+    uint8_t ack[64];
+
+    CHECK(coap_client_group_init(&group, 100) == COAP_SUCCESS);
+    CHECK(_group_get(client, &group, &r) == COAP_SUCCESS);
+    CHECK(_request(server, tok, &port));
+    // a confirmable response is acknowledged
+    const int fd = _respond(0, COAP_TYPE_CON, tok, port, 1);
+    const struct timeval tv = { 1, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    for (unsigned id = 1; id < 300; ++id) {
+        close(_respond(id, COAP_TYPE_NONCON, tok, port, 1));
+    }
+    coap_client_process(client, _now_ms());
+    const ssize_t n = recv(fd, ack, sizeof(ack), 0);
+    CHECK((n == 4) && ((ack[0] >> 4 & 0x03) == COAP_TYPE_ACK) && !ack[1] && !ack[2] && !ack[3]);
+    close(fd);
+    _pump(client, &r);
+    CHECK(r.responses == 100);
+    CHECK(group.dropped == 200);
+    CHECK(r.done == 1);
+    // cancelled, nothing is called back
+    memset(&r, 0, sizeof(r));
+    CHECK(_group_get(client, &group, &r) == COAP_SUCCESS);
+    CHECK(_request(server, tok, &port));
+    coap_client_group_cancel(client, &group);
+    close(_respond(1, COAP_TYPE_NONCON, tok, port, 1));
+    usleep(10000);
+    coap_client_process(client, _now_ms() + WINDOW_MS);
+    CHECK(!r.calls && !group.active);
+    coap_client_group_free(&group);
+}
+
+/* --- MAIN ----------------------------------------------------------------- */
+int main(void)
+{
+    coap_client_t client;
+    const int server = _server();
+    const struct ip_mreqn mreq = { .imr_ifindex = (int)if_nametoindex("lo") };
+
+    if (server < 0) {
+        printf("group requests: skipped, no multicast over loopback\n");
+        printf("PASSED\n");
+        return 0;
+    }
+    CHECK(coap_client_init(&client, (uint32_t)getpid()) == COAP_SUCCESS);
+    setsockopt(client.fd, IPPROTO_IP, IP_MULTICAST_IF, &mreq, sizeof(mreq));
+    _test_thousands(&client, server);
+    _test_members(&client, server);
+    coap_client_close(&client);
+    close(server);
+    printf("%s\n", failures ? "FAILED" : "PASSED");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,545 @@
+#include <errno.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "coap.h"
+#include "coap_client.h"
+#include "coap_gw.h"
+
+/*
+ * Tests the HTTP-to-CoAP gateway against a stand-in CoAP server on loopback.
+ * Gateway, client, server and the HTTP viewers all run in one poll loop of
+ * this process. Checks that many viewers of one resource cause one CoAP
+ * request and are answered from the cache afterwards, that many event
+ * streams share one observation, which is reset once all are closed, and the
+ * mapping of block wise bodies, errors and bad requests. Exits non-zero if any
+ * check fails.
+ */
+
+#define VIEWERS         200
+#define STREAMS         50
+#define MAX_HELD        8
+#define BIG_LEN         3000    //!< body of /big, three blocks
+#define WAIT_MS         3000
+
+typedef struct viewer
+{
+    int fd;
+    size_t len;
+    char buf[8192];
+} viewer_t;
+
+typedef struct held
+{
+    size_t len;
+    uint8_t buf[512];
+    struct sockaddr_storage from;
+    socklen_t fromlen;
+} held_t;
+
+static struct
+{
+    int fd;
+    uint16_t port;
+    bool hold;                  //!< keep requests for /temp unanswered
+    size_t nheld;
+    held_t held[MAX_HELD];
+    uint32_t requests[4];       //!< temp, big, obs, others
+    uint32_t resets;
+    bool observed;
+    uint8_t obs_tok[8];
+    size_t obs_toklen;
+    struct sockaddr_storage obs_addr;
+    socklen_t obs_addrlen;
+    uint32_t obs_seq;
+    uint16_t msgid;
+} srv;
+
+static coap_client_t client;
+static coap_gw_t gw;
+static uint16_t gw_port;
+static viewer_t viewers[VIEWERS];
+static uint8_t big[BIG_LEN];
+static int failures;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+/* --- PRIVATE -------------------------------------------------------------- */
+static uint32_t _now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+static bool _path_is(const coap_packet_t *pkt, const char *path)
+{
+    uint8_t count;
+    const coap_option_t *opt = coap_find_options(pkt, COAP_OPTION_URI_PATH, &count);
+    return opt && (count == 1) && (opt->buf.len == strlen(path)) &&
+           !memcmp(opt->buf.p, path, opt->buf.len);
+}
+
+static void _server_send(coap_packet_t *rsp, const struct sockaddr_storage *to,
+                         const socklen_t tolen)
+{
+    uint8_t buf[1500];
+    size_t len = sizeof(buf);
+    if (coap_build(rsp, buf, &len) == COAP_SUCCESS) {
+        sendto(srv.fd, buf, len, 0, (const struct sockaddr *)to, tolen);
+    }
+}
+
+static void _server_notify(const char *value)
+{
+    static uint8_t seq[4], cf[1];
+    coap_packet_t rsp;
+    memset(&rsp, 0, sizeof(rsp));
+    rsp.hdr.ver = COAP_VERSION;
+    rsp.hdr.t = COAP_TYPE_NONCON;
+    rsp.hdr.code = COAP_RSPCODE_CONTENT;
+    rsp.hdr.id = ++srv.msgid;
+    rsp.hdr.tkl = (uint8_t)srv.obs_toklen;
+    rsp.tok.p = srv.obs_tok;
+    rsp.tok.len = srv.obs_toklen;
+    coap_add_option(&rsp, COAP_OPTION_OBSERVE, seq, coap_encode_uint(++srv.obs_seq, seq));
+    coap_add_option(&rsp, COAP_OPTION_CONTENT_FORMAT, cf, 0);
+    rsp.payload.p = (const uint8_t *)value;
+    rsp.payload.len = strlen(value);
+    _server_send(&rsp, &srv.obs_addr, srv.obs_addrlen);
+}
+
+static void _server_answer(const uint8_t *buf, const size_t len,
+                           const struct sockaddr_storage *from, const socklen_t fromlen)
+{
+    static const uint8_t text[] = { 0 }, age[] = { 5 };
+    uint8_t seq[4], block[4];
+    coap_packet_t req, rsp;
+    coap_block_t b;
+    uint8_t count;
+
+    if (coap_parse(buf, len, &req) != COAP_SUCCESS) {
+        return;
+    }
+    memset(&rsp, 0, sizeof(rsp));
+    rsp.hdr.ver = COAP_VERSION;
+    rsp.hdr.t = (req.hdr.t == COAP_TYPE_CON) ? COAP_TYPE_ACK : COAP_TYPE_NONCON;
+    rsp.hdr.code = COAP_RSPCODE_CONTENT;
+    rsp.hdr.id = req.hdr.id;
+    rsp.hdr.tkl = req.hdr.tkl;
+    rsp.tok = req.tok;
+    if (_path_is(&req, "temp")) {
+        coap_add_option(&rsp, COAP_OPTION_CONTENT_FORMAT, text, 0);
+        coap_add_option(&rsp, COAP_OPTION_MAX_AGE, age, sizeof(age));
+        rsp.payload.p = (const uint8_t *)"21.5";
+        rsp.payload.len = 4;
+    }
+    else if (_path_is(&req, "big")) {
+        if (coap_get_block(&req, COAP_OPTION_BLOCK2, &b) != COAP_SUCCESS) {
+            b.num = 0;
+        }
+        // always 512 byte blocks, smaller than asked for
+        const size_t off = b.num * 512;
+        const bool more = off + 512 < BIG_LEN;
+        coap_add_option(&rsp, COAP_OPTION_CONTENT_FORMAT, block, 0);
+        coap_add_option(&rsp, COAP_OPTION_BLOCK2, block + 1,
+                        coap_encode_uint(b.num << 4 | (uint32_t)more << 3 | 5, block + 1));
+        rsp.payload.p = big + off;
+        rsp.payload.len = more ? 512 : BIG_LEN - off;
+    }
+    else if (_path_is(&req, "obs") && coap_find_options(&req, COAP_OPTION_OBSERVE, &count)) {
+        srv.observed = true;
+        memcpy(srv.obs_tok, req.tok.p, req.tok.len);
+        srv.obs_toklen = req.tok.len;
+        memcpy(&srv.obs_addr, from, fromlen);
+        srv.obs_addrlen = fromlen;
+        coap_add_option(&rsp, COAP_OPTION_OBSERVE, seq, coap_encode_uint(++srv.obs_seq, seq));
+        coap_add_option(&rsp, COAP_OPTION_CONTENT_FORMAT, text, 0);
+        rsp.payload.p = (const uint8_t *)"v0";
+        rsp.payload.len = 2;
+    }
+    else {
+        rsp.hdr.code = COAP_RSPCODE_NOT_FOUND;
+    }
+    _server_send(&rsp, from, fromlen);
+}
+
+static void _server_receive(void)
+{
+    held_t in;
+    ssize_t n;
+
+    in.fromlen = sizeof(in.from);
+    while ((n = recvfrom(srv.fd, in.buf, sizeof(in.buf), MSG_DONTWAIT,
+                         (struct sockaddr *)&in.from, &in.fromlen)) > 0) {
+        coap_packet_t req;
+        in.len = (size_t)n;
+        if (coap_parse(in.buf, in.len, &req) == COAP_SUCCESS) {
+            if (req.hdr.t == COAP_TYPE_RESET) {
+                srv.resets++;
+            }
+            else if (req.hdr.code >= COAP_METHOD_GET && req.hdr.code <= COAP_METHOD_DELETE) {
+                const int i = _path_is(&req, "temp") ? 0 : _path_is(&req, "big") ? 1 :
+                              _path_is(&req, "obs") ? 2 : 3;
+                srv.requests[i]++;
+                if (srv.hold && (i == 0) && (srv.nheld < MAX_HELD)) {
+                    srv.held[srv.nheld++] = in;
+                }
+                else {
+                    _server_answer(in.buf, in.len, &in.from, in.fromlen);
+                }
+            }
+        }
+        in.fromlen = sizeof(in.from);
+    }
+}
+
+static void _server_release(void)
+{
+    for (size_t i = 0; i < srv.nheld; ++i) {
+        _server_answer(srv.held[i].buf, srv.held[i].len, &srv.held[i].from, srv.held[i].fromlen);
+    }
+    srv.nheld = 0;
+}
+
+/* one round of the event loop */
+static void _pump(int timeout)
+{
+    struct pollfd fds[VIEWERS + STREAMS + 4];
+    size_t n = coap_gw_pollfds(&gw, fds, sizeof(fds) / sizeof(fds[0]) - 2);
+    const size_t ngw = n;
+    fds[n].fd = client.fd;
+    fds[n++].events = POLLIN;
+    fds[n].fd = srv.fd;
+    fds[n++].events = POLLIN;
+    for (size_t i = ngw; i < n; ++i) {
+        fds[i].revents = 0;
+    }
+    poll(fds, n, timeout);
+    const uint32_t now = _now_ms();
+    _server_receive();
+    coap_gw_process(&gw, fds, ngw, now);
+    coap_client_process(&client, now);
+    for (size_t i = 0; i < VIEWERS; ++i) {
+        viewer_t *v = &viewers[i];
+        while (v->fd >= 0) {
+            const ssize_t r = recv(v->fd, v->buf + v->len, sizeof(v->buf) - 1 - v->len,
+                                   MSG_DONTWAIT);
+            if (r <= 0) {
+                break;
+            }
+            v->len += (size_t)r;
+            v->buf[v->len] = '\0';
+        }
+    }
+}
+
+static bool _connect(viewer_t *v)
+{
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(gw_port) };
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    v->fd = socket(AF_INET, SOCK_STREAM, 0);
+    v->len = 0;
+    v->buf[0] = '\0';
+    return (v->fd >= 0) && !connect(v->fd, (struct sockaddr *)&addr, sizeof(addr));
+}
+
+static void _close(viewer_t *v)
+{
+    close(v->fd);
+    v->fd = -1;
+}
+
+static void _get(viewer_t *v, const char *target, const char *accept)
+{
+    char req[512];
+    const int n = snprintf(req, sizeof(req), "GET %s HTTP/1.1\r\nHost: gw\r\n%s%s%s\r\n",
+                           target, accept ? "Accept: " : "", accept ? accept : "",
+                           accept ? "\r\n" : "");
+    v->len = 0;
+    v->buf[0] = '\0';
+    send(v->fd, req, (size_t)n, 0);
+}
+
+/* a complete response with Content-Length has arrived */
+static bool _complete(const viewer_t *v)
+{
+    const char *end = strstr(v->buf, "\r\n\r\n");
+    const char *cl = strstr(v->buf, "Content-Length: ");
+    return end && cl && (v->len >= (size_t)(end + 4 - v->buf) + strtoul(cl + 16, NULL, 10));
+}
+
+static bool _all_complete(size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        if (!_complete(&viewers[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool _wait_complete(size_t count)
+{
+    const uint32_t start = _now_ms();
+    while (!_all_complete(count) && (_now_ms() - start < WAIT_MS)) {
+        _pump(10);
+    }
+    return _all_complete(count);
+}
+
+/* a single request on viewer 0 */
+static const viewer_t *_roundtrip(const char *target, const char *accept)
+{
+    viewer_t *v = &viewers[0];
+    if (v->fd < 0) {
+        _connect(v);
+    }
+    _get(v, target, accept);
+    _wait_complete(1);
+    return v;
+}
+
+static int _status(const viewer_t *v)
+{
+    return (strncmp(v->buf, "HTTP/1.1 ", 9) == 0) ? atoi(v->buf + 9) : 0;
+}
+
+static const char *_body(const viewer_t *v)
+{
+    const char *end = strstr(v->buf, "\r\n\r\n");
+    return end ? end + 4 : "";
+}
+
+static void _test_coalescing(void)
+{
+    char target[64];
+    snprintf(target, sizeof(target), "/coap/127.0.0.1:%u/temp", srv.port);
+
+    srv.hold = true;
+    for (size_t i = 0; i < VIEWERS; ++i) {
+        CHECK(_connect(&viewers[i]));
+        _get(&viewers[i], target, NULL);
+    }
+    const uint32_t start = _now_ms();
+    while (((gw.http_requests < VIEWERS) || !srv.requests[0]) && (_now_ms() - start < WAIT_MS)) {
+        _pump(10);
+    }
+    CHECK(gw.http_requests == VIEWERS);
+    CHECK(srv.requests[0] == 1);
+    CHECK(gw.coalesced == VIEWERS - 1);
+    srv.hold = false;
+    _server_release();
+    CHECK(_wait_complete(VIEWERS));
+    for (size_t i = 0; i < VIEWERS; ++i) {
+        const viewer_t *v = &viewers[i];
+        CHECK(_status(v) == 200);
+        CHECK(!strcmp(_body(v), "21.5"));
+        CHECK(strstr(v->buf, "Content-Type: text/plain"));
+        CHECK(strstr(v->buf, "Cache-Control: max-age="));
+    }
+
+    // fresh for its Max-Age, again on the same connections
+    for (size_t i = 0; i < VIEWERS; ++i) {
+        _get(&viewers[i], target, NULL);
+    }
+    CHECK(_wait_complete(VIEWERS));
+    CHECK(srv.requests[0] == 1);
+    CHECK(gw.cache_hits == VIEWERS);
+    for (size_t i = 0; i < VIEWERS; ++i) {
+        CHECK(!strcmp(_body(&viewers[i]), "21.5"));
+        _close(&viewers[i]);
+    }
+    printf("coalescing: %u HTTP requests, %u CoAP requests, %u coalesced, %u cache hits\n",
+           gw.http_requests, srv.requests[0], gw.coalesced, gw.cache_hits);
+}
+
+static void _test_mapping(void)
+{
+    char target[64];
+    const viewer_t *v;
+
+    snprintf(target, sizeof(target), "/coap/127.0.0.1:%u/big", srv.port);
+    v = _roundtrip(target, NULL);
+    CHECK(_status(v) == 200);
+    CHECK(strstr(v->buf, "Content-Length: 3000\r\n"));
+    CHECK(!memcmp(_body(v), big, BIG_LEN));
+    CHECK(srv.requests[1] == (BIG_LEN + 511) / 512);
+
+    snprintf(target, sizeof(target), "/coap/127.0.0.1:%u/missing", srv.port);
+    v = _roundtrip(target, NULL);
+    CHECK(_status(v) == 404);
+
+    v = _roundtrip("/coap/example.com/temp", NULL);
+    CHECK(_status(v) == 400);
+    v = _roundtrip("/coap/[::1/temp", NULL);
+    CHECK(_status(v) == 400);
+    v = _roundtrip("/coap/127.0.0.1:70000/temp", NULL);
+    CHECK(_status(v) == 400);
+    v = _roundtrip("/coap/127.0.0.1/a%zz", NULL);
+    CHECK(_status(v) == 400);
+    v = _roundtrip("/other", NULL);
+    CHECK(_status(v) == 404);
+    v = _roundtrip("/coap/127.0.0.1/temp", "image/png");
+    CHECK(_status(v) == 406);
+    v = _roundtrip("/coap/127.0.0.1/a/b/c/d/e/f/g/h/i", NULL);
+    CHECK(_status(v) == 414);
+
+    // the connection is closed after a request that is not HTTP/1.1
+    viewer_t *w = &viewers[0];
+    const char *post = "POST /coap/127.0.0.1/temp HTTP/1.0\r\nContent-Length: 0\r\n\r\n";
+    w->len = 0;
+    send(w->fd, post, strlen(post), 0);
+    CHECK(_wait_complete(1));
+    CHECK(_status(w) == 405);
+    CHECK(strstr(w->buf, "Connection: close"));
+    _close(w);
+
+    // pipelined requests are answered in order
+    snprintf(target, sizeof(target), "/coap/127.0.0.1:%u/temp", srv.port);
+    char reqs[512];
+    const int n = snprintf(reqs, sizeof(reqs), "GET %s HTTP/1.1\r\n\r\nGET /x HTTP/1.1\r\n\r\n",
+                           target);
+    CHECK(_connect(w));
+    send(w->fd, reqs, (size_t)n, 0);
+    const uint32_t start = _now_ms();
+    while (!strstr(w->buf, "404") && (_now_ms() - start < WAIT_MS)) {
+        _pump(10);
+    }
+    CHECK(_status(w) == 200);
+    CHECK(strstr(w->buf, "21.5HTTP/1.1 404"));
+    _close(w);
+}
+
+static bool _has_event(const viewer_t *v, const char *data)
+{
+    return strstr(v->buf, data) != NULL;
+}
+
+static bool _wait_events(const char *data)
+{
+    const uint32_t start = _now_ms();
+    for (;;) {
+        size_t i = 0;
+        while ((i < STREAMS) && _has_event(&viewers[i], data)) {
+            i++;
+        }
+        if (i == STREAMS) {
+            return true;
+        }
+        if (_now_ms() - start > WAIT_MS) {
+            return false;
+        }
+        _pump(10);
+    }
+}
+
+static void _test_events(void)
+{
+    char target[64];
+    snprintf(target, sizeof(target), "/coap/127.0.0.1:%u/obs", srv.port);
+
+    const uint32_t events = gw.events;
+    for (size_t i = 0; i < STREAMS; ++i) {
+        CHECK(_connect(&viewers[i]));
+        _get(&viewers[i], target, "text/event-stream");
+    }
+    CHECK(_wait_events("data: v0\n\n"));
+    CHECK(srv.requests[2] == 1);
+    CHECK(strstr(viewers[0].buf, "Content-Type: text/event-stream"));
+
+    _server_notify("v1");
+    CHECK(_wait_events("data: v1\n\n"));
+    _server_notify("line1\nline2");
+    CHECK(_wait_events("data: line1\ndata: line2\n\n"));
+    CHECK(srv.requests[2] == 1);
+    CHECK(gw.events - events == STREAMS * 3);
+
+    // a late viewer gets the current value straight away
+    viewer_t *late = &viewers[STREAMS];
+    CHECK(_connect(late));
+    _get(late, target, "text/event-stream");
+    const uint32_t start = _now_ms();
+    while (!strstr(late->buf, "data: line2") && (_now_ms() - start < WAIT_MS)) {
+        _pump(10);
+    }
+    CHECK(strstr(late->buf, "data: line2"));
+    _close(late);
+
+    // no one listens, the next notification is reset
+    for (size_t i = 0; i < STREAMS; ++i) {
+        _close(&viewers[i]);
+    }
+    for (int i = 0; i < 10; ++i) {
+        _pump(10);
+    }
+    _server_notify("v3");
+    const uint32_t reset = _now_ms();
+    while (!srv.resets && (_now_ms() - reset < WAIT_MS)) {
+        _pump(10);
+    }
+    CHECK(srv.resets == 1);
+    printf("events: %u streams, %u CoAP registrations, %u events, %u resets\n",
+           STREAMS, srv.requests[2], gw.events - events, srv.resets);
+}
+
+/* --- MAIN ----------------------------------------------------------------- */
+int main(void)
+{
+    struct sockaddr_in addr = { .sin_family = AF_INET };
+    socklen_t len = sizeof(addr);
+
+    for (size_t i = 0; i < BIG_LEN; ++i) {
+        big[i] = (uint8_t)(i * 7 + i / 256);
+    }
+    for (size_t i = 0; i < VIEWERS; ++i) {
+        viewers[i].fd = -1;
+    }
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    srv.fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if ((srv.fd < 0) || bind(srv.fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+        getsockname(srv.fd, (struct sockaddr *)&addr, &len)) {
+        perror("server");
+        return 1;
+    }
+    srv.port = ntohs(addr.sin_port);
+
+    const int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    addr.sin_port = 0;
+    len = sizeof(addr);
+    if ((lfd < 0) || bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) ||
+        listen(lfd, VIEWERS) || getsockname(lfd, (struct sockaddr *)&addr, &len)) {
+        perror("gateway");
+        return 1;
+    }
+    gw_port = ntohs(addr.sin_port);
+    if ((coap_client_init(&client, (uint32_t)getpid()) != COAP_SUCCESS) ||
+        (coap_gw_init(&gw, lfd, &client, VIEWERS + 8) != COAP_SUCCESS)) {
+        fprintf(stderr, "init failed\n");
+        return 1;
+    }
+
+    _test_coalescing();
+    _test_mapping();
+    _test_events();
+
+    coap_gw_free(&gw);
+    coap_client_close(&client);
+    close(lfd);
+    close(srv.fd);
+    printf("%s\n", failures ? "FAILED" : "PASSED");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,575 @@
+#include <errno.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "coap.h"
+#include "coap_http.h"
+
+/*
+ * Tests the CoAP-to-HTTP cross-proxy against a stand-in HTTP/1.1 server on
+ * loopback, forked from this process. The proxy runs in-process, requests are
+ * passed to it directly and its responses collected from the send callback.
+ * Checks the request and response mapping, keep-alive connection reuse and
+ * GET coalescing, and compares the latency of keep-alive connections with a
+ * connection per request. Exits non-zero if any check fails.
+ */
+
+#define HTTP_MAX_CLIENTS    16
+#define HTTP_BIG_LEN        3000    //!< body of /v1/big, three blocks
+#define MAX_RESPONSES       64
+#define LATENCY_ROUNDS      500
+
+typedef struct http_client
+{
+    int fd;
+    size_t len;
+    char buf[4096];
+} http_client_t;
+
+typedef struct response
+{
+    size_t len;
+    uint8_t buf[1152];
+    coap_packet_t pkt;
+} response_t;
+
+static response_t responses[MAX_RESPONSES];
+static size_t nresponses;
+static int failures;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+/* --- PRIVATE -------------------------------------------------------------- */
+static uint32_t _now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+static double _now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int _cmp_double(const void *a, const void *b)
+{
+    const double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* header value of a request, or "" */
+static void _header(const char *req, const char *name, char *value, size_t size)
+{
+    const size_t n = strlen(name);
+    value[0] = 0;
+    for (const char *p = strstr(req, "\r\n"); p && p[2] != '\r'; p = strstr(p + 2, "\r\n")) {
+        if (!strncasecmp(p + 2, name, n) && (p[2 + n] == ':')) {
+            const char *v = p + 3 + n;
+            while (*v == ' ') {
+                v++;
+            }
+            const size_t len = strcspn(v, "\r");
+            snprintf(value, size, "%.*s", (int)((len < size) ? len : size - 1), v);
+            return;
+        }
+    }
+}
+
+/* answers one complete request, returns false to close the connection */
+static bool _http_respond(int fd, const char *req, const char *body, size_t bodylen,
+                          unsigned long *requests, unsigned long connections)
+{
+    char method[8], target[256], accept[64], type[64], rsp[HTTP_BIG_LEN + 512];
+    int n = 0;
+    bool keep = true;
+
+    if (sscanf(req, "%7s %255s", method, target) != 2) {
+        return false;
+    }
+    (*requests)++;
+    _header(req, "accept", accept, sizeof(accept));
+    _header(req, "content-type", type, sizeof(type));
+    if (!strcmp(target, "/v1/hello")) {
+        n = snprintf(rsp, sizeof(rsp), "HTTP/1.1 200 OK\r\n"
+                     "Content-Type: text/plain; charset=utf-8\r\n"
+                     "Cache-Control: public, max-age=60\r\n"
+                     "Content-Length: 5\r\n\r\nhello");
+    }
+    else if (!strcmp(target, "/v1/json")) {
+        n = snprintf(rsp, sizeof(rsp), "HTTP/1.1 200 OK\r\n"
+                     "Content-Type: application/json\r\n"
+                     "Transfer-Encoding: chunked\r\n\r\n"
+                     "7\r\n{\"temp\"\r\n6;ext=1\r\n:21.5}\r\n0\r\n\r\n");
+    }
+    else if (!strcmp(target, "/v1/big")) {
+        n = snprintf(rsp, sizeof(rsp), "HTTP/1.1 200 OK\r\n"
+                     "Content-Type: application/octet-stream\r\n"
+                     "Content-Length: %d\r\n\r\n", HTTP_BIG_LEN);
+        for (int i = 0; i < HTTP_BIG_LEN; ++i) {
+            rsp[n++] = (char)('a' + i % 26);
+        }
+    }
+    else if (!strcmp(target, "/v1/items") && !strcmp(method, "POST")) {
+        n = snprintf(rsp, sizeof(rsp), "HTTP/1.1 201 Created\r\n"
+                     "Content-Type: %s\r\nContent-Length: %zu\r\n\r\n%.*s",
+                     type, bodylen, (int)bodylen, body);
+    }
+    else if (!strcmp(target, "/v1/items/1") &&
+             (!strcmp(method, "PUT") || !strcmp(method, "DELETE"))) {
+        n = snprintf(rsp, sizeof(rsp), "HTTP/1.1 204 No Content\r\n\r\n");
+    }
+    else if (!strcmp(target, "/v1/close")) {
+        n = snprintf(rsp, sizeof(rsp), "HTTP/1.1 200 OK\r\nConnection: close\r\n"
+                     "Content-Type: text/plain\r\nContent-Length: 2\r\n\r\nok");
+        keep = false;
+    }
+    else if (!strcmp(target, "/v1/accept")) {
+        n = snprintf(rsp, sizeof(rsp), "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\n"
+                     "Content-Length: %zu\r\n\r\n%s", strlen(accept), accept);
+    }
+    else if (!strcmp(target, "/v1/stats")) {
+        char stats[64];
+        snprintf(stats, sizeof(stats), "%lu %lu", *requests, connections);
+        n = snprintf(rsp, sizeof(rsp), "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\n"
+                     "Cache-Control: no-cache\r\nContent-Length: %zu\r\n\r\n%s",
+                     strlen(stats), stats);
+    }
+    else if (!strncmp(target, "/v1/echo", 8)) {
+        // the request target as received
+        n = snprintf(rsp, sizeof(rsp), "HTTP/1.0 200 OK\r\nContent-Type: text/plain\r\n"
+                     "Connection: keep-alive\r\nContent-Length: %zu\r\n\r\n%s",
+                     strlen(target), target);
+    }
+    else {
+        n = snprintf(rsp, sizeof(rsp), "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n");
+    }
+    for (int sent = 0, rc; sent < n; sent += rc) {
+        if ((rc = (int)send(fd, rsp + sent, n - sent, MSG_NOSIGNAL)) <= 0) {
+            return false;
+        }
+    }
+    return keep;
+}
+
+/* stand-in upstream: keep-alive HTTP/1.1 with Content-Length bodies */
+static void _http_server(int lfd)
+{
+    http_client_t clients[HTTP_MAX_CLIENTS];
+    unsigned long requests = 0, connections = 0;
+
+    for (int i = 0; i < HTTP_MAX_CLIENTS; ++i) {
+        clients[i].fd = -1;
+    }
+    for (;;) {
+        struct pollfd fds[HTTP_MAX_CLIENTS + 1];
+        fds[0].fd = lfd;
+        fds[0].events = POLLIN;
+        for (int i = 0; i < HTTP_MAX_CLIENTS; ++i) {
+            fds[i + 1].fd = clients[i].fd;
+            fds[i + 1].events = POLLIN;
+        }
+        if (poll(fds, HTTP_MAX_CLIENTS + 1, -1) < 0) {
+            continue;
+        }
+        if (fds[0].revents & POLLIN) {
+            const int fd = accept(lfd, NULL, NULL);
+            for (int i = 0; (fd >= 0) && (i < HTTP_MAX_CLIENTS); ++i) {
+                if (clients[i].fd < 0) {
+                    clients[i].fd = fd;
+                    clients[i].len = 0;
+                    connections++;
+                    break;
+                }
+            }
+        }
+        for (int i = 0; i < HTTP_MAX_CLIENTS; ++i) {
+            http_client_t *c = &clients[i];
+            if ((c->fd < 0) || !(fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR))) {
+                continue;
+            }
+            const ssize_t n = recv(c->fd, c->buf + c->len, sizeof(c->buf) - 1 - c->len, 0);
+            bool keep = (n > 0);
+            if (keep) {
+                c->len += (size_t)n;
+                c->buf[c->len] = 0;
+            }
+            // all complete requests in the buffer
+            char *end;
+            while (keep && (end = strstr(c->buf, "\r\n\r\n"))) {
+                char length[16];
+                _header(c->buf, "content-length", length, sizeof(length));
+                const size_t head = (size_t)(end + 4 - c->buf);
+                const size_t bodylen = strtoul(length, NULL, 10);
+                if (c->len < head + bodylen) {
+                    break;
+                }
+                keep = _http_respond(c->fd, c->buf, c->buf + head, bodylen,
+                                     &requests, connections);
+                memmove(c->buf, c->buf + head + bodylen, c->len - head - bodylen + 1);
+                c->len -= head + bodylen;
+            }
+            if (!keep) {
+                close(c->fd);
+                c->fd = -1;
+            }
+        }
+    }
+}
+
+static void _send(void *ctx, const struct sockaddr *addr, const socklen_t addrlen,
+                  const coap_packet_t *pkt)
+{
+    (void)ctx;
+    (void)addr;
+    (void)addrlen;
+    if (nresponses == MAX_RESPONSES) {
+        failures++;
+        return;
+    }
+    // keep the datagram, the packet points into the proxy's buffers
+    response_t *r = &responses[nresponses++];
+    r->len = sizeof(r->buf);
+    if ((coap_build(pkt, r->buf, &r->len) != COAP_SUCCESS) ||
+        (coap_parse(r->buf, r->len, &r->pkt) != COAP_SUCCESS)) {
+        failures++;
+        r->len = 0;
+    }
+}
+
+/* runs the proxy until \p count responses arrived, false on timeout */
+static bool _wait(coap_http_proxy_t *proxy, size_t count)
+{
+    const uint32_t start = _now_ms();
+    while (nresponses < count) {
+        struct pollfd fds[COAP_HTTP_POOL_SIZE];
+        const size_t n = coap_http_proxy_pollfds(proxy, fds, COAP_HTTP_POOL_SIZE);
+        poll(fds, n, 10);
+        coap_http_proxy_process(proxy, _now_ms(), _send, NULL);
+        if (_now_ms() - start > 2 * COAP_HTTP_TIMEOUT_MS) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* request for "path", segments separated by '/', queries by ',' */
+static void _request(coap_packet_t *pkt, coap_method_t method, coap_msgtype_t type,
+                     uint16_t msgid, const uint8_t *tok, char *path, char *query)
+{
+    memset(pkt, 0, sizeof(*pkt));
+    pkt->hdr.ver = COAP_VERSION;
+    pkt->hdr.t = type;
+    pkt->hdr.code = method;
+    pkt->hdr.id = msgid;
+    pkt->hdr.tkl = 2;
+    pkt->tok.p = tok;
+    pkt->tok.len = 2;
+    for (char *seg = strtok(path, "/"); seg; seg = strtok(NULL, "/")) {
+        coap_add_option(pkt, COAP_OPTION_URI_PATH, (const uint8_t *)seg, strlen(seg));
+    }
+    for (char *arg = query ? strtok(query, ",") : NULL; arg; arg = strtok(NULL, ",")) {
+        coap_add_option(pkt, COAP_OPTION_URI_QUERY, (const uint8_t *)arg, strlen(arg));
+    }
+}
+
+static const coap_option_t *_option(const coap_packet_t *pkt, uint16_t num)
+{
+    uint8_t count;
+    return coap_find_options(pkt, num, &count);
+}
+
+static int _uint_option(const coap_packet_t *pkt, uint16_t num)
+{
+    const coap_option_t *opt = _option(pkt, num);
+    return opt ? (int)coap_decode_uint(&opt->buf) : -1;
+}
+
+static bool _payload_is(const coap_packet_t *pkt, const char *s)
+{
+    return (pkt->payload.len == strlen(s)) && !memcmp(pkt->payload.p, s, strlen(s));
+}
+
+/* sends one request through the proxy and waits for its response */
+static const coap_packet_t *_roundtrip(coap_http_proxy_t *proxy, coap_packet_t *req,
+                                       const struct sockaddr_in *client)
+{
+    coap_packet_t rsp;
+    nresponses = 0;
+    const coap_state_t rc = coap_http_proxy_request(proxy, req, (const struct sockaddr *)client,
+                                                    sizeof(*client), _now_ms(), &rsp);
+    if (rc == COAP_RSP_SEND) {
+        _send(NULL, NULL, 0, &rsp);
+        return &responses[0].pkt;
+    }
+    CHECK((req->hdr.t == COAP_TYPE_CON) ? (rc == COAP_ACK_SEND) : (rc == COAP_RSP_WAIT));
+    if ((rc == COAP_ACK_SEND) && ((rsp.hdr.code != COAP_RSPCODE_EMPTY) ||
+                                  (rsp.hdr.id != req->hdr.id))) {
+        failures++;
+    }
+    if (!_wait(proxy, 1)) {
+        fprintf(stderr, "no response\n");
+        failures++;
+        memset(&responses[0].pkt, 0, sizeof(responses[0].pkt));
+    }
+    return &responses[0].pkt;
+}
+
+static void _test_mapping(coap_http_proxy_t *proxy, const struct sockaddr_in *client)
+{
+    const uint8_t tok[2] = { 0xab, 0xcd };
+    coap_packet_t req;
+    const coap_packet_t *rsp;
+    char path[64], query[64];
+    uint8_t accept[2], block[1], cf[1];
+
+    strcpy(path, "api/hello");
+    _request(&req, COAP_METHOD_GET, COAP_TYPE_CON, 1, tok, path, NULL);
+    rsp = _roundtrip(proxy, &req, client);
+    CHECK(rsp->hdr.code == COAP_RSPCODE_CONTENT);
+    CHECK(rsp->hdr.t == COAP_TYPE_NONCON);
+    CHECK((rsp->tok.len == 2) && !memcmp(rsp->tok.p, tok, 2));
+    CHECK(_uint_option(rsp, COAP_OPTION_CONTENT_FORMAT) == COAP_CONTENTTYPE_TXT_PLAIN);
+    CHECK(_uint_option(rsp, COAP_OPTION_MAX_AGE) == 60);
+    CHECK(_payload_is(rsp, "hello"));
+
+    strcpy(path, "api/json");
+    _request(&req, COAP_METHOD_GET, COAP_TYPE_NONCON, 2, tok, path, NULL);
+    rsp = _roundtrip(proxy, &req, client);
+    CHECK(rsp->hdr.code == COAP_RSPCODE_CONTENT);
+    CHECK(_uint_option(rsp, COAP_OPTION_CONTENT_FORMAT) == COAP_CONTENTTYPE_APP_JSON);
+    CHECK(_uint_option(rsp, COAP_OPTION_MAX_AGE) == -1);
+    CHECK(_payload_is(rsp, "{\"temp\":21.5}"));
+
+    // block wise: first block by default, the last one on request
+    strcpy(path, "api/big");
+    _request(&req, COAP_METHOD_GET, COAP_TYPE_CON, 3, tok, path, NULL);
+    rsp = _roundtrip(proxy, &req, client);
+    CHECK(rsp->payload.len == 1024);
+    CHECK(_uint_option(rsp, COAP_OPTION_BLOCK2) == ((0 << 4) | (1 << 3) | 6));
+    strcpy(path, "api/big");
+    _request(&req, COAP_METHOD_GET, COAP_TYPE_CON, 4, tok, path, NULL);
+    block[0] = (2 << 4) | 6;
+    coap_add_option(&req, COAP_OPTION_BLOCK2, block, 1);
+    rsp = _roundtrip(proxy, &req, client);
+    CHECK(rsp->payload.len == HTTP_BIG_LEN - 2048);
+    CHECK(_uint_option(rsp, COAP_OPTION_BLOCK2) == ((2 << 4) | 6));
+    CHECK(rsp->payload.len && (rsp->payload.p[0] == 'a' + 2048 % 26));
+
+    strcpy(path, "api/items");
+    _request(&req, COAP_METHOD_POST, COAP_TYPE_CON, 5, tok, path, NULL);
+    cf[0] = COAP_CONTENTTYPE_APP_JSON;
+    coap_add_option(&req, COAP_OPTION_CONTENT_FORMAT, cf, 1);
+    req.payload.p = (const uint8_t *)"{\"on\":true}";
+    req.payload.len = 11;
+    rsp = _roundtrip(proxy, &req, client);
+    CHECK(rsp->hdr.code == COAP_RSPCODE_CREATED);
+    CHECK(_uint_option(rsp, COAP_OPTION_CONTENT_FORMAT) == COAP_CONTENTTYPE_APP_JSON);
+    CHECK(_payload_is(rsp, "{\"on\":true}"));
+
+    strcpy(path, "api/items/1");
+    _request(&req, COAP_METHOD_PUT, COAP_TYPE_CON, 6, tok, path, NULL);
+    req.payload.p = (const uint8_t *)"x";
+    req.payload.len = 1;
+    rsp = _roundtrip(proxy, &req, client);
+    CHECK(rsp->hdr.code == COAP_RSPCODE_CHANGED);
+    CHECK(rsp->payload.len == 0);
+
+    strcpy(path, "api/items/1");
+    _request(&req, COAP_METHOD_DELETE, COAP_TYPE_CON, 7, tok, path, NULL);
+    rsp = _roundtrip(proxy, &req, client);
+    CHECK(rsp->hdr.code == COAP_RSPCODE_DELETED);
+
+    strcpy(path, "api/missing");
+    _request(&req, COAP_METHOD_GET, COAP_TYPE_CON, 8, tok, path, NULL);
+    rsp = _roundtrip(proxy, &req, client);
+    CHECK(rsp->hdr.code == COAP_RSPCODE_NOT_FOUND);
+
+    // HTTP/1.0 with keep-alive, percent-encoded path and query
+    strcpy(path, "api/echo/a b");
+    strcpy(query, "x=1,y=a&b");
+    _request(&req, COAP_METHOD_GET, COAP_TYPE_CON, 9, tok, path, query);
+    rsp = _roundtrip(proxy, &req, client);
+    CHECK(_payload_is(rsp, "/v1/echo/a%20b?x=1&y=a%26b"));
+
+    strcpy(path, "api/accept");
+    _request(&req, COAP_METHOD_GET, COAP_TYPE_CON, 10, tok, path, NULL);
+    accept[0] = COAP_CONTENTTYPE_APP_CBOR;
+    coap_add_option(&req, COAP_OPTION_ACCEPT, accept, 1);
+    rsp = _roundtrip(proxy, &req, client);
+    CHECK(_payload_is(rsp, "application/cbor"));
+    CHECK(_uint_option(rsp, COAP_OPTION_CONTENT_FORMAT) == COAP_CONTENTTYPE_TXT_PLAIN);
+
+    // answered at once: unmapped Accept, method, and other paths
+    strcpy(path, "api/accept");
+    _request(&req, COAP_METHOD_GET, COAP_TYPE_CON, 11, tok, path, NULL);
+    accept[0] = 0x27;
+    accept[1] = 0x10;
+    coap_add_option(&req, COAP_OPTION_ACCEPT, accept, 2);
+    rsp = _roundtrip(proxy, &req, client);
+    CHECK(rsp->hdr.code == COAP_RSPCODE_NOT_ACCEPTABLE);
+    CHECK(rsp->hdr.t == COAP_TYPE_ACK);
+
+    strcpy(path, "api/hello");
+    _request(&req, (coap_method_t)5, COAP_TYPE_CON, 12, tok, path, NULL);
+    rsp = _roundtrip(proxy, &req, client);
+    CHECK(rsp->hdr.code == COAP_RSPCODE_METHOD_NOT_ALLOWED);
+
+    strcpy(path, "light");
+    _request(&req, COAP_METHOD_GET, COAP_TYPE_CON, 13, tok, path, NULL);
+    coap_packet_t out;
+    CHECK(coap_http_proxy_request(proxy, &req, (const struct sockaddr *)client,
+                                  sizeof(*client), _now_ms(), &out) ==
+          COAP_ERR_REQUEST_NOT_FOUND);
+
+    // the upstream closes after this one, the next request reconnects
+    const uint32_t connects = proxy->connects;
+    strcpy(path, "api/close");
+    _request(&req, COAP_METHOD_GET, COAP_TYPE_CON, 14, tok, path, NULL);
+    rsp = _roundtrip(proxy, &req, client);
+    CHECK(_payload_is(rsp, "ok"));
+    strcpy(path, "api/hello");
+    _request(&req, COAP_METHOD_GET, COAP_TYPE_CON, 15, tok, path, NULL);
+    rsp = _roundtrip(proxy, &req, client);
+    CHECK(_payload_is(rsp, "hello"));
+    CHECK(proxy->connects == connects + 1);
+}
+
+static void _test_coalescing(coap_http_proxy_t *proxy, const struct sockaddr_in *client)
+{
+    enum { N = 50 };
+    uint8_t toks[N][2];
+    coap_packet_t req, rsp;
+    char path[32], query[32];
+    const uint32_t upstream = proxy->upstream_requests;
+
+    nresponses = 0;
+    for (int i = 0; i < N; ++i) {
+        toks[i][0] = 0x10;
+        toks[i][1] = (uint8_t)i;
+        strcpy(path, "api/echo");
+        strcpy(query, "id=7");
+        _request(&req, COAP_METHOD_GET, COAP_TYPE_NONCON, (uint16_t)(100 + i), toks[i],
+                 path, query);
+        CHECK(coap_http_proxy_request(proxy, &req, (const struct sockaddr *)client,
+                                      sizeof(*client), _now_ms(), &rsp) == COAP_RSP_WAIT);
+    }
+    CHECK(_wait(proxy, N));
+    CHECK(proxy->upstream_requests == upstream + 1);
+    CHECK(proxy->coalesced >= N - 1);
+    bool seen[N] = { false };
+    for (size_t i = 0; i < nresponses; ++i) {
+        const coap_packet_t *p = &responses[i].pkt;
+        CHECK(_payload_is(p, "/v1/echo?id=7"));
+        if ((p->tok.len == 2) && (p->tok.p[1] < N)) {
+            seen[p->tok.p[1]] = true;
+        }
+    }
+    for (int i = 0; i < N; ++i) {
+        CHECK(seen[i]);
+    }
+
+    // the upstream saw the same, including this request
+    const uint8_t tok[2] = { 0x20, 0 };
+    strcpy(path, "api/stats");
+    _request(&req, COAP_METHOD_GET, COAP_TYPE_CON, 99, tok, path, NULL);
+    char stats[64];
+    snprintf(stats, sizeof(stats), "%u %u", proxy->upstream_requests + 1, proxy->connects);
+    const coap_packet_t *p = _roundtrip(proxy, &req, client);
+    CHECK(_payload_is(p, stats));
+    CHECK(_uint_option(p, COAP_OPTION_MAX_AGE) == 0);
+}
+
+/* per request latency through the proxy, in µs */
+static double _latency(coap_http_proxy_t *proxy, const struct sockaddr_in *client,
+                       const char *resource)
+{
+    static double samples[LATENCY_ROUNDS];
+    const uint8_t tok[2] = { 0, 1 };
+    coap_packet_t req;
+    char path[32];
+
+    for (int i = 0; i < LATENCY_ROUNDS; ++i) {
+        snprintf(path, sizeof(path), "%s", resource);
+        _request(&req, COAP_METHOD_GET, COAP_TYPE_CON, (uint16_t)i, tok, path, NULL);
+        const double start = _now_us();
+        _roundtrip(proxy, &req, client);
+        samples[i] = _now_us() - start;
+    }
+    qsort(samples, LATENCY_ROUNDS, sizeof(samples[0]), _cmp_double);
+    return samples[LATENCY_ROUNDS / 2];
+}
+
+/* --- PUBLIC --------------------------------------------------------------- */
+int main(void)
+{
+    static coap_http_proxy_t proxy;
+    static const coap_http_route_t routes[] = {{ "api", "/v1" }};
+    struct sockaddr_in upstream, client;
+    socklen_t len = sizeof(upstream);
+
+    const int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    memset(&upstream, 0, sizeof(upstream));
+    upstream.sin_family = AF_INET;
+    upstream.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if ((bind(lfd, (struct sockaddr *)&upstream, sizeof(upstream)) < 0) ||
+        (listen(lfd, 16) < 0) ||
+        (getsockname(lfd, (struct sockaddr *)&upstream, &len) < 0)) {
+        perror("upstream");
+        return 1;
+    }
+    const pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return 1;
+    }
+    if (!pid) {
+        _http_server(lfd);
+        _exit(0);
+    }
+    close(lfd);
+
+    memset(&client, 0, sizeof(client));
+    client.sin_family = AF_INET;
+    client.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    client.sin_port = htons(COAP_DEFAULT_PORT + 1);
+    coap_http_proxy_init(&proxy, routes, 1, (const struct sockaddr *)&upstream,
+                         sizeof(upstream), "localhost");
+
+    _test_mapping(&proxy, &client);
+    _test_coalescing(&proxy, &client);
+    printf("mapping and coalescing: %s, %u connections for %u requests\n",
+           failures ? "FAILED" : "ok", proxy.connects, proxy.upstream_requests);
+    CHECK(proxy.connects <= COAP_HTTP_POOL_SIZE + 1);
+
+    const double keepalive = _latency(&proxy, &client, "api/hello");
+    const uint32_t connects = proxy.connects;
+    const double reconnect = _latency(&proxy, &client, "api/close");
+    CHECK(proxy.connects - connects >= LATENCY_ROUNDS - COAP_HTTP_POOL_SIZE);
+    printf("median latency: keep-alive %.1f us, connection per request %.1f us\n",
+           keepalive, reconnect);
+
+    coap_http_proxy_close(&proxy);
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+    printf("%s\n", failures ? "FAILED" : "PASSED");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,444 @@
+#define _GNU_SOURCE     // memfd_create
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "coap.h"
+#include "coap_local.h"
+
+/*
+ * Tests the local transports: requests over a Unix domain datagram socket
+ * answered to the address of the client, unbound clients and datagrams too
+ * large; shared memory channels handed over the socket, requests and
+ * responses in the slots of the rings, a payload echoed from the request
+ * slot into the response slot, full rings on both sides, channels refused
+ * for a full table, unsealed memory, a regular file, missing descriptors
+ * or too many of them, and closed by the client; clients killed in child
+ * processes without closing, their channels freed so that others attach. Then a client thread and a server thread pass 200,000
+ * requests through a channel, sleeping in poll whenever their ring is
+ * empty, so that a lost wakeup stalls the test. Exits non-zero if any
+ * check fails.
+ */
+
+#define MAX_CHANNELS    2
+#define THREAD_REQUESTS 200000
+
+static int failures;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+static char path[64];
+static struct sockaddr_un server_addr;
+static socklen_t server_addrlen;
+
+/* --- RESOURCES ------------------------------------------------------------ */
+static const coap_resource_path_t path_light = {1, {"light"}};
+static const coap_resource_path_t path_echo = {1, {"echo"}};
+
+static int handle_get_light(const coap_resource_t *resource, const coap_packet_t *inpkt,
+                            coap_packet_t *pkt)
+{
+    return coap_make_response(inpkt->hdr.id, &inpkt->tok, COAP_TYPE_ACK,
+                              COAP_RSPCODE_CONTENT, resource->content_type,
+                              (const uint8_t *)"on", 2, pkt);
+}
+
+/* the payload of the response points into the request */
+static int handle_post_echo(const coap_resource_t *resource, const coap_packet_t *inpkt,
+                            coap_packet_t *pkt)
+{
+    return coap_make_response(inpkt->hdr.id, &inpkt->tok, COAP_TYPE_ACK,
+                              COAP_RSPCODE_CHANGED, resource->content_type,
+                              inpkt->payload.p, inpkt->payload.len, pkt);
+}
+
+static coap_resource_t resources[] =
+{
+    {COAP_RDY, COAP_METHOD_GET, COAP_TYPE_ACK, handle_get_light, &path_light,
+        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_TXT_PLAIN), NULL},
+    {COAP_RDY, COAP_METHOD_POST, COAP_TYPE_ACK, handle_post_echo, &path_echo,
+        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_APP_OCTECT_STREAM), NULL},
+    {(coap_state_t)0, (coap_method_t)0, (coap_msgtype_t)0, NULL, NULL,
+        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_NONE), NULL}
+};
+
+/* --- HELPERS -------------------------------------------------------------- */
+static size_t _request(uint8_t *buf, const size_t size, const uint16_t id,
+                       const coap_method_t method, const char *res,
+                       const uint8_t *payload, const size_t len)
+{
+    const uint8_t tok[2] = { (uint8_t)(id >> 8), (uint8_t)id };
+    coap_packet_t pkt;
+    size_t n = size;
+
+    memset(&pkt, 0, sizeof(pkt));
+    pkt.hdr.ver = COAP_VERSION;
+    pkt.hdr.t = COAP_TYPE_CON;
+    pkt.hdr.code = method;
+    pkt.hdr.id = id;
+    pkt.hdr.tkl = sizeof(tok);
+    pkt.tok = (coap_buffer_t){ tok, sizeof(tok) };
+    coap_add_option(&pkt, COAP_OPTION_URI_PATH, (const uint8_t *)res, strlen(res));
+    pkt.payload = (coap_buffer_t){ payload, len };
+    return (coap_build(&pkt, buf, &n) == COAP_SUCCESS) ? n : 0;
+}
+
+static void _pump(coap_local_t *local, const int timeout)
+{
+    struct pollfd fds[2 * MAX_CHANNELS + 1];
+    const size_t n = coap_local_pollfds(local, fds, 2 * MAX_CHANNELS + 1);
+    if (poll(fds, n, timeout) > 0) {
+        coap_local_process(local, fds, n);
+    }
+}
+
+/* the response of a channel after a wakeup */
+static const uint8_t *_response(coap_local_channel_t *ch, coap_packet_t *pkt)
+{
+    struct pollfd pfd = { ch->rxfd, POLLIN, 0 };
+    size_t len;
+
+    if (poll(&pfd, 1, 1000) != 1) {
+        return NULL;
+    }
+    coap_local_wakeup(ch);
+    const uint8_t *p = coap_local_peek(ch, &len);
+    if (!p || (coap_parse(p, len, pkt) != COAP_SUCCESS)) {
+        return NULL;
+    }
+    return p;
+}
+
+/* memory handed over as a channel, with count descriptors in all */
+static void _handover(const int fd, const int memfd, const int count)
+{
+    union {
+        struct cmsghdr hdr;
+        uint8_t buf[CMSG_SPACE(6 * sizeof(int))];
+    } control;
+    int live[2];
+    CHECK(!socketpair(AF_UNIX, SOCK_SEQPACKET, 0, live));
+    int fds[6] = { memfd, dup(fd), dup(fd), live[1], dup(fd), dup(fd) };
+    struct iovec iov = { NULL, 0 };
+    struct msghdr msg = {
+        .msg_name = &server_addr, .msg_namelen = server_addrlen, .msg_iov = &iov,
+        .msg_iovlen = 1, .msg_control = control.buf,
+        .msg_controllen = CMSG_SPACE(count * sizeof(int))
+    };
+    struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type = SCM_RIGHTS;
+    c->cmsg_len = CMSG_LEN(count * sizeof(int));
+    memcpy(CMSG_DATA(c), fds, count * sizeof(int));
+    CHECK(sendmsg(fd, &msg, 0) == 0);
+    for (size_t i = 0; i < 6; ++i) {
+        close(fds[i]);
+    }
+    close(live[0]);
+}
+
+/* a memfd without seals */
+static int _unsealed(void)
+{
+    const int memfd = memfd_create("unsealed", 0);
+    CHECK(!ftruncate(memfd, sizeof(coap_local_shm_t)));
+    return memfd;
+}
+
+/* a regular file, no seals at all, laid out as a channel would be */
+static int _regular(const uint32_t magic)
+{
+    char name[] = "/tmp/yacoap-local-XXXXXX";
+    const int f = mkstemp(name);
+    unlink(name);
+    CHECK(!ftruncate(f, sizeof(coap_local_shm_t)));
+    CHECK(pwrite(f, &magic, sizeof(magic), offsetof(coap_local_shm_t, magic)) == sizeof(magic));
+    return f;
+}
+
+/* --- TESTS ---------------------------------------------------------------- */
+static void _test_unix(coap_local_t *local)
+{
+    uint8_t buf[2048];
+    coap_packet_t pkt;
+    const int fd = coap_local_socket(NULL);
+    const int unbound = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+
+    CHECK(fd >= 0);
+    size_t n = _request(buf, sizeof(buf), 1, COAP_METHOD_GET, "light", NULL, 0);
+    CHECK(sendto(fd, buf, n, 0, (struct sockaddr *)&server_addr, server_addrlen) == (ssize_t)n);
+    _pump(local, 1000);
+    const struct pollfd pfd = { fd, POLLIN, 0 };
+    CHECK(poll((struct pollfd *)&pfd, 1, 1000) == 1);
+    const ssize_t len = recv(fd, buf, sizeof(buf), 0);
+    CHECK((len > 0) && (coap_parse(buf, (size_t)len, &pkt) == COAP_SUCCESS));
+    CHECK((pkt.hdr.code == COAP_RSPCODE_CONTENT) && (pkt.hdr.id == 1));
+    CHECK((pkt.payload.len == 2) && !memcmp(pkt.payload.p, "on", 2));
+    CHECK(local->requests == 1);
+
+    // nowhere to answer to, and larger than any message
+    n = _request(buf, sizeof(buf), 2, COAP_METHOD_GET, "light", NULL, 0);
+    CHECK(sendto(unbound, buf, n, 0, (struct sockaddr *)&server_addr, server_addrlen) == (ssize_t)n);
+    memset(buf, 0x40, sizeof(buf));
+    CHECK(sendto(fd, buf, sizeof(buf), 0, (struct sockaddr *)&server_addr,
+                 server_addrlen) == (ssize_t)sizeof(buf));
+    _pump(local, 1000);
+    CHECK(local->requests == 1);
+    CHECK(local->dropped == 1);
+    CHECK(recv(fd, buf, sizeof(buf), MSG_DONTWAIT) < 0);
+    close(unbound);
+    close(fd);
+}
+
+static void _test_shm(coap_local_t *local)
+{
+    static const uint8_t payload[] = "zero copy";
+    coap_local_channel_t ch;
+    coap_packet_t pkt;
+    size_t size, len;
+    const int fd = coap_local_socket(NULL);
+
+    CHECK(coap_local_channel_open(&ch, fd, (struct sockaddr *)&server_addr,
+                                  server_addrlen) == COAP_SUCCESS);
+    _pump(local, 1000);
+    CHECK(local->attached == 1);
+    CHECK(local->channels[0].shm != NULL);
+
+    // built in the request slot, the echo built from there into the response slot
+    uint8_t *slot = coap_local_reserve(&ch, &size);
+    CHECK(slot && (size == COAP_LOCAL_DGRAM_SIZE));
+    coap_local_commit(&ch, _request(slot, size, 10, COAP_METHOD_POST, "echo", payload,
+                                    sizeof(payload)));
+    _pump(local, 1000);
+    const uint8_t *rsp = _response(&ch, &pkt);
+    CHECK(rsp != NULL);
+    CHECK((pkt.hdr.code == COAP_RSPCODE_CHANGED) && (pkt.hdr.id == 10));
+    CHECK((pkt.payload.len == sizeof(payload)) && !memcmp(pkt.payload.p, payload, sizeof(payload)));
+    CHECK(((const uint8_t *)ch.shm < rsp) && (rsp < (const uint8_t *)(ch.shm + 1)));
+    coap_local_release(&ch);
+    CHECK(!coap_local_peek(&ch, &len));
+
+    // a full ring of requests, answered in order
+    for (uint16_t id = 100; id < 100 + COAP_LOCAL_SLOTS; ++id) {
+        CHECK((slot = coap_local_reserve(&ch, &size)) != NULL);
+        coap_local_commit(&ch, _request(slot, size, id, COAP_METHOD_GET, "light", NULL, 0));
+    }
+    CHECK(!coap_local_reserve(&ch, &size));
+    _pump(local, 1000);
+    for (uint16_t id = 100; id < 100 + COAP_LOCAL_SLOTS; ++id) {
+        const uint8_t *p = coap_local_peek(&ch, &len);
+        CHECK(p && (coap_parse(p, len, &pkt) == COAP_SUCCESS) && (pkt.hdr.id == id));
+        coap_local_release(&ch);
+    }
+    CHECK(!coap_local_peek(&ch, &len));
+
+    // responses the client does not take are dropped
+    const uint32_t dropped = local->dropped;
+    for (size_t round = 0; round < 2; ++round) {
+        for (uint16_t id = 0; id < COAP_LOCAL_SLOTS; ++id) {
+            slot = coap_local_reserve(&ch, &size);
+            coap_local_commit(&ch, _request(slot, size, id, COAP_METHOD_GET, "light", NULL, 0));
+        }
+        _pump(local, 1000);
+    }
+    CHECK(local->dropped - dropped == COAP_LOCAL_SLOTS);
+
+    // refused: a full table, unsealed memory, descriptors missing
+    coap_local_channel_t second, third;
+    CHECK(coap_local_channel_open(&second, fd, (struct sockaddr *)&server_addr,
+                                  server_addrlen) == COAP_SUCCESS);
+    CHECK(coap_local_channel_open(&third, fd, (struct sockaddr *)&server_addr,
+                                  server_addrlen) == COAP_SUCCESS);
+    _pump(local, 1000);
+    CHECK(local->attached == 2);
+    CHECK(local->refused == 1);
+    coap_local_channel_close(&third);
+    coap_local_channel_close(&second);
+    _pump(local, 1000);
+    CHECK(!local->channels[1].shm);
+    _handover(fd, _unsealed(), 4);
+    _handover(fd, _unsealed(), 3);
+    _pump(local, 1000);
+    CHECK(local->refused == 3);
+    CHECK(!local->channels[1].shm);
+
+    // a file that could shrink under the mapping, and more descriptors than a channel has
+    const int regular = _regular(ch.shm->magic);
+    _handover(fd, dup(regular), 4);
+    _handover(fd, _unsealed(), 5);
+    _handover(fd, _unsealed(), 6);
+    _pump(local, 1000);
+    CHECK(local->refused == 6);
+    CHECK((local->attached == 2) && !local->channels[1].shm);
+    CHECK(!ftruncate(regular, 0));
+    _pump(local, 100);
+    close(regular);
+
+    coap_local_channel_close(&ch);
+    CHECK(!ch.shm);
+    _pump(local, 1000);
+    CHECK(!local->channels[0].shm);
+    close(fd);
+}
+
+/* clients that fill the table and are killed, their channels are freed */
+static void _test_killed(coap_local_t *local)
+{
+    pid_t pids[MAX_CHANNELS];
+    coap_local_channel_t ch;
+    coap_packet_t pkt;
+    size_t size;
+    char ready;
+    int ready_pipe[2];
+    const uint32_t attached = local->attached, refused = local->refused;
+
+    CHECK(!pipe(ready_pipe));
+    for (size_t i = 0; i < MAX_CHANNELS; ++i) {
+        if ((pids[i] = fork()) == 0) {
+            const int fd = coap_local_socket(NULL);
+            if (coap_local_channel_open(&ch, fd, (struct sockaddr *)&server_addr,
+                                        server_addrlen) == COAP_SUCCESS) {
+                ready = 1;
+                if (write(ready_pipe[1], &ready, 1) == 1) {
+                    pause();
+                }
+            }
+            _exit(1);
+        }
+        CHECK(pids[i] > 0);
+        CHECK(read(ready_pipe[0], &ready, 1) == 1);
+    }
+    _pump(local, 1000);
+    CHECK(local->attached - attached == MAX_CHANNELS);
+
+    // the table is full
+    const int fd = coap_local_socket(NULL);
+    CHECK(coap_local_channel_open(&ch, fd, (struct sockaddr *)&server_addr,
+                                  server_addrlen) == COAP_SUCCESS);
+    _pump(local, 1000);
+    CHECK(local->refused - refused == 1);
+    coap_local_channel_close(&ch);
+
+    for (size_t i = 0; i < MAX_CHANNELS; ++i) {
+        kill(pids[i], SIGKILL);
+        waitpid(pids[i], NULL, 0);
+    }
+    for (int i = 0; (i < 10) && (local->lost < MAX_CHANNELS); ++i) {
+        _pump(local, 100);
+    }
+    CHECK(local->lost == MAX_CHANNELS);
+    for (size_t i = 0; i < MAX_CHANNELS; ++i) {
+        CHECK(!local->channels[i].shm);
+    }
+
+    // and served again
+    CHECK(coap_local_channel_open(&ch, fd, (struct sockaddr *)&server_addr,
+                                  server_addrlen) == COAP_SUCCESS);
+    _pump(local, 1000);
+    CHECK(local->attached - attached == MAX_CHANNELS + 1);
+    uint8_t *slot = coap_local_reserve(&ch, &size);
+    coap_local_commit(&ch, _request(slot, size, 20, COAP_METHOD_GET, "light", NULL, 0));
+    _pump(local, 1000);
+    CHECK(_response(&ch, &pkt) && (pkt.hdr.id == 20) && (pkt.hdr.code == COAP_RSPCODE_CONTENT));
+    coap_local_release(&ch);
+    coap_local_channel_close(&ch);
+    _pump(local, 1000);
+    CHECK(local->lost == MAX_CHANNELS);
+    close(fd);
+    close(ready_pipe[0]);
+    close(ready_pipe[1]);
+}
+
+static bool stop;
+
+static void *_server(void *arg)
+{
+    while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+        _pump(arg, 10);
+    }
+    return NULL;
+}
+
+static void _test_threads(coap_local_t *local)
+{
+    coap_local_channel_t ch;
+    pthread_t thread;
+    size_t size, len, sent = 0, received = 0, stalls = 0;
+    const int fd = coap_local_socket(NULL);
+
+    CHECK(coap_local_channel_open(&ch, fd, (struct sockaddr *)&server_addr,
+                                  server_addrlen) == COAP_SUCCESS);
+    pthread_create(&thread, NULL, _server, local);
+    while ((received < THREAD_REQUESTS) && (stalls < 10)) {
+        uint8_t *slot;
+        // up to half a ring ahead
+        while ((sent < THREAD_REQUESTS) && (sent - received < COAP_LOCAL_SLOTS / 2) &&
+               (slot = coap_local_reserve(&ch, &size))) {
+            coap_local_commit(&ch, _request(slot, size, (uint16_t)sent, COAP_METHOD_GET,
+                                            "light", NULL, 0));
+            sent++;
+        }
+        struct pollfd pfd = { ch.rxfd, POLLIN, 0 };
+        if (poll(&pfd, 1, 100) != 1) {
+            stalls++;
+            continue;
+        }
+        coap_local_wakeup(&ch);
+        const uint8_t *p;
+        while ((p = coap_local_peek(&ch, &len))) {
+            coap_packet_t pkt;
+            CHECK((coap_parse(p, len, &pkt) == COAP_SUCCESS) &&
+                  (pkt.hdr.id == (uint16_t)received));
+            coap_local_release(&ch);
+            received++;
+        }
+    }
+    __atomic_store_n(&stop, true, __ATOMIC_RELAXED);
+    pthread_join(thread, NULL);
+    CHECK(received == THREAD_REQUESTS);
+    CHECK(stalls == 0);
+    coap_local_channel_close(&ch);
+    close(fd);
+}
+
+/* --- MAIN ----------------------------------------------------------------- */
+int main(void)
+{
+    coap_local_t local;
+
+    snprintf(path, sizeof(path), "/tmp/yacoap-local-%d.sock", (int)getpid());
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sun_family = AF_UNIX;
+    strcpy(server_addr.sun_path, path);
+    server_addrlen = sizeof(server_addr);
+    const int fd = coap_local_socket(path);
+    CHECK(fd >= 0);
+    CHECK(coap_local_init(&local, fd, resources, MAX_CHANNELS) == COAP_SUCCESS);
+
+    _test_unix(&local);
+    _test_shm(&local);
+    _test_killed(&local);
+    _test_threads(&local);
+
+    coap_local_free(&local);
+    close(fd);
+    unlink(path);
+    printf("%s\n", failures ? "FAILED" : "PASSED");
+    return failures ? 1 : 0;
+}
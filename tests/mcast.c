@@ -0,0 +1,392 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+#include "coap.h"
+#include "coap_mcast.h"
+
+/*
+ * Tests multicast requests to the server: the responses suppressed by RFC
+ * 7252 section 8.2 and those sent non-confirmable, the random delays within
+ * the Leisure on the timer wheel, the timeout to poll for and a full pool;
+ * then requests sent to 224.0.1.187 over loopback and to ff02::fd on an
+ * interface with multicast, the first up or the one named on the command
+ * line, e.g. one end of a veth pair, told apart from unicast requests by
+ * their packet info and answered after the delay. Live parts are skipped if
+ * the host has no multicast route. Exits non-zero if any check fails.
+ */
+
+#define LEISURE_MS  1000
+#define WAIT_MS     3000
+
+static int failures;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+/* --- RESOURCES ------------------------------------------------------------ */
+static const coap_resource_path_t path_core = {2, {".well-known", "core"}};
+static const char core[] = "</sensors/temp>;rt=\"temperature\"";
+
+static int handle_get_core(const coap_resource_t *resource, const coap_packet_t *inpkt,
+                           coap_packet_t *pkt)
+{
+    return coap_make_response(inpkt->hdr.id, &inpkt->tok, COAP_TYPE_ACK,
+                              COAP_RSPCODE_CONTENT, resource->content_type,
+                              (const uint8_t *)core, sizeof(core) - 1, pkt);
+}
+
+static coap_resource_t resources[] =
+{
+    {COAP_RDY, COAP_METHOD_GET, COAP_TYPE_ACK, handle_get_core, &path_core,
+        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_APP_LINKFORMAT), NULL},
+    {(coap_state_t)0, (coap_method_t)0, (coap_msgtype_t)0, NULL, NULL,
+        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_NONE), NULL}
+};
+
+/* --- HELPERS -------------------------------------------------------------- */
+static void _request(coap_packet_t *pkt, const coap_msgtype_t type, const char *seg1,
+                     const char *seg2)
+{
+    static const uint8_t tok[2] = { 0x4d, 0x43 };
+    memset(pkt, 0, sizeof(*pkt));
+    pkt->hdr.ver = COAP_VERSION;
+    pkt->hdr.t = type;
+    pkt->hdr.code = COAP_METHOD_GET;
+    pkt->hdr.id = 0x1234;
+    pkt->hdr.tkl = sizeof(tok);
+    pkt->tok = (coap_buffer_t){ tok, sizeof(tok) };
+    coap_add_option(pkt, COAP_OPTION_URI_PATH, (const uint8_t *)seg1, strlen(seg1));
+    if (seg2) {
+        coap_add_option(pkt, COAP_OPTION_URI_PATH, (const uint8_t *)seg2, strlen(seg2));
+    }
+}
+
+/* a UDP socket on loopback and its address */
+static int _socket(const int family, struct sockaddr_storage *addr, socklen_t *len)
+{
+    const int fd = socket(family, SOCK_DGRAM, 0);
+    memset(addr, 0, sizeof(*addr));
+    addr->ss_family = (sa_family_t)family;
+    if (family == AF_INET) {
+        ((struct sockaddr_in *)addr)->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        *len = sizeof(struct sockaddr_in);
+    }
+    else {
+        const int off = 0;
+        setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+        *len = sizeof(struct sockaddr_in6);
+    }
+    if ((fd < 0) || bind(fd, (struct sockaddr *)addr, *len) ||
+        getsockname(fd, (struct sockaddr *)addr, len)) {
+        perror("socket");
+        exit(1);
+    }
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    return fd;
+}
+
+static size_t _drain(const int fd)
+{
+    uint8_t buf[COAP_MCAST_DGRAM_SIZE];
+    size_t n = 0;
+    while (recv(fd, buf, sizeof(buf), 0) >= 0) {
+        n++;
+    }
+    return n;
+}
+
+/* the first interface that is up and has multicast, besides loopback */
+static unsigned _mcast_if(void)
+{
+    struct if_nameindex *ifs = if_nameindex();
+    const int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    unsigned index = 0;
+
+    for (struct if_nameindex *i = ifs; i && i->if_index && !index; ++i) {
+        struct ifreq ifr;
+        memset(&ifr, 0, sizeof(ifr));
+        strncpy(ifr.ifr_name, i->if_name, IFNAMSIZ - 1);
+        if (!ioctl(fd, SIOCGIFFLAGS, &ifr) && (ifr.ifr_flags & IFF_UP) &&
+            (ifr.ifr_flags & IFF_MULTICAST) && !(ifr.ifr_flags & IFF_LOOPBACK)) {
+            index = i->if_index;
+        }
+    }
+    close(fd);
+    if_freenameindex(ifs);
+    return index;
+}
+
+/*
+ * Serves one datagram of \p srv as a server loop does: answered at once if
+ * unicast, through the multicast state otherwise. Returns whether it was
+ * multicast, -1 if nothing came.
+ */
+static int _serve(coap_mcast_t *mcast, const int srv, const uint32_t now)
+{
+    uint8_t buf[COAP_MCAST_DGRAM_SIZE];
+    struct sockaddr_storage from;
+    socklen_t fromlen = sizeof(from);
+    bool multicast;
+    coap_packet_t req, rsp;
+    size_t len = sizeof(buf);
+
+    for (int i = 0; i < WAIT_MS; ++i) {
+        const ssize_t n = coap_mcast_recvfrom(srv, buf, sizeof(buf), (struct sockaddr *)&from,
+                                              &fromlen, &multicast);
+        if (n < 0) {
+            usleep(1000);
+            continue;
+        }
+        if (coap_parse(buf, (size_t)n, &req) != COAP_SUCCESS) {
+            return -1;
+        }
+        coap_handle_request(resources, &req, &rsp);
+        if (multicast && (coap_mcast_response(mcast, &req, &rsp) != COAP_RSP_SEND)) {
+            return 1;
+        }
+        coap_build(&rsp, buf, &len);
+        if (multicast) {
+            coap_mcast_delay(mcast, buf, len, (struct sockaddr *)&from, fromlen, now);
+        }
+        else {
+            sendto(srv, buf, len, 0, (struct sockaddr *)&from, fromlen);
+        }
+        return multicast;
+    }
+    return -1;
+}
+
+/* the response to the client \p fd, waiting for the wheel of \p mcast */
+static bool _response(coap_mcast_t *mcast, const int fd, coap_packet_t *pkt,
+                      uint8_t *buf, const size_t size)
+{
+    for (uint32_t now = 0; now < WAIT_MS; ++now) {
+        coap_mcast_tick(mcast, now);
+        const ssize_t n = recv(fd, buf, size, 0);
+        if (n >= 0) {
+            return coap_parse(buf, (size_t)n, pkt) == COAP_SUCCESS;
+        }
+        usleep(1000);
+    }
+    return false;
+}
+
+/* --- TESTS ---------------------------------------------------------------- */
+static void _test_response(void)
+{
+    coap_mcast_t mcast;
+    coap_packet_t req, rsp;
+
+    CHECK(coap_mcast_init(&mcast, -1, 0, 0, 1) == COAP_SUCCESS);
+    CHECK(mcast.leisure_ms == COAP_MCAST_LEISURE_MS);
+    CHECK(coap_mcast_init(&mcast, -1, COAP_MCAST_SLOT_MS * COAP_MCAST_WHEEL_SLOTS, 0, 1) ==
+          COAP_ERR_BUFFER_TOO_SMALL);
+
+    CHECK(coap_mcast_init(&mcast, -1, LEISURE_MS, 0, 1) == COAP_SUCCESS);
+    const uint16_t msgid = mcast.msgid;
+    _request(&req, COAP_TYPE_NONCON, ".well-known", "core");
+    coap_handle_request(resources, &req, &rsp);
+    CHECK(coap_mcast_response(&mcast, &req, &rsp) == COAP_RSP_SEND);
+    CHECK((rsp.hdr.t == COAP_TYPE_NONCON) && (rsp.hdr.id == msgid) &&
+          (rsp.hdr.code == COAP_RSPCODE_CONTENT) && (rsp.tok.len == 2));
+    coap_handle_request(resources, &req, &rsp);
+    CHECK(coap_mcast_response(&mcast, &req, &rsp) == COAP_RSP_SEND);
+    CHECK(rsp.hdr.id == (uint16_t)(msgid + 1));
+
+    // multicast requests must not be confirmable
+    _request(&req, COAP_TYPE_CON, ".well-known", "core");
+    coap_handle_request(resources, &req, &rsp);
+    CHECK(coap_mcast_response(&mcast, &req, &rsp) == COAP_RSP_RECV);
+    // errors
+    _request(&req, COAP_TYPE_NONCON, "missing", NULL);
+    coap_handle_request(resources, &req, &rsp);
+    CHECK((rsp.hdr.code >> 5) == 4);
+    CHECK(coap_mcast_response(&mcast, &req, &rsp) == COAP_RSP_RECV);
+    coap_make_response(1, &req.tok, COAP_TYPE_ACK, COAP_RSPCODE_INTERNAL_SERVER_ERROR,
+                       NULL, NULL, 0, &rsp);
+    CHECK(coap_mcast_response(&mcast, &req, &rsp) == COAP_RSP_RECV);
+    // a discovery that found nothing, but 2.04 Changed needs no payload
+    coap_make_response(1, &req.tok, COAP_TYPE_ACK, COAP_RSPCODE_CONTENT, NULL, NULL, 0, &rsp);
+    CHECK(coap_mcast_response(&mcast, &req, &rsp) == COAP_RSP_RECV);
+    coap_make_response(1, &req.tok, COAP_TYPE_ACK, COAP_RSPCODE_CHANGED, NULL, NULL, 0, &rsp);
+    CHECK(coap_mcast_response(&mcast, &req, &rsp) == COAP_RSP_SEND);
+    CHECK((mcast.requests == 7) && (mcast.suppressed == 4));
+}
+
+static void _test_wheel(void)
+{
+    struct sockaddr_storage addr, unused;
+    socklen_t len, unusedlen;
+    const int rcv = _socket(AF_INET, &addr, &len);
+    const int snd = _socket(AF_INET, &unused, &unusedlen);
+    coap_mcast_t mcast;
+    const uint8_t dgram[4] = { 0x50, 0x45, 0x00, 0x01 };
+    uint32_t earliest = LEISURE_MS;
+    size_t sent = 0, early = 0;
+
+    // start near the wrap of the clock
+    const uint32_t start = UINT32_MAX - LEISURE_MS / 2;
+    CHECK(coap_mcast_init(&mcast, snd, LEISURE_MS, start, 7) == COAP_SUCCESS);
+    CHECK(coap_mcast_timeout(&mcast, start) == -1);
+    for (size_t i = 0; i < COAP_MCAST_PENDING; ++i) {
+        CHECK(coap_mcast_delay(&mcast, dgram, sizeof(dgram), (struct sockaddr *)&addr, len,
+                               start) == COAP_RSP_WAIT);
+    }
+    CHECK(coap_mcast_delay(&mcast, dgram, sizeof(dgram), (struct sockaddr *)&addr, len,
+                           start) == COAP_ERR_BUFFER_TOO_SMALL);
+    CHECK((mcast.pending == COAP_MCAST_PENDING) && (mcast.dropped == 1));
+    for (size_t i = 0; i < COAP_MCAST_PENDING; ++i) {
+        const uint32_t delay = mcast.pool[i].due - start;
+        CHECK(delay <= LEISURE_MS);
+        earliest = (delay < earliest) ? delay : earliest;
+        early += delay < LEISURE_MS / 2;
+    }
+    // spread over the Leisure
+    CHECK((early > COAP_MCAST_PENDING / 4) && (early < 3 * COAP_MCAST_PENDING / 4));
+    CHECK(coap_mcast_timeout(&mcast, start) == (int)earliest);
+
+    // nothing before it is due, all by the end of the Leisure
+    for (uint32_t t = 0; t <= LEISURE_MS; t += 5) {
+        const uint32_t now = start + t;
+        const int timeout = coap_mcast_timeout(&mcast, now);
+        const size_t n = coap_mcast_tick(&mcast, now);
+        CHECK(!n || (timeout == 0));
+        for (size_t i = 0; i < COAP_MCAST_PENDING; ++i) {
+            const coap_mcast_rsp_t *rsp = &mcast.pool[i];
+            bool waiting = false;
+            for (size_t s = 0; s < COAP_MCAST_WHEEL_SLOTS && !waiting; ++s) {
+                for (const coap_mcast_rsp_t *r = mcast.wheel[s]; r; r = r->next) {
+                    waiting |= r == rsp;
+                }
+            }
+            CHECK(!waiting || ((int32_t)(rsp->due - now) > 0));
+        }
+        sent += n;
+    }
+    CHECK((sent == COAP_MCAST_PENDING) && (mcast.sent == sent) && !mcast.pending);
+    CHECK(coap_mcast_timeout(&mcast, start + LEISURE_MS) == -1);
+    usleep(10000);
+    CHECK(_drain(rcv) == COAP_MCAST_PENDING);
+
+    // ticks after a long pause send what is overdue
+    CHECK(coap_mcast_delay(&mcast, dgram, sizeof(dgram), (struct sockaddr *)&addr, len,
+                           start + 2000) == COAP_RSP_WAIT);
+    CHECK(coap_mcast_tick(&mcast, start + 100000) == 1);
+    close(rcv);
+    close(snd);
+}
+
+static void _test_live(const int family, const unsigned ifindex)
+{
+    struct sockaddr_storage srvaddr, cliaddr, group;
+    socklen_t srvlen, clilen, grouplen;
+    const int srv = _socket(AF_INET6, &srvaddr, &srvlen);
+    const int cli = _socket(family, &cliaddr, &clilen);
+    const uint16_t port = ((struct sockaddr_in6 *)&srvaddr)->sin6_port;
+    uint8_t buf[COAP_MCAST_DGRAM_SIZE];
+    size_t len = sizeof(buf);
+    coap_mcast_t mcast;
+    coap_packet_t req, rsp;
+
+    memset(&group, 0, sizeof(group));
+    if (family == AF_INET) {
+        struct sockaddr_in *g = (struct sockaddr_in *)&group;
+        struct ip_mreqn mreq = { .imr_ifindex = (int)ifindex };
+        g->sin_family = AF_INET;
+        g->sin_port = port;
+        inet_pton(AF_INET, COAP_MCAST_IPV4, &g->sin_addr);
+        grouplen = sizeof(*g);
+        setsockopt(cli, IPPROTO_IP, IP_MULTICAST_IF, &mreq, sizeof(mreq));
+    }
+    else {
+        struct sockaddr_in6 *g = (struct sockaddr_in6 *)&group;
+        g->sin6_family = AF_INET6;
+        g->sin6_port = port;
+        inet_pton(AF_INET6, "ff02::fd", &g->sin6_addr);
+        g->sin6_scope_id = ifindex;
+        grouplen = sizeof(*g);
+        setsockopt(cli, IPPROTO_IPV6, IPV6_MULTICAST_IF, &ifindex, sizeof(ifindex));
+    }
+    CHECK(coap_mcast_init(&mcast, srv, 200, 0, 3) == COAP_SUCCESS);
+    _request(&req, COAP_TYPE_NONCON, ".well-known", "core");
+    coap_build(&req, buf, &len);
+    if ((coap_mcast_join(srv, ifindex, COAP_MCAST_SCOPE_LINK) != COAP_SUCCESS) ||
+        (sendto(cli, buf, len, 0, (struct sockaddr *)&group, grouplen) != (ssize_t)len)) {
+        printf("%s multicast: skipped, %s\n", (family == AF_INET) ? "IPv4" : "IPv6",
+               strerror(errno));
+        close(srv);
+        close(cli);
+        return;
+    }
+    // multicast, answered non-confirmable after the delay
+    CHECK(_serve(&mcast, srv, 0) == 1);
+    CHECK(mcast.pending == 1);
+    CHECK(_response(&mcast, cli, &rsp, buf, sizeof(buf)));
+    CHECK((rsp.hdr.t == COAP_TYPE_NONCON) && (rsp.hdr.code == COAP_RSPCODE_CONTENT) &&
+          (rsp.payload.len == sizeof(core) - 1) && (rsp.tok.len == 2));
+
+    // confirmable and not found multicast requests are not answered
+    _request(&req, COAP_TYPE_CON, ".well-known", "core");
+    len = sizeof(buf);
+    coap_build(&req, buf, &len);
+    sendto(cli, buf, len, 0, (struct sockaddr *)&group, grouplen);
+    CHECK(_serve(&mcast, srv, 0) == 1);
+    _request(&req, COAP_TYPE_NONCON, "missing", NULL);
+    len = sizeof(buf);
+    coap_build(&req, buf, &len);
+    sendto(cli, buf, len, 0, (struct sockaddr *)&group, grouplen);
+    CHECK(_serve(&mcast, srv, 0) == 1);
+    CHECK(!mcast.pending && (mcast.suppressed == 2));
+
+    // unicast to the same socket is answered at once, with the ACK
+    _request(&req, COAP_TYPE_CON, ".well-known", "core");
+    len = sizeof(buf);
+    coap_build(&req, buf, &len);
+    if (family == AF_INET) {
+        ((struct sockaddr_in *)&cliaddr)->sin_port = port;
+    }
+    else {
+        ((struct sockaddr_in6 *)&cliaddr)->sin6_port = port;
+        ((struct sockaddr_in6 *)&cliaddr)->sin6_addr = in6addr_loopback;
+    }
+    sendto(cli, buf, len, 0, (struct sockaddr *)&cliaddr, clilen);
+    CHECK(_serve(&mcast, srv, 0) == 0);
+    CHECK(_response(&mcast, cli, &rsp, buf, sizeof(buf)) && (rsp.hdr.t == COAP_TYPE_ACK));
+    CHECK(!_drain(cli));
+    printf("%s multicast: %u requests, %u suppressed, %u sent\n",
+           (family == AF_INET) ? "IPv4" : "IPv6", mcast.requests, mcast.suppressed, mcast.sent);
+    close(srv);
+    close(cli);
+}
+
+/* --- MAIN ----------------------------------------------------------------- */
+int main(int argc, char *argv[])
+{
+    const unsigned ifindex = (argc > 1) ? if_nametoindex(argv[1]) : _mcast_if();
+
+    _test_response();
+    _test_wheel();
+    _test_live(AF_INET, if_nametoindex("lo"));
+    if (ifindex) {
+        _test_live(AF_INET6, ifindex);
+    }
+    else {
+        printf("IPv6 multicast: skipped, no interface\n");
+    }
+    printf("%s\n", failures ? "FAILED" : "PASSED");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,374 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "coap.h"
+#include "coap_client.h"
+#include "coap_gw.h"
+#include "coap_http.h"
+#include "coap_metrics.h"
+
+/*
+ * Tests the metrics shards as threads come and go: rounds of threads, as
+ * many alive at a time as there are shards of their own, count concurrently
+ * and exit, far more threads over all rounds than there are shards. Each
+ * must get a shard of its own, one handed over from an exited thread, and
+ * one handed to a new thread while its owner still runs loses counts. Then
+ * more threads than shards at a time, so that some share the last one. The
+ * sums must match in every round, the shards in use count the threads of
+ * the round while they run and drop to none once they exited.
+ *
+ * Then the modules feeding the metrics, against loopback stand-ins: a
+ * confirmable request without answer is retransmitted, its observation
+ * raises the observer gauge until cancelled; the gateway misses its cache
+ * on the first GET and hits it on the second; the upstream pool of the
+ * HTTP proxy is busy during an exchange, open but idle after it and empty
+ * once closed. Exits non-zero if any check fails.
+ */
+
+#define ROUNDS      8
+#define INCREMENTS  200000
+#define WAIT_MS     2000
+
+static int failures;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+static pthread_barrier_t alive;
+static pthread_barrier_t done;
+static int answered;
+
+/* --- THREADS -------------------------------------------------------------- */
+/* all threads of a round have their shards before any exits */
+static void *_count(void *arg)
+{
+    (void)arg;
+    for (int i = 0; i < INCREMENTS; ++i) {
+        coap_metrics_add(COAP_METRIC_REQUESTS, 1);
+    }
+    coap_metrics_observe(COAP_HIST_HANDLER_NS, 1000);
+    pthread_barrier_wait(&alive);
+    pthread_barrier_wait(&done);
+    return NULL;
+}
+
+/* n threads at a time count, and exit */
+static void _round(const unsigned n)
+{
+    pthread_t threads[2 * COAP_METRICS_MAX_SHARDS];
+    const unsigned shared = (n > COAP_METRICS_MAX_SHARDS - 1) ? n - (COAP_METRICS_MAX_SHARDS - 1) : 0;
+    coap_metrics_snapshot_t snap;
+
+    coap_metrics_snapshot(&snap);
+    const uint64_t before = snap.counters[COAP_METRIC_REQUESTS];
+
+    pthread_barrier_init(&alive, NULL, n + 1);
+    pthread_barrier_init(&done, NULL, n + 1);
+    for (unsigned i = 0; i < n; ++i) {
+        CHECK(pthread_create(&threads[i], NULL, _count, NULL) == 0);
+    }
+    pthread_barrier_wait(&alive);
+    coap_metrics_snapshot(&snap);
+    CHECK(snap.shards == n);
+    CHECK(snap.shared == shared);
+    CHECK(snap.counters[COAP_METRIC_REQUESTS] - before == (uint64_t)n * INCREMENTS);
+    pthread_barrier_wait(&done);
+    for (unsigned i = 0; i < n; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_barrier_destroy(&alive);
+    pthread_barrier_destroy(&done);
+
+    // the shards went back with their threads, the counts stayed
+    coap_metrics_snapshot(&snap);
+    CHECK(snap.shards == 0);
+    CHECK(snap.shared == 0);
+    CHECK(snap.counters[COAP_METRIC_REQUESTS] - before == (uint64_t)n * INCREMENTS);
+}
+
+/* --- STAND-INS ----------------------------------------------------------- */
+static uint32_t _now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+static int _listen(const int type, struct sockaddr_in *addr)
+{
+    socklen_t len = sizeof(*addr);
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    const int fd = socket(AF_INET, type, 0);
+    if ((fd < 0) || bind(fd, (struct sockaddr *)addr, sizeof(*addr)) ||
+        ((type == SOCK_STREAM) && listen(fd, 4)) ||
+        getsockname(fd, (struct sockaddr *)addr, &len)) {
+        perror("loopback");
+        exit(1);
+    }
+    return fd;
+}
+
+static int64_t _gauge(const coap_gauge_t id)
+{
+    coap_metrics_snapshot_t snap;
+    coap_metrics_snapshot(&snap);
+    return snap.gauges[id];
+}
+
+static uint64_t _counter(const coap_metric_t id)
+{
+    coap_metrics_snapshot_t snap;
+    coap_metrics_snapshot(&snap);
+    return snap.counters[id];
+}
+
+/* answers all requests waiting on \p fd with "21", as notification if \p seq */
+static void _device(const int fd, const uint32_t seq)
+{
+    static const uint8_t age[] = { 60 };
+    uint8_t buf[1500], obs[4];
+    struct sockaddr_storage from;
+    socklen_t fromlen = sizeof(from);
+    coap_packet_t req, rsp;
+    ssize_t n;
+
+    while ((n = recvfrom(fd, buf, sizeof(buf), MSG_DONTWAIT,
+                         (struct sockaddr *)&from, &fromlen)) > 0) {
+        if (coap_parse(buf, (size_t)n, &req) == COAP_SUCCESS) {
+            size_t len = sizeof(buf);
+            coap_make_response(req.hdr.id, &req.tok,
+                               (req.hdr.t == COAP_TYPE_CON) ? COAP_TYPE_ACK : COAP_TYPE_NONCON,
+                               COAP_RSPCODE_CONTENT, NULL, (const uint8_t *)"21", 2, &rsp);
+            if (seq) {
+                coap_add_option(&rsp, COAP_OPTION_OBSERVE, obs, coap_encode_uint(seq, obs));
+            }
+            coap_add_option(&rsp, COAP_OPTION_MAX_AGE, age, sizeof(age));
+            if (coap_build(&rsp, buf, &len) == COAP_SUCCESS) {
+                sendto(fd, buf, len, 0, (struct sockaddr *)&from, fromlen);
+            }
+        }
+        fromlen = sizeof(from);
+    }
+}
+
+static void _answered(void *arg, const coap_state_t state, const coap_packet_t *rsp)
+{
+    (void)arg;
+    (void)rsp;
+    answered += (state == COAP_RSP_RECV);
+}
+
+static void _proxied(void *ctx, const struct sockaddr *addr, const socklen_t addrlen,
+                     const coap_packet_t *pkt)
+{
+    (void)ctx;
+    (void)addr;
+    (void)addrlen;
+    answered += (pkt->hdr.code == COAP_RSPCODE_CONTENT);
+}
+
+/* --- TESTS ---------------------------------------------------------------- */
+static void _test_churn(void)
+{
+    for (int r = 0; r < ROUNDS; ++r) {
+        _round(COAP_METRICS_MAX_SHARDS - 1);
+    }
+
+    coap_metrics_snapshot_t snap;
+    coap_metrics_snapshot(&snap);
+    CHECK(snap.counters[COAP_METRIC_REQUESTS] ==
+          (uint64_t)ROUNDS * (COAP_METRICS_MAX_SHARDS - 1) * INCREMENTS);
+    CHECK(snap.hist_sum[COAP_HIST_HANDLER_NS] ==
+          (uint64_t)ROUNDS * (COAP_METRICS_MAX_SHARDS - 1) * 1000);
+}
+
+static void _test_shared(void)
+{
+    _round(2 * COAP_METRICS_MAX_SHARDS);
+    // all shards are free again
+    _round(COAP_METRICS_MAX_SHARDS - 1);
+}
+
+static void _test_client(void)
+{
+    static const uint8_t zero[] = { 0 };
+    static coap_client_t client;
+    struct sockaddr_in addr;
+    struct pollfd pfd;
+    coap_packet_t req;
+
+    const int fd = _listen(SOCK_DGRAM, &addr);
+    CHECK(coap_client_init(&client, 1) == COAP_SUCCESS);
+    const uint64_t retransmits = _counter(COAP_METRIC_RETRANSMITS);
+    memset(&req, 0, sizeof(req));
+    req.hdr.ver = COAP_VERSION;
+    req.hdr.t = COAP_TYPE_CON;
+    req.hdr.code = COAP_METHOD_GET;
+    coap_add_option(&req, COAP_OPTION_OBSERVE, zero, 0);
+    coap_add_option(&req, COAP_OPTION_URI_PATH, (const uint8_t *)"temp", 4);
+    const int handle = coap_client_send(&client, &req, (struct sockaddr *)&addr,
+                                        sizeof(addr), 0, _answered, NULL);
+    CHECK(handle >= 0);
+
+    // unanswered past the longest first timeout
+    coap_client_process(&client, 2 * COAP_CLIENT_ACK_TIMEOUT_MS);
+    CHECK(_counter(COAP_METRIC_RETRANSMITS) - retransmits == 1);
+    CHECK(_gauge(COAP_GAUGE_OBSERVERS) == 0);
+
+    // both copies are answered, the second one is a duplicate
+    _device(fd, 2);
+    pfd.fd = client.fd;
+    pfd.events = POLLIN;
+    CHECK(poll(&pfd, 1, WAIT_MS) == 1);
+    coap_client_process(&client, 2 * COAP_CLIENT_ACK_TIMEOUT_MS + 1);
+    CHECK(answered == 1);
+    CHECK(_gauge(COAP_GAUGE_OBSERVERS) == 1);
+    coap_client_cancel(&client, handle);
+    CHECK(_gauge(COAP_GAUGE_OBSERVERS) == 0);
+    coap_client_cancel(&client, handle);
+    CHECK(_gauge(COAP_GAUGE_OBSERVERS) == 0);
+
+    coap_client_close(&client);
+    close(fd);
+}
+
+static void _test_gateway(void)
+{
+    static coap_client_t client;
+    static coap_gw_t gw;
+    struct sockaddr_in dev, http;
+    char buf[4096];
+
+    const int fd = _listen(SOCK_DGRAM, &dev);
+    const int lfd = _listen(SOCK_STREAM, &http);
+    if ((coap_client_init(&client, 2) != COAP_SUCCESS) ||
+        (coap_gw_init(&gw, lfd, &client, 4) != COAP_SUCCESS)) {
+        CHECK(!"gateway init");
+        return;
+    }
+    const uint64_t hits = _counter(COAP_METRIC_CACHE_HIT);
+    const uint64_t misses = _counter(COAP_METRIC_CACHE_MISS);
+    const int viewer = socket(AF_INET, SOCK_STREAM, 0);
+    CHECK(!connect(viewer, (struct sockaddr *)&http, sizeof(http)));
+
+    for (int i = 0; i < 2; ++i) {
+        const int n = snprintf(buf, sizeof(buf), "GET /coap/127.0.0.1:%u/temp HTTP/1.1\r\n"
+                               "Host: gw\r\n\r\n", ntohs(dev.sin_port));
+        send(viewer, buf, (size_t)n, 0);
+        size_t len = 0;
+        buf[0] = '\0';
+        const uint32_t start = _now_ms();
+        while (!strstr(buf, "\r\n\r\n21") && (_now_ms() - start < WAIT_MS)) {
+            struct pollfd fds[8];
+            size_t nfds = coap_gw_pollfds(&gw, fds, 6);
+            const size_t ngw = nfds;
+            fds[nfds].fd = client.fd;
+            fds[nfds++].events = POLLIN;
+            fds[nfds].fd = fd;
+            fds[nfds++].events = POLLIN;
+            poll(fds, nfds, 10);
+            _device(fd, 0);
+            coap_gw_process(&gw, fds, ngw, _now_ms());
+            coap_client_process(&client, _now_ms());
+            const ssize_t r = recv(viewer, buf + len, sizeof(buf) - 1 - len, MSG_DONTWAIT);
+            if (r > 0) {
+                len += (size_t)r;
+                buf[len] = '\0';
+            }
+        }
+        CHECK(strstr(buf, "\r\n\r\n21") != NULL);
+    }
+    CHECK(_counter(COAP_METRIC_CACHE_MISS) - misses == 1);
+    CHECK(_counter(COAP_METRIC_CACHE_HIT) - hits == 1);
+
+    close(viewer);
+    coap_gw_free(&gw);
+    coap_client_close(&client);
+    close(lfd);
+    close(fd);
+}
+
+static void _test_pool(void)
+{
+    static const coap_http_route_t routes[] = { {"api", ""} };
+    static const char ok[] = "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\n21";
+    static coap_http_proxy_t proxy;
+    struct sockaddr_in upstream, peer;
+    coap_packet_t req, rsp;
+    char buf[2048];
+
+    const int lfd = _listen(SOCK_STREAM, &upstream);
+    memset(&peer, 0, sizeof(peer));
+    peer.sin_family = AF_INET;
+    peer.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    peer.sin_port = htons(COAP_DEFAULT_PORT + 1);
+    coap_http_proxy_init(&proxy, routes, 1, (struct sockaddr *)&upstream,
+                         sizeof(upstream), "localhost");
+    memset(&req, 0, sizeof(req));
+    req.hdr.ver = COAP_VERSION;
+    req.hdr.t = COAP_TYPE_NONCON;
+    req.hdr.code = COAP_METHOD_GET;
+    req.hdr.id = 1;
+    coap_add_option(&req, COAP_OPTION_URI_PATH, (const uint8_t *)"api", 3);
+    answered = 0;
+    CHECK(coap_http_proxy_request(&proxy, &req, (struct sockaddr *)&peer, sizeof(peer),
+                                  _now_ms(), &rsp) == COAP_RSP_WAIT);
+    coap_http_proxy_process(&proxy, _now_ms(), _proxied, NULL);
+    CHECK(_gauge(COAP_GAUGE_HTTP_POOL_OPEN) == 1);
+    CHECK(_gauge(COAP_GAUGE_HTTP_POOL_BUSY) == 1);
+
+    // the stand-in upstream answers once the request is in
+    int fd = -1;
+    const uint32_t start = _now_ms();
+    while (!answered && (_now_ms() - start < WAIT_MS)) {
+        struct pollfd fds[COAP_HTTP_POOL_SIZE + 1];
+        const size_t n = coap_http_proxy_pollfds(&proxy, fds, COAP_HTTP_POOL_SIZE);
+        fds[n].fd = (fd < 0) ? lfd : fd;
+        fds[n].events = POLLIN;
+        poll(fds, n + 1, 10);
+        if ((fd < 0) && fds[n].revents) {
+            fd = accept(lfd, NULL, NULL);
+        }
+        else if ((fd >= 0) && fds[n].revents && (recv(fd, buf, sizeof(buf), 0) > 0)) {
+            send(fd, ok, sizeof(ok) - 1, 0);
+        }
+        coap_http_proxy_process(&proxy, _now_ms(), _proxied, NULL);
+    }
+    CHECK(answered == 1);
+    CHECK(_gauge(COAP_GAUGE_HTTP_POOL_OPEN) == 1);
+    CHECK(_gauge(COAP_GAUGE_HTTP_POOL_BUSY) == 0);
+
+    coap_http_proxy_close(&proxy);
+    CHECK(_gauge(COAP_GAUGE_HTTP_POOL_OPEN) == 0);
+    CHECK(_gauge(COAP_GAUGE_HTTP_POOL_BUSY) == 0);
+    close(fd);
+    close(lfd);
+}
+
+int main(void)
+{
+    _test_churn();
+    _test_shared();
+    // the main thread takes a shard from here on
+    _test_client();
+    _test_gateway();
+    _test_pool();
+
+    printf("%s\n", failures ? "FAILED" : "PASSED");
+    return failures ? 1 : 0;
+}
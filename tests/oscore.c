@@ -0,0 +1,395 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "coap.h"
+#include "coap_oscore.h"
+
+/*
+ * Tests OSCORE: the key derivation and message protection against the test
+ * vectors of RFC 8613 Appendix C, round trips of requests, responses and
+ * notifications with the options of each class and payloads of all lengths
+ * up to a block on AES-NI and the portable AES, the replay window, tampered
+ * messages and the rejected ones. Exits non-zero if any check fails.
+ */
+
+#define ROUND_TRIP_MAX  1100    //!< payload lengths tried
+
+static int failures;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+static const uint8_t master_secret[] = {
+    0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08,
+    0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x10,
+};
+static const uint8_t master_salt[] = { 0x9e, 0x7c, 0xa9, 0x22, 0x23, 0x78, 0x63, 0x40 };
+static const uint8_t id_context[] = { 0x37, 0xcb, 0xf3, 0x21, 0x00, 0x17, 0xa2, 0xd3 };
+static const uint8_t id_00[] = { 0x00 };
+static const uint8_t id_01[] = { 0x01 };
+static const uint8_t id_none[1];
+
+/* --- HELPERS -------------------------------------------------------------- */
+static size_t _hex(const char *hex, uint8_t *out)
+{
+    size_t n = 0;
+    for (; hex[0] && hex[1]; hex += 2) {
+        unsigned v;
+        sscanf(hex, "%2x", &v);
+        out[n++] = (uint8_t)v;
+    }
+    return n;
+}
+
+static bool _equals_hex(const uint8_t *p, const size_t len, const char *hex)
+{
+    uint8_t want[256];
+    return (_hex(hex, want) == len) && !memcmp(p, want, len);
+}
+
+static void _params(coap_oscore_params_t *params, const uint8_t *salt, const size_t saltlen,
+                    const uint8_t *sender, const size_t senderlen,
+                    const uint8_t *recipient, const size_t recipientlen, const bool ctx)
+{
+    memset(params, 0, sizeof(*params));
+    params->master_secret = (coap_buffer_t){ master_secret, sizeof(master_secret) };
+    params->master_salt = (coap_buffer_t){ salt, saltlen };
+    params->sender_id = (coap_buffer_t){ sender, senderlen };
+    params->recipient_id = (coap_buffer_t){ recipient, recipientlen };
+    if (ctx) {
+        params->id_context = (coap_buffer_t){ id_context, sizeof(id_context) };
+    }
+}
+
+/* client and server of RFC 8613 Appendix C.1 */
+static void _pair(coap_oscore_ctx_t *client, coap_oscore_ctx_t *server, const bool ctx)
+{
+    coap_oscore_params_t params;
+    _params(&params, master_salt, sizeof(master_salt), id_none, 0, id_01, 1, ctx);
+    CHECK(coap_oscore_derive(client, &params) == COAP_SUCCESS);
+    _params(&params, master_salt, sizeof(master_salt), id_01, 1, id_none, 0, ctx);
+    CHECK(coap_oscore_derive(server, &params) == COAP_SUCCESS);
+}
+
+/* --- TESTS ---------------------------------------------------------------- */
+static void _test_derive(void)
+{
+    coap_oscore_ctx_t client, server, ctx;
+    coap_oscore_params_t params;
+
+    // C.1 with master salt
+    _pair(&client, &server, false);
+    CHECK(_equals_hex(client.sender_key, 16, "f0910ed7295e6ad4b54fc793154302ff"));
+    CHECK(_equals_hex(client.recipient_key, 16, "ffb14e093c94c9cac9471648b4f98710"));
+    CHECK(_equals_hex(client.common_iv, 13, "4622d4dd6d944168eefb54987c"));
+    CHECK(!memcmp(server.sender_key, client.recipient_key, 16));
+    CHECK(!memcmp(server.recipient_key, client.sender_key, 16));
+    // C.2 without master salt
+    _params(&params, NULL, 0, id_00, 1, id_01, 1, false);
+    CHECK(coap_oscore_derive(&ctx, &params) == COAP_SUCCESS);
+    CHECK(_equals_hex(ctx.sender_key, 16, "321b26943253c7ffb6003b0b64d74041"));
+    CHECK(_equals_hex(ctx.recipient_key, 16, "e57b5635815177cd679ab4bcec9d7dda"));
+    CHECK(_equals_hex(ctx.common_iv, 13, "be35ae297d2dace910c52e99f9"));
+    // C.3 with ID context
+    _pair(&client, &server, true);
+    CHECK(_equals_hex(client.sender_key, 16, "af2a1300a5e95788b356336eeecd2b92"));
+    CHECK(_equals_hex(client.recipient_key, 16, "e39a0c7c77b43f03b4b39ab9a268699f"));
+    CHECK(_equals_hex(client.common_iv, 13, "2ca58fb85ff1b81c0b7181b85e"));
+
+    _params(&params, NULL, 0, master_secret, COAP_OSCORE_MAX_ID + 1, id_01, 1, false);
+    CHECK(coap_oscore_derive(&ctx, &params) == COAP_ERR_SECURITY_CONTEXT);
+    _params(&params, NULL, 0, id_00, 1, id_01, 1, false);
+    params.master_secret.len = 0;
+    CHECK(coap_oscore_derive(&ctx, &params) == COAP_ERR_SECURITY_CONTEXT);
+}
+
+/* request of C.4 and response of C.7, on both AES implementations */
+static void _test_vectors(const bool aesni)
+{
+    static const char *request_plain = "44015d1f00003974396c6f63616c686f737483747631";
+    static const char *request_protected =
+        "44025d1f00003974396c6f63616c686f7374620914ff612f1092f1776f1c1668b3825e";
+    static const char *response_plain = "64455d1f00003974ff48656c6c6f20576f726c6421";
+    static const char *response_protected =
+        "64445d1f0000397490ffdbaad1e9a7e7b2a813d3c31524378303cdafae119106";
+    coap_oscore_ctx_t client, server;
+    coap_oscore_request_t sent, received;
+    uint8_t buf[256];
+    size_t len;
+
+    _pair(&client, &server, false);
+    client.aesni &= aesni;
+    server.aesni &= aesni;
+    client.sender_seq = 20;
+
+    len = _hex(request_plain, buf);
+    CHECK(coap_oscore_protect(&client, buf, &len, sizeof(buf), &sent) == COAP_SUCCESS);
+    CHECK(_equals_hex(buf, len, request_protected));
+    CHECK(client.sender_seq == 21);
+    CHECK((sent.kidlen == 0) && (sent.pivlen == 1) && (sent.piv[0] == 0x14));
+    CHECK(coap_oscore_unprotect(&server, buf, &len, &received) == COAP_SUCCESS);
+    CHECK(_equals_hex(buf, len, request_plain));
+    CHECK((received.kidlen == 0) && (received.pivlen == 1) && (received.piv[0] == 0x14));
+
+    len = _hex(response_plain, buf);
+    CHECK(coap_oscore_protect(&server, buf, &len, sizeof(buf), &received) == COAP_SUCCESS);
+    CHECK(_equals_hex(buf, len, response_protected));
+    CHECK(server.sender_seq == 0);
+    CHECK(coap_oscore_unprotect(&client, buf, &len, &sent) == COAP_SUCCESS);
+    CHECK(_equals_hex(buf, len, response_plain));
+
+    // a replayed request
+    len = _hex(request_protected, buf);
+    CHECK(coap_oscore_unprotect(&server, buf, &len, &received) == COAP_ERR_REPLAY);
+}
+
+static void _build(coap_packet_t *pkt, const uint8_t code, const bool observe,
+                   const uint8_t *payload, const size_t len)
+{
+    static const uint8_t tok[4] = { 0xca, 0xfe, 0xba, 0xbe };
+    static const uint8_t obs[1] = { 7 };
+    static const uint8_t port[2] = { 0x16, 0x33 };
+    static const uint8_t ct[1] = { COAP_CONTENTTYPE_APP_JSON };
+    static const uint8_t block2[1] = { 0x06 };
+
+    memset(pkt, 0, sizeof(*pkt));
+    pkt->hdr.ver = 1;
+    pkt->hdr.t = COAP_TYPE_CON;
+    pkt->hdr.tkl = sizeof(tok);
+    pkt->hdr.code = code;
+    pkt->hdr.id = 0x1234;
+    pkt->tok = (coap_buffer_t){ tok, sizeof(tok) };
+    coap_add_option(pkt, COAP_OPTION_URI_HOST, (const uint8_t *)"example.com", 11);
+    if (observe) {
+        coap_add_option(pkt, COAP_OPTION_OBSERVE, obs, sizeof(obs));
+    }
+    coap_add_option(pkt, COAP_OPTION_URI_PORT, port, sizeof(port));
+    coap_add_option(pkt, COAP_OPTION_URI_PATH, (const uint8_t *)"sensors", 7);
+    coap_add_option(pkt, COAP_OPTION_CONTENT_FORMAT, ct, sizeof(ct));
+    coap_add_option(pkt, COAP_OPTION_BLOCK2, block2, sizeof(block2));
+    coap_add_option(pkt, COAP_OPTION_PROXY_SCHEME, (const uint8_t *)"coap", 4);
+    pkt->payload = (coap_buffer_t){ payload, len };
+}
+
+/* \p msg protected by \p from and unprotected by \p to gives \p msg again */
+static bool _round_trip(coap_oscore_ctx_t *from, coap_oscore_ctx_t *to,
+                        const uint8_t *msg, const size_t msglen, uint8_t *out,
+                        size_t *outlen, coap_oscore_request_t *sent,
+                        coap_oscore_request_t *received)
+{
+    uint8_t buf[1536];
+    size_t len = msglen;
+
+    memcpy(buf, msg, msglen);
+    if ((coap_oscore_protect(from, buf, &len, sizeof(buf), sent) != COAP_SUCCESS) ||
+        (len > msglen + COAP_OSCORE_OVERHEAD)) {
+        return false;
+    }
+    memcpy(out, buf, len);
+    *outlen = len;
+    return (coap_oscore_unprotect(to, buf, &len, received) == COAP_SUCCESS) &&
+           (len == msglen) && !memcmp(buf, msg, len);
+}
+
+static void _test_round_trip(void)
+{
+    coap_oscore_ctx_t client[2], server[2];
+    coap_oscore_request_t sent, received;
+    coap_packet_t pkt, parsed;
+    uint8_t payload[ROUND_TRIP_MAX], msg[1536], out[2][1536];
+    size_t outlen[2];
+    int bad = 0;
+
+    for (size_t i = 0; i < sizeof(payload); ++i) {
+        payload[i] = (uint8_t)(i * 7 + 3);
+    }
+    // the same messages with AES-NI where available and with the portable AES
+    for (int i = 0; i < 2; ++i) {
+        _pair(&client[i], &server[i], true);
+        client[i].aesni &= !i;
+        server[i].aesni &= !i;
+    }
+    for (size_t n = 0; n < sizeof(payload); ++n) {
+        const bool observe = n & 1;
+        size_t msglen = sizeof(msg);
+        _build(&pkt, observe ? COAP_METHOD_GET : COAP_METHOD_PUT, observe, payload, n);
+        CHECK(coap_build(&pkt, msg, &msglen) == COAP_SUCCESS);
+        for (int i = 0; i < 2; ++i) {
+            bad += !_round_trip(&client[i], &server[i], msg, msglen, out[i], &outlen[i],
+                                &sent, &received);
+        }
+        bad += (outlen[0] != outlen[1]) || memcmp(out[0], out[1], outlen[0]);
+        // the outer request is a POST, or a FETCH with Observe, for proxies
+        CHECK(coap_parse(out[0], outlen[0], &parsed) == COAP_SUCCESS);
+        bad += parsed.hdr.code != (observe ? 5 : COAP_METHOD_POST);
+        bad += !coap_find_options(&parsed, COAP_OPTION_URI_HOST, &(uint8_t){0}) ||
+               !coap_find_options(&parsed, COAP_OPTION_OSCORE, &(uint8_t){0}) ||
+               coap_find_options(&parsed, COAP_OPTION_URI_PATH, &(uint8_t){0});
+
+        // the response, a notification with a Partial IV of its own for Observe
+        msglen = sizeof(msg);
+        _build(&pkt, COAP_RSPCODE_CONTENT, observe, payload, sizeof(payload) - 1 - n);
+        CHECK(coap_build(&pkt, msg, &msglen) == COAP_SUCCESS);
+        const uint64_t seq = server[0].sender_seq;
+        for (int i = 0; i < 2; ++i) {
+            bad += !_round_trip(&server[i], &client[i], msg, msglen, out[i], &outlen[i],
+                                &received, &sent);
+        }
+        bad += (outlen[0] != outlen[1]) || memcmp(out[0], out[1], outlen[0]);
+        bad += server[0].sender_seq != seq + observe;
+        CHECK(coap_parse(out[0], outlen[0], &parsed) == COAP_SUCCESS);
+        bad += parsed.hdr.code != (observe ? COAP_RSPCODE_CONTENT : COAP_RSPCODE_CHANGED);
+    }
+    CHECK(!bad);
+    printf("round trip: %zu requests and responses, aesni %s\n", sizeof(payload),
+           client[0].aesni ? "yes" : "no");
+}
+
+static void _test_replay(void)
+{
+    coap_oscore_ctx_t client, server;
+    coap_oscore_request_t req;
+    uint8_t saved[200][64], buf[64];
+    size_t savedlen[200];
+
+    _pair(&client, &server, false);
+    for (int i = 0; i < 200; ++i) {
+        savedlen[i] = _hex("44015d1f00003974396c6f63616c686f737483747631", saved[i]);
+        CHECK(coap_oscore_protect(&client, saved[i], &savedlen[i], sizeof(saved[i]), &req) ==
+              COAP_SUCCESS);
+    }
+#define UNPROTECT(i) (memcpy(buf, saved[i], savedlen[i]), \
+                      coap_oscore_unprotect(&server, buf, &(size_t){savedlen[i]}, &req))
+    // out of order within the window, each once
+    CHECK(UNPROTECT(100) == COAP_SUCCESS);
+    CHECK(UNPROTECT(90) == COAP_SUCCESS);
+    CHECK(UNPROTECT(37) == COAP_SUCCESS);
+    CHECK(UNPROTECT(90) == COAP_ERR_REPLAY);
+    CHECK(UNPROTECT(100) == COAP_ERR_REPLAY);
+    CHECK(UNPROTECT(36) == COAP_ERR_REPLAY);
+    CHECK(UNPROTECT(101) == COAP_SUCCESS);
+    CHECK(UNPROTECT(38) == COAP_SUCCESS);
+    CHECK(UNPROTECT(37) == COAP_ERR_REPLAY);
+    // a jump beyond the window forgets everything below it
+    CHECK(UNPROTECT(199) == COAP_SUCCESS);
+    CHECK(UNPROTECT(135) == COAP_ERR_REPLAY);
+    CHECK(UNPROTECT(136) == COAP_SUCCESS);
+    CHECK(UNPROTECT(198) == COAP_SUCCESS);
+    CHECK(UNPROTECT(198) == COAP_ERR_REPLAY);
+    // a forged message does not move the window
+    memcpy(buf, saved[150], savedlen[150]);
+    buf[savedlen[150] - 1] ^= 1;
+    CHECK(coap_oscore_unprotect(&server, buf, &(size_t){savedlen[150]}, &req) == COAP_ERR_DECRYPT);
+    CHECK(UNPROTECT(150) == COAP_SUCCESS);
+#undef UNPROTECT
+    CHECK(server.replay_max == 199);
+}
+
+static void _test_tamper(void)
+{
+    coap_oscore_ctx_t client, server;
+    coap_oscore_request_t req;
+    uint8_t msg[128], buf[128];
+    size_t len, ok = 0;
+
+    _pair(&client, &server, false);
+    len = _hex("44015d1f00003974396c6f63616c686f737483747631ff7061796c6f6164", msg);
+    CHECK(coap_oscore_protect(&client, msg, &len, sizeof(msg), &req) == COAP_SUCCESS);
+    // every bit of the OSCORE option, ciphertext and tag
+    for (size_t i = 4 + 4 + 10; i < len; ++i) {
+        for (int bit = 0; bit < 8; ++bit) {
+            size_t n = len;
+            memcpy(buf, msg, len);
+            buf[i] ^= (uint8_t)(1 << bit);
+            ok += coap_oscore_unprotect(&server, buf, &n, &req) == COAP_SUCCESS;
+        }
+    }
+    CHECK(!ok);
+    // a truncated message
+    for (size_t n = 0; n < len; ++n) {
+        size_t m = n;
+        memcpy(buf, msg, n);
+        CHECK(coap_oscore_unprotect(&server, buf, &m, &req) != COAP_SUCCESS);
+    }
+    memcpy(buf, msg, len);
+    CHECK(coap_oscore_unprotect(&server, buf, &len, &req) == COAP_SUCCESS);
+}
+
+static void _test_errors(void)
+{
+    coap_oscore_ctx_t client, server, other;
+    coap_oscore_request_t req;
+    coap_oscore_params_t params;
+    uint8_t buf[128];
+    size_t len;
+
+    _pair(&client, &server, false);
+    // Proxy-Uri, an empty message, a protected message and no response binding
+    len = _hex("44015d1f00003974d81663636f61703a2f2f78", buf);
+    CHECK(coap_oscore_protect(&client, buf, &len, sizeof(buf), &req) == COAP_ERR_UNSUPPORTED);
+    len = _hex("40005d1f", buf);
+    CHECK(coap_oscore_protect(&client, buf, &len, sizeof(buf), &req) == COAP_ERR_UNSUPPORTED);
+    len = _hex("44025d1f00003974920914ff612f", buf);
+    CHECK(coap_oscore_protect(&client, buf, &len, sizeof(buf), &req) == COAP_ERR_UNSUPPORTED);
+    len = _hex("64455d1f00003974", buf);
+    CHECK(coap_oscore_protect(&client, buf, &len, sizeof(buf), NULL) == COAP_ERR_REQUEST_NOT_FOUND);
+    len = _hex("58015d1f00003974", buf);
+    CHECK(coap_oscore_protect(&client, buf, &len, sizeof(buf), &req) == COAP_ERR_TOKEN_TOO_SHORT);
+    // too small a buffer, or too many options of class U
+    len = _hex("44015d1f00003974396c6f63616c686f737483747631", buf);
+    CHECK(coap_oscore_protect(&client, buf, &len, len + 8, &req) == COAP_ERR_BUFFER_TOO_SMALL);
+    len = _hex("44015d1f00003974316101610161016101610161", buf);
+    CHECK(coap_oscore_protect(&client, buf, &len, sizeof(buf), &req) == COAP_ERR_BUFFER_TOO_SMALL);
+    // no OSCORE option, and a request for another recipient or ID context
+    len = _hex("44015d1f00003974396c6f63616c686f737483747631", buf);
+    CHECK(coap_oscore_unprotect(&server, buf, &len, &req) == COAP_ERR_OPTION_NOT_FOUND);
+    len = _hex("44015d1f00003974b3747631", buf);
+    CHECK(coap_oscore_protect(&client, buf, &len, sizeof(buf), &req) == COAP_SUCCESS);
+    CHECK(coap_oscore_unprotect(&client, buf, &len, &req) == COAP_ERR_SECURITY_CONTEXT);
+    _pair(&other, &server, true);
+    len = _hex("44015d1f00003974b3747631", buf);
+    CHECK(coap_oscore_protect(&other, buf, &len, sizeof(buf), &req) == COAP_SUCCESS);
+    _pair(&client, &server, false);
+    CHECK(coap_oscore_unprotect(&server, buf, &len, &req) == COAP_ERR_SECURITY_CONTEXT);
+    // reserved flags and a Partial IV longer than the option
+    len = _hex("44025d1f00003974922914ff612f1092f1776f1c1668b3825e", buf);
+    CHECK(coap_oscore_unprotect(&server, buf, &len, &req) == COAP_ERR_PAYLOAD_INVALID);
+    len = _hex("44025d1f00003974920614ff612f1092f1776f1c1668b3825e", buf);
+    CHECK(coap_oscore_unprotect(&server, buf, &len, &req) == COAP_ERR_PAYLOAD_INVALID);
+    // a response without Partial IV is bound to its request
+    len = _hex("64455d1f00003974ff48656c6c6f", buf);
+    req = (coap_oscore_request_t){ .pivlen = 1, .piv = { 0x14 } };
+    CHECK(coap_oscore_protect(&server, buf, &len, sizeof(buf), &req) == COAP_SUCCESS);
+    req.piv[0] = 0x15;
+    CHECK(coap_oscore_unprotect(&client, buf, &len, &req) == COAP_ERR_DECRYPT);
+    // the last sequence number
+    _params(&params, master_salt, sizeof(master_salt), id_none, 0, id_01, 1, false);
+    CHECK(coap_oscore_derive(&client, &params) == COAP_SUCCESS);
+    client.sender_seq = COAP_OSCORE_MAX_SEQ;
+    len = _hex("44015d1f00003974b3747631", buf);
+    CHECK(coap_oscore_protect(&client, buf, &len, sizeof(buf), &req) == COAP_SUCCESS);
+    CHECK((req.pivlen == COAP_OSCORE_MAX_PIV) && (req.piv[0] == 0xff));
+    CHECK(coap_oscore_unprotect(&server, buf, &len, &req) == COAP_SUCCESS);
+    len = _hex("44015d1f00003974b3747631", buf);
+    CHECK(coap_oscore_protect(&client, buf, &len, sizeof(buf), &req) == COAP_ERR_SECURITY_CONTEXT);
+}
+
+/* --- MAIN ----------------------------------------------------------------- */
+int main(void)
+{
+    _test_derive();
+    _test_vectors(true);
+    _test_vectors(false);
+    _test_round_trip();
+    _test_replay();
+    _test_tamper();
+    _test_errors();
+    printf("%s\n", failures ? "FAILED" : "PASSED");
+    return failures ? 1 : 0;
+}
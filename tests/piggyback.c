@@ -3,6 +3,7 @@
 #include <netinet/in.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <string.h>
 #include <strings.h>
 
 #include "coap.h"
@@ -53,16 +54,16 @@ coap_resource_t resources[] =
 {
     {COAP_RDY, COAP_METHOD_GET, COAP_TYPE_ACK,
         handle_get_well_known_core, &path_well_known_core,
-        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_APP_LINKFORMAT)},
+        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_APP_LINKFORMAT), NULL},
     {COAP_RDY, COAP_METHOD_GET, COAP_TYPE_ACK,
         handle_get_piggyback, &path_piggyback,
-        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_TXT_PLAIN)},
+        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_TXT_PLAIN), NULL},
     {COAP_RDY, COAP_METHOD_GET, COAP_TYPE_NONCON,
         handle_get_separate, &path_separate,
-        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_TXT_PLAIN)},
+        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_TXT_PLAIN), NULL},
     {(coap_state_t)0, (coap_method_t)0, (coap_msgtype_t)0,
         NULL, NULL,
-        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_NONE)}
+        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_NONE), NULL}
 };
 
 int main(void)
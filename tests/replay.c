@@ -0,0 +1,646 @@
+#include <errno.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "coap.h"
+
+/*
+ * Replays CoAP traffic from a pcap or pcapng capture, either in-process
+ * against the resource table of the example server or over UDP against a
+ * running server. Datagrams sent to the server port are requests, datagrams
+ * sent from it are the recorded responses the replayed ones are compared to.
+ */
+
+extern void resource_setup(const coap_resource_t *resources);
+extern coap_resource_t resources[];
+
+#define REPLAY_MAX_DGRAM    1500    //!< largest UDP payload kept per packet
+#define REPLAY_MAX_DIVERGE  10      //!< number of divergences dumped in detail
+#define REPLAY_TIMEOUT_MS   1000    //!< wait for a response in loopback mode
+#define REPLAY_NONE         ((size_t)-1)
+
+/* link types, see http://www.tcpdump.org/linktypes.html */
+#define LINKTYPE_NULL       0
+#define LINKTYPE_ETHERNET   1
+#define LINKTYPE_RAW        101
+#define LINKTYPE_LINUX_SLL  113
+#define LINKTYPE_IPV4       228
+#define LINKTYPE_IPV6       229
+#define LINKTYPE_LINUX_SLL2 276
+
+/**
+ * One CoAP datagram extracted from the capture
+ */
+typedef struct replay_dgram
+{
+    bool request;               //!< sent to the server port
+    size_t len;                 //!< length of the UDP payload
+    uint8_t data[REPLAY_MAX_DGRAM]; //!< the UDP payload
+    const struct replay_dgram *rsp; //!< recorded response to a request
+    uint16_t id;                //!< message ID of a request, for pairing
+    size_t next;                //!< next request with the same token, while pairing
+} replay_dgram_t;
+
+/**
+ * Requests with one token, in capture order, while pairing
+ */
+typedef struct replay_token
+{
+    bool used;
+    uint8_t tkl;
+    uint8_t tok[8];
+    size_t head;                //!< earliest request not known to be paired
+    size_t tail;
+} replay_token_t;
+
+typedef struct replay_capture
+{
+    replay_dgram_t *dgrams;
+    size_t count;
+    size_t size;
+    uint16_t port;
+} replay_capture_t;
+
+typedef struct replay_stats
+{
+    size_t requests;
+    size_t parse_errors;
+    size_t build_errors;
+    size_t matched;
+    size_t diverged;
+    size_t unrecorded;
+    size_t lost;
+    size_t stale;               //!< responses that came after their request timed out
+    double seconds;
+    uint64_t *latency;          //!< nanoseconds per replayed request
+    size_t nlatency;
+} replay_stats_t;
+
+/* --- PRIVATE -------------------------------------------------------------- */
+static uint16_t _rd16(const uint8_t *p, bool swap)
+{
+    return swap ? (uint16_t)(p[0] << 8 | p[1]) : (uint16_t)(p[1] << 8 | p[0]);
+}
+
+static uint32_t _rd32(const uint8_t *p, bool swap)
+{
+    if (swap) {
+        return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+               (uint32_t)p[2] << 8 | p[3];
+    }
+    return (uint32_t)p[3] << 24 | (uint32_t)p[2] << 16 |
+           (uint32_t)p[1] << 8 | p[0];
+}
+
+static uint64_t _now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void _add_udp(replay_capture_t *cap, const uint8_t *p, size_t len)
+{
+    if (len < 8) {
+        return;
+    }
+    uint16_t sport = p[0] << 8 | p[1];
+    uint16_t dport = p[2] << 8 | p[3];
+    size_t ulen = p[4] << 8 | p[5];
+    if ((sport != cap->port) && (dport != cap->port)) {
+        return;
+    }
+    if ((ulen < 8) || (ulen > len)) {
+        ulen = len;
+    }
+    if (ulen - 8 > REPLAY_MAX_DGRAM) {
+        return;
+    }
+    if (cap->count == cap->size) {
+        size_t size = cap->size ? 2 * cap->size : 256;
+        replay_dgram_t *d = realloc(cap->dgrams, size * sizeof(*d));
+        if (!d) {
+            return;
+        }
+        cap->dgrams = d;
+        cap->size = size;
+    }
+    replay_dgram_t *d = &cap->dgrams[cap->count++];
+    d->request = (dport == cap->port);
+    d->len = ulen - 8;
+    d->rsp = NULL;
+    memcpy(d->data, p + 8, d->len);
+}
+
+static void _add_ip(replay_capture_t *cap, const uint8_t *p, size_t len)
+{
+    if (len < 1) {
+        return;
+    }
+    if ((p[0] >> 4) == 4) {
+        size_t ihl = (p[0] & 0x0F) * 4;
+        /* skip non-UDP and non-first fragments */
+        if ((len < 20) || (ihl < 20) || (len < ihl) || (p[9] != 17) ||
+            ((p[6] & 0x1F) | p[7])) {
+            return;
+        }
+        _add_udp(cap, p + ihl, len - ihl);
+    }
+    else if ((p[0] >> 4) == 6) {
+        if ((len < 40) || (p[6] != 17)) {
+            return;
+        }
+        _add_udp(cap, p + 40, len - 40);
+    }
+}
+
+static void _add_frame(replay_capture_t *cap, uint32_t linktype,
+                       const uint8_t *p, size_t len)
+{
+    uint16_t ethertype;
+    switch (linktype) {
+    case LINKTYPE_NULL:
+        if (len > 4) {
+            _add_ip(cap, p + 4, len - 4);
+        }
+        break;
+    case LINKTYPE_ETHERNET:
+        if (len < 14) {
+            return;
+        }
+        ethertype = p[12] << 8 | p[13];
+        p += 14;
+        len -= 14;
+        /* strip VLAN tags */
+        while (((ethertype == 0x8100) || (ethertype == 0x88A8)) && (len >= 4)) {
+            ethertype = p[2] << 8 | p[3];
+            p += 4;
+            len -= 4;
+        }
+        if ((ethertype == 0x0800) || (ethertype == 0x86DD)) {
+            _add_ip(cap, p, len);
+        }
+        break;
+    case LINKTYPE_RAW:
+    case LINKTYPE_IPV4:
+    case LINKTYPE_IPV6:
+        _add_ip(cap, p, len);
+        break;
+    case LINKTYPE_LINUX_SLL:
+        if (len > 16) {
+            _add_ip(cap, p + 16, len - 16);
+        }
+        break;
+    case LINKTYPE_LINUX_SLL2:
+        if (len > 20) {
+            _add_ip(cap, p + 20, len - 20);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+/* classic pcap, https://wiki.wireshark.org/Development/LibpcapFileFormat */
+static int _read_pcap(replay_capture_t *cap, const uint8_t *buf, size_t len)
+{
+    uint32_t magic = _rd32(buf, false);
+    bool swap = (magic == 0xD4C3B2A1) || (magic == 0x4D3CB2A1);
+    if (len < 24) {
+        return -1;
+    }
+    uint32_t linktype = _rd32(buf + 20, swap);
+    for (size_t off = 24; off + 16 <= len; ) {
+        size_t caplen = _rd32(buf + off + 8, swap);
+        off += 16;
+        if (caplen > len - off) {
+            break;
+        }
+        _add_frame(cap, linktype, buf + off, caplen);
+        off += caplen;
+    }
+    return 0;
+}
+
+/* pcapng, https://www.ietf.org/archive/id/draft-ietf-opsawg-pcapng-01.html */
+static int _read_pcapng(replay_capture_t *cap, const uint8_t *buf, size_t len)
+{
+    uint32_t linktypes[16];
+    size_t nif = 0;
+    bool swap = false;
+    for (size_t off = 0; off + 12 <= len; ) {
+        uint32_t type = _rd32(buf + off, swap);
+        if (type == 0x0A0D0D0A) {
+            /* section header, byte order magic decides endianess */
+            swap = (_rd32(buf + off + 8, false) == 0x4D3C2B1A);
+            nif = 0;
+        }
+        uint32_t blen = _rd32(buf + off + 4, swap);
+        if ((blen < 12) || (blen > len - off)) {
+            return -1;
+        }
+        const uint8_t *b = buf + off + 8;
+        size_t bodylen = blen - 12;
+        if ((type == 0x00000001) && (bodylen >= 8)) {
+            /* interface description */
+            if (nif < sizeof(linktypes) / sizeof(linktypes[0])) {
+                linktypes[nif++] = _rd16(b, swap);
+            }
+        }
+        else if ((type == 0x00000006) && (bodylen >= 20)) {
+            /* enhanced packet */
+            uint32_t ifid = _rd32(b, swap);
+            size_t caplen = _rd32(b + 12, swap);
+            if ((ifid < nif) && (caplen <= bodylen - 20)) {
+                _add_frame(cap, linktypes[ifid], b + 20, caplen);
+            }
+        }
+        else if ((type == 0x00000003) && (bodylen >= 4) && (nif > 0)) {
+            /* simple packet, always on the first interface */
+            size_t caplen = _rd32(b, swap);
+            if (caplen > bodylen - 4) {
+                caplen = bodylen - 4;
+            }
+            _add_frame(cap, linktypes[0], b + 4, caplen);
+        }
+        off += blen;
+    }
+    return 0;
+}
+
+static int _load(replay_capture_t *cap, const char *file)
+{
+    FILE *f = fopen(file, "rb");
+    if (!f) {
+        perror(file);
+        return -1;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *buf = malloc(size > 0 ? size : 1);
+    if (!buf || (size < 4) || (fread(buf, 1, size, f) != (size_t)size)) {
+        fprintf(stderr, "%s: cannot read capture\n", file);
+        fclose(f);
+        free(buf);
+        return -1;
+    }
+    fclose(f);
+    int rc = -1;
+    switch (_rd32(buf, false)) {
+    case 0xA1B2C3D4: case 0xD4C3B2A1:   /* microsecond timestamps */
+    case 0xA1B23C4D: case 0x4D3CB2A1:   /* nanosecond timestamps */
+        rc = _read_pcap(cap, buf, size);
+        break;
+    case 0x0A0D0D0A:
+        rc = _read_pcapng(cap, buf, size);
+        break;
+    default:
+        fprintf(stderr, "%s: not a pcap or pcapng file\n", file);
+        break;
+    }
+    free(buf);
+    return rc;
+}
+
+/* whether \p rsp answers \p req: the same token, and message ID if piggybacked */
+static bool _answers(const coap_packet_t *req, const coap_packet_t *rsp)
+{
+    return (req->tok.len == rsp->tok.len) &&
+           (!req->tok.len || !memcmp(req->tok.p, rsp->tok.p, req->tok.len)) &&
+           ((rsp->hdr.t != COAP_TYPE_ACK) || (req->hdr.id == rsp->hdr.id));
+}
+
+/* the requests with the token of \p pkt, in a table of \p mask + 1 slots */
+static replay_token_t *_token(replay_token_t *tokens, size_t mask, const coap_packet_t *pkt)
+{
+    uint32_t h = 2166136261u;   // FNV-1a
+    for (size_t i = 0; i < pkt->tok.len; ++i) {
+        h = (h ^ pkt->tok.p[i]) * 16777619u;
+    }
+    for (size_t i = (h ^ pkt->tok.len) & mask; ; i = (i + 1) & mask) {
+        replay_token_t *t = &tokens[i];
+        if (!t->used) {
+            return t;
+        }
+        if ((t->tkl == pkt->tok.len) && !memcmp(t->tok, pkt->tok.p, t->tkl)) {
+            return t;
+        }
+    }
+}
+
+/*
+ * Attach each recorded response to the earliest preceding request with the
+ * same message ID and token, separate responses (new message ID) are matched
+ * by token only. Each datagram is parsed once, requests are chained by
+ * token in a hash table, paired ones leave the head of their chain.
+ */
+static void _pair(replay_capture_t *cap)
+{
+    size_t mask = 15;
+    while (mask + 1 < 2 * cap->count) {
+        mask = 2 * mask + 1;
+    }
+    replay_token_t *tokens = calloc(mask + 1, sizeof(*tokens));
+    if (!tokens) {
+        return;
+    }
+    for (size_t i = 0; i < cap->count; ++i) {
+        replay_dgram_t *d = &cap->dgrams[i];
+        coap_packet_t pkt;
+        d->next = REPLAY_NONE;
+        if (coap_parse(d->data, d->len, &pkt) > COAP_ERR) {
+            continue;
+        }
+        replay_token_t *t = _token(tokens, mask, &pkt);
+        if (d->request) {
+            d->id = pkt.hdr.id;
+            if (!t->used) {
+                t->used = true;
+                t->tkl = (uint8_t)pkt.tok.len;
+                memcpy(t->tok, pkt.tok.p, pkt.tok.len);
+                t->head = i;
+            }
+            else if (t->head == REPLAY_NONE) {
+                t->head = i;
+            }
+            else {
+                cap->dgrams[t->tail].next = i;
+            }
+            t->tail = i;
+            continue;
+        }
+        /* empty ACKs only announce a separate response */
+        if (!t->used || (pkt.hdr.code == COAP_RSPCODE_EMPTY)) {
+            continue;
+        }
+        while ((t->head != REPLAY_NONE) && cap->dgrams[t->head].rsp) {
+            t->head = cap->dgrams[t->head].next;
+        }
+        for (size_t j = t->head; j != REPLAY_NONE; j = cap->dgrams[j].next) {
+            replay_dgram_t *req = &cap->dgrams[j];
+            if (!req->rsp && ((pkt.hdr.t != COAP_TYPE_ACK) || (req->id == pkt.hdr.id))) {
+                req->rsp = d;
+                break;
+            }
+        }
+    }
+    free(tokens);
+}
+
+static void _hex(const char *label, const uint8_t *buf, size_t len)
+{
+    fprintf(stderr, "    %s:", label);
+    for (size_t i = 0; i < len; ++i) {
+        fprintf(stderr, " %02X", buf[i]);
+    }
+    fprintf(stderr, "\n");
+}
+
+static void _compare(replay_stats_t *st, size_t idx, const replay_dgram_t *req,
+                     const uint8_t *rsp, size_t rsplen)
+{
+    if (!req->rsp) {
+        st->unrecorded++;
+        return;
+    }
+    if ((req->rsp->len == rsplen) && !memcmp(req->rsp->data, rsp, rsplen)) {
+        st->matched++;
+        return;
+    }
+    if (st->diverged++ < REPLAY_MAX_DIVERGE) {
+        fprintf(stderr, "  divergence at datagram %zu\n", idx);
+        _hex("request ", req->data, req->len);
+        _hex("recorded", req->rsp->data, req->rsp->len);
+        _hex("replayed", rsp, rsplen);
+    }
+}
+
+static void _replay_local(const replay_capture_t *cap, replay_stats_t *st,
+                          bool compare)
+{
+    uint8_t buf[REPLAY_MAX_DGRAM];
+    uint64_t start = _now_ns();
+    for (size_t i = 0; i < cap->count; ++i) {
+        const replay_dgram_t *req = &cap->dgrams[i];
+        if (!req->request) {
+            continue;
+        }
+        coap_packet_t pkt, rsppkt;
+        size_t buflen = sizeof(buf);
+        uint64_t t0 = _now_ns();
+        st->requests++;
+        if (coap_parse(req->data, req->len, &pkt) > COAP_ERR) {
+            st->parse_errors++;
+            continue;
+        }
+        coap_handle_request(resources, &pkt, &rsppkt);
+        if (coap_build(&rsppkt, buf, &buflen) > COAP_ERR) {
+            st->build_errors++;
+            continue;
+        }
+        st->latency[st->nlatency++] = _now_ns() - t0;
+        if (compare) {
+            _compare(st, i, req, buf, buflen);
+        }
+    }
+    st->seconds += (_now_ns() - start) / 1e9;
+}
+
+static void _replay_remote(const replay_capture_t *cap, replay_stats_t *st,
+                           int fd, const struct addrinfo *dst, bool compare)
+{
+    uint8_t buf[REPLAY_MAX_DGRAM];
+    uint64_t start = _now_ns();
+    for (size_t i = 0; i < cap->count; ++i) {
+        const replay_dgram_t *req = &cap->dgrams[i];
+        if (!req->request) {
+            continue;
+        }
+        coap_packet_t pkt;
+        st->requests++;
+        const bool parsed = coap_parse(req->data, req->len, &pkt) <= COAP_ERR;
+        if (!parsed) {
+            st->parse_errors++;
+        }
+        /* responses to requests that timed out are not this one's */
+        while (recv(fd, buf, sizeof(buf), MSG_DONTWAIT) >= 0) {
+            st->stale++;
+        }
+        uint64_t t0 = _now_ns();
+        if (sendto(fd, req->data, req->len, 0, dst->ai_addr, dst->ai_addrlen) < 0) {
+            perror("sendto");
+            st->lost++;
+            continue;
+        }
+        /* skip empty ACKs of separate responses and late responses, wait for this one */
+        const uint64_t deadline = t0 + REPLAY_TIMEOUT_MS * 1000000ull;
+        for (;;) {
+            const uint64_t now = _now_ns();
+            struct pollfd pfd = { fd, POLLIN, 0 };
+            if ((now >= deadline) ||
+                (poll(&pfd, 1, (int)((deadline - now + 999999) / 1000000)) <= 0)) {
+                st->lost++;
+                break;
+            }
+            ssize_t n = recv(fd, buf, sizeof(buf), 0);
+            coap_packet_t rsp;
+            if ((n < 0) || (coap_parse(buf, n, &rsp) > COAP_ERR) ||
+                (rsp.hdr.code == COAP_RSPCODE_EMPTY)) {
+                continue;
+            }
+            if (parsed && !_answers(&pkt, &rsp)) {
+                st->stale++;
+                continue;
+            }
+            st->latency[st->nlatency++] = _now_ns() - t0;
+            if (compare) {
+                _compare(st, i, req, buf, n);
+            }
+            break;
+        }
+    }
+    st->seconds += (_now_ns() - start) / 1e9;
+}
+
+static int _cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void _report(replay_stats_t *st)
+{
+    fprintf(stderr, "requests     %zu\n", st->requests);
+    fprintf(stderr, "parse errors %zu\n", st->parse_errors);
+    fprintf(stderr, "build errors %zu\n", st->build_errors);
+    fprintf(stderr, "lost         %zu\n", st->lost);
+    fprintf(stderr, "stale        %zu\n", st->stale);
+    fprintf(stderr, "matched      %zu\n", st->matched);
+    fprintf(stderr, "diverged     %zu\n", st->diverged);
+    fprintf(stderr, "unrecorded   %zu\n", st->unrecorded);
+    if (st->seconds > 0) {
+        fprintf(stderr, "throughput   %.0f req/s\n", st->requests / st->seconds);
+    }
+    if (st->nlatency > 0) {
+        qsort(st->latency, st->nlatency, sizeof(uint64_t), _cmp_u64);
+        fprintf(stderr, "latency ns   min %llu p50 %llu p90 %llu p99 %llu max %llu\n",
+                (unsigned long long)st->latency[0],
+                (unsigned long long)st->latency[st->nlatency / 2],
+                (unsigned long long)st->latency[st->nlatency * 90 / 100],
+                (unsigned long long)st->latency[st->nlatency * 99 / 100],
+                (unsigned long long)st->latency[st->nlatency - 1]);
+    }
+}
+
+static void _usage(const char *prog)
+{
+    fprintf(stderr, "USAGE: %s [-s host] [-p port] [-n rounds] capture.pcap[ng]\n", prog);
+    fprintf(stderr, "  -s host   replay over UDP to a running server instead of in-process\n");
+    fprintf(stderr, "  -p port   server port in the capture and on host (default %d)\n",
+            COAP_DEFAULT_PORT);
+    fprintf(stderr, "  -n rounds number of replay rounds, first one is compared (default 1)\n");
+}
+
+/* --- MAIN ----------------------------------------------------------------- */
+int main(int argc, char *argv[])
+{
+    replay_capture_t cap = { NULL, 0, 0, COAP_DEFAULT_PORT };
+    replay_stats_t st;
+    const char *host = NULL;
+    long rounds = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:p:n:")) != -1) {
+        switch (opt) {
+        case 's':
+            host = optarg;
+            break;
+        case 'p':
+            cap.port = (uint16_t)atoi(optarg);
+            break;
+        case 'n':
+            rounds = atol(optarg);
+            break;
+        default:
+            _usage(argv[0]);
+            return 1;
+        }
+    }
+    if ((optind != argc - 1) || (rounds < 1)) {
+        _usage(argv[0]);
+        return 1;
+    }
+    if (_load(&cap, argv[optind])) {
+        return 1;
+    }
+    _pair(&cap);
+
+    memset(&st, 0, sizeof(st));
+    st.latency = calloc(cap.count * rounds + 1, sizeof(uint64_t));
+    if (!st.latency) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    fprintf(stderr, "loaded %zu datagrams from %s\n", cap.count, argv[optind]);
+
+    if (host) {
+        struct addrinfo hints, *dst;
+        char port[8];
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_DGRAM;
+        snprintf(port, sizeof(port), "%u", cap.port);
+        int rv = getaddrinfo(host, port, &hints, &dst);
+        if (rv != 0) {
+            fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(rv));
+            return 1;
+        }
+        int fd = socket(dst->ai_family, dst->ai_socktype, dst->ai_protocol);
+        if (fd == -1) {
+            perror("socket");
+            return 2;
+        }
+        for (long r = 0; r < rounds; ++r) {
+            _replay_remote(&cap, &st, fd, dst, r == 0);
+        }
+        freeaddrinfo(dst);
+        close(fd);
+    }
+    else {
+        /* handlers print to stdout, keep that out of the measurement */
+        fflush(stdout);
+        int out = dup(STDOUT_FILENO);
+        int null = open("/dev/null", O_WRONLY);
+        if (null >= 0) {
+            dup2(null, STDOUT_FILENO);
+        }
+        resource_setup(resources);
+        for (long r = 0; r < rounds; ++r) {
+            _replay_local(&cap, &st, r == 0);
+        }
+        fflush(stdout);
+        if (out >= 0) {
+            dup2(out, STDOUT_FILENO);
+            close(out);
+        }
+        if (null >= 0) {
+            close(null);
+        }
+    }
+    _report(&st);
+    free(st.latency);
+    free(cap.dgrams);
+    return (st.diverged || st.parse_errors || st.build_errors) ? 3 : 0;
+}
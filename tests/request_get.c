@@ -11,8 +11,39 @@
 #include <unistd.h>
 
 #include "coap.h"
+#include "coap_link.h"
 
 #define DSTPORT     "5683"
+#define MAXFILTERS  4
+#define BLOCK_SZX   2       //!< 64 byte blocks, see COAP_BLOCK_SIZE
+
+/* discovery result, read as the blocks arrive */
+static uint8_t carry[256];
+static coap_link_stream_t links;
+static coap_link_filter_t filters[MAXFILTERS];
+static size_t num_filters;
+static uint32_t next_block;
+
+static void print_links(void)
+{
+    coap_link_t link;
+    coap_link_attr_t attr;
+    coap_state_t rc;
+
+    while ((rc = coap_link_stream_find(&links, filters, num_filters, &link)) == COAP_SUCCESS) {
+        printf("  <%.*s>\n", (int)link.target.len, (const char *)link.target.p);
+        for (size_t pos = 0; coap_link_attr_next(&link, &pos, &attr) == COAP_SUCCESS; ) {
+            printf("    %.*s", (int)attr.name.len, (const char *)attr.name.p);
+            if (attr.value.p) {
+                printf(" = %.*s", (int)attr.value.len, (const char *)attr.value.p);
+            }
+            printf("\n");
+        }
+    }
+    if ((rc != COAP_RSP_WAIT) && (rc != COAP_RSP_RECV)) {
+        printf("  invalid link format rc=%d\n", rc);
+    }
+}
 
 static const coap_resource_path_t path_well_known_core = {2, {".well-known", "core"}};
 static int handle_get_well_known_core(const coap_resource_t *resource,
@@ -20,21 +51,30 @@ static int handle_get_well_known_core(const coap_resource_t *resource,
                                       coap_packet_t *rsppkt)
 {
 
+    coap_block_t block;
+    bool last = true;
+
     (void) resource;
     (void) reqpkt;
     printf("handle_get_well_known_core\n");
-    printf("  content: %.*s\n", (int)rsppkt->payload.len, (char *)rsppkt->payload.p);
-    return COAP_RSP_RECV;
+    if (coap_get_block(rsppkt, COAP_OPTION_BLOCK2, &block) == COAP_SUCCESS) {
+        printf("  block %u, more %d\n", (unsigned)block.num, block.more);
+        last = !block.more;
+        next_block = block.num + 1;
+    }
+    coap_link_stream_feed(&links, rsppkt->payload.p, rsppkt->payload.len, last);
+    print_links();
+    return last ? COAP_RSP_RECV : COAP_RSP_WAIT;
 }
 
 coap_resource_t resources[] =
 {
     {COAP_RDY, COAP_METHOD_GET, COAP_TYPE_ACK,
         handle_get_well_known_core, &path_well_known_core,
-        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_APP_LINKFORMAT)},
+        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_APP_LINKFORMAT), NULL},
     {(coap_state_t)0, (coap_method_t)0, (coap_msgtype_t)0,
         NULL, NULL,
-        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_NONE)}
+        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_NONE), NULL}
 };
 
 int main(int argc, char *argv[])
@@ -43,10 +83,20 @@ int main(int argc, char *argv[])
     struct addrinfo hints, *dstinfo, *p;
     int rv;
 
-    if (argc != 2) {
-        fprintf(stderr, "USAGE: %s hostname\n", argv[0]);
+    if ((argc < 2) || (argc > 2 + MAXFILTERS)) {
+        fprintf(stderr, "USAGE: %s hostname [name=value ...]\n", argv[0]);
         return 1;
     }
+    // query filters as in RFC 6690 section 4.1, e.g. rt=temperature*
+    for (int i = 2; i < argc; ++i) {
+        char *eq = strchr(argv[i], '=');
+        if (eq) {
+            *eq = '\0';
+        }
+        filters[num_filters].name = argv[i];
+        filters[num_filters++].value = eq ? eq + 1 : NULL;
+    }
+    coap_link_stream_init(&links, carry, sizeof(carry));
     memset(&hints, 0, sizeof(hints));
     hints.ai_family = AF_UNSPEC;
     hints.ai_socktype = SOCK_DGRAM;
@@ -73,22 +123,27 @@ int main(int argc, char *argv[])
     socklen_t len = sizeof(cliaddr);
     coap_packet_t req, rsp;
     uint16_t msgid = 42;
-    printf(" + coap_make_request\n");
-    coap_make_request(msgid, NULL, &resources[0], NULL, 0, &req);
     uint8_t buf[1024];
-    size_t buflen = sizeof(buf);
-    if ((rc = coap_build(&req, buf, &buflen)) > COAP_ERR) {
-        printf("coap_build failed rc=%d\n", rc);
-        return 1;
-    }
-    else {
+    int state = COAP_RSP_WAIT;
+    // fetch the document block wise, one request per block
+    while (state != COAP_RSP_RECV) {
+        uint8_t block2[4];
+        size_t buflen = sizeof(buf);
+        printf(" + coap_make_request\n");
+        coap_make_request(msgid++, NULL, &resources[0], NULL, 0, &req);
+        coap_add_option(&req, COAP_OPTION_BLOCK2, block2,
+                        coap_encode_uint((next_block << 4) | BLOCK_SZX, block2));
+        if ((rc = coap_build(&req, buf, &buflen)) > COAP_ERR) {
+            printf("coap_build failed rc=%d\n", rc);
+            return 1;
+        }
         printf("send request\n");
         if ((n = sendto(fd, buf, buflen, 0, p->ai_addr, p->ai_addrlen)) == -1) {
             perror("sendto");
             return 1;
         }
         printf("wait for response ...\n");
-        for (int state = COAP_RSP_WAIT; state != COAP_RSP_RECV; ) {
+        do {
             n = recvfrom(fd, buf, sizeof(buf), 0, (struct sockaddr *)&cliaddr, &len);
             printf("received message of %d bytes\n", n);
             if ((rc = coap_parse(buf, n, &rsp)) > COAP_ERR) {
@@ -96,7 +151,7 @@ int main(int argc, char *argv[])
                 return 1;
             }
             state = coap_handle_response(resources, &req, &rsp);
-        }
+        } while (state > COAP_ERR);
     }
     // cleanup and exit
     freeaddrinfo(dstinfo);
@@ -34,10 +34,10 @@ coap_resource_t resources[] =
 {
     {COAP_RDY, COAP_METHOD_PUT, COAP_TYPE_CON,
         handle_request_put_response, NULL,
-        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_TXT_PLAIN)},
+        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_TXT_PLAIN), NULL},
     {(coap_state_t)0, (coap_method_t)0, (coap_msgtype_t)0,
         NULL, NULL,
-        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_NONE)}
+        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_NONE), NULL}
 };
 
 int main(int argc, char *argv[])
@@ -0,0 +1,314 @@
+#define _GNU_SOURCE     // recvmmsg
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "coap.h"
+#include "coap_mcast.h"
+#include "coap_tstamp.h"
+
+/*
+ * Tests queueing delays and load shedding on them. Datagrams left in the
+ * queue of a loopback socket for 20 ms come with a delay of at least that,
+ * through recvmsg and recvmmsg. The shedding decision is driven with
+ * chosen delays and clock: a burst that drains is served, a standing queue
+ * sheds the requests above the target for the next interval, and those
+ * below it and unstamped ones are served. Shed confirmable requests get a
+ * 5.03 with Max-Age, others nothing. Last, 50 requests left queued for
+ * longer than an interval are all shed and answered 5.03, and a fresh one
+ * behind them is served. One recvmsg takes both the stamp and the packet
+ * info of multicast, and the 5.03 of a request shed on the group is
+ * suppressed. Exits non-zero if any check fails.
+ */
+
+#define MS              1000000ull
+#define QUEUED          50
+
+static int failures;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+/* --- HELPERS -------------------------------------------------------------- */
+static void _sleep_ms(const unsigned ms)
+{
+    struct timespec t = { 0, (long)(ms * MS) };
+    nanosleep(&t, NULL);
+}
+
+static size_t _request(uint8_t *buf, const size_t size, const uint16_t id,
+                       const coap_msgtype_t type)
+{
+    static const uint8_t tok[] = { 0x51, 0x52 };
+    coap_packet_t pkt;
+    size_t buflen = size;
+
+    memset(&pkt, 0, sizeof(pkt));
+    pkt.hdr.ver = COAP_VERSION;
+    pkt.hdr.t = type;
+    pkt.hdr.code = COAP_METHOD_GET;
+    pkt.hdr.id = id;
+    pkt.hdr.tkl = sizeof(tok);
+    pkt.tok.p = tok;
+    pkt.tok.len = sizeof(tok);
+    coap_add_option(&pkt, COAP_OPTION_URI_PATH, (const uint8_t *)"light", 5);
+    coap_build(&pkt, buf, &buflen);
+    return buflen;
+}
+
+/* a server socket on loopback and a client connected to it */
+static void _sockets(int *server, int *client)
+{
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    *server = socket(AF_INET, SOCK_DGRAM, 0);
+    *client = socket(AF_INET, SOCK_DGRAM, 0);
+    CHECK(bind(*server, (struct sockaddr *)&addr, len) == 0);
+    CHECK(getsockname(*server, (struct sockaddr *)&addr, &len) == 0);
+    CHECK(connect(*client, (struct sockaddr *)&addr, len) == 0);
+}
+
+/* --- TESTS ---------------------------------------------------------------- */
+static void _test_delay(void)
+{
+    uint8_t buf[64], bufs[8][64];
+    union {
+        struct cmsghdr hdr;
+        uint8_t buf[COAP_TSTAMP_CONTROL_SIZE];
+    } control[8];
+    struct mmsghdr msgs[8];
+    struct iovec iov[8];
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+    uint64_t delay, delays[8];
+    coap_tstamp_t ts;
+    int server, client;
+
+    _sockets(&server, &client);
+    CHECK(coap_tstamp_init(&ts, server, 0, 0) == COAP_SUCCESS);
+    CHECK((ts.target_ns == COAP_TSTAMP_TARGET_NS) && (ts.interval_ns == COAP_TSTAMP_INTERVAL_NS));
+
+    const size_t len = _request(buf, sizeof(buf), 1, COAP_TYPE_CON);
+    CHECK(send(client, buf, len, 0) == (ssize_t)len);
+    _sleep_ms(20);
+    CHECK(coap_tstamp_recvfrom(&ts, server, buf, sizeof(buf), (struct sockaddr *)&addr,
+                               &addrlen, &delay) == (ssize_t)len);
+    CHECK((addrlen == sizeof(addr)) && (addr.sin_family == AF_INET));
+    CHECK((delay >= 20 * MS) && (delay < 1000 * MS));
+    CHECK((ts.stamped == 1) && (ts.unstamped == 0));
+
+    for (int i = 0; i < 8; ++i) {
+        CHECK(send(client, buf, len, 0) == (ssize_t)len);
+    }
+    _sleep_ms(10);
+    for (int i = 0; i < 8; ++i) {
+        iov[i] = (struct iovec){ bufs[i], sizeof(bufs[i]) };
+        memset(&msgs[i], 0, sizeof(msgs[i]));
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_control = control[i].buf;
+        msgs[i].msg_hdr.msg_controllen = sizeof(control[i].buf);
+    }
+    CHECK(coap_tstamp_recvmmsg(&ts, server, msgs, 8, MSG_DONTWAIT, delays) == 8);
+    for (int i = 0; i < 8; ++i) {
+        CHECK((msgs[i].msg_len == len) && (delays[i] >= 10 * MS) && (delays[i] < 1000 * MS));
+    }
+    CHECK(ts.stamped == 9);
+
+    // without the option nothing is stamped
+    coap_tstamp_t plain = ts;
+    int other, peer;
+    _sockets(&other, &peer);
+    CHECK(send(peer, buf, len, 0) == (ssize_t)len);
+    addrlen = sizeof(addr);
+    CHECK(coap_tstamp_recvfrom(&plain, other, buf, sizeof(buf), (struct sockaddr *)&addr,
+                               &addrlen, &delay) == (ssize_t)len);
+    CHECK((delay == 0) && (plain.unstamped == 1));
+
+    close(other);
+    close(peer);
+    close(server);
+    close(client);
+}
+
+static void _test_admit(void)
+{
+    coap_tstamp_t ts;
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+
+    CHECK(coap_tstamp_init(&ts, fd, 5 * MS, 100 * MS) == COAP_SUCCESS);
+    close(fd);
+    const uint64_t start = ts.interval_end - 100 * MS;
+
+    // a burst, the queue drains within the interval
+    ts.received = start + 10 * MS;
+    CHECK(coap_tstamp_admit(&ts, 30 * MS));
+    ts.received = start + 50 * MS;
+    CHECK(coap_tstamp_admit(&ts, 1 * MS));
+    ts.received = start + 100 * MS;
+    CHECK(coap_tstamp_admit(&ts, 30 * MS));
+    CHECK(!ts.shedding && (ts.shed == 0));
+
+    // standing, nothing below the target for an interval
+    ts.received = start + 150 * MS;
+    CHECK(coap_tstamp_admit(&ts, 20 * MS));
+    ts.received = start + 199 * MS;
+    CHECK(coap_tstamp_admit(&ts, 8 * MS));
+    ts.received = start + 200 * MS;
+    CHECK(!coap_tstamp_admit(&ts, 12 * MS));
+    CHECK(ts.shedding && (ts.shed == 1));
+    ts.received = start + 210 * MS;
+    CHECK(!coap_tstamp_admit(&ts, 6 * MS));
+    CHECK(coap_tstamp_admit(&ts, 4 * MS));
+    CHECK(coap_tstamp_admit(&ts, 0));
+    CHECK(ts.shed == 2);
+
+    // the queue drained in that interval, serving again
+    ts.received = start + 300 * MS;
+    CHECK(coap_tstamp_admit(&ts, 40 * MS));
+    CHECK(!ts.shedding && (ts.shed == 2));
+}
+
+static void _test_reject(void)
+{
+    uint8_t buf[64], out[64];
+    coap_packet_t req, rsp, parsed;
+    uint8_t count;
+    size_t outlen = sizeof(out);
+
+    size_t len = _request(buf, sizeof(buf), 0x7001, COAP_TYPE_CON);
+    CHECK(coap_parse(buf, len, &req) == COAP_SUCCESS);
+    CHECK(coap_tstamp_reject(&req, &rsp) == COAP_RSP_SEND);
+    CHECK(coap_build(&rsp, out, &outlen) == COAP_SUCCESS);
+    CHECK(coap_parse(out, outlen, &parsed) == COAP_SUCCESS);
+    CHECK((parsed.hdr.t == COAP_TYPE_ACK) && (parsed.hdr.id == 0x7001) &&
+          (parsed.hdr.code == COAP_RSPCODE_SERVICE_UNAVAILABLE));
+    CHECK((parsed.tok.len == 2) && (parsed.tok.p[0] == 0x51));
+    const coap_option_t *opt = coap_find_options(&parsed, COAP_OPTION_MAX_AGE, &count);
+    CHECK(opt && (count == 1) && (opt->buf.len == 1) && (opt->buf.p[0] == COAP_TSTAMP_RETRY_S));
+
+    len = _request(buf, sizeof(buf), 0x7002, COAP_TYPE_NONCON);
+    CHECK(coap_parse(buf, len, &req) == COAP_SUCCESS);
+    CHECK(coap_tstamp_reject(&req, &rsp) == COAP_RSP_RECV);
+}
+
+/* requests queued past an interval, served as the example server does */
+static void _test_shed(void)
+{
+    uint8_t buf[64];
+    struct sockaddr_in addr;
+    socklen_t addrlen;
+    coap_tstamp_t ts;
+    coap_packet_t req, rsp;
+    uint64_t delay;
+    int server, client, served = 0, rejected = 0;
+
+    _sockets(&server, &client);
+    CHECK(coap_tstamp_init(&ts, server, 5 * MS, 50 * MS) == COAP_SUCCESS);
+    for (uint16_t id = 0; id < QUEUED; ++id) {
+        const size_t len = _request(buf, sizeof(buf), id, COAP_TYPE_CON);
+        CHECK(send(client, buf, len, 0) == (ssize_t)len);
+    }
+    _sleep_ms(80);
+    for (int i = 0; i <= QUEUED; ++i) {
+        if (i == QUEUED) {
+            // behind them, a fresh one
+            const size_t len = _request(buf, sizeof(buf), 0x8000, COAP_TYPE_CON);
+            CHECK(send(client, buf, len, 0) == (ssize_t)len);
+        }
+        addrlen = sizeof(addr);
+        const ssize_t n = coap_tstamp_recvfrom(&ts, server, buf, sizeof(buf),
+                                               (struct sockaddr *)&addr, &addrlen, &delay);
+        CHECK((n > 0) && (coap_parse(buf, (size_t)n, &req) == COAP_SUCCESS));
+        if (coap_tstamp_admit(&ts, delay)) {
+            served += req.hdr.id == 0x8000;
+            continue;
+        }
+        size_t buflen = sizeof(buf);
+        CHECK(coap_tstamp_reject(&req, &rsp) == COAP_RSP_SEND);
+        CHECK(coap_build(&rsp, buf, &buflen) == COAP_SUCCESS);
+        sendto(server, buf, buflen, 0, (struct sockaddr *)&addr, addrlen);
+        coap_tstamp_sent(&ts, 1);
+    }
+    CHECK((ts.shed == QUEUED) && (served == 1));
+
+    for (ssize_t n; (n = recv(client, buf, sizeof(buf), MSG_DONTWAIT)) > 0; ) {
+        rejected += (coap_parse(buf, (size_t)n, &rsp) == COAP_SUCCESS) &&
+                    (rsp.hdr.code == COAP_RSPCODE_SERVICE_UNAVAILABLE);
+    }
+    CHECK(rejected == QUEUED);
+    close(server);
+    close(client);
+}
+
+/* the stamp and the packet info of coap_mcast_destination, from one receive */
+static void _test_mcast(void)
+{
+    union {
+        struct cmsghdr hdr;
+        uint8_t buf[COAP_MCAST_CONTROL_SIZE + COAP_TSTAMP_CONTROL_SIZE];
+    } control;
+    uint8_t buf[64];
+    struct iovec iov = { buf, sizeof(buf) };
+    struct msghdr msg = {
+        .msg_iov = &iov, .msg_iovlen = 1,
+        .msg_control = control.buf, .msg_controllen = sizeof(control.buf)
+    };
+    coap_tstamp_t ts;
+    int server, client, pktinfo = 0;
+    const int on = 1;
+
+    _sockets(&server, &client);
+    CHECK(coap_tstamp_init(&ts, server, 0, 0) == COAP_SUCCESS);
+    CHECK(setsockopt(server, IPPROTO_IP, IP_PKTINFO, &on, sizeof(on)) == 0);
+    const size_t len = _request(buf, sizeof(buf), 1, COAP_TYPE_CON);
+    CHECK(send(client, buf, len, 0) == (ssize_t)len);
+    _sleep_ms(20);
+    CHECK(recvmsg(server, &msg, 0) == (ssize_t)len);
+    CHECK(!(msg.msg_flags & MSG_CTRUNC));
+    const uint64_t delay = coap_tstamp_delay(&ts, &msg);
+    CHECK((delay >= 20 * MS) && (delay < 1000 * MS));
+    CHECK(!coap_mcast_destination(&msg));
+    for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+        pktinfo += (c->cmsg_level == IPPROTO_IP) && (c->cmsg_type == IP_PKTINFO);
+    }
+    CHECK(pktinfo == 1);
+
+    // shed on the group, the 5.03 is suppressed like any error
+    coap_packet_t req, rsp;
+    coap_mcast_t mcast;
+    CHECK(coap_mcast_init(&mcast, -1, 0, 0, 1) == COAP_SUCCESS);
+    CHECK(coap_parse(buf, len, &req) == COAP_SUCCESS);
+    CHECK(coap_tstamp_reject(&req, &rsp) == COAP_RSP_SEND);
+    CHECK(coap_mcast_response(&mcast, &req, &rsp) == COAP_RSP_RECV);
+    CHECK(mcast.suppressed == 1);
+    close(server);
+    close(client);
+}
+
+/* --- MAIN ----------------------------------------------------------------- */
+int main(void)
+{
+    _test_delay();
+    _test_admit();
+    _test_reject();
+    _test_shed();
+    _test_mcast();
+
+    printf("%s\n", failures ? "FAILED" : "PASSED");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,451 @@
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "coap.h"
+#include "coap_ws.h"
+
+/*
+ * Tests CoAP over WebSockets: the message codec of the reliable transports,
+ * frame masking and the server with a local WebSocket client on loopback,
+ * both in this process. Checks the upgrade, the CSM, requests dispatched to
+ * a resource table, fragmented messages with control frames in between,
+ * signaling, rejected handshakes and frames, and many concurrent
+ * connections with pipelined requests. Exits non-zero if any check fails.
+ */
+
+#define CLIENTS         200
+#define ROUNDS          20      //!< pipelined requests per client
+#define WAIT_MS         3000
+
+typedef struct client
+{
+    int fd;
+    size_t len;
+    uint8_t buf[16384];
+} client_t;
+
+static coap_ws_t ws;
+static uint16_t port;
+static client_t clients[CLIENTS];
+static int failures;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+/* --- RESOURCES ------------------------------------------------------------ */
+static const coap_resource_path_t path_hello = {1, {"hello"}};
+static const coap_resource_path_t path_echo = {1, {"echo"}};
+
+static int handle_get_hello(const coap_resource_t *resource,
+                            const coap_packet_t *inpkt,
+                            coap_packet_t *pkt)
+{
+    return coap_make_response(inpkt->hdr.id, &inpkt->tok,
+                              COAP_TYPE_ACK, COAP_RSPCODE_CONTENT,
+                              resource->content_type,
+                              (const uint8_t *)"world", 5, pkt);
+}
+
+static int handle_put_echo(const coap_resource_t *resource,
+                           const coap_packet_t *inpkt,
+                           coap_packet_t *pkt)
+{
+    return coap_make_response(inpkt->hdr.id, &inpkt->tok,
+                              COAP_TYPE_ACK, COAP_RSPCODE_CHANGED,
+                              resource->content_type,
+                              inpkt->payload.p, inpkt->payload.len, pkt);
+}
+
+static coap_resource_t resources[] =
+{
+    {COAP_RDY, COAP_METHOD_GET, COAP_TYPE_ACK,
+        handle_get_hello, &path_hello,
+        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_TXT_PLAIN), NULL},
+    {COAP_RDY, COAP_METHOD_PUT, COAP_TYPE_ACK,
+        handle_put_echo, &path_echo,
+        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_APP_OCTECT_STREAM), NULL},
+    {(coap_state_t)0, (coap_method_t)0, (coap_msgtype_t)0,
+        NULL, NULL,
+        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_NONE), NULL}
+};
+
+/* --- PRIVATE -------------------------------------------------------------- */
+static uint32_t _now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+/* one round of the event loop, clients read what arrived */
+static void _pump(int timeout)
+{
+    struct pollfd fds[CLIENTS + 2];
+    const size_t n = coap_ws_pollfds(&ws, fds, sizeof(fds) / sizeof(fds[0]));
+    poll(fds, n, timeout);
+    coap_ws_process(&ws, fds, n);
+    for (size_t i = 0; i < CLIENTS; ++i) {
+        client_t *c = &clients[i];
+        while (c->fd >= 0) {
+            const ssize_t r = recv(c->fd, c->buf + c->len, sizeof(c->buf) - 1 - c->len,
+                                   MSG_DONTWAIT);
+            if (r <= 0) {
+                break;
+            }
+            c->len += (size_t)r;
+            c->buf[c->len] = 0;
+        }
+    }
+}
+
+static bool _connect(client_t *c)
+{
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port) };
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    c->fd = socket(AF_INET, SOCK_STREAM, 0);
+    c->len = 0;
+    c->buf[0] = 0;
+    return (c->fd >= 0) && !connect(c->fd, (struct sockaddr *)&addr, sizeof(addr));
+}
+
+static void _close(client_t *c)
+{
+    close(c->fd);
+    c->fd = -1;
+}
+
+static void _send(client_t *c, const void *data, size_t len)
+{
+    CHECK(send(c->fd, data, len, 0) == (ssize_t)len);
+}
+
+/* a masked client frame */
+static size_t _frame(uint8_t *buf, const coap_ws_opcode_t opcode, const bool fin,
+                     const uint8_t *payload, const size_t len)
+{
+    static uint32_t seed = 0x9e3779b9;
+    size_t n = coap_ws_frame_header(buf, opcode, len);
+    buf[0] = (buf[0] & 0x7F) | (fin ? 0x80 : 0);
+    buf[1] |= 0x80;
+    seed = seed * 1103515245 + 12345;
+    memcpy(buf + n, &seed, 4);
+    memcpy(buf + n + 4, payload, len);
+    coap_ws_mask(buf + n + 4, len, buf + n);
+    return n + 4 + len;
+}
+
+static size_t _request(uint8_t *buf, const coap_method_t method, const char *path,
+                       const uint8_t *tok, const size_t toklen,
+                       const uint8_t *payload, const size_t len)
+{
+    coap_packet_t pkt;
+    size_t n = 2048;
+    memset(&pkt, 0, sizeof(pkt));
+    pkt.hdr.ver = COAP_VERSION;
+    pkt.hdr.code = method;
+    pkt.hdr.tkl = (uint8_t)toklen;
+    pkt.tok.p = tok;
+    pkt.tok.len = toklen;
+    coap_add_option(&pkt, COAP_OPTION_URI_PATH, (const uint8_t *)path, strlen(path));
+    pkt.payload.p = payload;
+    pkt.payload.len = len;
+    return (coap_build_tcp(&pkt, COAP_FRAMING_WS, buf, &n) == COAP_SUCCESS) ? n : 0;
+}
+
+/* takes the next server frame of \p c, waiting for it */
+static bool _next_frame(client_t *c, coap_ws_frame_t *f, uint8_t *payload)
+{
+    const uint32_t start = _now_ms();
+    for (;;) {
+        if (coap_ws_parse_frame(c->buf, c->len, false, f) == COAP_SUCCESS) {
+            const size_t n = f->headlen + f->len;
+            memcpy(payload, f->payload, f->len);
+            f->payload = payload;
+            memmove(c->buf, c->buf + n, c->len - n);
+            c->len -= n;
+            return true;
+        }
+        if (_now_ms() - start > WAIT_MS) {
+            return false;
+        }
+        _pump(5);
+    }
+}
+
+/* the next CoAP message of \p c */
+static bool _next_message(client_t *c, coap_packet_t *pkt, uint8_t *buf)
+{
+    coap_ws_frame_t f;
+    size_t len;
+    return _next_frame(c, &f, buf) && (f.opcode == COAP_WS_BINARY) &&
+           (coap_parse_tcp(buf, f.len, COAP_FRAMING_WS, pkt, &len) == COAP_SUCCESS);
+}
+
+static bool _wait_for(client_t *c, const char *s)
+{
+    const uint32_t start = _now_ms();
+    while (!strstr((const char *)c->buf, s) && (_now_ms() - start < WAIT_MS)) {
+        _pump(5);
+    }
+    return strstr((const char *)c->buf, s) != NULL;
+}
+
+/* upgrade, then the CSM of the server */
+static bool _handshake(client_t *c)
+{
+    static const char req[] = "GET /.well-known/coap HTTP/1.1\r\nHost: localhost\r\n"
+                              "Upgrade: websocket\r\nConnection: keep-alive, Upgrade\r\n"
+                              "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+                              "Sec-WebSocket-Protocol: coap\r\n"
+                              "Sec-WebSocket-Version: 13\r\n\r\n";
+    uint8_t buf[2048];
+    coap_packet_t csm;
+    if (!_connect(c)) {
+        return false;
+    }
+    _send(c, req, sizeof(req) - 1);
+    if (!_wait_for(c, "\r\n\r\n")) {
+        return false;
+    }
+    const char *end = strstr((const char *)c->buf, "\r\n\r\n") + 4;
+    const bool ok = !strncmp((const char *)c->buf, "HTTP/1.1 101 ", 13) &&
+                    strstr((const char *)c->buf, "Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\n") &&
+                    strstr((const char *)c->buf, "Sec-WebSocket-Protocol: coap\r\n");
+    const size_t n = (size_t)(end - (const char *)c->buf);
+    memmove(c->buf, c->buf + n, c->len - n);
+    c->len -= n;
+    return ok && _next_message(c, &csm, buf) && (csm.hdr.code == COAP_SIGNAL_CSM);
+}
+
+static void _test_codec(void)
+{
+    static uint8_t payload[70000], buf[71000];
+    coap_packet_t pkt, out;
+    size_t len, msglen;
+
+    for (size_t i = 0; i < sizeof(payload); ++i) {
+        payload[i] = (uint8_t)(i * 31);
+    }
+    // the length field in all four sizes
+    const size_t sizes[] = { 0, 5, 11, 200, 300, 66000 };
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+        for (int framing = COAP_FRAMING_TCP; framing <= COAP_FRAMING_WS; ++framing) {
+            static const uint8_t tok[] = { 1, 2, 3 };
+            memset(&pkt, 0, sizeof(pkt));
+            pkt.hdr.ver = COAP_VERSION;
+            pkt.hdr.code = COAP_METHOD_PUT;
+            pkt.hdr.tkl = sizeof(tok);
+            pkt.tok.p = tok;
+            pkt.tok.len = sizeof(tok);
+            coap_add_option(&pkt, COAP_OPTION_URI_PATH, (const uint8_t *)"echo", 4);
+            pkt.payload.p = payload;
+            pkt.payload.len = sizes[s];
+            len = sizeof(buf);
+            CHECK(coap_build_tcp(&pkt, (coap_framing_t)framing, buf, &len) == COAP_SUCCESS);
+            CHECK(coap_parse_tcp(buf, len, (coap_framing_t)framing, &out, &msglen) == COAP_SUCCESS);
+            CHECK(msglen == len);
+            CHECK((out.hdr.code == COAP_METHOD_PUT) && (out.tok.len == 3) && !memcmp(out.tok.p, tok, 3));
+            CHECK((out.numopts == 1) && (out.opts[0].num == COAP_OPTION_URI_PATH));
+            CHECK((out.payload.len == sizes[s]) &&
+                  (!sizes[s] || !memcmp(out.payload.p, payload, sizes[s])));
+            if (framing == COAP_FRAMING_TCP) {
+                // a stream that has not all of it yet, and two messages in a row
+                CHECK(coap_parse_tcp(buf, len - 1, COAP_FRAMING_TCP, &out, &msglen) ==
+                      COAP_ERR_HEADER_TOO_SHORT);
+                CHECK(msglen == len);
+                memcpy(buf + len, buf, len < 1000 ? len : 0);
+                CHECK((len >= 1000) || ((coap_parse_tcp(buf, 2 * len, COAP_FRAMING_TCP, &out,
+                                                        &msglen) == COAP_SUCCESS) &&
+                                        (msglen == len)));
+            }
+            else {
+                CHECK(buf[0] >> 4 == 0);
+            }
+        }
+    }
+    // the example of https://tools.ietf.org/html/rfc8323#section-3.2, an empty 2.05 with Len 0
+    const uint8_t empty[] = { 0x00, COAP_RSPCODE_CONTENT };
+    CHECK((coap_parse_tcp(empty, sizeof(empty), COAP_FRAMING_TCP, &out, &msglen) == COAP_SUCCESS) &&
+          (msglen == 2) && (out.hdr.code == COAP_RSPCODE_CONTENT) && !out.payload.len);
+    const uint8_t bad_ws[] = { 0x10, COAP_METHOD_GET, 0xB1 };
+    CHECK(coap_parse_tcp(bad_ws, sizeof(bad_ws), COAP_FRAMING_WS, &out, &msglen) != COAP_SUCCESS);
+
+    // SIMD and word paths against plain XOR, at any alignment
+    const uint8_t key[4] = { 0x37, 0xfa, 0x21, 0x3d };
+    for (size_t off = 0; off < 8; ++off) {
+        for (size_t n = 0; n < 300; n += 7) {
+            uint8_t a[320], b[320];
+            memcpy(a, payload, sizeof(a));
+            memcpy(b, payload, sizeof(b));
+            coap_ws_mask(a + off, n, key);
+            for (size_t i = 0; i < n; ++i) {
+                b[off + i] ^= key[i & 3];
+            }
+            CHECK(!memcmp(a, b, sizeof(a)));
+        }
+    }
+    char accept[COAP_WS_ACCEPT_LEN + 1];
+    coap_ws_accept_key("dGhlIHNhbXBsZSBub25jZQ==", 24, accept);
+    CHECK(!strcmp(accept, "s3pPLMBiTxaQ9kYGzzhZRbK+xOo="));
+}
+
+static void _test_server(void)
+{
+    static const uint8_t tok[] = { 0xca, 0xfe };
+    uint8_t buf[4096], msg[2048], rsp[2048];
+    coap_ws_frame_t f;
+    coap_packet_t pkt;
+    client_t *c = &clients[0];
+
+    CHECK(_handshake(c));
+    size_t n = _request(msg, COAP_METHOD_GET, "hello", tok, sizeof(tok), NULL, 0);
+    _send(c, buf, _frame(buf, COAP_WS_BINARY, true, msg, n));
+    CHECK(_next_message(c, &pkt, rsp));
+    CHECK((pkt.hdr.code == COAP_RSPCODE_CONTENT) && (pkt.tok.len == 2) &&
+          !memcmp(pkt.tok.p, tok, 2) && (pkt.payload.len == 5) &&
+          !memcmp(pkt.payload.p, "world", 5));
+
+    n = _request(msg, COAP_METHOD_GET, "nothing", tok, sizeof(tok), NULL, 0);
+    _send(c, buf, _frame(buf, COAP_WS_BINARY, true, msg, n));
+    CHECK(_next_message(c, &pkt, rsp) && ((pkt.hdr.code >> 5) == 4));
+
+    // a message in three fragments, a ping between them
+    uint8_t body[1000];
+    for (size_t i = 0; i < sizeof(body); ++i) {
+        body[i] = (uint8_t)(i ^ 0x5a);
+    }
+    n = _request(msg, COAP_METHOD_PUT, "echo", tok, sizeof(tok), body, sizeof(body));
+    size_t len = _frame(buf, COAP_WS_BINARY, false, msg, 100);
+    len += _frame(buf + len, COAP_WS_PING, true, (const uint8_t *)"hi", 2);
+    len += _frame(buf + len, COAP_WS_CONTINUATION, false, msg + 100, 500);
+    _send(c, buf, len);
+    _pump(5);
+    len = _frame(buf, COAP_WS_CONTINUATION, true, msg + 600, n - 600);
+    _send(c, buf, len);
+    CHECK(_next_frame(c, &f, rsp) && (f.opcode == COAP_WS_PONG) && (f.len == 2) &&
+          !memcmp(f.payload, "hi", 2));
+    CHECK(_next_message(c, &pkt, rsp));
+    CHECK((pkt.hdr.code == COAP_RSPCODE_CHANGED) && (pkt.payload.len == sizeof(body)) &&
+          !memcmp(pkt.payload.p, body, sizeof(body)));
+
+    // CoAP signaling ping
+    coap_packet_t ping;
+    memset(&ping, 0, sizeof(ping));
+    ping.hdr.ver = COAP_VERSION;
+    ping.hdr.code = COAP_SIGNAL_PING;
+    ping.hdr.tkl = 1;
+    ping.tok.p = tok;
+    ping.tok.len = 1;
+    n = sizeof(msg);
+    CHECK(coap_build_tcp(&ping, COAP_FRAMING_WS, msg, &n) == COAP_SUCCESS);
+    _send(c, buf, _frame(buf, COAP_WS_BINARY, true, msg, n));
+    CHECK(_next_message(c, &pkt, rsp) && (pkt.hdr.code == COAP_SIGNAL_PONG) &&
+          (pkt.tok.len == 1) && (pkt.tok.p[0] == tok[0]));
+
+    // CoAP goes in binary frames only
+    _send(c, buf, _frame(buf, COAP_WS_TEXT, true, (const uint8_t *)"hello", 5));
+    CHECK(_next_frame(c, &f, rsp) && (f.opcode == COAP_WS_CLOSE) && (f.len == 2) &&
+          (f.payload[0] << 8 | f.payload[1]) == 1003);
+    _close(c);
+
+    // rejected upgrades
+    CHECK(_connect(c));
+    const char *no_protocol = "GET /.well-known/coap HTTP/1.1\r\nUpgrade: websocket\r\n"
+                              "Connection: Upgrade\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+                              "Sec-WebSocket-Version: 13\r\n\r\n";
+    _send(c, no_protocol, strlen(no_protocol));
+    CHECK(_wait_for(c, "\r\n\r\n") && !strncmp((const char *)c->buf, "HTTP/1.1 400", 12));
+    _close(c);
+    CHECK(_connect(c));
+    const char *path = "GET /ws HTTP/1.1\r\nUpgrade: websocket\r\n\r\n";
+    _send(c, path, strlen(path));
+    CHECK(_wait_for(c, "\r\n\r\n") && !strncmp((const char *)c->buf, "HTTP/1.1 404", 12));
+    _close(c);
+
+    // unmasked client frames are a protocol error
+    CHECK(_handshake(c));
+    n = _request(msg, COAP_METHOD_GET, "hello", tok, sizeof(tok), NULL, 0);
+    len = coap_ws_frame_header(buf, COAP_WS_BINARY, n);
+    memcpy(buf + len, msg, n);
+    _send(c, buf, len + n);
+    CHECK(_next_frame(c, &f, rsp) && (f.opcode == COAP_WS_CLOSE) &&
+          (f.payload[0] << 8 | f.payload[1]) == 1002);
+    _close(c);
+}
+
+static void _test_concurrency(void)
+{
+    static const uint8_t tok[] = { 0x42 };
+    uint8_t buf[ROUNDS * 64], msg[64], rsp[2048];
+    coap_packet_t pkt;
+    size_t ok = 0;
+
+    for (size_t i = 0; i < CLIENTS; ++i) {
+        CHECK(_handshake(&clients[i]));
+    }
+    const uint32_t requests = ws.requests;
+    const uint32_t start = _now_ms();
+    const size_t n = _request(msg, COAP_METHOD_GET, "hello", tok, sizeof(tok), NULL, 0);
+    for (size_t i = 0; i < CLIENTS; ++i) {
+        size_t len = 0;
+        for (size_t r = 0; r < ROUNDS; ++r) {
+            len += _frame(buf + len, COAP_WS_BINARY, true, msg, n);
+        }
+        _send(&clients[i], buf, len);
+    }
+    for (size_t i = 0; i < CLIENTS; ++i) {
+        for (size_t r = 0; r < ROUNDS; ++r) {
+            ok += _next_message(&clients[i], &pkt, rsp) && (pkt.hdr.code == COAP_RSPCODE_CONTENT);
+        }
+    }
+    const uint32_t ms = _now_ms() - start;
+    CHECK(ok == CLIENTS * ROUNDS);
+    CHECK(ws.requests - requests == CLIENTS * ROUNDS);
+    for (size_t i = 0; i < CLIENTS; ++i) {
+        _close(&clients[i]);
+    }
+    printf("concurrency: %d connections, %zu requests in %u ms\n", CLIENTS, ok, ms);
+}
+
+/* --- MAIN ----------------------------------------------------------------- */
+int main(void)
+{
+    struct sockaddr_in addr = { .sin_family = AF_INET };
+    socklen_t len = sizeof(addr);
+
+    for (size_t i = 0; i < CLIENTS; ++i) {
+        clients[i].fd = -1;
+    }
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    const int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    if ((lfd < 0) || bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) ||
+        listen(lfd, CLIENTS) || getsockname(lfd, (struct sockaddr *)&addr, &len) ||
+        (coap_ws_init(&ws, lfd, resources, CLIENTS + 8) != COAP_SUCCESS)) {
+        perror("server");
+        return 1;
+    }
+    port = ntohs(addr.sin_port);
+
+    _test_codec();
+    _test_server();
+    _test_concurrency();
+
+    printf("server: %u connections, %u requests, %u signals, %u errors\n",
+           ws.connections, ws.requests, ws.signals, ws.errors);
+    coap_ws_free(&ws);
+    close(lfd);
+    printf("%s\n", failures ? "FAILED" : "PASSED");
+    return failures ? 1 : 0;
+}
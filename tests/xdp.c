@@ -0,0 +1,514 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <net/if.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/if_packet.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include "coap.h"
+#include "coap_xdp.h"
+
+/*
+ * Tests the AF_XDP server. First without the kernel: requests in IPv4 and
+ * IPv6 frames answered behind them, addresses and ports swapped, length
+ * and checksum fields checked, a 1000 byte payload echoed from the request
+ * into the response; frames for the UDP server refused: other ports, IP
+ * options, fragments, multicast, broadcast, lengths that do not add up,
+ * ARP; garbled CoAP and no room for the response; corrupted datagrams, a
+ * wrong UDP or IPv4 header checksum, and IPv6 without a UDP checksum.
+ *
+ * With two interfaces, ./xdp <served> <peer>, e.g. the ends of a veth pair
+ * set up by
+ *
+ *     ip link add vxdp0 type veth peer name vxdp1
+ *     ip link set vxdp0 up && ip link set vxdp1 up
+ *
+ * it also serves <served> for real, as root: frames written to <peer> with
+ * a packet socket come back answered, each of the frames refused is passed
+ * to the kernel by the program, garbled CoAP and a corrupted datagram dropped, and 10,000 requests in bursts of 64 are all answered and
+ * their frames recycled. Exits non-zero if any check fails.
+ */
+
+#define PORT            5683
+#define FRAME_SIZE      COAP_XDP_FRAME_SIZE
+#define LIVE_REQUESTS   10000
+#define LIVE_BURST      64
+
+static int failures;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+static const uint8_t mac_client[6] = { 0x02, 0, 0, 0, 0, 0x01 };
+static const uint8_t mac_server[6] = { 0x02, 0, 0, 0, 0, 0x02 };
+static const uint8_t ip4_client[4] = { 192, 0, 2, 1 };
+static const uint8_t ip4_server[4] = { 192, 0, 2, 2 };
+static const uint8_t ip6_client[16] = { 0x20, 0x01, 0x0d, 0xb8, [15] = 1 };
+static const uint8_t ip6_server[16] = { 0x20, 0x01, 0x0d, 0xb8, [15] = 2 };
+
+/* --- RESOURCES ------------------------------------------------------------ */
+static const coap_resource_path_t path_light = {1, {"light"}};
+static const coap_resource_path_t path_echo = {1, {"echo"}};
+
+static int handle_get_light(const coap_resource_t *resource, const coap_packet_t *inpkt,
+                            coap_packet_t *pkt)
+{
+    return coap_make_response(inpkt->hdr.id, &inpkt->tok, COAP_TYPE_ACK,
+                              COAP_RSPCODE_CONTENT, resource->content_type,
+                              (const uint8_t *)"on", 2, pkt);
+}
+
+/* the payload of the response points into the request */
+static int handle_post_echo(const coap_resource_t *resource, const coap_packet_t *inpkt,
+                            coap_packet_t *pkt)
+{
+    return coap_make_response(inpkt->hdr.id, &inpkt->tok, COAP_TYPE_ACK,
+                              COAP_RSPCODE_CHANGED, resource->content_type,
+                              inpkt->payload.p, inpkt->payload.len, pkt);
+}
+
+static coap_resource_t resources[] =
+{
+    {COAP_RDY, COAP_METHOD_GET, COAP_TYPE_ACK, handle_get_light, &path_light,
+        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_TXT_PLAIN), NULL},
+    {COAP_RDY, COAP_METHOD_POST, COAP_TYPE_ACK, handle_post_echo, &path_echo,
+        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_APP_OCTECT_STREAM), NULL},
+    {(coap_state_t)0, (coap_method_t)0, (coap_msgtype_t)0, NULL, NULL,
+        COAP_SET_CONTENTTYPE(COAP_CONTENTTYPE_NONE), NULL}
+};
+
+/* --- HELPERS -------------------------------------------------------------- */
+static uint16_t _get16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static void _put16(uint8_t *p, const uint16_t v)
+{
+    p[0] = (uint8_t)(v >> 8);
+    p[1] = (uint8_t)v;
+}
+
+/* the Internet checksum over the pieces, 0 if they include a correct one */
+static uint16_t _csum(const uint8_t *a, const size_t alen, const uint8_t *b, const size_t blen,
+                      const uint32_t extra)
+{
+    uint32_t sum = extra;
+    for (size_t i = 0; i < alen; i += 2) {
+        sum += (uint32_t)(a[i] << 8 | ((i + 1 < alen) ? a[i + 1] : 0));
+    }
+    for (size_t i = 0; i < blen; i += 2) {
+        sum += (uint32_t)(b[i] << 8 | ((i + 1 < blen) ? b[i + 1] : 0));
+    }
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return (uint16_t)~sum;
+}
+
+static size_t _coap(uint8_t *buf, const size_t size, const uint16_t id,
+                    const coap_method_t method, const char *res,
+                    const uint8_t *payload, const size_t len)
+{
+    static const uint8_t tok[] = { 0xca, 0xfe };
+    coap_packet_t pkt;
+    size_t buflen = size;
+
+    memset(&pkt, 0, sizeof(pkt));
+    pkt.hdr.ver = COAP_VERSION;
+    pkt.hdr.t = COAP_TYPE_CON;
+    pkt.hdr.code = method;
+    pkt.hdr.id = id;
+    pkt.hdr.tkl = sizeof(tok);
+    pkt.tok.p = tok;
+    pkt.tok.len = sizeof(tok);
+    coap_add_option(&pkt, COAP_OPTION_URI_PATH, (const uint8_t *)res, strlen(res));
+    pkt.payload.p = payload;
+    pkt.payload.len = len;
+    if (coap_build(&pkt, buf, &buflen) != COAP_SUCCESS) {
+        return 0;
+    }
+    return buflen;
+}
+
+/* a frame from the client to the server carrying \p coap, returns its length */
+static size_t _frame(uint8_t *frame, const bool v6, const uint16_t port,
+                     const uint8_t *coap, const size_t coaplen)
+{
+    const size_t udplen = 8 + coaplen;
+    uint8_t *ip = frame + 14;
+    uint8_t *udp;
+
+    memcpy(frame, mac_server, 6);
+    memcpy(frame + 6, mac_client, 6);
+    if (v6) {
+        _put16(frame + 12, 0x86dd);
+        memset(ip, 0, 40);
+        ip[0] = 0x60;
+        _put16(ip + 4, (uint16_t)udplen);
+        ip[6] = 17;
+        ip[7] = 64;
+        memcpy(ip + 8, ip6_client, 16);
+        memcpy(ip + 24, ip6_server, 16);
+        udp = ip + 40;
+    }
+    else {
+        _put16(frame + 12, 0x0800);
+        memset(ip, 0, 20);
+        ip[0] = 0x45;
+        _put16(ip + 2, (uint16_t)(20 + udplen));
+        ip[8] = 64;
+        ip[9] = 17;
+        memcpy(ip + 12, ip4_client, 4);
+        memcpy(ip + 16, ip4_server, 4);
+        _put16(ip + 10, _csum(ip, 20, NULL, 0, 0));
+        udp = ip + 20;
+    }
+    _put16(udp, 40000);
+    _put16(udp + 2, port);
+    _put16(udp + 4, (uint16_t)udplen);
+    _put16(udp + 6, 0);
+    memcpy(udp + 8, coap, coaplen);
+    const uint16_t csum = v6 ? _csum(ip + 8, 32, udp, udplen, 17 + (uint32_t)udplen)
+                             : _csum(ip + 12, 8, udp, udplen, 17 + (uint32_t)udplen);
+    _put16(udp + 6, csum ? csum : 0xffff);
+    return (size_t)(udp - frame) + udplen;
+}
+
+/*
+ * Frames for the kernel, not the server, one \p kind after the other;
+ * returns the length of the frame, 0 past the last kind.
+ */
+static size_t _refused(uint8_t *frame, const int kind, const uint8_t *coap, const size_t coaplen)
+{
+    const bool v6 = (kind >= 7) && (kind <= 11) && (kind != 10);
+    size_t len = _frame(frame, v6, PORT, coap, coaplen);
+
+    switch (kind) {
+    case 0:     // another port
+        return _frame(frame, false, PORT + 1, coap, coaplen);
+    case 1:     // IP options
+        frame[14] = 0x46;
+        break;
+    case 2:     // first and later fragments
+        frame[20] = 0x20;
+        break;
+    case 3:
+        frame[21] = 0x10;
+        break;
+    case 4:     // multicast, for the group server
+        frame[30] = 224;
+        break;
+    case 5:     // broadcast
+        memset(frame + 30, 0xff, 4);
+        break;
+    case 6:
+        memset(frame, 0xff, 6);
+        break;
+    case 7:
+        frame[38] = 0xff;
+        break;
+    case 8:     // extension header
+        frame[20] = 0;
+        break;
+    case 9:     // not IPv6 after all
+        frame[14] = 0x40;
+        break;
+    case 10:    // lengths past the frame and the datagram, UDP header cut
+        return len - 1;
+    case 11:
+        _put16(frame + 54 + 4, (uint16_t)(coaplen + 9));
+        break;
+    case 12:
+        _put16(frame + 34 + 4, 7);
+        break;
+    case 13:
+        _put16(frame + 34 + 4, (uint16_t)(coaplen + 9));
+        break;
+    case 14:    // ARP
+        _put16(frame + 12, 0x0806);
+        break;
+    default:
+        return 0;
+    }
+    return len;
+}
+
+/* a response frame to the client, its headers checked, its CoAP parsed */
+static bool _check_response(const uint8_t *out, const size_t len, const bool v6,
+                            coap_packet_t *pkt)
+{
+    const uint8_t *ip = out + 14;
+    const uint8_t *udp;
+    bool ok = (memcmp(out, mac_client, 6) == 0) && (memcmp(out + 6, mac_server, 6) == 0);
+
+    if (v6) {
+        udp = ip + 40;
+        ok = ok && (_get16(out + 12) == 0x86dd) && (ip[0] == 0x60) && (ip[6] == 17) &&
+             (_get16(ip + 4) == len - 54) &&
+             (memcmp(ip + 8, ip6_server, 16) == 0) && (memcmp(ip + 24, ip6_client, 16) == 0) &&
+             (_csum(ip + 8, 32, udp, len - 54, 17 + (uint32_t)(len - 54)) == 0);
+    }
+    else {
+        udp = ip + 20;
+        ok = ok && (_get16(out + 12) == 0x0800) && (ip[0] == 0x45) && (ip[9] == 17) &&
+             (_get16(ip + 2) == len - 14) && (_csum(ip, 20, NULL, 0, 0) == 0) &&
+             (memcmp(ip + 12, ip4_server, 4) == 0) && (memcmp(ip + 16, ip4_client, 4) == 0) &&
+             (_csum(ip + 12, 8, udp, len - 34, 17 + (uint32_t)(len - 34)) == 0);
+    }
+    const size_t udplen = len - (size_t)(udp - out);
+    ok = ok && (_get16(udp) == PORT) && (_get16(udp + 2) == 40000) &&
+         (_get16(udp + 4) == udplen) && (_get16(udp + 6) != 0);
+    return ok && (coap_parse(udp + 8, udplen - 8, pkt) == COAP_SUCCESS);
+}
+
+/* --- TESTS ---------------------------------------------------------------- */
+static void _test_respond(const bool v6)
+{
+    uint8_t frame[FRAME_SIZE], coap[1200], payload[1000];
+    coap_packet_t rsp;
+    size_t off, outlen;
+
+    size_t coaplen = _coap(coap, sizeof(coap), 0x1001, COAP_METHOD_GET, "light", NULL, 0);
+    size_t len = _frame(frame, v6, PORT, coap, coaplen);
+    CHECK(coap_xdp_respond(resources, PORT, frame, len, sizeof(frame), &off, &outlen) ==
+          COAP_RSP_SEND);
+    CHECK((off >= len) && (off % 8 == 0) && (off + outlen <= sizeof(frame)));
+    CHECK(_check_response(frame + off, outlen, v6, &rsp));
+    CHECK((rsp.hdr.id == 0x1001) && (rsp.hdr.code == COAP_RSPCODE_CONTENT));
+    CHECK((rsp.tok.len == 2) && (rsp.tok.p[0] == 0xca) && (rsp.tok.p[1] == 0xfe));
+    CHECK((rsp.payload.len == 2) && (memcmp(rsp.payload.p, "on", 2) == 0));
+
+    for (size_t i = 0; i < sizeof(payload); ++i) {
+        payload[i] = (uint8_t)(i * 7);
+    }
+    coaplen = _coap(coap, sizeof(coap), 0x1002, COAP_METHOD_POST, "echo",
+                    payload, sizeof(payload));
+    len = _frame(frame, v6, PORT, coap, coaplen);
+    CHECK(coap_xdp_respond(resources, PORT, frame, len, sizeof(frame), &off, &outlen) ==
+          COAP_RSP_SEND);
+    CHECK(_check_response(frame + off, outlen, v6, &rsp));
+    CHECK((rsp.hdr.code == COAP_RSPCODE_CHANGED) && (rsp.payload.len == sizeof(payload)) &&
+          (memcmp(rsp.payload.p, payload, sizeof(payload)) == 0));
+
+    // the request stayed in place
+    CHECK(_get16(frame + 12) == (v6 ? 0x86dd : 0x0800));
+    CHECK(memcmp(frame + len - sizeof(payload), payload, sizeof(payload)) == 0);
+
+    // no room behind it
+    CHECK(coap_xdp_respond(resources, PORT, frame, len, len + 40, &off, &outlen) ==
+          COAP_ERR_BUFFER_TOO_SMALL);
+}
+
+static void _test_refused(void)
+{
+    uint8_t frame[FRAME_SIZE], coap[64];
+    size_t len, off, outlen;
+
+    const size_t coaplen = _coap(coap, sizeof(coap), 0x2001, COAP_METHOD_GET, "light", NULL, 0);
+    for (int kind = 0; (len = _refused(frame, kind, coap, coaplen)); ++kind) {
+        CHECK(coap_xdp_respond(resources, PORT, frame, len, sizeof(frame), &off, &outlen) ==
+              COAP_ERR_UNSUPPORTED);
+    }
+    CHECK(coap_xdp_respond(resources, PORT, frame, 20, sizeof(frame), &off, &outlen) ==
+          COAP_ERR_UNSUPPORTED);
+
+    // don't fragment is fine
+    len = _frame(frame, false, PORT, coap, coaplen);
+    frame[20] = 0x40;
+    _put16(frame + 24, 0);
+    _put16(frame + 24, _csum(frame + 14, 20, NULL, 0, 0));
+    CHECK(coap_xdp_respond(resources, PORT, frame, len, sizeof(frame), &off, &outlen) ==
+          COAP_RSP_SEND);
+
+    // not CoAP
+    coap[0] = 0x80;
+    len = _frame(frame, false, PORT, coap, coaplen);
+    CHECK(coap_xdp_respond(resources, PORT, frame, len, sizeof(frame), &off, &outlen) ==
+          COAP_ERR_VERSION_NOT_1);
+}
+
+static void _test_corrupted(const bool v6)
+{
+    uint8_t frame[FRAME_SIZE], coap[64];
+    size_t off, outlen;
+
+    const size_t coaplen = _coap(coap, sizeof(coap), 0x3001, COAP_METHOD_GET, "light", NULL, 0);
+    const size_t len = _frame(frame, v6, PORT, coap, coaplen);
+    uint8_t *udp = frame + (v6 ? 54 : 34);
+
+    // a bit flipped in the CoAP message, still a valid one
+    udp[8 + 2] ^= 0x01;
+    CHECK(coap_xdp_respond(resources, PORT, frame, len, sizeof(frame), &off, &outlen) ==
+          COAP_ERR_PAYLOAD_INVALID);
+    udp[8 + 2] ^= 0x01;
+
+    // no checksum at all, fine for IPv4 only
+    const uint16_t check = _get16(udp + 6);
+    _put16(udp + 6, 0);
+    CHECK(coap_xdp_respond(resources, PORT, frame, len, sizeof(frame), &off, &outlen) ==
+          (v6 ? COAP_ERR_PAYLOAD_INVALID : COAP_RSP_SEND));
+    _put16(udp + 6, check);
+    if (v6) {
+        return;
+    }
+
+    // the IPv4 header checksum
+    frame[14 + 8]--;
+    CHECK(coap_xdp_respond(resources, PORT, frame, len, sizeof(frame), &off, &outlen) ==
+          COAP_ERR_PAYLOAD_INVALID);
+}
+
+/* the responses waiting on the packet socket, outgoing frames skipped */
+static size_t _live_receive(const int pfd, coap_xdp_t *xdp, uint32_t *seen, const size_t want)
+{
+    uint8_t buf[2048];
+    coap_packet_t rsp;
+    size_t got = 0;
+
+    for (int idle = 0; (got < want) && (idle < 100); ) {
+        struct sockaddr_ll sll;
+        socklen_t slen = sizeof(sll);
+
+        coap_xdp_process(xdp);
+        const ssize_t n = recvfrom(pfd, buf, sizeof(buf), MSG_DONTWAIT,
+                                   (struct sockaddr *)&sll, &slen);
+        if (n < 0) {
+            struct pollfd p = { xdp->fd, POLLIN, 0 };
+            idle += (poll(&p, 1, 10) == 0);
+            continue;
+        }
+        if ((sll.sll_pkttype == PACKET_OUTGOING) || (memcmp(buf, mac_client, 6) != 0)) {
+            continue;
+        }
+        const bool v6 = _get16(buf + 12) == 0x86dd;
+        if (_check_response(buf, (size_t)n, v6, &rsp) &&
+            (rsp.hdr.code == COAP_RSPCODE_CONTENT) && (rsp.hdr.id < LIVE_REQUESTS)) {
+            seen[rsp.hdr.id]++;
+            got++;
+        }
+    }
+    return got;
+}
+
+/* frames sent a moment ago are through the program and the server */
+static void _live_settle(coap_xdp_t *xdp)
+{
+    for (int i = 0; i < 10; ++i) {
+        usleep(2000);
+        coap_xdp_process(xdp);
+    }
+}
+
+static void _test_live(const char *served, const char *peer)
+{
+    static uint32_t seen[LIVE_REQUESTS];
+    uint8_t frame[256], coap[64];
+    coap_xdp_t xdp;
+    size_t len;
+
+    const unsigned ifindex = if_nametoindex(served);
+    const unsigned peerindex = if_nametoindex(peer);
+    CHECK(ifindex && peerindex);
+    if (coap_xdp_init(&xdp, ifindex, 0, PORT, resources) != COAP_SUCCESS) {
+        fprintf(stderr, "no AF_XDP on %s: %s\n", served, strerror(errno));
+        failures++;
+        return;
+    }
+    const int pfd = socket(AF_PACKET, SOCK_RAW, htons(0x0003));    // ETH_P_ALL
+    struct sockaddr_ll sll = { .sll_family = AF_PACKET, .sll_protocol = htons(0x0003),
+                               .sll_ifindex = (int)peerindex };
+    CHECK((pfd >= 0) && (bind(pfd, (struct sockaddr *)&sll, sizeof(sll)) == 0));
+
+    // one request of each family
+    for (int v6 = 0; v6 < 2; ++v6) {
+        const size_t coaplen = _coap(coap, sizeof(coap), (uint16_t)v6, COAP_METHOD_GET,
+                                     "light", NULL, 0);
+        len = _frame(frame, v6, PORT, coap, coaplen);
+        CHECK(send(pfd, frame, len, 0) == (ssize_t)len);
+    }
+    CHECK(_live_receive(pfd, &xdp, seen, 2) == 2);
+    CHECK((seen[0] == 1) && (seen[1] == 1));
+
+    // what the server refuses the program passes to the kernel
+    const uint32_t requests = xdp.requests;
+    const size_t coaplen = _coap(coap, sizeof(coap), 2, COAP_METHOD_GET, "light", NULL, 0);
+    for (int kind = 0; (len = _refused(frame, kind, coap, coaplen)); ++kind) {
+        CHECK(send(pfd, frame, len, 0) == (ssize_t)len);
+    }
+    _live_settle(&xdp);
+    CHECK((xdp.requests == requests) && !xdp.dropped && !xdp.unserved);
+
+    // garbled CoAP is the server's, dropped as the UDP server would
+    coap[0] = 0x80;
+    len = _frame(frame, false, PORT, coap, coaplen);
+    CHECK(send(pfd, frame, len, 0) == (ssize_t)len);
+    _live_settle(&xdp);
+    CHECK((xdp.requests == requests) && (xdp.dropped == 1) && !xdp.unserved);
+
+    // and so is a corrupted datagram, as the kernel would
+    _coap(coap, sizeof(coap), 2, COAP_METHOD_GET, "light", NULL, 0);
+    len = _frame(frame, false, PORT, coap, coaplen);
+    frame[len - 1] ^= 0x01;
+    CHECK(send(pfd, frame, len, 0) == (ssize_t)len);
+    _live_settle(&xdp);
+    CHECK((xdp.requests == requests) && (xdp.dropped == 2) && !xdp.unserved);
+
+    // bursts
+    memset(seen, 0, sizeof(seen));
+    size_t got = 0;
+    for (uint16_t id = 0; id < LIVE_REQUESTS; ) {
+        size_t sent = 0;
+        for (; (sent < LIVE_BURST) && (id < LIVE_REQUESTS); ++sent, ++id) {
+            const size_t coaplen = _coap(coap, sizeof(coap), id, COAP_METHOD_GET,
+                                         "light", NULL, 0);
+            len = _frame(frame, id & 1, PORT, coap, coaplen);
+            if (send(pfd, frame, len, 0) != (ssize_t)len) {
+                break;
+            }
+        }
+        got += _live_receive(pfd, &xdp, seen, sent);
+    }
+    CHECK(got == LIVE_REQUESTS);
+    size_t once = 0;
+    for (size_t i = 0; i < LIVE_REQUESTS; ++i) {
+        once += seen[i] == 1;
+    }
+    CHECK(once == LIVE_REQUESTS);
+    coap_xdp_process(&xdp);
+    CHECK(xdp.requests == LIVE_REQUESTS + 2);
+    CHECK(xdp.responses == xdp.requests);
+    CHECK((xdp.dropped == 2) && !xdp.unserved);
+
+    close(pfd);
+    coap_xdp_free(&xdp);
+}
+
+/* --- MAIN ----------------------------------------------------------------- */
+int main(int argc, char *argv[])
+{
+    _test_respond(false);
+    _test_respond(true);
+    _test_refused();
+    _test_corrupted(false);
+    _test_corrupted(true);
+    if (argc == 3) {
+        _test_live(argv[1], argv[2]);
+    }
+    else {
+        printf("live test skipped, run ./xdp <served> <peer> as root\n");
+    }
+
+    printf("%s\n", failures ? "FAILED" : "PASSED");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,129 @@
+#!/usr/bin/env python3
+"""
+Compare benchmark samples against a stored baseline.
+
+Both files are the JSON written by the benchmarks with -j, i.e.
+{"unit": "ns/op", "metrics": {"name": [sample, ...], ...}}. A metric
+regresses if its samples are significantly slower than the baseline ones
+(one sided Mann-Whitney U test, p < alpha) and the median grew by more than
+the threshold and by at least --min-delta ns, which keeps timer noise on
+metrics of a few ns out. Current samples are scaled by the speed ratio of
+the fixed reference loop the benchmarks run before each metric, which takes
+out clock and host load differences between the two runs. Exits 1 if any tracked metric regressed.
+
+USAGE: perf_check.py [--threshold PCT] [--alpha P] [--min-delta NS]
+                     baseline.json current.json...
+"""
+
+import argparse
+import json
+import math
+import statistics
+import sys
+
+
+def mann_whitney_greater(x, y):
+    """p-value of H1: samples x tend to be greater than samples y.
+
+    Normal approximation with tie correction, good enough for the 10+
+    samples per metric the benchmarks take by default.
+    """
+    n1, n2 = len(x), len(y)
+    ranked = sorted([(v, 0) for v in x] + [(v, 1) for v in y])
+    ranks = [0.0] * len(ranked)
+    ties = 0.0
+    i = 0
+    while i < len(ranked):
+        j = i
+        while j + 1 < len(ranked) and ranked[j + 1][0] == ranked[i][0]:
+            j += 1
+        for k in range(i, j + 1):
+            ranks[k] = (i + j) / 2.0 + 1
+        t = j - i + 1
+        ties += t ** 3 - t
+        i = j + 1
+    r1 = sum(r for r, (_, grp) in zip(ranks, ranked) if grp == 0)
+    u1 = r1 - n1 * (n1 + 1) / 2.0
+    n = n1 + n2
+    var = n1 * n2 / 12.0 * ((n + 1) - ties / (n * (n - 1)))
+    if var <= 0:
+        return 1.0
+    z = (u1 - n1 * n2 / 2.0 - 0.5) / math.sqrt(var)
+    return 0.5 * math.erfc(z / math.sqrt(2))
+
+
+def load(files):
+    metrics, reference = {}, []
+    for name in files:
+        with open(name) as f:
+            data = json.load(f)
+        reference.extend(data.get("reference", []))
+        for key, samples in data["metrics"].items():
+            metrics.setdefault(key, []).extend(samples)
+    return metrics, reference
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    ap.add_argument("--threshold", type=float, default=10.0,
+                    help="allowed median slowdown in percent (default 10)")
+    ap.add_argument("--alpha", type=float, default=0.01,
+                    help="significance level (default 0.01)")
+    ap.add_argument("--min-delta", type=float, default=1.0,
+                    help="ignore median slowdowns below this many ns (default 1)")
+    ap.add_argument("--no-normalize", action="store_true",
+                    help="do not scale by the reference loop speed")
+    ap.add_argument("baseline")
+    ap.add_argument("current", nargs="+")
+    args = ap.parse_args()
+
+    base, base_ref = load([args.baseline])
+    cur, cur_ref = load(args.current)
+    # scale current samples by the speed of the reference loop on both runs
+    scale = 1.0
+    if base_ref and cur_ref and not args.no_normalize:
+        scale = statistics.median(base_ref) / statistics.median(cur_ref)
+        cur = {k: [v * scale for v in s] for k, s in cur.items()}
+    regressions = 0
+    rows = []
+    for key in sorted(set(base) | set(cur)):
+        if key not in cur:
+            rows.append((key, statistics.median(base[key]), None, None, None, "MISSING"))
+            regressions += 1
+            continue
+        if key not in base:
+            rows.append((key, None, statistics.median(cur[key]), None, None, "new"))
+            continue
+        b, c = statistics.median(base[key]), statistics.median(cur[key])
+        delta = (c - b) / b * 100.0 if b > 0 else 0.0
+        p = mann_whitney_greater(cur[key], base[key])
+        status = "ok"
+        if p < args.alpha and delta > args.threshold and c - b >= args.min_delta:
+            status = "REGRESSION"
+            regressions += 1
+        elif mann_whitney_greater(base[key], cur[key]) < args.alpha and \
+                delta < -args.threshold:
+            status = "faster"
+        rows.append((key, b, c, delta, p, status))
+
+    if scale != 1.0:
+        print("current samples scaled by %.3f (reference loop)\n" % scale)
+    fmt = "{:<40} {:>10} {:>10} {:>8} {:>8}  {}"
+    print(fmt.format("metric (median ns/op)", "baseline", "current", "delta", "p", ""))
+    for key, b, c, delta, p, status in rows:
+        print(fmt.format(key,
+                         "-" if b is None else "%.1f" % b,
+                         "-" if c is None else "%.1f" % c,
+                         "-" if delta is None else "%+.1f%%" % delta,
+                         "-" if p is None else "%.3f" % p,
+                         status))
+    if regressions:
+        print("\n%d metric(s) regressed by more than %.0f%% (p < %g)"
+              % (regressions, args.threshold, args.alpha))
+        return 1
+    print("\nno regressions")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())